@@ -92,27 +92,43 @@ bupsplit_sum(uint8_t *buf, size_t ofs, size_t len)
 }
 
 
+// This is rollsum_roll() with the circular window buffer eliminated:
+// for the first BUP_WINDOWSIZE bytes the dropped byte is the initial
+// zero fill, and past that point the byte rolling out of the window is
+// simply buf[count - BUP_WINDOWSIZE].  That removes a store and the
+// offset modulo from the per-byte loop, which dominates delta
+// similarity analysis on large payloads.
 int bupsplit_find_ofs(const unsigned char *buf, int len, int *bits)
 {
-    Rollsum r;
+    unsigned s1 = BUP_WINDOWSIZE * ROLLSUM_CHAR_OFFSET;
+    unsigned s2 = BUP_WINDOWSIZE * (BUP_WINDOWSIZE-1) * ROLLSUM_CHAR_OFFSET;
+    const int prefix = (len < BUP_WINDOWSIZE) ? len : BUP_WINDOWSIZE;
     int count;
-    
-    rollsum_init(&r);
-    for (count = 0; count < len; count++)
+
+    for (count = 0; count < prefix; count++)
     {
-	rollsum_roll(&r, buf[count]);
-	if ((r.s2 & (BUP_BLOBSIZE-1)) == ((~0) & (BUP_BLOBSIZE-1)))
-	{
-	    if (bits)
-	    {
-		unsigned rsum = rollsum_digest(&r);
-		*bits = BUP_BLOBBITS;
-		rsum >>= BUP_BLOBBITS;
-		for (*bits = BUP_BLOBBITS; (rsum >>= 1) & 1; (*bits)++)
-		    ;
-	    }
-	    return count+1;
-	}
+	s1 += buf[count];
+	s2 += s1 - (BUP_WINDOWSIZE * ROLLSUM_CHAR_OFFSET);
+	if ((s2 & (BUP_BLOBSIZE-1)) == ((~0) & (BUP_BLOBSIZE-1)))
+	    goto found;
+    }
+    for (; count < len; count++)
+    {
+	const uint8_t drop = buf[count - BUP_WINDOWSIZE];
+	s1 += buf[count] - drop;
+	s2 += s1 - (BUP_WINDOWSIZE * (drop + ROLLSUM_CHAR_OFFSET));
+	if ((s2 & (BUP_BLOBSIZE-1)) == ((~0) & (BUP_BLOBSIZE-1)))
+	    goto found;
     }
     return 0;
+
+found:
+    if (bits)
+    {
+	unsigned rsum = (s1 << 16) | (s2 & 0xffff);
+	rsum >>= BUP_BLOBBITS;
+	for (*bits = BUP_BLOBBITS; (rsum >>= 1) & 1; (*bits)++)
+	    ;
+    }
+    return count+1;
 }
@@ -343,11 +343,59 @@ ostree_async_progress_set (OstreeAsyncProgress *self,
       g_autoptr(GVariant) new_value = NULL;
       gpointer qkey = GUINT_TO_POINTER (g_quark_from_string (key));
 
-      new_value = g_variant_ref_sink (g_variant_new_va (format_string, NULL, &ap));
+      orig_value = g_hash_table_lookup (self->values, qkey);
+
+      /* Fast path for scalar counters and strings, which is almost every
+       * key the pull code reports on its periodic tick: compare the raw
+       * argument against the stored value first, so the (common) case of
+       * an unchanged value does no GVariant allocation at all.
+       */
+      if (format_string[0] != '\0' && format_string[1] == '\0')
+        {
+          switch (format_string[0])
+            {
+            case 'u':
+              {
+                guint32 v = va_arg (ap, guint32);
+                if (orig_value != NULL &&
+                    g_variant_is_of_type (orig_value, G_VARIANT_TYPE_UINT32) &&
+                    g_variant_get_uint32 (orig_value) == v)
+                  continue;
+                new_value = g_variant_ref_sink (g_variant_new_uint32 (v));
+                break;
+              }
+            case 't':
+              {
+                guint64 v = va_arg (ap, guint64);
+                if (orig_value != NULL &&
+                    g_variant_is_of_type (orig_value, G_VARIANT_TYPE_UINT64) &&
+                    g_variant_get_uint64 (orig_value) == v)
+                  continue;
+                new_value = g_variant_ref_sink (g_variant_new_uint64 (v));
+                break;
+              }
+            case 's':
+              {
+                const char *v = va_arg (ap, const char *);
+                if (orig_value != NULL &&
+                    g_variant_is_of_type (orig_value, G_VARIANT_TYPE_STRING) &&
+                    g_strcmp0 (g_variant_get_string (orig_value, NULL), v) == 0)
+                  continue;
+                new_value = g_variant_ref_sink (g_variant_new_string (v));
+                break;
+              }
+            default:
+              break;
+            }
+        }
 
-      if (g_hash_table_lookup_extended (self->values, qkey, NULL, (gpointer *) &orig_value) &&
-          g_variant_equal (orig_value, new_value))
-        continue;
+      if (new_value == NULL)
+        {
+          new_value = g_variant_ref_sink (g_variant_new_va (format_string, NULL, &ap));
+
+          if (orig_value != NULL && g_variant_equal (orig_value, new_value))
+            continue;
+        }
 
       g_hash_table_replace (self->values, qkey, g_steal_pointer (&new_value));
       changed = TRUE;
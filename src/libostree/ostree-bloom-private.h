@@ -72,6 +72,26 @@ OstreeBloom *ostree_bloom_new_from_bytes (GBytes              *bytes,
                                           guint8               k,
                                           OstreeBloomHashFunc  hash_func);
 
+/**
+ * OSTREE_BLOOM_BLOCK_SIZE:
+ *
+ * Block size of the blocked bloom filter layout, in bytes; chosen to
+ * match a cache line.
+ *
+ * Since: 2017.10
+ */
+#define OSTREE_BLOOM_BLOCK_SIZE 64
+
+G_GNUC_INTERNAL
+OstreeBloom *ostree_bloom_new_blocked (gsize               n_bytes,
+                                       guint8              k,
+                                       OstreeBloomHashFunc hash_func);
+
+G_GNUC_INTERNAL
+OstreeBloom *ostree_bloom_new_from_bytes_blocked (GBytes              *bytes,
+                                                  guint8               k,
+                                                  OstreeBloomHashFunc  hash_func);
+
 G_GNUC_INTERNAL
 OstreeBloom *ostree_bloom_ref (OstreeBloom *bloom);
 G_GNUC_INTERNAL
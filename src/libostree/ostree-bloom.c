@@ -86,6 +86,7 @@ struct _OstreeBloom
     };
   guint8 k;
   OstreeBloomHashFunc hash_func;
+  gboolean is_blocked;  /* all k probes land in one OSTREE_BLOOM_BLOCK_SIZE block */
 };
 
 G_DEFINE_BOXED_TYPE (OstreeBloom, ostree_bloom, ostree_bloom_ref, ostree_bloom_unref)
@@ -133,6 +134,45 @@ ostree_bloom_new (gsize               n_bytes,
   return g_steal_pointer (&bloom);
 }
 
+/**
+ * ostree_bloom_new_blocked:
+ * @n_bytes: size to make the bloom filter, in bytes; must be a positive
+ *    multiple of %OSTREE_BLOOM_BLOCK_SIZE
+ * @k: number of probe bits to set per element
+ * @hash_func: universal hash function to use
+ *
+ * Like ostree_bloom_new(), but using the blocked layout: for each element,
+ * the hash with parameter 0 selects one %OSTREE_BLOOM_BLOCK_SIZE byte block
+ * of the filter, and all @k probe bits are derived from the hashes with
+ * parameters 0 and 1 within that single block.  Lookups then touch exactly
+ * one cache line and compute at most two hashes, rather than @k of each as
+ * in the classic layout, at the cost of a slightly higher false positive
+ * rate for the same size.
+ *
+ * The serialized form is not interchangeable with the classic layout; the
+ * caller must record which layout was used alongside the `k`/hash metadata.
+ *
+ * Returns: (transfer full): a new mutable blocked bloom filter
+ *
+ * Since: 2017.10
+ */
+OstreeBloom *
+ostree_bloom_new_blocked (gsize               n_bytes,
+                          guint8              k,
+                          OstreeBloomHashFunc hash_func)
+{
+  OstreeBloom *bloom;
+
+  g_return_val_if_fail (n_bytes > 0, NULL);
+  g_return_val_if_fail (n_bytes % OSTREE_BLOOM_BLOCK_SIZE == 0, NULL);
+
+  bloom = ostree_bloom_new (n_bytes, k, hash_func);
+  if (bloom != NULL)
+    bloom->is_blocked = TRUE;
+
+  return bloom;
+}
+
 /**
  * ostree_bloom_new_from_bytes:
  * @bytes: array of bytes containing the filter data
@@ -175,6 +215,42 @@ ostree_bloom_new_from_bytes (GBytes              *bytes,
   return g_steal_pointer (&bloom);
 }
 
+/**
+ * ostree_bloom_new_from_bytes_blocked:
+ * @bytes: array of bytes containing the filter data; its size must be a
+ *    positive multiple of %OSTREE_BLOOM_BLOCK_SIZE
+ * @k: number of probe bits per element
+ * @hash_func: universal hash function to use
+ *
+ * Like ostree_bloom_new_from_bytes(), but interpreting @bytes using the
+ * blocked layout described for ostree_bloom_new_blocked().  @bytes must
+ * have been produced by a blocked filter with the same @k and @hash_func.
+ *
+ * Returns: (transfer full) (nullable): a new immutable blocked bloom
+ *    filter, or %NULL if the size of @bytes is not a block multiple
+ *
+ * Since: 2017.10
+ */
+OstreeBloom *
+ostree_bloom_new_from_bytes_blocked (GBytes              *bytes,
+                                     guint8               k,
+                                     OstreeBloomHashFunc  hash_func)
+{
+  OstreeBloom *bloom;
+
+  g_return_val_if_fail (bytes != NULL, NULL);
+
+  if (g_bytes_get_size (bytes) == 0 ||
+      g_bytes_get_size (bytes) % OSTREE_BLOOM_BLOCK_SIZE != 0)
+    return NULL;
+
+  bloom = ostree_bloom_new_from_bytes (bytes, k, hash_func);
+  if (bloom != NULL)
+    bloom->is_blocked = TRUE;
+
+  return bloom;
+}
+
 /**
  * ostree_bloom_ref:
  * @bloom: an #OstreeBloom
@@ -250,6 +326,25 @@ ostree_bloom_set_bit (OstreeBloom *bloom,
   bloom->mutable_bytes[idx / 8] |= (1 << (idx % 8));
 }
 
+/* Absolute bit index of probe @i for an element in a blocked filter, given
+ * the element's two base hashes @h1 and @h2.  @h1 selects the block; the
+ * probes are derived by double hashing (Kirsch–Mitzenmacher), so only two
+ * hash computations are needed however large k is, and every probe falls
+ * within the one cache-line-sized block.
+ */
+static inline gsize
+ostree_bloom_blocked_idx (OstreeBloom *bloom,
+                          guint64      h1,
+                          guint64      h2,
+                          guint8       i)
+{
+  const gsize n_blocks = bloom->n_bytes / OSTREE_BLOOM_BLOCK_SIZE;
+  const gsize block = (gsize) (h1 % n_blocks);
+  const gsize bit = (gsize) ((h1 + ((guint64) i + 1) * h2) % (OSTREE_BLOOM_BLOCK_SIZE * 8));
+
+  return block * OSTREE_BLOOM_BLOCK_SIZE * 8 + bit;
+}
+
 /**
  * ostree_bloom_maybe_contains:
  * @bloom: an #OstreeBloom
@@ -272,6 +367,20 @@ ostree_bloom_maybe_contains (OstreeBloom   *bloom,
   g_return_val_if_fail (bloom != NULL, TRUE);
   g_return_val_if_fail (bloom->ref_count >= 1, TRUE);
 
+  if (bloom->is_blocked)
+    {
+      const guint64 h1 = bloom->hash_func (element, 0);
+      const guint64 h2 = bloom->hash_func (element, 1);
+
+      for (i = 0; i < bloom->k; i++)
+        {
+          if (!ostree_bloom_get_bit (bloom, ostree_bloom_blocked_idx (bloom, h1, h2, i)))
+            return FALSE;  /* definitely not in the set */
+        }
+
+      return TRUE;  /* possibly in the set */
+    }
+
   for (i = 0; i < bloom->k; i++)
     {
       gsize idx;
@@ -336,6 +445,17 @@ ostree_bloom_add_element (OstreeBloom   *bloom,
   g_return_if_fail (bloom->ref_count >= 1);
   g_return_if_fail (bloom->is_mutable);
 
+  if (bloom->is_blocked)
+    {
+      const guint64 h1 = bloom->hash_func (element, 0);
+      const guint64 h2 = bloom->hash_func (element, 1);
+
+      for (i = 0; i < bloom->k; i++)
+        ostree_bloom_set_bit (bloom, ostree_bloom_blocked_idx (bloom, h1, h2, i));
+
+      return;
+    }
+
   for (i = 0; i < bloom->k; i++)
     {
       gsize idx = bloom->hash_func (element, i);
@@ -21,6 +21,7 @@
 #include "config.h"
 
 #include "ostree-bootconfig-parser.h"
+#include "ostree-bootconfig-parser-private.h"
 #include "otutil.h"
 
 struct _OstreeBootconfigParser
@@ -205,6 +206,52 @@ ostree_bootconfig_parser_write (OstreeBootconfigParser   *self,
                                             cancellable, error);
 }
 
+/* Serialize the parsed state (raw lines plus any key overrides) as a
+ * `(a(ss)a{ss})` variant; used by the sysroot state cache.
+ */
+GVariant *
+_ostree_bootconfig_parser_serialize (OstreeBootconfigParser *self)
+{
+  GVariantBuilder lines_builder;
+  g_variant_builder_init (&lines_builder, G_VARIANT_TYPE ("a(ss)"));
+  for (guint i = 0; i < self->lines->len; i++)
+    g_variant_builder_add_value (&lines_builder, self->lines->pdata[i]);
+
+  GVariantBuilder options_builder;
+  g_variant_builder_init (&options_builder, G_VARIANT_TYPE ("a{ss}"));
+  GLNX_HASH_TABLE_FOREACH_KV (self->options, const char*, k, const char*, v)
+    g_variant_builder_add (&options_builder, "{ss}", k, v);
+
+  return g_variant_ref_sink (g_variant_new ("(a(ss)a{ss})",
+                                            &lines_builder, &options_builder));
+}
+
+/* Inverse of _ostree_bootconfig_parser_serialize(); the returned parser
+ * behaves as if it had been initialized via parse().
+ */
+OstreeBootconfigParser *
+_ostree_bootconfig_parser_new_from_variant (GVariant *variant)
+{
+  OstreeBootconfigParser *self = ostree_bootconfig_parser_new ();
+
+  g_autoptr(GVariant) lines = g_variant_get_child_value (variant, 0);
+  const gsize n_lines = g_variant_n_children (lines);
+  for (gsize i = 0; i < n_lines; i++)
+    g_ptr_array_add (self->lines, g_variant_get_child_value (lines, i));
+
+  g_autoptr(GVariant) options = g_variant_get_child_value (variant, 1);
+  GVariantIter iter;
+  const char *k;
+  const char *v;
+  g_variant_iter_init (&iter, options);
+  while (g_variant_iter_loop (&iter, "{&s&s}", &k, &v))
+    g_hash_table_replace (self->options, g_strdup (k), g_strdup (v));
+
+  self->parsed = TRUE;
+
+  return self;
+}
+
 static void
 ostree_bootconfig_parser_finalize (GObject *object)
 {
@@ -321,6 +321,83 @@ grub2_child_setup (gpointer user_data)
     }
 }
 
+#define GRUB2_ENTRIES_DIGEST_COMMENT "# ostree-grub2-entries-digest: "
+
+static gint
+compare_entry_names (gconstpointer ap,
+                     gconstpointer bp)
+{
+  return strcmp (*((const char *const*)ap), *((const char *const*)bp));
+}
+
+/* Compute a SHA256 over the set of loader entries for @bootversion
+ * (file names and contents, in sorted order).  For a given OS root the
+ * generated grub.cfg is a function of this set, so an unchanged digest
+ * lets us skip the grub2-mkconfig subprocess and reuse the previous
+ * configuration.
+ */
+static gboolean
+grub2_compute_entries_digest (OstreeSysroot  *sysroot,
+                              int             bootversion,
+                              char          **out_digest,
+                              GCancellable   *cancellable,
+                              GError        **error)
+{
+  g_autoptr(GChecksum) checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  g_autofree char *entries_path = g_strdup_printf ("boot/loader.%d/entries", bootversion);
+  g_autoptr(GPtrArray) names = g_ptr_array_new_with_free_func (g_free);
+
+  gboolean exists;
+  g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
+  if (!ot_dfd_iter_init_allow_noent (sysroot->sysroot_fd, entries_path,
+                                     &dfd_iter, &exists, error))
+    return FALSE;
+
+  if (exists)
+    {
+      while (TRUE)
+        {
+          struct dirent *dent;
+
+          if (!glnx_dirfd_iterator_next_dent (&dfd_iter, &dent, cancellable, error))
+            return FALSE;
+          if (dent == NULL)
+            break;
+
+          if (g_str_has_prefix (dent->d_name, "ostree-") &&
+              g_str_has_suffix (dent->d_name, ".conf"))
+            g_ptr_array_add (names, g_strdup (dent->d_name));
+        }
+      g_ptr_array_sort (names, compare_entry_names);
+
+      for (guint i = 0; i < names->len; i++)
+        {
+          const char *name = names->pdata[i];
+          gsize len;
+          g_autofree char *contents =
+            glnx_file_get_contents_utf8_at (dfd_iter.fd, name, &len, cancellable, error);
+          if (contents == NULL)
+            return FALSE;
+          g_checksum_update (checksum, (const guchar*)name, strlen (name) + 1);
+          g_checksum_update (checksum, (const guchar*)contents, len);
+        }
+    }
+
+  *out_digest = g_strdup (g_checksum_get_string (checksum));
+  return TRUE;
+}
+
+static gboolean
+grub2_config_digest_matches (const char *contents,
+                             const char *digest)
+{
+  const char *found = contents ? strstr (contents, GRUB2_ENTRIES_DIGEST_COMMENT) : NULL;
+  if (found == NULL)
+    return FALSE;
+  found += strlen (GRUB2_ENTRIES_DIGEST_COMMENT);
+  return strncmp (found, digest, strlen (digest)) == 0;
+}
+
 static gboolean
 _ostree_bootloader_grub2_write_config (OstreeBootloader      *bootloader,
                                        int                    bootversion,
@@ -338,6 +415,7 @@ _ostree_bootloader_grub2_write_config (OstreeBootloader      *bootloader,
   const char *grub_argv[4] = { NULL, "-o", NULL, NULL};
   GSpawnFlags grub_spawnflags = G_SPAWN_SEARCH_PATH;
   int grub2_estatus;
+  g_autofree char *entries_digest = NULL;
   Grub2ChildSetupData cdata = { NULL, };
 
 #ifdef USE_BUILTIN_GRUB2_MKCONFIG
@@ -395,6 +473,46 @@ _ostree_bootloader_grub2_write_config (OstreeBootloader      *bootloader,
                                                       bootversion);
     }
 
+  /* If the entry set is unchanged from the previous configuration,
+   * reuse that configuration rather than re-running the generator,
+   * which can take many seconds on appliance hardware.  Any change to
+   * the deployment list changes the entries (and hence the digest), so
+   * stale reuse requires a no-op redeploy.
+   */
+  if (!grub2_compute_entries_digest (self->sysroot, bootversion, &entries_digest,
+                                     cancellable, error))
+    goto out;
+
+  {
+    g_autoptr(GFile) prev_config_path = NULL;
+    if (self->is_efi)
+      prev_config_path = g_object_ref (self->config_path_efi);
+    else
+      prev_config_path = ot_gfile_resolve_path_printf (self->sysroot->path, "boot/loader.%d/grub.cfg",
+                                                       bootversion == 0 ? 1 : 0);
+
+    g_autofree char *prev_contents = NULL;
+    gsize prev_len;
+    if (g_file_load_contents (prev_config_path, cancellable, &prev_contents, &prev_len, NULL, NULL)
+        && grub2_config_digest_matches (prev_contents, entries_digest))
+      {
+        if (!self->is_efi)
+          {
+            /* Don't fsync; the deployment core does a syncfs() on /boot
+             * before swapping the bootversion.
+             */
+            if (!glnx_file_replace_contents_at (AT_FDCWD, gs_file_get_path_cached (new_config_path),
+                                                (guint8*)prev_contents, prev_len,
+                                                GLNX_FILE_REPLACE_NODATASYNC,
+                                                cancellable, error))
+              goto out;
+          }
+        /* For EFI, the live config is already the one we want */
+        ret = TRUE;
+        goto out;
+      }
+  }
+
   grub_argv[0] = grub_exec;
   grub_argv[2] = gs_file_get_path_cached (new_config_path);
 
@@ -421,18 +539,42 @@ _ostree_bootloader_grub2_write_config (OstreeBootloader      *bootloader,
       goto out;
     }
 
-  /* Now let's fdatasync() for the new file */
-  { glnx_fd_close int new_config_fd = -1;
-    if (!glnx_openat_rdonly (AT_FDCWD, gs_file_get_path_cached (new_config_path), TRUE, &new_config_fd, error))
-      goto out;
-
-    if (fdatasync (new_config_fd) < 0)
+  /* Record the digest so the next deployment can detect an unchanged
+   * entry set; GRUB ignores comment lines.
+   */
+  { g_autofree char *digest_comment =
+      g_strdup_printf ("%s%s\n", GRUB2_ENTRIES_DIGEST_COMMENT, entries_digest);
+    glnx_fd_close int append_fd = openat (AT_FDCWD, gs_file_get_path_cached (new_config_path),
+                                          O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (append_fd < 0)
       {
-        (void)glnx_throw_errno_prefix (error, "fdatasync");
+        (void)glnx_throw_errno_prefix (error, "openat(%s)", gs_file_get_path_cached (new_config_path));
+        goto out;
+      }
+    if (glnx_loop_write (append_fd, digest_comment, strlen (digest_comment)) < 0)
+      {
+        (void)glnx_throw_errno_prefix (error, "write");
         goto out;
       }
   }
 
+  /* For EFI, fdatasync() the new file before we rename it into place
+   * below; the ESP is a separate filesystem which isn't covered by the
+   * deployment core's syncfs() barrier.  For BIOS the config lives in
+   * /boot/loader.N/ and that barrier suffices.
+   */
+  if (self->is_efi)
+    { glnx_fd_close int new_config_fd = -1;
+      if (!glnx_openat_rdonly (AT_FDCWD, gs_file_get_path_cached (new_config_path), TRUE, &new_config_fd, error))
+        goto out;
+
+      if (fdatasync (new_config_fd) < 0)
+        {
+          (void)glnx_throw_errno_prefix (error, "fdatasync");
+          goto out;
+        }
+    }
+
   if (self->is_efi)
     {
       g_autoptr(GFile) config_path_efi_old = g_file_get_child (config_path_efi_dir, "grub.cfg.old");
@@ -246,15 +246,14 @@ _ostree_bootloader_syslinux_write_config (OstreeBootloader          *bootloader,
     goto out;
 
   new_config_contents = _ostree_sysroot_join_lines (new_lines);
-  {
-    g_autoptr(GBytes) new_config_contents_bytes =
-      g_bytes_new_static (new_config_contents,
-                          strlen (new_config_contents));
-
-    if (!ot_gfile_replace_contents_fsync (new_config_path, new_config_contents_bytes,
-                                          cancellable, error))
-      goto out;
-  }
+  /* Don't fsync here; the deployment core does a syncfs() on /boot
+   * before swapping the bootversion.
+   */
+  if (!glnx_file_replace_contents_at (AT_FDCWD, gs_file_get_path_cached (new_config_path),
+                                      (guint8*)new_config_contents, strlen (new_config_contents),
+                                      GLNX_FILE_REPLACE_NODATASYNC,
+                                      cancellable, error))
+    goto out;
   
   ret = TRUE;
  out:
@@ -165,28 +165,49 @@ ostree_chain_input_stream_read (GInputStream  *stream,
 {
   OstreeChainInputStream *self = (OstreeChainInputStream*) stream;
   GInputStream *child;
-  gssize res = -1;
+  gssize total = 0;
 
   if (g_cancellable_set_error_if_cancelled (cancellable, error))
     return -1;
-  
+
   if (self->priv->index >= self->priv->streams->len)
     return 0;
 
-  res = 0;
-  while (res == 0 && self->priv->index < self->priv->streams->len)
+  /* Fill the caller's buffer across child stream boundaries, rather
+   * than returning at each child's EOF.  The chains we build are a
+   * small header stream followed by the payload, so without this every
+   * large read was split into a header-sized sliver plus a second round
+   * trip for the content.
+   */
+  while ((gsize) total < count && self->priv->index < self->priv->streams->len)
     {
+      gssize res;
+
       child = self->priv->streams->pdata[self->priv->index];
       res = g_input_stream_read (child,
-                                 buffer,
-                                 count,
+                                 (guint8*) buffer + total,
+                                 count - (gsize) total,
                                  cancellable,
                                  error);
+      if (res < 0)
+        {
+          /* We can't return both data and an error; report the bytes we
+           * have, and let the (persistent) error surface on the next read.
+           */
+          if (total > 0)
+            {
+              g_clear_error (error);
+              return total;
+            }
+          return -1;
+        }
       if (res == 0)
         self->priv->index++;
+      else
+        total += res;
     }
 
-  return res;
+  return total;
 }
 
 static gboolean
@@ -49,7 +49,10 @@ ostree_cmd__private__ (void)
     impl_ostree_generate_grub2_config,
     _ostree_repo_static_delta_dump,
     _ostree_repo_static_delta_query_exists,
-    _ostree_repo_static_delta_delete
+    _ostree_repo_static_delta_delete,
+    _ostree_repo_sha512_index_update,
+    _ostree_repo_crc32c_index_update,
+    _ostree_repo_crc32c_quick_check
   };
 
   return &table;
@@ -32,6 +32,9 @@ typedef struct {
   gboolean (* ostree_static_delta_dump) (OstreeRepo *repo, const char *delta_id, GCancellable *cancellable, GError **error);
   gboolean (* ostree_static_delta_query_exists) (OstreeRepo *repo, const char *delta_id, gboolean *out_exists, GCancellable *cancellable, GError **error);
   gboolean (* ostree_static_delta_delete) (OstreeRepo *repo, const char *delta_id, GCancellable *cancellable, GError **error);
+  gboolean (* ostree_repo_sha512_index_update) (OstreeRepo *repo, GHashTable *new_entries, GCancellable *cancellable, GError **error);
+  gboolean (* ostree_repo_crc32c_index_update) (OstreeRepo *repo, GHashTable *new_entries, GCancellable *cancellable, GError **error);
+  gboolean (* ostree_repo_crc32c_quick_check) (OstreeRepo *repo, guint *out_n_verified, GHashTable **out_unverified, GCancellable *cancellable, GError **error);
 } OstreeCmdPrivateVTable;
 
 /* Note this not really "public", we just export the symbol, but not the header */
@@ -21,6 +21,7 @@
 #pragma once
 
 #include "ostree-core.h"
+#include <string.h>
 #include <sys/stat.h>
 
 G_BEGIN_DECLS
@@ -82,6 +83,9 @@ gboolean _ostree_write_variant_with_size (GOutputStream      *output,
                                           GCancellable       *cancellable,
                                           GError            **error);
 
+GBytes *_ostree_file_header_to_bytes (GVariant  *file_header,
+                                      GError   **error);
+
 gboolean
 _ostree_make_temporary_symlink_at (int             tmp_dirfd,
                                    const char     *target,
@@ -100,6 +104,33 @@ _ostree_checksum_inplace_from_bytes_v (GVariant *csum_v, char *buf)
   ostree_checksum_inplace_from_bytes (csum, buf);
 }
 
+/* Packed binary object name: the SHA256 digest followed by the object
+ * type.  Used as a hash table key on hot paths, where the serialized
+ * GVariant form from ostree_object_name_serialize() would roughly double
+ * the memory per entry and require hex conversions per lookup.
+ */
+typedef struct {
+  guint8 csum[OSTREE_SHA256_DIGEST_LEN];
+  guint8 objtype;
+} OstreeObjectNameBin;
+
+static inline void
+_ostree_object_name_bin_init (OstreeObjectNameBin *name,
+                              const guchar        *csum,
+                              OstreeObjectType     objtype)
+{
+  memcpy (name->csum, csum, OSTREE_SHA256_DIGEST_LEN);
+  name->objtype = (guint8)objtype;
+}
+
+guint _ostree_object_name_bin_hash (gconstpointer a);
+gboolean _ostree_object_name_bin_equal (gconstpointer a, gconstpointer b);
+
+/* Hash/equal over raw 32-byte SHA256 digests, for tables keyed by
+ * content checksums alone. */
+guint _ostree_checksum_bytes_hash (gconstpointer a);
+gboolean _ostree_checksum_bytes_equal (gconstpointer a, gconstpointer b);
+
 /* XX/checksum-2.extension, but let's just use 256 for a
  * bit of overkill.
  */
@@ -129,11 +160,96 @@ _ostree_get_relative_static_delta_part_path (const char        *from,
                                              const char        *to,
                                              guint              i);
 
+/* Published per-commit object manifest; see
+ * ostree_repo_regenerate_summary().  Fanned out like objects/ so a
+ * large repository doesn't accumulate one flat directory.
+ */
+static inline char * _ostree_get_relative_object_manifest_path (const char *checksum)
+{
+  return g_strdup_printf ("manifests/%c%c/%s.manifest", checksum[0], checksum[1], checksum + 2);
+}
+
 static inline char * _ostree_get_commitpartial_path (const char *checksum)
 {
   return g_strconcat ("state/", checksum, ".commitpartial", NULL);
 }
 
+/* Marker recording that @checksum's parent commit was deliberately not
+ * fetched due to a depth limit; the set of these markers forms the
+ * shallow history boundary, which a later pull with the "deepen" option
+ * resumes from without re-traversing history from the refs.
+ */
+static inline char * _ostree_get_shallow_path (const char *checksum)
+{
+  return g_strconcat ("state/", checksum, ".shallow", NULL);
+}
+
+/* Cache of dirtree checksums whose subtrees are known fully stored;
+ * maintained by pull, invalidated wholesale by prune.
+ */
+#define _OSTREE_SCANNED_SUBTREE_INDEX_PATH "state/scanned-subtrees.idx"
+
+/* Persisted devino→checksum table written by ostree_repo_scan_hardlinks(),
+ * invalidated via an mtime snapshot of the objects directories.
+ */
+#define _OSTREE_DEVINO_CACHE_PATH "state/devino-cache"
+
+/* Opt-in (core.commit-stat-cache) table mapping committed relative paths to
+ * their stat identity and content checksum, so unchanged files skip
+ * read+SHA256 on repeated commits.
+ */
+#define _OSTREE_COMMIT_STAT_CACHE_PATH "state/commit-stat-cache"
+
+/* Sorted (refname, checksum) table for local refs written by
+ * _ostree_repo_pack_refs(); loose files under refs/heads always win.
+ */
+#define _OSTREE_PACKED_REFS_PATH "refs/packed"
+
+/* Sorted (checksum, parent, timestamp, subject) table over all local
+ * commit objects, regenerated with the summary and incrementally
+ * merged at transaction commit; lets parent/timestamp scans (history
+ * traversal, age-based prune planning) avoid one random loose-object
+ * read per commit.
+ */
+#define _OSTREE_COMMIT_GRAPH_PATH "state/commit-graph"
+
+/* Directory of optional per-tree path indexes, one file per root
+ * dirtree checksum: a path-sorted table over every entry in the tree,
+ * letting deep path resolution skip the component-by-component dirtree
+ * walk.  Written by _ostree_repo_regenerate_path_index().
+ */
+#define _OSTREE_PATH_INDEX_DIR "state/path-index"
+
+/* Subdirectory of objects/ holding content packs for archive repos:
+ * pack-<id>.data is a concatenation of raw .filez streams, indexed by
+ * the checksum-sorted pack-<id>.index next to it.  Written by
+ * _ostree_repo_pack_small_objects(); loose objects always win.
+ */
+#define _OSTREE_CONTENT_PACK_DIR "pack"
+
+/* Per-commit reachability closures persisted by prune so repeated
+ * prunes skip re-traversing commits seen before; one file per commit,
+ * removed when the commit itself is pruned.
+ */
+#define _OSTREE_PRUNE_CLOSURE_DIR "state/prune-closures"
+
+static inline char * _ostree_get_prune_closure_path (const char *checksum)
+{
+  return g_strconcat (_OSTREE_PRUNE_CLOSURE_DIR "/", checksum, NULL);
+}
+
+/* Per-commit (object, objtype, storage size) closures backing
+ * ostree_repo_get_commit_sizes(); maintained at transaction commit,
+ * removed when the commit itself is pruned.
+ */
+#define _OSTREE_SIZE_CLOSURE_DIR "state/size-closures"
+#define _OSTREE_SIZE_CLOSURE_GVARIANT_STRING "a(sut)"
+
+static inline char * _ostree_get_size_closure_path (const char *checksum)
+{
+  return g_strconcat (_OSTREE_SIZE_CLOSURE_DIR "/", checksum, NULL);
+}
+
 gboolean
 _ostree_parse_delta_name (const char  *delta_name,
                           char        **out_from,
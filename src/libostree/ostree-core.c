@@ -31,6 +31,7 @@
 #include "ostree.h"
 #include "ostree-core-private.h"
 #include "ostree-chain-input-stream.h"
+#include "ostree-deflate-converter.h"
 #include "otutil.h"
 
 #define ALIGN_VALUE(this, boundary) \
@@ -439,30 +440,30 @@ _ostree_write_variant_with_size (GOutputStream      *output,
 }
 
 /*
- * write_file_header_update_checksum:
- * @out: Stream
- * @variant: A variant, should be a file header
- * @checksum: (allow-none): If provided, update with written data
- * @cancellable: Cancellable
+ * _ostree_file_header_to_bytes:
+ * @file_header: A file header variant
  * @error: Error
  *
- * Write a file header variant to the provided @out stream, optionally
- * updating @checksum.
+ * Serialize @file_header with its size prefix and alignment padding,
+ * exactly as it appears at the start of a content object stream.
+ * Useful for callers that write many objects sharing the same header
+ * and want to reuse the serialized form.
  */
-static gboolean
-write_file_header_update_checksum (GOutputStream         *out,
-                                   GVariant              *header,
-                                   GChecksum             *checksum,
-                                   GCancellable          *cancellable,
-                                   GError               **error)
+GBytes *
+_ostree_file_header_to_bytes (GVariant  *file_header,
+                              GError   **error)
 {
-  gsize bytes_written;
+  g_autoptr(GOutputStream) header_out_stream =
+    g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
 
-  if (!_ostree_write_variant_with_size (out, header, 0, &bytes_written, checksum,
-                                        cancellable, error))
-    return FALSE;
+  if (!_ostree_write_variant_with_size (header_out_stream, file_header, 0,
+                                        NULL, NULL, NULL, error))
+    return NULL;
 
-  return TRUE;
+  if (!g_output_stream_close (header_out_stream, NULL, error))
+    return NULL;
+
+  return g_memory_output_stream_steal_as_bytes ((GMemoryOutputStream*) header_out_stream);
 }
 
 /*
@@ -484,25 +485,19 @@ header_and_input_to_stream (GVariant           *file_header,
                             GCancellable       *cancellable,
                             GError            **error)
 {
-  gpointer header_data;
-  gsize header_size;
   g_autoptr(GInputStream) ret_input = NULL;
   g_autoptr(GPtrArray) streams = NULL;
-  g_autoptr(GOutputStream) header_out_stream = NULL;
+  g_autoptr(GBytes) header_bytes = NULL;
   g_autoptr(GInputStream) header_in_stream = NULL;
 
-  header_out_stream = g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
-
-  if (!_ostree_write_variant_with_size (header_out_stream, file_header, 0, NULL, NULL,
-                                        cancellable, error))
-    return FALSE;
-
-  if (!g_output_stream_close (header_out_stream, cancellable, error))
+  /* Build the serialized header once and hand the GBytes to the memory
+   * stream directly; no output-stream round trip or extra copy.
+   */
+  header_bytes = _ostree_file_header_to_bytes (file_header, error);
+  if (header_bytes == NULL)
     return FALSE;
 
-  header_size = g_memory_output_stream_get_data_size ((GMemoryOutputStream*) header_out_stream);
-  header_data = g_memory_output_stream_steal_data ((GMemoryOutputStream*) header_out_stream);
-  header_in_stream = g_memory_input_stream_new_from_data (header_data, header_size, g_free);
+  header_in_stream = g_memory_input_stream_new_from_bytes (header_bytes);
 
   streams = g_ptr_array_new_with_free_func ((GDestroyNotify)g_object_unref);
 
@@ -513,7 +508,7 @@ header_and_input_to_stream (GVariant           *file_header,
   ret_input = (GInputStream*)ostree_chain_input_stream_new (streams);
   ot_transfer_out_value (out_input, &ret_input);
   if (out_header_size)
-    *out_header_size = header_size;
+    *out_header_size = g_bytes_get_size (header_bytes);
 
   return TRUE;
 }
@@ -535,7 +530,7 @@ _ostree_raw_file_to_archive_stream (GInputStream       *input,
     {
       g_autoptr(GConverter) zlib_compressor = NULL;
 
-      zlib_compressor = G_CONVERTER (g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_RAW, compression_level));
+      zlib_compressor = _ostree_deflate_compressor_new (compression_level);
       zlib_input = g_converter_input_stream_new (input, zlib_compressor);
     }
   return header_and_input_to_stream (file_header,
@@ -736,7 +731,7 @@ ostree_content_stream_parse (gboolean                compressed,
        **/
       if (compressed)
         {
-          g_autoptr(GConverter) zlib_decomp = (GConverter*)g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_RAW);
+          g_autoptr(GConverter) zlib_decomp = _ostree_deflate_decompressor_new ();
           ret_input = g_converter_input_stream_new (input, zlib_decomp);
         }
       else
@@ -831,6 +826,56 @@ ostree_content_file_parse (gboolean                compressed,
                                        cancellable, error);
 }
 
+/* Feed the canonical object stream for (@file_info, @xattrs, @in) into
+ * all of @checksums; the content is read exactly once no matter how
+ * many digests are requested.
+ */
+static gboolean
+checksum_file_from_input (GFileInfo        *file_info,
+                          GVariant         *xattrs,
+                          GInputStream     *in,
+                          OstreeObjectType  objtype,
+                          GChecksum       **checksums,
+                          guint             n_checksums,
+                          GCancellable     *cancellable,
+                          GError          **error)
+{
+  if (OSTREE_OBJECT_TYPE_IS_META (objtype))
+    {
+      if (!ot_gio_splice_update_checksums (NULL, in, checksums, n_checksums,
+                                           cancellable, error))
+        return FALSE;
+    }
+  else if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_DIRECTORY)
+    {
+      g_autoptr(GVariant) dirmeta = ostree_create_directory_metadata (file_info, xattrs);
+      for (guint i = 0; i < n_checksums; i++)
+        g_checksum_update (checksums[i], g_variant_get_data (dirmeta),
+                           g_variant_get_size (dirmeta));
+    }
+  else
+    {
+      g_autoptr(GVariant) file_header = _ostree_file_header_new (file_info, xattrs);
+      g_autoptr(GBytes) header_bytes = _ostree_file_header_to_bytes (file_header, error);
+      if (header_bytes == NULL)
+        return FALSE;
+
+      gsize header_len;
+      const guint8 *header_data = g_bytes_get_data (header_bytes, &header_len);
+      for (guint i = 0; i < n_checksums; i++)
+        g_checksum_update (checksums[i], header_data, header_len);
+
+      if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_REGULAR)
+        {
+          if (!ot_gio_splice_update_checksums (NULL, in, checksums, n_checksums,
+                                               cancellable, error))
+            return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
 /**
  * ostree_checksum_file_from_input:
  * @file_info: File information
@@ -852,36 +897,53 @@ ostree_checksum_file_from_input (GFileInfo        *file_info,
                                  GCancellable     *cancellable,
                                  GError          **error)
 {
+  return ostree_checksum_file_from_input_multi (file_info, xattrs, in, objtype,
+                                                NULL, 0, out_csum,
+                                                cancellable, error);
+}
 
+/**
+ * ostree_checksum_file_from_input_multi:
+ * @file_info: File information
+ * @xattrs: (allow-none): Optional extended attributes
+ * @in: (allow-none): File content, should be %NULL for symbolic links
+ * @objtype: Object type
+ * @extra_checksums: (allow-none) (array length=n_extra): Additional checksums to update
+ * @n_extra: Number of additional checksums
+ * @out_csum: (out) (array fixed-size=32): Return location for binary SHA256 checksum
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Like ostree_checksum_file_from_input(), but additionally feed the
+ * canonical object stream into each of @extra_checksums.  All digests
+ * are computed interleaved in a single pass over the input, so e.g.
+ * recording a SHA512 digest alongside the SHA256 object checksum does
+ * not cost a second read of the content.
+ *
+ * Since: 2017.10
+ */
+gboolean
+ostree_checksum_file_from_input_multi (GFileInfo        *file_info,
+                                       GVariant         *xattrs,
+                                       GInputStream     *in,
+                                       OstreeObjectType  objtype,
+                                       GChecksum       **extra_checksums,
+                                       guint             n_extra,
+                                       guchar          **out_csum,
+                                       GCancellable     *cancellable,
+                                       GError          **error)
+{
   g_autoptr(GChecksum) checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  g_autofree GChecksum **checksums = g_new (GChecksum *, n_extra + 1);
 
-  if (OSTREE_OBJECT_TYPE_IS_META (objtype))
-    {
-      if (!ot_gio_splice_update_checksum (NULL, in, checksum, cancellable, error))
-        return FALSE;
-    }
-  else if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_DIRECTORY)
-    {
-      g_autoptr(GVariant) dirmeta = ostree_create_directory_metadata (file_info, xattrs);
-      g_checksum_update (checksum, g_variant_get_data (dirmeta),
-                         g_variant_get_size (dirmeta));
-    }
-  else
-    {
-      g_autoptr(GVariant) file_header = NULL;
-
-      file_header = _ostree_file_header_new (file_info, xattrs);
+  checksums[0] = checksum;
+  for (guint i = 0; i < n_extra; i++)
+    checksums[i + 1] = extra_checksums[i];
 
-      if (!write_file_header_update_checksum (NULL, file_header, checksum,
-                                              cancellable, error))
-        return FALSE;
-
-      if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_REGULAR)
-        {
-          if (!ot_gio_splice_update_checksum (NULL, in, checksum, cancellable, error))
-            return FALSE;
-        }
-    }
+  if (!checksum_file_from_input (file_info, xattrs, in, objtype,
+                                 checksums, n_extra + 1,
+                                 cancellable, error))
+    return FALSE;
 
   *out_csum = ot_csum_from_gchecksum (checksum);
   return TRUE;
@@ -1211,6 +1273,47 @@ ostree_hash_object_name (gconstpointer a)
   return g_str_hash (checksum) + g_int_hash (&objtype_int);
 }
 
+/* Hash for #OstreeObjectNameBin keys.  The digest is the output of
+ * SHA256, so it's already uniformly distributed; just take the leading
+ * bytes and fold in the object type.
+ */
+guint
+_ostree_object_name_bin_hash (gconstpointer a)
+{
+  const OstreeObjectNameBin *name = a;
+  guint hash;
+
+  memcpy (&hash, name->csum, sizeof (hash));
+  return hash ^ name->objtype;
+}
+
+gboolean
+_ostree_object_name_bin_equal (gconstpointer a,
+                               gconstpointer b)
+{
+  const OstreeObjectNameBin *name_a = a;
+  const OstreeObjectNameBin *name_b = b;
+
+  return name_a->objtype == name_b->objtype
+    && memcmp (name_a->csum, name_b->csum, OSTREE_SHA256_DIGEST_LEN) == 0;
+}
+
+guint
+_ostree_checksum_bytes_hash (gconstpointer a)
+{
+  guint hash;
+
+  memcpy (&hash, a, sizeof (hash));
+  return hash;
+}
+
+gboolean
+_ostree_checksum_bytes_equal (gconstpointer a,
+                              gconstpointer b)
+{
+  return memcmp (a, b, OSTREE_SHA256_DIGEST_LEN) == 0;
+}
+
 /**
  * ostree_cmp_checksum_bytes:
  * @a: A binary checksum
@@ -1289,6 +1392,126 @@ ostree_checksum_b64_inplace_to_bytes (const char *checksum,
   g_base64_decode_step (tmpbuf, sizeof (tmpbuf), (guchar *) buf, &state, &save);
 }
 
+/* SIMD kernels for the hex<->binary checksum codecs.  These run for
+ * every object during pull, traverse and prune — tens of millions of
+ * conversions on a large mirror sync — so the per-character table
+ * lookups show up in profiles.  Both kernels operate on exactly one
+ * SHA256 digest (32 bytes / 64 hex characters); the scalar code below
+ * remains the fallback for other architectures, and for the decoder
+ * also the path that reports invalid input.
+ */
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#define OSTREE_CHECKSUM_HAVE_SIMD 1
+
+static inline gboolean
+checksum_hex_to_bytes_vec (const char *checksum,
+                           guchar     *buf)
+{
+  const __m128i lcase_bit = _mm_set1_epi8 (0x20);
+  /* For _mm_maddubs_epi16: each high-nibble value is multiplied by 16
+   * and added to the adjacent low-nibble value. */
+  const __m128i nib_weights = _mm_set1_epi16 (0x0110);
+  __m128i pairs[4];
+
+  for (guint i = 0; i < 4; i++)
+    {
+      __m128i c = _mm_loadu_si128 ((const __m128i *)checksum + i);
+      __m128i lc = _mm_or_si128 (c, lcase_bit);
+      __m128i is_digit = _mm_and_si128 (_mm_cmpgt_epi8 (c, _mm_set1_epi8 ('0' - 1)),
+                                        _mm_cmplt_epi8 (c, _mm_set1_epi8 ('9' + 1)));
+      __m128i is_alpha = _mm_and_si128 (_mm_cmpgt_epi8 (lc, _mm_set1_epi8 ('a' - 1)),
+                                        _mm_cmplt_epi8 (lc, _mm_set1_epi8 ('f' + 1)));
+
+      if (_mm_movemask_epi8 (_mm_or_si128 (is_digit, is_alpha)) != 0xffff)
+        return FALSE;
+
+      __m128i nibbles =
+        _mm_or_si128 (_mm_and_si128 (_mm_sub_epi8 (c, _mm_set1_epi8 ('0')), is_digit),
+                      _mm_and_si128 (_mm_sub_epi8 (lc, _mm_set1_epi8 ('a' - 10)), is_alpha));
+      pairs[i] = _mm_maddubs_epi16 (nibbles, nib_weights);
+    }
+
+  _mm_storeu_si128 ((__m128i *)buf, _mm_packus_epi16 (pairs[0], pairs[1]));
+  _mm_storeu_si128 ((__m128i *)buf + 1, _mm_packus_epi16 (pairs[2], pairs[3]));
+  return TRUE;
+}
+
+static inline void
+checksum_bytes_to_hex_vec (const guchar *csum,
+                           char         *buf)
+{
+  const __m128i hexchars = _mm_setr_epi8 ('0', '1', '2', '3', '4', '5', '6', '7',
+                                          '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+  const __m128i low_mask = _mm_set1_epi8 (0x0f);
+
+  for (guint i = 0; i < 2; i++)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i *)csum + i);
+      /* The cross-byte bits shifted in by the 64-bit shift are masked off */
+      __m128i hex_hi = _mm_shuffle_epi8 (hexchars, _mm_and_si128 (_mm_srli_epi64 (v, 4), low_mask));
+      __m128i hex_lo = _mm_shuffle_epi8 (hexchars, _mm_and_si128 (v, low_mask));
+      _mm_storeu_si128 ((__m128i *)buf + 2 * i, _mm_unpacklo_epi8 (hex_hi, hex_lo));
+      _mm_storeu_si128 ((__m128i *)buf + 2 * i + 1, _mm_unpackhi_epi8 (hex_hi, hex_lo));
+    }
+}
+
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define OSTREE_CHECKSUM_HAVE_SIMD 1
+
+static inline gboolean
+checksum_hex_to_bytes_vec (const char *checksum,
+                           guchar     *buf)
+{
+  for (guint i = 0; i < 2; i++)
+    {
+      /* vld2q deinterleaves: val[0] holds the high-nibble characters,
+       * val[1] the low-nibble ones. */
+      uint8x16x2_t c = vld2q_u8 ((const uint8_t *)checksum + 32 * i);
+      uint8x16_t nib[2];
+
+      for (guint j = 0; j < 2; j++)
+        {
+          uint8x16_t ch = c.val[j];
+          uint8x16_t lc = vorrq_u8 (ch, vdupq_n_u8 (0x20));
+          uint8x16_t is_digit = vandq_u8 (vcgeq_u8 (ch, vdupq_n_u8 ('0')),
+                                          vcleq_u8 (ch, vdupq_n_u8 ('9')));
+          uint8x16_t is_alpha = vandq_u8 (vcgeq_u8 (lc, vdupq_n_u8 ('a')),
+                                          vcleq_u8 (lc, vdupq_n_u8 ('f')));
+
+          if (vmaxvq_u8 (vmvnq_u8 (vorrq_u8 (is_digit, is_alpha))) != 0)
+            return FALSE;
+
+          nib[j] = vorrq_u8 (vandq_u8 (vsubq_u8 (ch, vdupq_n_u8 ('0')), is_digit),
+                             vandq_u8 (vsubq_u8 (lc, vdupq_n_u8 ('a' - 10)), is_alpha));
+        }
+
+      vst1q_u8 (buf + 16 * i, vorrq_u8 (vshlq_n_u8 (nib[0], 4), nib[1]));
+    }
+  return TRUE;
+}
+
+static inline void
+checksum_bytes_to_hex_vec (const guchar *csum,
+                           char         *buf)
+{
+  static const uint8_t hexchars[16] = { '0', '1', '2', '3', '4', '5', '6', '7',
+                                        '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
+  const uint8x16_t lut = vld1q_u8 (hexchars);
+
+  for (guint i = 0; i < 2; i++)
+    {
+      uint8x16_t v = vld1q_u8 (csum + 16 * i);
+      uint8x16x2_t hex;
+
+      hex.val[0] = vqtbl1q_u8 (lut, vshrq_n_u8 (v, 4));
+      hex.val[1] = vqtbl1q_u8 (lut, vandq_u8 (v, vdupq_n_u8 (0x0f)));
+      vst2q_u8 ((uint8_t *)buf + 32 * i, hex);
+    }
+}
+#endif /* __SSSE3__ / __ARM_NEON */
+
 /**
  * ostree_checksum_inplace_to_bytes:
  * @checksum: a SHA256 string
@@ -1304,6 +1527,13 @@ ostree_checksum_inplace_to_bytes (const char *checksum,
   guint i;
   guint j;
 
+#ifdef OSTREE_CHECKSUM_HAVE_SIMD
+  if (G_LIKELY (checksum_hex_to_bytes_vec (checksum, buf)))
+    return;
+  /* Invalid characters; fall through so the assertions below fire as
+   * they would have on the scalar path. */
+#endif
+
   for (i = 0, j = 0; i < OSTREE_SHA256_DIGEST_LEN; i += 1, j += 2)
     {
       gint big, little;
@@ -1374,7 +1604,12 @@ void
 ostree_checksum_inplace_from_bytes (const guchar *csum,
                                     char         *buf)
 {
+#ifdef OSTREE_CHECKSUM_HAVE_SIMD
+  checksum_bytes_to_hex_vec (csum, buf);
+  buf[OSTREE_SHA256_STRING_LEN] = '\0';
+#else
   ot_bin2hex (buf, csum, OSTREE_SHA256_DIGEST_LEN);
+#endif
 }
 
 /**
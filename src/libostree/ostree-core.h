@@ -412,6 +412,17 @@ gboolean ostree_checksum_file_from_input (GFileInfo        *file_info,
                                           GCancellable     *cancellable,
                                           GError          **error);
 
+_OSTREE_PUBLIC
+gboolean ostree_checksum_file_from_input_multi (GFileInfo        *file_info,
+                                                GVariant         *xattrs,
+                                                GInputStream     *in,
+                                                OstreeObjectType  objtype,
+                                                GChecksum       **extra_checksums,
+                                                guint             n_extra,
+                                                guchar          **out_csum,
+                                                GCancellable     *cancellable,
+                                                GError          **error);
+
 _OSTREE_PUBLIC
 gboolean ostree_checksum_file (GFile             *f,
                                OstreeObjectType   objtype,
@@ -0,0 +1,275 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2017 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "ostree-deflate-converter.h"
+
+#include <string.h>
+
+#ifdef HAVE_ZLIB_NG
+#include <zlib-ng.h>
+#endif
+
+/**
+ * SECTION:ostree-deflate-converter
+ * @title: Deflate converter factory
+ *
+ * The archive repository format stores content objects as raw deflate
+ * streams.  The format is fixed, but the implementation producing and
+ * consuming it is not: when built against zlib-ng, these factories
+ * return a converter backed by its SIMD-accelerated deflate, which
+ * emits and accepts exactly the same wire format as zlib.  Otherwise
+ * (or when `OSTREE_DEFLATE_BACKEND=zlib` is set) they fall back to
+ * GLib's #GZlibCompressor/#GZlibDecompressor.
+ */
+
+#ifdef HAVE_ZLIB_NG
+
+static gboolean
+use_zng_backend (void)
+{
+  static gsize initialized;
+  static gboolean use_zng;
+  if (g_once_init_enter (&initialized))
+    {
+      const char *backend = g_getenv ("OSTREE_DEFLATE_BACKEND");
+      use_zng = (backend == NULL || strcmp (backend, "zlib") != 0);
+      g_once_init_leave (&initialized, 1);
+    }
+  return use_zng;
+}
+
+#define OSTREE_TYPE_ZNG_CONVERTER (_ostree_zng_converter_get_type ())
+#define OSTREE_ZNG_CONVERTER(o) (G_TYPE_CHECK_INSTANCE_CAST ((o), OSTREE_TYPE_ZNG_CONVERTER, OstreeZngConverter))
+
+typedef struct {
+  GObject parent_instance;
+
+  gboolean compress;
+  int level;
+
+  gboolean initialized;
+  zng_stream zstream;
+} OstreeZngConverter;
+
+typedef struct {
+  GObjectClass parent_class;
+} OstreeZngConverterClass;
+
+static void _ostree_zng_converter_iface_init (GConverterIface *iface);
+
+GType _ostree_zng_converter_get_type (void) G_GNUC_CONST;
+
+G_DEFINE_TYPE_WITH_CODE (OstreeZngConverter, _ostree_zng_converter,
+                         G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_CONVERTER,
+                                                _ostree_zng_converter_iface_init))
+
+static void
+zng_converter_deinit (OstreeZngConverter *self)
+{
+  if (!self->initialized)
+    return;
+  if (self->compress)
+    (void) zng_deflateEnd (&self->zstream);
+  else
+    (void) zng_inflateEnd (&self->zstream);
+  self->initialized = FALSE;
+}
+
+static void
+_ostree_zng_converter_finalize (GObject *object)
+{
+  OstreeZngConverter *self = OSTREE_ZNG_CONVERTER (object);
+
+  zng_converter_deinit (self);
+
+  G_OBJECT_CLASS (_ostree_zng_converter_parent_class)->finalize (object);
+}
+
+static void
+_ostree_zng_converter_init (OstreeZngConverter *self)
+{
+}
+
+static void
+_ostree_zng_converter_class_init (OstreeZngConverterClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->finalize = _ostree_zng_converter_finalize;
+}
+
+static void
+_ostree_zng_converter_reset (GConverter *converter)
+{
+  OstreeZngConverter *self = OSTREE_ZNG_CONVERTER (converter);
+
+  zng_converter_deinit (self);
+  memset (&self->zstream, 0, sizeof (self->zstream));
+}
+
+static gboolean
+zng_converter_ensure_initialized (OstreeZngConverter *self,
+                                  GError            **error)
+{
+  if (self->initialized)
+    return TRUE;
+
+  int res;
+  /* windowBits -15: a raw deflate stream, same as
+   * G_ZLIB_COMPRESSOR_FORMAT_RAW. */
+  if (self->compress)
+    res = zng_deflateInit2 (&self->zstream, self->level, Z_DEFLATED,
+                            -15, 8, Z_DEFAULT_STRATEGY);
+  else
+    res = zng_inflateInit2 (&self->zstream, -15);
+  if (res != Z_OK)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "zlib-ng: failed to initialize stream (%d)", res);
+      return FALSE;
+    }
+  self->initialized = TRUE;
+  return TRUE;
+}
+
+static GConverterResult
+_ostree_zng_converter_convert (GConverter *converter,
+                               const void *inbuf,
+                               gsize       inbuf_size,
+                               void       *outbuf,
+                               gsize       outbuf_size,
+                               GConverterFlags flags,
+                               gsize      *bytes_read,
+                               gsize      *bytes_written,
+                               GError    **error)
+{
+  OstreeZngConverter *self = OSTREE_ZNG_CONVERTER (converter);
+
+  if (outbuf_size == 0)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
+                           "Output buffer too small");
+      return G_CONVERTER_ERROR;
+    }
+
+  if (!zng_converter_ensure_initialized (self, error))
+    return G_CONVERTER_ERROR;
+
+  self->zstream.next_in = inbuf;
+  self->zstream.avail_in = inbuf_size;
+  self->zstream.next_out = outbuf;
+  self->zstream.avail_out = outbuf_size;
+
+  int res;
+  if (self->compress)
+    {
+      int flush = Z_NO_FLUSH;
+      if (flags & G_CONVERTER_INPUT_AT_END)
+        flush = Z_FINISH;
+      else if (flags & G_CONVERTER_FLUSH)
+        flush = Z_SYNC_FLUSH;
+      res = zng_deflate (&self->zstream, flush);
+    }
+  else
+    res = zng_inflate (&self->zstream, Z_NO_FLUSH);
+
+  if (res == Z_MEM_ERROR)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "zlib-ng: out of memory");
+      return G_CONVERTER_ERROR;
+    }
+  if (res == Z_DATA_ERROR || res == Z_NEED_DICT)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                           "zlib-ng: invalid compressed data");
+      return G_CONVERTER_ERROR;
+    }
+  if (res == Z_STREAM_ERROR)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "zlib-ng: internal error: %s",
+                   self->zstream.msg ? self->zstream.msg : "(unknown)");
+      return G_CONVERTER_ERROR;
+    }
+  if (res == Z_BUF_ERROR)
+    {
+      if (flags & G_CONVERTER_FLUSH)
+        return G_CONVERTER_FLUSHED;
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                           "zlib-ng: need more input");
+      return G_CONVERTER_ERROR;
+    }
+
+  g_assert (res == Z_OK || res == Z_STREAM_END);
+
+  *bytes_read = inbuf_size - self->zstream.avail_in;
+  *bytes_written = outbuf_size - self->zstream.avail_out;
+
+  if (res == Z_STREAM_END)
+    return G_CONVERTER_FINISHED;
+  if ((flags & G_CONVERTER_FLUSH) && self->zstream.avail_out > 0)
+    return G_CONVERTER_FLUSHED;
+  return G_CONVERTER_CONVERTED;
+}
+
+static void
+_ostree_zng_converter_iface_init (GConverterIface *iface)
+{
+  iface->convert = _ostree_zng_converter_convert;
+  iface->reset = _ostree_zng_converter_reset;
+}
+
+static GConverter *
+zng_converter_new (gboolean compress,
+                   int      level)
+{
+  OstreeZngConverter *self = g_object_new (OSTREE_TYPE_ZNG_CONVERTER, NULL);
+  self->compress = compress;
+  self->level = level;
+  return (GConverter*)self;
+}
+
+#endif /* HAVE_ZLIB_NG */
+
+/* Return a #GConverter producing a raw deflate stream at @level, using
+ * the fastest available backend. */
+GConverter *
+_ostree_deflate_compressor_new (int level)
+{
+#ifdef HAVE_ZLIB_NG
+  if (use_zng_backend ())
+    return zng_converter_new (TRUE, level);
+#endif
+  return (GConverter*)g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_RAW, level);
+}
+
+/* Return a #GConverter consuming a raw deflate stream, using the
+ * fastest available backend. */
+GConverter *
+_ostree_deflate_decompressor_new (void)
+{
+#ifdef HAVE_ZLIB_NG
+  if (use_zng_backend ())
+    return zng_converter_new (FALSE, 0);
+#endif
+  return (GConverter*)g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_RAW);
+}
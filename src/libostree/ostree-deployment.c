@@ -274,6 +274,19 @@ ostree_deployment_get_origin_relpath (OstreeDeployment *self)
                           ostree_deployment_get_deployserial (self));
 }
 
+/* Sidecar to the origin file holding the readahead pack: a list of
+ * boot-critical files in the deployment, sorted for one sequential
+ * sweep; see generate_readahead_pack() in ostree-sysroot-deploy.c.
+ */
+char *
+_ostree_deployment_get_readahead_pack_relpath (OstreeDeployment *self)
+{
+  return g_strdup_printf ("ostree/deploy/%s/deploy/%s.%d.readahead",
+                          ostree_deployment_get_osname (self),
+                          ostree_deployment_get_csum (self),
+                          ostree_deployment_get_deployserial (self));
+}
+
 const char *
 ostree_deployment_unlocked_state_to_string (OstreeDeploymentUnlockedState state)
 {
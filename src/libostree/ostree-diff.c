@@ -25,6 +25,7 @@
 #include "libglnx.h"
 #include "ostree.h"
 #include "ostree-repo-private.h"
+#include "ostree-rollsum.h"
 #include "otutil.h"
 
 static gboolean
@@ -185,93 +186,139 @@ diff_add_dir_recurse (GFile          *d,
   return TRUE;
 }
 
-/**
- * ostree_diff_dirs:
- * @flags: Flags
- * @a: First directory path, or %NULL
- * @b: First directory path
- * @modified: (element-type OstreeDiffItem): Modified files
- * @removed: (element-type Gio.File): Removed files
- * @added: (element-type Gio.File): Added files
- * @cancellable: Cancellable
- * @error: Error
- *
- * Compute the difference between directory @a and @b as 3 separate
- * sets of #OstreeDiffItem in @modified, @removed, and @added.
+/* Shared state for one ostree_diff_dirs_with_options() invocation.  The
+ * walk is decomposed into one job per differing directory pair; jobs run
+ * on @pool when we have multiple CPUs, or inline otherwise.
  */
-gboolean
-ostree_diff_dirs (OstreeDiffFlags flags,
-                  GFile          *a,
-                  GFile          *b,
-                  GPtrArray      *modified,
-                  GPtrArray      *removed,
-                  GPtrArray      *added,
-                  GCancellable   *cancellable,
-                  GError        **error)
+typedef struct {
+  OstreeDiffFlags flags;
+  OstreeDiffDirsOptions *options;
+  GThreadPool *pool; /* NULL => run jobs inline */
+  GMutex lock;
+  GCond cond;
+  guint jobs_pending; /* protected by lock */
+  GError *error; /* first failure, protected by lock */
+  GCancellable *cancellable;
+} DiffDirsContext;
+
+/* One directory pair to compare.  Results accumulate in the job-local
+ * arrays and are spliced into the caller's arrays in deterministic
+ * (enumeration) order once all jobs have completed, so parallelism
+ * doesn't perturb output ordering.
+ */
+typedef struct _DiffDirsJob DiffDirsJob;
+struct _DiffDirsJob {
+  DiffDirsContext *ctx;
+  GFile *a;
+  GFile *b;
+  /* Non-NULL for subdirectory jobs; emit a modified entry for the
+   * directory pair itself, as the serial recursion did in the parent.
+   */
+  GFileInfo *a_info;
+  GFileInfo *b_info;
+  GPtrArray *modified; /* OstreeDiffItem */
+  GPtrArray *removed;  /* GFile */
+  GPtrArray *added;    /* GFile */
+  GPtrArray *children; /* DiffDirsJob, in enumeration order */
+};
+
+static void diff_dirs_job_free (DiffDirsJob *job);
+
+static DiffDirsJob *
+diff_dirs_job_new (DiffDirsContext *ctx,
+                   GFile           *a,
+                   GFileInfo       *a_info,
+                   GFile           *b,
+                   GFileInfo       *b_info)
 {
-  return ostree_diff_dirs_with_options (flags, a, b, modified,
-                                        removed, added, NULL,
-                                        cancellable, error);
+  DiffDirsJob *job = g_new0 (DiffDirsJob, 1);
+  job->ctx = ctx;
+  job->a = g_object_ref (a);
+  job->b = g_object_ref (b);
+  job->a_info = a_info ? g_object_ref (a_info) : NULL;
+  job->b_info = b_info ? g_object_ref (b_info) : NULL;
+  job->modified = g_ptr_array_new_with_free_func ((GDestroyNotify)ostree_diff_item_unref);
+  job->removed = g_ptr_array_new_with_free_func (g_object_unref);
+  job->added = g_ptr_array_new_with_free_func (g_object_unref);
+  job->children = g_ptr_array_new_with_free_func ((GDestroyNotify)diff_dirs_job_free);
+  return job;
 }
 
-/**
- * ostree_diff_dirs_with_options:
- * @flags: Flags
- * @a: First directory path, or %NULL
- * @b: First directory path
- * @modified: (element-type OstreeDiffItem): Modified files
- * @removed: (element-type Gio.File): Removed files
- * @added: (element-type Gio.File): Added files
- * @cancellable: Cancellable
- * @options: (allow-none): Options
- * @error: Error
- *
- * Compute the difference between directory @a and @b as 3 separate
- * sets of #OstreeDiffItem in @modified, @removed, and @added.
+static void
+diff_dirs_job_free (DiffDirsJob *job)
+{
+  g_object_unref (job->a);
+  g_object_unref (job->b);
+  g_clear_object (&job->a_info);
+  g_clear_object (&job->b_info);
+  g_ptr_array_unref (job->modified);
+  g_ptr_array_unref (job->removed);
+  g_ptr_array_unref (job->added);
+  g_ptr_array_unref (job->children);
+  g_free (job);
+}
+
+/* Move one job array's elements to @dest, preserving order. */
+static void
+diff_dirs_splice_array (GPtrArray *src,
+                        GPtrArray *dest)
+{
+  for (guint i = 0; i < src->len; i++)
+    g_ptr_array_add (dest, src->pdata[i]);
+  g_ptr_array_set_free_func (src, NULL);
+  g_ptr_array_set_size (src, 0);
+}
+
+/* Reassemble results depth-first.  A job's own modified/removed entries
+ * precede its subdirectories' (files enumerate before directories in
+ * dirtrees), while its own added entries follow them, matching the
+ * order the serial recursion produced.
  */
-gboolean
-ostree_diff_dirs_with_options (OstreeDiffFlags        flags,
-                               GFile                 *a,
-                               GFile                 *b,
-                               GPtrArray             *modified,
-                               GPtrArray             *removed,
-                               GPtrArray             *added,
-                               OstreeDiffDirsOptions *options,
-                               GCancellable          *cancellable,
-                               GError               **error)
+static void
+diff_dirs_job_splice (DiffDirsJob *job,
+                      GPtrArray   *modified,
+                      GPtrArray   *removed,
+                      GPtrArray   *added)
+{
+  diff_dirs_splice_array (job->modified, modified);
+  diff_dirs_splice_array (job->removed, removed);
+
+  for (guint i = 0; i < job->children->len; i++)
+    diff_dirs_job_splice (job->children->pdata[i], modified, removed, added);
+
+  diff_dirs_splice_array (job->added, added);
+}
+
+static gboolean diff_dirs_job_schedule (DiffDirsJob *job, GError **error);
+
+static gboolean
+diff_dirs_job_execute (DiffDirsJob   *job,
+                       GCancellable  *cancellable,
+                       GError       **error)
 {
   gboolean ret = FALSE;
+  DiffDirsContext *ctx = job->ctx;
+  OstreeDiffFlags flags = ctx->flags;
+  OstreeDiffDirsOptions *options = ctx->options;
+  GFile *a = job->a;
+  GFile *b = job->b;
   GError *temp_error = NULL;
   g_autoptr(GFileEnumerator) dir_enum = NULL;
   g_autoptr(GFile) child_a = NULL;
   g_autoptr(GFile) child_b = NULL;
   g_autoptr(GFileInfo) child_a_info = NULL;
   g_autoptr(GFileInfo) child_b_info = NULL;
-  OstreeDiffDirsOptions default_opts = OSTREE_DIFF_DIRS_OPTIONS_INIT;
 
-  if (!options)
-    options = &default_opts;
-
-  /* If we're diffing versus a repo, and either of them have xattrs disabled,
-   * then disable for both.
-   */
-  OstreeRepo *repo;
-  if (OSTREE_IS_REPO_FILE (a))
-    repo = ostree_repo_file_get_repo ((OstreeRepoFile*)a);
-  else if (OSTREE_IS_REPO_FILE (b))
-    repo = ostree_repo_file_get_repo ((OstreeRepoFile*)b);
-  else
-    repo = NULL;
-  if (repo != NULL && repo->disable_xattrs)
-    flags |= OSTREE_DIFF_FLAGS_IGNORE_XATTRS;
-
-  if (a == NULL)
+  if (job->a_info)
     {
-      if (!diff_add_dir_recurse (b, added, cancellable, error))
+      OstreeDiffItem *diff_item = NULL;
+
+      if (!diff_files (flags, a, job->a_info, b, job->b_info, &diff_item,
+                       cancellable, error))
         goto out;
 
-      ret = TRUE;
-      goto out;
+      if (diff_item)
+        g_ptr_array_add (job->modified, diff_item); /* Transfer ownership */
     }
 
   child_a_info = g_file_query_info (a, OSTREE_GIO_FAST_QUERYINFO,
@@ -294,7 +341,7 @@ ostree_diff_dirs_with_options (OstreeDiffFlags        flags,
     {
       OstreeRepoFile *a_repof = (OstreeRepoFile*) a;
       OstreeRepoFile *b_repof = (OstreeRepoFile*) b;
-      
+
       if (strcmp (ostree_repo_file_tree_get_contents_checksum (a_repof),
                   ostree_repo_file_tree_get_contents_checksum (b_repof)) == 0)
         {
@@ -306,7 +353,7 @@ ostree_diff_dirs_with_options (OstreeDiffFlags        flags,
   g_clear_object (&child_a_info);
   g_clear_object (&child_b_info);
 
-  dir_enum = g_file_enumerate_children (a, OSTREE_GIO_FAST_QUERYINFO, 
+  dir_enum = g_file_enumerate_children (a, OSTREE_GIO_FAST_QUERYINFO,
                                         G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
                                         cancellable, error);
   if (!dir_enum)
@@ -337,7 +384,7 @@ ostree_diff_dirs_with_options (OstreeDiffFlags        flags,
           if (g_error_matches (temp_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
             {
               g_clear_error (&temp_error);
-              g_ptr_array_add (removed, g_object_ref (child_a));
+              g_ptr_array_add (job->removed, g_object_ref (child_a));
             }
           else
             {
@@ -357,8 +404,17 @@ ostree_diff_dirs_with_options (OstreeDiffFlags        flags,
             {
               OstreeDiffItem *diff_item = diff_item_new (child_a, child_a_info,
                                                    child_b, child_b_info, NULL, NULL);
-              
-              g_ptr_array_add (modified, diff_item);
+
+              g_ptr_array_add (job->modified, diff_item);
+            }
+          else if (child_a_type == G_FILE_TYPE_DIRECTORY)
+            {
+              DiffDirsJob *child_job =
+                diff_dirs_job_new (ctx, child_a, child_a_info, child_b, child_b_info);
+              g_ptr_array_add (job->children, child_job);
+
+              if (!diff_dirs_job_schedule (child_job, error))
+                goto out;
             }
           else
             {
@@ -367,20 +423,12 @@ ostree_diff_dirs_with_options (OstreeDiffFlags        flags,
               if (!diff_files (flags, child_a, child_a_info, child_b, child_b_info, &diff_item,
                                cancellable, error))
                 goto out;
-              
-              if (diff_item)
-                g_ptr_array_add (modified, diff_item); /* Transfer ownership */
 
-              if (child_a_type == G_FILE_TYPE_DIRECTORY)
-                {
-                  if (!ostree_diff_dirs_with_options (flags, child_a, child_b, modified,
-                                                      removed, added, options,
-                                                      cancellable, error))
-                    goto out;
-                }
+              if (diff_item)
+                g_ptr_array_add (job->modified, diff_item); /* Transfer ownership */
             }
         }
-      
+
       g_clear_object (&child_a_info);
     }
   if (temp_error != NULL)
@@ -390,7 +438,7 @@ ostree_diff_dirs_with_options (OstreeDiffFlags        flags,
     }
 
   g_clear_object (&dir_enum);
-  dir_enum = g_file_enumerate_children (b, OSTREE_GIO_FAST_QUERYINFO, 
+  dir_enum = g_file_enumerate_children (b, OSTREE_GIO_FAST_QUERYINFO,
                                         G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
                                         cancellable, error);
   if (!dir_enum)
@@ -419,10 +467,10 @@ ostree_diff_dirs_with_options (OstreeDiffFlags        flags,
           if (g_error_matches (temp_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
             {
               g_clear_error (&temp_error);
-              g_ptr_array_add (added, g_object_ref (child_b));
+              g_ptr_array_add (job->added, g_object_ref (child_b));
               if (g_file_info_get_file_type (child_b_info) == G_FILE_TYPE_DIRECTORY)
                 {
-                  if (!diff_add_dir_recurse (child_b, added, cancellable, error))
+                  if (!diff_add_dir_recurse (child_b, job->added, cancellable, error))
                     goto out;
                 }
             }
@@ -445,6 +493,502 @@ ostree_diff_dirs_with_options (OstreeDiffFlags        flags,
   return ret;
 }
 
+static void
+diff_dirs_worker (gpointer data,
+                  gpointer user_data)
+{
+  DiffDirsJob *job = data;
+  DiffDirsContext *ctx = job->ctx;
+  gboolean failed;
+  g_autoptr(GError) local_error = NULL;
+
+  /* After the first failure, just drain the queue */
+  g_mutex_lock (&ctx->lock);
+  failed = (ctx->error != NULL);
+  g_mutex_unlock (&ctx->lock);
+
+  if (!failed &&
+      !diff_dirs_job_execute (job, ctx->cancellable, &local_error))
+    {
+      g_mutex_lock (&ctx->lock);
+      if (ctx->error == NULL)
+        ctx->error = g_steal_pointer (&local_error);
+      g_mutex_unlock (&ctx->lock);
+    }
+
+  g_mutex_lock (&ctx->lock);
+  ctx->jobs_pending--;
+  if (ctx->jobs_pending == 0)
+    g_cond_signal (&ctx->cond);
+  g_mutex_unlock (&ctx->lock);
+}
+
+static gboolean
+diff_dirs_job_schedule (DiffDirsJob  *job,
+                        GError      **error)
+{
+  DiffDirsContext *ctx = job->ctx;
+
+  if (ctx->pool)
+    {
+      g_mutex_lock (&ctx->lock);
+      ctx->jobs_pending++;
+      g_mutex_unlock (&ctx->lock);
+      /* If thread creation fails the job stays queued for the
+       * existing workers, so this can't actually fail on us.
+       */
+      (void) g_thread_pool_push (ctx->pool, job, NULL);
+      return TRUE;
+    }
+
+  return diff_dirs_job_execute (job, ctx->cancellable, error);
+}
+
+/**
+ * ostree_diff_dirs:
+ * @flags: Flags
+ * @a: First directory path, or %NULL
+ * @b: First directory path
+ * @modified: (element-type OstreeDiffItem): Modified files
+ * @removed: (element-type Gio.File): Removed files
+ * @added: (element-type Gio.File): Added files
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Compute the difference between directory @a and @b as 3 separate
+ * sets of #OstreeDiffItem in @modified, @removed, and @added.
+ */
+/* Minimum percentage of an added file's bytes that must be covered by
+ * rollsum matches against a removed file for the pair to count as a
+ * rename; 100 only results from an identical checksum.
+ */
+#define DIFF_RENAME_SIMILARITY_PERCENT 50
+/* Bound the number of similarly-sized removed files evaluated per
+ * added file, so pathological trees (thousands of same-size files)
+ * stay O(n) in rollsum computations.
+ */
+#define DIFF_RENAME_MAX_CANDIDATES 8
+
+typedef struct {
+  GFile *file;       /* unowned; element of the removed/added array */
+  GFileInfo *info;   /* owned */
+  guint64 size;
+  gboolean claimed;
+} RenameEntry;
+
+typedef struct {
+  RenameEntry *from;  /* unowned */
+  RenameEntry *to;    /* unowned */
+  guint similarity;   /* percent, written by the worker */
+  GError *error;
+} RenameTask;
+
+static void
+rename_entry_free (gpointer data)
+{
+  RenameEntry *entry = data;
+  g_object_unref (entry->info);
+  g_free (entry);
+}
+
+static void
+rename_task_free (gpointer data)
+{
+  RenameTask *task = data;
+  g_clear_error (&task->error);
+  g_free (task);
+}
+
+static gint
+rename_entry_compare_size (gconstpointer ap,
+                           gconstpointer bp)
+{
+  const RenameEntry *a = *((RenameEntry**)ap);
+  const RenameEntry *b = *((RenameEntry**)bp);
+  if (a->size < b->size)
+    return -1;
+  else if (a->size > b->size)
+    return 1;
+  return 0;
+}
+
+static gint
+rename_task_compare_similarity (gconstpointer ap,
+                                gconstpointer bp)
+{
+  const RenameTask *a = *((RenameTask**)ap);
+  const RenameTask *b = *((RenameTask**)bp);
+  if (a->similarity > b->similarity)
+    return -1;
+  else if (a->similarity < b->similarity)
+    return 1;
+  return 0;
+}
+
+static GBytes *
+rename_read_file_bytes (GFile         *f,
+                        GCancellable  *cancellable,
+                        GError       **error)
+{
+  g_autoptr(GInputStream) in = (GInputStream*)g_file_read (f, cancellable, error);
+  if (!in)
+    return NULL;
+
+  g_autoptr(GOutputStream) out = g_memory_output_stream_new_resizable ();
+  if (g_output_stream_splice (out, in,
+                              G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE | G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                              cancellable, error) < 0)
+    return NULL;
+
+  return g_memory_output_stream_steal_as_bytes ((GMemoryOutputStream*)out);
+}
+
+/* Worker for one candidate (removed, added) pair: read both files and
+ * score how much of the added file's content the rollsum chunker can
+ * find in the removed one.
+ */
+static void
+rename_detect_worker (gpointer item,
+                      gpointer user_data)
+{
+  RenameTask *task = item;
+  GCancellable *cancellable = user_data;
+
+  g_autoptr(GBytes) from_bytes = rename_read_file_bytes (task->from->file, cancellable, &task->error);
+  if (!from_bytes)
+    return;
+  g_autoptr(GBytes) to_bytes = rename_read_file_bytes (task->to->file, cancellable, &task->error);
+  if (!to_bytes)
+    return;
+
+  const gsize to_size = g_bytes_get_size (to_bytes);
+  if (to_size == 0)
+    return;
+
+  g_autoptr(OstreeRollsumMatches) matches = _ostree_compute_rollsum_matches (from_bytes, to_bytes);
+  task->similarity = (guint)((matches->match_size * 100) / to_size);
+}
+
+static gboolean
+rename_gather_entries (OstreeDiffFlags  flags,
+                       GPtrArray       *files,
+                       GPtrArray       *entries,
+                       GCancellable    *cancellable,
+                       GError         **error)
+{
+  for (guint i = 0; i < files->len; i++)
+    {
+      GFile *file = files->pdata[i];
+      g_autoptr(GFileInfo) info =
+        g_file_query_info (file, OSTREE_GIO_FAST_QUERYINFO,
+                           G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                           cancellable, error);
+      if (!info)
+        return FALSE;
+      if (g_file_info_get_file_type (info) != G_FILE_TYPE_REGULAR)
+        continue;
+
+      RenameEntry *entry = g_new0 (RenameEntry, 1);
+      entry->file = file;
+      entry->info = g_steal_pointer (&info);
+      entry->size = g_file_info_get_size (entry->info);
+      g_ptr_array_add (entries, entry);
+    }
+  return TRUE;
+}
+
+/* Pair one (removed, added) match up as a rename: it becomes a
+ * modified entry whose src and target paths differ, and both endpoints
+ * leave the removed/added arrays.
+ */
+static gboolean
+rename_emit_pair (OstreeDiffFlags  flags,
+                  RenameEntry     *from,
+                  RenameEntry     *to,
+                  GPtrArray       *modified,
+                  GPtrArray       *removed,
+                  GPtrArray       *added,
+                  GCancellable    *cancellable,
+                  GError         **error)
+{
+  g_autofree char *from_checksum = NULL;
+  g_autofree char *to_checksum = NULL;
+
+  if (!get_file_checksum (flags, from->file, from->info, &from_checksum,
+                          cancellable, error))
+    return FALSE;
+  if (!get_file_checksum (flags, to->file, to->info, &to_checksum,
+                          cancellable, error))
+    return FALSE;
+
+  OstreeDiffItem *diff = diff_item_new (from->file, from->info,
+                                        to->file, to->info,
+                                        from_checksum, to_checksum);
+  g_ptr_array_add (modified, diff);
+
+  from->claimed = TRUE;
+  to->claimed = TRUE;
+  g_ptr_array_remove (removed, from->file);
+  g_ptr_array_remove (added, to->file);
+  return TRUE;
+}
+
+/* Opt-in pass for %OSTREE_DIFF_FLAGS_DETECT_RENAMES: pair removed and
+ * added regular files by content similarity so moved (and moved plus
+ * lightly edited) files show up as renames rather than a full
+ * deletion/addition.  Identical content is matched by checksum
+ * without any reads; the rest is scored with the rollsum chunker
+ * against similarly-sized candidates on a worker pool.
+ */
+static gboolean
+diff_detect_renames (OstreeDiffFlags  flags,
+                     GPtrArray       *modified,
+                     GPtrArray       *removed,
+                     GPtrArray       *added,
+                     GCancellable    *cancellable,
+                     GError         **error)
+{
+  g_autoptr(GPtrArray) removed_entries = g_ptr_array_new_with_free_func (rename_entry_free);
+  g_autoptr(GPtrArray) added_entries = g_ptr_array_new_with_free_func (rename_entry_free);
+
+  if (!rename_gather_entries (flags, removed, removed_entries, cancellable, error))
+    return FALSE;
+  if (!rename_gather_entries (flags, added, added_entries, cancellable, error))
+    return FALSE;
+
+  if (removed_entries->len == 0 || added_entries->len == 0)
+    return TRUE;
+
+  /* Exact renames first: content objects are checksummed already, so
+   * when both sides live in a repository this costs no I/O at all.
+   */
+  { g_autoptr(GHashTable) by_checksum = g_hash_table_new (g_str_hash, g_str_equal);
+    for (guint i = 0; i < removed_entries->len; i++)
+      {
+        RenameEntry *entry = removed_entries->pdata[i];
+        if (OSTREE_IS_REPO_FILE (entry->file))
+          {
+            const char *checksum = ostree_repo_file_get_checksum ((OstreeRepoFile*)entry->file);
+            if (!g_hash_table_contains (by_checksum, checksum))
+              g_hash_table_insert (by_checksum, (char*)checksum, entry);
+          }
+      }
+    for (guint i = 0; i < added_entries->len; i++)
+      {
+        RenameEntry *entry = added_entries->pdata[i];
+        if (!OSTREE_IS_REPO_FILE (entry->file))
+          continue;
+        RenameEntry *from =
+          g_hash_table_lookup (by_checksum,
+                               ostree_repo_file_get_checksum ((OstreeRepoFile*)entry->file));
+        if (from == NULL || from->claimed)
+          continue;
+        if (!rename_emit_pair (flags, from, entry, modified, removed, added,
+                               cancellable, error))
+          return FALSE;
+      }
+  }
+
+  /* Score the remainder against removed files of comparable size.  A
+   * removed file smaller than half the added one can never reach the
+   * similarity threshold, and one more than twice as large is a poor
+   * rename candidate, so the window prunes most pairs up front.
+   */
+  g_ptr_array_sort (removed_entries, rename_entry_compare_size);
+  g_ptr_array_sort (added_entries, rename_entry_compare_size);
+
+  g_autoptr(GPtrArray) tasks = g_ptr_array_new_with_free_func (rename_task_free);
+  guint lower = 0;
+  for (guint i = 0; i < added_entries->len; i++)
+    {
+      RenameEntry *to = added_entries->pdata[i];
+      if (to->claimed || to->size == 0)
+        continue;
+
+      const guint64 min_size = to->size / 2;
+      const guint64 max_size = to->size * 2;
+
+      while (lower < removed_entries->len
+             && ((RenameEntry*)removed_entries->pdata[lower])->size < min_size)
+        lower++;
+
+      guint n_candidates = 0;
+      for (guint j = lower; j < removed_entries->len && n_candidates < DIFF_RENAME_MAX_CANDIDATES; j++)
+        {
+          RenameEntry *from = removed_entries->pdata[j];
+          if (from->size > max_size)
+            break;
+          if (from->claimed)
+            continue;
+
+          RenameTask *task = g_new0 (RenameTask, 1);
+          task->from = from;
+          task->to = to;
+          g_ptr_array_add (tasks, task);
+          n_candidates++;
+        }
+    }
+
+  if (tasks->len > 0)
+    {
+      /* Parallelism is best-effort; on failure just run inline */
+      GThreadPool *pool = NULL;
+      const guint n_threads = g_get_num_processors ();
+      if (n_threads > 1)
+        pool = g_thread_pool_new (rename_detect_worker, cancellable, n_threads, FALSE, NULL);
+
+      for (guint i = 0; i < tasks->len; i++)
+        {
+          if (pool)
+            g_thread_pool_push (pool, tasks->pdata[i], NULL);
+          else
+            rename_detect_worker (tasks->pdata[i], cancellable);
+        }
+      if (pool)
+        g_thread_pool_free (pool, FALSE, TRUE);
+
+      for (guint i = 0; i < tasks->len; i++)
+        {
+          RenameTask *task = tasks->pdata[i];
+          if (task->error)
+            {
+              g_propagate_error (error, g_steal_pointer (&task->error));
+              return FALSE;
+            }
+        }
+
+      /* Best matches win; each endpoint participates in one rename */
+      g_ptr_array_sort (tasks, rename_task_compare_similarity);
+      for (guint i = 0; i < tasks->len; i++)
+        {
+          RenameTask *task = tasks->pdata[i];
+          if (task->similarity < DIFF_RENAME_SIMILARITY_PERCENT)
+            break;
+          if (task->from->claimed || task->to->claimed)
+            continue;
+          if (!rename_emit_pair (flags, task->from, task->to, modified,
+                                 removed, added, cancellable, error))
+            return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+gboolean
+ostree_diff_dirs (OstreeDiffFlags flags,
+                  GFile          *a,
+                  GFile          *b,
+                  GPtrArray      *modified,
+                  GPtrArray      *removed,
+                  GPtrArray      *added,
+                  GCancellable   *cancellable,
+                  GError        **error)
+{
+  return ostree_diff_dirs_with_options (flags, a, b, modified,
+                                        removed, added, NULL,
+                                        cancellable, error);
+}
+
+/**
+ * ostree_diff_dirs_with_options:
+ * @flags: Flags
+ * @a: First directory path, or %NULL
+ * @b: First directory path
+ * @modified: (element-type OstreeDiffItem): Modified files
+ * @removed: (element-type Gio.File): Removed files
+ * @added: (element-type Gio.File): Added files
+ * @cancellable: Cancellable
+ * @options: (allow-none): Options
+ * @error: Error
+ *
+ * Compute the difference between directory @a and @b as 3 separate
+ * sets of #OstreeDiffItem in @modified, @removed, and @added.
+ *
+ * Subdirectories whose tree checksums match are skipped entirely, and
+ * differing subtrees are compared on a pool of worker threads.
+ */
+gboolean
+ostree_diff_dirs_with_options (OstreeDiffFlags        flags,
+                               GFile                 *a,
+                               GFile                 *b,
+                               GPtrArray             *modified,
+                               GPtrArray             *removed,
+                               GPtrArray             *added,
+                               OstreeDiffDirsOptions *options,
+                               GCancellable          *cancellable,
+                               GError               **error)
+{
+  gboolean ret = FALSE;
+  OstreeDiffDirsOptions default_opts = OSTREE_DIFF_DIRS_OPTIONS_INIT;
+  DiffDirsContext ctx = { 0, };
+  DiffDirsJob *root = NULL;
+
+  if (!options)
+    options = &default_opts;
+
+  /* If we're diffing versus a repo, and either of them have xattrs disabled,
+   * then disable for both.
+   */
+  OstreeRepo *repo;
+  if (OSTREE_IS_REPO_FILE (a))
+    repo = ostree_repo_file_get_repo ((OstreeRepoFile*)a);
+  else if (OSTREE_IS_REPO_FILE (b))
+    repo = ostree_repo_file_get_repo ((OstreeRepoFile*)b);
+  else
+    repo = NULL;
+  if (repo != NULL && repo->disable_xattrs)
+    flags |= OSTREE_DIFF_FLAGS_IGNORE_XATTRS;
+
+  if (a == NULL)
+    return diff_add_dir_recurse (b, added, cancellable, error);
+
+  ctx.flags = flags;
+  ctx.options = options;
+  ctx.cancellable = cancellable;
+  g_mutex_init (&ctx.lock);
+  g_cond_init (&ctx.cond);
+
+  /* Parallelism is best-effort; on failure (or one CPU) just
+   * run every job inline.
+   */
+  const guint n_threads = g_get_num_processors ();
+  if (n_threads > 1)
+    ctx.pool = g_thread_pool_new (diff_dirs_worker, &ctx, n_threads, FALSE, NULL);
+
+  root = diff_dirs_job_new (&ctx, a, NULL, b, NULL);
+  ret = diff_dirs_job_schedule (root, error);
+
+  if (ctx.pool)
+    {
+      /* Jobs spawn further jobs, so wait for quiescence rather than
+       * just an empty queue.
+       */
+      g_mutex_lock (&ctx.lock);
+      while (ctx.jobs_pending > 0)
+        g_cond_wait (&ctx.cond, &ctx.lock);
+      g_mutex_unlock (&ctx.lock);
+      g_thread_pool_free (ctx.pool, FALSE, TRUE);
+
+      if (ctx.error)
+        {
+          ret = FALSE;
+          g_propagate_error (error, g_steal_pointer (&ctx.error));
+        }
+    }
+
+  if (ret)
+    diff_dirs_job_splice (root, modified, removed, added);
+
+  if (ret && (flags & OSTREE_DIFF_FLAGS_DETECT_RENAMES) > 0)
+    ret = diff_detect_renames (flags, modified, removed, added, cancellable, error);
+
+  diff_dirs_job_free (root);
+  g_mutex_clear (&ctx.lock);
+  g_cond_clear (&ctx.cond);
+  return ret;
+}
+
 static void
 print_diff_item (char        prefix,
                  GFile      *base,
@@ -483,6 +1027,19 @@ ostree_diff_print (GFile          *a,
   for (i = 0; i < modified->len; i++)
     {
       OstreeDiffItem *diff = modified->pdata[i];
+
+      /* Rename detection emits modified entries whose paths differ */
+      if (diff->src && diff->target)
+        {
+          g_autofree char *src_path = g_file_get_relative_path (a, diff->src);
+          g_autofree char *target_path = g_file_get_relative_path (b, diff->target);
+          if (src_path && target_path && strcmp (src_path, target_path) != 0)
+            {
+              g_print ("R    %s -> %s\n", src_path, target_path);
+              continue;
+            }
+        }
+
       print_diff_item ('M', a, diff->src);
     }
   for (i = 0; i < removed->len; i++)
@@ -32,7 +32,11 @@ G_BEGIN_DECLS
  */
 typedef enum {
   OSTREE_DIFF_FLAGS_NONE = 0,
-  OSTREE_DIFF_FLAGS_IGNORE_XATTRS = (1 << 0)
+  OSTREE_DIFF_FLAGS_IGNORE_XATTRS = (1 << 0),
+  /* Pair removed and added files by content similarity; a detected
+   * rename becomes a modified entry whose src and target paths differ.
+   */
+  OSTREE_DIFF_FLAGS_DETECT_RENAMES = (1 << 1)
 } OstreeDiffFlags;
 
 /**
@@ -48,6 +48,7 @@
 #include "ostree-fetcher-util.h"
 #include "ostree-enumtypes.h"
 #include "ostree-repo-private.h"
+#include "ostree-tracepoints-private.h"
 #include "otutil.h"
 
 #include "ostree-soup-uri.h"
@@ -77,14 +78,24 @@ struct OstreeFetcher
   struct curl_slist *extra_headers;
   int tmpdir_dfd;
 
+  /* Persistent per-remote DNS cache; see _ostree_fetcher_set_dns_cache() */
+  char *dns_cache_path;
+  GHashTable *dns_cache;  /* char * "host:port" → DnsCacheEntry */
+  gboolean dns_cache_dirty;
+  struct curl_slist *resolve_list;
+
   GMainContext *mainctx;
   CURLM *multi;
+  /* Shares DNS answers and negotiated TLS sessions across the easy
+   * handles, so only the first request to a host pays for setup. */
+  CURLSH *share;
   GSource *timer_event;
   int curl_running;
   GHashTable *outstanding_requests; /* Set<GTask> */
   GHashTable *sockets; /* Set<SockInfo> */
 
   guint64 bytes_transferred;
+  OstreeFetcherRequestStats request_stats;
 };
 
 /* Information associated with a request */
@@ -96,18 +107,43 @@ struct FetcherRequest {
   char *filename;
   guint64 current_size;
   guint64 max_size;
+  /* Partial-download state for Range-based resume; see initiate_next_curl_request() */
+  char *partial_path;
+  guint64 resume_from;
   OstreeFetcherRequestFlags flags;
+  char *if_none_match;  /* request ETag */
+  guint64 if_modified_since;  /* seconds since the epoch */
   gboolean is_membuf;
+  /* Whether we've fallocate()d the transfer size into the tmpfile */
+  gboolean tmpf_allocated;
   GError *caught_write_error;
   GLnxTmpfile tmpf;
+  /* Streaming SHA256 of the downloaded bytes; only initialized when
+   * OSTREE_FETCHER_REQUEST_COMPUTE_CHECKSUM was given */
+  OtChecksum checksum;
   GString *output_buf;
+  gboolean out_not_modified;  /* TRUE if the server gave a 304 Not Modified response */
+  char *out_etag;  /* response ETag */
+  guint64 out_last_modified;  /* response Last-Modified, seconds since the epoch */
 
+  struct curl_slist *req_headers;
   CURL *easy;
   char error[CURL_ERROR_SIZE];
 
   OstreeFetcher *fetcher;
 };
 
+/* A resolved server address remembered across processes */
+typedef struct {
+  char *addr;
+  guint64 expires;  /* seconds since the epoch */
+} DnsCacheEntry;
+
+/* Without access to the resolver's actual TTL (curl doesn't expose it),
+ * cap how long a persisted answer is trusted.
+ */
+#define DNS_CACHE_TTL_SECS (10 * 60)
+
 /* Information associated with a specific socket */
 struct SockInfo {
   guint refcount;
@@ -163,14 +199,40 @@ _ostree_fetcher_get_property (GObject    *object,
     }
 }
 
+/* Flush learned server addresses back to the per-remote cache file.
+ * Best-effort; losing the file just means one extra DNS lookup.
+ */
+static void
+dns_cache_save (OstreeFetcher *self)
+{
+  if (!self->dns_cache_dirty || self->dns_cache_path == NULL)
+    return;
+
+  const guint64 now = g_get_real_time () / G_USEC_PER_SEC;
+  g_autoptr(GString) buf = g_string_new ("");
+  GLNX_HASH_TABLE_FOREACH_KV (self->dns_cache, const char*, hostport, DnsCacheEntry*, entry)
+    {
+      if (entry->expires <= now)
+        continue;
+      g_string_append_printf (buf, "%s %s %" G_GUINT64_FORMAT "\n",
+                              hostport, entry->addr, entry->expires);
+    }
+  (void) g_file_set_contents (self->dns_cache_path, buf->str, buf->len, NULL);
+  self->dns_cache_dirty = FALSE;
+}
+
 static void
 _ostree_fetcher_finalize (GObject *object)
 {
   OstreeFetcher *self = OSTREE_FETCHER (object);
 
+  dns_cache_save (self);
   g_free (self->remote_name);
   g_free (self->cookie_jar_path);
   g_free (self->proxy);
+  g_free (self->dns_cache_path);
+  g_clear_pointer (&self->dns_cache, g_hash_table_unref);
+  g_clear_pointer (&self->resolve_list, (GDestroyNotify)curl_slist_free_all);
   g_assert_cmpint (g_hash_table_size (self->outstanding_requests), ==, 0);
   g_clear_pointer (&self->extra_headers, (GDestroyNotify)curl_slist_free_all);
   g_hash_table_unref (self->outstanding_requests);
@@ -179,6 +241,8 @@ _ostree_fetcher_finalize (GObject *object)
   if (self->mainctx)
     g_main_context_unref (self->mainctx);
   curl_multi_cleanup (self->multi);
+  if (self->share != NULL)
+    curl_share_cleanup (self->share);
 
   G_OBJECT_CLASS (_ostree_fetcher_parent_class)->finalize (object);
 }
@@ -233,6 +297,13 @@ _ostree_fetcher_init (OstreeFetcher *self)
 #if CURL_AT_LEAST_VERSION(7, 51, 0)
   curl_multi_setopt (self->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
 #endif
+  /* We're single threaded, so no lock callbacks are needed */
+  self->share = curl_share_init ();
+  if (self->share != NULL)
+    {
+      curl_share_setopt (self->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+      curl_share_setopt (self->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
 }
 
 
@@ -294,6 +365,7 @@ check_multi_info (OstreeFetcher *fetcher)
       const char *eff_url;
       gboolean is_file;
       gboolean continued_request = FALSE;
+      gboolean retry_request = FALSE;
 
       if (msg->msg != CURLMSG_DONE)
         continue;
@@ -308,6 +380,70 @@ check_multi_info (OstreeFetcher *fetcher)
 
       req = g_task_get_task_data (task);
 
+      ostree_probe3 (fetch_done, eff_url, (guint64)req->current_size, (int)curlres);
+
+      /* Sample per-request timing for successful HTTP transfers; this
+       * feeds the adaptive request window in the pull code.
+       */
+      if (!is_file && curlres == CURLE_OK && req->caught_write_error == NULL)
+        {
+          double ttfb_secs = 0;
+          double speed = 0;
+          if (curl_easy_getinfo (easy, CURLINFO_STARTTRANSFER_TIME, &ttfb_secs) == CURLE_OK
+              && curl_easy_getinfo (easy, CURLINFO_SPEED_DOWNLOAD, &speed) == CURLE_OK
+              && ttfb_secs > 0)
+            {
+              OstreeFetcherRequestStats *stats = &fetcher->request_stats;
+              const guint64 ttfb_usecs = (guint64)(ttfb_secs * G_USEC_PER_SEC);
+              const guint64 bytes_per_sec = (guint64)speed;
+              if (stats->n_completed == 0)
+                {
+                  stats->ewma_ttfb_usecs = ttfb_usecs;
+                  stats->min_ttfb_usecs = ttfb_usecs;
+                  stats->ewma_bytes_per_sec = bytes_per_sec;
+                }
+              else
+                {
+                  /* TCP-style smoothing, alpha = 1/8 */
+                  stats->ewma_ttfb_usecs += ((gint64)ttfb_usecs - (gint64)stats->ewma_ttfb_usecs) / 8;
+                  stats->min_ttfb_usecs = MIN (stats->min_ttfb_usecs, ttfb_usecs);
+                  if (bytes_per_sec > 0)
+                    stats->ewma_bytes_per_sec += ((gint64)bytes_per_sec - (gint64)stats->ewma_bytes_per_sec) / 8;
+                }
+              stats->n_completed++;
+            }
+        }
+
+      /* Remember which address the server resolved to, for preloading
+       * into the next process; see _ostree_fetcher_set_dns_cache().
+       * Skip proxied connections, where the primary IP is the proxy's.
+       */
+      if (!is_file && curlres == CURLE_OK && fetcher->dns_cache != NULL
+          && fetcher->proxy == NULL)
+        {
+          char *primary_ip = NULL;
+          long primary_port = 0;
+          if (curl_easy_getinfo (easy, CURLINFO_PRIMARY_IP, &primary_ip) == CURLE_OK
+              && curl_easy_getinfo (easy, CURLINFO_PRIMARY_PORT, &primary_port) == CURLE_OK
+              && primary_ip != NULL && primary_ip[0] != '\0' && primary_port > 0)
+            {
+              SoupURI *uri = soup_uri_new (eff_url);
+              const char *host = uri != NULL ? soup_uri_get_host (uri) : NULL;
+              if (host != NULL)
+                {
+                  DnsCacheEntry *entry = g_new0 (DnsCacheEntry, 1);
+                  entry->addr = g_strdup (primary_ip);
+                  entry->expires = g_get_real_time () / G_USEC_PER_SEC + DNS_CACHE_TTL_SECS;
+                  g_hash_table_replace (fetcher->dns_cache,
+                                        g_strdup_printf ("%s:%ld", host, primary_port),
+                                        entry);
+                  fetcher->dns_cache_dirty = TRUE;
+                }
+              if (uri != NULL)
+                soup_uri_free (uri);
+            }
+        }
+
       if (req->caught_write_error)
         g_task_return_error (task, g_steal_pointer (&req->caught_write_error));
       else if (curlres != CURLE_OK)
@@ -319,8 +455,26 @@ check_multi_info (OstreeFetcher *fetcher)
                                        "%s",
                                          curl_easy_strerror (curlres));
             }
+          else if (curlres == CURLE_RANGE_ERROR && req->resume_from > 0)
+            {
+              /* The server can't resume our partial download; restart this
+               * mirror from scratch.
+               */
+              (void) unlinkat (fetcher->tmpdir_dfd, req->partial_path, 0);
+              glnx_tmpfile_clear (&req->tmpf);
+              req->resume_from = 0;
+              retry_request = TRUE;
+            }
           else
             {
+              /* Keep whatever we downloaded, so that a later attempt at the
+               * same URL can resume with a Range request.
+               */
+              if (!req->is_membuf && req->tmpf.initialized && req->partial_path != NULL
+                  && fchmod (req->tmpf.fd, 0600) == 0)
+                (void) glnx_link_tmpfile_at (&req->tmpf, GLNX_LINK_TMPFILE_REPLACE,
+                                             fetcher->tmpdir_dfd, req->partial_path, NULL);
+
               g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED, "[%u] %s",
                                        curlres,
                                        curl_easy_strerror (curlres));
@@ -332,7 +486,18 @@ check_multi_info (OstreeFetcher *fetcher)
       else
         {
           curl_easy_getinfo (easy, CURLINFO_RESPONSE_CODE, &response);
-          if (!is_file && !(response >= 200 && response < 300))
+          /* 416 with a resume offset means the partial file was already
+           * complete; treat it as success.
+           */
+          const gboolean range_already_complete =
+            (response == 416 && req->resume_from > 0 && !req->is_membuf);
+          /* A 304 in answer to one of our conditional requests just means
+           * the version we have cached locally is still current.
+           */
+          const gboolean is_not_modified =
+            (response == 304 && (req->if_none_match != NULL || req->if_modified_since > 0));
+          if (!is_file && !(response >= 200 && response < 300)
+              && !range_already_complete && !is_not_modified)
             {
               GIOErrorEnum giocode;
 
@@ -368,6 +533,14 @@ check_multi_info (OstreeFetcher *fetcher)
           else if (req->is_membuf)
             {
               GBytes *ret;
+              req->out_not_modified = is_not_modified;
+              if (!is_file)
+                {
+                  long filetime;
+                  if (curl_easy_getinfo (easy, CURLINFO_FILETIME, &filetime) == CURLE_OK
+                      && filetime >= 0)
+                    req->out_last_modified = filetime;
+                }
               if ((req->flags & OSTREE_FETCHER_REQUEST_NUL_TERMINATION) > 0)
                 g_string_append_c (req->output_buf, '\0');
               ret = g_string_free_to_bytes (req->output_buf);
@@ -398,13 +571,19 @@ check_multi_info (OstreeFetcher *fetcher)
                 g_task_return_error (task, g_steal_pointer (&local_error));
               else
                 {
+                  if (req->partial_path != NULL)
+                    (void) unlinkat (fetcher->tmpdir_dfd, req->partial_path, 0);
                   g_task_return_pointer (task, g_steal_pointer (&tmpfile_path), g_free);
                 }
             }
         }
 
       curl_multi_remove_handle (fetcher->multi, easy);
-      if (continued_request)
+      if (retry_request)
+        {
+          initiate_next_curl_request (req, task);
+        }
+      else if (continued_request)
         {
           req->idx++;
           initiate_next_curl_request (req, task);
@@ -415,6 +594,7 @@ check_multi_info (OstreeFetcher *fetcher)
           if (g_hash_table_size (fetcher->outstanding_requests) == 0)
             {
               g_clear_pointer (&fetcher->mainctx, g_main_context_unref);
+              dns_cache_save (fetcher);
             }
         }
     }
@@ -578,11 +758,29 @@ write_cb (void *ptr, size_t size, size_t nmemb, void *data)
       if (!ensure_tmpfile (req, &req->caught_write_error))
         return -1;
       g_assert (req->tmpf.fd >= 0);
+      /* On the first write of a transfer, preallocate the full download
+       * size (when the server told us via Content-Length), so the object
+       * lands in contiguous extents rather than being grown write by
+       * write.  Best-effort; unsupported filesystems are skipped inside
+       * glnx_try_fallocate().
+       */
+      if (!req->tmpf_allocated)
+        {
+          double content_length = -1;
+          req->tmpf_allocated = TRUE;
+          curl_easy_getinfo (req->easy, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &content_length);
+          if (content_length > 0
+              && !glnx_try_fallocate (req->tmpf.fd, req->current_size, (goffset)content_length,
+                                      &req->caught_write_error))
+            return -1;
+        }
       if (glnx_loop_write (req->tmpf.fd, ptr, realsize) < 0)
         {
           glnx_set_error_from_errno (&req->caught_write_error);
           return -1;
         }
+      if (req->checksum.initialized)
+        ot_checksum_update (&req->checksum, ptr, realsize);
     }
 
   req->current_size += realsize;
@@ -604,6 +802,30 @@ prog_cb (void *p, double dltotal, double dlnow, double ult, double uln)
   return 0;
 }
 
+/* CURLOPT_HEADERFUNCTION.  We only parse out the ETag response header, so
+ * that callers can issue conditional requests next time; everything else
+ * comes via curl_easy_getinfo(). */
+static size_t
+response_header_cb (const char *buffer, size_t size, size_t nitems, void *data)
+{
+  const size_t real_size = size * nitems;
+  GTask *task = G_TASK (data);
+  FetcherRequest *req = g_task_get_task_data (task);
+  const char *etag_header = "ETag: ";
+  const size_t etag_header_len = strlen (etag_header);
+
+  if (real_size > etag_header_len &&
+      g_ascii_strncasecmp (buffer, etag_header, etag_header_len) == 0)
+    {
+      char *etag = g_strndup (buffer + etag_header_len, real_size - etag_header_len);
+      g_strchomp (etag);
+      g_free (req->out_etag);
+      req->out_etag = etag;
+    }
+
+  return real_size;
+}
+
 static void
 request_unref (FetcherRequest *req)
 {
@@ -612,10 +834,15 @@ request_unref (FetcherRequest *req)
 
   g_ptr_array_unref (req->mirrorlist);
   g_free (req->filename);
+  g_free (req->partial_path);
+  g_free (req->if_none_match);
   g_clear_error (&req->caught_write_error);
   glnx_tmpfile_clear (&req->tmpf);
+  ot_checksum_clear (&req->checksum);
   if (req->output_buf)
     g_string_free (req->output_buf, TRUE);
+  g_free (req->out_etag);
+  g_clear_pointer (&req->req_headers, (GDestroyNotify)curl_slist_free_all);
   curl_easy_cleanup (req->easy);
 
   g_free (req);
@@ -643,6 +870,61 @@ _ostree_fetcher_set_cookie_jar (OstreeFetcher *self,
   self->cookie_jar_path = g_strdup (jar_path);
 }
 
+static void
+dns_cache_entry_free (gpointer data)
+{
+  DnsCacheEntry *entry = data;
+  g_free (entry->addr);
+  g_free (entry);
+}
+
+/* Enable the persistent DNS cache at @path.  Unexpired answers from a
+ * previous process are preloaded into curl's resolver cache, so the
+ * first connection of a fresh process skips the DNS round trip;
+ * addresses learned during this session are written back when the
+ * fetcher goes idle.
+ */
+void
+_ostree_fetcher_set_dns_cache (OstreeFetcher *self,
+                               const char    *path)
+{
+  g_free (self->dns_cache_path);
+  self->dns_cache_path = g_strdup (path);
+  g_clear_pointer (&self->resolve_list, (GDestroyNotify)curl_slist_free_all);
+  if (self->dns_cache == NULL)
+    self->dns_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                             g_free, dns_cache_entry_free);
+  else
+    g_hash_table_remove_all (self->dns_cache);
+  self->dns_cache_dirty = FALSE;
+
+  g_autofree char *contents = NULL;
+  if (!g_file_get_contents (path, &contents, NULL, NULL))
+    return;
+
+  const guint64 now = g_get_real_time () / G_USEC_PER_SEC;
+  g_auto(GStrv) lines = g_strsplit (contents, "\n", -1);
+  for (char **iter = lines; iter && *iter; iter++)
+    {
+      /* "host:port address expiry" */
+      g_auto(GStrv) fields = g_strsplit (*iter, " ", -1);
+      if (g_strv_length (fields) != 3)
+        continue;
+      const guint64 expires = g_ascii_strtoull (fields[2], NULL, 10);
+      if (expires <= now)
+        continue;
+
+      DnsCacheEntry *entry = g_new0 (DnsCacheEntry, 1);
+      entry->addr = g_strdup (fields[1]);
+      entry->expires = expires;
+      g_hash_table_replace (self->dns_cache, g_strdup (fields[0]), entry);
+
+      { g_autofree char *resolve = g_strdup_printf ("%s:%s", fields[0], fields[1]);
+        self->resolve_list = curl_slist_append (self->resolve_list, resolve);
+      }
+    }
+}
+
 void
 _ostree_fetcher_set_client_cert (OstreeFetcher   *self,
                                  const char      *cert_path,
@@ -674,6 +956,9 @@ _ostree_fetcher_set_extra_headers (OstreeFetcher *self,
 
   g_clear_pointer (&self->extra_headers, (GDestroyNotify)curl_slist_free_all);
 
+  if (extra_headers == NULL)
+    return;
+
   g_variant_iter_init (&viter, extra_headers);
   while (g_variant_iter_loop (&viter, "(&s&s)", &key, &value))
     {
@@ -720,11 +1005,89 @@ initiate_next_curl_request (FetcherRequest *req,
 
   { g_autofree char *uri = request_get_uri (req, req->idx);
     curl_easy_setopt (req->easy, CURLOPT_URL, uri);
+    ostree_probe1 (fetch_start, uri);
+
+    /* For tmpfile requests, try to resume from a partial download left
+     * behind by a previously failed attempt at the same URL; see the
+     * persistence in check_multi_info().  This is best-effort - any problem
+     * just falls back to fetching from byte 0.
+     */
+    req->resume_from = 0;
+    req->tmpf_allocated = FALSE;
+    if (!req->is_membuf)
+      {
+        g_free (req->partial_path);
+        { g_autofree char *uri_sha256 =
+            g_compute_checksum_for_string (G_CHECKSUM_SHA256, uri, strlen (uri));
+          req->partial_path = g_strconcat (uri_sha256, ".partial", NULL);
+        }
+
+        struct stat stbuf;
+        if (!req->tmpf.initialized
+            && fstatat (self->tmpdir_dfd, req->partial_path, &stbuf, 0) == 0
+            && stbuf.st_size > 0)
+          {
+            glnx_fd_close int partial_fd = -1;
+            if (glnx_openat_rdonly (self->tmpdir_dfd, req->partial_path, TRUE, &partial_fd, NULL)
+                && ensure_tmpfile (req, NULL)
+                && glnx_regfile_copy_bytes (partial_fd, req->tmpf.fd, (off_t)stbuf.st_size, TRUE) >= 0
+                && lseek (req->tmpf.fd, 0, SEEK_END) == stbuf.st_size)
+              req->resume_from = stbuf.st_size;
+            else
+              glnx_tmpfile_clear (&req->tmpf);
+          }
+        req->current_size = req->resume_from;
+      }
   }
 
+  /* (Re)start the streaming checksum for this attempt; if we adopted
+   * partial bytes above, fold them in so the digest covers the whole
+   * file.  Any problem just disables the optimization - the caller then
+   * falls back to verifying the tmpfile itself.
+   */
+  ot_checksum_clear (&req->checksum);
+  if ((req->flags & OSTREE_FETCHER_REQUEST_COMPUTE_CHECKSUM) > 0 && !req->is_membuf)
+    {
+      ot_checksum_init (&req->checksum);
+      if (req->tmpf.initialized
+          && !ot_checksum_update_from_fd (&req->checksum, req->tmpf.fd, NULL))
+        ot_checksum_clear (&req->checksum);
+    }
+
   curl_easy_setopt (req->easy, CURLOPT_USERAGENT, "ostree ");
-  if (self->extra_headers)
-    curl_easy_setopt (req->easy, CURLOPT_HTTPHEADER, self->extra_headers);
+
+  if (self->share != NULL)
+    curl_easy_setopt (req->easy, CURLOPT_SHARE, self->share);
+  if (self->resolve_list != NULL)
+    curl_easy_setopt (req->easy, CURLOPT_RESOLVE, self->resolve_list);
+
+  /* Rebuild the per-request header list from scratch, since we may be
+   * retrying on another mirror. */
+  g_clear_pointer (&req->req_headers, (GDestroyNotify)curl_slist_free_all);
+  for (struct curl_slist *h = self->extra_headers; h != NULL; h = h->next)
+    req->req_headers = curl_slist_append (req->req_headers, h->data);
+  if (req->if_none_match != NULL)
+    {
+      g_autofree char *if_none_match = g_strconcat ("If-None-Match: ", req->if_none_match, NULL);
+      req->req_headers = curl_slist_append (req->req_headers, if_none_match);
+    }
+  if (req->req_headers != NULL)
+    curl_easy_setopt (req->easy, CURLOPT_HTTPHEADER, req->req_headers);
+
+  if (req->if_modified_since > 0)
+    {
+      curl_easy_setopt (req->easy, CURLOPT_TIMECONDITION, CURL_TIMECOND_IFMODSINCE);
+      curl_easy_setopt (req->easy, CURLOPT_TIMEVALUE, (long)req->if_modified_since);
+    }
+
+  /* Ask for the server's Last-Modified, and watch the response headers for
+   * an ETag, so the caller can make its next request conditional. */
+  curl_easy_setopt (req->easy, CURLOPT_FILETIME, 1L);
+  curl_easy_setopt (req->easy, CURLOPT_HEADERFUNCTION, response_header_cb);
+  curl_easy_setopt (req->easy, CURLOPT_HEADERDATA, task);
+  g_clear_pointer (&req->out_etag, g_free);
+  req->out_not_modified = FALSE;
+  req->out_last_modified = 0;
 
   if (self->cookie_jar_path)
     {
@@ -752,7 +1115,15 @@ initiate_next_curl_request (FetcherRequest *req,
       curl_easy_setopt (req->easy, CURLOPT_SSLKEY, self->tls_client_key_path);
     }
 
-  if ((self->config_flags & OSTREE_FETCHER_FLAGS_TRANSFER_GZIP) > 0)
+  /* Always negotiate Content-Encoding for membuf (i.e. metadata) requests;
+   * summaries and commit/dirtree objects compress very well, and libcurl
+   * transparently streams the decompressed bytes into our write callback.
+   * Content objects in archive repos are already gzip-compressed, so for
+   * tmpfile requests we only ask when the fetcher was configured for it -
+   * that also avoids mixing Content-Encoding with the Range-based resume
+   * logic above.
+   */
+  if (req->is_membuf || (self->config_flags & OSTREE_FETCHER_FLAGS_TRANSFER_GZIP) > 0)
     curl_easy_setopt (req->easy, CURLOPT_ACCEPT_ENCODING, "");
 
   /* We should only speak HTTP; TODO: only enable file if specified */
@@ -769,6 +1140,24 @@ initiate_next_curl_request (FetcherRequest *req,
   /* wait for pipe connection to confirm */
   curl_easy_setopt (req->easy, CURLOPT_PIPEWAIT, 1L);
 #endif
+
+  if ((self->config_flags & OSTREE_FETCHER_FLAGS_TCP_FASTOPEN) > 0)
+    {
+      /* Shave round trips off connection setup for frequent small
+       * polls (e.g. the conditional summary request): carry the
+       * request in the SYN when the kernel has a Fast Open cookie for
+       * the server, and start sending before the TLS handshake fully
+       * completes where the TLS backend can.  Both options degrade to
+       * the normal handshakes when unsupported, and setopt failures
+       * here just mean this libcurl lacks the feature.
+       */
+#if CURL_AT_LEAST_VERSION(7, 49, 0)
+      (void) curl_easy_setopt (req->easy, CURLOPT_TCP_FASTOPEN, 1L);
+#endif
+#if CURL_AT_LEAST_VERSION(7, 42, 0)
+      (void) curl_easy_setopt (req->easy, CURLOPT_SSL_FALSESTART, 1L);
+#endif
+    }
   curl_easy_setopt (req->easy, CURLOPT_WRITEFUNCTION, write_cb);
   if (g_getenv ("OSTREE_DEBUG_HTTP"))
     curl_easy_setopt (req->easy, CURLOPT_VERBOSE, 1L);
@@ -780,6 +1169,8 @@ initiate_next_curl_request (FetcherRequest *req,
   curl_easy_setopt (req->easy, CURLOPT_CONNECTTIMEOUT, 30L);
   curl_easy_setopt (req->easy, CURLOPT_LOW_SPEED_LIMIT, 1L);
   curl_easy_setopt (req->easy, CURLOPT_LOW_SPEED_TIME, 30L);
+  if (req->resume_from > 0)
+    curl_easy_setopt (req->easy, CURLOPT_RESUME_FROM_LARGE, (curl_off_t)req->resume_from);
 
   /* closure bindings -> task */
   curl_easy_setopt (req->easy, CURLOPT_PRIVATE, task);
@@ -795,6 +1186,8 @@ _ostree_fetcher_request_async (OstreeFetcher         *self,
                                GPtrArray             *mirrorlist,
                                const char            *filename,
                                OstreeFetcherRequestFlags flags,
+                               const char            *if_none_match,
+                               guint64                if_modified_since,
                                gboolean               is_membuf,
                                guint64                max_size,
                                int                    priority,
@@ -828,6 +1221,8 @@ _ostree_fetcher_request_async (OstreeFetcher         *self,
   req->filename = g_strdup (filename);
   req->max_size = max_size;
   req->flags = flags;
+  req->if_none_match = g_strdup (if_none_match);
+  req->if_modified_since = if_modified_since;
   req->is_membuf = is_membuf;
   /* We'll allocate the tmpfile on demand, so we handle
    * file I/O errors just in the write func.
@@ -845,11 +1240,11 @@ _ostree_fetcher_request_async (OstreeFetcher         *self,
 
   g_hash_table_add (self->outstanding_requests, g_steal_pointer (&task));
 
-  /* Sanity check, I added * 2 just so we don't abort if something odd happens,
-   * but we do want to abort if we're asked to do obviously too many requests.
+  /* No queue-depth assertion here: with HTTP/2 multiplexing the pull
+   * layer may legitimately keep hundreds of streams in flight (see the
+   * per-remote max-outstanding-requests option); they all share the
+   * CURLMOPT_MAX_TOTAL_CONNECTIONS-bounded connection pool.
    */
-  g_assert_cmpint (g_hash_table_size (self->outstanding_requests), <,
-                   _OSTREE_MAX_OUTSTANDING_FETCHER_REQUESTS * 2);
 }
 
 void
@@ -863,7 +1258,8 @@ _ostree_fetcher_request_to_tmpfile (OstreeFetcher         *self,
                                     GAsyncReadyCallback    callback,
                                     gpointer               user_data)
 {
-  _ostree_fetcher_request_async (self, mirrorlist, filename, flags, FALSE,
+  _ostree_fetcher_request_async (self, mirrorlist, filename, flags,
+                                 NULL, 0, FALSE,
                                  max_size, priority, cancellable,
                                  callback, user_data);
 }
@@ -872,6 +1268,7 @@ gboolean
 _ostree_fetcher_request_to_tmpfile_finish (OstreeFetcher *self,
                                            GAsyncResult  *result,
                                            char         **out_filename,
+                                           char         **out_checksum,
                                            GError       **error)
 {
   GTask *task;
@@ -892,6 +1289,18 @@ _ostree_fetcher_request_to_tmpfile_finish (OstreeFetcher *self,
   g_assert (out_filename);
   *out_filename = ret;
 
+  if (out_checksum)
+    {
+      if (req->checksum.initialized)
+        {
+          char hexdigest[OT_CHECKSUM_DIGEST_HEXLEN];
+          ot_checksum_get_hexdigest (&req->checksum, hexdigest, sizeof (hexdigest));
+          *out_checksum = g_strdup (hexdigest);
+        }
+      else
+        *out_checksum = NULL;
+    }
+
   return TRUE;
 }
 
@@ -900,13 +1309,16 @@ _ostree_fetcher_request_to_membuf (OstreeFetcher         *self,
                                    GPtrArray             *mirrorlist,
                                    const char            *filename,
                                    OstreeFetcherRequestFlags flags,
+                                   const char            *if_none_match,
+                                   guint64                if_modified_since,
                                    guint64                max_size,
                                    int                    priority,
                                    GCancellable          *cancellable,
                                    GAsyncReadyCallback    callback,
                                    gpointer               user_data)
 {
-  _ostree_fetcher_request_async (self, mirrorlist, filename, flags, TRUE,
+  _ostree_fetcher_request_async (self, mirrorlist, filename, flags,
+                                 if_none_match, if_modified_since, TRUE,
                                  max_size, priority, cancellable,
                                  callback, user_data);
 }
@@ -915,6 +1327,9 @@ gboolean
 _ostree_fetcher_request_to_membuf_finish (OstreeFetcher *self,
                                           GAsyncResult  *result,
                                           GBytes       **out_buf,
+                                          gboolean      *out_not_modified,
+                                          char         **out_etag,
+                                          guint64       *out_last_modified,
                                           GError       **error)
 {
   GTask *task;
@@ -935,6 +1350,13 @@ _ostree_fetcher_request_to_membuf_finish (OstreeFetcher *self,
   g_assert (out_buf);
   *out_buf = ret;
 
+  if (out_not_modified != NULL)
+    *out_not_modified = req->out_not_modified;
+  if (out_etag != NULL)
+    *out_etag = g_steal_pointer (&req->out_etag);
+  if (out_last_modified != NULL)
+    *out_last_modified = req->out_last_modified;
+
   return TRUE;
 }
 
@@ -943,3 +1365,10 @@ _ostree_fetcher_bytes_transferred (OstreeFetcher       *self)
 {
   return self->bytes_transferred;
 }
+
+void
+_ostree_fetcher_get_request_stats (OstreeFetcher             *self,
+                                   OstreeFetcherRequestStats *out_stats)
+{
+  *out_stats = self->request_stats;
+}
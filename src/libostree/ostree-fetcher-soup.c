@@ -93,9 +93,17 @@ typedef struct {
 
   gboolean is_membuf;
   OstreeFetcherRequestFlags flags;
+  char *if_none_match;  /* request ETag */
+  guint64 if_modified_since;  /* seconds since the epoch */
   GInputStream *request_body;
   char *out_tmpfile;
   GOutputStream *out_stream;
+  /* Streaming SHA256 of the downloaded bytes; only initialized when
+   * OSTREE_FETCHER_REQUEST_COMPUTE_CHECKSUM was given */
+  OtChecksum checksum;
+  gboolean out_not_modified;  /* TRUE if the server gave a 304 Not Modified response */
+  char *out_etag;  /* response ETag */
+  guint64 out_last_modified;  /* response Last-Modified, seconds since the epoch */
 
   guint64 max_size;
   guint64 current_size;
@@ -208,10 +216,13 @@ pending_uri_unref (OstreeFetcherPendingURI *pending)
 
   g_clear_pointer (&pending->mirrorlist, g_ptr_array_unref);
   g_free (pending->filename);
+  g_free (pending->if_none_match);
   g_clear_object (&pending->request);
   g_clear_object (&pending->request_body);
   g_free (pending->out_tmpfile);
   g_clear_object (&pending->out_stream);
+  ot_checksum_clear (&pending->checksum);
+  g_free (pending->out_etag);
   g_free (pending);
 }
 
@@ -339,7 +350,8 @@ session_thread_set_headers_cb (ThreadClosure *thread_closure,
   GVariant *headers = data;
 
   g_clear_pointer (&thread_closure->extra_headers, (GDestroyNotify)g_variant_unref);
-  thread_closure->extra_headers = g_variant_ref (headers);
+  if (headers != NULL)
+    thread_closure->extra_headers = g_variant_ref (headers);
 }
 
 #ifdef HAVE_LIBSOUP_CLIENT_CERTS
@@ -457,15 +469,33 @@ session_thread_request_uri (ThreadClosure *thread_closure,
       return;
     }
 
-  if (SOUP_IS_REQUEST_HTTP (pending->request) && thread_closure->extra_headers)
+  if (SOUP_IS_REQUEST_HTTP (pending->request))
     {
       glnx_unref_object SoupMessage *msg = soup_request_http_get_message ((SoupRequestHTTP*) pending->request);
-      g_autoptr(GVariantIter) viter = g_variant_iter_new (thread_closure->extra_headers);
-      const char *key;
-      const char *value;
 
-      while (g_variant_iter_next (viter, "(&s&s)", &key, &value))
-        soup_message_headers_append (msg->request_headers, key, value);
+      if (thread_closure->extra_headers)
+        {
+          g_autoptr(GVariantIter) viter = g_variant_iter_new (thread_closure->extra_headers);
+          const char *key;
+          const char *value;
+
+          while (g_variant_iter_next (viter, "(&s&s)", &key, &value))
+            soup_message_headers_append (msg->request_headers, key, value);
+        }
+
+      if (pending->if_none_match != NULL)
+        soup_message_headers_append (msg->request_headers, "If-None-Match",
+                                     pending->if_none_match);
+
+      if (pending->if_modified_since > 0)
+        {
+          SoupDate *date = soup_date_new_from_time_t ((time_t) pending->if_modified_since);
+          g_autofree char *mod_date = soup_date_to_string (date, SOUP_DATE_HTTP);
+
+          soup_message_headers_append (msg->request_headers, "If-Modified-Since",
+                                       mod_date);
+          soup_date_free (date);
+        }
     }
 
   if (pending->is_membuf)
@@ -793,6 +823,17 @@ _ostree_fetcher_set_cookie_jar (OstreeFetcher *self,
                            (GDestroyNotify) g_object_unref);
 }
 
+/* The curl backend persists resolved addresses here; libsoup delegates
+ * resolution to GResolver, which has no preload interface, so this is a
+ * no-op.
+ */
+void
+_ostree_fetcher_set_dns_cache (OstreeFetcher *self,
+                               const char    *path)
+{
+  g_return_if_fail (OSTREE_IS_FETCHER (self));
+}
+
 void
 _ostree_fetcher_set_client_cert (OstreeFetcher   *self,
                                  const char      *cert_path,
@@ -836,8 +877,8 @@ _ostree_fetcher_set_extra_headers (OstreeFetcher *self,
 {
   session_thread_idle_add (self->thread_closure,
                            session_thread_set_headers_cb,
-                           g_variant_ref (extra_headers),
-                           (GDestroyNotify) g_variant_unref);
+                           extra_headers ? g_variant_ref (extra_headers) : NULL,
+                           extra_headers ? (GDestroyNotify) g_variant_unref : NULL);
 }
 
 static gboolean
@@ -1014,6 +1055,10 @@ on_stream_read (GObject        *object,
       
       pending->current_size += bytes_read;
 
+      if (pending->checksum.initialized)
+        ot_checksum_update (&pending->checksum,
+                            g_bytes_get_data (bytes, NULL), bytes_read);
+
       /* We do this instead of _write_bytes_async() as that's not
        * guaranteed to do a complete write.
        */
@@ -1075,6 +1120,19 @@ on_request_sent (GObject        *object,
           remove_pending (pending);
           goto out;
         }
+      else if (msg->status_code == SOUP_STATUS_NOT_MODIFIED &&
+               (pending->if_none_match != NULL || pending->if_modified_since > 0))
+        {
+          /* Version on the server is unchanged from the version we have
+           * cached locally; report that back.  There is no response body. */
+          pending->out_not_modified = TRUE;
+          (void) g_input_stream_close (pending->request_body, NULL, NULL);
+          g_task_return_pointer (task,
+                                 g_bytes_new (NULL, 0),
+                                 (GDestroyNotify) g_bytes_unref);
+          remove_pending (pending);
+          goto out;
+        }
       else if (!SOUP_STATUS_IS_SUCCESSFUL (msg->status_code))
         {
           /* is there another mirror we can try? */
@@ -1137,6 +1195,23 @@ on_request_sent (GObject        *object,
             }
           goto out;
         }
+
+      /* Remember the validators the server sent back, so the caller can
+       * make the next request for this resource conditional. */
+      g_free (pending->out_etag);
+      pending->out_etag = g_strdup (soup_message_headers_get_one (msg->response_headers, "ETag"));
+      pending->out_last_modified = 0;
+
+      const char *last_modified_str = soup_message_headers_get_one (msg->response_headers, "Last-Modified");
+      if (last_modified_str != NULL)
+        {
+          SoupDate *date = soup_date_new_from_string (last_modified_str);
+          if (date != NULL)
+            {
+              pending->out_last_modified = soup_date_to_time_t (date);
+              soup_date_free (date);
+            }
+        }
     }
 
   pending->state = OSTREE_FETCHER_STATE_DOWNLOADING;
@@ -1156,6 +1231,25 @@ on_request_sent (GObject        *object,
       else
         oflags |= O_TRUNC;
 
+      /* (Re)start the streaming checksum for this attempt; on a resumed
+       * download fold in the bytes we already have.  Any problem just
+       * disables the optimization - the caller then falls back to
+       * verifying the tmpfile itself.
+       */
+      ot_checksum_clear (&pending->checksum);
+      if ((pending->flags & OSTREE_FETCHER_REQUEST_COMPUTE_CHECKSUM) > 0)
+        {
+          ot_checksum_init (&pending->checksum);
+          if ((oflags & O_APPEND) > 0)
+            {
+              glnx_fd_close int rfd = -1;
+              if (!glnx_openat_rdonly (pending->thread_closure->tmpdir_dfd,
+                                       pending->out_tmpfile, TRUE, &rfd, NULL)
+                  || !ot_checksum_update_from_fd (&pending->checksum, rfd, NULL))
+                ot_checksum_clear (&pending->checksum);
+            }
+        }
+
       fd = openat (pending->thread_closure->tmpdir_dfd,
                    pending->out_tmpfile, oflags, 0666);
       if (fd == -1)
@@ -1199,6 +1293,8 @@ _ostree_fetcher_request_async (OstreeFetcher         *self,
                                GPtrArray             *mirrorlist,
                                const char            *filename,
                                OstreeFetcherRequestFlags flags,
+                               const char            *if_none_match,
+                               guint64                if_modified_since,
                                gboolean               is_membuf,
                                guint64                max_size,
                                int                    priority,
@@ -1220,6 +1316,8 @@ _ostree_fetcher_request_async (OstreeFetcher         *self,
   pending->mirrorlist = g_ptr_array_ref (mirrorlist);
   pending->filename = g_strdup (filename);
   pending->flags = flags;
+  pending->if_none_match = g_strdup (if_none_match);
+  pending->if_modified_since = if_modified_since;
   pending->max_size = max_size;
   pending->is_membuf = is_membuf;
 
@@ -1247,7 +1345,8 @@ _ostree_fetcher_request_to_tmpfile (OstreeFetcher         *self,
                                     GAsyncReadyCallback    callback,
                                     gpointer               user_data)
 {
-  _ostree_fetcher_request_async (self, mirrorlist, filename, flags, FALSE,
+  _ostree_fetcher_request_async (self, mirrorlist, filename, flags,
+                                 NULL, 0, FALSE,
                                  max_size, priority, cancellable,
                                  callback, user_data);
 }
@@ -1256,6 +1355,7 @@ gboolean
 _ostree_fetcher_request_to_tmpfile_finish (OstreeFetcher *self,
                                            GAsyncResult  *result,
                                            char         **out_filename,
+                                           char         **out_checksum,
                                            GError       **error)
 {
   GTask *task;
@@ -1276,6 +1376,18 @@ _ostree_fetcher_request_to_tmpfile_finish (OstreeFetcher *self,
   g_assert (out_filename);
   *out_filename = ret;
 
+  if (out_checksum)
+    {
+      if (pending->checksum.initialized)
+        {
+          char hexdigest[OT_CHECKSUM_DIGEST_HEXLEN];
+          ot_checksum_get_hexdigest (&pending->checksum, hexdigest, sizeof (hexdigest));
+          *out_checksum = g_strdup (hexdigest);
+        }
+      else
+        *out_checksum = NULL;
+    }
+
   return TRUE;
 }
 
@@ -1284,13 +1396,16 @@ _ostree_fetcher_request_to_membuf (OstreeFetcher         *self,
                                    GPtrArray             *mirrorlist,
                                    const char            *filename,
                                    OstreeFetcherRequestFlags flags,
+                                   const char            *if_none_match,
+                                   guint64                if_modified_since,
                                    guint64                max_size,
                                    int                    priority,
                                    GCancellable          *cancellable,
                                    GAsyncReadyCallback    callback,
                                    gpointer               user_data)
 {
-  _ostree_fetcher_request_async (self, mirrorlist, filename, flags, TRUE,
+  _ostree_fetcher_request_async (self, mirrorlist, filename, flags,
+                                 if_none_match, if_modified_since, TRUE,
                                  max_size, priority, cancellable,
                                  callback, user_data);
 }
@@ -1299,6 +1414,9 @@ gboolean
 _ostree_fetcher_request_to_membuf_finish (OstreeFetcher *self,
                                           GAsyncResult  *result,
                                           GBytes       **out_buf,
+                                          gboolean      *out_not_modified,
+                                          char         **out_etag,
+                                          guint64       *out_last_modified,
                                           GError       **error)
 {
   GTask *task;
@@ -1319,6 +1437,13 @@ _ostree_fetcher_request_to_membuf_finish (OstreeFetcher *self,
   g_assert (out_buf);
   *out_buf = ret;
 
+  if (out_not_modified != NULL)
+    *out_not_modified = pending->out_not_modified;
+  if (out_etag != NULL)
+    *out_etag = g_steal_pointer (&pending->out_etag);
+  if (out_last_modified != NULL)
+    *out_last_modified = pending->out_last_modified;
+
   return TRUE;
 }
 
@@ -1349,3 +1474,13 @@ _ostree_fetcher_bytes_transferred (OstreeFetcher       *self)
 
   return ret;
 }
+
+/* This backend doesn't gather per-request timing; callers treat the
+ * all-zero stats as "no data" and keep their static behavior.
+ */
+void
+_ostree_fetcher_get_request_stats (OstreeFetcher             *self,
+                                   OstreeFetcherRequestStats *out_stats)
+{
+  memset (out_stats, 0, sizeof (*out_stats));
+}
@@ -111,6 +111,12 @@ _ostree_fetcher_uri_get_path (OstreeFetcherURI *uri)
   return g_strdup (soup_uri_get_path ((SoupURI*)uri));
 }
 
+char *
+_ostree_fetcher_uri_get_host (OstreeFetcherURI *uri)
+{
+  return g_strdup (soup_uri_get_host ((SoupURI*)uri));
+}
+
 char *
 _ostree_fetcher_uri_to_string (OstreeFetcherURI *uri)
 {
@@ -33,6 +33,9 @@
 typedef struct
 {
   GBytes          *result_buf;
+  gboolean         result_not_modified;
+  char            *result_etag;
+  guint64          result_last_modified;  /* seconds since the epoch */
   gboolean         done;
   GError         **error;
 }
@@ -47,6 +50,9 @@ fetch_uri_sync_on_complete (GObject        *object,
 
   (void)_ostree_fetcher_request_to_membuf_finish ((OstreeFetcher*)object,
                                                   result, &data->result_buf,
+                                                  &data->result_not_modified,
+                                                  &data->result_etag,
+                                                  &data->result_last_modified,
                                                   data->error);
   data->done = TRUE;
 }
@@ -56,7 +62,12 @@ _ostree_fetcher_mirrored_request_to_membuf (OstreeFetcher  *fetcher,
                                             GPtrArray     *mirrorlist,
                                             const char     *filename,
                                             OstreeFetcherRequestFlags flags,
+                                            const char     *if_none_match,
+                                            guint64         if_modified_since,
                                             GBytes         **out_contents,
+                                            gboolean       *out_not_modified,
+                                            char          **out_etag,
+                                            guint64        *out_last_modified,
                                             guint64        max_size,
                                             GCancellable   *cancellable,
                                             GError         **error)
@@ -78,12 +89,28 @@ _ostree_fetcher_mirrored_request_to_membuf (OstreeFetcher  *fetcher,
   data.error = error;
 
   _ostree_fetcher_request_to_membuf (fetcher, mirrorlist, filename,
-                                     flags,
+                                     flags, if_none_match, if_modified_since,
                                      max_size, OSTREE_FETCHER_DEFAULT_PRIORITY,
                                      cancellable, fetch_uri_sync_on_complete, &data);
   while (!data.done)
     g_main_context_iteration (mainctx, TRUE);
 
+  if (out_not_modified != NULL)
+    *out_not_modified = data.result_not_modified;
+  if (out_etag != NULL)
+    *out_etag = g_steal_pointer (&data.result_etag);
+  if (out_last_modified != NULL)
+    *out_last_modified = data.result_last_modified;
+
+  if (data.result_not_modified)
+    {
+      /* A 304 Not Modified response has no body; the caller is expected to
+       * reuse the copy it validated against. */
+      ret = TRUE;
+      *out_contents = NULL;
+      goto out;
+    }
+
   if (!data.result_buf)
     {
       if (flags & OSTREE_FETCHER_REQUEST_OPTIONAL_CONTENT)
@@ -104,6 +131,7 @@ _ostree_fetcher_mirrored_request_to_membuf (OstreeFetcher  *fetcher,
   if (mainctx)
     g_main_context_pop_thread_default (mainctx);
   g_clear_pointer (&data.result_buf, (GDestroyNotify)g_bytes_unref);
+  g_clear_pointer (&data.result_etag, g_free);
   return ret;
 }
 
@@ -120,7 +148,9 @@ _ostree_fetcher_request_uri_to_membuf (OstreeFetcher  *fetcher,
   g_autoptr(GPtrArray) mirrorlist = g_ptr_array_new ();
   g_ptr_array_add (mirrorlist, uri); /* no transfer */
   return _ostree_fetcher_mirrored_request_to_membuf (fetcher, mirrorlist, NULL, flags,
-                                                     out_contents, max_size,
+                                                     NULL, 0,
+                                                     out_contents, NULL, NULL, NULL,
+                                                     max_size,
                                                      cancellable, error);
 }
 
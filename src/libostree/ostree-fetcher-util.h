@@ -30,7 +30,12 @@ gboolean _ostree_fetcher_mirrored_request_to_membuf (OstreeFetcher *fetcher,
                                                      GPtrArray     *mirrorlist,
                                                      const char    *filename,
                                                      OstreeFetcherRequestFlags flags,
+                                                     const char     *if_none_match,
+                                                     guint64         if_modified_since,
                                                      GBytes         **out_contents,
+                                                     gboolean       *out_not_modified,
+                                                     char          **out_etag,
+                                                     guint64        *out_last_modified,
                                                      guint64        max_size,
                                                      GCancellable   *cancellable,
                                                      GError         **error);
@@ -51,12 +51,21 @@ G_DEFINE_AUTOPTR_CLEANUP_FUNC(OstreeFetcher, g_object_unref)
 typedef enum {
   OSTREE_FETCHER_FLAGS_NONE = 0,
   OSTREE_FETCHER_FLAGS_TLS_PERMISSIVE = (1 << 0),
-  OSTREE_FETCHER_FLAGS_TRANSFER_GZIP = (1 << 1)
+  OSTREE_FETCHER_FLAGS_TRANSFER_GZIP = (1 << 1),
+  /* Trade a round trip per connection for early data where the stack
+   * supports it (TCP Fast Open, TLS false start); curl backend only.
+   */
+  OSTREE_FETCHER_FLAGS_TCP_FASTOPEN = (1 << 2)
 } OstreeFetcherConfigFlags;
 
 typedef enum {
   OSTREE_FETCHER_REQUEST_NUL_TERMINATION = (1 << 0),
-  OSTREE_FETCHER_REQUEST_OPTIONAL_CONTENT = (1 << 1)
+  OSTREE_FETCHER_REQUEST_OPTIONAL_CONTENT = (1 << 1),
+  /* Compute the SHA256 of the downloaded bytes as they arrive, returned
+   * via _ostree_fetcher_request_to_tmpfile_finish(); lets callers verify
+   * fetched objects without reading the tmpfile back.
+   */
+  OSTREE_FETCHER_REQUEST_COMPUTE_CHECKSUM = (1 << 2)
 } OstreeFetcherRequestFlags;
 
 void
@@ -84,6 +93,9 @@ _ostree_fetcher_uri_get_scheme (OstreeFetcherURI *uri);
 char *
 _ostree_fetcher_uri_get_path (OstreeFetcherURI *uri);
 
+char *
+_ostree_fetcher_uri_get_host (OstreeFetcherURI *uri);
+
 char *
 _ostree_fetcher_uri_to_string (OstreeFetcherURI *uri);
 
@@ -98,6 +110,9 @@ int  _ostree_fetcher_get_dfd (OstreeFetcher *fetcher);
 void _ostree_fetcher_set_cookie_jar (OstreeFetcher *self,
                                      const char    *jar_path);
 
+void _ostree_fetcher_set_dns_cache (OstreeFetcher *self,
+                                    const char    *path);
+
 void _ostree_fetcher_set_proxy (OstreeFetcher *fetcher,
                                 const char    *proxy);
 
@@ -108,11 +123,26 @@ void _ostree_fetcher_set_client_cert (OstreeFetcher *fetcher,
 void _ostree_fetcher_set_tls_database (OstreeFetcher *self,
                                        const char    *tlsdb_path);
 
+/* @extra_headers may be %NULL to clear previously set headers */
 void _ostree_fetcher_set_extra_headers (OstreeFetcher *self,
                                         GVariant      *extra_headers);
 
 guint64 _ostree_fetcher_bytes_transferred (OstreeFetcher       *self);
 
+/* Aggregate timing of completed HTTP requests, used by the pull code to
+ * adapt its request window to the link.  All zeroes until a request has
+ * completed, and always for backends that don't gather timing.
+ */
+typedef struct {
+  guint   n_completed;
+  guint64 ewma_ttfb_usecs;     /* smoothed time-to-first-byte */
+  guint64 min_ttfb_usecs;      /* best time-to-first-byte seen */
+  guint64 ewma_bytes_per_sec;  /* smoothed per-request throughput */
+} OstreeFetcherRequestStats;
+
+void _ostree_fetcher_get_request_stats (OstreeFetcher             *self,
+                                        OstreeFetcherRequestStats *out_stats);
+
 void _ostree_fetcher_request_to_tmpfile (OstreeFetcher         *self,
                                          GPtrArray             *mirrorlist,
                                          const char            *filename,
@@ -123,15 +153,29 @@ void _ostree_fetcher_request_to_tmpfile (OstreeFetcher         *self,
                                          GAsyncReadyCallback    callback,
                                          gpointer               user_data);
 
+/* @out_checksum (allow-none): When %OSTREE_FETCHER_REQUEST_COMPUTE_CHECKSUM
+ * was given, the hex SHA256 of the downloaded bytes.  May still come back
+ * %NULL (e.g. a problem folding in a resumed partial download); callers
+ * must then fall back to verifying the tmpfile themselves.
+ */
 gboolean _ostree_fetcher_request_to_tmpfile_finish (OstreeFetcher *self,
                                                     GAsyncResult  *result,
                                                     char         **out_filename,
+                                                    char         **out_checksum,
                                                     GError       **error);
 
+/* @if_none_match and @if_modified_since make the request conditional: if
+ * the server supports them and the resource is unchanged, it answers with
+ * 304 Not Modified and no body, which the _finish() call reports via
+ * @out_not_modified.  The validators the server sent back are returned in
+ * @out_etag and @out_last_modified (seconds since the epoch) so the caller
+ * can persist them for the next request. */
 void _ostree_fetcher_request_to_membuf (OstreeFetcher         *self,
                                         GPtrArray             *mirrorlist,
                                         const char            *filename,
                                         OstreeFetcherRequestFlags flags,
+                                        const char            *if_none_match,
+                                        guint64                if_modified_since,
                                         guint64                max_size,
                                         int                    priority,
                                         GCancellable          *cancellable,
@@ -141,6 +185,9 @@ void _ostree_fetcher_request_to_membuf (OstreeFetcher         *self,
 gboolean _ostree_fetcher_request_to_membuf_finish (OstreeFetcher *self,
                                                    GAsyncResult  *result,
                                                    GBytes       **out_buf,
+                                                   gboolean      *out_not_modified,
+                                                   char         **out_etag,
+                                                   guint64       *out_last_modified,
                                                    GError       **error);
 
 
@@ -30,6 +30,8 @@
 #include "otutil.h"
 
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <glib/gstdio.h>
 
 typedef struct {
@@ -41,6 +43,17 @@ struct OstreeGpgVerifier {
 
   GList *keyrings;
   GPtrArray *key_ascii_files;
+
+  /* Temporary home directory with the concatenated keyring and any
+   * imported ASCII keys; built on the first verification and reused for
+   * the life of the verifier, so repeated verifications (multi-ref
+   * pulls) skip the keyring assembly and key import entirely.
+   * Verifiers are shared across worker threads via the repo's
+   * per-remote cache, so the lazy init is guarded by @lock; once set,
+   * home_dir is immutable until finalize.
+   */
+  GMutex lock;
+  char *home_dir;
 };
 
 G_DEFINE_TYPE (OstreeGpgVerifier, _ostree_gpg_verifier, G_TYPE_OBJECT)
@@ -53,6 +66,12 @@ ostree_gpg_verifier_finalize (GObject *object)
   g_list_free_full (self->keyrings, g_object_unref);
   if (self->key_ascii_files)
     g_ptr_array_unref (self->key_ascii_files);
+  if (self->home_dir != NULL)
+    {
+      (void) glnx_shutil_rm_rf_at (AT_FDCWD, self->home_dir, NULL, NULL);
+      g_free (self->home_dir);
+    }
+  g_mutex_clear (&self->lock);
 
   G_OBJECT_CLASS (_ostree_gpg_verifier_parent_class)->finalize (object);
 }
@@ -71,53 +90,42 @@ _ostree_gpg_verifier_class_init (OstreeGpgVerifierClass *klass)
 static void
 _ostree_gpg_verifier_init (OstreeGpgVerifier *self)
 {
+  g_mutex_init (&self->lock);
 }
 
-static void
-verify_result_finalized_cb (gpointer data,
-                            GObject *finalized_verify_result)
-{
-  g_autofree gchar *tmp_dir = data;  /* assume ownership */
-
-  /* XXX OstreeGpgVerifyResult could do this cleanup in its own
-   *     finalize() method, but I didn't want this keyring hack
-   *     bleeding into multiple classes. */
-
-  (void) glnx_shutil_rm_rf_at (AT_FDCWD, tmp_dir, NULL, NULL);
-}
-
-OstreeGpgVerifyResult *
-_ostree_gpg_verifier_check_signature (OstreeGpgVerifier  *self,
-                                      GBytes             *signed_data,
-                                      GBytes             *signatures,
-                                      GCancellable       *cancellable,
-                                      GError            **error)
+/* Assemble the temporary GPG home directory holding all configured
+ * keyrings and ASCII keys, if we haven't already.  GPGME has no API for
+ * using multiple keyrings (aka, gpg --keyring), so we concatenate all
+ * the keyring files into one pubring.gpg in a temporary directory, then
+ * point each verification context at that directory.
+ */
+static gboolean
+ostree_gpg_verifier_ensure_home_dir (OstreeGpgVerifier  *self,
+                                     GCancellable       *cancellable,
+                                     GError            **error)
 {
-  GLNX_AUTO_PREFIX_ERROR("GPG", error);
   gpgme_error_t gpg_error = 0;
-  g_auto(gpgme_data_t) data_buffer = NULL;
-  g_auto(gpgme_data_t) signature_buffer = NULL;
   g_autofree char *tmp_dir = NULL;
   g_autoptr(GOutputStream) target_stream = NULL;
-  OstreeGpgVerifyResult *result = NULL;
   gboolean success = FALSE;
   GList *link;
-  int armor;
 
-  /* GPGME has no API for using multiple keyrings (aka, gpg --keyring),
-   * so we concatenate all the keyring files into one pubring.gpg in a
-   * temporary directory, then tell GPGME to use that directory as the
-   * home directory. */
+  /* Serialize the assembly; concurrent verifications on a cold
+   * verifier must not both build (and race on publishing) the tmpdir.
+   */
+  g_mutex_lock (&self->lock);
 
-  if (g_cancellable_set_error_if_cancelled (cancellable, error))
-    goto out;
+  if (self->home_dir != NULL)
+    {
+      g_mutex_unlock (&self->lock);
+      return TRUE;
+    }
 
-  result = g_initable_new (OSTREE_TYPE_GPG_VERIFY_RESULT,
-                           cancellable, error, NULL);
-  if (result == NULL)
+  g_auto(gpgme_ctx_t) context = ot_gpgme_new_ctx (NULL, error);
+  if (context == NULL)
     goto out;
 
-  if (!ot_gpgme_ctx_tmp_home_dir (result->context,
+  if (!ot_gpgme_ctx_tmp_home_dir (context,
                                   &tmp_dir, &target_stream,
                                   cancellable, error))
     goto out;
@@ -154,9 +162,10 @@ _ostree_gpg_verifier_check_signature (OstreeGpgVerifier  *self,
   if (!g_output_stream_close (target_stream, cancellable, error))
     goto out;
 
-  /* Save the previous armor value - we need it on for importing ASCII keys */
-  armor = gpgme_get_armor (result->context);
-  gpgme_set_armor (result->context, 1);
+  /* Armor needs to be on for importing ASCII keys; the import updates
+   * the home directory keyring on disk, so later verification contexts
+   * see the keys without re-importing. */
+  gpgme_set_armor (context, 1);
 
   /* Now, use the API to import ASCII-armored keys */
   if (self->key_ascii_files)
@@ -177,7 +186,7 @@ _ostree_gpg_verifier_check_signature (OstreeGpgVerifier  *self,
               goto out;
             }
 
-          gpg_error = gpgme_op_import (result->context, kdata);
+          gpg_error = gpgme_op_import (context, kdata);
           if (gpg_error != GPG_ERR_NO_ERROR)
             {
               ot_gpgme_error_to_gio_error (gpg_error, error);
@@ -186,7 +195,52 @@ _ostree_gpg_verifier_check_signature (OstreeGpgVerifier  *self,
         }
     }
 
-  gpgme_set_armor (result->context, armor);
+  self->home_dir = g_steal_pointer (&tmp_dir);
+  success = TRUE;
+
+out:
+  if (!success && tmp_dir != NULL)
+    (void) glnx_shutil_rm_rf_at (AT_FDCWD, tmp_dir, NULL, NULL);
+
+  g_mutex_unlock (&self->lock);
+  return success;
+}
+
+OstreeGpgVerifyResult *
+_ostree_gpg_verifier_check_signature (OstreeGpgVerifier  *self,
+                                      GBytes             *signed_data,
+                                      GBytes             *signatures,
+                                      GCancellable       *cancellable,
+                                      GError            **error)
+{
+  GLNX_AUTO_PREFIX_ERROR("GPG", error);
+  gpgme_error_t gpg_error = 0;
+  g_auto(gpgme_data_t) data_buffer = NULL;
+  g_auto(gpgme_data_t) signature_buffer = NULL;
+  OstreeGpgVerifyResult *result = NULL;
+  gboolean success = FALSE;
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    goto out;
+
+  if (!ostree_gpg_verifier_ensure_home_dir (self, cancellable, error))
+    goto out;
+
+  result = g_initable_new (OSTREE_TYPE_GPG_VERIFY_RESULT,
+                           cancellable, error, NULL);
+  if (result == NULL)
+    goto out;
+
+  /* Not documented, but gpgme_ctx_set_engine_info() accepts NULL for
+   * the executable file name, which leaves the old setting unchanged. */
+  gpg_error = gpgme_ctx_set_engine_info (result->context,
+                                         GPGME_PROTOCOL_OpenPGP,
+                                         NULL, self->home_dir);
+  if (gpg_error != GPG_ERR_NO_ERROR)
+    {
+      ot_gpgme_error_to_gio_error (gpg_error, error);
+      goto out;
+    }
 
   /* Both the signed data and signature GBytes instances will outlive the
    * gpgme_data_t structs, so we can safely reuse the GBytes memory buffer
@@ -232,22 +286,17 @@ _ostree_gpg_verifier_check_signature (OstreeGpgVerifier  *self,
 out:
   if (success)
     {
-      /* Keep the temporary directory around for the life of the result
-       * object so its GPGME context remains valid.  It may yet have to
-       * extract user details from signing keys and will need to access
-       * the fabricated pubring.gpg keyring. */
-      g_object_weak_ref (G_OBJECT (result),
-                         verify_result_finalized_cb,
-                         g_strdup (tmp_dir));
+      /* Keep the verifier (and thus its home directory) around for the
+       * life of the result object so its GPGME context remains valid.
+       * It may yet have to extract user details from signing keys and
+       * will need to access the fabricated pubring.gpg keyring. */
+      g_object_set_data_full (G_OBJECT (result), "ostree-gpg-verifier",
+                              g_object_ref (self), g_object_unref);
     }
   else
     {
       /* Destroy the result object on error. */
       g_clear_object (&result);
-
-      /* Try to clean up the temporary directory. */
-      if (tmp_dir != NULL)
-        (void) glnx_shutil_rm_rf_at (AT_FDCWD, tmp_dir, NULL, NULL);
     }
 
   return result;
@@ -271,6 +320,49 @@ _ostree_gpg_verifier_add_key_ascii_file (OstreeGpgVerifier *self,
   g_ptr_array_add (self->key_ascii_files, g_strdup (path));
 }
 
+static void
+add_file_state_to_checksum (GChecksum  *checksum,
+                            const char *path)
+{
+  struct stat stbuf;
+
+  g_checksum_update (checksum, (const guchar *)path, strlen (path) + 1);
+
+  if (stat (path, &stbuf) == 0)
+    {
+      g_autofree char *state =
+        g_strdup_printf ("%" G_GUINT64_FORMAT ",%" G_GINT64_FORMAT ".%lu",
+                         (guint64)stbuf.st_size,
+                         (gint64)stbuf.st_mtim.tv_sec,
+                         (unsigned long)stbuf.st_mtim.tv_nsec);
+      g_checksum_update (checksum, (const guchar *)state, strlen (state) + 1);
+    }
+  else
+    g_checksum_update (checksum, (const guchar *)"missing", 8);
+}
+
+/* Fold the identity and on-disk state (path, size, mtime) of every
+ * configured keyring and ASCII key file into @checksum.  The digest
+ * changes whenever a key file is added, removed or replaced, so it can
+ * serve as the keyring fingerprint in a verification cache key without
+ * importing anything into GPGME.
+ */
+void
+_ostree_gpg_verifier_add_state_to_checksum (OstreeGpgVerifier *self,
+                                            GChecksum         *checksum)
+{
+  GList *link;
+
+  for (link = self->keyrings; link != NULL; link = link->next)
+    add_file_state_to_checksum (checksum, gs_file_get_path_cached (link->data));
+
+  if (self->key_ascii_files)
+    {
+      for (guint i = 0; i < self->key_ascii_files->len; i++)
+        add_file_state_to_checksum (checksum, self->key_ascii_files->pdata[i]);
+    }
+}
+
 gboolean
 _ostree_gpg_verifier_add_keyring_dir (OstreeGpgVerifier   *self,
                                       GFile               *path,
@@ -65,4 +65,7 @@ void _ostree_gpg_verifier_add_keyring (OstreeGpgVerifier *self,
 void _ostree_gpg_verifier_add_key_ascii_file (OstreeGpgVerifier *self,
                                               const char        *path);
 
+void _ostree_gpg_verifier_add_state_to_checksum (OstreeGpgVerifier *self,
+                                                 GChecksum         *checksum);
+
 G_END_DECLS
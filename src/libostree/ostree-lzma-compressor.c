@@ -81,7 +81,7 @@ _ostree_lzma_compressor_set_property (GObject      *object,
   switch (prop_id)
     {
     case PROP_PARAMS:
-      self->params = g_value_get_variant (value);
+      self->params = g_value_dup_variant (value);
       break;
 
     default:
@@ -136,6 +136,11 @@ _ostree_lzma_compressor_class_init (OstreeLzmaCompressorClass *klass)
 							 G_PARAM_STATIC_STRINGS));
 }
 
+/* @params may be %NULL for the defaults, or an a{sv} with:
+ *   - preset: u: liblzma preset level (default 8)
+ *   - threads: u: encoder threads; >1 uses the multi-threaded
+ *     encoder when liblzma is new enough (default 1)
+ */
 OstreeLzmaCompressor *
 _ostree_lzma_compressor_new (GVariant *params)
 {
@@ -182,7 +187,31 @@ _ostree_lzma_compressor_convert (GConverter *converter,
 
   if (!self->initialized)
     {
-      res = lzma_easy_encoder (&self->lstream, 8, LZMA_CHECK_CRC64);
+      guint32 preset = 8;
+      guint32 threads = 1;
+
+      if (self->params)
+        {
+          (void) g_variant_lookup (self->params, "preset", "u", &preset);
+          (void) g_variant_lookup (self->params, "threads", "u", &threads);
+        }
+
+/* lzma_stream_encoder_mt() appeared in xz 5.2.0; its output is a
+ * regular .xz stream, so decompression needs nothing special.
+ */
+#if LZMA_VERSION >= 50020002
+      if (threads > 1)
+        {
+          lzma_mt mt_options = { 0, };
+
+          mt_options.preset = preset;
+          mt_options.threads = threads;
+          mt_options.check = LZMA_CHECK_CRC64;
+          res = lzma_stream_encoder_mt (&self->lstream, &mt_options);
+        }
+      else
+#endif
+        res = lzma_easy_encoder (&self->lstream, preset, LZMA_CHECK_CRC64);
       if (res != LZMA_OK)
         goto out;
       self->initialized = TRUE;
@@ -77,11 +77,90 @@ typedef struct
 
   char *last_metalink_error;
   guint current_url_index;
-  GPtrArray *urls;
+  guint current_url_preference;
+  GPtrArray *urls; /* Element-type MetalinkUrl */
 
   OstreeMetalinkState state;
 } OstreeMetalinkRequest;
 
+typedef struct
+{
+  OstreeFetcherURI *uri;
+  guint preference; /* From the metalink; higher is better */
+  guint64 score;    /* From mirror_score_lookup(); lower is better */
+} MetalinkUrl;
+
+static void
+metalink_url_free (MetalinkUrl *url)
+{
+  _ostree_fetcher_uri_free (url->uri);
+  g_free (url);
+}
+
+/* Process-wide table of host → last observed fetch latency in
+ * microseconds (G_MAXUINT64 records a failure), so pulls that hit the
+ * same metalink repeatedly - summary, summary.sig - start from the
+ * mirror that actually performed last time instead of stalling on a
+ * slow first entry.  Hosts we have no data for rank between known-good
+ * and known-bad, ordered by the metalink's own preference.
+ */
+static GMutex mirror_scores_lock;
+static GHashTable *mirror_scores;
+
+#define MIRROR_SCORE_UNKNOWN (G_MAXUINT64 / 2)
+
+static guint64
+mirror_score_lookup (OstreeFetcherURI *uri)
+{
+  g_autofree char *host = _ostree_fetcher_uri_get_host (uri);
+  guint64 score = MIRROR_SCORE_UNKNOWN;
+
+  if (host == NULL)
+    return score;
+
+  g_mutex_lock (&mirror_scores_lock);
+  if (mirror_scores != NULL)
+    {
+      guint64 *value = g_hash_table_lookup (mirror_scores, host);
+      if (value != NULL)
+        score = *value;
+    }
+  g_mutex_unlock (&mirror_scores_lock);
+  return score;
+}
+
+static void
+mirror_score_update (OstreeFetcherURI *uri,
+                     guint64           score)
+{
+  g_autofree char *host = _ostree_fetcher_uri_get_host (uri);
+
+  if (host == NULL)
+    return;
+
+  g_mutex_lock (&mirror_scores_lock);
+  if (mirror_scores == NULL)
+    mirror_scores = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  g_hash_table_replace (mirror_scores, g_steal_pointer (&host),
+                        g_memdup (&score, sizeof (score)));
+  g_mutex_unlock (&mirror_scores_lock);
+}
+
+static gint
+compare_metalink_urls (gconstpointer a,
+                       gconstpointer b)
+{
+  const MetalinkUrl *url_a = *(MetalinkUrl**)a;
+  const MetalinkUrl *url_b = *(MetalinkUrl**)b;
+
+  if (url_a->score != url_b->score)
+    return url_a->score < url_b->score ? -1 : 1;
+  /* Higher preference first */
+  if (url_a->preference != url_b->preference)
+    return url_a->preference > url_b->preference ? -1 : 1;
+  return 0;
+}
+
 static void
 state_transition (OstreeMetalinkRequest  *self,
                   OstreeMetalinkState     new_state)
@@ -226,6 +305,7 @@ metalink_parser_start (GMarkupParseContext  *context,
       if (strcmp (element_name, "url") == 0)
         {
           const char *protocol;
+          const char *preference;
 
           if (!g_markup_collect_attributes (element_name,
                                             attribute_names,
@@ -242,10 +322,12 @@ metalink_parser_start (GMarkupParseContext  *context,
                                             NULL,
                                             G_MARKUP_COLLECT_STRING,
                                             "preference",
-                                            NULL,
+                                            &preference,
                                             G_MARKUP_COLLECT_INVALID))
             goto out;
 
+          self->current_url_preference = (guint) g_ascii_strtoull (preference, NULL, 10);
+
           /* Ignore non-HTTP resources */
           if (!(strcmp (protocol, "http") == 0 || strcmp (protocol, "https") == 0))
             state_transition (self, OSTREE_METALINK_STATE_PASSTHROUGH);
@@ -360,7 +442,12 @@ metalink_parser_text (GMarkupParseContext *context,
         g_autofree char *uri_text = g_strndup (text, text_len);
         OstreeFetcherURI *uri = _ostree_fetcher_uri_parse (uri_text, NULL);
         if (uri != NULL)
-          g_ptr_array_add (self->urls, uri);
+          {
+            MetalinkUrl *url = g_new0 (MetalinkUrl, 1);
+            url->uri = uri;
+            url->preference = self->current_url_preference;
+            g_ptr_array_add (self->urls, url);
+          }
       }
       break;
     case OSTREE_METALINK_STATE_PASSTHROUGH:
@@ -537,18 +624,35 @@ try_metalink_targets (OstreeMetalinkRequest      *self,
       goto out;
     }
 
+  /* Rank mirrors before trying any: fastest previously-observed hosts
+   * first, then unknown hosts by the metalink's preference, then hosts
+   * that failed last time.
+   */
+  for (guint i = 0; i < self->urls->len; i++)
+    {
+      MetalinkUrl *url = self->urls->pdata[i];
+      url->score = mirror_score_lookup (url->uri);
+    }
+  g_ptr_array_sort (self->urls, compare_metalink_urls);
+
   for (self->current_url_index = 0;
        self->current_url_index < self->urls->len;
        self->current_url_index++)
     {
       GError *temp_error = NULL;
+      MetalinkUrl *url = self->urls->pdata[self->current_url_index];
+      guint64 start_time = g_get_monotonic_time ();
+
+      target_uri = url->uri;
 
-      target_uri = self->urls->pdata[self->current_url_index];
-      
       if (try_one_url (self, target_uri, &ret_data, &temp_error))
-        break;
+        {
+          mirror_score_update (target_uri, g_get_monotonic_time () - start_time);
+          break;
+        }
       else
         {
+          mirror_score_update (target_uri, G_MAXUINT64);
           g_free (self->last_metalink_error);
           self->last_metalink_error = g_strdup (temp_error->message);
           g_clear_error (&temp_error);
@@ -608,7 +712,7 @@ _ostree_metalink_request_sync (OstreeMetalink        *self,
   g_main_context_push_thread_default (mainctx);
 
   request.metalink = g_object_ref (self);
-  request.urls = g_ptr_array_new_with_free_func ((GDestroyNotify) _ostree_fetcher_uri_free);
+  request.urls = g_ptr_array_new_with_free_func ((GDestroyNotify) metalink_url_free);
   request.parser = g_markup_parse_context_new (&metalink_parser, G_MARKUP_PREFIX_ERROR_POSITION, &request, NULL);
 
   if (!_ostree_fetcher_request_uri_to_membuf (self->fetcher, self->uri, 0,
@@ -37,6 +37,55 @@
  * programmatically.
  */
 
+/* All trees reachable from one root share an arena: a string chunk
+ * holding every name and checksum exactly once.  Interned strings are
+ * never individually freed; they die with the arena, whose lifetime is
+ * the union of the trees referencing it.  For commit-sized trees this
+ * replaces two mallocs per entry with (usually) pointer lookups - the
+ * dirmeta checksum in particular is shared by nearly every directory.
+ */
+typedef struct {
+  int refcount; /* atomic */
+  GStringChunk *chunk;
+} MutableTreeArena;
+
+static MutableTreeArena *
+mutable_tree_arena_new (void)
+{
+  MutableTreeArena *arena = g_new0 (MutableTreeArena, 1);
+  arena->refcount = 1;
+  arena->chunk = g_string_chunk_new (4096);
+  return arena;
+}
+
+static MutableTreeArena *
+mutable_tree_arena_ref (MutableTreeArena *arena)
+{
+  g_atomic_int_inc (&arena->refcount);
+  return arena;
+}
+
+static void
+mutable_tree_arena_unref (MutableTreeArena *arena)
+{
+  if (!g_atomic_int_dec_and_test (&arena->refcount))
+    return;
+  g_string_chunk_free (arena->chunk);
+  g_free (arena);
+}
+
+typedef enum {
+  /* The tree is fully represented by the `files` and `subdirs` tables */
+  MTREE_STATE_WHOLE,
+  /* The tree is a copy-on-write reference to a dirtree object in
+   * `repo`: `contents_checksum`/`metadata_checksum` name it, and the
+   * child tables are unpopulated.  The first mutation (or child
+   * lookup) materializes one level via mutable_tree_make_whole(),
+   * whose children are in turn lazy - so overlaying a few files onto
+   * a huge base only ever instantiates the modified paths. */
+  MTREE_STATE_LAZY
+} MutableTreeState;
+
 /**
  * OstreeMutableTree:
  *
@@ -46,8 +95,14 @@ struct OstreeMutableTree
 {
   GObject parent_instance;
 
-  char *contents_checksum;
-  char *metadata_checksum;
+  MutableTreeArena *arena; /* created lazily */
+
+  MutableTreeState state;
+  OstreeRepo *repo; /* only set for %MTREE_STATE_LAZY */
+
+  /* Interned in the arena */
+  const char *contents_checksum;
+  const char *metadata_checksum;
 
   GHashTable *files;
   GHashTable *subdirs;
@@ -55,6 +110,104 @@ struct OstreeMutableTree
 
 G_DEFINE_TYPE (OstreeMutableTree, ostree_mutable_tree, G_TYPE_OBJECT)
 
+static const char *
+mutable_tree_intern (OstreeMutableTree *self,
+                     const char        *str)
+{
+  if (!self->arena)
+    self->arena = mutable_tree_arena_new ();
+  return g_string_chunk_insert_const (self->arena->chunk, str);
+}
+
+/* Newly created subdirectories join their parent's arena; they can't
+ * have interned anything on their own yet.
+ */
+static void
+mutable_tree_adopt_arena (OstreeMutableTree *self,
+                          OstreeMutableTree *child)
+{
+  if (!self->arena)
+    self->arena = mutable_tree_arena_new ();
+  g_assert (child->arena == NULL);
+  child->arena = mutable_tree_arena_ref (self->arena);
+}
+
+/* Expand a lazy tree by one level: load its dirtree object and
+ * populate `files` with checksums and `subdirs` with lazy children.
+ * No-op for whole trees.
+ */
+static gboolean
+mutable_tree_make_whole (OstreeMutableTree *self,
+                         GCancellable      *cancellable,
+                         GError           **error)
+{
+  if (self->state == MTREE_STATE_WHOLE)
+    return TRUE;
+
+  g_assert (self->repo != NULL);
+  g_assert (self->contents_checksum != NULL);
+  g_assert (self->metadata_checksum != NULL);
+
+  g_autoptr(GVariant) dirtree = NULL;
+  if (!ostree_repo_load_variant (self->repo, OSTREE_OBJECT_TYPE_DIR_TREE,
+                                 self->contents_checksum, &dirtree, error))
+    return FALSE;
+
+  { g_autoptr(GVariant) dir_file_contents = g_variant_get_child_value (dirtree, 0);
+    const gsize n = g_variant_n_children (dir_file_contents);
+    for (gsize i = 0; i < n; i++)
+      {
+        const char *fname = NULL;
+        g_autoptr(GVariant) csum_v = NULL;
+        g_variant_get_child (dir_file_contents, i, "(&s@ay)", &fname, &csum_v);
+
+        const guchar *csum_bytes = ostree_checksum_bytes_peek_validate (csum_v, error);
+        if (csum_bytes == NULL)
+          return FALSE;
+        char csum[OSTREE_SHA256_STRING_LEN+1];
+        ostree_checksum_inplace_from_bytes (csum_bytes, csum);
+
+        g_hash_table_replace (self->files,
+                              (char*)mutable_tree_intern (self, fname),
+                              (char*)mutable_tree_intern (self, csum));
+      }
+  }
+
+  { g_autoptr(GVariant) dir_subdirs = g_variant_get_child_value (dirtree, 1);
+    const gsize n = g_variant_n_children (dir_subdirs);
+    for (gsize i = 0; i < n; i++)
+      {
+        const char *dname = NULL;
+        g_autoptr(GVariant) subdir_contents_v = NULL;
+        g_autoptr(GVariant) subdir_meta_v = NULL;
+        g_variant_get_child (dir_subdirs, i, "(&s@ay@ay)", &dname,
+                             &subdir_contents_v, &subdir_meta_v);
+
+        const guchar *contents_bytes = ostree_checksum_bytes_peek_validate (subdir_contents_v, error);
+        const guchar *meta_bytes = ostree_checksum_bytes_peek_validate (subdir_meta_v, error);
+        if (contents_bytes == NULL || meta_bytes == NULL)
+          return FALSE;
+        char contents_csum[OSTREE_SHA256_STRING_LEN+1];
+        char meta_csum[OSTREE_SHA256_STRING_LEN+1];
+        ostree_checksum_inplace_from_bytes (contents_bytes, contents_csum);
+        ostree_checksum_inplace_from_bytes (meta_bytes, meta_csum);
+
+        OstreeMutableTree *child = ostree_mutable_tree_new ();
+        mutable_tree_adopt_arena (self, child);
+        child->state = MTREE_STATE_LAZY;
+        child->repo = g_object_ref (self->repo);
+        child->contents_checksum = mutable_tree_intern (child, contents_csum);
+        child->metadata_checksum = mutable_tree_intern (child, meta_csum);
+        g_hash_table_insert (self->subdirs,
+                             (char*)mutable_tree_intern (self, dname),
+                             child);
+      }
+  }
+
+  self->state = MTREE_STATE_WHOLE;
+  return TRUE;
+}
+
 static void
 ostree_mutable_tree_finalize (GObject *object)
 {
@@ -62,12 +215,12 @@ ostree_mutable_tree_finalize (GObject *object)
 
   self = OSTREE_MUTABLE_TREE (object);
 
-  g_free (self->contents_checksum);
-  g_free (self->metadata_checksum);
-
   g_hash_table_destroy (self->files);
   g_hash_table_destroy (self->subdirs);
 
+  g_clear_object (&self->repo);
+  g_clear_pointer (&self->arena, mutable_tree_arena_unref);
+
   G_OBJECT_CLASS (ostree_mutable_tree_parent_class)->finalize (object);
 }
 
@@ -82,18 +235,17 @@ ostree_mutable_tree_class_init (OstreeMutableTreeClass *klass)
 static void
 ostree_mutable_tree_init (OstreeMutableTree *self)
 {
-  self->files = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                       g_free, g_free);
+  /* Keys and file values are interned in the arena, not owned here */
+  self->files = g_hash_table_new (g_str_hash, g_str_equal);
   self->subdirs = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                         g_free, (GDestroyNotify)g_object_unref);
+                                         NULL, (GDestroyNotify)g_object_unref);
 }
 
 void
 ostree_mutable_tree_set_metadata_checksum (OstreeMutableTree *self,
                                            const char        *checksum)
 {
-  g_free (self->metadata_checksum);
-  self->metadata_checksum = g_strdup (checksum);
+  self->metadata_checksum = checksum ? mutable_tree_intern (self, checksum) : NULL;
 }
 
 const char *
@@ -106,8 +258,7 @@ void
 ostree_mutable_tree_set_contents_checksum (OstreeMutableTree *self,
                                            const char        *checksum)
 {
-  g_free (self->contents_checksum);
-  self->contents_checksum = g_strdup (checksum);
+  self->contents_checksum = checksum ? mutable_tree_intern (self, checksum) : NULL;
 }
 
 const char *
@@ -127,7 +278,6 @@ ostree_mutable_tree_get_contents_checksum (OstreeMutableTree *self)
     {
       if (!ostree_mutable_tree_get_contents_checksum (subdir))
         {
-          g_free (self->contents_checksum);
           self->contents_checksum = NULL;
           return NULL;
         }
@@ -158,6 +308,9 @@ ostree_mutable_tree_replace_file (OstreeMutableTree *self,
   if (!ot_util_filename_validate (name, error))
     goto out;
 
+  if (!mutable_tree_make_whole (self, NULL, error))
+    goto out;
+
   if (g_hash_table_lookup (self->subdirs, name))
     {
       g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
@@ -167,8 +320,8 @@ ostree_mutable_tree_replace_file (OstreeMutableTree *self,
 
   ostree_mutable_tree_set_contents_checksum (self, NULL);
   g_hash_table_replace (self->files,
-                        g_strdup (name),
-                        g_strdup (checksum));
+                        (char*)mutable_tree_intern (self, name),
+                        (char*)mutable_tree_intern (self, checksum));
 
   ret = TRUE;
  out:
@@ -189,6 +342,9 @@ ostree_mutable_tree_ensure_dir (OstreeMutableTree *self,
   if (!ot_util_filename_validate (name, error))
     goto out;
 
+  if (!mutable_tree_make_whole (self, NULL, error))
+    goto out;
+
   if (g_hash_table_lookup (self->files, name))
     {
       g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
@@ -200,8 +356,11 @@ ostree_mutable_tree_ensure_dir (OstreeMutableTree *self,
   if (!ret_dir)
     {
       ret_dir = ostree_mutable_tree_new ();
+      mutable_tree_adopt_arena (self, ret_dir);
       ostree_mutable_tree_set_contents_checksum (self, NULL);
-      g_hash_table_insert (self->subdirs, g_strdup (name), g_object_ref (ret_dir));
+      g_hash_table_insert (self->subdirs,
+                           (char*)mutable_tree_intern (self, name),
+                           g_object_ref (ret_dir));
     }
   
   ret = TRUE;
@@ -220,7 +379,10 @@ ostree_mutable_tree_lookup (OstreeMutableTree   *self,
   gboolean ret = FALSE;
   g_autoptr(OstreeMutableTree) ret_subdir = NULL;
   g_autofree char *ret_file_checksum = NULL;
-  
+
+  if (!mutable_tree_make_whole (self, NULL, error))
+    goto out;
+
   ret_subdir = ot_gobject_refz (g_hash_table_lookup (self->subdirs, name));
   if (!ret_subdir)
     {
@@ -272,6 +434,9 @@ ostree_mutable_tree_ensure_parent_dirs (OstreeMutableTree  *self,
       OstreeMutableTree *next;
       const char *name = split_path->pdata[i];
 
+      if (!mutable_tree_make_whole (subdir, NULL, error))
+        goto out;
+
       if (g_hash_table_lookup (subdir->files, name))
         {
           g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
@@ -280,11 +445,14 @@ ostree_mutable_tree_ensure_parent_dirs (OstreeMutableTree  *self,
         }
 
       next = g_hash_table_lookup (subdir->subdirs, name);
-      if (!next) 
+      if (!next)
         {
           next = ostree_mutable_tree_new ();
+          mutable_tree_adopt_arena (subdir, next);
           ostree_mutable_tree_set_metadata_checksum (next, metadata_checksum);
-          g_hash_table_insert (subdir->subdirs, g_strdup (name), next);
+          g_hash_table_insert (subdir->subdirs,
+                               (char*)mutable_tree_intern (subdir, name),
+                               next);
         }
       
       subdir = next;
@@ -327,6 +495,9 @@ ostree_mutable_tree_walk (OstreeMutableTree     *self,
     {
       OstreeMutableTree *subdir;
 
+      if (!mutable_tree_make_whole (self, NULL, error))
+        return FALSE;
+
       subdir = g_hash_table_lookup (self->subdirs, split_path->pdata[start]);
       if (!subdir)
         return set_error_noent (error, (char*)split_path->pdata[start]);
@@ -344,6 +515,12 @@ ostree_mutable_tree_walk (OstreeMutableTree     *self,
 GHashTable *
 ostree_mutable_tree_get_subdirs (OstreeMutableTree *self)
 {
+  /* No error parameter here; failure to expand a lazy tree means the
+   * referenced dirtree is unreadable, which any subsequent use of the
+   * result would hit as repository corruption anyway.
+   */
+  if (!mutable_tree_make_whole (self, NULL, NULL))
+    g_assert_not_reached ();
   return self->subdirs;
 }
 
@@ -356,9 +533,67 @@ ostree_mutable_tree_get_subdirs (OstreeMutableTree *self)
 GHashTable *
 ostree_mutable_tree_get_files (OstreeMutableTree *self)
 {
+  /* See the note in ostree_mutable_tree_get_subdirs() */
+  if (!mutable_tree_make_whole (self, NULL, NULL))
+    g_assert_not_reached ();
   return self->files;
 }
 
+/**
+ * ostree_mutable_tree_fill_empty_from_dirtree:
+ * @self: Tree
+ * @repo: An #OstreeRepo containing the dirtree object
+ * @contents_checksum: SHA256 checksum of an %OSTREE_OBJECT_TYPE_DIR_TREE object
+ * @metadata_checksum: SHA256 checksum of an %OSTREE_OBJECT_TYPE_DIR_META object
+ *
+ * Make @self into a copy-on-write reference to the given dirtree.  No
+ * children are instantiated: unchanged subtrees remain checksum
+ * references, and only paths that are subsequently modified (or looked
+ * up) are loaded from @repo, one level at a time.  This makes
+ * composing a small overlay onto a large base commit cost
+ * proportional to the overlay, not the base.
+ *
+ * This may only be done to an empty tree, or to one that already
+ * references the same dirtree in the same repo.
+ *
+ * Returns: %TRUE if @self was set to reference the dirtree, %FALSE if
+ * it already had content
+ *
+ * Since: 2017.10
+ */
+gboolean
+ostree_mutable_tree_fill_empty_from_dirtree (OstreeMutableTree *self,
+                                             OstreeRepo        *repo,
+                                             const char        *contents_checksum,
+                                             const char        *metadata_checksum)
+{
+  g_return_val_if_fail (repo != NULL, FALSE);
+  g_return_val_if_fail (contents_checksum != NULL, FALSE);
+  g_return_val_if_fail (metadata_checksum != NULL, FALSE);
+
+  switch (self->state)
+    {
+    case MTREE_STATE_LAZY:
+      if (self->repo != repo
+          || strcmp (self->contents_checksum, contents_checksum) != 0)
+        return FALSE;
+      break;
+    case MTREE_STATE_WHOLE:
+      if (g_hash_table_size (self->files) > 0
+          || g_hash_table_size (self->subdirs) > 0
+          || self->contents_checksum != NULL
+          || self->metadata_checksum != NULL)
+        return FALSE;
+      break;
+    }
+
+  g_set_object (&self->repo, repo);
+  self->state = MTREE_STATE_LAZY;
+  ostree_mutable_tree_set_contents_checksum (self, contents_checksum);
+  ostree_mutable_tree_set_metadata_checksum (self, metadata_checksum);
+  return TRUE;
+}
+
 /**
  * ostree_mutable_tree_new:
  *
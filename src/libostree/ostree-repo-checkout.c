@@ -23,21 +23,42 @@
 #include "config.h"
 
 #include <glib-unix.h>
+#include <sys/ioctl.h>
 #include <sys/xattr.h>
 #include <gio/gfiledescriptorbased.h>
 #include <gio/gunixoutputstream.h>
 #include "otutil.h"
 
+/* Linux 4.5 (and older btrfs-specific) clone/reflink ioctl */
+#ifndef FICLONE
+#define FICLONE _IOW (0x94, 9, int)
+#endif
+
 #include "ostree-repo-file.h"
 #include "ostree-sepolicy-private.h"
 #include "ostree-core-private.h"
 #include "ostree-repo-private.h"
+#include "ostree-tracepoints-private.h"
 
 #define WHITEOUT_PREFIX ".wh."
 
 /* Per-checkout call state/caching */
 typedef struct {
   GString *selabel_path_buf;
+  GHashTable *xattr_plans;  /* Serialized xattr bytes → XattrPlan, see below */
+  /* Only with OstreeRepoCheckoutAtOptions.ordered_object_reads; see
+   * execute_checkout_plan() below. */
+  GString *path_buf;         /* Current relpath from the checkout root's parent */
+  GPtrArray *planned_files;  /* CheckoutFileItem */
+  GPtrArray *planned_dirs;   /* CheckoutDirFinalizeItem, post-order */
+  /* Non-%NULL only while execute_checkout_plan() runs workers;
+   * serializes writes to the per-checkout caches (xattr plans, devino
+   * cache) from concurrent file materializations. */
+  GMutex *shared_lock;
+  /* Running totals published to OstreeRepoCheckoutAtOptions.async_progress;
+   * protected by shared_lock while workers run. */
+  guint64 progress_files;
+  guint64 progress_bytes;
 } CheckoutState;
 
 static void
@@ -45,9 +66,111 @@ checkout_state_clear (CheckoutState *state)
 {
   if (state->selabel_path_buf)
     g_string_free (state->selabel_path_buf, TRUE);
+  g_clear_pointer (&state->xattr_plans, g_hash_table_unref);
+  if (state->path_buf)
+    g_string_free (state->path_buf, TRUE);
+  g_clear_pointer (&state->planned_files, g_ptr_array_unref);
+  g_clear_pointer (&state->planned_dirs, g_ptr_array_unref);
 }
 G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC(CheckoutState, checkout_state_clear)
 
+typedef struct {
+  char *name;
+  GVariant *value;
+} XattrPlanEntry;
+
+/* An xattr variant unpacked into a flat list of fsetxattr() arguments.
+ * A checkout of a large tree typically sees only a handful of distinct
+ * xattr sets (roughly one per SELinux label), so we build this once per
+ * distinct variant and cache it in the CheckoutState, rather than
+ * re-walking the variant (and, with SELinux enabled, re-filtering it)
+ * for every single file.
+ */
+typedef struct {
+  GArray *entries;  /* XattrPlanEntry */
+} XattrPlan;
+
+static void
+xattr_plan_entry_clear (gpointer data)
+{
+  XattrPlanEntry *entry = data;
+  g_free (entry->name);
+  g_variant_unref (entry->value);
+}
+
+static void
+xattr_plan_free (gpointer data)
+{
+  XattrPlan *plan = data;
+  g_array_unref (plan->entries);
+  g_free (plan);
+}
+
+static XattrPlan *
+checkout_state_get_xattr_plan (CheckoutState *state,
+                               GVariant      *xattrs,
+                               gboolean       filter_selinux)
+{
+  if (state->shared_lock)
+    g_mutex_lock (state->shared_lock);
+
+  if (state->xattr_plans == NULL)
+    state->xattr_plans = g_hash_table_new_full (g_bytes_hash, g_bytes_equal,
+                                                (GDestroyNotify)g_bytes_unref,
+                                                xattr_plan_free);
+
+  /* @filter_selinux is fixed for the whole checkout invocation, so the
+   * serialized bytes alone are a sufficient key.
+   */
+  g_autoptr(GBytes) key = g_variant_get_data_as_bytes (xattrs);
+  XattrPlan *plan = g_hash_table_lookup (state->xattr_plans, key);
+  if (plan == NULL)
+    {
+      plan = g_new0 (XattrPlan, 1);
+      plan->entries = g_array_new (FALSE, FALSE, sizeof (XattrPlanEntry));
+      g_array_set_clear_func (plan->entries, xattr_plan_entry_clear);
+
+      const gsize n = g_variant_n_children (xattrs);
+      for (gsize i = 0; i < n; i++)
+        {
+          const char *name;
+          g_autoptr(GVariant) value = NULL;
+
+          g_variant_get_child (xattrs, i, "(^&ay@ay)", &name, &value);
+          if (filter_selinux && g_str_equal (name, "security.selinux"))
+            continue;
+
+          XattrPlanEntry entry = { g_strdup (name), g_steal_pointer (&value) };
+          g_array_append_val (plan->entries, entry);
+        }
+
+      g_hash_table_replace (state->xattr_plans, g_bytes_ref (key), plan);
+    }
+
+  /* Plans are immutable once built and live until the checkout
+   * completes, so the pointer stays valid after unlocking. */
+  if (state->shared_lock)
+    g_mutex_unlock (state->shared_lock);
+
+  return plan;
+}
+
+static gboolean
+xattr_plan_apply_to_fd (XattrPlan  *plan,
+                        int         fd,
+                        GError    **error)
+{
+  for (guint i = 0; i < plan->entries->len; i++)
+    {
+      XattrPlanEntry *entry = &g_array_index (plan->entries, XattrPlanEntry, i);
+      if (TEMP_FAILURE_RETRY (fsetxattr (fd, entry->name,
+                                         g_variant_get_data (entry->value),
+                                         g_variant_get_size (entry->value), 0)) < 0)
+        return glnx_throw_errno_prefix (error, "fsetxattr(%s)", entry->name);
+    }
+  return TRUE;
+}
+
 static gboolean
 checkout_object_for_uncompressed_cache (OstreeRepo      *self,
                                         const char      *loose_path,
@@ -56,6 +179,9 @@ checkout_object_for_uncompressed_cache (OstreeRepo      *self,
                                         GCancellable    *cancellable,
                                         GError         **error)
 {
+  if (!_ostree_repo_ensure_uncompressed_cache (self, error))
+    return FALSE;
+
   /* Don't make setuid files in uncompressed cache */
   guint32 file_mode = g_file_info_get_attribute_uint32 (src_info, "unix::mode");
   file_mode &= ~(S_ISUID|S_ISGID);
@@ -107,6 +233,7 @@ fsync_is_enabled (OstreeRepo   *self,
 static gboolean
 write_regular_file_content (OstreeRepo            *self,
                             OstreeRepoCheckoutAtOptions *options,
+                            CheckoutState         *state,
                             int                    outfd,
                             GFileInfo             *file_info,
                             GVariant              *xattrs,
@@ -122,8 +249,19 @@ write_regular_file_content (OstreeRepo            *self,
       int infd = g_file_descriptor_based_get_fd ((GFileDescriptorBased*) input);
       guint64 len = g_file_info_get_size (file_info);
 
-      if (glnx_regfile_copy_bytes (infd, outfd, (off_t)len, TRUE) < 0)
-        return glnx_throw_errno_prefix (error, "regfile copy");
+      /* Try to reflink (FICLONE) the object first; on filesystems with
+       * CoW support (btrfs, XFS) this gives us copy semantics at
+       * hardlink speed, which matters a lot for e.g. --force-copy and
+       * user-mode checkouts of large trees.  Content is shared but the
+       * inode is distinct, so the ownership/xattr/mode fixups below
+       * still apply only to the checkout.  Fall back silently to a
+       * byte copy on any error; the ioctl is purely an optimization.
+       */
+      if (ioctl (outfd, FICLONE, infd) != 0)
+        {
+          if (glnx_regfile_copy_bytes (infd, outfd, (off_t)len, TRUE) < 0)
+            return glnx_throw_errno_prefix (error, "regfile copy");
+        }
     }
   else
     {
@@ -144,7 +282,12 @@ write_regular_file_content (OstreeRepo            *self,
 
       if (xattrs)
         {
-          if (!glnx_fd_set_all_xattrs (outfd, xattrs, cancellable, error))
+          /* Any SELinux label was applied (or filtered) by our caller,
+           * so drop it from the generic application here.
+           */
+          const gboolean filter_selinux = options->sepolicy && !self->disable_xattrs;
+          XattrPlan *plan = checkout_state_get_xattr_plan (state, xattrs, filter_selinux);
+          if (!xattr_plan_apply_to_fd (plan, outfd, error))
             return FALSE;
         }
     }
@@ -193,23 +336,20 @@ create_file_copy_from_input_at (OstreeRepo     *repo,
   const gboolean sepolicy_enabled = options->sepolicy && !repo->disable_xattrs;
   g_autoptr(GVariant) modified_xattrs = NULL;
 
-  /* If we're doing SELinux labeling, prepare it */
-  if (sepolicy_enabled)
-    {
-      /* If doing sepolicy path-based labeling, we don't want to set the
-       * security.selinux attr via the generic xattr paths in either the symlink
-       * or regfile cases, so filter it out.
-       */
-      modified_xattrs = _ostree_filter_selinux_xattr (xattrs);
-      xattrs = modified_xattrs;
-    }
-
   if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_SYMBOLIC_LINK)
     {
       g_auto(OstreeSepolicyFsCreatecon) fscreatecon = { 0, };
 
       if (sepolicy_enabled)
         {
+          /* With sepolicy path-based labeling the label is set via
+           * setfscreatecon(), so filter security.selinux out of the
+           * generic xattr application below.  The regular-file path
+           * does the equivalent filtering via its cached xattr plan.
+           */
+          modified_xattrs = _ostree_filter_selinux_xattr (xattrs);
+          xattrs = modified_xattrs;
+
           /* For symlinks, since we don't have O_TMPFILE, we use setfscreatecon() */
           if (!_ostree_sepolicy_preparefscreatecon (&fscreatecon, options->sepolicy,
                                                     state->selabel_path_buf->str,
@@ -273,7 +413,7 @@ create_file_copy_from_input_at (OstreeRepo     *repo,
             return glnx_throw_errno_prefix (error, "Setting security.selinux");
         }
 
-      if (!write_regular_file_content (repo, options, tmpf.fd, file_info, xattrs, input,
+      if (!write_regular_file_content (repo, options, state, tmpf.fd, file_info, xattrs, input,
                                        cancellable, error))
         return FALSE;
 
@@ -373,6 +513,11 @@ checkout_one_file_at (OstreeRepo                        *repo,
   gboolean is_bare_user_symlink = FALSE;
   char loose_path_buf[_OSTREE_LOOSE_PATH_MAX];
 
+  ostree_probe2 (checkout_file, checksum, options->mode);
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return FALSE;
+
   /* FIXME - avoid the GFileInfo here */
   g_autoptr(GFileInfo) source_info = NULL;
   if (!ostree_repo_load_file (repo, checksum, NULL, &source_info, NULL,
@@ -427,6 +572,11 @@ checkout_one_file_at (OstreeRepo                        *repo,
                                                && options->mode == OSTREE_REPO_CHECKOUT_MODE_USER
                                                && current_can_cache);
 
+          /* The cache directory is opened lazily */
+          if (is_archive_z2_with_cache &&
+              !_ostree_repo_ensure_uncompressed_cache (current_repo, error))
+            return FALSE;
+
           /* NOTE: bare-user symlinks are not stored as symlinks; see
            * https://github.com/ostreedev/ostree/commit/47c612e5a0688c3452a125655a245e8f4f01b2b0
            * as well as write_object().
@@ -470,7 +620,11 @@ checkout_one_file_at (OstreeRepo                        *repo,
                   key->ino = stbuf.st_ino;
                   memcpy (key->checksum, checksum, OSTREE_SHA256_STRING_LEN+1);
 
+                  if (state->shared_lock)
+                    g_mutex_lock (state->shared_lock);
                   g_hash_table_add ((GHashTable*)options->devino_to_csum_cache, key);
+                  if (state->shared_lock)
+                    g_mutex_unlock (state->shared_lock);
                 }
 
               if (hardlink_res != HARDLINK_RESULT_NOT_SUPPORTED)
@@ -558,9 +712,43 @@ checkout_one_file_at (OstreeRepo                        *repo,
        */
       if (options->no_copy_fallback)
         g_assert (is_bare_user_symlink);
-      if (!ostree_repo_load_file (repo, checksum, &input, NULL, &xattrs,
-                                  cancellable, error))
-        return FALSE;
+
+      /* Tiny files dominate config-heavy trees and recur across paths
+       * and checkouts; serve them from the in-memory cache rather than
+       * re-opening the loose object for each instance.
+       */
+      g_autoptr(GBytes) content_bytes = NULL;
+      const gboolean content_is_cachable =
+        !is_symlink && g_file_info_get_size (source_info) <= _OSTREE_SMALL_CONTENT_CACHE_THRESHOLD;
+
+      if (content_is_cachable
+          && _ostree_repo_small_content_cache_lookup (repo, checksum, &content_bytes, &xattrs))
+        {
+          input = g_memory_input_stream_new_from_bytes (content_bytes);
+        }
+      else
+        {
+          if (!ostree_repo_load_file (repo, checksum, &input, NULL, &xattrs,
+                                      cancellable, error))
+            return FALSE;
+
+          if (content_is_cachable && input != NULL)
+            {
+              const gsize len = g_file_info_get_size (source_info);
+              g_autofree guint8 *buf = g_malloc (len + 1);
+              gsize bytes_read;
+
+              if (!g_input_stream_read_all (input, buf, len, &bytes_read,
+                                            cancellable, error))
+                return FALSE;
+
+              content_bytes = g_bytes_new_take (g_steal_pointer (&buf), bytes_read);
+              _ostree_repo_small_content_cache_insert (repo, checksum, content_bytes, xattrs);
+
+              g_clear_object (&input);
+              input = g_memory_input_stream_new_from_bytes (content_bytes);
+            }
+        }
 
       if (!create_file_copy_from_input_at (repo, options, state, source_info, xattrs, input,
                                            destination_dfd, destination_name,
@@ -574,9 +762,152 @@ checkout_one_file_at (OstreeRepo                        *repo,
         }
     }
 
+  if (options->async_progress != NULL)
+    {
+      guint64 files, bytes;
+
+      if (state->shared_lock)
+        g_mutex_lock (state->shared_lock);
+      files = ++state->progress_files;
+      bytes = state->progress_bytes +=
+        (is_symlink || is_whiteout) ? 0 : g_file_info_get_size (source_info);
+      if (state->shared_lock)
+        g_mutex_unlock (state->shared_lock);
+
+      ostree_async_progress_set (options->async_progress,
+                                 "files-written", "t", files,
+                                 "bytes-written", "t", bytes,
+                                 NULL);
+    }
+
   return TRUE;
 }
 
+/* Parsed (and byteswapped) form of a dirmeta object */
+typedef struct {
+  guint32 uid;
+  guint32 gid;
+  guint32 mode;
+  GVariant *xattrs;  /* Always parsed; callers in USER mode ignore it */
+} ParsedDirmeta;
+
+static void
+parsed_dirmeta_free (ParsedDirmeta *p)
+{
+  g_clear_pointer (&p->xattrs, g_variant_unref);
+  g_free (p);
+}
+
+/* A safety valve only; real trees have on the order of ten distinct dirmetas */
+#define DIRMETA_PARSE_CACHE_MAX_ENTRIES 512
+
+/* Load and parse the dirmeta named by @checksum, caching the parsed
+ * form on the repo so a million-directory checkout does a handful of
+ * variant parses rather than one per directory.  @out_xattrs may be
+ * %NULL to skip xattrs (USER mode).
+ */
+static gboolean
+load_parsed_dirmeta (OstreeRepo    *self,
+                     const char    *checksum,
+                     guint32       *out_uid,
+                     guint32       *out_gid,
+                     guint32       *out_mode,
+                     GVariant     **out_xattrs,
+                     GError       **error)
+{
+  g_mutex_lock (&self->cache_lock);
+  ParsedDirmeta *cached = NULL;
+  if (self->dirmeta_parse_cache)
+    cached = g_hash_table_lookup (self->dirmeta_parse_cache, checksum);
+  if (cached)
+    {
+      *out_uid = cached->uid;
+      *out_gid = cached->gid;
+      *out_mode = cached->mode;
+      if (out_xattrs)
+        *out_xattrs = cached->xattrs ? g_variant_ref (cached->xattrs) : NULL;
+      g_mutex_unlock (&self->cache_lock);
+      return TRUE;
+    }
+  g_mutex_unlock (&self->cache_lock);
+
+  g_autoptr(GVariant) dirmeta = NULL;
+  if (!ostree_repo_load_variant (self, OSTREE_OBJECT_TYPE_DIR_META,
+                                 checksum, &dirmeta, error))
+    return FALSE;
+
+  ParsedDirmeta *p = g_new0 (ParsedDirmeta, 1);
+  g_variant_get (dirmeta, "(uuu@a(ayay))",
+                 &p->uid, &p->gid, &p->mode, &p->xattrs);
+  p->uid = GUINT32_FROM_BE (p->uid);
+  p->gid = GUINT32_FROM_BE (p->gid);
+  p->mode = GUINT32_FROM_BE (p->mode);
+
+  g_mutex_lock (&self->cache_lock);
+  if (self->dirmeta_parse_cache == NULL)
+    self->dirmeta_parse_cache =
+      g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                             (GDestroyNotify) parsed_dirmeta_free);
+  else if (g_hash_table_size (self->dirmeta_parse_cache) >= DIRMETA_PARSE_CACHE_MAX_ENTRIES)
+    g_hash_table_remove_all (self->dirmeta_parse_cache);
+  g_hash_table_replace (self->dirmeta_parse_cache, g_strdup (checksum), p);
+  *out_uid = p->uid;
+  *out_gid = p->gid;
+  *out_mode = p->mode;
+  if (out_xattrs)
+    *out_xattrs = p->xattrs ? g_variant_ref (p->xattrs) : NULL;
+  g_mutex_unlock (&self->cache_lock);
+
+  return TRUE;
+}
+
+/* A deferred file checkout, used with ordered_object_reads.  Object reads
+ * dominate a copy checkout, and visiting files in directory-tree order
+ * produces random reads across the objects/XX fanout; so we can instead plan
+ * the full file list and execute it sorted by checksum, which matches the
+ * on-disk object layout.
+ */
+typedef struct {
+  char checksum[OSTREE_SHA256_STRING_LEN+1];
+  char *dirpath;  /* Relative to the checkout root's parent dfd */
+  char *fname;
+} CheckoutFileItem;
+
+static void
+checkout_file_item_free (gpointer data)
+{
+  CheckoutFileItem *item = data;
+  g_free (item->dirpath);
+  g_free (item->fname);
+  g_free (item);
+}
+
+static gint
+checkout_file_item_compare (gconstpointer ap,
+                            gconstpointer bp)
+{
+  const CheckoutFileItem *a = *((CheckoutFileItem**)ap);
+  const CheckoutFileItem *b = *((CheckoutFileItem**)bp);
+  return strcmp (a->checksum, b->checksum);
+}
+
+/* Directory ownership/mode/mtime finalization deferred until after the
+ * planned file pass; created in post-order so each directory precedes its
+ * parent. */
+typedef struct {
+  char *path;  /* Relative to the checkout root's parent dfd */
+  guint32 uid, gid, mode;
+  gboolean did_exist;
+} CheckoutDirFinalizeItem;
+
+static void
+checkout_dir_finalize_item_free (gpointer data)
+{
+  CheckoutDirFinalizeItem *item = data;
+  g_free (item->path);
+  g_free (item);
+}
+
 /*
  * checkout_tree_at:
  * @self: Repo
@@ -593,6 +924,59 @@ checkout_one_file_at (OstreeRepo                        *repo,
  * Like ostree_repo_checkout_tree(), but check out @source into the
  * relative @destination_name, located by @destination_parent_fd.
  */
+static gboolean
+finalize_checkout_dir (OstreeRepo                  *self,
+                       OstreeRepoCheckoutAtOptions *options,
+                       int                          destination_dfd,
+                       gboolean                     did_exist,
+                       guint32                      uid,
+                       guint32                      gid,
+                       guint32                      mode,
+                       GError                     **error)
+{
+  if (!did_exist)
+    {
+      guint32 canonical_mode;
+      /* Silently ignore world-writable directories (plus sticky, suid bits,
+       * etc.) when doing a checkout for bare-user-only repos, or if requested explicitly.
+       * This is related to the logic in ostree-repo-commit.c for files.
+       * See also: https://github.com/ostreedev/ostree/pull/909 i.e. 0c4b3a2b6da950fd78e63f9afec602f6188f1ab0
+       */
+      if (self->mode == OSTREE_REPO_MODE_BARE_USER_ONLY || options->bareuseronly_dirs)
+        canonical_mode = (mode & 0775) | S_IFDIR;
+      else
+        canonical_mode = mode;
+      if (TEMP_FAILURE_RETRY (fchmod (destination_dfd, canonical_mode)) < 0)
+        return glnx_throw_errno_prefix (error, "fchmod");
+    }
+
+  if (!did_exist && options->mode != OSTREE_REPO_CHECKOUT_MODE_USER)
+    {
+      if (TEMP_FAILURE_RETRY (fchown (destination_dfd, uid, gid)) < 0)
+        return glnx_throw_errno (error);
+    }
+
+  /* Set directory mtime to OSTREE_TIMESTAMP, so that it is constant for all checkouts.
+   * Must be done after setting permissions and creating all children.  Note we skip doing
+   * this for directories that already exist (under the theory we possibly don't own them),
+   * and we also skip it if doing copying checkouts, which is mostly for /etc.
+   */
+  if (!did_exist && !options->force_copy)
+    {
+      const struct timespec times[2] = { { OSTREE_TIMESTAMP, UTIME_OMIT }, { OSTREE_TIMESTAMP, 0} };
+      if (TEMP_FAILURE_RETRY (futimens (destination_dfd, times)) < 0)
+        return glnx_throw_errno (error);
+    }
+
+  if (fsync_is_enabled (self, options))
+    {
+      if (fsync (destination_dfd) == -1)
+        return glnx_throw_errno (error);
+    }
+
+  return TRUE;
+}
+
 static gboolean
 checkout_tree_at_recurse (OstreeRepo                        *self,
                           OstreeRepoCheckoutAtOptions       *options,
@@ -607,25 +991,25 @@ checkout_tree_at_recurse (OstreeRepo                        *self,
   gboolean did_exist = FALSE;
   const gboolean sepolicy_enabled = options->sepolicy && !self->disable_xattrs;
   g_autoptr(GVariant) dirtree = NULL;
-  g_autoptr(GVariant) dirmeta = NULL;
   g_autoptr(GVariant) xattrs = NULL;
   g_autoptr(GVariant) modified_xattrs = NULL;
 
+  const size_t path_buf_origlen = state->path_buf ? state->path_buf->len : 0;
+  if (state->path_buf)
+    {
+      g_string_append (state->path_buf, destination_name);
+      g_string_append_c (state->path_buf, '/');
+    }
+
   if (!ostree_repo_load_variant (self, OSTREE_OBJECT_TYPE_DIR_TREE,
                                  dirtree_checksum, &dirtree, error))
     return FALSE;
-  if (!ostree_repo_load_variant (self, OSTREE_OBJECT_TYPE_DIR_META,
-                                 dirmeta_checksum, &dirmeta, error))
-    return FALSE;
 
-  /* Parse OSTREE_OBJECT_TYPE_DIR_META */
   guint32 uid, gid, mode;
-  g_variant_get (dirmeta, "(uuu@a(ayay))",
-                 &uid, &gid, &mode,
-                 options->mode != OSTREE_REPO_CHECKOUT_MODE_USER ? &xattrs : NULL);
-  uid = GUINT32_FROM_BE (uid);
-  gid = GUINT32_FROM_BE (gid);
-  mode = GUINT32_FROM_BE (mode);
+  if (!load_parsed_dirmeta (self, dirmeta_checksum, &uid, &gid, &mode,
+                            options->mode != OSTREE_REPO_CHECKOUT_MODE_USER ? &xattrs : NULL,
+                            error))
+    return FALSE;
 
   /* First, make the directory.  Push a new scope in case we end up using
    * setfscreatecon().
@@ -700,10 +1084,18 @@ checkout_tree_at_recurse (OstreeRepo                        *self,
         char tmp_checksum[OSTREE_SHA256_STRING_LEN+1];
         _ostree_checksum_inplace_from_bytes_v (contents_csum_v, tmp_checksum);
 
-        if (!checkout_one_file_at (self, options, state,
-                                   tmp_checksum,
-                                   destination_dfd, fname,
-                                   cancellable, error))
+        if (state->planned_files != NULL)
+          {
+            CheckoutFileItem *item = g_new0 (CheckoutFileItem, 1);
+            memcpy (item->checksum, tmp_checksum, sizeof (item->checksum));
+            item->dirpath = g_strdup (state->path_buf->str);
+            item->fname = g_strdup (fname);
+            g_ptr_array_add (state->planned_files, item);
+          }
+        else if (!checkout_one_file_at (self, options, state,
+                                        tmp_checksum,
+                                        destination_dfd, fname,
+                                        cancellable, error))
           return FALSE;
 
         if (selabel_path_buf)
@@ -745,46 +1137,210 @@ checkout_tree_at_recurse (OstreeRepo                        *self,
   }
 
   /* We do fchmod/fchown last so that no one else could access the
-   * partially created directory and change content we're laying out.
+   * partially created directory and change content we're laying out.  With
+   * ordered_object_reads the files haven't been written yet, so record the
+   * finalization for after the planned file pass instead.
    */
-  if (!did_exist)
+  if (state->planned_dirs != NULL)
     {
-      guint32 canonical_mode;
-      /* Silently ignore world-writable directories (plus sticky, suid bits,
-       * etc.) when doing a checkout for bare-user-only repos, or if requested explicitly.
-       * This is related to the logic in ostree-repo-commit.c for files.
-       * See also: https://github.com/ostreedev/ostree/pull/909 i.e. 0c4b3a2b6da950fd78e63f9afec602f6188f1ab0
-       */
-      if (self->mode == OSTREE_REPO_MODE_BARE_USER_ONLY || options->bareuseronly_dirs)
-        canonical_mode = (mode & 0775) | S_IFDIR;
-      else
-        canonical_mode = mode;
-      if (TEMP_FAILURE_RETRY (fchmod (destination_dfd, canonical_mode)) < 0)
-        return glnx_throw_errno_prefix (error, "fchmod");
+      CheckoutDirFinalizeItem *item = g_new0 (CheckoutDirFinalizeItem, 1);
+      item->path = g_strdup (state->path_buf->str);
+      item->uid = uid;
+      item->gid = gid;
+      item->mode = mode;
+      item->did_exist = did_exist;
+      g_ptr_array_add (state->planned_dirs, item);
+    }
+  else
+    {
+      if (!finalize_checkout_dir (self, options, destination_dfd, did_exist,
+                                  uid, gid, mode, error))
+        return FALSE;
     }
 
-  if (!did_exist && options->mode != OSTREE_REPO_CHECKOUT_MODE_USER)
+  if (state->path_buf)
+    g_string_truncate (state->path_buf, path_buf_origlen);
+
+  return TRUE;
+}
+
+/* Shared state for parallel plan execution.  File materializations are
+ * independent, so workers only synchronize on the error slot (first
+ * error wins) and, via CheckoutState.shared_lock, on the per-checkout
+ * caches. */
+typedef struct {
+  OstreeRepo *repo;
+  OstreeRepoCheckoutAtOptions *options;
+  CheckoutState *state;
+  int destination_parent_fd;
+  GCancellable *cancellable;
+  GMutex lock;      /* Doubles as CheckoutState.shared_lock */
+  GError *error;    /* Protected by lock */
+  gint stop;        /* Atomic; set on first error */
+} CheckoutPlanExec;
+
+/* A contiguous range [start, end) of the checksum-sorted plan, so each
+ * worker still sweeps the objects/XX fanout in on-disk order. */
+typedef struct {
+  CheckoutPlanExec *exec;
+  guint start;
+  guint end;
+} CheckoutPlanShard;
+
+static void
+checkout_plan_worker (gpointer item,
+                      gpointer user_data)
+{
+  CheckoutPlanShard *shard = item;
+  CheckoutPlanExec *exec = shard->exec;
+  CheckoutState *state = exec->state;
+  glnx_fd_close int current_dfd = -1;
+  const char *current_dirpath = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  for (guint i = shard->start; i < shard->end; i++)
     {
-      if (TEMP_FAILURE_RETRY (fchown (destination_dfd, uid, gid)) < 0)
-        return glnx_throw_errno (error);
+      CheckoutFileItem *file = state->planned_files->pdata[i];
+
+      if (g_atomic_int_get (&exec->stop))
+        break;
+
+      if (current_dirpath == NULL || !g_str_equal (current_dirpath, file->dirpath))
+        {
+          if (current_dfd != -1)
+            {
+              (void) close (current_dfd);
+              current_dfd = -1;
+            }
+          if (!glnx_opendirat (exec->destination_parent_fd, file->dirpath, TRUE,
+                               &current_dfd, &local_error))
+            break;
+          current_dirpath = file->dirpath;
+        }
+
+      if (!checkout_one_file_at (exec->repo, exec->options, state,
+                                 file->checksum,
+                                 current_dfd, file->fname,
+                                 exec->cancellable, &local_error))
+        break;
     }
 
-  /* Set directory mtime to OSTREE_TIMESTAMP, so that it is constant for all checkouts.
-   * Must be done after setting permissions and creating all children.  Note we skip doing
-   * this for directories that already exist (under the theory we possibly don't own them),
-   * and we also skip it if doing copying checkouts, which is mostly for /etc.
-   */
-  if (!did_exist && !options->force_copy)
+  if (local_error != NULL)
     {
-      const struct timespec times[2] = { { OSTREE_TIMESTAMP, UTIME_OMIT }, { OSTREE_TIMESTAMP, 0} };
-      if (TEMP_FAILURE_RETRY (futimens (destination_dfd, times)) < 0)
-        return glnx_throw_errno (error);
+      g_mutex_lock (&exec->lock);
+      if (exec->error == NULL)
+        exec->error = g_steal_pointer (&local_error);
+      g_mutex_unlock (&exec->lock);
+      g_atomic_int_set (&exec->stop, 1);
     }
 
-  if (fsync_is_enabled (self, options))
+  g_free (shard);
+}
+
+/* Execute a planned (ordered_object_reads) checkout: write all regular
+ * files and symlinks sorted by object checksum, so reads walk the
+ * objects/XX fanout in on-disk order rather than seeking randomly across
+ * it, then apply the deferred directory finalization.
+ *
+ * Large plans are executed by a worker pool, each worker taking a
+ * contiguous shard of the sorted plan; that keeps hundreds of file
+ * materializations in flight while preserving per-worker read locality,
+ * instead of waiting out every openat/write/fchmod round trip serially.
+ */
+#define CHECKOUT_PLAN_PARALLEL_MIN_FILES 1024
+
+static gboolean
+execute_checkout_plan (OstreeRepo                        *self,
+                       OstreeRepoCheckoutAtOptions       *options,
+                       CheckoutState                     *state,
+                       int                                destination_parent_fd,
+                       GCancellable                      *cancellable,
+                       GError                           **error)
+{
+  g_ptr_array_sort (state->planned_files, checkout_file_item_compare);
+
+  const guint n_files = state->planned_files->len;
+  const guint n_workers = MIN (g_get_num_processors (), 8);
+
+  if (n_workers > 1 && n_files >= CHECKOUT_PLAN_PARALLEL_MIN_FILES)
     {
-      if (fsync (destination_dfd) == -1)
-        return glnx_throw_errno (error);
+      CheckoutPlanExec exec = { self, options, state, destination_parent_fd,
+                                cancellable, };
+      g_mutex_init (&exec.lock);
+      state->shared_lock = &exec.lock;
+
+      /* More shards than workers, so an unlucky run of large files in
+       * one shard doesn't leave the other workers idle at the end. */
+      const guint n_shards = n_workers * 4;
+      const guint per_shard = (n_files + n_shards - 1) / n_shards;
+
+      GThreadPool *pool = g_thread_pool_new (checkout_plan_worker, &exec,
+                                             n_workers, FALSE, NULL);
+      for (guint start = 0; start < n_files; start += per_shard)
+        {
+          CheckoutPlanShard *shard = g_new0 (CheckoutPlanShard, 1);
+          shard->exec = &exec;
+          shard->start = start;
+          shard->end = MIN (start + per_shard, n_files);
+          g_thread_pool_push (pool, shard, NULL);
+        }
+      g_thread_pool_free (pool, FALSE, TRUE);
+
+      state->shared_lock = NULL;
+      g_mutex_clear (&exec.lock);
+
+      if (exec.error != NULL)
+        {
+          g_propagate_error (error, g_steal_pointer (&exec.error));
+          return FALSE;
+        }
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        return FALSE;
+    }
+  else
+    {
+      glnx_fd_close int current_dfd = -1;
+      const char *current_dirpath = NULL;
+
+      for (guint i = 0; i < n_files; i++)
+        {
+          CheckoutFileItem *item = state->planned_files->pdata[i];
+
+          if (current_dirpath == NULL || !g_str_equal (current_dirpath, item->dirpath))
+            {
+              if (current_dfd != -1)
+                {
+                  (void) close (current_dfd);
+                  current_dfd = -1;
+                }
+              if (!glnx_opendirat (destination_parent_fd, item->dirpath, TRUE,
+                                   &current_dfd, error))
+                return FALSE;
+              current_dirpath = item->dirpath;
+            }
+
+          if (!checkout_one_file_at (self, options, state,
+                                     item->checksum,
+                                     current_dfd, item->fname,
+                                     cancellable, error))
+            return FALSE;
+        }
+    }
+
+  /* The directory records were appended post-order, so each directory is
+   * finalized (and gets its canonical mtime) before its parent.
+   */
+  for (guint i = 0; i < state->planned_dirs->len; i++)
+    {
+      CheckoutDirFinalizeItem *item = state->planned_dirs->pdata[i];
+      glnx_fd_close int dir_dfd = -1;
+
+      if (!glnx_opendirat (destination_parent_fd, item->path, TRUE,
+                           &dir_dfd, error))
+        return FALSE;
+      if (!finalize_checkout_dir (self, options, dir_dfd, item->did_exist,
+                                  item->uid, item->gid, item->mode, error))
+        return FALSE;
     }
 
   return TRUE;
@@ -851,12 +1407,33 @@ checkout_tree_at (OstreeRepo                        *self,
   _ostree_repo_memory_cache_ref_init (&memcache_ref, self);
 
   g_assert_cmpint (g_file_info_get_file_type (source_info), ==, G_FILE_TYPE_DIRECTORY);
+
+  /* Two-phase checkout: plan the full file list during the directory walk,
+   * then execute it in object order.  Whiteout processing and SELinux
+   * labeling depend on visiting entries in tree order, so those keep the
+   * direct path.
+   */
+  if (options->ordered_object_reads && !options->sepolicy
+      && !options->process_whiteouts)
+    {
+      state.path_buf = g_string_new ("");
+      state.planned_files = g_ptr_array_new_with_free_func (checkout_file_item_free);
+      state.planned_dirs = g_ptr_array_new_with_free_func (checkout_dir_finalize_item_free);
+    }
+
   const char *dirtree_checksum = ostree_repo_file_tree_get_contents_checksum (source);
   const char *dirmeta_checksum = ostree_repo_file_tree_get_metadata_checksum (source);
-  return checkout_tree_at_recurse (self, options, &state, destination_parent_fd,
-                                   destination_name,
-                                   dirtree_checksum, dirmeta_checksum,
-                                   cancellable, error);
+  if (!checkout_tree_at_recurse (self, options, &state, destination_parent_fd,
+                                 destination_name,
+                                 dirtree_checksum, dirmeta_checksum,
+                                 cancellable, error))
+    return FALSE;
+
+  if (state.planned_files != NULL)
+    return execute_checkout_plan (self, options, &state, destination_parent_fd,
+                                  cancellable, error);
+
+  return TRUE;
 }
 
 static void
@@ -1032,6 +1609,145 @@ ostree_repo_checkout_at (OstreeRepo                        *self,
   return TRUE;
 }
 
+typedef struct {
+  OstreeRepoCheckoutAtOptions options;
+  int destination_dfd;
+  char *destination_path;
+  char *commit;
+  gboolean destination_existed;
+} CheckoutAtAsyncData;
+
+static void
+checkout_at_async_data_free (gpointer user_data)
+{
+  CheckoutAtAsyncData *data = user_data;
+
+  g_free ((char*)data->options.subpath);
+  g_free ((char*)data->options.sepolicy_prefix);
+  g_clear_pointer (&data->options.devino_to_csum_cache, ostree_repo_devino_cache_unref);
+  g_clear_object (&data->options.async_progress);
+  g_clear_object (&data->options.sepolicy);
+  g_free (data->destination_path);
+  g_free (data->commit);
+  g_free (data);
+}
+
+static void
+checkout_at_thread (GTask         *task,
+                    gpointer       source,
+                    gpointer       task_data,
+                    GCancellable  *cancellable)
+{
+  OstreeRepo *repo = source;
+  CheckoutAtAsyncData *data = task_data;
+  GError *local_error = NULL;
+
+  if (ostree_repo_checkout_at (repo, &data->options, data->destination_dfd,
+                               data->destination_path, data->commit,
+                               cancellable, &local_error))
+    {
+      g_task_return_boolean (task, TRUE);
+      return;
+    }
+
+  /* An interrupted checkout leaves a partially populated tree behind;
+   * if the destination was ours, don't make the caller clean it up.
+   */
+  if (!data->destination_existed
+      && g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    (void) glnx_shutil_rm_rf_at (data->destination_dfd, data->destination_path,
+                                 NULL, NULL);
+
+  g_task_return_error (task, local_error);
+}
+
+/**
+ * ostree_repo_checkout_at_async:
+ * @self: Repo
+ * @options: (allow-none): Options
+ * @destination_dfd: Directory FD for destination
+ * @destination_path: Directory for destination
+ * @commit: Checksum for commit
+ * @progress: (allow-none): Progress
+ * @cancellable: Cancellable
+ * @callback: Invoked when the checkout completes
+ * @user_data: Data for @callback
+ *
+ * An asynchronous version of ostree_repo_checkout_at(): the checkout
+ * runs on a worker thread and @callback is invoked in the caller's
+ * main context.  If @progress is provided, it is updated with
+ * `files-written` and `bytes-written` counts as the tree is
+ * materialized (equivalently, the `async_progress` member of @options
+ * may be set; the explicit argument takes precedence).
+ *
+ * On cancellation, if @destination_path did not exist beforehand, the
+ * partially written tree is removed.
+ *
+ * @destination_dfd must remain valid until @callback is invoked.
+ */
+void
+ostree_repo_checkout_at_async (OstreeRepo                        *self,
+                               OstreeRepoCheckoutAtOptions       *options,
+                               int                                destination_dfd,
+                               const char                        *destination_path,
+                               const char                        *commit,
+                               OstreeAsyncProgress               *progress,
+                               GCancellable                      *cancellable,
+                               GAsyncReadyCallback                callback,
+                               gpointer                           user_data)
+{
+  CheckoutAtAsyncData *data = g_new0 (CheckoutAtAsyncData, 1);
+
+  /* Deep-copy the options; the caller's structure (and the strings it
+   * points to) need not outlive this call.
+   */
+  if (options)
+    data->options = *options;
+  data->options.subpath = g_strdup (data->options.subpath);
+  data->options.sepolicy_prefix = g_strdup (data->options.sepolicy_prefix);
+  if (data->options.devino_to_csum_cache)
+    ostree_repo_devino_cache_ref (data->options.devino_to_csum_cache);
+  if (data->options.sepolicy)
+    g_object_ref (data->options.sepolicy);
+  if (progress != NULL)
+    data->options.async_progress = progress;
+  if (data->options.async_progress)
+    g_object_ref (data->options.async_progress);
+
+  data->destination_dfd = destination_dfd;
+  data->destination_path = g_strdup (destination_path);
+  data->commit = g_strdup (commit);
+
+  { struct stat stbuf;
+    data->destination_existed =
+      (fstatat (destination_dfd, destination_path, &stbuf, AT_SYMLINK_NOFOLLOW) == 0);
+  }
+
+  g_autoptr(GTask) task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, ostree_repo_checkout_at_async);
+  g_task_set_task_data (task, data, checkout_at_async_data_free);
+  g_task_run_in_thread (task, checkout_at_thread);
+}
+
+/**
+ * ostree_repo_checkout_at_finish:
+ * @self: Repo
+ * @result: Result from the `GAsyncReadyCallback`
+ * @error: Error
+ *
+ * Completes an invocation of ostree_repo_checkout_at_async().
+ */
+gboolean
+ostree_repo_checkout_at_finish (OstreeRepo        *self,
+                                GAsyncResult      *result,
+                                GError           **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+  g_return_val_if_fail (g_async_result_is_tagged (result, ostree_repo_checkout_at_async), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
 static guint
 devino_hash (gconstpointer a)
 {
@@ -1068,6 +1784,129 @@ ostree_repo_devino_cache_new (void)
   return (OstreeRepoDevInoCache*) g_hash_table_new_full (devino_hash, devino_equal, g_free, NULL);
 }
 
+typedef struct {
+  char *relpath;   /* "xx/rest" relative to the cache dir */
+  guint64 size;
+  struct timespec atime;
+} UncompressedCacheEntry;
+
+static void
+uncompressed_cache_entry_free (UncompressedCacheEntry *entry)
+{
+  g_free (entry->relpath);
+  g_free (entry);
+}
+
+static gint
+compare_uncompressed_cache_entries (gconstpointer ap,
+                                    gconstpointer bp)
+{
+  const UncompressedCacheEntry *a = *((UncompressedCacheEntry**)ap);
+  const UncompressedCacheEntry *b = *((UncompressedCacheEntry**)bp);
+
+  if (a->atime.tv_sec != b->atime.tv_sec)
+    return a->atime.tv_sec < b->atime.tv_sec ? -1 : 1;
+  if (a->atime.tv_nsec != b->atime.tv_nsec)
+    return a->atime.tv_nsec < b->atime.tv_nsec ? -1 : 1;
+  return 0;
+}
+
+/* Bounded variant of the uncompressed cache GC: rather than discarding
+ * every object not currently hardlinked into a checkout, keep the cache
+ * around up to core/uncompressed-cache-max-size-mb and evict in
+ * least-recently-used order (by atime; checkouts link from the cache,
+ * which reads it).  Objects still referenced by a checkout (nlink > 1)
+ * count toward the total but are never unlinked here, since removing
+ * the cache link wouldn't free their blocks anyway.  Concurrent
+ * checkouts are fine: population uses tmpfile-and-link, so we only ever
+ * race against a whole object appearing or disappearing, and a lost
+ * unlink race is ignored.
+ */
+static gboolean
+uncompressed_cache_prune_lru (OstreeRepo     *self,
+                              GCancellable   *cancellable,
+                              GError        **error)
+{
+  g_autoptr(GPtrArray) entries =
+    g_ptr_array_new_with_free_func ((GDestroyNotify)uncompressed_cache_entry_free);
+  guint64 total_size = 0;
+
+  g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
+  if (!glnx_dirfd_iterator_init_at (self->uncompressed_objects_dir_fd, ".", FALSE,
+                                    &dfd_iter, error))
+    return FALSE;
+
+  while (TRUE)
+    {
+      struct dirent *dent;
+
+      if (!glnx_dirfd_iterator_next_dent_ensure_dtype (&dfd_iter, &dent, cancellable, error))
+        return FALSE;
+      if (dent == NULL)
+        break;
+      if (dent->d_type != DT_DIR)
+        continue;
+
+      g_auto(GLnxDirFdIterator) sub_dfd_iter = { 0, };
+      if (!glnx_dirfd_iterator_init_at (dfd_iter.fd, dent->d_name, FALSE,
+                                        &sub_dfd_iter, error))
+        return FALSE;
+
+      while (TRUE)
+        {
+          struct dirent *sub_dent;
+          struct stat stbuf;
+
+          if (!glnx_dirfd_iterator_next_dent (&sub_dfd_iter, &sub_dent, cancellable, error))
+            return FALSE;
+          if (sub_dent == NULL)
+            break;
+
+          if (fstatat (sub_dfd_iter.fd, sub_dent->d_name, &stbuf, AT_SYMLINK_NOFOLLOW) != 0)
+            {
+              if (errno == ENOENT)
+                continue;  /* Raced with a concurrent prune */
+              return glnx_throw_errno_prefix (error, "fstatat");
+            }
+          if (!S_ISREG (stbuf.st_mode))
+            continue;
+
+          total_size += stbuf.st_size;
+
+          if (stbuf.st_nlink == 1)
+            {
+              UncompressedCacheEntry *entry = g_new0 (UncompressedCacheEntry, 1);
+              entry->relpath = g_strconcat (dent->d_name, "/", sub_dent->d_name, NULL);
+              entry->size = stbuf.st_size;
+              entry->atime = stbuf.st_atim;
+              g_ptr_array_add (entries, entry);
+            }
+        }
+    }
+
+  if (total_size <= self->uncompressed_cache_max_size_bytes)
+    return TRUE;
+
+  g_ptr_array_sort (entries, compare_uncompressed_cache_entries);
+
+  for (guint i = 0; i < entries->len; i++)
+    {
+      UncompressedCacheEntry *entry = entries->pdata[i];
+
+      if (total_size <= self->uncompressed_cache_max_size_bytes)
+        break;
+
+      if (unlinkat (self->uncompressed_objects_dir_fd, entry->relpath, 0) != 0)
+        {
+          if (errno != ENOENT)
+            return glnx_throw_errno_prefix (error, "unlinkat(%s)", entry->relpath);
+        }
+      total_size -= entry->size;
+    }
+
+  return TRUE;
+}
+
 /**
  * ostree_repo_checkout_gc:
  * @self: Repo
@@ -1077,6 +1916,11 @@ ostree_repo_devino_cache_new (void)
  * Call this after finishing a succession of checkout operations; it
  * will delete any currently-unused uncompressed objects from the
  * cache.
+ *
+ * If the `core/uncompressed-cache-max-size-mb` configuration option is
+ * set, unused objects are instead retained up to that size and evicted
+ * least-recently-used first, so repeated checkouts of a working set
+ * stay hot.
  */
 gboolean
 ostree_repo_checkout_gc (OstreeRepo        *self,
@@ -1085,11 +1929,18 @@ ostree_repo_checkout_gc (OstreeRepo        *self,
 {
   g_autoptr(GHashTable) to_clean_dirs = NULL;
 
+  if (!_ostree_repo_ensure_uncompressed_cache (self, error))
+    return FALSE;
+
   g_mutex_lock (&self->cache_lock);
   to_clean_dirs = self->updated_uncompressed_dirs;
   self->updated_uncompressed_dirs = g_hash_table_new (NULL, NULL);
   g_mutex_unlock (&self->cache_lock);
 
+  if (self->uncompressed_objects_dir_fd != -1 &&
+      self->uncompressed_cache_max_size_bytes > 0)
+    return uncompressed_cache_prune_lru (self, cancellable, error);
+
   if (!to_clean_dirs)
     return TRUE; /* Note early return */
 
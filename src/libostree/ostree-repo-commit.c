@@ -36,6 +36,8 @@
 #include "ostree-repo-private.h"
 #include "ostree-repo-file-enumerator.h"
 #include "ostree-checksum-input-stream.h"
+#include "ostree-deflate-converter.h"
+#include "ostree-tracepoints-private.h"
 #include "ostree-varint.h"
 
 gboolean
@@ -125,6 +127,82 @@ ot_security_smack_reset_fd (int fd)
 #endif
 }
 
+#define OSTREE_STAGING_JOURNAL ".staged-objects"
+
+/* Record @loose_path as staged.  The in-memory set is authoritative for
+ * _ostree_repo_has_loose_object() probes in this process; the on-disk
+ * journal exists so a resumed transaction can recover the set without
+ * enumerating the staging directory.  The append happens after the
+ * object has been linked into place, so a crash in between only costs
+ * a redundant re-stage on resume, never a false positive.
+ */
+static void
+txn_journal_add_object (OstreeRepo  *self,
+                        const char  *loose_path)
+{
+  g_mutex_lock (&self->txn_stats_lock);
+  if (self->txn_staged_objects != NULL &&
+      !g_hash_table_contains (self->txn_staged_objects, loose_path))
+    {
+      g_hash_table_add (self->txn_staged_objects, g_strdup (loose_path));
+      if (self->commit_stagedir_journal_fd != -1)
+        {
+          g_autofree char *line = g_strconcat (loose_path, "\n", NULL);
+          /* Best-effort; a lost append degrades to a re-stage on resume */
+          (void) glnx_loop_write (self->commit_stagedir_journal_fd, line, strlen (line));
+        }
+    }
+  g_mutex_unlock (&self->txn_stats_lock);
+}
+
+/* Open (and on resume, replay) the staging journal for the current
+ * transaction's staging directory.
+ */
+static gboolean
+txn_journal_open (OstreeRepo    *self,
+                  gboolean       resuming,
+                  GCancellable  *cancellable,
+                  GError       **error)
+{
+  self->txn_staged_objects = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  if (resuming)
+    {
+      g_autofree char *contents =
+        glnx_file_get_contents_utf8_at (self->commit_stagedir_fd, OSTREE_STAGING_JOURNAL,
+                                        NULL, cancellable, NULL);
+      if (contents != NULL)
+        {
+          g_auto(GStrv) lines = g_strsplit (contents, "\n", -1);
+          for (char **iter = lines; *iter != NULL; iter++)
+            {
+              if (**iter == '\0')
+                continue;
+              g_hash_table_add (self->txn_staged_objects, g_strdup (*iter));
+            }
+        }
+    }
+
+  self->commit_stagedir_journal_fd =
+    TEMP_FAILURE_RETRY (openat (self->commit_stagedir_fd, OSTREE_STAGING_JOURNAL,
+                                O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644));
+  if (self->commit_stagedir_journal_fd < 0)
+    return glnx_throw_errno_prefix (error, "openat(%s)", OSTREE_STAGING_JOURNAL);
+
+  return TRUE;
+}
+
+static void
+txn_journal_close (OstreeRepo *self)
+{
+  if (self->commit_stagedir_journal_fd != -1)
+    {
+      (void) close (self->commit_stagedir_journal_fd);
+      self->commit_stagedir_journal_fd = -1;
+    }
+  g_clear_pointer (&self->txn_staged_objects, g_hash_table_destroy);
+}
+
 /* Given an O_TMPFILE regular file, link it into place. */
 gboolean
 _ostree_repo_commit_tmpf_final (OstreeRepo        *self,
@@ -150,6 +228,8 @@ _ostree_repo_commit_tmpf_final (OstreeRepo        *self,
   if (!glnx_link_tmpfile_at (tmpf, GLNX_LINK_TMPFILE_NOREPLACE_IGNORE_EXIST,
                              dest_dfd, tmpbuf, error))
     return FALSE;
+  if (dest_dfd == self->commit_stagedir_fd)
+    txn_journal_add_object (self, tmpbuf);
   /* We're done with the fd */
   glnx_tmpfile_clear (tmpf);
   return TRUE;
@@ -193,6 +273,9 @@ _ostree_repo_commit_path_final (OstreeRepo        *self,
       ot_cleanup_unlinkat_clear (tmp_path);
     }
 
+  if (dest_dfd == self->commit_stagedir_fd)
+    txn_journal_add_object (self, tmpbuf);
+
   return TRUE;
 }
 
@@ -422,8 +505,18 @@ _ostree_repo_open_content_bare (OstreeRepo          *self,
       return TRUE;
     }
 
-  return glnx_open_tmpfile_linkable_at (self->tmp_dir_fd, ".", O_WRONLY|O_CLOEXEC,
-                                        out_tmpf, error);
+  if (!glnx_open_tmpfile_linkable_at (self->tmp_dir_fd, ".", O_WRONLY|O_CLOEXEC,
+                                      out_tmpf, error))
+    return FALSE;
+
+  /* We know the object size up front; preallocate it so the content
+   * lands in contiguous extents instead of growing write by write.
+   */
+  if (content_len > 0
+      && !glnx_try_fallocate (out_tmpf->fd, 0, content_len, error))
+    return FALSE;
+
+  return TRUE;
 }
 
 gboolean
@@ -505,6 +598,105 @@ create_regular_tmpfile_linkable_with_content (OstreeRepo *self,
   return TRUE;
 }
 
+/* Like _ostree_make_temporary_symlink_at(), but creates the temporary
+ * link inside the fanout directory that will hold the final object
+ * (derived from @loose_path), so the shared tmp dir is untouched and
+ * the eventual rename happens within a single directory.  @out_name is
+ * relative to @dest_dfd.
+ */
+static gboolean
+make_temporary_symlink_in_objdir (int             dest_dfd,
+                                  const char     *loose_path,
+                                  const char     *target,
+                                  char          **out_name,
+                                  GCancellable   *cancellable,
+                                  GError        **error)
+{
+  g_autofree char *tmpname = g_strdup_printf ("%.2s/tmplink.XXXXXX", loose_path);
+  const int max_attempts = 128;
+  guint i;
+
+  for (i = 0; i < max_attempts; i++)
+    {
+      glnx_gen_temp_name (tmpname);
+      if (symlinkat (target, dest_dfd, tmpname) < 0)
+        {
+          if (errno == EEXIST)
+            continue;
+          else
+            return glnx_throw_errno_prefix (error, "symlinkat");
+        }
+      else
+        break;
+    }
+  if (i == max_attempts)
+    return glnx_throw (error, "Exhausted attempts to open temporary file");
+
+  *out_name = g_steal_pointer (&tmpname);
+  return TRUE;
+}
+
+/* Decide from a sample of a payload's first bytes whether deflating it
+ * is worthwhile.  Common already-compressed formats are recognized by
+ * magic number; everything else is trial-deflated at the fastest level,
+ * which approximates an entropy test without a libm dependency.  A
+ * false positive just stores one compressible object; a false negative
+ * wastes one compression pass - both are harmless.
+ */
+static gboolean
+sample_is_incompressible (const guint8 *data,
+                          gsize         len)
+{
+  static const struct {
+    guint8 magic[6];
+    guint len;
+  } compressed_magic[] = {
+    { { 0x1f, 0x8b }, 2 },                          /* gzip */
+    { { 0xfd, '7', 'z', 'X', 'Z', 0x00 }, 6 },      /* xz */
+    { { 'B', 'Z', 'h' }, 3 },                       /* bzip2 */
+    { { 0x28, 0xb5, 0x2f, 0xfd }, 4 },              /* zstd */
+    { { 0x89, 'P', 'N', 'G' }, 4 },                 /* png */
+    { { 0xff, 0xd8, 0xff }, 3 },                    /* jpeg */
+    { { 'P', 'K', 0x03, 0x04 }, 4 },                /* zip */
+    { { 'h', 's', 'q', 's' }, 4 },                  /* squashfs */
+    { { 'O', 'g', 'g', 'S' }, 4 },                  /* ogg */
+    { { 0x37, 0x7a, 0xbc, 0xaf }, 4 },              /* 7z */
+  };
+
+  for (guint i = 0; i < G_N_ELEMENTS (compressed_magic); i++)
+    {
+      if (len >= compressed_magic[i].len
+          && memcmp (data, compressed_magic[i].magic, compressed_magic[i].len) == 0)
+        return TRUE;
+    }
+
+  g_autoptr(GConverter) compressor =
+    _ostree_deflate_compressor_new (1);
+  g_autofree guint8 *outbuf = g_malloc (len);
+  gsize inpos = 0;
+  gsize outpos = 0;
+  while (TRUE)
+    {
+      gsize bytes_read = 0;
+      gsize bytes_written = 0;
+      GConverterResult res =
+        g_converter_convert (G_CONVERTER (compressor),
+                             data + inpos, len - inpos,
+                             outbuf + outpos, len - outpos,
+                             G_CONVERTER_INPUT_AT_END,
+                             &bytes_read, &bytes_written, NULL);
+      if (res == G_CONVERTER_ERROR)
+        return TRUE;  /* Ran out of output space: the sample grew */
+      inpos += bytes_read;
+      outpos += bytes_written;
+      if (res == G_CONVERTER_FINISHED)
+        break;
+    }
+
+  /* If even the fastest level can't shave off ~3%, don't bother */
+  return outpos >= len - len / 32;
+}
+
 /* Write a content object. */
 static gboolean
 write_content_object (OstreeRepo         *self,
@@ -517,6 +709,8 @@ write_content_object (OstreeRepo         *self,
 {
   g_return_val_if_fail (expected_checksum || out_csum, FALSE);
 
+  ostree_probe2 (write_content_object, expected_checksum ?: "", file_object_length);
+
   if (g_cancellable_set_error_if_cancelled (cancellable, error))
     return FALSE;
 
@@ -524,7 +718,12 @@ write_content_object (OstreeRepo         *self,
 
   glnx_unref_object OtChecksumInstream *checksum_input = NULL;
   if (out_csum)
-    checksum_input = ot_checksum_instream_new (input, G_CHECKSUM_SHA256);
+    {
+      checksum_input = ot_checksum_instream_new (input, G_CHECKSUM_SHA256);
+      /* Record the migration digest in the same read pass */
+      if (self->record_sha512)
+        ot_checksum_instream_add_digest (checksum_input, G_CHECKSUM_SHA512);
+    }
 
   g_autoptr(GInputStream) file_input = NULL;
   g_autoptr(GVariant) xattrs = NULL;
@@ -593,9 +792,11 @@ write_content_object (OstreeRepo         *self,
    * binary with trailing garbage, creating a window on the local
    * system where a malicious setuid binary exists.
    *
-   * We use GLnxTmpfile for regular files, and OtCleanupUnlinkat for symlinks.
+   * We use GLnxTmpfile for regular files (which is O_TMPFILE-based
+   * where supported, so no tmp directory entry exists at all), and
+   * OtCleanupUnlinkat for symlinks.
    */
-  g_auto(OtCleanupUnlinkat) tmp_unlinker = { self->tmp_dir_fd, NULL };
+  g_auto(OtCleanupUnlinkat) tmp_unlinker = { -1, NULL };
   g_auto(GLnxTmpfile) tmpf = { 0, };
   goffset unpacked_size = 0;
   gboolean indexable = FALSE;
@@ -604,11 +805,10 @@ write_content_object (OstreeRepo         *self,
     {
       /* This will not be hit for bare-user or archive */
       g_assert (self->mode == OSTREE_REPO_MODE_BARE || self->mode == OSTREE_REPO_MODE_BARE_USER_ONLY);
-      if (!_ostree_make_temporary_symlink_at (self->tmp_dir_fd,
-                                              g_file_info_get_symlink_target (file_info),
-                                              &tmp_unlinker.path,
-                                              cancellable, error))
-        return FALSE;
+      /* Nothing to stage yet: a symlink object has no payload beyond
+       * the header we already fed into the checksum, so creating the
+       * temporary link is deferred until after the dedup check below.
+       */
     }
   else if (repo_mode != OSTREE_REPO_MODE_ARCHIVE_Z2)
     {
@@ -641,11 +841,36 @@ write_content_object (OstreeRepo         *self,
 
       if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_REGULAR)
         {
-          zlib_compressor = (GConverter*)g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_RAW, self->zlib_compression_level);
+          int compression_level = self->zlib_compression_level;
+
+          /* Sample the head of the payload; already-compressed content
+           * (firmware blobs, images, squashfs) is stored at level 0
+           * rather than pointlessly recompressed.  Level 0 emits stored
+           * deflate blocks, so the filez envelope is unchanged and
+           * readers decompress it as usual - just trivially.
+           */
+          gsize sample_len = 0;
+          g_autofree guint8 *sample = NULL;
+          if (size >= 512)
+            {
+              const gsize to_sample = MIN (size, (guint64)64 * 1024);
+              sample = g_malloc (to_sample);
+              if (!g_input_stream_read_all (file_input, sample, to_sample,
+                                            &sample_len, cancellable, error))
+                return FALSE;
+              if (sample_is_incompressible (sample, sample_len))
+                compression_level = 0;
+            }
+
+          zlib_compressor = _ostree_deflate_compressor_new (compression_level);
           compressed_out_stream = g_converter_output_stream_new (temp_out, zlib_compressor);
           /* Don't close the base; we'll do that later */
           g_filter_output_stream_set_close_base_stream ((GFilterOutputStream*)compressed_out_stream, FALSE);
 
+          if (sample_len > 0
+              && !g_output_stream_write_all (compressed_out_stream, sample, sample_len,
+                                             NULL, cancellable, error))
+            return FALSE;
           if (g_output_stream_splice (compressed_out_stream, file_input,
                                       0, cancellable, error) < 0)
             return FALSE;
@@ -671,6 +896,24 @@ write_content_object (OstreeRepo         *self,
         return glnx_throw (error, "Corrupted %s object %s (actual checksum is %s)",
                            ostree_object_type_to_string (OSTREE_OBJECT_TYPE_FILE),
                            expected_checksum, actual_checksum);
+
+      /* The extra digest covers the whole object stream, which has been
+       * fully consumed at this point, so record it even if the dedup
+       * check below short-circuits the write.
+       */
+      if (self->record_sha512)
+        {
+          g_autofree char *digest =
+            ot_checksum_instream_get_extra_digest_string (checksum_input, G_CHECKSUM_SHA512);
+          g_autofree char *objname =
+            ostree_object_to_string (actual_checksum, OSTREE_OBJECT_TYPE_FILE);
+          g_mutex_lock (&self->txn_stats_lock);
+          if (self->txn_sha512_index != NULL)
+            g_hash_table_replace (self->txn_sha512_index,
+                                  g_steal_pointer (&objname),
+                                  g_steal_pointer (&digest));
+          g_mutex_unlock (&self->txn_stats_lock);
+        }
     }
 
   g_assert (actual_checksum != NULL); /* Pacify static analysis */
@@ -700,6 +943,35 @@ write_content_object (OstreeRepo         *self,
   /* Is it "physically" a symlink? */
   if (phys_object_is_symlink)
     {
+      /* Only now create the temporary symlink — deduplicated objects
+       * never touch the filesystem at all.  There's no O_TMPFILE
+       * equivalent for symlinks, so we need a named temporary, but we
+       * stage it directly in the fanout directory that will hold the
+       * final object: the shared tmp dir sees no entry, and the final
+       * rename stays within a single directory.  During a transaction
+       * the staging directory is private until commit, so applying the
+       * metadata below before the rename preserves the invariant that
+       * objects are complete before they're visible at their final
+       * name.
+       */
+      char loose_path_buf[_OSTREE_LOOSE_PATH_MAX];
+      _ostree_loose_path (loose_path_buf, actual_checksum, OSTREE_OBJECT_TYPE_FILE, self->mode);
+
+      if (self->in_transaction)
+        tmp_unlinker.dfd = self->commit_stagedir_fd;
+      else
+        tmp_unlinker.dfd = self->objects_dir_fd;
+
+      if (!_ostree_repo_ensure_loose_objdir_at (tmp_unlinker.dfd, loose_path_buf,
+                                                cancellable, error))
+        return FALSE;
+
+      if (!make_temporary_symlink_in_objdir (tmp_unlinker.dfd, loose_path_buf,
+                                             g_file_info_get_symlink_target (file_info),
+                                             &tmp_unlinker.path,
+                                             cancellable, error))
+        return FALSE;
+
       if (self->mode == OSTREE_REPO_MODE_BARE_USER_ONLY)
         {
           /* We don't store the metadata in bare-user-only, so we're done. */
@@ -712,14 +984,14 @@ write_content_object (OstreeRepo         *self,
            * Note, this does not apply for bare-user repos, as they store symlinks
            * as regular files.
            */
-          if (G_UNLIKELY (fchownat (self->tmp_dir_fd, tmp_unlinker.path,
+          if (G_UNLIKELY (fchownat (tmp_unlinker.dfd, tmp_unlinker.path,
                                     uid, gid, AT_SYMLINK_NOFOLLOW) == -1))
             return glnx_throw_errno_prefix (error, "fchownat");
 
           if (xattrs != NULL)
             {
-              ot_security_smack_reset_dfd_name (self->tmp_dir_fd, tmp_unlinker.path);
-              if (!glnx_dfd_name_set_all_xattrs (self->tmp_dir_fd, tmp_unlinker.path,
+              ot_security_smack_reset_dfd_name (tmp_unlinker.dfd, tmp_unlinker.path);
+              if (!glnx_dfd_name_set_all_xattrs (tmp_unlinker.dfd, tmp_unlinker.path,
                                                  xattrs, cancellable, error))
                 return FALSE;
             }
@@ -748,6 +1020,26 @@ write_content_object (OstreeRepo         *self,
           repo_store_size_entry (self, actual_checksum, unpacked_size, stbuf.st_size);
         }
 
+      /* The quick-check index covers the loose file bytes as stored,
+       * so the CRC is taken over the staged tmpfile we're about to
+       * link into place (still hot in the page cache).  Symlink
+       * objects have no loose payload and are not indexed.
+       */
+      if (self->record_crc32c)
+        {
+          guint32 crc;
+          if (!ot_crc32c_fd (tmpf.fd, &crc, error))
+            return FALSE;
+          g_autofree char *objname =
+            ostree_object_to_string (actual_checksum, OSTREE_OBJECT_TYPE_FILE);
+          g_mutex_lock (&self->txn_stats_lock);
+          if (self->txn_crc32c_index != NULL)
+            g_hash_table_replace (self->txn_crc32c_index,
+                                  g_steal_pointer (&objname),
+                                  g_strdup_printf ("%08x", crc));
+          g_mutex_unlock (&self->txn_stats_lock);
+        }
+
       /* This path is for regular files */
       if (!commit_loose_regfile_object (self, actual_checksum, &tmpf,
                                         uid, gid, mode,
@@ -773,6 +1065,48 @@ write_content_object (OstreeRepo         *self,
   return TRUE;
 }
 
+/* Per-transaction dedup of metadata writes.  Typical trees repeat a handful
+ * of distinct dirmeta (and many dirtree) serializations thousands of times;
+ * a byte-equality lookup is much cheaper than SHA256 plus a loose-object
+ * stat per write.  Only those two object types are cached — commit objects
+ * are unique anyway and can be large.
+ */
+static char *
+txn_metadata_cache_lookup (OstreeRepo       *self,
+                           OstreeObjectType  objtype,
+                           GBytes           *buf)
+{
+  char *ret;
+
+  if (self->txn_metadata_cache == NULL)
+    return NULL;
+  if (objtype != OSTREE_OBJECT_TYPE_DIR_META && objtype != OSTREE_OBJECT_TYPE_DIR_TREE)
+    return NULL;
+
+  g_mutex_lock (&self->txn_stats_lock);
+  ret = g_strdup (g_hash_table_lookup (self->txn_metadata_cache, buf));
+  g_mutex_unlock (&self->txn_stats_lock);
+
+  return ret;
+}
+
+static void
+txn_metadata_cache_insert (OstreeRepo       *self,
+                           OstreeObjectType  objtype,
+                           GBytes           *buf,
+                           const char       *checksum)
+{
+  if (self->txn_metadata_cache == NULL)
+    return;
+  if (objtype != OSTREE_OBJECT_TYPE_DIR_META && objtype != OSTREE_OBJECT_TYPE_DIR_TREE)
+    return;
+
+  g_mutex_lock (&self->txn_stats_lock);
+  g_hash_table_replace (self->txn_metadata_cache, g_bytes_ref (buf),
+                        g_strdup (checksum));
+  g_mutex_unlock (&self->txn_stats_lock);
+}
+
 static gboolean
 write_metadata_object (OstreeRepo         *self,
                        OstreeObjectType    objtype,
@@ -784,6 +1118,9 @@ write_metadata_object (OstreeRepo         *self,
 {
   g_return_val_if_fail (expected_checksum || out_csum, FALSE);
 
+  ostree_probe3 (write_metadata_object, expected_checksum ?: "", objtype,
+                 (guint64)g_bytes_get_size (buf));
+
   if (g_cancellable_set_error_if_cancelled (cancellable, error))
     return FALSE;
 
@@ -804,6 +1141,25 @@ write_metadata_object (OstreeRepo         *self,
     }
   else
     {
+      /* Did we already see these exact bytes this transaction? */
+      actual_checksum = txn_metadata_cache_lookup (self, objtype, buf);
+      if (actual_checksum != NULL)
+        {
+          if (expected_checksum && strcmp (actual_checksum, expected_checksum) != 0)
+            return glnx_throw (error, "Corrupted %s object %s (actual checksum is %s)",
+                               ostree_object_type_to_string (objtype),
+                               expected_checksum, actual_checksum);
+
+          g_mutex_lock (&self->txn_stats_lock);
+          self->txn_stats.metadata_objects_total++;
+          g_mutex_unlock (&self->txn_stats_lock);
+
+          if (out_csum)
+            *out_csum = ostree_checksum_to_bytes (actual_checksum);
+          /* Note early return */
+          return TRUE;
+        }
+
       actual_checksum = g_compute_checksum_for_bytes (G_CHECKSUM_SHA256, buf);
       gboolean have_obj;
       if (!_ostree_repo_has_loose_object (self, actual_checksum, objtype, &have_obj,
@@ -814,6 +1170,8 @@ write_metadata_object (OstreeRepo         *self,
        */
       if (have_obj)
         {
+          txn_metadata_cache_insert (self, objtype, buf, actual_checksum);
+
           g_mutex_lock (&self->txn_stats_lock);
           self->txn_stats.metadata_objects_total++;
           g_mutex_unlock (&self->txn_stats_lock);
@@ -830,6 +1188,35 @@ write_metadata_object (OstreeRepo         *self,
                            expected_checksum, actual_checksum);
     }
 
+  /* Metadata is already in memory, so the extra digest is a cheap
+   * second walk of the buffer rather than a second disk read.
+   */
+  if (self->record_sha512 && !is_tombstone)
+    {
+      g_autofree char *digest = g_compute_checksum_for_bytes (G_CHECKSUM_SHA512, buf);
+      g_autofree char *objname = ostree_object_to_string (actual_checksum, objtype);
+      g_mutex_lock (&self->txn_stats_lock);
+      if (self->txn_sha512_index != NULL)
+        g_hash_table_replace (self->txn_sha512_index,
+                              g_steal_pointer (&objname),
+                              g_steal_pointer (&digest));
+      g_mutex_unlock (&self->txn_stats_lock);
+    }
+
+  /* A metadata object's loose file is exactly these bytes */
+  if (self->record_crc32c && !is_tombstone)
+    {
+      gsize crclen;
+      const guint8 *crcp = g_bytes_get_data (buf, &crclen);
+      g_autofree char *objname = ostree_object_to_string (actual_checksum, objtype);
+      g_mutex_lock (&self->txn_stats_lock);
+      if (self->txn_crc32c_index != NULL)
+        g_hash_table_replace (self->txn_crc32c_index,
+                              g_steal_pointer (&objname),
+                              g_strdup_printf ("%08x", ot_crc32c (0, crcp, crclen)));
+      g_mutex_unlock (&self->txn_stats_lock);
+    }
+
   /* Ok, checksum is known, let's get the data */
   gsize len;
   const guint8 *bufp = g_bytes_get_data (buf, &len);
@@ -846,13 +1233,17 @@ write_metadata_object (OstreeRepo         *self,
                  metasize, warnsize, maxsize);
     }
 
-  /* Write the metadata to a temporary file */
+  /* Write the metadata to a temporary file; @buf references the
+   * variant's serialized form directly, so this is a single copy from
+   * memory to the staging fd.  No fallocate() here: unlike the
+   * streaming content case we issue exactly one full-size write, so
+   * preallocation would only add a syscall per object, which shows up
+   * when importing millions of dirtrees.
+   */
   g_auto(GLnxTmpfile) tmpf = { 0, };
   if (!glnx_open_tmpfile_linkable_at (self->tmp_dir_fd, ".", O_WRONLY|O_CLOEXEC,
                                       &tmpf, error))
     return FALSE;
-  if (!glnx_try_fallocate (tmpf.fd, 0, len, error))
-    return FALSE;
   if (glnx_loop_write (tmpf.fd, bufp, len) < 0)
     return glnx_throw_errno_prefix (error, "write()");
   if (!glnx_fchmod (tmpf.fd, 0644, error))
@@ -884,10 +1275,14 @@ write_metadata_object (OstreeRepo         *self,
         }
     }
 
+  txn_metadata_cache_insert (self, objtype, buf, actual_checksum);
+
   /* Update the stats, note we both wrote one and add to total */
   g_mutex_lock (&self->txn_stats_lock);
   self->txn_stats.metadata_objects_written++;
   self->txn_stats.metadata_objects_total++;
+  if (objtype == OSTREE_OBJECT_TYPE_COMMIT && self->txn_written_commits != NULL)
+    g_hash_table_add (self->txn_written_commits, g_strdup (actual_checksum));
   g_mutex_unlock (&self->txn_stats_lock);
 
   if (out_csum)
@@ -902,6 +1297,14 @@ scan_one_loose_devino (OstreeRepo                     *self,
                        GCancellable                   *cancellable,
                        GError                        **error)
 {
+  /* All objects live on the device of the objects/ directory itself,
+   * and the dirent already carries the inode number, so bulk directory
+   * reads give us everything we need without a per-object fstatat().
+   */
+  struct stat object_dir_stbuf;
+  if (!glnx_fstat (object_dir_fd, &object_dir_stbuf, error))
+    return FALSE;
+
   g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
   if (!glnx_dirfd_iterator_init_at (object_dir_fd, ".", FALSE,
                                     &dfd_iter, error))
@@ -910,7 +1313,8 @@ scan_one_loose_devino (OstreeRepo                     *self,
   while (TRUE)
     {
       struct dirent *dent;
-      g_auto(GLnxDirFdIterator) child_dfd_iter = { 0, };
+      g_autoptr(GPtrArray) entries = NULL;
+      gboolean exists;
 
       if (!glnx_dirfd_iterator_next_dent (&dfd_iter, &dent, cancellable, error))
         return FALSE;
@@ -921,20 +1325,17 @@ scan_one_loose_devino (OstreeRepo                     *self,
       if (strlen (dent->d_name) != 2)
         continue;
 
-      if (!glnx_dirfd_iterator_init_at (dfd_iter.fd, dent->d_name, FALSE,
-                                        &child_dfd_iter, error))
+      if (!ot_dfd_list_sorted_allow_noent (dfd_iter.fd, dent->d_name,
+                                           &entries, &exists, error))
         return FALSE;
+      if (!exists)
+        continue;
 
-      while (TRUE)
+      for (guint i = 0; i < entries->len; i++)
         {
-          struct dirent *child_dent;
-
-          if (!glnx_dirfd_iterator_next_dent (&child_dfd_iter, &child_dent, cancellable, error))
-            return FALSE;
-          if (child_dent == NULL)
-            break;
+          const OtBulkDirent *child_dent = entries->pdata[i];
 
-          const char *name = child_dent->d_name;
+          const char *name = child_dent->name;
 
           gboolean skip;
           switch (self->mode)
@@ -958,14 +1359,9 @@ scan_one_loose_devino (OstreeRepo                     *self,
           if ((dot - name) != 62)
             continue;
 
-          struct stat stbuf;
-          if (!glnx_fstatat (child_dfd_iter.fd, child_dent->d_name,
-                             &stbuf, AT_SYMLINK_NOFOLLOW, error))
-            return FALSE;
-
           OstreeDevIno *key = g_new (OstreeDevIno, 1);
-          key->dev = stbuf.st_dev;
-          key->ino = stbuf.st_ino;
+          key->dev = object_dir_stbuf.st_dev;
+          key->ino = child_dent->ino;
           memcpy (key->checksum, dent->d_name, 2);
           memcpy (key->checksum + 2, name, 62);
           key->checksum[sizeof(key->checksum)-1] = '\0';
@@ -990,7 +1386,10 @@ scan_loose_devino (OstreeRepo                     *self,
 
   if (self->mode == OSTREE_REPO_MODE_ARCHIVE_Z2)
     {
-      if (!scan_one_loose_devino (self, self->uncompressed_objects_dir_fd, devino_cache,
+      if (!_ostree_repo_ensure_uncompressed_cache (self, error))
+        return FALSE;
+      if (self->uncompressed_objects_dir_fd != -1 &&
+          !scan_one_loose_devino (self, self->uncompressed_objects_dir_fd, devino_cache,
                                   cancellable, error))
         return FALSE;
     }
@@ -1002,76 +1401,478 @@ scan_loose_devino (OstreeRepo                     *self,
   return TRUE;
 }
 
-static const char *
-devino_cache_lookup (OstreeRepo           *self,
-                     OstreeRepoCommitModifier *modifier,
-                     guint32               device,
-                     guint32               inode)
+#define OSTREE_DEVINO_CACHE_GVARIANT_STRING "(tta(tts))"
+#define OSTREE_DEVINO_CACHE_GVARIANT_FORMAT G_VARIANT_TYPE (OSTREE_DEVINO_CACHE_GVARIANT_STRING)
+
+static gboolean
+devino_cache_snapshot_one (int            dfd,
+                           guint64       *inout_mtime_ns,
+                           GCancellable  *cancellable,
+                           GError       **error)
 {
-  OstreeDevIno dev_ino_key;
-  OstreeDevIno *dev_ino_val;
-  GHashTable *cache;
+  struct stat stbuf;
+  if (!glnx_fstat (dfd, &stbuf, error))
+    return FALSE;
+  *inout_mtime_ns = MAX (*inout_mtime_ns,
+                         (guint64)stbuf.st_mtim.tv_sec * G_GUINT64_CONSTANT (1000000000) + stbuf.st_mtim.tv_nsec);
 
-  if (self->loose_object_devino_hash)
-    cache = self->loose_object_devino_hash;
-  else if (modifier && modifier->devino_cache)
-    cache = modifier->devino_cache;
-  else
-    return NULL;
+  g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
+  if (!glnx_dirfd_iterator_init_at (dfd, ".", FALSE, &dfd_iter, error))
+    return FALSE;
 
-  dev_ino_key.dev = device;
-  dev_ino_key.ino = inode;
-  dev_ino_val = g_hash_table_lookup (cache, &dev_ino_key);
-  if (!dev_ino_val)
-    return NULL;
-  return dev_ino_val->checksum;
+  while (TRUE)
+    {
+      struct dirent *dent;
+      if (!glnx_dirfd_iterator_next_dent (&dfd_iter, &dent, cancellable, error))
+        return FALSE;
+      if (dent == NULL)
+        break;
+      if (strlen (dent->d_name) != 2)
+        continue;
+      if (!glnx_fstatat (dfd_iter.fd, dent->d_name, &stbuf, AT_SYMLINK_NOFOLLOW, error))
+        return FALSE;
+      *inout_mtime_ns = MAX (*inout_mtime_ns,
+                             (guint64)stbuf.st_mtim.tv_sec * G_GUINT64_CONSTANT (1000000000) + stbuf.st_mtim.tv_nsec);
+    }
+
+  return TRUE;
 }
 
-/**
- * ostree_repo_scan_hardlinks:
- * @self: An #OstreeRepo
- * @cancellable: Cancellable
- * @error: Error
- *
- * When ostree builds a mutable tree from directory like in
- * ostree_repo_write_directory_to_mtree(), it has to scan all files that you
- * pass in and compute their checksums. If your commit contains hardlinks from
- * ostree's existing repo, ostree can build a mapping of device numbers and
- * inodes to their checksum.
- *
- * There is an upfront cost to creating this mapping, as this will scan the
- * entire objects directory. If your commit is composed of mostly hardlinks to
- * existing ostree objects, then this will speed up considerably, so call it
- * before you call ostree_write_directory_to_mtree() or similar.
+/* Compute an invalidation token for the persisted devino cache: the device of
+ * the objects directory plus the maximal mtime over it and its fanout
+ * subdirectories.  Any object addition or removal updates a subdirectory
+ * mtime, so a matching snapshot implies the cached (dev,ino)→checksum
+ * entries are still live.
  */
-gboolean
-ostree_repo_scan_hardlinks (OstreeRepo    *self,
-                            GCancellable  *cancellable,
-                            GError       **error)
+static gboolean
+devino_cache_snapshot (OstreeRepo     *self,
+                       guint64        *out_dev,
+                       guint64        *out_mtime_ns,
+                       GCancellable   *cancellable,
+                       GError        **error)
 {
-  gboolean ret = FALSE;
+  struct stat stbuf;
+  guint64 mtime_ns = 0;
 
-  g_return_val_if_fail (self->in_transaction == TRUE, FALSE);
+  if (!glnx_fstat (self->objects_dir_fd, &stbuf, error))
+    return FALSE;
+  *out_dev = stbuf.st_dev;
 
-  if (!self->loose_object_devino_hash)
-    self->loose_object_devino_hash = (GHashTable*)ostree_repo_devino_cache_new ();
-  g_hash_table_remove_all (self->loose_object_devino_hash);
-  if (!scan_loose_devino (self, self->loose_object_devino_hash, cancellable, error))
-    goto out;
+  if (!devino_cache_snapshot_one (self->objects_dir_fd, &mtime_ns, cancellable, error))
+    return FALSE;
+  if (self->mode == OSTREE_REPO_MODE_ARCHIVE_Z2)
+    {
+      if (!_ostree_repo_ensure_uncompressed_cache (self, error))
+        return FALSE;
+      if (self->uncompressed_objects_dir_fd != -1 &&
+          !devino_cache_snapshot_one (self->uncompressed_objects_dir_fd, &mtime_ns, cancellable, error))
+        return FALSE;
+    }
 
-  ret = TRUE;
- out:
-  return ret;
+  *out_mtime_ns = mtime_ns;
+  return TRUE;
 }
 
-/**
- * ostree_repo_prepare_transaction:
- * @self: An #OstreeRepo
- * @out_transaction_resume: (allow-none) (out): Whether this transaction
- * is resuming from a previous one.  This is a legacy state, now OSTree
- * pulls use per-commit `state/.commitpartial` files.
- * @cancellable: Cancellable
- * @error: Error
+static gboolean
+devino_cache_try_load (OstreeRepo     *self,
+                       GHashTable     *devino_cache,
+                       guint64         current_dev,
+                       guint64         current_mtime_ns,
+                       gboolean       *out_loaded,
+                       GError        **error)
+{
+  *out_loaded = FALSE;
+
+  glnx_fd_close int fd = openat (self->repo_dir_fd, _OSTREE_DEVINO_CACHE_PATH, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    {
+      if (errno == ENOENT)
+        return TRUE;
+      return glnx_throw_errno_prefix (error, "openat(%s)", _OSTREE_DEVINO_CACHE_PATH);
+    }
+
+  g_autoptr(GVariant) cache_v = NULL;
+  if (!ot_util_variant_map_fd (fd, 0, OSTREE_DEVINO_CACHE_GVARIANT_FORMAT, FALSE,
+                               &cache_v, error))
+    return glnx_prefix_error (error, "Mapping %s", _OSTREE_DEVINO_CACHE_PATH);
+
+  guint64 expected_dev, expected_mtime_ns;
+  g_autoptr(GVariant) records = NULL;
+  g_variant_get (cache_v, "(tt@a(tts))", &expected_dev, &expected_mtime_ns, &records);
+
+  /* Objects were added or removed (or the volume changed) since the cache was
+   * written; fall back to a full scan.
+   */
+  if (expected_dev != current_dev || expected_mtime_ns != current_mtime_ns)
+    return TRUE;
+
+  const gsize n = g_variant_n_children (records);
+  for (gsize i = 0; i < n; i++)
+    {
+      guint64 dev, ino;
+      const char *checksum;
+      g_variant_get_child (records, i, "(tt&s)", &dev, &ino, &checksum);
+      if (strlen (checksum) != OSTREE_SHA256_STRING_LEN)
+        return glnx_throw (error, "Invalid checksum in %s", _OSTREE_DEVINO_CACHE_PATH);
+
+      OstreeDevIno *key = g_new (OstreeDevIno, 1);
+      key->dev = dev;
+      key->ino = ino;
+      memcpy (key->checksum, checksum, OSTREE_SHA256_STRING_LEN);
+      key->checksum[sizeof (key->checksum) - 1] = '\0';
+      g_hash_table_add (devino_cache, key);
+    }
+
+  *out_loaded = TRUE;
+  return TRUE;
+}
+
+static gboolean
+devino_cache_save (OstreeRepo     *self,
+                   GHashTable     *devino_cache,
+                   guint64         snapshot_dev,
+                   guint64         snapshot_mtime_ns,
+                   GCancellable   *cancellable,
+                   GError        **error)
+{
+  g_auto(GVariantBuilder) builder = OT_VARIANT_BUILDER_INITIALIZER;
+  GHashTableIter hashiter;
+  gpointer key;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(tts)"));
+  g_hash_table_iter_init (&hashiter, devino_cache);
+  while (g_hash_table_iter_next (&hashiter, &key, NULL))
+    {
+      OstreeDevIno *devino = key;
+      g_variant_builder_add (&builder, "(tts)",
+                             (guint64)devino->dev, (guint64)devino->ino,
+                             devino->checksum);
+    }
+
+  g_autoptr(GVariant) cache_v =
+    g_variant_ref_sink (g_variant_new ("(tta(tts))", snapshot_dev, snapshot_mtime_ns, &builder));
+
+  return glnx_file_replace_contents_at (self->repo_dir_fd, _OSTREE_DEVINO_CACHE_PATH,
+                                        g_variant_get_data (cache_v),
+                                        g_variant_get_size (cache_v),
+                                        GLNX_FILE_REPLACE_NODATASYNC,
+                                        cancellable, error);
+}
+
+/* Implementation of the core.commit-stat-cache repo option: a persisted map
+ * from committed relative path to the stat identity the file had and the
+ * content checksum it produced, in the spirit of git's index.  st_ctim is part
+ * of the identity so chmod/chown and xattr updates (which don't touch
+ * st_mtim) invalidate an entry.
+ */
+typedef struct {
+  guint64 dev;
+  guint64 ino;
+  guint64 mtime_ns;
+  guint64 ctime_ns;
+  guint64 size;
+  char checksum[OSTREE_SHA256_STRING_LEN+1];
+} CommitStatCacheEntry;
+
+#define OSTREE_COMMIT_STAT_CACHE_GVARIANT_STRING "a(sttttts)"
+
+static guint64
+timespec_to_ns (const struct timespec *ts)
+{
+  return (guint64)ts->tv_sec * G_GUINT64_CONSTANT (1000000000) + ts->tv_nsec;
+}
+
+static gboolean
+commit_stat_cache_ensure (OstreeRepo    *self,
+                          GCancellable  *cancellable,
+                          GError       **error)
+{
+  if (self->commit_stat_cache != NULL)
+    return TRUE;
+
+  self->commit_stat_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                   g_free, g_free);
+
+  glnx_fd_close int fd = openat (self->repo_dir_fd, _OSTREE_COMMIT_STAT_CACHE_PATH,
+                                 O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    {
+      if (errno == ENOENT)
+        return TRUE;
+      return glnx_throw_errno_prefix (error, "openat(%s)", _OSTREE_COMMIT_STAT_CACHE_PATH);
+    }
+
+  /* The cache is purely advisory; treat one we can't parse as empty. */
+  g_autoptr(GVariant) cache_v = NULL;
+  { g_autoptr(GError) temp_error = NULL;
+    if (!ot_util_variant_map_fd (fd, 0, G_VARIANT_TYPE (OSTREE_COMMIT_STAT_CACHE_GVARIANT_STRING),
+                                 FALSE, &cache_v, &temp_error))
+      return TRUE;
+  }
+
+  const gsize n = g_variant_n_children (cache_v);
+  for (gsize i = 0; i < n; i++)
+    {
+      const char *relpath;
+      const char *checksum;
+      CommitStatCacheEntry entry;
+
+      g_variant_get_child (cache_v, i, "(&sttttt&s)", &relpath,
+                           &entry.dev, &entry.ino, &entry.mtime_ns,
+                           &entry.ctime_ns, &entry.size, &checksum);
+      if (strlen (checksum) != OSTREE_SHA256_STRING_LEN)
+        continue;
+      memcpy (entry.checksum, checksum, OSTREE_SHA256_STRING_LEN);
+      entry.checksum[OSTREE_SHA256_STRING_LEN] = '\0';
+      g_hash_table_replace (self->commit_stat_cache, g_strdup (relpath),
+                            g_memdup (&entry, sizeof (entry)));
+    }
+
+  return TRUE;
+}
+
+static const char *
+commit_stat_cache_lookup (OstreeRepo        *self,
+                          const char        *relpath,
+                          const struct stat *stbuf)
+{
+  CommitStatCacheEntry *entry = g_hash_table_lookup (self->commit_stat_cache, relpath);
+
+  if (entry == NULL)
+    return NULL;
+  if (entry->dev != (guint64)stbuf->st_dev ||
+      entry->ino != (guint64)stbuf->st_ino ||
+      entry->mtime_ns != timespec_to_ns (&stbuf->st_mtim) ||
+      entry->ctime_ns != timespec_to_ns (&stbuf->st_ctim) ||
+      entry->size != (guint64)stbuf->st_size)
+    return NULL;
+  return entry->checksum;
+}
+
+static void
+commit_stat_cache_insert (OstreeRepo        *self,
+                          const char        *relpath,
+                          const struct stat *stbuf,
+                          const char        *checksum)
+{
+  CommitStatCacheEntry *entry = g_new0 (CommitStatCacheEntry, 1);
+
+  entry->dev = stbuf->st_dev;
+  entry->ino = stbuf->st_ino;
+  entry->mtime_ns = timespec_to_ns (&stbuf->st_mtim);
+  entry->ctime_ns = timespec_to_ns (&stbuf->st_ctim);
+  entry->size = stbuf->st_size;
+  memcpy (entry->checksum, checksum, OSTREE_SHA256_STRING_LEN);
+  entry->checksum[OSTREE_SHA256_STRING_LEN] = '\0';
+  g_hash_table_replace (self->commit_stat_cache, g_strdup (relpath), entry);
+}
+
+static gboolean
+commit_stat_cache_save (OstreeRepo    *self,
+                        GCancellable  *cancellable,
+                        GError       **error)
+{
+  g_auto(GVariantBuilder) builder = OT_VARIANT_BUILDER_INITIALIZER;
+  GHashTableIter hashiter;
+  gpointer hashkey, hashvalue;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE (OSTREE_COMMIT_STAT_CACHE_GVARIANT_STRING));
+  g_hash_table_iter_init (&hashiter, self->commit_stat_cache);
+  while (g_hash_table_iter_next (&hashiter, &hashkey, &hashvalue))
+    {
+      CommitStatCacheEntry *entry = hashvalue;
+      g_variant_builder_add (&builder, "(sttttts)", (const char*)hashkey,
+                             entry->dev, entry->ino, entry->mtime_ns,
+                             entry->ctime_ns, entry->size, entry->checksum);
+    }
+
+  g_autoptr(GVariant) cache_v =
+    g_variant_ref_sink (g_variant_builder_end (&builder));
+
+  return glnx_file_replace_contents_at (self->repo_dir_fd, _OSTREE_COMMIT_STAT_CACHE_PATH,
+                                        g_variant_get_data (cache_v),
+                                        g_variant_get_size (cache_v),
+                                        GLNX_FILE_REPLACE_NODATASYNC,
+                                        cancellable, error);
+}
+
+static const char *
+devino_cache_lookup (OstreeRepo           *self,
+                     OstreeRepoCommitModifier *modifier,
+                     guint32               device,
+                     guint32               inode)
+{
+  OstreeDevIno dev_ino_key;
+  OstreeDevIno *dev_ino_val;
+  GHashTable *cache;
+
+  if (self->loose_object_devino_hash)
+    cache = self->loose_object_devino_hash;
+  else if (modifier && modifier->devino_cache)
+    cache = modifier->devino_cache;
+  else
+    return NULL;
+
+  dev_ino_key.dev = device;
+  dev_ino_key.ino = inode;
+  dev_ino_val = g_hash_table_lookup (cache, &dev_ino_key);
+  if (!dev_ino_val)
+    return NULL;
+  return dev_ino_val->checksum;
+}
+
+/**
+ * ostree_repo_scan_hardlinks:
+ * @self: An #OstreeRepo
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * When ostree builds a mutable tree from directory like in
+ * ostree_repo_write_directory_to_mtree(), it has to scan all files that you
+ * pass in and compute their checksums. If your commit contains hardlinks from
+ * ostree's existing repo, ostree can build a mapping of device numbers and
+ * inodes to their checksum.
+ *
+ * There is an upfront cost to creating this mapping, as this will scan the
+ * entire objects directory. If your commit is composed of mostly hardlinks to
+ * existing ostree objects, then this will speed up considerably, so call it
+ * before you call ostree_write_directory_to_mtree() or similar.
+ */
+gboolean
+ostree_repo_scan_hardlinks (OstreeRepo    *self,
+                            GCancellable  *cancellable,
+                            GError       **error)
+{
+  gboolean ret = FALSE;
+
+  g_return_val_if_fail (self->in_transaction == TRUE, FALSE);
+
+  if (!self->loose_object_devino_hash)
+    self->loose_object_devino_hash = (GHashTable*)ostree_repo_devino_cache_new ();
+  g_hash_table_remove_all (self->loose_object_devino_hash);
+
+  /* The persisted cache saves restatting every loose object on repeated
+   * commits.  Its invalidation snapshot doesn't cover parent repos, so fall
+   * back to a full scan for those.
+   */
+  if (self->parent_repo == NULL)
+    {
+      guint64 snapshot_dev, snapshot_mtime_ns;
+      gboolean loaded = FALSE;
+
+      if (!devino_cache_snapshot (self, &snapshot_dev, &snapshot_mtime_ns,
+                                  cancellable, error))
+        goto out;
+      if (!devino_cache_try_load (self, self->loose_object_devino_hash,
+                                  snapshot_dev, snapshot_mtime_ns, &loaded, error))
+        goto out;
+      if (loaded)
+        {
+          ret = TRUE;
+          goto out;
+        }
+
+      /* The snapshot was taken before the scan, so objects landing
+       * concurrently at worst invalidate the cache on the next run.
+       */
+      if (!scan_loose_devino (self, self->loose_object_devino_hash, cancellable, error))
+        goto out;
+      if (!devino_cache_save (self, self->loose_object_devino_hash,
+                              snapshot_dev, snapshot_mtime_ns, cancellable, error))
+        goto out;
+    }
+  else if (!scan_loose_devino (self, self->loose_object_devino_hash, cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+typedef struct {
+  OstreeRepo *repo;  /* owned */
+} AutoPruneData;
+
+static gpointer
+auto_prune_thread (gpointer user_data)
+{
+  AutoPruneData *data = user_data;
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(OstreeRepo) repo = ostree_repo_new (data->repo->repodir);
+  gint n_objects_total = 0;
+  gint n_objects_pruned = 0;
+  guint64 objsize_total = 0;
+
+  /* Open a separate handle so the prune shares no transaction state
+   * with the handle that triggered it; the generation-epoch protocol
+   * (see get_prune_epoch()) already protects the in-flight transaction
+   * from the concurrent sweep.
+   */
+  if (!ostree_repo_open (repo, NULL, &local_error) ||
+      !ostree_repo_prune (repo, OSTREE_REPO_PRUNE_FLAGS_REFS_ONLY,
+                          data->repo->auto_prune_depth,
+                          &n_objects_total, &n_objects_pruned, &objsize_total,
+                          NULL, &local_error))
+    g_debug ("auto-prune failed: %s", local_error->message);
+  else
+    g_debug ("auto-prune: removed %d/%d objects, %" G_GUINT64_FORMAT " bytes",
+             n_objects_pruned, n_objects_total, objsize_total);
+
+  g_atomic_int_set (&data->repo->auto_prune_running, 0);
+  g_object_unref (data->repo);
+  g_free (data);
+  return NULL;
+}
+
+/* Implementation of core.auto-prune-watermark-percent: called at
+ * transaction start, and when free space has dropped below the
+ * watermark, kick off a background refs-only prune of the oldest
+ * unreferenced commits rather than waiting for the disk to fill and
+ * forcing a stop-the-world prune in the middle of an update window.
+ * Never fails: reclamation is best-effort and the transaction proceeds
+ * (or hits the min-free-space-percent check) regardless.
+ */
+static void
+maybe_start_auto_prune (OstreeRepo *self)
+{
+  if (self->auto_prune_watermark_percent == 0)
+    return;
+
+  struct statvfs stvfsbuf;
+  if (TEMP_FAILURE_RETRY (fstatvfs (self->repo_dir_fd, &stvfsbuf)) < 0)
+    return;
+  if (stvfsbuf.f_blocks == 0)
+    return;
+  /* Use the appropriate free block count if we're unprivileged */
+  guint64 bfree = (getuid () != 0 ? stvfsbuf.f_bavail : stvfsbuf.f_bfree);
+  if (bfree * 100 / stvfsbuf.f_blocks >= self->auto_prune_watermark_percent)
+    return;
+
+  /* One background prune at a time per handle */
+  if (!g_atomic_int_compare_and_exchange (&self->auto_prune_running, 0, 1))
+    return;
+
+  AutoPruneData *data = g_new0 (AutoPruneData, 1);
+  data->repo = g_object_ref (self);
+  GThread *thread = g_thread_try_new ("auto-prune", auto_prune_thread, data, NULL);
+  if (thread == NULL)
+    {
+      g_atomic_int_set (&self->auto_prune_running, 0);
+      g_object_unref (data->repo);
+      g_free (data);
+      return;
+    }
+  g_thread_unref (thread);
+}
+
+/**
+ * ostree_repo_prepare_transaction:
+ * @self: An #OstreeRepo
+ * @out_transaction_resume: (allow-none) (out): Whether this transaction
+ * is resuming from a previous one.  This is a legacy state, now OSTree
+ * pulls use per-commit `state/.commitpartial` files.
+ * @cancellable: Cancellable
+ * @error: Error
  *
  * Starts or resumes a transaction. In order to write to a repo, you
  * need to start a transaction. You can complete the transaction with
@@ -1080,6 +1881,21 @@ ostree_repo_scan_hardlinks (OstreeRepo    *self,
  *
  * Currently, transactions are not atomic, and aborting a transaction
  * will not erase any data you  write during the transaction.
+ *
+ * Objects written inside a transaction are not individually fsync()ed;
+ * durability is instead provided by a single syncfs() of the staging
+ * area in ostree_repo_commit_transaction(), before any refs are
+ * updated.  This batched mode is dramatically cheaper than per-object
+ * fsync for large commits while providing the same crash-safety
+ * guarantee for the published refs.
+ *
+ * Each #OstreeRepo handle supports one active transaction at a time,
+ * but the staging directory itself is per-transaction, so concurrent
+ * transactions against the same repository are fully supported by
+ * opening additional #OstreeRepo handles on the same path - whether in
+ * other threads or other processes.  At commit time each transaction
+ * merges its staged objects into the object store with rename(),
+ * which deduplicates objects some other transaction already landed.
  */
 gboolean
 ostree_repo_prepare_transaction (OstreeRepo     *self,
@@ -1087,12 +1903,34 @@ ostree_repo_prepare_transaction (OstreeRepo     *self,
                                  GCancellable   *cancellable,
                                  GError        **error)
 {
-
-  g_return_val_if_fail (self->in_transaction == FALSE, FALSE);
-
+  /* Take the stats lock around the flag transition, so a second thread
+   * racing on the same handle gets a clean error rather than sharing
+   * (and corrupting) this transaction's staging state.
+   */
+  g_mutex_lock (&self->txn_stats_lock);
+  if (self->in_transaction)
+    {
+      g_mutex_unlock (&self->txn_stats_lock);
+      return glnx_throw (error, "A transaction is already in progress on this repository handle; "
+                                "open another OstreeRepo on the same path to commit concurrently");
+    }
   memset (&self->txn_stats, 0, sizeof (OstreeRepoTransactionStats));
-
+  self->txn_metadata_cache = g_hash_table_new_full (g_bytes_hash, g_bytes_equal,
+                                                    (GDestroyNotify) g_bytes_unref, g_free);
+  self->txn_written_commits = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  if (self->record_sha512)
+    self->txn_sha512_index = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  if (self->record_crc32c)
+    self->txn_crc32c_index = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
   self->in_transaction = TRUE;
+  g_mutex_unlock (&self->txn_stats_lock);
+
+  /* Kick off background reclamation before the hard free-space check,
+   * so that even a transaction about to fail on min-free-space-percent
+   * starts freeing space for the retry.
+   */
+  maybe_start_auto_prune (self);
+
   if (self->min_free_space_percent > 0)
     {
       struct statvfs stvfsbuf;
@@ -1127,6 +1965,9 @@ ostree_repo_prepare_transaction (OstreeRepo     *self,
                                      cancellable, error))
     return FALSE;
 
+  if (!txn_journal_open (self, ret_transaction_resume, cancellable, error))
+    return FALSE;
+
   if (out_transaction_resume)
     *out_transaction_resume = ret_transaction_resume;
   return TRUE;
@@ -1193,7 +2034,7 @@ rename_pending_loose_objects (OstreeRepo        *self,
           renamed_some_object = TRUE;
         }
 
-      if (renamed_some_object)
+      if (renamed_some_object && !self->disable_fsync)
         {
           /* Ensure that in the case of a power cut all the directory metadata that
              we want has reached the disk. In particular, we want this before we
@@ -1214,7 +2055,7 @@ rename_pending_loose_objects (OstreeRepo        *self,
     }
 
   /* In case we created any loose object subdirs, make sure they are on disk */
-  if (fsync (self->objects_dir_fd) == -1)
+  if (!self->disable_fsync && fsync (self->objects_dir_fd) == -1)
     return glnx_throw_errno_prefix (error, "fsync");
 
   if (!glnx_shutil_rm_rf_at (self->tmp_dir_fd, self->commit_stagedir_name,
@@ -1511,80 +2352,464 @@ ostree_repo_set_collection_ref_immediate (OstreeRepo                 *self,
                                  cancellable, error);
 }
 
-/**
- * ostree_repo_commit_transaction:
- * @self: An #OstreeRepo
- * @out_stats: (allow-none) (out): A set of statistics of things
- * that happened during this transaction.
- * @cancellable: Cancellable
- * @error: Error
- *
- * Complete the transaction. Any refs set with
- * ostree_repo_transaction_set_ref() or
- * ostree_repo_transaction_set_refspec() will be written out.
+/* The SHA512 migration index: a sorted `a(ss)` array of (object name,
+ * hex digest) pairs in the repo cache directory, recording the SHA512
+ * digest of each object's canonical stream.  Extended incrementally
+ * here at transaction commit (with core.extra-checksum-algos=sha512)
+ * and by `ostree fsck --checksum=sha256,sha512`; in both cases the
+ * digest was computed in the same pass as the SHA256 the object is
+ * addressed by.
  */
+#define _OSTREE_SHA512_INDEX_NAME "sha512-index"
+
 gboolean
-ostree_repo_commit_transaction (OstreeRepo                  *self,
-                                OstreeRepoTransactionStats  *out_stats,
-                                GCancellable                *cancellable,
-                                GError                     **error)
+_ostree_repo_sha512_index_update (OstreeRepo    *self,
+                                  GHashTable    *new_entries,
+                                  GCancellable  *cancellable,
+                                  GError       **error)
 {
-  g_return_val_if_fail (self->in_transaction == TRUE, FALSE);
-
-  if ((self->test_error_flags & OSTREE_REPO_TEST_ERROR_PRE_COMMIT) > 0)
-    return glnx_throw (error, "OSTREE_REPO_TEST_ERROR_PRE_COMMIT specified");
-
-  /* FIXME: Added since valgrind in el7 doesn't know about
-   * `syncfs`...we should delete this later.
-   */
-  if (g_getenv ("OSTREE_SUPPRESS_SYNCFS") == NULL)
-    {
-      if (syncfs (self->tmp_dir_fd) < 0)
-        return glnx_throw_errno (error);
-    }
-
-  if (!rename_pending_loose_objects (self, cancellable, error))
-    return FALSE;
+  if (self->cache_dir_fd == -1)
+    return TRUE;
 
-  if (!cleanup_tmpdir (self, cancellable, error))
-    return FALSE;
+  g_autoptr(GHashTable) merged = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                        g_free, g_free);
 
-  if (self->loose_object_devino_hash)
-    g_hash_table_remove_all (self->loose_object_devino_hash);
+  { glnx_fd_close int fd = -1;
+    g_autoptr(GVariant) existing = NULL;
 
-  if (self->txn_refs)
-    if (!_ostree_repo_update_refs (self, self->txn_refs, cancellable, error))
+    if (!ot_openat_ignore_enoent (self->cache_dir_fd, _OSTREE_SHA512_INDEX_NAME, &fd, error))
       return FALSE;
-  g_clear_pointer (&self->txn_refs, g_hash_table_destroy);
+    if (fd != -1 && ot_util_variant_map_fd (fd, 0, G_VARIANT_TYPE ("a(ss)"),
+                                            TRUE, &existing, NULL))
+      {
+        GVariantIter viter;
+        const char *name;
+        const char *digest;
+
+        g_variant_iter_init (&viter, existing);
+        while (g_variant_iter_loop (&viter, "(&s&s)", &name, &digest))
+          g_hash_table_replace (merged, g_strdup (name), g_strdup (digest));
+      }
+  }
+
+  GHashTableIter hiter;
+  gpointer key, value;
+  g_hash_table_iter_init (&hiter, new_entries);
+  while (g_hash_table_iter_next (&hiter, &key, &value))
+    g_hash_table_replace (merged, g_strdup (key), g_strdup (value));
+
+  g_autoptr(GList) sorted = g_hash_table_get_keys (merged);
+  sorted = g_list_sort (sorted, (GCompareFunc)strcmp);
+
+  g_autoptr(GVariantBuilder) builder = g_variant_builder_new (G_VARIANT_TYPE ("a(ss)"));
+  for (GList *iter = sorted; iter != NULL; iter = iter->next)
+    g_variant_builder_add (builder, "(ss)", iter->data,
+                           g_hash_table_lookup (merged, iter->data));
+  g_autoptr(GVariant) index = g_variant_ref_sink (g_variant_builder_end (builder));
+
+  if (!glnx_file_replace_contents_at (self->cache_dir_fd, _OSTREE_SHA512_INDEX_NAME,
+                                      g_variant_get_data (index),
+                                      g_variant_get_size (index),
+                                      self->disable_fsync ?
+                                      GLNX_FILE_REPLACE_NODATASYNC :
+                                      GLNX_FILE_REPLACE_DATASYNC_NEW,
+                                      cancellable, error))
+    return FALSE;
 
-  if (self->txn_collection_refs)
-    if (!_ostree_repo_update_collection_refs (self, self->txn_collection_refs, cancellable, error))
-      return FALSE;
-  g_clear_pointer (&self->txn_collection_refs, g_hash_table_destroy);
+  return TRUE;
+}
 
-  if (self->commit_stagedir_fd != -1)
-    {
-      (void) close (self->commit_stagedir_fd);
-      self->commit_stagedir_fd = -1;
+/* The quick-check index: a sorted `a(ss)` array of (object name,
+ * "%08x" CRC32C) pairs in the repo cache directory, covering the
+ * loose file bytes of each object as stored on disk.  Unlike the
+ * SHA512 index above this is not a migration artifact but a scrub
+ * accelerator: `ostree fsck --quick` re-reads each loose file and
+ * compares CRCs at memory bandwidth, escalating to full checksum
+ * verification only for mismatched or unindexed objects.
+ */
+#define _OSTREE_CRC32C_INDEX_NAME "crc32c-index"
 
-      glnx_release_lock_file (&self->commit_stagedir_lock);
-    }
+gboolean
+_ostree_repo_crc32c_index_update (OstreeRepo    *self,
+                                  GHashTable    *new_entries,
+                                  GCancellable  *cancellable,
+                                  GError       **error)
+{
+  if (self->cache_dir_fd == -1)
+    return TRUE;
 
-  g_clear_pointer (&self->commit_stagedir_name, g_free);
+  g_autoptr(GHashTable) merged = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                        g_free, g_free);
 
-  self->in_transaction = FALSE;
+  { glnx_fd_close int fd = -1;
+    g_autoptr(GVariant) existing = NULL;
 
-  if (!ot_ensure_unlinked_at (self->repo_dir_fd, "transaction", 0))
+    if (!ot_openat_ignore_enoent (self->cache_dir_fd, _OSTREE_CRC32C_INDEX_NAME, &fd, error))
+      return FALSE;
+    if (fd != -1 && ot_util_variant_map_fd (fd, 0, G_VARIANT_TYPE ("a(ss)"),
+                                            TRUE, &existing, NULL))
+      {
+        GVariantIter viter;
+        const char *name;
+        const char *crc;
+
+        g_variant_iter_init (&viter, existing);
+        while (g_variant_iter_loop (&viter, "(&s&s)", &name, &crc))
+          g_hash_table_replace (merged, g_strdup (name), g_strdup (crc));
+      }
+  }
+
+  GHashTableIter hiter;
+  gpointer key, value;
+  g_hash_table_iter_init (&hiter, new_entries);
+  while (g_hash_table_iter_next (&hiter, &key, &value))
+    g_hash_table_replace (merged, g_strdup (key), g_strdup (value));
+
+  g_autoptr(GList) sorted = g_hash_table_get_keys (merged);
+  sorted = g_list_sort (sorted, (GCompareFunc)strcmp);
+
+  g_autoptr(GVariantBuilder) builder = g_variant_builder_new (G_VARIANT_TYPE ("a(ss)"));
+  for (GList *iter = sorted; iter != NULL; iter = iter->next)
+    g_variant_builder_add (builder, "(ss)", iter->data,
+                           g_hash_table_lookup (merged, iter->data));
+  g_autoptr(GVariant) index = g_variant_ref_sink (g_variant_builder_end (builder));
+
+  if (!glnx_file_replace_contents_at (self->cache_dir_fd, _OSTREE_CRC32C_INDEX_NAME,
+                                      g_variant_get_data (index),
+                                      g_variant_get_size (index),
+                                      self->disable_fsync ?
+                                      GLNX_FILE_REPLACE_NODATASYNC :
+                                      GLNX_FILE_REPLACE_DATASYNC_NEW,
+                                      cancellable, error))
     return FALSE;
 
-  if (out_stats)
-    *out_stats = self->txn_stats;
-
   return TRUE;
 }
 
+/* Check every loose object's stored bytes against the CRC32C index.
+ * Matches count into @out_n_verified; objects that are unindexed or
+ * whose CRC differs are returned in @out_unverified, mapped to the
+ * CRC of the bytes actually on disk, so the caller can escalate them
+ * to full checksum verification and fold the result back into the
+ * index.  Symlink objects have no loose payload and are skipped.
+ */
 gboolean
-ostree_repo_abort_transaction (OstreeRepo     *self,
+_ostree_repo_crc32c_quick_check (OstreeRepo    *self,
+                                 guint         *out_n_verified,
+                                 GHashTable   **out_unverified,
+                                 GCancellable  *cancellable,
+                                 GError       **error)
+{
+  guint n_verified = 0;
+  g_autoptr(GHashTable) unverified = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                            g_free, g_free);
+
+  g_autoptr(GVariant) index = NULL;
+  if (self->cache_dir_fd != -1)
+    {
+      glnx_fd_close int fd = -1;
+      if (!ot_openat_ignore_enoent (self->cache_dir_fd, _OSTREE_CRC32C_INDEX_NAME, &fd, error))
+        return FALSE;
+      if (fd != -1)
+        (void) ot_util_variant_map_fd (fd, 0, G_VARIANT_TYPE ("a(ss)"), TRUE, &index, NULL);
+    }
+
+  g_autoptr(GHashTable) objects = NULL;
+  if (!ostree_repo_list_objects (self, OSTREE_REPO_LIST_OBJECTS_LOOSE, &objects,
+                                 cancellable, error))
+    return FALSE;
+
+  GHashTableIter hiter;
+  gpointer key, value;
+  g_hash_table_iter_init (&hiter, objects);
+  while (g_hash_table_iter_next (&hiter, &key, &value))
+    {
+      GVariant *serialized_key = key;
+      const char *checksum;
+      OstreeObjectType objtype;
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        return FALSE;
+
+      ostree_object_name_deserialize (serialized_key, &checksum, &objtype);
+
+      char loose_path[_OSTREE_LOOSE_PATH_MAX];
+      _ostree_loose_path (loose_path, checksum, objtype, self->mode);
+
+      struct stat stbuf;
+      if (TEMP_FAILURE_RETRY (fstatat (self->objects_dir_fd, loose_path, &stbuf,
+                                       AT_SYMLINK_NOFOLLOW)) < 0)
+        {
+          if (errno == ENOENT)
+            continue; /* Raced with a prune */
+          return glnx_throw_errno_prefix (error, "fstatat(%s)", loose_path);
+        }
+      if (S_ISLNK (stbuf.st_mode))
+        continue;
+
+      glnx_fd_close int fd = openat (self->objects_dir_fd, loose_path,
+                                     O_RDONLY | O_CLOEXEC);
+      if (fd < 0)
+        {
+          if (errno == ENOENT)
+            continue;
+          return glnx_throw_errno_prefix (error, "openat(%s)", loose_path);
+        }
+
+      guint32 crc;
+      if (!ot_crc32c_fd (fd, &crc, error))
+        return FALSE;
+      g_autofree char *actual = g_strdup_printf ("%08x", crc);
+      g_autofree char *objname = ostree_object_to_string (checksum, objtype);
+
+      int pos;
+      if (index != NULL && ot_variant_bsearch_str (index, objname, &pos))
+        {
+          g_autoptr(GVariant) entry = g_variant_get_child_value (index, pos);
+          const char *recorded;
+          g_variant_get_child (entry, 1, "&s", &recorded);
+          if (g_str_equal (recorded, actual))
+            {
+              n_verified++;
+              continue;
+            }
+        }
+
+      g_hash_table_replace (unverified, g_steal_pointer (&objname),
+                            g_steal_pointer (&actual));
+    }
+
+  if (out_n_verified)
+    *out_n_verified = n_verified;
+  ot_transfer_out_value (out_unverified, &unverified);
+  return TRUE;
+}
+
+/* Ensure the cached size closure for commit @checksum exists under
+ * state/size-closures/, building it from a traversal when absent.  The
+ * file records (object checksum, objtype, storage size) for every
+ * object in the commit's closure; like the prune closures it is content
+ * addressed and hence immutable until the commit itself is pruned.
+ * Partial commits can't be sized and are never cached; *out_closure is
+ * left %NULL for them.
+ */
+gboolean
+_ostree_repo_size_closure_ensure (OstreeRepo    *self,
+                                  const char    *checksum,
+                                  GVariant     **out_closure,
+                                  GCancellable  *cancellable,
+                                  GError       **error)
+{
+  g_autofree char *path = _ostree_get_size_closure_path (checksum);
+  g_autoptr(GVariant) closure = NULL;
+
+  { glnx_fd_close int fd = -1;
+    if (!ot_openat_ignore_enoent (self->repo_dir_fd, path, &fd, error))
+      return FALSE;
+    /* The cache is advisory; unparsable content is just a miss */
+    if (fd != -1
+        && ot_util_variant_map_fd (fd, 0, G_VARIANT_TYPE (_OSTREE_SIZE_CLOSURE_GVARIANT_STRING),
+                                   FALSE, &closure, NULL))
+      {
+        if (out_closure)
+          *out_closure = g_steal_pointer (&closure);
+        return TRUE;
+      }
+  }
+
+  g_autoptr(GHashTable) reachable = NULL;
+  { g_autoptr(GError) local_error = NULL;
+    if (!ostree_repo_traverse_commit (self, checksum, 0, &reachable,
+                                      cancellable, &local_error))
+      {
+        if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+          {
+            if (out_closure)
+              *out_closure = NULL;
+            return TRUE;
+          }
+        g_propagate_error (error, g_steal_pointer (&local_error));
+        return FALSE;
+      }
+  }
+
+  g_auto(GVariantBuilder) builder = OT_VARIANT_BUILDER_INITIALIZER;
+  g_variant_builder_init (&builder, G_VARIANT_TYPE (_OSTREE_SIZE_CLOSURE_GVARIANT_STRING));
+  GLNX_HASH_TABLE_FOREACH (reachable, GVariant*, object)
+    {
+      const char *obj_checksum;
+      OstreeObjectType objtype;
+      guint64 size;
+
+      ostree_object_name_deserialize (object, &obj_checksum, &objtype);
+      if (!ostree_repo_query_object_storage_size (self, objtype, obj_checksum,
+                                                  &size, cancellable, error))
+        return FALSE;
+      g_variant_builder_add (&builder, "(sut)", obj_checksum, (guint32)objtype, size);
+    }
+  closure = g_variant_ref_sink (g_variant_builder_end (&builder));
+
+  if (!glnx_shutil_mkdir_p_at (self->repo_dir_fd, _OSTREE_SIZE_CLOSURE_DIR, 0755,
+                               cancellable, error))
+    return FALSE;
+  if (!glnx_file_replace_contents_at (self->repo_dir_fd, path,
+                                      g_variant_get_data (closure),
+                                      g_variant_get_size (closure),
+                                      GLNX_FILE_REPLACE_NODATASYNC,
+                                      cancellable, error))
+    return FALSE;
+
+  if (out_closure)
+    *out_closure = g_steal_pointer (&closure);
+  return TRUE;
+}
+
+/**
+ * ostree_repo_commit_transaction:
+ * @self: An #OstreeRepo
+ * @out_stats: (allow-none) (out): A set of statistics of things
+ * that happened during this transaction.
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Complete the transaction. Any refs set with
+ * ostree_repo_transaction_set_ref() or
+ * ostree_repo_transaction_set_refspec() will be written out.
+ */
+gboolean
+ostree_repo_commit_transaction (OstreeRepo                  *self,
+                                OstreeRepoTransactionStats  *out_stats,
+                                GCancellable                *cancellable,
+                                GError                     **error)
+{
+  g_return_val_if_fail (self->in_transaction == TRUE, FALSE);
+
+  if ((self->test_error_flags & OSTREE_REPO_TEST_ERROR_PRE_COMMIT) > 0)
+    return glnx_throw (error, "OSTREE_REPO_TEST_ERROR_PRE_COMMIT specified");
+
+  /* Object writes inside a transaction skip per-object fsync()
+   * entirely; this single syncfs() is what makes the whole staged
+   * object set durable before we publish it via the rename dance and
+   * the ref update below.  Hence we can (and should) skip it when
+   * fsync is disabled, and when the transaction didn't stage any
+   * objects (e.g. ref-only transactions).  The staging journal is the
+   * authority on whether anything was staged - txn_stats only counts
+   * the regular write paths, not adopted or passed-through objects.
+   *
+   * FIXME: The env var was added since valgrind in el7 doesn't know
+   * about `syncfs`...we should delete this later.
+   */
+  gboolean staged_any;
+  g_mutex_lock (&self->txn_stats_lock);
+  staged_any = (self->txn_staged_objects != NULL
+                && g_hash_table_size (self->txn_staged_objects) > 0);
+  g_mutex_unlock (&self->txn_stats_lock);
+
+  if (!self->disable_fsync
+      && staged_any
+      && g_getenv ("OSTREE_SUPPRESS_SYNCFS") == NULL)
+    {
+      if (syncfs (self->tmp_dir_fd) < 0)
+        return glnx_throw_errno (error);
+    }
+
+  if (!rename_pending_loose_objects (self, cancellable, error))
+    return FALSE;
+
+  if (!cleanup_tmpdir (self, cancellable, error))
+    return FALSE;
+
+  if (self->loose_object_devino_hash)
+    g_hash_table_remove_all (self->loose_object_devino_hash);
+
+  g_clear_pointer (&self->txn_metadata_cache, g_hash_table_destroy);
+
+  /* The objects the stat cache references are now committed to disk */
+  if (self->commit_stat_cache)
+    {
+      if (!commit_stat_cache_save (self, cancellable, error))
+        return FALSE;
+    }
+
+  if (self->txn_refs)
+    if (!_ostree_repo_update_refs (self, self->txn_refs, cancellable, error))
+      return FALSE;
+  g_clear_pointer (&self->txn_refs, g_hash_table_destroy);
+
+  if (self->txn_collection_refs)
+    if (!_ostree_repo_update_collection_refs (self, self->txn_collection_refs, cancellable, error))
+      return FALSE;
+  g_clear_pointer (&self->txn_collection_refs, g_hash_table_destroy);
+
+  /* Fold the commits we just landed into the commit graph, so
+   * timestamp/parent scans stay a single index read even on repos that
+   * never regenerate a summary.
+   */
+  if (self->txn_written_commits != NULL
+      && g_hash_table_size (self->txn_written_commits) > 0)
+    {
+      if (!_ostree_repo_commit_graph_merge (self, self->txn_written_commits,
+                                            cancellable, error))
+        return FALSE;
+
+      /* Likewise cache each new commit's size closure while its objects
+       * are still hot, so ostree_repo_get_commit_sizes() never has to
+       * traverse on demand.
+       */
+      GLNX_HASH_TABLE_FOREACH (self->txn_written_commits, const char*, commit_checksum)
+        {
+          if (!_ostree_repo_size_closure_ensure (self, commit_checksum, NULL,
+                                                 cancellable, error))
+            return FALSE;
+        }
+    }
+  g_clear_pointer (&self->txn_written_commits, g_hash_table_destroy);
+
+  if (self->txn_sha512_index != NULL
+      && g_hash_table_size (self->txn_sha512_index) > 0)
+    {
+      if (!_ostree_repo_sha512_index_update (self, self->txn_sha512_index,
+                                             cancellable, error))
+        return FALSE;
+    }
+  g_clear_pointer (&self->txn_sha512_index, g_hash_table_destroy);
+
+  if (self->txn_crc32c_index != NULL
+      && g_hash_table_size (self->txn_crc32c_index) > 0)
+    {
+      if (!_ostree_repo_crc32c_index_update (self, self->txn_crc32c_index,
+                                             cancellable, error))
+        return FALSE;
+    }
+  g_clear_pointer (&self->txn_crc32c_index, g_hash_table_destroy);
+
+  txn_journal_close (self);
+
+  if (self->commit_stagedir_fd != -1)
+    {
+      (void) close (self->commit_stagedir_fd);
+      self->commit_stagedir_fd = -1;
+
+      glnx_release_lock_file (&self->commit_stagedir_lock);
+    }
+
+  g_clear_pointer (&self->commit_stagedir_name, g_free);
+
+  g_mutex_lock (&self->txn_stats_lock);
+  self->in_transaction = FALSE;
+  g_mutex_unlock (&self->txn_stats_lock);
+
+  if (!ot_ensure_unlinked_at (self->repo_dir_fd, "transaction", 0))
+    return FALSE;
+
+  if (out_stats)
+    *out_stats = self->txn_stats;
+
+  return TRUE;
+}
+
+gboolean
+ostree_repo_abort_transaction (OstreeRepo     *self,
                                GCancellable   *cancellable,
                                GError        **error)
 {
@@ -1598,9 +2823,21 @@ ostree_repo_abort_transaction (OstreeRepo     *self,
   if (self->loose_object_devino_hash)
     g_hash_table_remove_all (self->loose_object_devino_hash);
 
+  g_clear_pointer (&self->txn_metadata_cache, g_hash_table_destroy);
+  g_clear_pointer (&self->txn_written_commits, g_hash_table_destroy);
+  g_clear_pointer (&self->txn_sha512_index, g_hash_table_destroy);
+  g_clear_pointer (&self->txn_crc32c_index, g_hash_table_destroy);
+
+  /* Discard un-persisted stat cache entries; they may reference objects
+   * that were staged but never committed.
+   */
+  g_clear_pointer (&self->commit_stat_cache, g_hash_table_destroy);
+
   g_clear_pointer (&self->txn_refs, g_hash_table_destroy);
   g_clear_pointer (&self->txn_collection_refs, g_hash_table_destroy);
 
+  txn_journal_close (self);
+
   if (self->commit_stagedir_fd != -1)
     {
       (void) close (self->commit_stagedir_fd);
@@ -1610,7 +2847,9 @@ ostree_repo_abort_transaction (OstreeRepo     *self,
     }
   g_clear_pointer (&self->commit_stagedir_name, g_free);
 
+  g_mutex_lock (&self->txn_stats_lock);
   self->in_transaction = FALSE;
+  g_mutex_unlock (&self->txn_stats_lock);
 
   return TRUE;
 }
@@ -1763,14 +3002,9 @@ ostree_repo_write_metadata_trusted (OstreeRepo         *self,
 }
 
 typedef struct {
-  OstreeRepo *repo;
   OstreeObjectType objtype;
   char *expected_checksum;
   GVariant *object;
-  GCancellable *cancellable;
-  GSimpleAsyncResult *result;
-
-  guchar *result_csum;
 } WriteMetadataAsyncData;
 
 static void
@@ -1778,28 +3012,29 @@ write_metadata_async_data_free (gpointer user_data)
 {
   WriteMetadataAsyncData *data = user_data;
 
-  g_clear_object (&data->repo);
-  g_clear_object (&data->cancellable);
   g_variant_unref (data->object);
-  g_free (data->result_csum);
   g_free (data->expected_checksum);
   g_free (data);
 }
 
 static void
-write_metadata_thread (GSimpleAsyncResult  *res,
-                       GObject             *object,
-                       GCancellable        *cancellable)
+write_metadata_thread (GTask         *task,
+                       gpointer       source,
+                       gpointer       task_data,
+                       GCancellable  *cancellable)
 {
   GError *error = NULL;
-  WriteMetadataAsyncData *data;
+  OstreeRepo *repo = source;
+  WriteMetadataAsyncData *data = task_data;
+  guchar *result_csum = NULL;
 
-  data = g_simple_async_result_get_op_res_gpointer (res);
-  if (!ostree_repo_write_metadata (data->repo, data->objtype, data->expected_checksum,
+  if (!ostree_repo_write_metadata (repo, data->objtype, data->expected_checksum,
                                    data->object,
-                                   &data->result_csum,
+                                   &result_csum,
                                    cancellable, &error))
-    g_simple_async_result_take_error (res, error);
+    g_task_return_error (task, error);
+  else
+    g_task_return_pointer (task, result_csum, g_free);
 }
 
 /**
@@ -1825,22 +3060,17 @@ ostree_repo_write_metadata_async (OstreeRepo               *self,
                                   gpointer                  user_data)
 {
   WriteMetadataAsyncData *asyncdata;
+  g_autoptr(GTask) task = NULL;
 
   asyncdata = g_new0 (WriteMetadataAsyncData, 1);
-  asyncdata->repo = g_object_ref (self);
   asyncdata->objtype = objtype;
   asyncdata->expected_checksum = g_strdup (expected_checksum);
   asyncdata->object = g_variant_ref (object);
-  asyncdata->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
-
-  asyncdata->result = g_simple_async_result_new ((GObject*) self,
-                                                 callback, user_data,
-                                                 ostree_repo_write_metadata_async);
 
-  g_simple_async_result_set_op_res_gpointer (asyncdata->result, asyncdata,
-                                             write_metadata_async_data_free);
-  g_simple_async_result_run_in_thread (asyncdata->result, write_metadata_thread, G_PRIORITY_DEFAULT, cancellable);
-  g_object_unref (asyncdata->result);
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, ostree_repo_write_metadata_async);
+  g_task_set_task_data (task, asyncdata, write_metadata_async_data_free);
+  g_task_run_in_thread (task, write_metadata_thread);
 }
 
 gboolean
@@ -1849,18 +3079,17 @@ ostree_repo_write_metadata_finish (OstreeRepo        *self,
                                    guchar           **out_csum,
                                    GError           **error)
 {
-  GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (result);
-  WriteMetadataAsyncData *data;
+  guchar *ret_csum;
 
-  g_warn_if_fail (g_simple_async_result_get_source_tag (simple) == ostree_repo_write_metadata_async);
+  g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+  g_return_val_if_fail (g_async_result_is_tagged (result, ostree_repo_write_metadata_async), FALSE);
 
-  if (g_simple_async_result_propagate_error (simple, error))
+  ret_csum = g_task_propagate_pointer (G_TASK (result), error);
+  if (ret_csum == NULL)
     return FALSE;
 
-  data = g_simple_async_result_get_op_res_gpointer (simple);
   /* Transfer ownership */
-  *out_csum = data->result_csum;
-  data->result_csum = NULL;
+  *out_csum = ret_csum;
   return TRUE;
 }
 
@@ -1957,14 +3186,9 @@ ostree_repo_write_content (OstreeRepo       *self,
 }
 
 typedef struct {
-  OstreeRepo *repo;
   char *expected_checksum;
   GInputStream *object;
   guint64 file_object_length;
-  GCancellable *cancellable;
-  GSimpleAsyncResult *result;
-
-  guchar *result_csum;
 } WriteContentAsyncData;
 
 static void
@@ -1972,28 +3196,29 @@ write_content_async_data_free (gpointer user_data)
 {
   WriteContentAsyncData *data = user_data;
 
-  g_clear_object (&data->repo);
-  g_clear_object (&data->cancellable);
   g_clear_object (&data->object);
-  g_free (data->result_csum);
   g_free (data->expected_checksum);
   g_free (data);
 }
 
 static void
-write_content_thread (GSimpleAsyncResult  *res,
-                      GObject             *object,
-                      GCancellable        *cancellable)
+write_content_thread (GTask         *task,
+                      gpointer       source,
+                      gpointer       task_data,
+                      GCancellable  *cancellable)
 {
   GError *error = NULL;
-  WriteContentAsyncData *data;
+  OstreeRepo *repo = source;
+  WriteContentAsyncData *data = task_data;
+  guchar *result_csum = NULL;
 
-  data = g_simple_async_result_get_op_res_gpointer (res);
-  if (!ostree_repo_write_content (data->repo, data->expected_checksum,
+  if (!ostree_repo_write_content (repo, data->expected_checksum,
                                   data->object, data->file_object_length,
-                                  &data->result_csum,
+                                  &result_csum,
                                   cancellable, &error))
-    g_simple_async_result_take_error (res, error);
+    g_task_return_error (task, error);
+  else
+    g_task_return_pointer (task, result_csum, g_free);
 }
 
 /**
@@ -2019,22 +3244,17 @@ ostree_repo_write_content_async (OstreeRepo               *self,
                                  gpointer                  user_data)
 {
   WriteContentAsyncData *asyncdata;
+  g_autoptr(GTask) task = NULL;
 
   asyncdata = g_new0 (WriteContentAsyncData, 1);
-  asyncdata->repo = g_object_ref (self);
   asyncdata->expected_checksum = g_strdup (expected_checksum);
   asyncdata->object = g_object_ref (object);
   asyncdata->file_object_length = length;
-  asyncdata->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
-
-  asyncdata->result = g_simple_async_result_new ((GObject*) self,
-                                                 callback, user_data,
-                                                 ostree_repo_write_content_async);
 
-  g_simple_async_result_set_op_res_gpointer (asyncdata->result, asyncdata,
-                                             write_content_async_data_free);
-  g_simple_async_result_run_in_thread (asyncdata->result, write_content_thread, G_PRIORITY_DEFAULT, cancellable);
-  g_object_unref (asyncdata->result);
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, ostree_repo_write_content_async);
+  g_task_set_task_data (task, asyncdata, write_content_async_data_free);
+  g_task_run_in_thread (task, write_content_thread);
 }
 
 /**
@@ -2052,16 +3272,16 @@ ostree_repo_write_content_finish (OstreeRepo        *self,
                                   guchar           **out_csum,
                                   GError           **error)
 {
-  GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (result);
-  WriteContentAsyncData *data;
+  g_autofree guchar *ret_csum = NULL;
 
-  g_warn_if_fail (g_simple_async_result_get_source_tag (simple) == ostree_repo_write_content_async);
+  g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+  g_return_val_if_fail (g_async_result_is_tagged (result, ostree_repo_write_content_async), FALSE);
 
-  if (g_simple_async_result_propagate_error (simple, error))
+  ret_csum = g_task_propagate_pointer (G_TASK (result), error);
+  if (ret_csum == NULL)
     return FALSE;
 
-  data = g_simple_async_result_get_op_res_gpointer (simple);
-  ot_transfer_out_value (out_csum, &data->result_csum);
+  ot_transfer_out_value (out_csum, &ret_csum);
   return TRUE;
 }
 
@@ -2524,6 +3744,276 @@ get_modified_xattrs (OstreeRepo                       *self,
   return TRUE;
 }
 
+/* Worker pool state for OSTREE_REPO_COMMIT_MODIFIER_FLAGS_PARALLEL_WRITES
+ * and _CONCURRENT_FILTERS.  With only the former, the directory walk,
+ * commit filter and xattr callbacks all stay on the calling thread and
+ * just the expensive checksum+write of content objects is pushed to the
+ * pool.  With _CONCURRENT_FILTERS, non-directory entries are handed off
+ * before the filter runs, so expensive filter and xattr callbacks also
+ * come off the walking thread; directories still need their filter
+ * result on the walker to decide recursion.  The lock covers both the
+ * first-error slot and all OstreeMutableTree mutation, since workers
+ * insert their resulting checksums into directories the walker may
+ * still be appending to.
+ */
+typedef struct {
+  OstreeRepo *repo;
+  OstreeRepoCommitModifier *modifier; /* unowned; outlives the commit */
+  gboolean concurrent_filters;
+  GThreadPool *pool;
+  GMutex lock;
+  GError *error;
+  GCancellable *cancellable;
+} CommitParallelState;
+
+typedef struct {
+  CommitParallelState *state;
+  char *name;
+  GFileInfo *modified_info;
+  GVariant *xattrs;          /* maybe NULL */
+  GInputStream *file_input;  /* NULL for symlinks */
+  OstreeMutableTree *mtree;
+  /* Only set for deferred filter evaluation (_CONCURRENT_FILTERS) */
+  gboolean filter_pending;
+  char *relpath;
+  GFileInfo *child_info;
+  GFile *child;              /* GFile-based walk, else NULL */
+  int dfd;                   /* dup'd dirfd for the fd-based walk, else -1 */
+} CommitParallelJob;
+
+static inline void
+commit_parallel_lock (CommitParallelState *state)
+{
+  if (state != NULL)
+    g_mutex_lock (&state->lock);
+}
+
+static inline void
+commit_parallel_unlock (CommitParallelState *state)
+{
+  if (state != NULL)
+    g_mutex_unlock (&state->lock);
+}
+
+static void
+commit_parallel_job_free (CommitParallelJob *job)
+{
+  g_free (job->name);
+  g_clear_object (&job->modified_info);
+  g_clear_pointer (&job->xattrs, (GDestroyNotify)g_variant_unref);
+  g_clear_object (&job->file_input);
+  g_clear_object (&job->mtree);
+  g_free (job->relpath);
+  g_clear_object (&job->child_info);
+  g_clear_object (&job->child);
+  if (job->dfd != -1)
+    (void) close (job->dfd);
+  g_free (job);
+}
+
+/* Deferred filter evaluation: run the commit filter and xattr callbacks
+ * for @job, filling in modified_info/xattrs/file_input for the write
+ * step.  Sets @out_done if the entry needs no write (filtered out, or
+ * satisfied from the devino cache).
+ */
+static gboolean
+commit_parallel_apply_filter (CommitParallelJob *job,
+                              gboolean          *out_done,
+                              GError           **error)
+{
+  CommitParallelState *state = job->state;
+  OstreeRepo *self = state->repo;
+  OstreeRepoCommitModifier *modifier = state->modifier;
+
+  *out_done = FALSE;
+
+  OstreeRepoCommitFilterResult filter_result =
+    apply_commit_filter (self, modifier, job->relpath, job->child_info, &job->modified_info);
+  if (filter_result != OSTREE_REPO_COMMIT_FILTER_ALLOW)
+    {
+      *out_done = TRUE;
+      return TRUE;
+    }
+
+  switch (g_file_info_get_file_type (job->child_info))
+    {
+    case G_FILE_TYPE_SYMBOLIC_LINK:
+    case G_FILE_TYPE_REGULAR:
+      break;
+    default:
+      return glnx_throw (error, "Unsupported file type: '%s'", job->relpath);
+    }
+
+  const char *loose_checksum =
+    devino_cache_lookup (self, modifier,
+                         g_file_info_get_attribute_uint32 (job->child_info, "unix::device"),
+                         g_file_info_get_attribute_uint64 (job->child_info, "unix::inode"));
+  if (loose_checksum)
+    {
+      gboolean replaced;
+      g_mutex_lock (&state->lock);
+      replaced = ostree_mutable_tree_replace_file (job->mtree, job->name,
+                                                   loose_checksum, error);
+      g_mutex_unlock (&state->lock);
+      if (!replaced)
+        return FALSE;
+      *out_done = TRUE;
+      return TRUE;
+    }
+
+  if (g_file_info_get_file_type (job->modified_info) == G_FILE_TYPE_REGULAR)
+    {
+      if (job->child != NULL)
+        {
+          job->file_input = (GInputStream*)g_file_read (job->child, state->cancellable, error);
+          if (job->file_input == NULL)
+            return FALSE;
+        }
+      else
+        {
+          if (!ot_openat_read_stream (job->dfd, job->name, FALSE,
+                                      &job->file_input, state->cancellable, error))
+            return FALSE;
+        }
+    }
+
+  if (!get_modified_xattrs (self, modifier,
+                            job->relpath, job->child_info, job->child,
+                            job->child == NULL ? job->dfd : -1, job->name,
+                            &job->xattrs,
+                            state->cancellable, error))
+    return FALSE;
+
+  return TRUE;
+}
+
+static void
+commit_parallel_worker (gpointer data,
+                        gpointer user_data)
+{
+  CommitParallelJob *job = data;
+  CommitParallelState *state = job->state;
+  g_autoptr(GError) local_error = NULL;
+  gboolean done = FALSE;
+
+  g_mutex_lock (&state->lock);
+  const gboolean failed = (state->error != NULL);
+  g_mutex_unlock (&state->lock);
+
+  /* After the first failure, just drain the queue */
+  if (!failed)
+    {
+      if (job->filter_pending)
+        {
+          if (!commit_parallel_apply_filter (job, &done, &local_error))
+            g_prefix_error (&local_error, "Filtering %s: ", job->name);
+        }
+
+      if (local_error == NULL && !done)
+        {
+          g_autoptr(GInputStream) file_object_input = NULL;
+          guint64 file_obj_length;
+          g_autofree guchar *child_file_csum = NULL;
+
+          if (!ostree_raw_file_to_content_stream (job->file_input,
+                                                  job->modified_info, job->xattrs,
+                                                  &file_object_input, &file_obj_length,
+                                                  state->cancellable, &local_error) ||
+              !ostree_repo_write_content (state->repo, NULL,
+                                          file_object_input, file_obj_length,
+                                          &child_file_csum,
+                                          state->cancellable, &local_error))
+            {
+              g_prefix_error (&local_error, "Writing content object %s: ", job->name);
+            }
+          else
+            {
+              g_autofree char *tmp_checksum = ostree_checksum_from_bytes (child_file_csum);
+
+              g_mutex_lock (&state->lock);
+              if (state->error == NULL)
+                (void) ostree_mutable_tree_replace_file (job->mtree, job->name,
+                                                         tmp_checksum, &local_error);
+              g_mutex_unlock (&state->lock);
+            }
+        }
+
+      if (local_error != NULL)
+        {
+          g_mutex_lock (&state->lock);
+          if (state->error == NULL)
+            state->error = g_steal_pointer (&local_error);
+          g_mutex_unlock (&state->lock);
+        }
+    }
+
+  commit_parallel_job_free (job);
+}
+
+static CommitParallelState *
+commit_parallel_state_new (OstreeRepo               *self,
+                           OstreeRepoCommitModifier *modifier,
+                           GCancellable             *cancellable)
+{
+  if (modifier == NULL ||
+      (modifier->flags & (OSTREE_REPO_COMMIT_MODIFIER_FLAGS_PARALLEL_WRITES |
+                          OSTREE_REPO_COMMIT_MODIFIER_FLAGS_CONCURRENT_FILTERS)) == 0)
+    return NULL;
+  /* The object size index is updated unlocked in write_content_object() */
+  if (self->generate_sizes)
+    return NULL;
+  guint n_jobs = g_get_num_processors ();
+  if (n_jobs <= 1)
+    return NULL;
+
+  CommitParallelState *state = g_new0 (CommitParallelState, 1);
+  state->repo = self;
+  state->modifier = modifier;
+  /* The shared SELinux labeling handle isn't guaranteed thread-safe, so
+   * filter evaluation stays on the walking thread when sepolicy is in
+   * use. */
+  state->concurrent_filters =
+    (modifier->flags & OSTREE_REPO_COMMIT_MODIFIER_FLAGS_CONCURRENT_FILTERS) != 0
+    && modifier->sepolicy == NULL;
+  state->cancellable = cancellable;
+  g_mutex_init (&state->lock);
+  state->pool = g_thread_pool_new (commit_parallel_worker, state, n_jobs, FALSE, NULL);
+  if (state->pool == NULL)
+    {
+      /* Best-effort; fall back to serial writes */
+      g_mutex_clear (&state->lock);
+      g_free (state);
+      return NULL;
+    }
+  return state;
+}
+
+/* Drain the pool and propagate the first worker error; NULL @state is a
+ * no-op so callers can pair this unconditionally with _new().
+ */
+static gboolean
+commit_parallel_state_finish (CommitParallelState *state,
+                              GError             **error)
+{
+  if (state == NULL)
+    return TRUE;
+
+  g_thread_pool_free (state->pool, FALSE, TRUE);
+
+  gboolean ret = TRUE;
+  if (state->error != NULL)
+    {
+      if (error != NULL && *error == NULL)
+        g_propagate_error (error, g_steal_pointer (&state->error));
+      else
+        g_clear_error (&state->error);
+      ret = FALSE;
+    }
+  g_mutex_clear (&state->lock);
+  g_free (state);
+  return ret;
+}
+
 static gboolean
 write_directory_to_mtree_internal (OstreeRepo                  *self,
                                    GFile                       *dir,
@@ -2560,6 +4050,7 @@ write_directory_content_to_mtree_internal (OstreeRepo                  *self,
   const char *name;
   GFileType file_type;
   OstreeRepoCommitFilterResult filter_result;
+  CommitParallelState *par_state = modifier != NULL ? modifier->parallel_commit_state : NULL;
 
   g_assert (dir_enum != NULL || dfd_iter != NULL);
 
@@ -2569,6 +4060,39 @@ write_directory_content_to_mtree_internal (OstreeRepo                  *self,
   if (modifier != NULL)
     child_relpath = ptrarray_path_join (path);
 
+  /* With concurrent filter evaluation, non-directory entries are handed
+   * to the worker pool before the filter runs; directories still need
+   * their filter result here to decide recursion, and the repo_dir case
+   * is just a cheap checksum copy.
+   */
+  if (par_state != NULL && par_state->concurrent_filters && repo_dir == NULL
+      && g_file_info_get_file_type (child_info) != G_FILE_TYPE_DIRECTORY)
+    {
+      CommitParallelJob *job = g_new0 (CommitParallelJob, 1);
+      job->state = par_state;
+      job->name = g_strdup (name);
+      job->mtree = g_object_ref (mtree);
+      job->filter_pending = TRUE;
+      job->relpath = g_strdup (child_relpath);
+      job->child_info = g_object_ref (child_info);
+      job->child = dir_enum != NULL ? g_file_enumerator_get_child (dir_enum, child_info) : NULL;
+      job->dfd = -1;
+      if (dfd_iter != NULL)
+        {
+          job->dfd = fcntl (dfd_iter->fd, F_DUPFD_CLOEXEC, 3);
+          if (job->dfd < 0)
+            {
+              int errsv = errno;
+              commit_parallel_job_free (job);
+              errno = errsv;
+              return glnx_throw_errno_prefix (error, "fcntl(F_DUPFD_CLOEXEC)");
+            }
+        }
+      g_thread_pool_push (par_state->pool, job, NULL);
+      g_ptr_array_remove_index (path, path->len - 1);
+      return TRUE;
+    }
+
   filter_result = apply_commit_filter (self, modifier, child_relpath, child_info, &modified_info);
 
   if (filter_result != OSTREE_REPO_COMMIT_FILTER_ALLOW)
@@ -2595,7 +4119,10 @@ write_directory_content_to_mtree_internal (OstreeRepo                  *self,
 
   if (file_type == G_FILE_TYPE_DIRECTORY)
     {
-      if (!ostree_mutable_tree_ensure_dir (mtree, name, &child_mtree, error))
+      commit_parallel_lock (par_state);
+      const gboolean ensured = ostree_mutable_tree_ensure_dir (mtree, name, &child_mtree, error);
+      commit_parallel_unlock (par_state);
+      if (!ensured)
         return FALSE;
 
       if (dir_enum != NULL)
@@ -2622,9 +4149,13 @@ write_directory_content_to_mtree_internal (OstreeRepo                  *self,
     {
       g_assert (dir_enum != NULL);
       g_debug ("Adding: %s", gs_file_get_path_cached (child));
-      if (!ostree_mutable_tree_replace_file (mtree, name,
-                                             ostree_repo_file_get_checksum ((OstreeRepoFile*) child),
-                                             error))
+      commit_parallel_lock (par_state);
+      const gboolean replaced =
+        ostree_mutable_tree_replace_file (mtree, name,
+                                          ostree_repo_file_get_checksum ((OstreeRepoFile*) child),
+                                          error);
+      commit_parallel_unlock (par_state);
+      if (!replaced)
         return FALSE;
     }
   else
@@ -2643,8 +4174,11 @@ write_directory_content_to_mtree_internal (OstreeRepo                  *self,
 
       if (loose_checksum)
         {
-          if (!ostree_mutable_tree_replace_file (mtree, name, loose_checksum,
-                                                 error))
+          commit_parallel_lock (par_state);
+          const gboolean replaced =
+            ostree_mutable_tree_replace_file (mtree, name, loose_checksum, error);
+          commit_parallel_unlock (par_state);
+          if (!replaced)
             return FALSE;
         }
       else
@@ -2671,20 +4205,35 @@ write_directory_content_to_mtree_internal (OstreeRepo                  *self,
                                     cancellable, error))
             return FALSE;
 
-          if (!ostree_raw_file_to_content_stream (file_input,
-                                                  modified_info, xattrs,
-                                                  &file_object_input, &file_obj_length,
-                                                  cancellable, error))
-            return FALSE;
-          if (!ostree_repo_write_content (self, NULL, file_object_input, file_obj_length,
-                                          &child_file_csum, cancellable, error))
-            return FALSE;
+          if (par_state != NULL)
+            {
+              CommitParallelJob *job = g_new0 (CommitParallelJob, 1);
+              job->state = par_state;
+              job->name = g_strdup (name);
+              job->modified_info = g_object_ref (modified_info);
+              job->xattrs = xattrs != NULL ? g_variant_ref (xattrs) : NULL;
+              job->file_input = file_input != NULL ? g_object_ref (file_input) : NULL;
+              job->mtree = g_object_ref (mtree);
+              job->dfd = -1;
+              g_thread_pool_push (par_state->pool, job, NULL);
+            }
+          else
+            {
+              if (!ostree_raw_file_to_content_stream (file_input,
+                                                      modified_info, xattrs,
+                                                      &file_object_input, &file_obj_length,
+                                                      cancellable, error))
+                return FALSE;
+              if (!ostree_repo_write_content (self, NULL, file_object_input, file_obj_length,
+                                              &child_file_csum, cancellable, error))
+                return FALSE;
 
-          g_free (tmp_checksum);
-          tmp_checksum = ostree_checksum_from_bytes (child_file_csum);
-          if (!ostree_mutable_tree_replace_file (mtree, name, tmp_checksum,
-                                                 error))
-            return FALSE;
+              g_free (tmp_checksum);
+              tmp_checksum = ostree_checksum_from_bytes (child_file_csum);
+              if (!ostree_mutable_tree_replace_file (mtree, name, tmp_checksum,
+                                                     error))
+                return FALSE;
+            }
         }
     }
 
@@ -2718,6 +4267,15 @@ write_directory_to_mtree_internal (OstreeRepo                  *self,
       if (!ostree_repo_file_ensure_resolved (repo_dir, error))
         return FALSE;
 
+      /* A pristine mtree can become a copy-on-write reference to the
+       * base tree; nothing below it is instantiated unless an overlay
+       * later modifies a path there.  Note: early return.
+       */
+      if (ostree_mutable_tree_fill_empty_from_dirtree (mtree, self,
+                                                       ostree_repo_file_tree_get_contents_checksum (repo_dir),
+                                                       ostree_repo_file_tree_get_metadata_checksum (repo_dir)))
+        return TRUE;
+
       ostree_mutable_tree_set_metadata_checksum (mtree, ostree_repo_file_tree_get_metadata_checksum (repo_dir));
 
       filter_result = OSTREE_REPO_COMMIT_FILTER_ALLOW;
@@ -2863,13 +4421,55 @@ write_dfd_iter_to_mtree_internal (OstreeRepo                  *self,
       const char *loose_checksum = devino_cache_lookup (self, modifier, stbuf.st_dev, stbuf.st_ino);
       if (loose_checksum)
         {
-          if (!ostree_mutable_tree_replace_file (mtree, dent->d_name, loose_checksum,
-                                                 error))
+          CommitParallelState *par_state = modifier != NULL ? modifier->parallel_commit_state : NULL;
+          commit_parallel_lock (par_state);
+          const gboolean replaced =
+            ostree_mutable_tree_replace_file (mtree, dent->d_name, loose_checksum, error);
+          commit_parallel_unlock (par_state);
+          if (!replaced)
             return FALSE;
 
           continue;
         }
 
+      /* Like the devino cache, but keyed on path + stat identity; see the
+       * core.commit-stat-cache repo option.  Only active without a modifier,
+       * since filters and xattr callbacks can change what gets committed for
+       * the same on-disk file.
+       */
+      const gboolean use_stat_cache =
+        self->enable_commit_stat_cache && modifier == NULL && S_ISREG (stbuf.st_mode);
+      g_autofree char *stat_cache_path = NULL;
+      if (use_stat_cache)
+        {
+          if (!commit_stat_cache_ensure (self, cancellable, error))
+            return FALSE;
+
+          g_ptr_array_add (path, (char*)dent->d_name);
+          stat_cache_path = ptrarray_path_join (path);
+          g_ptr_array_remove_index (path, path->len - 1);
+
+          const char *cached_checksum = commit_stat_cache_lookup (self, stat_cache_path, &stbuf);
+          if (cached_checksum != NULL)
+            {
+              /* The referenced object may have been pruned since the cache
+               * was written; only take the shortcut if it's still present.
+               */
+              gboolean have_object;
+              if (!ostree_repo_has_object (self, OSTREE_OBJECT_TYPE_FILE, cached_checksum,
+                                           &have_object, cancellable, error))
+                return FALSE;
+              if (have_object)
+                {
+                  if (!ostree_mutable_tree_replace_file (mtree, dent->d_name, cached_checksum,
+                                                         error))
+                    return FALSE;
+
+                  continue;
+                }
+            }
+        }
+
       g_autoptr(GFileInfo) child_info = _ostree_stbuf_to_gfileinfo (&stbuf);
       g_file_info_set_name (child_info, dent->d_name);
 
@@ -2894,11 +4494,288 @@ write_dfd_iter_to_mtree_internal (OstreeRepo                  *self,
                                                       mtree, modifier, path,
                                                       cancellable, error))
         return FALSE;
+
+      if (use_stat_cache)
+        {
+          g_autofree char *new_checksum = NULL;
+          g_autoptr(OstreeMutableTree) subdir = NULL;
+
+          if (!ostree_mutable_tree_lookup (mtree, dent->d_name, &new_checksum, &subdir, error))
+            return FALSE;
+          if (new_checksum != NULL)
+            commit_stat_cache_insert (self, stat_cache_path, &stbuf, new_checksum);
+        }
     }
 
   return TRUE;
 }
 
+/* Overlayfs marks a directory in the upper layer as hiding the
+ * corresponding lower directory entirely via this xattr.
+ */
+static gboolean
+overlay_xattrs_is_opaque (GVariant *xattrs)
+{
+  gsize n = g_variant_n_children (xattrs);
+
+  for (gsize i = 0; i < n; i++)
+    {
+      const guint8 *name;
+      g_autoptr(GVariant) value = NULL;
+
+      g_variant_get_child (xattrs, i, "(^&ay@ay)", &name, &value);
+      if (strcmp ((const char*)name, "trusted.overlay.opaque") == 0)
+        {
+          gsize len;
+          const char *data = g_variant_get_fixed_array (value, &len, 1);
+          return len >= 1 && data[0] == 'y';
+        }
+    }
+
+  return FALSE;
+}
+
+static gboolean
+write_overlay_upper_to_mtree_internal (OstreeRepo                  *self,
+                                       OstreeRepoFile              *base_dir,
+                                       GLnxDirFdIterator           *upper_dfd_iter,
+                                       OstreeMutableTree           *mtree,
+                                       OstreeRepoCommitModifier    *modifier,
+                                       GPtrArray                   *path,
+                                       GCancellable                *cancellable,
+                                       GError                     **error)
+{
+  g_autofree char *relpath = NULL;
+  g_autoptr(GFileInfo) modified_info = NULL;
+  OstreeRepoCommitFilterResult filter_result;
+  struct stat dir_stbuf;
+
+  if (fstat (upper_dfd_iter->fd, &dir_stbuf) != 0)
+    return glnx_throw_errno (error);
+
+  { g_autoptr(GFileInfo) dir_info = _ostree_stbuf_to_gfileinfo (&dir_stbuf);
+
+    if (modifier != NULL)
+      {
+        relpath = ptrarray_path_join (path);
+        filter_result = apply_commit_filter (self, modifier, relpath, dir_info, &modified_info);
+      }
+    else
+      {
+        filter_result = OSTREE_REPO_COMMIT_FILTER_ALLOW;
+        modified_info = g_object_ref (dir_info);
+      }
+  }
+
+  if (filter_result != OSTREE_REPO_COMMIT_FILTER_ALLOW)
+    {
+      /* Note - early return */
+      return TRUE;
+    }
+
+  /* The directory exists in the upper layer, so its ownership,
+   * permissions and xattrs are authoritative.
+   */
+  { g_autoptr(GVariant) xattrs = NULL;
+    g_autofree guchar *dirmeta_csum = NULL;
+
+    if (!get_modified_xattrs (self, modifier, relpath, modified_info,
+                              NULL, upper_dfd_iter->fd, NULL,
+                              &xattrs,
+                              cancellable, error))
+      return FALSE;
+
+    if (!_ostree_repo_write_directory_meta (self, modified_info, xattrs, &dirmeta_csum,
+                                            cancellable, error))
+      return FALSE;
+
+    g_autofree char *tmp_checksum = ostree_checksum_from_bytes (dirmeta_csum);
+    ostree_mutable_tree_set_metadata_checksum (mtree, tmp_checksum);
+  }
+
+  /* An opaque upper directory replaces the lower one outright */
+  if (base_dir != NULL)
+    {
+      g_autoptr(GVariant) raw_xattrs = NULL;
+
+      if (!glnx_fd_get_all_xattrs (upper_dfd_iter->fd, &raw_xattrs,
+                                   cancellable, error))
+        return FALSE;
+      if (overlay_xattrs_is_opaque (raw_xattrs))
+        base_dir = NULL;
+    }
+
+  /* First merge in the base directory's entries.  Anything the upper
+   * layer touched (including whiteouts) shadows the base version and
+   * is handled while walking the upper directory below; untouched
+   * subdirectories are referenced by checksum without recursing into
+   * them, which is what keeps this O(changes).
+   */
+  if (base_dir != NULL)
+    {
+      if (!ostree_repo_file_ensure_resolved (base_dir, error))
+        return FALSE;
+
+      GVariant *base_contents = ostree_repo_file_tree_get_contents (base_dir);
+      g_autoptr(GVariant) base_files = g_variant_get_child_value (base_contents, 0);
+      g_autoptr(GVariant) base_dirs = g_variant_get_child_value (base_contents, 1);
+
+      gsize n = g_variant_n_children (base_files);
+      for (gsize i = 0; i < n; i++)
+        {
+          const char *fname;
+          g_autoptr(GVariant) csum_v = NULL;
+          struct stat stbuf;
+
+          g_variant_get_child (base_files, i, "(&s@ay)", &fname, &csum_v);
+
+          if (fstatat (upper_dfd_iter->fd, fname, &stbuf, AT_SYMLINK_NOFOLLOW) == 0)
+            continue;
+          else if (errno != ENOENT)
+            return glnx_throw_errno (error);
+
+          g_autofree char *checksum = ostree_checksum_from_bytes_v (csum_v);
+          if (!ostree_mutable_tree_replace_file (mtree, fname, checksum, error))
+            return FALSE;
+        }
+
+      n = g_variant_n_children (base_dirs);
+      for (gsize i = 0; i < n; i++)
+        {
+          const char *dname;
+          g_autoptr(GVariant) tree_csum_v = NULL;
+          g_autoptr(GVariant) meta_csum_v = NULL;
+          struct stat stbuf;
+
+          g_variant_get_child (base_dirs, i, "(&s@ay@ay)", &dname,
+                               &tree_csum_v, &meta_csum_v);
+
+          if (fstatat (upper_dfd_iter->fd, dname, &stbuf, AT_SYMLINK_NOFOLLOW) == 0)
+            continue;
+          else if (errno != ENOENT)
+            return glnx_throw_errno (error);
+
+          g_autoptr(OstreeMutableTree) child_mtree = NULL;
+          if (!ostree_mutable_tree_ensure_dir (mtree, dname, &child_mtree, error))
+            return FALSE;
+
+          g_autofree char *tree_checksum = ostree_checksum_from_bytes_v (tree_csum_v);
+          g_autofree char *meta_checksum = ostree_checksum_from_bytes_v (meta_csum_v);
+          ostree_mutable_tree_set_metadata_checksum (child_mtree, meta_checksum);
+          ostree_mutable_tree_set_contents_checksum (child_mtree, tree_checksum);
+        }
+    }
+
+  while (TRUE)
+    {
+      struct dirent *dent;
+      if (!glnx_dirfd_iterator_next_dent (upper_dfd_iter, &dent, cancellable, error))
+        return FALSE;
+      if (dent == NULL)
+        break;
+
+      struct stat stbuf;
+      if (!glnx_fstatat (upper_dfd_iter->fd, dent->d_name, &stbuf, AT_SYMLINK_NOFOLLOW, error))
+        return FALSE;
+
+      /* Whiteout: the lower entry was deleted.  We already omitted it
+       * while merging the base, so there's nothing to commit.
+       */
+      if (S_ISCHR (stbuf.st_mode) && stbuf.st_rdev == 0)
+        continue;
+
+      if (S_ISDIR (stbuf.st_mode))
+        {
+          g_autoptr(OstreeMutableTree) child_mtree = NULL;
+          g_autoptr(GFile) base_child_file = NULL;
+          OstreeRepoFile *base_child = NULL;
+
+          if (!ostree_mutable_tree_ensure_dir (mtree, dent->d_name, &child_mtree, error))
+            return FALSE;
+
+          if (base_dir != NULL)
+            {
+              gboolean is_dir;
+
+              if (ostree_repo_file_tree_find_child (base_dir, dent->d_name, &is_dir, NULL) >= 0
+                  && is_dir)
+                {
+                  base_child_file = g_file_get_child (G_FILE (base_dir), dent->d_name);
+                  base_child = (OstreeRepoFile*)base_child_file;
+                }
+            }
+
+          g_auto(GLnxDirFdIterator) child_dfd_iter = { 0, };
+          if (!glnx_dirfd_iterator_init_at (upper_dfd_iter->fd, dent->d_name, FALSE,
+                                            &child_dfd_iter, error))
+            return FALSE;
+
+          g_ptr_array_add (path, (char*)dent->d_name);
+          gboolean subret = write_overlay_upper_to_mtree_internal (self, base_child,
+                                                                   &child_dfd_iter, child_mtree,
+                                                                   modifier, path,
+                                                                   cancellable, error);
+          g_ptr_array_remove_index (path, path->len - 1);
+          if (!subret)
+            return FALSE;
+        }
+      else
+        {
+          g_autoptr(GFileInfo) child_info = _ostree_stbuf_to_gfileinfo (&stbuf);
+          g_file_info_set_name (child_info, dent->d_name);
+
+          if (S_ISLNK (stbuf.st_mode))
+            {
+              if (!ot_readlinkat_gfile_info (upper_dfd_iter->fd, dent->d_name,
+                                             child_info, cancellable, error))
+                return FALSE;
+            }
+          else if (!S_ISREG (stbuf.st_mode))
+            {
+              return glnx_throw (error, "Not a regular file or symlink: %s",
+                                 dent->d_name);
+            }
+
+          if (!write_directory_content_to_mtree_internal (self, NULL, NULL, upper_dfd_iter,
+                                                          child_info,
+                                                          mtree, modifier, path,
+                                                          cancellable, error))
+            return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+/* Merge an overlayfs upper directory @upper_dfd on top of the
+ * already-committed tree @base_dir (which may be %NULL for an
+ * unrelated base) into @mtree, honoring whiteouts and opaque
+ * directories.  Only objects the overlay actually copied up are
+ * checksummed and written; untouched subtrees of @base_dir are
+ * referenced by their existing checksums.  This is how `ostree admin
+ * commit-hotfix` harvests live hotfix changes in O(changes) rather
+ * than O(tree).
+ */
+gboolean
+_ostree_repo_write_overlay_upper_to_mtree (OstreeRepo                *self,
+                                           OstreeRepoFile            *base_dir,
+                                           int                        upper_dfd,
+                                           OstreeMutableTree         *mtree,
+                                           OstreeRepoCommitModifier  *modifier,
+                                           GCancellable              *cancellable,
+                                           GError                   **error)
+{
+  g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
+  g_autoptr(GPtrArray) path = g_ptr_array_new ();
+
+  if (!glnx_dirfd_iterator_init_at (upper_dfd, ".", FALSE, &dfd_iter, error))
+    return FALSE;
+
+  return write_overlay_upper_to_mtree_internal (self, base_dir, &dfd_iter, mtree,
+                                                modifier, path,
+                                                cancellable, error);
+}
+
 /**
  * ostree_repo_write_directory_to_mtree:
  * @self: Repo
@@ -2932,9 +4809,21 @@ ostree_repo_write_directory_to_mtree (OstreeRepo                *self,
       if (modifier && modifier->flags & OSTREE_REPO_COMMIT_MODIFIER_FLAGS_GENERATE_SIZES)
         self->generate_sizes = TRUE;
 
+      if (modifier != NULL)
+        modifier->parallel_commit_state = commit_parallel_state_new (self, modifier, cancellable);
+
       g_autoptr(GPtrArray) path = g_ptr_array_new ();
-      if (!write_directory_to_mtree_internal (self, dir, mtree, modifier, path,
-                                              cancellable, error))
+      gboolean ret = write_directory_to_mtree_internal (self, dir, mtree, modifier, path,
+                                                        cancellable, error);
+      if (modifier != NULL)
+        {
+          /* Always drain the pool, even on walk failure */
+          if (!commit_parallel_state_finish (modifier->parallel_commit_state,
+                                             ret ? error : NULL))
+            ret = FALSE;
+          modifier->parallel_commit_state = NULL;
+        }
+      if (!ret)
         return FALSE;
     }
 
@@ -2971,12 +4860,21 @@ ostree_repo_write_dfd_to_mtree (OstreeRepo                *self,
   if (!glnx_dirfd_iterator_init_at (dfd, path, FALSE, &dfd_iter, error))
     return FALSE;
 
-  g_autoptr(GPtrArray) pathbuilder = g_ptr_array_new ();
-  if (!write_dfd_iter_to_mtree_internal (self, &dfd_iter, mtree, modifier, pathbuilder,
-                                         cancellable, error))
-    return FALSE;
+  if (modifier != NULL)
+    modifier->parallel_commit_state = commit_parallel_state_new (self, modifier, cancellable);
 
-  return TRUE;
+  g_autoptr(GPtrArray) pathbuilder = g_ptr_array_new ();
+  gboolean ret = write_dfd_iter_to_mtree_internal (self, &dfd_iter, mtree, modifier, pathbuilder,
+                                                   cancellable, error);
+  if (modifier != NULL)
+    {
+      /* Always drain the pool, even on walk failure */
+      if (!commit_parallel_state_finish (modifier->parallel_commit_state,
+                                         ret ? error : NULL))
+        ret = FALSE;
+      modifier->parallel_commit_state = NULL;
+    }
+  return ret;
 }
 
 /**
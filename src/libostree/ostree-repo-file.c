@@ -37,11 +37,12 @@ struct OstreeRepoFile
   int index;
   char *name;
 
-  char *cached_file_checksum;
+  /* Interned in the repo's checksum table; do not free */
+  const char *cached_file_checksum;
 
-  char *tree_contents_checksum;
+  const char *tree_contents_checksum;
   GVariant *tree_contents;
-  char *tree_metadata_checksum;
+  const char *tree_metadata_checksum;
   GVariant *tree_metadata;
 };
 
@@ -58,9 +59,6 @@ ostree_repo_file_finalize (GObject *object)
 
   g_clear_pointer (&self->tree_contents, (GDestroyNotify) g_variant_unref);
   g_clear_pointer (&self->tree_metadata, (GDestroyNotify) g_variant_unref);
-  g_free (self->cached_file_checksum);
-  g_free (self->tree_contents_checksum);
-  g_free (self->tree_metadata_checksum);
   g_free (self->name);
 
   G_OBJECT_CLASS (ostree_repo_file_parent_class)->finalize (object);
@@ -119,8 +117,8 @@ _ostree_repo_file_new_root (OstreeRepo *repo,
 
   self = g_object_new (OSTREE_TYPE_REPO_FILE, NULL);
   self->repo = g_object_ref (repo);
-  self->tree_contents_checksum = g_strdup (contents_checksum);
-  self->tree_metadata_checksum = g_strdup (metadata_checksum);
+  self->tree_contents_checksum = _ostree_repo_intern_checksum (repo, contents_checksum);
+  self->tree_metadata_checksum = _ostree_repo_intern_checksum (repo, metadata_checksum);
 
   return self;
 }
@@ -212,7 +210,12 @@ do_resolve_nonroot (OstreeRepoFile     *self,
   g_autoptr(GVariant) metadata_csum_v = NULL;
   g_autofree char *tmp_checksum = NULL;
 
-  if (!ostree_repo_file_ensure_resolved (self->parent, error))
+  /* A parent whose tree pair was seeded from a path index is already
+   * usable for child lookups even though its own position in the
+   * grandparent is unresolved; don't force a walk from the root.
+   */
+  if (self->parent->tree_contents == NULL
+      && !ostree_repo_file_ensure_resolved (self->parent, error))
     return FALSE;
 
   if (!self->parent->tree_contents)
@@ -256,12 +259,21 @@ do_resolve_nonroot (OstreeRepoFile     *self,
                                      error))
         return FALSE;
 
+      /* May already be set if we were seeded from a path index */
+      g_clear_pointer (&self->tree_contents, (GDestroyNotify) g_variant_unref);
+      g_clear_pointer (&self->tree_metadata, (GDestroyNotify) g_variant_unref);
+
       self->tree_contents = tree_contents;
       tree_contents = NULL;
       self->tree_metadata = tree_metadata;
       tree_metadata = NULL;
-      self->tree_contents_checksum = ostree_checksum_from_bytes_v (contents_csum_v);
-      self->tree_metadata_checksum = ostree_checksum_from_bytes_v (metadata_csum_v);
+      g_free (tmp_checksum);
+      tmp_checksum = ostree_checksum_from_bytes_v (contents_csum_v);
+      self->tree_contents_checksum = _ostree_repo_intern_checksum (self->repo, tmp_checksum);
+
+      g_free (tmp_checksum);
+      tmp_checksum = ostree_checksum_from_bytes_v (metadata_csum_v);
+      self->tree_metadata_checksum = _ostree_repo_intern_checksum (self->repo, tmp_checksum);
     }
   else
     self->index = i;
@@ -333,8 +345,8 @@ ostree_repo_file_tree_set_metadata (OstreeRepoFile *self,
 {
   g_clear_pointer (&self->tree_metadata, (GDestroyNotify) g_variant_unref);
   self->tree_metadata = g_variant_ref (metadata);
-  g_free (self->tree_metadata_checksum);
-  self->tree_metadata_checksum = g_strdup (checksum);
+  self->tree_metadata_checksum =
+    checksum ? _ostree_repo_intern_checksum (self->repo, checksum) : NULL;
 }
 
 const char *
@@ -411,7 +423,9 @@ ostree_repo_file_get_checksum (OstreeRepoFile  *self)
   g_clear_pointer (&files_variant, (GDestroyNotify) g_variant_unref);
   g_clear_pointer (&dirs_variant, (GDestroyNotify) g_variant_unref);
 
-  self->cached_file_checksum = ostree_checksum_from_bytes_v (csum_bytes);
+  { g_autofree char *checksum = ostree_checksum_from_bytes_v (csum_bytes);
+    self->cached_file_checksum = _ostree_repo_intern_checksum (self->repo, checksum);
+  }
 
   g_variant_unref (csum_bytes);
 
@@ -607,6 +621,90 @@ ostree_repo_file_get_relative_path (GFile *parent,
   return NULL;
 }
 
+/* Try to resolve @relative_path against the root @self using the
+ * repository's generated path index for this tree, if one exists; see
+ * _ostree_repo_get_path_index().  On a hit we seed the target's
+ * immediate parent with the dirtree/dirmeta pair the index names, so
+ * resolving the target costs one tree load instead of one per path
+ * component; the intermediate ancestors stay lazy and resolve normally
+ * if anything asks about them.  Returns %NULL to fall back to the
+ * component-by-component walk: no index, a path needing
+ * canonicalization, an absent entry, or index objects that have been
+ * pruned since generation.
+ */
+static GFile *
+resolve_relative_path_index (OstreeRepoFile *self,
+                             const char     *relative_path)
+{
+  g_assert (self->parent == NULL);
+
+  g_autoptr(GVariant) index = _ostree_repo_get_path_index (self->repo, self->tree_contents_checksum);
+  if (index == NULL)
+    return NULL;
+
+  g_autofree char *path = g_strdup (relative_path);
+  /* Strip trailing slashes so the key matches the generated entries */
+  size_t len = strlen (path);
+  while (len > 0 && path[len-1] == '/')
+    path[--len] = '\0';
+  if (len == 0)
+    return NULL;
+
+  g_auto(GStrv) components = g_strsplit (path, "/", -1);
+  guint n_components = g_strv_length (components);
+  /* A single component resolves against the root's own tree anyway */
+  if (n_components < 2)
+    return NULL;
+  for (guint i = 0; i < n_components; i++)
+    {
+      const char *component = components[i];
+      if (component[0] == '\0'
+          || strcmp (component, ".") == 0
+          || strcmp (component, "..") == 0)
+        return NULL;
+    }
+
+  int pos;
+  if (!ot_variant_bsearch_str (index, path, &pos))
+    return NULL;
+
+  g_autoptr(GVariant) entry = g_variant_get_child_value (index, pos);
+  g_autoptr(GVariant) tree_csum_v = NULL;
+  g_autoptr(GVariant) meta_csum_v = NULL;
+  g_variant_get (entry, "(&s@ay@ay)", NULL, &tree_csum_v, &meta_csum_v);
+
+  g_autofree char *tree_checksum = ostree_checksum_from_bytes_v (tree_csum_v);
+  g_autofree char *meta_checksum = ostree_checksum_from_bytes_v (meta_csum_v);
+
+  g_autoptr(GVariant) tree_contents = NULL;
+  g_autoptr(GVariant) tree_metadata = NULL;
+  if (!ostree_repo_load_variant (self->repo, OSTREE_OBJECT_TYPE_DIR_TREE,
+                                 tree_checksum, &tree_contents, NULL))
+    return NULL;
+  if (!ostree_repo_load_variant (self->repo, OSTREE_OBJECT_TYPE_DIR_META,
+                                 meta_checksum, &tree_metadata, NULL))
+    return NULL;
+
+  OstreeRepoFile *child = NULL;
+  for (guint i = 0; i < n_components; i++)
+    {
+      OstreeRepoFile *next = ostree_repo_file_new_child (child != NULL ? child : self,
+                                                         components[i]);
+      /* @next holds the reference on its parent */
+      if (child != NULL)
+        g_object_unref (child);
+      child = next;
+    }
+
+  OstreeRepoFile *parent = child->parent;
+  parent->tree_contents = g_variant_ref (tree_contents);
+  parent->tree_metadata = g_variant_ref (tree_metadata);
+  parent->tree_contents_checksum = _ostree_repo_intern_checksum (self->repo, tree_checksum);
+  parent->tree_metadata_checksum = _ostree_repo_intern_checksum (self->repo, meta_checksum);
+
+  return (GFile*)child;
+}
+
 static GFile *
 ostree_repo_file_resolve_relative_path (GFile      *file,
 					const char *relative_path)
@@ -631,6 +729,13 @@ ostree_repo_file_resolve_relative_path (GFile      *file,
         relative_path = relative_path+1;
     }
 
+  if (self->parent == NULL && strchr (relative_path, '/') != NULL)
+    {
+      ret = resolve_relative_path_index (self, relative_path);
+      if (ret != NULL)
+        return ret;
+    }
+
   rest = strchr (relative_path, '/');
   if (rest)
     {
@@ -861,6 +966,54 @@ ostree_repo_file_tree_query_child (OstreeRepoFile  *self,
   return ret;
 }
 
+/* Lightweight alternative to ostree_repo_file_tree_query_child() for
+ * callers that only need each child's name and whether it's a
+ * directory: both are served straight from the parsed dirtree variant,
+ * with no #GFileInfo construction and no loading of the child's
+ * objects.  On success, @out_name points into @self's tree contents
+ * variant (valid as long as @self is), or is %NULL if @n is past the
+ * last child.
+ */
+gboolean
+_ostree_repo_file_tree_query_child_lite (OstreeRepoFile  *self,
+                                         int              n,
+                                         const char     **out_name,
+                                         gboolean        *out_is_dir,
+                                         GError         **error)
+{
+  const char *name = NULL;
+  gboolean is_dir = FALSE;
+  g_autoptr(GVariant) files_variant = NULL;
+  g_autoptr(GVariant) dirs_variant = NULL;
+  int c;
+
+  if (!ostree_repo_file_ensure_resolved (self, error))
+    return FALSE;
+
+  g_assert (self->tree_contents);
+
+  files_variant = g_variant_get_child_value (self->tree_contents, 0);
+  dirs_variant = g_variant_get_child_value (self->tree_contents, 1);
+
+  c = g_variant_n_children (files_variant);
+  if (n < c)
+    g_variant_get_child (files_variant, n, "(&s@ay)", &name, NULL);
+  else
+    {
+      n -= c;
+      c = g_variant_n_children (dirs_variant);
+      if (n < c)
+        {
+          g_variant_get_child (dirs_variant, n, "(&s@ay@ay)", &name, NULL, NULL);
+          is_dir = TRUE;
+        }
+    }
+
+  *out_name = name;
+  *out_is_dir = is_dir;
+  return TRUE;
+}
+
 static GFileInfo *
 ostree_repo_file_query_info (GFile                *file,
 			     const char           *attributes,
@@ -390,9 +390,12 @@ bloom_refs_intersection (GVariant                          *bloom_encoded,
   if (k == 0)
     return NULL;
 
+  /* Hash ID 1 is the classic layout; 2 is the same hash family in the
+   * blocked layout (see ostree_bloom_new_from_bytes_blocked()). */
   switch (hash_id)
     {
     case 1:
+    case 2:
       hash_func = ostree_collection_ref_bloom_hash;
       break;
     default:
@@ -401,7 +404,12 @@ bloom_refs_intersection (GVariant                          *bloom_encoded,
 
   bloom_bytes = g_variant_get_fixed_array (bloom_variant, &n_bloom_bytes, sizeof (guint8));
   bytes = g_bytes_new_static (bloom_bytes, n_bloom_bytes);
-  bloom = ostree_bloom_new_from_bytes (bytes, k, hash_func);
+  if (hash_id == 2)
+    bloom = ostree_bloom_new_from_bytes_blocked (bytes, k, hash_func);
+  else
+    bloom = ostree_bloom_new_from_bytes (bytes, k, hash_func);
+  if (bloom == NULL)
+    return NULL;
 
   possible_refs = g_ptr_array_new_with_free_func (NULL);
 
@@ -584,6 +592,42 @@ fetch_summary_from_remote (OstreeRepo    *repo,
   *out_summary_bytes = g_steal_pointer (&summary_bytes);
   return TRUE;
 }
+
+/* How long a cached peer summary stays valid. The advertised summary
+ * timestamp (`st` TXT record) is the primary invalidation mechanism; the
+ * TTL is a backstop against peers whose adverts are stale. */
+#define SUMMARY_CACHE_TTL_USEC (15 * 60 * G_USEC_PER_SEC)
+
+/* Cached summary file from a peer repository, keyed in
+ * OstreeRepoFinderAvahi.summary_cache by repository URI. An entry is
+ * only reused while the peer still advertises the same summary
+ * timestamp and the TTL has not expired. */
+typedef struct
+{
+  GBytes *bytes;
+  guint64 summary_timestamp;
+  gint64 expires_us;  /* monotonic */
+} CachedSummary;
+
+static void
+cached_summary_free (CachedSummary *summary)
+{
+  g_bytes_unref (summary->bytes);
+  g_free (summary);
+}
+
+static CachedSummary *
+cached_summary_new (GBytes  *bytes,
+                    guint64  summary_timestamp)
+{
+  CachedSummary *summary = g_new0 (CachedSummary, 1);
+
+  summary->bytes = g_bytes_ref (bytes);
+  summary->summary_timestamp = summary_timestamp;
+  summary->expires_us = g_get_monotonic_time () + SUMMARY_CACHE_TTL_USEC;
+
+  return summary;
+}
 #endif  /* HAVE_AVAHI */
 
 struct _OstreeRepoFinderAvahi
@@ -619,6 +663,12 @@ struct _OstreeRepoFinderAvahi
   /* Array of #OstreeAvahiService instances representing all the services which
    * we currently think are valid. */
   GPtrArray *found_services;  /* (element-type (owned OstreeAvahiService) */
+
+  /* Map of repository URI to its cached summary file. Unlike the other
+   * members, this is also accessed from summary fetcher worker threads,
+   * so is protected by @summary_cache_lock. */
+  GMutex summary_cache_lock;
+  GHashTable *summary_cache;  /* (element-type (owned) utf8 (owned) CachedSummary) */
 #endif  /* HAVE_AVAHI */
 };
 
@@ -629,36 +679,42 @@ G_DEFINE_TYPE_WITH_CODE (OstreeRepoFinderAvahi, ostree_repo_finder_avahi, G_TYPE
 
 #ifdef HAVE_AVAHI
 
-/* Download the summary file from @remote and fill in the checksums in the given
- * @supported_ref_to_checksum hash table, given the existing refs in it as keys.
- * See get_refs_and_checksums_from_summary() for more details. */
-static gboolean
-get_checksums (OstreeRepoFinderAvahi  *finder,
-               OstreeRepo             *repo,
-               OstreeRemote           *remote,
-               GHashTable             *supported_ref_to_checksum /* (element-type OstreeCollectionRef utf8) */,
-               GError                **error)
+/* A (remote, refs) pair collected from a service advert, whose summary still
+ * needs to be fetched (or served from the summary cache) before it can be
+ * turned into an #OstreeRepoFinderResult. */
+typedef struct
 {
-  g_autoptr(GBytes) summary_bytes = NULL;
-
-  if (!fetch_summary_from_remote (repo,
-                                  remote,
-                                  &summary_bytes,
-                                  finder->avahi_cancellable,
-                                  error))
-    return FALSE;
+  OstreeRemote *remote;  /* (owned) */
+  OstreeRepo *parent_repo;  /* (owned) */
+  gchar *uri;  /* (owned) */
+  GHashTable *supported_ref_to_checksum;  /* (owned) (element-type OstreeCollectionRef utf8) */
+  guint64 summary_timestamp;
+  gint priority;
+  GPtrArray *results;  /* (unowned) results array for the originating task */
+  gboolean success;
+} PendingResult;
 
-  return get_refs_and_checksums_from_summary (summary_bytes, supported_ref_to_checksum, error);
+static void
+pending_result_free (PendingResult *pending)
+{
+  ostree_remote_unref (pending->remote);
+  g_object_unref (pending->parent_repo);
+  g_free (pending->uri);
+  g_hash_table_unref (pending->supported_ref_to_checksum);
+  g_free (pending);
 }
 
 /* Build some #OstreeRepoFinderResults out of the given #OstreeAvahiService by
  * parsing its DNS-SD TXT records and finding the intersection between the refs
- * it advertises and @refs. One or more results will be added to @results, with
- * multiple results being added if the intersection of refs covers refs which
- * need different GPG keyrings. One result is added per (uri, keyring) pair.
+ * it advertises and @refs. One or more #PendingResults will be added to
+ * @pending, with multiple entries being added if the intersection of refs
+ * covers refs which need different GPG keyrings. One entry is added per
+ * (uri, keyring) pair; each targets @results, and becomes an
+ * #OstreeRepoFinderResult there once its peer's summary has been fetched
+ * (see fetch_pending_summaries()).
  *
  * If any of the TXT records are malformed or missing, or if the intersection of
- * refs is empty, return early without modifying @results.
+ * refs is empty, return early without modifying @pending.
  *
  * This recognises the following TXT records:
  *  - `v` (`y`): Version of the TXT record format. Only version `1` is currently
@@ -676,6 +732,7 @@ ostree_avahi_service_build_repo_finder_result (OstreeAvahiService
                                                gint                               priority,
                                                const OstreeCollectionRef * const *refs,
                                                GPtrArray                         *results,
+                                               GPtrArray                         *pending,
                                                GCancellable                      *cancellable)
 {
   g_autoptr(GHashTable) attributes = NULL;
@@ -797,16 +854,18 @@ ostree_avahi_service_build_repo_finder_result (OstreeAvahiService
         }
 
       /* Add a placeholder to @supported_ref_to_checksum for this ref. It will
-       * be filled out by the get_checksums() call below. */
+       * be filled out when the summary is fetched, in
+       * fetch_pending_summaries(). */
       g_hash_table_insert (supported_ref_to_checksum, (gpointer) ref, NULL);
     }
 
-  /* Aggregate the results. */
+  /* Queue up the results, pending their summary fetches. */
   g_hash_table_iter_init (&iter, repo_to_refs);
 
   while (g_hash_table_iter_next (&iter, (gpointer *) &repo, (gpointer *) &supported_ref_to_checksum))
     {
       g_autoptr(OstreeRemote) remote = NULL;
+      PendingResult *pending_result = NULL;
 
       /* Build an #OstreeRemote. Use the escaped URI, since remote->name
        * is used in file paths, so needs to not contain special characters. */
@@ -820,17 +879,16 @@ ostree_avahi_service_build_repo_finder_result (OstreeAvahiService
       g_key_file_set_boolean (remote->options, remote->group, "gpg-verify", TRUE);
       g_key_file_set_boolean (remote->options, remote->group, "gpg-verify-summary", TRUE);
 
-      get_checksums (finder, parent_repo, remote, supported_ref_to_checksum, &error);
-      if (error != NULL)
-        {
-          g_debug ("Failed to get checksums for possible refs; ignoring: %s", error->message);
-          g_clear_error (&error);
-          continue;
-        }
+      pending_result = g_new0 (PendingResult, 1);
+      pending_result->remote = ostree_remote_ref (remote);
+      pending_result->parent_repo = g_object_ref (parent_repo);
+      pending_result->uri = g_strdup (repo->uri);
+      pending_result->supported_ref_to_checksum = g_hash_table_ref (supported_ref_to_checksum);
+      pending_result->summary_timestamp = GUINT64_FROM_BE (g_variant_get_uint64 (summary_timestamp));
+      pending_result->priority = priority;
+      pending_result->results = results;
 
-      g_ptr_array_add (results, ostree_repo_finder_result_new (remote, OSTREE_REPO_FINDER (finder),
-                                                               priority, supported_ref_to_checksum,
-                                                               (summary_timestamp != NULL) ? GUINT64_FROM_BE (g_variant_get_uint64 (summary_timestamp)) : 0));
+      g_ptr_array_add (pending, pending_result);
     }
 }
 
@@ -900,6 +958,142 @@ fail_all_pending_tasks (OstreeRepoFinderAvahi *self,
   g_ptr_array_set_size (self->resolve_tasks, 0);
 }
 
+typedef struct
+{
+  OstreeRepoFinderAvahi *finder;  /* (unowned) */
+  GMutex lock;
+  GCond cond;
+  guint jobs_pending;
+} SummaryFetchContext;
+
+/* Number of peer summaries to fetch concurrently. The work is
+ * network-bound, so this is deliberately independent of the CPU count. */
+#define N_SUMMARY_FETCHERS 8
+
+/* Fetch the summary for @pending (or serve it from the summary cache) and
+ * fill in its ref → checksum map. Sets pending->success on success; on
+ * failure the peer is ignored, matching the previous inline behaviour.
+ * May be executed in a worker thread. */
+static void
+pending_result_fetch (SummaryFetchContext *ctx,
+                      PendingResult       *pending)
+{
+  OstreeRepoFinderAvahi *self = ctx->finder;
+  g_autoptr(GBytes) summary_bytes = NULL;
+  g_autoptr(GError) error = NULL;
+  CachedSummary *cached;
+
+  /* Serve the summary from the cache if the peer still advertises the same
+   * summary timestamp and the entry hasn't expired. */
+  g_mutex_lock (&self->summary_cache_lock);
+  cached = g_hash_table_lookup (self->summary_cache, pending->uri);
+  if (cached != NULL &&
+      cached->summary_timestamp == pending->summary_timestamp &&
+      g_get_monotonic_time () < cached->expires_us)
+    summary_bytes = g_bytes_ref (cached->bytes);
+  g_mutex_unlock (&self->summary_cache_lock);
+
+  if (summary_bytes == NULL)
+    {
+      if (!fetch_summary_from_remote (pending->parent_repo, pending->remote,
+                                      &summary_bytes, self->avahi_cancellable,
+                                      &error))
+        {
+          g_debug ("Failed to download summary from ‘%s’; ignoring: %s",
+                   pending->uri, error->message);
+          return;
+        }
+
+      g_mutex_lock (&self->summary_cache_lock);
+      g_hash_table_replace (self->summary_cache, g_strdup (pending->uri),
+                            cached_summary_new (summary_bytes, pending->summary_timestamp));
+      g_mutex_unlock (&self->summary_cache_lock);
+    }
+
+  if (!get_refs_and_checksums_from_summary (summary_bytes,
+                                            pending->supported_ref_to_checksum,
+                                            &error))
+    {
+      g_debug ("Failed to get checksums for possible refs from ‘%s’; ignoring: %s",
+               pending->uri, error->message);
+      return;
+    }
+
+  pending->success = TRUE;
+}
+
+static void
+summary_fetch_worker (gpointer data,
+                      gpointer user_data)
+{
+  SummaryFetchContext *ctx = user_data;
+  PendingResult *pending = data;
+
+  pending_result_fetch (ctx, pending);
+
+  g_mutex_lock (&ctx->lock);
+  ctx->jobs_pending--;
+  if (ctx->jobs_pending == 0)
+    g_cond_signal (&ctx->cond);
+  g_mutex_unlock (&ctx->lock);
+}
+
+/* Executed in @self->avahi_context.
+ *
+ * Fetch (or load from the cache) the summaries for all entries of @pending,
+ * several at a time, filling in their ref → checksum maps. Blocks until all
+ * the fetches have completed. */
+static void
+fetch_pending_summaries (OstreeRepoFinderAvahi *self,
+                         GPtrArray             *pending)
+{
+  SummaryFetchContext ctx = { self, };
+  GThreadPool *pool = NULL;
+
+  g_assert (g_main_context_is_owner (self->avahi_context));
+
+  if (pending->len == 0)
+    return;
+
+  g_mutex_init (&ctx.lock);
+  g_cond_init (&ctx.cond);
+
+  if (pending->len > 1)
+    pool = g_thread_pool_new (summary_fetch_worker, &ctx,
+                              MIN (pending->len, N_SUMMARY_FETCHERS),
+                              FALSE, NULL);
+
+  if (pool != NULL)
+    {
+      g_mutex_lock (&ctx.lock);
+      ctx.jobs_pending = pending->len;
+      g_mutex_unlock (&ctx.lock);
+
+      for (gsize i = 0; i < pending->len; i++)
+        {
+          /* If the push fails, run the job on this thread so
+           * @jobs_pending still reaches zero. */
+          if (!g_thread_pool_push (pool, g_ptr_array_index (pending, i), NULL))
+            summary_fetch_worker (g_ptr_array_index (pending, i), &ctx);
+        }
+
+      g_mutex_lock (&ctx.lock);
+      while (ctx.jobs_pending > 0)
+        g_cond_wait (&ctx.cond, &ctx.lock);
+      g_mutex_unlock (&ctx.lock);
+
+      g_thread_pool_free (pool, FALSE, TRUE);
+    }
+  else
+    {
+      for (gsize i = 0; i < pending->len; i++)
+        pending_result_fetch (&ctx, g_ptr_array_index (pending, i));
+    }
+
+  g_cond_clear (&ctx.cond);
+  g_mutex_clear (&ctx.lock);
+}
+
 static gint
 results_compare_cb (gconstpointer a,
                     gconstpointer b)
@@ -921,6 +1115,7 @@ complete_all_pending_tasks (OstreeRepoFinderAvahi *self)
   gsize i;
   const gint priority = 60;  /* arbitrarily chosen */
   g_autoptr(GPtrArray) results_for_tasks = g_ptr_array_new_full (self->resolve_tasks->len, (GDestroyNotify)g_ptr_array_unref);
+  g_autoptr(GPtrArray) pending_results = g_ptr_array_new_with_free_func ((GDestroyNotify) pending_result_free);
   gboolean cancelled = FALSE;
 
   g_assert (g_main_context_is_owner (self->avahi_context));
@@ -945,6 +1140,7 @@ complete_all_pending_tasks (OstreeRepoFinderAvahi *self)
 
           ostree_avahi_service_build_repo_finder_result (service, self, data->parent_repo,
                                                          priority, refs, results,
+                                                         pending_results,
                                                          self->avahi_cancellable);
           if (g_cancellable_is_cancelled (self->avahi_cancellable))
             {
@@ -958,6 +1154,32 @@ complete_all_pending_tasks (OstreeRepoFinderAvahi *self)
       g_ptr_array_add (results_for_tasks, g_steal_pointer (&results));
     }
 
+  /* Fetch the peers' summaries concurrently, then turn each successful
+   * pending entry into a result for its task. */
+  if (!cancelled)
+    {
+      fetch_pending_summaries (self, pending_results);
+      cancelled = g_cancellable_is_cancelled (self->avahi_cancellable);
+    }
+
+  if (!cancelled)
+    {
+      for (i = 0; i < pending_results->len; i++)
+        {
+          PendingResult *pending = g_ptr_array_index (pending_results, i);
+
+          if (!pending->success)
+            continue;
+
+          g_ptr_array_add (pending->results,
+                           ostree_repo_finder_result_new (pending->remote,
+                                                          OSTREE_REPO_FINDER (self),
+                                                          pending->priority,
+                                                          pending->supported_ref_to_checksum,
+                                                          pending->summary_timestamp));
+        }
+    }
+
   if (!cancelled)
     {
       for (i = 0; i < self->resolve_tasks->len; i++)
@@ -1299,6 +1521,11 @@ ostree_repo_finder_avahi_dispose (GObject *obj)
   g_clear_pointer (&self->found_services, g_ptr_array_unref);
   g_clear_pointer (&self->resolvers, g_hash_table_unref);
   g_clear_object (&self->avahi_cancellable);
+  if (self->summary_cache != NULL)
+    {
+      g_clear_pointer (&self->summary_cache, g_hash_table_unref);
+      g_mutex_clear (&self->summary_cache_lock);
+    }
 #endif  /* HAVE_AVAHI */
 
   /* Chain up. */
@@ -1329,6 +1556,8 @@ ostree_repo_finder_avahi_init (OstreeRepoFinderAvahi *self)
   self->client_state = AVAHI_CLIENT_S_REGISTERING;
   self->resolvers = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_ptr_array_unref);
   self->found_services = g_ptr_array_new_with_free_func ((GDestroyNotify) ostree_avahi_service_free);
+  g_mutex_init (&self->summary_cache_lock);
+  self->summary_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) cached_summary_free);
 #endif  /* HAVE_AVAHI */
 }
 
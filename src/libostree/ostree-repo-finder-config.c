@@ -77,68 +77,134 @@ results_compare_cb (gconstpointer a,
   return ostree_repo_finder_result_compare (result_a, result_b);
 }
 
+/* State for the overall resolve operation; stored as the task data of the
+ * resolve #GTask and only accessed from the task's main context. */
+typedef struct
+{
+  const OstreeCollectionRef * const *refs;  /* unowned; owned by the caller for the duration of the resolve */
+  OstreeRepo *parent_repo;  /* owned */
+  guint n_remotes_pending;
+  GHashTable *repo_name_to_refs;  /* (element-type utf8 GHashTable) */
+} ResolveData;
+
 static void
-ostree_repo_finder_config_resolve_async (OstreeRepoFinder                  *finder,
-                                         const OstreeCollectionRef * const *refs,
-                                         OstreeRepo                        *parent_repo,
-                                         GCancellable                      *cancellable,
-                                         GAsyncReadyCallback                callback,
-                                         gpointer                           user_data)
+resolve_data_free (ResolveData *data)
 {
-  g_autoptr(GTask) task = NULL;
-  g_autoptr(GPtrArray) results = NULL;
+  g_hash_table_unref (data->repo_name_to_refs);
+  g_object_unref (data->parent_repo);
+  g_free (data);
+}
+
+/* Task data for each per-remote summary fetch subtask. */
+typedef struct
+{
+  OstreeRepo *parent_repo;  /* owned */
+  gchar *remote_name;  /* owned */
+  gchar *collection_id;  /* owned */
+} RemoteFetchData;
+
+static void
+remote_fetch_data_free (RemoteFetchData *data)
+{
+  g_object_unref (data->parent_repo);
+  g_free (data->remote_name);
+  g_free (data->collection_id);
+  g_free (data);
+}
+
+/* Runs in a worker thread; each thread fetches one remote's summary, using
+ * its own fetcher and main context. */
+static void
+remote_refs_list_thread_cb (GTask        *subtask,
+                            gpointer      source_object,
+                            gpointer      task_data,
+                            GCancellable *cancellable)
+{
+  RemoteFetchData *fetch_data = task_data;
+  GHashTable *remote_refs = NULL;  /* (element-type utf8 utf8) */
+  GError *local_error = NULL;
+
+  if (!ostree_repo_remote_list_refs (fetch_data->parent_repo, fetch_data->remote_name,
+                                     &remote_refs, cancellable, &local_error))
+    g_task_return_error (subtask, local_error);
+  else
+    g_task_return_pointer (subtask, remote_refs, (GDestroyNotify) g_hash_table_unref);
+}
+
+static void
+resolve_complete (GTask *task)
+{
+  OstreeRepoFinder *finder = OSTREE_REPO_FINDER (g_task_get_source_object (task));
+  ResolveData *data = g_task_get_task_data (task);
   const gint priority = 100;  /* arbitrarily chosen; lower than the others */
-  gsize i, j;
-  g_autoptr(GHashTable) repo_name_to_refs = NULL;  /* (element-type utf8 GHashTable) */
-  GHashTable *supported_ref_to_checksum;  /* (element-type OstreeCollectionRef utf8) */
+  g_autoptr(GPtrArray) results = NULL;
   GHashTableIter iter;
   const gchar *remote_name;
-  g_auto(GStrv) remotes = NULL;
-  gsize n_remotes = 0;
+  GHashTable *supported_ref_to_checksum;  /* (element-type OstreeCollectionRef utf8) */
 
-  task = g_task_new (finder, cancellable, callback, user_data);
-  g_task_set_source_tag (task, ostree_repo_finder_config_resolve_async);
   results = g_ptr_array_new_with_free_func ((GDestroyNotify) ostree_repo_finder_result_free);
-  repo_name_to_refs = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
-                                             (GDestroyNotify) g_hash_table_unref);
 
-  /* List all remotes in this #OstreeRepo and see which of their ref lists
-   * intersect with @refs. */
-  remotes = ostree_repo_remote_list (parent_repo, (guint *) &n_remotes);
-
-  g_debug ("%s: Checking %" G_GSIZE_FORMAT " remotes", G_STRFUNC, n_remotes);
+  /* Aggregate the results. */
+  g_hash_table_iter_init (&iter, data->repo_name_to_refs);
 
-  for (i = 0; i < n_remotes; i++)
+  while (g_hash_table_iter_next (&iter, (gpointer *) &remote_name, (gpointer *) &supported_ref_to_checksum))
     {
       g_autoptr(GError) local_error = NULL;
-      g_autoptr(GHashTable) remote_refs = NULL;  /* (element-type utf8 utf8) */
-      const gchar *checksum;
-      g_autofree gchar *remote_collection_id = NULL;
-
-      remote_name = remotes[i];
+      OstreeRemote *remote;
 
-      if (!ostree_repo_get_remote_option (parent_repo, remote_name, "collection-id",
-                                          NULL, &remote_collection_id, &local_error) ||
-          !ostree_validate_collection_id (remote_collection_id, &local_error))
+      /* We don’t know what last-modified timestamp the remote has without
+       * making expensive HTTP queries, so leave that information blank. We
+       * assume that the configuration which says the refs and commits in
+       * @supported_ref_to_checksum are in the repository is correct; the code
+       * in ostree_repo_find_remotes_async() will check that. */
+      remote = _ostree_repo_get_remote_inherited (data->parent_repo, remote_name, &local_error);
+      if (remote == NULL)
         {
-          g_debug ("Ignoring remote ‘%s’ due to no valid collection ID being configured for it: %s",
-                   remote_name, local_error->message);
-          g_clear_error (&local_error);
+          g_debug ("Configuration for remote ‘%s’ could not be found. Ignoring.",
+                   remote_name);
           continue;
         }
 
-      if (!ostree_repo_remote_list_refs (parent_repo, remote_name, &remote_refs,
-                                         cancellable, &local_error))
-        {
-          g_debug ("Ignoring remote ‘%s’ due to error loading its refs: %s",
-                   remote_name, local_error->message);
-          g_clear_error (&local_error);
-          continue;
-        }
+      g_ptr_array_add (results, ostree_repo_finder_result_new (remote, finder, priority, supported_ref_to_checksum, 0));
+    }
 
+  g_ptr_array_sort (results, results_compare_cb);
+
+  g_task_return_pointer (task, g_steal_pointer (&results), (GDestroyNotify) g_ptr_array_unref);
+}
+
+/* Called on the task's main context as each remote's summary fetch finishes;
+ * merges that remote's refs into the shared state and completes the resolve
+ * once no fetches remain. */
+static void
+remote_refs_list_cb (GObject      *obj,
+                     GAsyncResult *result,
+                     gpointer      user_data)
+{
+  g_autoptr(GTask) task = G_TASK (user_data);
+  GTask *subtask = G_TASK (result);
+  RemoteFetchData *fetch_data = g_task_get_task_data (subtask);
+  ResolveData *data = g_task_get_task_data (task);
+  const gchar *remote_name = fetch_data->remote_name;
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(GHashTable) remote_refs = NULL;  /* (element-type utf8 utf8) */
+  GHashTable *supported_ref_to_checksum;  /* (element-type OstreeCollectionRef utf8) */
+  const OstreeCollectionRef * const *refs = data->refs;
+  const gchar *checksum;
+  gsize j;
+
+  remote_refs = g_task_propagate_pointer (subtask, &local_error);
+
+  if (remote_refs == NULL)
+    {
+      g_debug ("Ignoring remote ‘%s’ due to error loading its refs: %s",
+               remote_name, local_error->message);
+    }
+  else
+    {
       for (j = 0; refs[j] != NULL; j++)
         {
-          if (g_strcmp0 (refs[j]->collection_id, remote_collection_id) == 0 &&
+          if (g_strcmp0 (refs[j]->collection_id, fetch_data->collection_id) == 0 &&
               g_hash_table_lookup_extended (remote_refs, refs[j]->ref_name, NULL, (gpointer *) &checksum))
             {
               /* The requested ref is listed in the refs for this remote. Add
@@ -147,14 +213,15 @@ ostree_repo_finder_config_resolve_async (OstreeRepoFinder                  *find
               g_debug ("Resolved ref (%s, %s) to remote ‘%s’.",
                        refs[j]->collection_id, refs[j]->ref_name, remote_name);
 
-              supported_ref_to_checksum = g_hash_table_lookup (repo_name_to_refs, remote_name);
+              supported_ref_to_checksum = g_hash_table_lookup (data->repo_name_to_refs, remote_name);
 
               if (supported_ref_to_checksum == NULL)
                 {
                   supported_ref_to_checksum = g_hash_table_new_full (ostree_collection_ref_hash,
                                                                      ostree_collection_ref_equal,
                                                                      NULL, g_free);
-                  g_hash_table_insert (repo_name_to_refs, (gpointer) remote_name, supported_ref_to_checksum  /* transfer */);
+                  g_hash_table_insert (data->repo_name_to_refs,
+                                       g_strdup (remote_name), supported_ref_to_checksum  /* transfer */);
                 }
 
               g_hash_table_insert (supported_ref_to_checksum,
@@ -163,33 +230,88 @@ ostree_repo_finder_config_resolve_async (OstreeRepoFinder                  *find
         }
     }
 
-  /* Aggregate the results. */
-  g_hash_table_iter_init (&iter, repo_name_to_refs);
+  g_assert (data->n_remotes_pending > 0);
+  data->n_remotes_pending--;
+  if (data->n_remotes_pending == 0)
+    resolve_complete (task);
+}
 
-  while (g_hash_table_iter_next (&iter, (gpointer *) &remote_name, (gpointer *) &supported_ref_to_checksum))
+static void
+ostree_repo_finder_config_resolve_async (OstreeRepoFinder                  *finder,
+                                         const OstreeCollectionRef * const *refs,
+                                         OstreeRepo                        *parent_repo,
+                                         GCancellable                      *cancellable,
+                                         GAsyncReadyCallback                callback,
+                                         gpointer                           user_data)
+{
+  g_autoptr(GTask) task = NULL;
+  ResolveData *data;
+  gsize i;
+  g_auto(GStrv) remotes = NULL;
+  gsize n_remotes = 0;
+  g_autoptr(GPtrArray) subtasks = NULL;  /* (element-type GTask) */
+
+  task = g_task_new (finder, cancellable, callback, user_data);
+  g_task_set_source_tag (task, ostree_repo_finder_config_resolve_async);
+
+  data = g_new0 (ResolveData, 1);
+  data->refs = refs;
+  data->parent_repo = g_object_ref (parent_repo);
+  data->repo_name_to_refs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                                   (GDestroyNotify) g_hash_table_unref);
+  g_task_set_task_data (task, data, (GDestroyNotify) resolve_data_free);
+
+  /* List all remotes in this #OstreeRepo and see which of their ref lists
+   * intersect with @refs. The collection ID filter is a cheap local
+   * configuration read, so do it here; the summary fetches behind
+   * ostree_repo_remote_list_refs() can each take a network round trip, so
+   * they are fanned out across worker threads and merged as they arrive.
+   * All the fetches share @cancellable as their deadline. */
+  remotes = ostree_repo_remote_list (parent_repo, (guint *) &n_remotes);
+
+  g_debug ("%s: Checking %" G_GSIZE_FORMAT " remotes", G_STRFUNC, n_remotes);
+
+  subtasks = g_ptr_array_new_with_free_func (g_object_unref);
+
+  for (i = 0; i < n_remotes; i++)
     {
       g_autoptr(GError) local_error = NULL;
-      OstreeRemote *remote;
+      g_autofree gchar *remote_collection_id = NULL;
+      const gchar *remote_name = remotes[i];
+      RemoteFetchData *fetch_data;
+      GTask *subtask;
 
-      /* We don’t know what last-modified timestamp the remote has without
-       * making expensive HTTP queries, so leave that information blank. We
-       * assume that the configuration which says the refs and commits in
-       * @supported_ref_to_checksum are in the repository is correct; the code
-       * in ostree_repo_find_remotes_async() will check that. */
-      remote = _ostree_repo_get_remote_inherited (parent_repo, remote_name, &local_error);
-      if (remote == NULL)
+      if (!ostree_repo_get_remote_option (parent_repo, remote_name, "collection-id",
+                                          NULL, &remote_collection_id, &local_error) ||
+          !ostree_validate_collection_id (remote_collection_id, &local_error))
         {
-          g_debug ("Configuration for remote ‘%s’ could not be found. Ignoring.",
-                   remote_name);
+          g_debug ("Ignoring remote ‘%s’ due to no valid collection ID being configured for it: %s",
+                   remote_name, local_error->message);
+          g_clear_error (&local_error);
           continue;
         }
 
-      g_ptr_array_add (results, ostree_repo_finder_result_new (remote, finder, priority, supported_ref_to_checksum, 0));
+      fetch_data = g_new0 (RemoteFetchData, 1);
+      fetch_data->parent_repo = g_object_ref (parent_repo);
+      fetch_data->remote_name = g_strdup (remote_name);
+      fetch_data->collection_id = g_steal_pointer (&remote_collection_id);
+
+      subtask = g_task_new (finder, cancellable, remote_refs_list_cb, g_object_ref (task));
+      g_task_set_source_tag (subtask, ostree_repo_finder_config_resolve_async);
+      g_task_set_task_data (subtask, fetch_data, (GDestroyNotify) remote_fetch_data_free);
+      g_ptr_array_add (subtasks, subtask  /* transfer */);
     }
 
-  g_ptr_array_sort (results, results_compare_cb);
+  data->n_remotes_pending = subtasks->len;
 
-  g_task_return_pointer (task, g_steal_pointer (&results), (GDestroyNotify) g_ptr_array_unref);
+  if (subtasks->len == 0)
+    {
+      resolve_complete (task);
+      return;
+    }
+
+  for (i = 0; i < subtasks->len; i++)
+    g_task_run_in_thread (g_ptr_array_index (subtasks, i), remote_refs_list_thread_cb);
 }
 
 static GPtrArray *
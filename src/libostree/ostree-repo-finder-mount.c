@@ -33,6 +33,7 @@
 #include "ostree-remote-private.h"
 #include "ostree-repo-finder.h"
 #include "ostree-repo-finder-mount.h"
+#include "otutil.h"
 
 /**
  * SECTION:ostree-repo-finder-mount
@@ -60,6 +61,16 @@
  * from `.ostree/repos`. Any symlink which points outside the volume’s file
  * system will be ignored. Repositories are deduplicated in the results.
  *
+ * Mounted volumes are scanned concurrently, with an overall deadline, so one
+ * slow or broken volume cannot stall resolution of the others. A volume may
+ * additionally carry a `.ostree/repos.index` file, a serialised #GVariant of
+ * type `a{s(ss)}` mapping `C/R` to a (repository path relative to the volume
+ * root, checksum) pair; if present and parseable, it is used to answer
+ * queries for that volume without opening the repositories at all. The index
+ * is as trustworthy as a repository summary file: a stale or malicious entry
+ * is caught at pull time by commit and signature verification. Tools which
+ * master update volumes are expected to generate it.
+ *
  * The volume monitor used to find mounted volumes can be overridden by setting
  * #OstreeRepoFinderMount:monitor. By default, g_volume_monitor_get() is used.
  *
@@ -165,245 +176,586 @@ results_compare_cb (gconstpointer a,
   return ostree_repo_finder_result_compare (result_a, result_b);
 }
 
+/* Convert the per-repository aggregation in @repo_to_refs into
+ * #OstreeRepoFinderResults appended to @results.
+ */
 static void
-ostree_repo_finder_mount_resolve_async (OstreeRepoFinder                  *finder,
-                                        const OstreeCollectionRef * const *refs,
-                                        OstreeRepo                        *parent_repo,
-                                        GCancellable                      *cancellable,
-                                        GAsyncReadyCallback                callback,
-                                        gpointer                           user_data)
+emit_results_for_repos (OstreeRepoFinder *finder,
+                        GHashTable       *repo_to_refs,
+                        GPtrArray        *results)
 {
-  OstreeRepoFinderMount *self = OSTREE_REPO_FINDER_MOUNT (finder);
-  g_autoptr(GTask) task = NULL;
-  g_autoptr(ObjectList) mounts = NULL;
-  g_autoptr(GPtrArray) results = NULL;  /* (element-type OstreeRepoFinderResult) */
-  GList *l;
+  GHashTableIter iter;
+  UriAndKeyring *repo;
+  GHashTable *supported_ref_to_checksum;  /* (element-type OstreeCollectionRef utf8) */
   const gint priority = 50;  /* arbitrarily chosen */
 
-  task = g_task_new (finder, cancellable, callback, user_data);
-  g_task_set_source_tag (task, ostree_repo_finder_mount_resolve_async);
+  g_hash_table_iter_init (&iter, repo_to_refs);
 
-  mounts = g_volume_monitor_get_mounts (self->monitor);
-  results = g_ptr_array_new_with_free_func ((GDestroyNotify) ostree_repo_finder_result_free);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &repo, (gpointer *) &supported_ref_to_checksum))
+    {
+      g_autoptr(OstreeRemote) remote = NULL;
 
-  g_debug ("%s: Found %u mounts", G_STRFUNC, g_list_length (mounts));
+      /* Build an #OstreeRemote. Use the escaped URI, since remote->name
+       * is used in file paths, so needs to not contain special characters. */
+      g_autofree gchar *name = uri_and_keyring_to_name (repo);
+      remote = ostree_remote_new (name);
 
-  for (l = mounts; l != NULL; l = l->next)
+      g_clear_pointer (&remote->keyring, g_free);
+      remote->keyring = g_strdup (repo->keyring);
+
+      g_key_file_set_string (remote->options, remote->group, "url", repo->uri);
+      g_key_file_set_boolean (remote->options, remote->group, "gpg-verify", TRUE);
+      g_key_file_set_boolean (remote->options, remote->group, "gpg-verify-summary", TRUE);
+
+      /* Set the timestamp in the #OstreeRepoFinderResult to 0 because
+       * the code in ostree_repo_pull_from_remotes_async() will be able to
+       * check it just as quickly as we can here; so don’t duplicate the
+       * code. */
+      g_ptr_array_add (results, ostree_repo_finder_result_new (remote, finder, priority, supported_ref_to_checksum, 0));
+    }
+}
+
+/* Fast path: the volume producer may ship a
+ * `.ostree/repos.index` file of type `a{s(ss)}`, mapping
+ * "$collection_id/$ref_name" to (repository path relative to the mount
+ * root, checksum).  It lets us answer a resolve request without
+ * opening and listing each repository; a stale checksum is caught at
+ * pull time by commit and signature verification, the same trust model
+ * as a repository summary.  Returns %TRUE if the index existed and was
+ * used (possibly matching no refs).
+ */
+static gboolean
+scan_mount_index (OstreeRepoFinder                  *finder,
+                  const gchar                       *mount_name,
+                  const gchar                       *mount_root_path,
+                  int                                mount_root_dfd,
+                  const struct stat                 *mount_root_stbuf,
+                  const OstreeCollectionRef * const *refs,
+                  OstreeRepo                        *parent_repo,
+                  GPtrArray                         *results,
+                  GCancellable                      *cancellable)
+{
+  glnx_fd_close int index_fd = -1;
+  g_autoptr(GVariant) index = NULL;
+  g_autoptr(GHashTable) repo_to_refs = NULL;  /* (element-type UriAndKeyring GHashTable) */
+  GHashTable *supported_ref_to_checksum;  /* (element-type OstreeCollectionRef utf8) */
+  gsize i;
+
+  if (!ot_openat_ignore_enoent (mount_root_dfd, ".ostree/repos.index", &index_fd, NULL))
+    return FALSE;
+  if (index_fd == -1)
+    return FALSE;
+
+  if (!ot_util_variant_map_fd (index_fd, 0, G_VARIANT_TYPE ("a{s(ss)}"), TRUE, &index, NULL))
+    {
+      g_debug ("Ignoring unparseable ‘%s/.ostree/repos.index’ on mount ‘%s’.",
+               mount_root_path, mount_name);
+      return FALSE;
+    }
+
+  g_debug ("Resolving refs on mount ‘%s’ from its repos.index.", mount_name);
+
+  repo_to_refs = g_hash_table_new_full (uri_and_keyring_hash, uri_and_keyring_equal,
+                                        (GDestroyNotify) uri_and_keyring_free, (GDestroyNotify) g_hash_table_unref);
+
+  for (i = 0; refs[i] != NULL; i++)
     {
-      GMount *mount = G_MOUNT (l->data);
-      g_autofree gchar *mount_name = NULL;
-      g_autoptr(GFile) mount_root = NULL;
-      g_autofree gchar *mount_root_path = NULL;
-      glnx_fd_close int mount_root_dfd = -1;
-      struct stat mount_root_stbuf;
-      glnx_fd_close int repos_dfd = -1;
-      gsize i;
-      g_autoptr(GHashTable) repo_to_refs = NULL;  /* (element-type UriAndKeyring GHashTable) */
-      GHashTable *supported_ref_to_checksum;  /* (element-type OstreeCollectionRef utf8) */
-      GHashTableIter iter;
-      UriAndKeyring *repo;
       g_autoptr(GError) local_error = NULL;
+      struct stat stbuf;
 
-      mount_name = g_mount_get_name (mount);
+      g_autofree gchar *collection_and_ref = g_build_filename (refs[i]->collection_id, refs[i]->ref_name, NULL);
+      g_autoptr(GVariant) entry = g_variant_lookup_value (index, collection_and_ref, G_VARIANT_TYPE ("(ss)"));
 
-      /* Check the mount’s general properties. */
-      if (g_mount_is_shadowed (mount))
+      if (entry == NULL)
         {
-          g_debug ("Ignoring mount ‘%s’ as it’s shadowed.", mount_name);
+          g_debug ("Ignoring ref (%s, %s) on mount ‘%s’ as it’s not in the index.",
+                   refs[i]->collection_id, refs[i]->ref_name, mount_name);
           continue;
         }
 
-      /* Check if it contains a .ostree/repos directory. */
-      mount_root = g_mount_get_root (mount);
-      mount_root_path = g_file_get_path (mount_root);
+      const gchar *relative_path, *checksum;
+      g_variant_get (entry, "(&s&s)", &relative_path, &checksum);
 
-      if (!glnx_opendirat (AT_FDCWD, mount_root_path, TRUE, &mount_root_dfd, &local_error))
+      if (!ostree_validate_checksum_string (checksum, NULL))
         {
-          g_debug ("Ignoring mount ‘%s’ as ‘%s’ directory can’t be opened: %s",
-                   mount_name, mount_root_path, local_error->message);
+          g_debug ("Ignoring ref (%s, %s) on mount ‘%s’ as its indexed checksum is invalid.",
+                   refs[i]->collection_id, refs[i]->ref_name, mount_name);
           continue;
         }
 
-      if (!glnx_opendirat (mount_root_dfd, ".ostree/repos", TRUE, &repos_dfd, &local_error))
+      g_autofree gchar *repo_dir_path = g_build_filename (mount_root_path, relative_path, NULL);
+
+      if (!glnx_fstatat (mount_root_dfd, relative_path, &stbuf, AT_NO_AUTOMOUNT, &local_error))
         {
-          if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
-            g_debug ("Ignoring mount ‘%s’ as ‘%s/.ostree/repos’ directory doesn’t exist.",
-                     mount_name, mount_root_path);
-          else
-            g_debug ("Ignoring mount ‘%s’ as ‘%s/.ostree/repos’ directory can’t be opened: %s",
-                     mount_name, mount_root_path, local_error->message);
+          g_debug ("Ignoring ref (%s, %s) on mount ‘%s’ as querying info of indexed ‘%s’ failed: %s",
+                   refs[i]->collection_id, refs[i]->ref_name, mount_name, repo_dir_path, local_error->message);
+          continue;
+        }
 
+      /* As in the slow path, don’t follow the index outside the mounted
+       * volume. */
+      if ((stbuf.st_mode & S_IFMT) != S_IFDIR || stbuf.st_dev != mount_root_stbuf->st_dev)
+        {
+          g_debug ("Ignoring ref (%s, %s) on mount ‘%s’ as indexed ‘%s’ is not a directory on the mount.",
+                   refs[i]->collection_id, refs[i]->ref_name, mount_name, repo_dir_path);
           continue;
         }
 
-      /* stat() the mount root so we can later check whether the resolved
-       * repositories for individual refs are on the same device (to avoid the
-       * symlinks for them pointing outside the mount root). */
-      if (!glnx_fstat (mount_root_dfd, &mount_root_stbuf, &local_error))
+      /* Exclude repositories which resolve to @parent_repo. */
+      g_autofree char *canonical_repo_dir_path = realpath (repo_dir_path, NULL);
+      g_autofree gchar *parent_repo_path = g_file_get_path (ostree_repo_get_path (parent_repo));
+      g_autofree char *canonical_parent_repo_path = realpath (parent_repo_path, NULL);
+
+      if (g_strcmp0 (canonical_repo_dir_path, canonical_parent_repo_path) == 0)
         {
-          g_debug ("Ignoring mount ‘%s’ as querying info of ‘%s’ failed: %s",
-                   mount_name, mount_root_path, local_error->message);
+          g_debug ("Ignoring ref (%s, %s) on mount ‘%s’ as its repository was the one we are resolving for: %s",
+                   refs[i]->collection_id, refs[i]->ref_name, mount_name, canonical_parent_repo_path);
           continue;
         }
 
-      /* Check whether a subdirectory exists for any of the @refs we’re looking
-       * for. If so, and it’s a symbolic link, dereference it so multiple links
-       * to the same repository (containing multiple refs) are coalesced.
-       * Otherwise, include it as a result by itself. */
-      repo_to_refs = g_hash_table_new_full (uri_and_keyring_hash, uri_and_keyring_equal,
-                                            (GDestroyNotify) uri_and_keyring_free, (GDestroyNotify) g_hash_table_unref);
+      g_autofree gchar *keyring = ostree_repo_resolve_keyring_for_collection (parent_repo, refs[i]->collection_id,
+                                                                              cancellable, &local_error);
 
-      for (i = 0; refs[i] != NULL; i++)
+      if (keyring == NULL)
         {
-          struct stat stbuf;
-          g_autofree gchar *collection_and_ref = NULL;
-          g_autofree gchar *repo_dir_path = NULL;
-          g_autofree gchar *resolved_repo_uri = NULL;
-          g_autofree gchar *keyring = NULL;
-          g_autoptr(UriAndKeyring) resolved_repo = NULL;
-
-          collection_and_ref = g_build_filename (refs[i]->collection_id, refs[i]->ref_name, NULL);
-          repo_dir_path = g_build_filename (mount_root_path, ".ostree", "repos",
-                                            collection_and_ref, NULL);
-
-          if (!glnx_fstatat (repos_dfd, collection_and_ref, &stbuf, AT_NO_AUTOMOUNT, &local_error))
-            {
-              g_debug ("Ignoring ref (%s, %s) on mount ‘%s’ as querying info of ‘%s’ failed: %s",
-                       refs[i]->collection_id, refs[i]->ref_name, mount_name, repo_dir_path, local_error->message);
-              g_clear_error (&local_error);
-              continue;
-            }
-
-          if ((stbuf.st_mode & S_IFMT) != S_IFDIR)
-            {
-              g_debug ("Ignoring ref (%s, %s) on mount ‘%s’ as ‘%s’ is of type %u, not a directory.",
-                       refs[i]->collection_id, refs[i]->ref_name, mount_name, repo_dir_path, (stbuf.st_mode & S_IFMT));
-              g_clear_error (&local_error);
-              continue;
-            }
-
-          /* Check the resolved repository path is below the mount point. Do not
-           * allow ref symlinks to point somewhere outside of the mounted
-           * volume. */
-          if (stbuf.st_dev != mount_root_stbuf.st_dev)
-            {
-              g_debug ("Ignoring ref (%s, %s) on mount ‘%s’ as it’s on a different file system from the mount.",
-                       refs[i]->collection_id, refs[i]->ref_name, mount_name);
-              g_clear_error (&local_error);
-              continue;
-            }
-
-          /* Exclude repositories which resolve to @parent_repo. */
-          g_autofree char *canonical_repo_dir_path = realpath (repo_dir_path, NULL);
-          g_autofree gchar *parent_repo_path = g_file_get_path (ostree_repo_get_path (parent_repo));
-          g_autofree char *canonical_parent_repo_path = realpath (parent_repo_path, NULL);
-
-          if (g_strcmp0 (canonical_repo_dir_path, canonical_parent_repo_path) == 0)
-            {
-              g_debug ("Ignoring ref (%s, %s) on mount ‘%s’ as its repository was the one we are resolving for: %s",
-                       refs[i]->collection_id, refs[i]->ref_name, mount_name, canonical_parent_repo_path);
-              g_clear_error (&local_error);
-              continue;
-            }
-
-          /* Grab the given ref and a checksum for it from the repo.
-           * FIXME: Ideally, there would be some ostree_repo_open_at() which we
-           * could use to keep the openat() chain going. See
-           * https://github.com/ostreedev/ostree/pull/820. */
-          g_autoptr(OstreeRepo) repo = NULL;
-          g_autoptr(GFile) repo_dir_file = g_file_new_for_path (repo_dir_path);
-          repo = ostree_repo_new (repo_dir_file);
-
-          if (!ostree_repo_open (repo, cancellable, &local_error))
-            {
-              g_debug ("Ignoring ref (%s, %s) on mount ‘%s’ as its repository could not be opened: %s",
-                       refs[i]->collection_id, refs[i]->ref_name, mount_name, local_error->message);
-              g_clear_error (&local_error);
-              continue;
-            }
-
-          g_autoptr(GHashTable) repo_refs = NULL;  /* (element-type OstreeCollectionRef utf8) */
-
-          if (!ostree_repo_list_collection_refs (repo, refs[i]->collection_id, &repo_refs, cancellable, &local_error))
-            {
-              g_debug ("Ignoring ref (%s, %s) on mount ‘%s’ as its refs could not be listed: %s",
-                       refs[i]->collection_id, refs[i]->ref_name, mount_name, local_error->message);
-              g_clear_error (&local_error);
-              continue;
-            }
-
-          const gchar *checksum = g_hash_table_lookup (repo_refs, refs[i]);
-
-          if (checksum == NULL)
-            {
-              g_debug ("Ignoring ref (%s, %s) on mount ‘%s’ as its repository doesn’t contain the ref.",
-                       refs[i]->collection_id, refs[i]->ref_name, mount_name);
-              g_clear_error (&local_error);
-              continue;
-            }
-
-          /* Finally, look up the GPG keyring for this ref. */
-          keyring = ostree_repo_resolve_keyring_for_collection (parent_repo, refs[i]->collection_id,
-                                                                cancellable, &local_error);
-
-          if (keyring == NULL)
-            {
-              g_debug ("Ignoring ref (%s, %s) on mount ‘%s’ due to missing keyring: %s",
-                       refs[i]->collection_id, refs[i]->ref_name, mount_name, local_error->message);
-              g_clear_error (&local_error);
-              continue;
-            }
-
-          /* There is a valid repo at (or pointed to by)
-           * $mount_root/.ostree/repos/$refs[i]->collection_id/$refs[i]->ref_name.
-           * Add it to the results, keyed by the canonicalised repository URI
-           * to deduplicate the results. */
-          resolved_repo_uri = g_strconcat ("file://", canonical_repo_dir_path, NULL);
-          g_debug ("Resolved ref (%s, %s) on mount ‘%s’ to repo URI ‘%s’ with keyring ‘%s’.",
-                   refs[i]->collection_id, refs[i]->ref_name, mount_name, resolved_repo_uri, keyring);
-
-          resolved_repo = uri_and_keyring_new (resolved_repo_uri, keyring);
-
-          supported_ref_to_checksum = g_hash_table_lookup (repo_to_refs, resolved_repo);
-
-          if (supported_ref_to_checksum == NULL)
-            {
-              supported_ref_to_checksum = g_hash_table_new_full (ostree_collection_ref_hash,
-                                                                 ostree_collection_ref_equal,
-                                                                 NULL, g_free);
-              g_hash_table_insert (repo_to_refs, g_steal_pointer (&resolved_repo), supported_ref_to_checksum  /* transfer */);
-            }
-
-          g_hash_table_insert (supported_ref_to_checksum, (gpointer) refs[i], g_strdup (checksum));
+          g_debug ("Ignoring ref (%s, %s) on mount ‘%s’ due to missing keyring: %s",
+                   refs[i]->collection_id, refs[i]->ref_name, mount_name, local_error->message);
+          continue;
         }
 
-      /* Aggregate the results. */
-      g_hash_table_iter_init (&iter, repo_to_refs);
+      g_autofree gchar *resolved_repo_uri = g_strconcat ("file://", canonical_repo_dir_path, NULL);
+      g_debug ("Resolved ref (%s, %s) on mount ‘%s’ to indexed repo URI ‘%s’ with keyring ‘%s’.",
+               refs[i]->collection_id, refs[i]->ref_name, mount_name, resolved_repo_uri, keyring);
+
+      g_autoptr(UriAndKeyring) resolved_repo = uri_and_keyring_new (resolved_repo_uri, keyring);
+
+      supported_ref_to_checksum = g_hash_table_lookup (repo_to_refs, resolved_repo);
 
-      while (g_hash_table_iter_next (&iter, (gpointer *) &repo, (gpointer *) &supported_ref_to_checksum))
+      if (supported_ref_to_checksum == NULL)
         {
-          g_autoptr(OstreeRemote) remote = NULL;
+          /* The keys are copies, since the results may outlive the refs
+           * array the scan was started with. */
+          supported_ref_to_checksum = g_hash_table_new_full (ostree_collection_ref_hash,
+                                                             ostree_collection_ref_equal,
+                                                             (GDestroyNotify) ostree_collection_ref_free, g_free);
+          g_hash_table_insert (repo_to_refs, g_steal_pointer (&resolved_repo), supported_ref_to_checksum  /* transfer */);
+        }
 
-          /* Build an #OstreeRemote. Use the escaped URI, since remote->name
-           * is used in file paths, so needs to not contain special characters. */
-          g_autofree gchar *name = uri_and_keyring_to_name (repo);
-          remote = ostree_remote_new (name);
+      g_hash_table_insert (supported_ref_to_checksum, ostree_collection_ref_dup (refs[i]), g_strdup (checksum));
+    }
 
-          g_clear_pointer (&remote->keyring, g_free);
-          remote->keyring = g_strdup (repo->keyring);
+  emit_results_for_repos (finder, repo_to_refs, results);
 
-          g_key_file_set_string (remote->options, remote->group, "url", repo->uri);
-          g_key_file_set_boolean (remote->options, remote->group, "gpg-verify", TRUE);
-          g_key_file_set_boolean (remote->options, remote->group, "gpg-verify-summary", TRUE);
+  return TRUE;
+}
 
-          /* Set the timestamp in the #OstreeRepoFinderResult to 0 because
-           * the code in ostree_repo_pull_from_remotes_async() will be able to
-           * check it just as quickly as we can here; so don’t duplicate the
-           * code. */
-          g_ptr_array_add (results, ostree_repo_finder_result_new (remote, finder, priority, supported_ref_to_checksum, 0));
+/* Scan a single mount for repositories matching @refs, appending any
+ * results to @results.  Failures are only worth a g_debug(); a broken
+ * or irrelevant volume should never abort the whole resolve operation.
+ */
+static void
+scan_one_mount (OstreeRepoFinder                  *finder,
+                GMount                            *mount,
+                const OstreeCollectionRef * const *refs,
+                OstreeRepo                        *parent_repo,
+                GPtrArray                         *results,
+                GCancellable                      *cancellable)
+{
+  g_autofree gchar *mount_name = NULL;
+  g_autoptr(GFile) mount_root = NULL;
+  g_autofree gchar *mount_root_path = NULL;
+  glnx_fd_close int mount_root_dfd = -1;
+  struct stat mount_root_stbuf;
+  glnx_fd_close int repos_dfd = -1;
+  gsize i;
+  g_autoptr(GHashTable) repo_to_refs = NULL;  /* (element-type UriAndKeyring GHashTable) */
+  GHashTable *supported_ref_to_checksum;  /* (element-type OstreeCollectionRef utf8) */
+  g_autoptr(GError) local_error = NULL;
+
+  mount_name = g_mount_get_name (mount);
+
+  /* Check the mount’s general properties. */
+  if (g_mount_is_shadowed (mount))
+    {
+      g_debug ("Ignoring mount ‘%s’ as it’s shadowed.", mount_name);
+      return;
+    }
+
+  /* Check if it contains a .ostree/repos directory. */
+  mount_root = g_mount_get_root (mount);
+  mount_root_path = g_file_get_path (mount_root);
+
+  if (!glnx_opendirat (AT_FDCWD, mount_root_path, TRUE, &mount_root_dfd, &local_error))
+    {
+      g_debug ("Ignoring mount ‘%s’ as ‘%s’ directory can’t be opened: %s",
+               mount_name, mount_root_path, local_error->message);
+      return;
+    }
+
+  /* stat() the mount root so we can later check whether the resolved
+   * repositories for individual refs are on the same device (to avoid the
+   * symlinks for them pointing outside the mount root). */
+  if (!glnx_fstat (mount_root_dfd, &mount_root_stbuf, &local_error))
+    {
+      g_debug ("Ignoring mount ‘%s’ as querying info of ‘%s’ failed: %s",
+               mount_name, mount_root_path, local_error->message);
+      return;
+    }
+
+  if (scan_mount_index (finder, mount_name, mount_root_path, mount_root_dfd,
+                        &mount_root_stbuf, refs, parent_repo, results, cancellable))
+    return;
+
+  if (!glnx_opendirat (mount_root_dfd, ".ostree/repos", TRUE, &repos_dfd, &local_error))
+    {
+      if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+        g_debug ("Ignoring mount ‘%s’ as ‘%s/.ostree/repos’ directory doesn’t exist.",
+                 mount_name, mount_root_path);
+      else
+        g_debug ("Ignoring mount ‘%s’ as ‘%s/.ostree/repos’ directory can’t be opened: %s",
+                 mount_name, mount_root_path, local_error->message);
+
+      return;
+    }
+
+  /* Check whether a subdirectory exists for any of the @refs we’re looking
+   * for. If so, and it’s a symbolic link, dereference it so multiple links
+   * to the same repository (containing multiple refs) are coalesced.
+   * Otherwise, include it as a result by itself. */
+  repo_to_refs = g_hash_table_new_full (uri_and_keyring_hash, uri_and_keyring_equal,
+                                        (GDestroyNotify) uri_and_keyring_free, (GDestroyNotify) g_hash_table_unref);
+
+  for (i = 0; refs[i] != NULL; i++)
+    {
+      struct stat stbuf;
+      g_autofree gchar *collection_and_ref = NULL;
+      g_autofree gchar *repo_dir_path = NULL;
+      g_autofree gchar *resolved_repo_uri = NULL;
+      g_autofree gchar *keyring = NULL;
+      g_autoptr(UriAndKeyring) resolved_repo = NULL;
+
+      collection_and_ref = g_build_filename (refs[i]->collection_id, refs[i]->ref_name, NULL);
+      repo_dir_path = g_build_filename (mount_root_path, ".ostree", "repos",
+                                        collection_and_ref, NULL);
+
+      if (!glnx_fstatat (repos_dfd, collection_and_ref, &stbuf, AT_NO_AUTOMOUNT, &local_error))
+        {
+          g_debug ("Ignoring ref (%s, %s) on mount ‘%s’ as querying info of ‘%s’ failed: %s",
+                   refs[i]->collection_id, refs[i]->ref_name, mount_name, repo_dir_path, local_error->message);
+          g_clear_error (&local_error);
+          continue;
         }
+
+      if ((stbuf.st_mode & S_IFMT) != S_IFDIR)
+        {
+          g_debug ("Ignoring ref (%s, %s) on mount ‘%s’ as ‘%s’ is of type %u, not a directory.",
+                   refs[i]->collection_id, refs[i]->ref_name, mount_name, repo_dir_path, (stbuf.st_mode & S_IFMT));
+          g_clear_error (&local_error);
+          continue;
+        }
+
+      /* Check the resolved repository path is below the mount point. Do not
+       * allow ref symlinks to point somewhere outside of the mounted
+       * volume. */
+      if (stbuf.st_dev != mount_root_stbuf.st_dev)
+        {
+          g_debug ("Ignoring ref (%s, %s) on mount ‘%s’ as it’s on a different file system from the mount.",
+                   refs[i]->collection_id, refs[i]->ref_name, mount_name);
+          g_clear_error (&local_error);
+          continue;
+        }
+
+      /* Exclude repositories which resolve to @parent_repo. */
+      g_autofree char *canonical_repo_dir_path = realpath (repo_dir_path, NULL);
+      g_autofree gchar *parent_repo_path = g_file_get_path (ostree_repo_get_path (parent_repo));
+      g_autofree char *canonical_parent_repo_path = realpath (parent_repo_path, NULL);
+
+      if (g_strcmp0 (canonical_repo_dir_path, canonical_parent_repo_path) == 0)
+        {
+          g_debug ("Ignoring ref (%s, %s) on mount ‘%s’ as its repository was the one we are resolving for: %s",
+                   refs[i]->collection_id, refs[i]->ref_name, mount_name, canonical_parent_repo_path);
+          g_clear_error (&local_error);
+          continue;
+        }
+
+      /* Grab the given ref and a checksum for it from the repo.
+       * FIXME: Ideally, there would be some ostree_repo_open_at() which we
+       * could use to keep the openat() chain going. See
+       * https://github.com/ostreedev/ostree/pull/820. */
+      g_autoptr(OstreeRepo) repo = NULL;
+      g_autoptr(GFile) repo_dir_file = g_file_new_for_path (repo_dir_path);
+      repo = ostree_repo_new (repo_dir_file);
+
+      if (!ostree_repo_open (repo, cancellable, &local_error))
+        {
+          g_debug ("Ignoring ref (%s, %s) on mount ‘%s’ as its repository could not be opened: %s",
+                   refs[i]->collection_id, refs[i]->ref_name, mount_name, local_error->message);
+          g_clear_error (&local_error);
+          continue;
+        }
+
+      g_autoptr(GHashTable) repo_refs = NULL;  /* (element-type OstreeCollectionRef utf8) */
+
+      if (!ostree_repo_list_collection_refs (repo, refs[i]->collection_id, &repo_refs, cancellable, &local_error))
+        {
+          g_debug ("Ignoring ref (%s, %s) on mount ‘%s’ as its refs could not be listed: %s",
+                   refs[i]->collection_id, refs[i]->ref_name, mount_name, local_error->message);
+          g_clear_error (&local_error);
+          continue;
+        }
+
+      const gchar *checksum = g_hash_table_lookup (repo_refs, refs[i]);
+
+      if (checksum == NULL)
+        {
+          g_debug ("Ignoring ref (%s, %s) on mount ‘%s’ as its repository doesn’t contain the ref.",
+                   refs[i]->collection_id, refs[i]->ref_name, mount_name);
+          g_clear_error (&local_error);
+          continue;
+        }
+
+      /* Finally, look up the GPG keyring for this ref. */
+      keyring = ostree_repo_resolve_keyring_for_collection (parent_repo, refs[i]->collection_id,
+                                                            cancellable, &local_error);
+
+      if (keyring == NULL)
+        {
+          g_debug ("Ignoring ref (%s, %s) on mount ‘%s’ due to missing keyring: %s",
+                   refs[i]->collection_id, refs[i]->ref_name, mount_name, local_error->message);
+          g_clear_error (&local_error);
+          continue;
+        }
+
+      /* There is a valid repo at (or pointed to by)
+       * $mount_root/.ostree/repos/$refs[i]->collection_id/$refs[i]->ref_name.
+       * Add it to the results, keyed by the canonicalised repository URI
+       * to deduplicate the results. */
+      resolved_repo_uri = g_strconcat ("file://", canonical_repo_dir_path, NULL);
+      g_debug ("Resolved ref (%s, %s) on mount ‘%s’ to repo URI ‘%s’ with keyring ‘%s’.",
+               refs[i]->collection_id, refs[i]->ref_name, mount_name, resolved_repo_uri, keyring);
+
+      resolved_repo = uri_and_keyring_new (resolved_repo_uri, keyring);
+
+      supported_ref_to_checksum = g_hash_table_lookup (repo_to_refs, resolved_repo);
+
+      if (supported_ref_to_checksum == NULL)
+        {
+          /* The keys are copies, since the results may outlive the refs
+           * array the scan was started with. */
+          supported_ref_to_checksum = g_hash_table_new_full (ostree_collection_ref_hash,
+                                                             ostree_collection_ref_equal,
+                                                             (GDestroyNotify) ostree_collection_ref_free, g_free);
+          g_hash_table_insert (repo_to_refs, g_steal_pointer (&resolved_repo), supported_ref_to_checksum  /* transfer */);
+        }
+
+      g_hash_table_insert (supported_ref_to_checksum, ostree_collection_ref_dup (refs[i]), g_strdup (checksum));
+    }
+
+  emit_results_for_repos (finder, repo_to_refs, results);
+}
+
+/* How long to wait for the slowest mount before returning whatever has been
+ * found so far.  Since the mounts are scanned concurrently this bounds the
+ * whole resolve operation, rather than accumulating per mount. */
+#define SCAN_TIMEOUT_SECONDS 10
+
+/* Shared state for the per-mount scan workers.  The coordinator waits on
+ * @cond until @n_pending drops to zero or the deadline passes; in the latter
+ * case it sets @abandoned, steals @results, and any stragglers (a dead USB
+ * stick, a spun-down optical drive) drop their results when they eventually
+ * finish. */
+typedef struct
+{
+  volatile gint ref_count;
+
+  OstreeRepoFinder *finder;  /* (owned) */
+  OstreeCollectionRef **refs;  /* (owned) */
+  OstreeRepo *parent_repo;  /* (owned) */
+  GCancellable *cancellable;  /* (owned) */
+
+  GMutex lock;
+  GCond cond;
+  guint n_pending;  /* (locked) */
+  gboolean abandoned;  /* (locked) */
+  GPtrArray *results;  /* (locked) (owned) (element-type OstreeRepoFinderResult) */
+} ScanState;
+
+static ScanState *
+scan_state_ref (ScanState *state)
+{
+  g_atomic_int_inc (&state->ref_count);
+  return state;
+}
+
+static void
+scan_state_unref (ScanState *state)
+{
+  if (!g_atomic_int_dec_and_test (&state->ref_count))
+    return;
+
+  g_clear_object (&state->finder);
+  g_clear_pointer (&state->refs, ostree_collection_ref_freev);
+  g_clear_object (&state->parent_repo);
+  g_clear_object (&state->cancellable);
+  g_mutex_clear (&state->lock);
+  g_cond_clear (&state->cond);
+  g_clear_pointer (&state->results, g_ptr_array_unref);
+  g_free (state);
+}
+
+static void
+scan_mount_worker (gpointer data,
+                   gpointer user_data)
+{
+  g_autoptr(GMount) mount = G_MOUNT (data);
+  ScanState *state = user_data;
+  g_autoptr(GPtrArray) mount_results = g_ptr_array_new_with_free_func ((GDestroyNotify) ostree_repo_finder_result_free);
+  gsize i;
+
+  scan_one_mount (state->finder, mount,
+                  (const OstreeCollectionRef * const *) state->refs,
+                  state->parent_repo, mount_results, state->cancellable);
+
+  g_mutex_lock (&state->lock);
+
+  if (!state->abandoned)
+    {
+      for (i = 0; i < mount_results->len; i++)
+        g_ptr_array_add (state->results, g_ptr_array_index (mount_results, i));
+      g_ptr_array_set_free_func (mount_results, NULL);
+    }
+
+  state->n_pending--;
+  g_cond_signal (&state->cond);
+  g_mutex_unlock (&state->lock);
+
+  scan_state_unref (state);
+}
+
+static void
+propagate_cancelled_cb (GCancellable *cancellable,
+                        gpointer      user_data)
+{
+  g_cancellable_cancel (G_CANCELLABLE (user_data));
+}
+
+static void
+ostree_repo_finder_mount_resolve_async (OstreeRepoFinder                  *finder,
+                                        const OstreeCollectionRef * const *refs,
+                                        OstreeRepo                        *parent_repo,
+                                        GCancellable                      *cancellable,
+                                        GAsyncReadyCallback                callback,
+                                        gpointer                           user_data)
+{
+  OstreeRepoFinderMount *self = OSTREE_REPO_FINDER_MOUNT (finder);
+  g_autoptr(GTask) task = NULL;
+  g_autoptr(ObjectList) mounts = NULL;
+  g_autoptr(GPtrArray) results = NULL;  /* (element-type OstreeRepoFinderResult) */
+  GList *l;
+  guint n_mounts;
+  ScanState *state;
+  GThreadPool *pool;
+  gulong cancelled_id = 0;
+  gint64 deadline;
+  g_autoptr(GError) local_error = NULL;
+
+  task = g_task_new (finder, cancellable, callback, user_data);
+  g_task_set_source_tag (task, ostree_repo_finder_mount_resolve_async);
+
+  mounts = g_volume_monitor_get_mounts (self->monitor);
+  n_mounts = g_list_length (mounts);
+
+  g_debug ("%s: Found %u mounts", G_STRFUNC, n_mounts);
+
+  if (n_mounts == 0)
+    {
+      results = g_ptr_array_new_with_free_func ((GDestroyNotify) ostree_repo_finder_result_free);
+      g_task_return_pointer (task, g_steal_pointer (&results), (GDestroyNotify) g_ptr_array_unref);
+      return;
     }
 
+  /* The workers take their own references to everything they touch, since
+   * they may outlive this call if a slow mount is abandoned at the
+   * deadline. */
+  state = g_new0 (ScanState, 1);
+  state->ref_count = 1;
+  state->finder = g_object_ref (finder);
+  state->refs = ostree_collection_ref_dupv (refs);
+  state->parent_repo = g_object_ref (parent_repo);
+  state->cancellable = g_cancellable_new ();
+  g_mutex_init (&state->lock);
+  g_cond_init (&state->cond);
+  state->n_pending = n_mounts;
+  state->results = g_ptr_array_new_with_free_func ((GDestroyNotify) ostree_repo_finder_result_free);
+
+  pool = g_thread_pool_new (scan_mount_worker, state,
+                            MIN (n_mounts, g_get_num_processors ()), FALSE,
+                            &local_error);
+
+  if (pool == NULL)
+    {
+      /* Fall back to scanning serially on this thread. */
+      g_debug ("%s: Failed to create scan thread pool, scanning serially: %s",
+               G_STRFUNC, local_error->message);
+
+      for (l = mounts; l != NULL; l = l->next)
+        scan_one_mount (finder, G_MOUNT (l->data),
+                        (const OstreeCollectionRef * const *) state->refs,
+                        parent_repo, state->results, cancellable);
+
+      results = g_steal_pointer (&state->results);
+      scan_state_unref (state);
+
+      g_ptr_array_sort (results, results_compare_cb);
+      g_task_return_pointer (task, g_steal_pointer (&results), (GDestroyNotify) g_ptr_array_unref);
+      return;
+    }
+
+  if (cancellable != NULL)
+    cancelled_id = g_cancellable_connect (cancellable,
+                                          G_CALLBACK (propagate_cancelled_cb),
+                                          g_object_ref (state->cancellable),
+                                          g_object_unref);
+
+  /* One reference per worker invocation (dropped as each worker finishes);
+   * the coordinator keeps its own. */
+  {
+    guint i;
+    for (i = 0; i < n_mounts; i++)
+      scan_state_ref (state);
+  }
+
+  for (l = mounts; l != NULL; l = l->next)
+    g_thread_pool_push (pool, g_object_ref (G_MOUNT (l->data)),
+                        NULL);  /* pushing to a non-exclusive pool can’t fail */
+
+  deadline = g_get_monotonic_time () + SCAN_TIMEOUT_SECONDS * G_TIME_SPAN_SECOND;
+
+  g_mutex_lock (&state->lock);
+
+  while (state->n_pending > 0)
+    {
+      if (!g_cond_wait_until (&state->cond, &state->lock, deadline))
+        {
+          g_debug ("%s: Abandoning %u unfinished mount scans at the deadline",
+                   G_STRFUNC, state->n_pending);
+          state->abandoned = TRUE;
+          g_cancellable_cancel (state->cancellable);
+          break;
+        }
+    }
+
+  results = g_steal_pointer (&state->results);
+  g_mutex_unlock (&state->lock);
+
+  if (cancelled_id != 0)
+    g_cancellable_disconnect (cancellable, cancelled_id);
+
+  /* Queued-but-unstarted scans still run (and drop their results, as
+   * @abandoned is set); don’t wait for them here. */
+  g_thread_pool_free (pool, FALSE, FALSE);
+  scan_state_unref (state);
+
   g_ptr_array_sort (results, results_compare_cb);
 
   g_task_return_pointer (task, g_steal_pointer (&results), (GDestroyNotify) g_ptr_array_unref);
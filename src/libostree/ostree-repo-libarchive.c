@@ -22,10 +22,13 @@
 
 #include "config.h"
 
+#include <gio/gunixinputstream.h>
+
 #include "otutil.h"
 #include "ostree.h"
 #include "ostree-core-private.h"
 #include "ostree-repo-private.h"
+#include "ostree-chain-input-stream.h"
 
 #ifdef HAVE_LIBARCHIVE
 #include <archive.h>
@@ -234,6 +237,15 @@ typedef struct {
   struct archive_entry           *entry;
   GHashTable                     *deferred_hardlinks;
   OstreeRepoCommitModifier       *modifier;
+  /* Serialized file headers keyed by uid:gid:mode:symlink-target; large
+   * archives contain millions of entries sharing a handful of headers.
+   */
+  GHashTable                     *file_header_cache;
+  /* Most archives order entries by directory; remember the last parent
+   * so consecutive entries skip the mtree walk.
+   */
+  char                           *last_parent_dirname;
+  OstreeMutableTree              *last_parent;
 } OstreeRepoArchiveImportContext;
 
 typedef struct {
@@ -396,6 +408,16 @@ aic_create_parent_dirs (OstreeRepoArchiveImportContext *ctx,
   return TRUE;
 }
 
+static void
+aic_cache_parent_dir (OstreeRepoArchiveImportContext *ctx,
+                      const char         *dirname,
+                      OstreeMutableTree  *dir)
+{
+  g_free (ctx->last_parent_dirname);
+  ctx->last_parent_dirname = g_strdup (dirname);
+  g_set_object (&ctx->last_parent, dir);
+}
+
 static gboolean
 aic_get_parent_dir (OstreeRepoArchiveImportContext *ctx,
                     const char          *path,
@@ -403,7 +425,16 @@ aic_get_parent_dir (OstreeRepoArchiveImportContext *ctx,
                     GCancellable        *cancellable,
                     GError             **error)
 {
+  g_autofree char *dirname = g_path_get_dirname (path);
   g_autoptr(GPtrArray) components = NULL;
+
+  if (ctx->last_parent_dirname != NULL &&
+      strcmp (dirname, ctx->last_parent_dirname) == 0)
+    {
+      *out_dir = g_object_ref (ctx->last_parent);
+      return TRUE;
+    }
+
   if (!ot_util_path_split_validate (path, &components, error))
     return FALSE;
 
@@ -414,7 +445,10 @@ aic_get_parent_dir (OstreeRepoArchiveImportContext *ctx,
     }
 
   if (ostree_mutable_tree_walk (ctx->root, components, 0, out_dir, error))
-    return TRUE; /* already exists, nice! */
+    {
+      aic_cache_parent_dir (ctx, dirname, *out_dir);
+      return TRUE; /* already exists, nice! */
+    }
 
   if (!g_error_matches (*error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
     return FALSE; /* some other error occurred */
@@ -422,8 +456,11 @@ aic_get_parent_dir (OstreeRepoArchiveImportContext *ctx,
   if (ctx->opts->autocreate_parents)
     {
       g_clear_error (error);
-      return aic_create_parent_dirs (ctx, components, out_dir,
-                                     cancellable, error);
+      if (!aic_create_parent_dirs (ctx, components, out_dir,
+                                   cancellable, error))
+        return FALSE;
+      aic_cache_parent_dir (ctx, dirname, *out_dir);
+      return TRUE;
     }
 
   return FALSE;
@@ -508,9 +545,51 @@ aic_write_file (OstreeRepoArchiveImportContext *ctx,
   if (g_file_info_get_file_type (fi) == G_FILE_TYPE_REGULAR)
     archive_stream = _ostree_libarchive_input_stream_new (ctx->archive);
 
-  if (!ostree_raw_file_to_content_stream (archive_stream, fi, xattrs,
-                                          &file_object_input, &length,
-                                          cancellable, error))
+  if (xattrs == NULL || g_variant_n_children (xattrs) == 0)
+    {
+      /* Fast path: reuse the serialized file header across entries;
+       * without xattrs it only depends on ownership, mode and symlink
+       * target, which repeat constantly in large archives.
+       */
+      guint32 uid = g_file_info_get_attribute_uint32 (fi, "unix::uid");
+      guint32 gid = g_file_info_get_attribute_uint32 (fi, "unix::gid");
+      guint32 mode = g_file_info_get_attribute_uint32 (fi, "unix::mode");
+      const char *symlink_target = "";
+      GBytes *header_bytes;
+
+      if (g_file_info_get_file_type (fi) == G_FILE_TYPE_SYMBOLIC_LINK)
+        symlink_target = g_file_info_get_symlink_target (fi);
+
+      g_autofree char *header_key =
+        g_strdup_printf ("%u:%u:%u:%s", uid, gid, mode, symlink_target);
+      header_bytes = g_hash_table_lookup (ctx->file_header_cache, header_key);
+      if (header_bytes == NULL)
+        {
+          g_autoptr(GVariant) file_header = _ostree_file_header_new (fi, xattrs);
+          header_bytes = _ostree_file_header_to_bytes (file_header, error);
+          if (header_bytes == NULL)
+            return FALSE;
+          g_hash_table_insert (ctx->file_header_cache,
+                               g_steal_pointer (&header_key), header_bytes);
+        }
+
+      g_autoptr(GInputStream) header_in = g_memory_input_stream_new_from_bytes (header_bytes);
+      if (archive_stream != NULL)
+        {
+          g_autoptr(GPtrArray) streams =
+            g_ptr_array_new_with_free_func ((GDestroyNotify)g_object_unref);
+          g_ptr_array_add (streams, g_object_ref (header_in));
+          g_ptr_array_add (streams, g_object_ref (archive_stream));
+          file_object_input = (GInputStream*)ostree_chain_input_stream_new (streams);
+        }
+      else
+        file_object_input = g_steal_pointer (&header_in);
+
+      length = g_bytes_get_size (header_bytes) + g_file_info_get_size (fi);
+    }
+  else if (!ostree_raw_file_to_content_stream (archive_stream, fi, xattrs,
+                                               &file_object_input, &length,
+                                               cancellable, error))
     return FALSE;
 
   if (!ostree_repo_write_content (ctx->repo, NULL, file_object_input, length,
@@ -817,6 +896,9 @@ ostree_repo_import_archive_to_mtree (OstreeRepo                   *self,
   g_autoptr(GHashTable) deferred_hardlinks =
     g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
                            deferred_hardlinks_list_free);
+  g_autoptr(GHashTable) file_header_cache =
+    g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                           (GDestroyNotify)g_bytes_unref);
 
   OstreeRepoArchiveImportContext aictx = {
     .repo = self,
@@ -824,7 +906,8 @@ ostree_repo_import_archive_to_mtree (OstreeRepo                   *self,
     .root = mtree,
     .archive = archive,
     .deferred_hardlinks = deferred_hardlinks,
-    .modifier = modifier
+    .modifier = modifier,
+    .file_header_cache = file_header_cache,
   };
 
   while (TRUE)
@@ -868,6 +951,8 @@ ostree_repo_import_archive_to_mtree (OstreeRepo                   *self,
 
   ret = TRUE;
  out:
+  g_free (aictx.last_parent_dirname);
+  g_clear_object (&aictx.last_parent);
   return ret;
 #else
   g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
@@ -1024,6 +1109,175 @@ write_header_free_entry (struct archive *a,
   return ret;
 }
 
+/* Copy the content object @checksum into @a.  The entry header is written
+ * here too, since the fast path learns the object size from the loose file
+ * itself.  In bare-type repos we map the loose object and hand the whole
+ * buffer to libarchive in one call, rather than copying through a small
+ * intermediate buffer; the kernel's readahead then overlaps the object
+ * reads with the archive writes.
+ *
+ * With OstreeRepoExportArchiveOptions.zlib_payloads set on an archive-z2
+ * repo, the entry content is the object's stored zlib stream spliced in
+ * as-is.  A loose .filez object is a big-endian guint32 header length,
+ * four bytes of padding, the file header variant, then the zlib stream;
+ * everything past the header is the payload.
+ */
+static gboolean
+write_file_content_to_archive (OstreeRepo           *self,
+                               OstreeRepoExportArchiveOptions *opts,
+                               struct archive       *a,
+                               struct archive_entry *entry,
+                               const char           *checksum,
+                               GCancellable         *cancellable,
+                               GError              **error)
+{
+  gboolean ret = FALSE;
+  g_autoptr(GInputStream) file_in = NULL;
+  g_autoptr(GMappedFile) mfile = NULL;
+  glnx_fd_close int fd = -1;
+  guint64 payload_offset = 0;
+  guint64 size;
+
+  if (opts->zlib_payloads && ostree_repo_get_mode (self) == OSTREE_REPO_MODE_ARCHIVE_Z2)
+    {
+      char loose_path_buf[_OSTREE_LOOSE_PATH_MAX];
+      struct stat stbuf;
+      guint32 archive_header_size;
+      ssize_t bytes_read;
+
+      _ostree_loose_path (loose_path_buf, checksum, OSTREE_OBJECT_TYPE_FILE, self->mode);
+      if (!ot_openat_ignore_enoent (self->objects_dir_fd, loose_path_buf, &fd, error))
+        goto out;
+      if (fd < 0 && self->commit_stagedir_fd != -1)
+        {
+          if (!ot_openat_ignore_enoent (self->commit_stagedir_fd, loose_path_buf, &fd, error))
+            goto out;
+        }
+      if (fd < 0)
+        {
+          /* Objects satisfied from a content pack or parent repo have no
+           * loose file to splice; failing hard keeps the payload framing
+           * consistent for every entry in the archive.
+           */
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                       "No loose object for %s; cannot splice compressed payload",
+                       checksum);
+          goto out;
+        }
+
+      if (!glnx_fstat (fd, &stbuf, error))
+        goto out;
+
+      bytes_read = TEMP_FAILURE_RETRY (pread (fd, &archive_header_size, 4, 0));
+      if (bytes_read < 0)
+        {
+          glnx_set_error_from_errno (error);
+          goto out;
+        }
+      archive_header_size = GUINT32_FROM_BE (archive_header_size);
+      payload_offset = 8 + (guint64)archive_header_size;
+      if (bytes_read != 4 || payload_offset > (guint64)stbuf.st_size)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Corrupted object %s.filez; invalid file header", checksum);
+          goto out;
+        }
+      size = stbuf.st_size - payload_offset;
+
+      mfile = g_mapped_file_new_from_fd (fd, FALSE, NULL);
+      if (mfile == NULL)
+        {
+          if (lseek (fd, payload_offset, SEEK_SET) < 0)
+            {
+              glnx_set_error_from_errno (error);
+              goto out;
+            }
+          file_in = g_unix_input_stream_new (glnx_steal_fd (&fd), TRUE);
+        }
+    }
+  else if (_ostree_repo_mode_is_bare (ostree_repo_get_mode (self)))
+    {
+      struct stat stbuf;
+      if (!_ostree_repo_load_file_bare (self, checksum, &fd, &stbuf, NULL, NULL,
+                                        cancellable, error))
+        goto out;
+      size = stbuf.st_size;
+      if (size > 0)
+        {
+          mfile = g_mapped_file_new_from_fd (fd, FALSE, NULL);
+          /* Fall back to streaming reads if the map failed */
+          if (mfile == NULL)
+            file_in = g_unix_input_stream_new (glnx_steal_fd (&fd), TRUE);
+        }
+    }
+  else
+    {
+      g_autoptr(GFileInfo) file_info = NULL;
+      if (!ostree_repo_load_file (self, checksum, &file_in, &file_info, NULL,
+                                  cancellable, error))
+        goto out;
+      size = g_file_info_get_size (file_info);
+    }
+
+  archive_entry_set_size (entry, size);
+
+  if (archive_write_header (a, entry) != ARCHIVE_OK)
+    {
+      propagate_libarchive_error (error, a);
+      goto out;
+    }
+
+  if (mfile != NULL)
+    {
+      const char *map = g_mapped_file_get_contents (mfile) + payload_offset;
+      const gsize len = g_mapped_file_get_length (mfile) - payload_offset;
+      ssize_t r = archive_write_data (a, map, len);
+      if (r < 0 || (gsize)r != len)
+        {
+          propagate_libarchive_error (error, a);
+          g_prefix_error (error, "Failed to write %" G_GUINT64_FORMAT " bytes (code %" G_GUINT64_FORMAT "): ", (guint64)len, (guint64)r);
+          goto out;
+        }
+    }
+  else if (file_in != NULL)
+    {
+      /* The archive-z2 (and fallback) path; a larger buffer here overlaps
+       * decompression with the archive writes.
+       */
+      const gsize bufsize = 128 * 1024;
+      g_autofree guint8 *buf = g_malloc (bufsize);
+
+      while (TRUE)
+        {
+          gssize bytes_read = g_input_stream_read (file_in, buf, bufsize,
+                                                   cancellable, error);
+          if (bytes_read < 0)
+            goto out;
+          if (bytes_read == 0)
+            break;
+
+          { ssize_t r = archive_write_data (a, buf, bytes_read);
+            if (r != bytes_read)
+              {
+                propagate_libarchive_error (error, a);
+                g_prefix_error (error, "Failed to write %" G_GUINT64_FORMAT " bytes (code %" G_GUINT64_FORMAT"): ", (guint64)bytes_read, (guint64)r);
+                goto out;
+              }
+          }
+        }
+    }
+
+  if (archive_write_finish_entry (a) != ARCHIVE_OK)
+    {
+      propagate_libarchive_error (error, a);
+      goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
 static gboolean
 write_directory_to_libarchive_recurse (OstreeRepo               *self,
                                        OstreeRepoExportArchiveOptions *opts,
@@ -1095,50 +1349,12 @@ write_directory_to_libarchive_recurse (OstreeRepo               *self,
           break;
         case G_FILE_TYPE_REGULAR:
           {
-            guint8 buf[8192];
-            g_autoptr(GInputStream) file_in = NULL;
-            g_autoptr(GFileInfo) file_info = NULL;
-            const char *checksum;
-
-            checksum = ostree_repo_file_get_checksum ((OstreeRepoFile*)path);
+            const char *checksum = ostree_repo_file_get_checksum ((OstreeRepoFile*)path);
 
-            if (!ostree_repo_load_file (self, checksum, &file_in, &file_info, NULL,
-                                        cancellable, error))
+            if (!write_file_content_to_archive (self, opts, a, entry, checksum,
+                                                cancellable, error))
               goto out;
 
-            archive_entry_set_size (entry, g_file_info_get_size (file_info));
-
-            if (archive_write_header (a, entry) != ARCHIVE_OK)
-              {
-                propagate_libarchive_error (error, a);
-                goto out;
-              }
-
-            while (TRUE)
-              {
-                gssize bytes_read = g_input_stream_read (file_in, buf, sizeof (buf),
-                                                         cancellable, error);
-                if (bytes_read < 0)
-                  goto out;
-                if (bytes_read == 0)
-                  break;
-
-                { ssize_t r = archive_write_data (a, buf, bytes_read);
-                  if (r != bytes_read)
-                    {
-                      propagate_libarchive_error (error, a);
-                      g_prefix_error (error, "Failed to write %" G_GUINT64_FORMAT " bytes (code %" G_GUINT64_FORMAT"): ", (guint64)bytes_read, (guint64)r);
-                      goto out;
-                    }
-                }
-              }
-
-            if (archive_write_finish_entry (a) != ARCHIVE_OK)
-              {
-                propagate_libarchive_error (error, a);
-                goto out;
-              }
-
             archive_entry_free (entry);
             entry = NULL;
           }
@@ -33,10 +33,32 @@ G_BEGIN_DECLS
 #define _OSTREE_OBJECT_SIZES_ENTRY_SIGNATURE "ay"
 
 #define _OSTREE_SUMMARY_CACHE_DIR "summaries"
+#define _OSTREE_DELTA_CACHE_DIR "delta-superblocks"
+
+/* Combined summary + signature artifact, so clients can poll a signed
+ * repository with a single conditional GET instead of sequential
+ * summary.sig and summary fetches.  An a{sv} with the keys below, each
+ * holding the raw bytes of the corresponding file.
+ */
+#define _OSTREE_SUMMARY_SIGNED_PATH "summary.signed"
+#define _OSTREE_SUMMARY_SIGNED_KEY_SUMMARY "ostree.summary"
+#define _OSTREE_SUMMARY_SIGNED_KEY_SIG "ostree.summary.sig"
+#define _OSTREE_COMMIT_VERIFY_CACHE_DIR "commit-verifies"
+#define _OSTREE_ROLLSUM_CACHE_DIR "rollsum-chunks"
 #define _OSTREE_CACHE_DIR "cache"
 
 #define _OSTREE_MAX_OUTSTANDING_FETCHER_REQUESTS 8
+/* Ceiling for the adaptive request window; it starts at
+ * _OSTREE_MAX_OUTSTANDING_FETCHER_REQUESTS and only grows while measured
+ * request latency stays flat, so this is reached on fat links only.
+ */
+#define _OSTREE_ADAPTIVE_MAX_OUTSTANDING_FETCHER_REQUESTS 64
 #define _OSTREE_MAX_OUTSTANDING_DELTAPART_REQUESTS 2
+/* How many of the request slots are held back from content and delta part
+ * fetches so newly discovered metadata (which unlocks further scanning) is
+ * never head-of-line blocked behind large objects.
+ */
+#define _OSTREE_RESERVED_METADATA_FETCHER_REQUESTS 2
 
 /* In most cases, writing to disk should be much faster than
  * fetching from the network, so we shouldn't actually hit
@@ -52,6 +74,36 @@ G_BEGIN_DECLS
 #define OSTREE_SUMMARY_COLLECTION_ID "ostree.summary.collection-id"
 #define OSTREE_SUMMARY_COLLECTION_MAP "ostree.summary.collection-map"
 
+/* A bloom filter over all ref names in the summary (both the main refs
+ * section and the collection map), of type (yyay): k, hash function id
+ * (1 = ostree_str_bloom_hash), filter bytes.  Lets clients answer "is
+ * this ref definitely absent?" without paging in or searching the ref
+ * arrays.  Same encoding as the DNS-SD record bloom in
+ * ostree-repo-finder-avahi.c.
+ */
+#define OSTREE_SUMMARY_REF_BLOOM "ostree.summary.ref-bloom"
+#define OSTREE_SUMMARY_REF_BLOOM_HASH_ID 1
+
+/* Sharded summaries (core.summary-shard-prefixes): the main refs array
+ * may be partitioned by ref prefix into standalone summary-format
+ * files named `summary.shard.<prefix>` ('/' mangled to '_') next to
+ * the summary.  The root summary advertises them under this key as an
+ * `a(say)` of (prefix, SHA256 of the shard file), so a client which
+ * trusts the (possibly signed) root summary can verify each shard it
+ * chooses to fetch.
+ */
+#define OSTREE_SUMMARY_SHARDS "ostree.summary.shards"
+
+static inline char *
+_ostree_summary_shard_filename (const char *prefix)
+{
+  char *ret = g_strconcat ("summary.shard.", prefix, NULL);
+  for (char *p = ret; *p; p++)
+    if (*p == '/')
+      *p = '_';
+  return ret;
+}
+
 /* Well-known keys for the additional metadata field in a commit in a ref entry
  * in a summary file. */
 #define OSTREE_COMMIT_TIMESTAMP "ostree.commit.timestamp"
@@ -74,6 +126,12 @@ struct OstreeRepoCommitModifier {
 
   OstreeSePolicy *sepolicy;
   GHashTable *devino_cache;
+
+  /* Transient per-walk worker pool, only non-NULL inside
+   * ostree_repo_write_{dfd,directory}_to_mtree() when
+   * OSTREE_REPO_COMMIT_MODIFIER_FLAGS_PARALLEL_WRITES is set.
+   */
+  gpointer parallel_commit_state;
 };
 
 typedef enum {
@@ -95,6 +153,13 @@ struct OstreeRepo {
   int commit_stagedir_fd;
   char *commit_stagedir_name;
   GLnxLockFile commit_stagedir_lock;
+  /* Append-only journal of loose object paths staged into
+   * commit_stagedir, mirrored by the txn_staged_objects set so that
+   * dedup probes and transaction resume never need to enumerate or
+   * stat the staging directory.  Both protected by txn_stats_lock.
+   */
+  int commit_stagedir_journal_fd;
+  GHashTable *txn_staged_objects; /* Set<loose path> */
 
   GFile *repodir;
   int    repo_dir_fd;
@@ -102,6 +167,10 @@ struct OstreeRepo {
   int    cache_dir_fd;
   char  *cache_dir;
   int objects_dir_fd;
+  /* Lazily-opened dirfds for the 256 objects/XX fanout directories,
+   * -1 when not yet opened; populated atomically, see
+   * _ostree_repo_fanout_dfd().  Owned by the repo, closed in finalize. */
+  int objects_fanout_dfds[256];
   int uncompressed_objects_dir_fd;
   GFile *sysroot_dir;
   GWeakRef sysroot; /* Weak to avoid a circular ref; see also `is_system` */
@@ -109,6 +178,23 @@ struct OstreeRepo {
 
   GHashTable *txn_refs;  /* (element-type utf8 utf8) */
   GHashTable *txn_collection_refs;  /* (element-type OstreeCollectionRef utf8) */
+  /* GBytes serialized variant → char * checksum; per-transaction dedup of
+   * repeated dirmeta/dirtree writes, see write_metadata_object() */
+  GHashTable *txn_metadata_cache;
+  /* Set<char* checksum> of commit objects written this transaction,
+   * merged into state/commit-graph at commit time; protected by
+   * txn_stats_lock */
+  GHashTable *txn_written_commits;
+  /* char *object name → char *hex digest; SHA512 digests of objects
+   * written this transaction, merged into the cache-dir sha512-index at
+   * commit time.  Only non-%NULL with core.extra-checksum-algos=sha512;
+   * protected by txn_stats_lock */
+  GHashTable *txn_sha512_index;
+  /* char *object name → char *"%08x" CRC32C of the loose file bytes as
+   * stored, merged into the cache-dir crc32c-index at commit time.
+   * Only non-%NULL with core.crc32c-index=true; protected by
+   * txn_stats_lock */
+  GHashTable *txn_crc32c_index;
   GMutex txn_stats_lock;
   OstreeRepoTransactionStats txn_stats;
   /* Implementation of min-free-space-percent */
@@ -117,8 +203,31 @@ struct OstreeRepo {
 
   GMutex cache_lock;
   guint dirmeta_cache_refcount;
-  /* char * checksum → GVariant * for dirmeta objects, used in the checkout path */
-  GHashTable *dirmeta_cache;
+  /* char * "objtype.checksum" → MetaCacheEntry for dirmeta/dirtree objects;
+   * LRU-bounded, see load_metadata_internal() */
+  GHashTable *meta_cache;
+  GQueue meta_cache_lru;
+  guint64 meta_cache_hits;
+  guint64 meta_cache_misses;
+  /* char * checksum → SmallContentCacheEntry for tiny content objects;
+   * LRU-bounded, used by checkout's copy path */
+  GHashTable *small_content_cache;
+  GQueue small_content_cache_lru;
+  guint64 small_content_cache_hits;
+  guint64 small_content_cache_misses;
+  /* char * checksum → ParsedDirmeta; a rootfs has only a handful of
+   * distinct dirmetas, see load_parsed_dirmeta() in ostree-repo-checkout.c */
+  GHashTable *dirmeta_parse_cache;
+
+  GMutex interned_checksums_lock;
+  /* Deduplicated hex checksum strings, live for the lifetime of the
+   * repo; see _ostree_repo_intern_checksum() */
+  GStringChunk *interned_checksums;
+
+  /* Ref watch state, see ostree_repo_watch_refs() */
+  GPtrArray *ref_monitors; /* (element-type GFileMonitor) */
+  GMainContext *ref_monitor_context;
+  GSource *refs_changed_source;
 
   gboolean inited;
   gboolean writable;
@@ -128,6 +237,24 @@ struct OstreeRepo {
   gboolean disable_fsync;
   gboolean disable_xattrs;
   guint zlib_compression_level;
+  gboolean enable_commit_stat_cache;
+  /* char *relpath → CommitStatCacheEntry, see ostree-repo-commit.c */
+  GHashTable *commit_stat_cache;
+  /* Lazily mapped refs/packed, see ostree-repo-refs.c */
+  GVariant *packed_refs;
+  gboolean packed_refs_checked;
+  /* Lazily mapped state/commit-graph, see ostree-repo.c */
+  GVariant *commit_graph;
+  gboolean commit_graph_checked;
+  /* Lazily mapped objects/pack content packs, see ostree-repo.c */
+  GPtrArray *content_packs;
+  gboolean content_packs_checked;
+  /* root dirtree checksum → mapped state/path-index variant, see
+   * ostree-repo.c; built on demand */
+  GHashTable *path_indexes;
+  /* fetcher config key → CachedFetcher from a completed pull, see
+   * ostree-repo-pull.c; reused across pulls to keep connections warm */
+  GHashTable *remote_fetchers;
   GHashTable *loose_object_devino_hash;
   GHashTable *updated_uncompressed_dirs;
   GHashTable *object_sizes;
@@ -136,19 +263,49 @@ struct OstreeRepo {
   uid_t target_owner_uid;
   gid_t target_owner_gid;
   guint min_free_space_percent;
+  /* Implementation of core.auto-prune-watermark-percent: when free
+   * space drops below the watermark at transaction start, a background
+   * refs-only prune of depth auto_prune_depth is kicked off.  0 disables.
+   */
+  guint auto_prune_watermark_percent;
+  gint auto_prune_depth;
+  gint auto_prune_running;  /* atomic; nonzero while a background prune runs */
+  /* Implementation of core.extra-checksum-algos */
+  gboolean record_sha512;
+  /* Implementation of core.crc32c-index */
+  gboolean record_crc32c;
 
   guint test_error_flags; /* OstreeRepoTestErrorFlags */
 
   GKeyFile *config;
   GHashTable *remotes;
+  /* Whether remotes.d has been enumerated into @remotes yet; deferred
+   * to the first remote lookup, see ensure_remotes_d_loaded().
+   */
+  gboolean remotes_d_loaded;
   GMutex remotes_lock;
+  /* remote name → OstreeGpgVerifier with its keyring home dir already
+   * assembled; invalidated when the remote's keys change */
+  GHashTable *remote_verifiers;
   OstreeRepoMode mode;
   gboolean enable_uncompressed_cache;
+  guint64 uncompressed_cache_max_size_bytes; /* 0 = unbounded */
+  guint64 summary_inline_delta_max_bytes; /* 0 = disabled */
+  char **summary_shard_prefixes; /* NULL or empty = disabled */
+  guint64 pack_small_objects_max_bytes; /* 0 = disabled */
   gboolean generate_sizes;
   guint64 tmp_expiry_seconds;
   gchar *collection_id;
 
   OstreeRepo *parent_repo;
+  /* Ordered chain of additional fallback object stores from the
+   * "core.alternates" config key; consulted after parent_repo.  The
+   * parallel array holds a lazily built per-alternate bloom filter over
+   * its object names (entries are NULL until first use), see
+   * alternate_repo_get_bloom() in ostree-repo.c.
+   */
+  GPtrArray *alternate_repos;
+  GPtrArray *alternate_blooms;
 };
 
 typedef struct {
@@ -175,6 +332,10 @@ void
 _ostree_repo_memory_cache_ref_destroy (OstreeRepoMemoryCacheRef *state);
 G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC(OstreeRepoMemoryCacheRef, _ostree_repo_memory_cache_ref_destroy)
 
+const char *
+_ostree_repo_intern_checksum (OstreeRepo *self,
+                              const char *checksum);
+
 #define OSTREE_REPO_TMPDIR_STAGING "staging-"
 #define OSTREE_REPO_TMPDIR_FETCHER "fetcher-"
 
@@ -224,6 +385,30 @@ _ostree_repo_has_loose_object (OstreeRepo           *self,
                                GCancellable         *cancellable,
                                GError             **error);
 
+int
+_ostree_repo_fanout_dfd (OstreeRepo           *self,
+                         const char           *loose_path);
+
+gboolean
+_ostree_repo_ensure_uncompressed_cache (OstreeRepo  *self,
+                                        GError     **error);
+
+/* Content objects up to this size are eligible for the in-memory
+ * small-content cache consulted by checkout's copy path. */
+#define _OSTREE_SMALL_CONTENT_CACHE_THRESHOLD 256
+
+gboolean
+_ostree_repo_small_content_cache_lookup (OstreeRepo  *self,
+                                         const char  *checksum,
+                                         GBytes     **out_content,
+                                         GVariant   **out_xattrs);
+
+void
+_ostree_repo_small_content_cache_insert (OstreeRepo  *self,
+                                         const char  *checksum,
+                                         GBytes      *content,
+                                         GVariant    *xattrs);
+
 gboolean
 _ostree_write_bareuser_metadata (int fd,
                                  guint32       uid,
@@ -240,6 +425,15 @@ _ostree_repo_write_directory_meta (OstreeRepo   *self,
                                    GCancellable *cancellable,
                                    GError      **error);
 gboolean
+_ostree_repo_write_overlay_upper_to_mtree (OstreeRepo                *self,
+                                           OstreeRepoFile            *base_dir,
+                                           int                        upper_dfd,
+                                           OstreeMutableTree         *mtree,
+                                           OstreeRepoCommitModifier  *modifier,
+                                           GCancellable              *cancellable,
+                                           GError                   **error);
+
+gboolean
 _ostree_repo_update_refs (OstreeRepo        *self,
                           GHashTable        *refs,
                           GCancellable      *cancellable,
@@ -251,6 +445,83 @@ _ostree_repo_update_collection_refs (OstreeRepo    *self,
                                      GCancellable  *cancellable,
                                      GError       **error);
 
+gboolean
+_ostree_repo_pack_refs (OstreeRepo    *self,
+                        GCancellable  *cancellable,
+                        GError       **error);
+
+gboolean
+_ostree_repo_regenerate_commit_graph (OstreeRepo    *self,
+                                      GCancellable  *cancellable,
+                                      GError       **error);
+
+gboolean
+_ostree_repo_commit_graph_merge (OstreeRepo    *self,
+                                 GHashTable    *commit_checksums,
+                                 GCancellable  *cancellable,
+                                 GError       **error);
+
+gboolean
+_ostree_repo_sha512_index_update (OstreeRepo    *self,
+                                  GHashTable    *new_entries,
+                                  GCancellable  *cancellable,
+                                  GError       **error);
+
+gboolean
+_ostree_repo_crc32c_index_update (OstreeRepo    *self,
+                                  GHashTable    *new_entries,
+                                  GCancellable  *cancellable,
+                                  GError       **error);
+
+gboolean
+_ostree_repo_crc32c_quick_check (OstreeRepo    *self,
+                                 guint         *out_n_verified,
+                                 GHashTable   **out_unverified,
+                                 GCancellable  *cancellable,
+                                 GError       **error);
+
+gboolean
+_ostree_repo_size_closure_ensure (OstreeRepo    *self,
+                                  const char    *checksum,
+                                  GVariant     **out_closure,
+                                  GCancellable  *cancellable,
+                                  GError       **error);
+
+gboolean
+_ostree_repo_commit_graph_lookup (OstreeRepo   *self,
+                                  const char   *checksum,
+                                  gboolean     *out_found,
+                                  char        **out_parent,
+                                  guint64      *out_timestamp,
+                                  char        **out_subject,
+                                  GError      **error);
+
+gboolean
+_ostree_repo_content_pack_lookup (OstreeRepo    *self,
+                                  const char    *checksum,
+                                  gboolean      *out_found,
+                                  guint64       *out_size,
+                                  GBytes       **out_data,
+                                  GCancellable  *cancellable,
+                                  GError       **error);
+
+gboolean
+_ostree_repo_regenerate_path_index (OstreeRepo    *self,
+                                    const char    *commit_checksum,
+                                    GCancellable  *cancellable,
+                                    GError       **error);
+
+GVariant *
+_ostree_repo_get_path_index (OstreeRepo    *self,
+                             const char    *tree_checksum);
+
+gboolean
+_ostree_repo_pack_small_objects (OstreeRepo    *self,
+                                 guint64        max_object_size,
+                                 guint         *out_n_packed,
+                                 GCancellable  *cancellable,
+                                 GError       **error);
+
 gboolean
 _ostree_repo_file_replace_contents (OstreeRepo    *self,
                                     int            dfd,
@@ -260,6 +531,16 @@ _ostree_repo_file_replace_contents (OstreeRepo    *self,
                                     GCancellable  *cancellable,
                                     GError       **error);
 
+GVariant *
+_ostree_repo_summary_signed_new (GBytes *summary,
+                                 GBytes *signatures);
+
+gboolean
+_ostree_repo_summary_signed_split (GBytes   *signed_data,
+                                   GBytes  **out_summary,
+                                   GBytes  **out_signatures,
+                                   GError  **error);
+
 gboolean
 _ostree_repo_write_ref (OstreeRepo                 *self,
                         const char                 *remote,
@@ -279,6 +560,13 @@ _ostree_repo_file_new_root (OstreeRepo  *repo,
                             const char  *contents_checksum,
                             const char  *metadata_checksum);
 
+gboolean
+_ostree_repo_file_tree_query_child_lite (OstreeRepoFile  *self,
+                                         int              n,
+                                         const char     **out_name,
+                                         gboolean        *out_is_dir,
+                                         GError         **error);
+
 gboolean
 _ostree_repo_traverse_dirtree_internal (OstreeRepo      *repo,
                                         const char      *dirtree_checksum,
@@ -288,6 +576,28 @@ _ostree_repo_traverse_dirtree_internal (OstreeRepo      *repo,
                                         GCancellable    *cancellable,
                                         GError         **error);
 
+/* Called once per reachable object during _ostree_repo_traverse_commit_visit().
+ * @csum is a borrowed binary (OSTREE_SHA256_DIGEST_LEN byte) checksum, valid
+ * only for the duration of the call.  For commit and dirtree objects,
+ * @out_recurse is non-%NULL and initialized to %TRUE; set it to %FALSE to
+ * skip descending into that object (e.g. because it was already visited).
+ */
+typedef gboolean (*OstreeRepoCommitTraverseVisitor) (OstreeRepo       *repo,
+                                                     OstreeObjectType  objtype,
+                                                     const guchar     *csum,
+                                                     gboolean         *out_recurse,
+                                                     gpointer          user_data,
+                                                     GError          **error);
+
+gboolean
+_ostree_repo_traverse_commit_visit (OstreeRepo                       *repo,
+                                    const char                       *commit_checksum,
+                                    int                               maxdepth,
+                                    OstreeRepoCommitTraverseVisitor   visitor,
+                                    gpointer                          user_data,
+                                    GCancellable                     *cancellable,
+                                    GError                          **error);
+
 OstreeRepoCommitFilterResult
 _ostree_repo_commit_modifier_apply (OstreeRepo               *self,
                                     OstreeRepoCommitModifier *modifier,
@@ -33,9 +33,74 @@ typedef struct {
   guint n_reachable_content;
   guint n_unreachable_meta;
   guint n_unreachable_content;
+  guint64 epoch_secs;
   guint64 freed_bytes;
 } OtPruneData;
 
+/* Compute the "pinning epoch" for a prune: the timestamp of the oldest
+ * generation marker among in-flight transactions, capped by the time
+ * the prune itself started.  Each transaction's flock'd staging (or
+ * fetcher) tmpdir acts as its generation marker - the lock file is
+ * created when the transaction starts and released at commit/abort.
+ * The sweep then refuses to delete any loose object whose mtime or
+ * ctime is at least the epoch: such objects may belong to a commit
+ * whose ref hasn't been published yet.  The ctime covers bare-mode
+ * objects, whose mtime is pinned to OSTREE_TIMESTAMP at commit time.
+ * Together with transactions bumping the generation of objects they
+ * dedup against (see _ostree_repo_has_loose_object()), this makes
+ * prune safe to run concurrently with pulls and commits.
+ */
+static gboolean
+get_prune_epoch (OstreeRepo    *self,
+                 guint64       *out_epoch_secs,
+                 GCancellable  *cancellable,
+                 GError       **error)
+{
+  guint64 epoch = g_get_real_time () / G_USEC_PER_SEC;
+
+  g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
+  if (!glnx_dirfd_iterator_init_at (self->tmp_dir_fd, ".", TRUE, &dfd_iter, error))
+    return FALSE;
+
+  while (TRUE)
+    {
+      struct dirent *dent;
+
+      if (!glnx_dirfd_iterator_next_dent_ensure_dtype (&dfd_iter, &dent, cancellable, error))
+        return FALSE;
+      if (dent == NULL)
+        break;
+      if (dent->d_type != DT_DIR)
+        continue;
+      if (!_ostree_repo_is_locked_tmpdir (dent->d_name))
+        continue;
+
+      g_auto(GLnxLockFile) lockfile = GLNX_LOCK_FILE_INIT;
+      gboolean did_lock;
+      if (!_ostree_repo_try_lock_tmpdir (self->tmp_dir_fd, dent->d_name,
+                                         &lockfile, &did_lock, error))
+        return FALSE;
+      if (did_lock)
+        continue;  /* Not an active transaction */
+
+      /* The lock file's timestamp is the generation start; the tmpdir
+       * itself is continuously touched as objects land in it.
+       */
+      g_autofree char *lock_name = g_strconcat (dent->d_name, "-lock", NULL);
+      struct stat stbuf;
+      if (TEMP_FAILURE_RETRY (fstatat (self->tmp_dir_fd, lock_name, &stbuf, 0)) < 0)
+        {
+          if (errno == ENOENT)
+            continue;  /* Raced with the transaction completing */
+          return glnx_throw_errno_prefix (error, "fstatat");
+        }
+      epoch = MIN (epoch, (guint64)stbuf.st_mtime);
+    }
+
+  *out_epoch_secs = epoch;
+  return TRUE;
+}
+
 static gboolean
 prune_commitpartial_file (OstreeRepo    *repo,
                           const char    *checksum,
@@ -52,6 +117,275 @@ prune_commitpartial_file (OstreeRepo    *repo,
   return TRUE;
 }
 
+/* Persisted reachability closure for one commit: the traversal depth it
+ * was computed with, plus every (checksum, objtype) pair reached.
+ */
+#define OSTREE_PRUNE_CLOSURE_GVARIANT_STRING "(ia(su))"
+
+static gboolean
+prune_closure_file (OstreeRepo    *repo,
+                    const char    *checksum,
+                    GCancellable  *cancellable,
+                    GError       **error)
+{
+  g_autofree char *path = _ostree_get_prune_closure_path (checksum);
+  if (unlinkat (repo->repo_dir_fd, path, 0) != 0)
+    {
+      if (errno != ENOENT)
+        return glnx_throw_errno_prefix (error, "unlinkat");
+    }
+
+  return TRUE;
+}
+
+static gboolean
+prune_size_closure_file (OstreeRepo    *repo,
+                         const char    *checksum,
+                         GCancellable  *cancellable,
+                         GError       **error)
+{
+  g_autofree char *path = _ostree_get_size_closure_path (checksum);
+  if (unlinkat (repo->repo_dir_fd, path, 0) != 0)
+    {
+      if (errno != ENOENT)
+        return glnx_throw_errno_prefix (error, "unlinkat");
+    }
+
+  return TRUE;
+}
+
+static gboolean
+prune_closure_load (OstreeRepo   *self,
+                    const char   *checksum,
+                    gint          depth,
+                    GHashTable   *inout_reachable,
+                    gboolean     *out_found,
+                    GError      **error)
+{
+  g_autofree char *path = _ostree_get_prune_closure_path (checksum);
+  glnx_fd_close int fd = -1;
+  g_autoptr(GVariant) closure = NULL;
+  g_autoptr(GVariant) objects = NULL;
+  gint stored_depth;
+
+  *out_found = FALSE;
+
+  fd = openat (self->repo_dir_fd, path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    {
+      if (errno == ENOENT)
+        return TRUE;
+      return glnx_throw_errno_prefix (error, "openat(%s)", path);
+    }
+
+  /* The cache is advisory; unparsable content is just a miss */
+  if (!ot_util_variant_map_fd (fd, 0, G_VARIANT_TYPE (OSTREE_PRUNE_CLOSURE_GVARIANT_STRING),
+                               FALSE, &closure, NULL))
+    return TRUE;
+
+  g_variant_get_child (closure, 0, "i", &stored_depth);
+  if (stored_depth != depth)
+    return TRUE;
+
+  objects = g_variant_get_child_value (closure, 1);
+  const gsize n = g_variant_n_children (objects);
+  for (gsize i = 0; i < n; i++)
+    g_hash_table_add (inout_reachable, g_variant_get_child_value (objects, i));
+
+  *out_found = TRUE;
+  return TRUE;
+}
+
+static gboolean
+prune_closure_save (OstreeRepo   *self,
+                    const char   *checksum,
+                    gint          depth,
+                    GHashTable   *reachable,
+                    GError      **error)
+{
+  g_auto(GVariantBuilder) builder = OT_VARIANT_BUILDER_INITIALIZER;
+  g_autoptr(GVariant) closure = NULL;
+  g_autofree char *path = _ostree_get_prune_closure_path (checksum);
+
+  if (!glnx_shutil_mkdir_p_at (self->repo_dir_fd, _OSTREE_PRUNE_CLOSURE_DIR, 0755,
+                               NULL, error))
+    return FALSE;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(su)"));
+  GLNX_HASH_TABLE_FOREACH (reachable, GVariant*, key)
+    g_variant_builder_add_value (&builder, key);
+  closure = g_variant_ref_sink (g_variant_new ("(i@a(su))", depth,
+                                               g_variant_builder_end (&builder)));
+
+  return glnx_file_replace_contents_at (self->repo_dir_fd, path,
+                                        g_variant_get_data (closure),
+                                        g_variant_get_size (closure),
+                                        GLNX_FILE_REPLACE_NODATASYNC,
+                                        NULL, error);
+}
+
+static gboolean
+commit_is_partial (OstreeRepo *self,
+                   const char *checksum)
+{
+  g_autofree char *path = _ostree_get_commitpartial_path (checksum);
+  struct stat stbuf;
+  return fstatat (self->repo_dir_fd, path, &stbuf, 0) == 0;
+}
+
+/* Like ostree_repo_traverse_commit_union(), but consults the persisted
+ * per-commit closure first, and persists the result on a miss.  A
+ * commit's closure is content addressed and hence immutable, so it
+ * stays valid until the commit itself is pruned; partial commits are
+ * never cached since their traversal is incomplete.
+ */
+static gboolean
+prune_traverse_commit_cached (OstreeRepo    *self,
+                              const char    *checksum,
+                              gint           depth,
+                              GHashTable    *inout_reachable,
+                              GCancellable  *cancellable,
+                              GError       **error)
+{
+  g_autoptr(GVariant) commit_key = NULL;
+  const gboolean is_partial = commit_is_partial (self, checksum);
+
+  commit_key = g_variant_ref_sink (ostree_object_name_serialize (checksum, OSTREE_OBJECT_TYPE_COMMIT));
+  if (g_hash_table_contains (inout_reachable, commit_key))
+    return TRUE;
+
+  if (!is_partial)
+    {
+      gboolean found = FALSE;
+      if (!prune_closure_load (self, checksum, depth, inout_reachable, &found, error))
+        return FALSE;
+      if (found)
+        return TRUE;
+    }
+
+  g_autoptr(GHashTable) local_reachable = ostree_repo_traverse_new_reachable ();
+  if (!ostree_repo_traverse_commit_union (self, checksum, depth, local_reachable,
+                                          cancellable, error))
+    return FALSE;
+
+  if (!is_partial)
+    {
+      if (!prune_closure_save (self, checksum, depth, local_reachable, error))
+        return FALSE;
+    }
+
+  GLNX_HASH_TABLE_FOREACH (local_reachable, GVariant*, key)
+    g_hash_table_add (inout_reachable, g_variant_ref (key));
+
+  return TRUE;
+}
+
+typedef struct {
+  OstreeRepo *repo;
+  gint depth;
+  GHashTable *reachable;       /* Shared; guarded by lock */
+  GMutex lock;
+  GCancellable *cancellable;
+  GError *error;               /* First failure; guarded by lock */
+} PruneMarkData;
+
+/* Worker for the parallel mark phase: traverse one commit into a
+ * thread-local set, then fold it into the shared reachable set under
+ * the lock.  Commits already marked (e.g. reached as a parent from
+ * another worker) are skipped up front.
+ */
+static void
+prune_mark_worker (gpointer item,
+                   gpointer user_data)
+{
+  const char *checksum = item;
+  PruneMarkData *data = user_data;
+  g_autoptr(GHashTable) local_reachable = NULL;
+  g_autoptr(GVariant) commit_key = NULL;
+  g_autoptr(GError) local_error = NULL;
+  gboolean skip;
+
+  commit_key = g_variant_ref_sink (ostree_object_name_serialize (checksum, OSTREE_OBJECT_TYPE_COMMIT));
+
+  g_mutex_lock (&data->lock);
+  skip = (data->error != NULL) || g_hash_table_contains (data->reachable, commit_key);
+  g_mutex_unlock (&data->lock);
+  if (skip)
+    return;
+
+  local_reachable = ostree_repo_traverse_new_reachable ();
+  if (!prune_traverse_commit_cached (data->repo, checksum, data->depth,
+                                     local_reachable, data->cancellable,
+                                     &local_error))
+    {
+      g_mutex_lock (&data->lock);
+      if (data->error == NULL)
+        data->error = g_steal_pointer (&local_error);
+      g_mutex_unlock (&data->lock);
+      return;
+    }
+
+  g_mutex_lock (&data->lock);
+  GLNX_HASH_TABLE_FOREACH (local_reachable, GVariant*, key)
+    g_hash_table_add (data->reachable, g_variant_ref (key));
+  g_mutex_unlock (&data->lock);
+}
+
+/* Compute the union of objects reachable from @commit_checksums into
+ * @reachable, traversing commits concurrently.  Falls back to serial
+ * traversal on a single processor or if pool creation fails.
+ */
+static gboolean
+prune_mark_reachable (OstreeRepo    *self,
+                      GPtrArray     *commit_checksums,
+                      gint           depth,
+                      GHashTable    *reachable,
+                      GCancellable  *cancellable,
+                      GError       **error)
+{
+  guint n_jobs = g_get_num_processors ();
+
+  if (n_jobs > 1 && commit_checksums->len > 1)
+    {
+      PruneMarkData data = { self, depth, reachable, };
+      GThreadPool *pool;
+
+      data.cancellable = cancellable;
+      data.error = NULL;
+      g_mutex_init (&data.lock);
+      pool = g_thread_pool_new (prune_mark_worker, &data, n_jobs, FALSE, NULL);
+      if (pool != NULL)
+        {
+          for (guint i = 0; i < commit_checksums->len; i++)
+            g_thread_pool_push (pool, commit_checksums->pdata[i], NULL);
+
+          /* Waits for the queue to drain */
+          g_thread_pool_free (pool, FALSE, TRUE);
+          g_mutex_clear (&data.lock);
+
+          if (data.error != NULL)
+            {
+              g_propagate_error (error, g_steal_pointer (&data.error));
+              return FALSE;
+            }
+          return TRUE;
+        }
+      /* Pool creation failed; fall through to the serial path */
+      g_mutex_clear (&data.lock);
+    }
+
+  for (guint i = 0; i < commit_checksums->len; i++)
+    {
+      const char *checksum = commit_checksums->pdata[i];
+      g_debug ("Finding objects to keep for commit %s", checksum);
+      if (!prune_traverse_commit_cached (self, checksum, depth, reachable,
+                                         cancellable, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
 static gboolean
 maybe_prune_loose_object (OtPruneData        *data,
                           OstreeRepoPruneFlags    flags,
@@ -72,10 +406,38 @@ maybe_prune_loose_object (OtPruneData        *data,
         {
           guint64 storage_size = 0;
 
+          /* Skip objects from generations still in flight: they may be
+           * referenced by a commit whose ref isn't published yet.  A
+           * future prune will collect them if they end up orphaned.
+           * The ctime matters as much as the mtime here: bare-mode
+           * content objects have their mtime pinned to OSTREE_TIMESTAMP
+           * at commit, but the rename/link into objects/ (and the
+           * dedup bump in bump_loose_object_generation()) refreshes
+           * the ctime, so a fresh object always trips one of the two.
+           */
+          { char loose_path_buf[_OSTREE_LOOSE_PATH_MAX];
+            struct stat stbuf;
+
+            _ostree_loose_path (loose_path_buf, checksum, objtype, data->repo->mode);
+            if (TEMP_FAILURE_RETRY (fstatat (data->repo->objects_dir_fd, loose_path_buf,
+                                             &stbuf, AT_SYMLINK_NOFOLLOW)) < 0)
+              {
+                if (errno != ENOENT)
+                  return glnx_throw_errno_prefix (error, "fstatat");
+                return TRUE;  /* Raced with another prune */
+              }
+            if ((guint64)MAX (stbuf.st_mtime, stbuf.st_ctime) >= data->epoch_secs)
+              return TRUE;
+          }
+
           if (objtype == OSTREE_OBJECT_TYPE_COMMIT)
             {
               if (!prune_commitpartial_file (data->repo, checksum, cancellable, error))
                 return FALSE;
+              if (!prune_closure_file (data->repo, checksum, cancellable, error))
+                return FALSE;
+              if (!prune_size_closure_file (data->repo, checksum, cancellable, error))
+                return FALSE;
             }
 
           if (!ostree_repo_query_object_storage_size (data->repo, objtype, checksum,
@@ -222,9 +584,46 @@ ostree_repo_prune_static_deltas (OstreeRepo *self, const char *commit,
   return TRUE;
 }
 
+/* Pass 1 of ostree_repo_prune(): just gather the commit checksums to
+ * traverse from, without holding the whole object set in memory.
+ */
+static gboolean
+collect_commit_checksums_cb (OstreeRepo       *repo,
+                             const guchar     *csum,
+                             OstreeObjectType  objtype,
+                             gpointer          user_data,
+                             GError          **error)
+{
+  GPtrArray *commit_checksums = user_data;
+
+  if (objtype == OSTREE_OBJECT_TYPE_COMMIT)
+    g_ptr_array_add (commit_checksums, ostree_checksum_from_bytes (csum));
+  return TRUE;
+}
+
+typedef struct {
+  OtPruneData *data;
+  OstreeRepoPruneFlags flags;
+  GCancellable *cancellable;
+} PruneForeachData;
+
+static gboolean
+prune_loose_object_cb (OstreeRepo       *repo,
+                       const guchar     *csum,
+                       OstreeObjectType  objtype,
+                       gpointer          user_data,
+                       GError          **error)
+{
+  PruneForeachData *fdata = user_data;
+  char checksum[OSTREE_SHA256_STRING_LEN+1];
+
+  ostree_checksum_inplace_from_bytes (csum, checksum);
+  return maybe_prune_loose_object (fdata->data, fdata->flags, checksum, objtype,
+                                   fdata->cancellable, error);
+}
+
 static gboolean
 repo_prune_internal (OstreeRepo        *self,
-                     GHashTable        *objects,
                      OstreeRepoPruneOptions *options,
                      gint              *out_objects_total,
                      gint              *out_objects_pruned,
@@ -239,22 +638,19 @@ repo_prune_internal (OstreeRepo        *self,
   g_autoptr(GHashTable) reachable_owned = g_hash_table_ref (options->reachable);
   data.reachable = reachable_owned;
 
-  GLNX_HASH_TABLE_FOREACH_KV (objects, GVariant*, serialized_key, GVariant*, objdata)
-    {
-      const char *checksum;
-      OstreeObjectType objtype;
-      gboolean is_loose;
-
-      ostree_object_name_deserialize (serialized_key, &checksum, &objtype);
-      g_variant_get_child (objdata, 0, "b", &is_loose);
-
-      if (!is_loose)
-        continue;
+  if (!get_prune_epoch (self, &data.epoch_secs, cancellable, error))
+    return FALSE;
 
-      if (!maybe_prune_loose_object (&data, options->flags, checksum, objtype,
-                                     cancellable, error))
-        return FALSE;
-    }
+  /* Stream the sweep rather than materializing the object set; the
+   * foreach visits objects grouped by objects/XX fanout directory, so
+   * unlinks stay batched per directory inode.
+   */
+  PruneForeachData fdata = { &data, options->flags, cancellable };
+  if (!ostree_repo_list_objects_foreach (self,
+                                         OSTREE_REPO_LIST_OBJECTS_ALL | OSTREE_REPO_LIST_OBJECTS_NO_PARENTS,
+                                         prune_loose_object_cb, &fdata,
+                                         cancellable, error))
+    return FALSE;
 
   if (!ostree_repo_prune_static_deltas (self, NULL, cancellable, error))
     return FALSE;
@@ -262,6 +658,10 @@ repo_prune_internal (OstreeRepo        *self,
   if (!_ostree_repo_prune_tmp (self, cancellable, error))
     return FALSE;
 
+  /* Deleting objects invalidates the scanned-subtree cache that pull
+   * maintains; ostree_repo_delete_object() drops it on our behalf.
+   */
+
   *out_objects_total = (data.n_reachable_meta + data.n_unreachable_meta +
                         data.n_reachable_content + data.n_unreachable_content);
   *out_objects_pruned = (data.n_unreachable_meta + data.n_unreachable_content);
@@ -293,6 +693,13 @@ repo_prune_internal (OstreeRepo        *self,
  * Use the %OSTREE_REPO_PRUNE_FLAGS_NO_PRUNE to just determine
  * statistics on objects that would be deleted, without actually
  * deleting them.
+ *
+ * Pruning may run concurrently with commits and pulls: the sweep skips
+ * objects at least as new as the oldest in-flight transaction's
+ * generation marker, and transactions refresh the timestamp of
+ * objects they reuse, so unpublished commits are never torn apart.
+ * Objects pinned this way are collected by a later prune once their
+ * transaction has completed.
  */
 gboolean
 ostree_repo_prune (OstreeRepo        *self,
@@ -304,7 +711,6 @@ ostree_repo_prune (OstreeRepo        *self,
                    GCancellable      *cancellable,
                    GError           **error)
 {
-  g_autoptr(GHashTable) objects = NULL;
   gboolean refs_only = flags & OSTREE_REPO_PRUNE_FLAGS_REFS_ONLY;
 
   g_autoptr(GHashTable) reachable = ostree_repo_traverse_new_reachable ();
@@ -314,6 +720,8 @@ ostree_repo_prune (OstreeRepo        *self,
    * the deletion.
    */
 
+  g_autoptr(GPtrArray) commit_checksums = g_ptr_array_new_with_free_func (g_free);
+
   if (refs_only)
     {
       /* Ignoring collections. */
@@ -324,12 +732,7 @@ ostree_repo_prune (OstreeRepo        *self,
         return FALSE;
 
       GLNX_HASH_TABLE_FOREACH_V (all_refs, const char*, checksum)
-        {
-          g_debug ("Finding objects to keep for commit %s", checksum);
-          if (!ostree_repo_traverse_commit_union (self, checksum, depth, reachable,
-                                                  cancellable, error))
-            return FALSE;
-        }
+        g_ptr_array_add (commit_checksums, g_strdup (checksum));
 
       /* Using collections. */
       g_autoptr(GHashTable) all_collection_refs = NULL;  /* (element-type OstreeChecksumRef utf8) */
@@ -339,39 +742,24 @@ ostree_repo_prune (OstreeRepo        *self,
         return FALSE;
 
       GLNX_HASH_TABLE_FOREACH_V (all_collection_refs, const char*, checksum)
-        {
-          g_debug ("Finding objects to keep for commit %s", checksum);
-          if (!ostree_repo_traverse_commit_union (self, checksum, depth, reachable,
-                                                  cancellable, error))
-            return FALSE;
-        }
+        g_ptr_array_add (commit_checksums, g_strdup (checksum));
     }
 
-  if (!ostree_repo_list_objects (self, OSTREE_REPO_LIST_OBJECTS_ALL | OSTREE_REPO_LIST_OBJECTS_NO_PARENTS,
-                                 &objects, cancellable, error))
-    return FALSE;
-
   if (!refs_only)
     {
-      GLNX_HASH_TABLE_FOREACH (objects, GVariant*, serialized_key)
-        {
-          const char *checksum;
-          OstreeObjectType objtype;
-
-          ostree_object_name_deserialize (serialized_key, &checksum, &objtype);
-
-          if (objtype != OSTREE_OBJECT_TYPE_COMMIT)
-            continue;
-
-          g_debug ("Finding objects to keep for commit %s", checksum);
-          if (!ostree_repo_traverse_commit_union (self, checksum, depth, reachable,
-                                                  cancellable, error))
-            return FALSE;
-        }
+      if (!ostree_repo_list_objects_foreach (self,
+                                             OSTREE_REPO_LIST_OBJECTS_ALL | OSTREE_REPO_LIST_OBJECTS_NO_PARENTS,
+                                             collect_commit_checksums_cb, commit_checksums,
+                                             cancellable, error))
+        return FALSE;
     }
 
+  if (!prune_mark_reachable (self, commit_checksums, depth, reachable,
+                             cancellable, error))
+    return FALSE;
+
   { OstreeRepoPruneOptions opts = { flags, reachable };
-    return repo_prune_internal (self, objects, &opts,
+    return repo_prune_internal (self, &opts,
                                 out_objects_total, out_objects_pruned,
                                 out_pruned_object_size_total, cancellable, error);
   }
@@ -408,13 +796,7 @@ ostree_repo_prune_from_reachable (OstreeRepo        *self,
                                   GCancellable      *cancellable,
                                   GError           **error)
 {
-  g_autoptr(GHashTable) objects = NULL;
-
-  if (!ostree_repo_list_objects (self, OSTREE_REPO_LIST_OBJECTS_ALL | OSTREE_REPO_LIST_OBJECTS_NO_PARENTS,
-                                 &objects, cancellable, error))
-    return FALSE;
-
-  return repo_prune_internal (self, objects, options, out_objects_total,
+  return repo_prune_internal (self, options, out_objects_total,
                               out_objects_pruned, out_pruned_object_size_total,
                               cancellable, error);
 }
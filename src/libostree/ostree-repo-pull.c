@@ -33,10 +33,12 @@
 
 #include "ostree-core-private.h"
 #include "ostree-repo-private.h"
+#include "ostree-bloom-private.h"
 #include "ostree-repo-static-delta-private.h"
 #include "ostree-metalink.h"
 #include "ostree-fetcher-util.h"
 #include "ostree-remote-private.h"
+#include "ostree-tracepoints-private.h"
 #include "ot-fs-utils.h"
 
 #ifdef OSTREE_ENABLE_EXPERIMENTAL_API
@@ -59,6 +61,12 @@
 #define OSTREE_REPO_PULL_CONTENT_PRIORITY  (OSTREE_FETCHER_DEFAULT_PRIORITY)
 #define OSTREE_REPO_PULL_METADATA_PRIORITY (OSTREE_REPO_PULL_CONTENT_PRIORITY - 100)
 
+/* Number of (timestamp, bytes) samples kept for smoothed transfer-rate
+ * computation in update_progress(); at the default one-second progress
+ * tick this covers roughly the last fifteen seconds.
+ */
+#define PROGRESS_RATE_N_SAMPLES 16
+
 typedef enum {
   OSTREE_FETCHER_SECURITY_STATE_CA_PINNED,
   OSTREE_FETCHER_SECURITY_STATE_TLS,
@@ -97,6 +105,7 @@ typedef struct {
   gboolean          gpg_verify;
   gboolean          require_static_deltas;
   gboolean          disable_static_deltas;
+  gboolean          disable_delta_cost_model;
   gboolean          gpg_verify_summary;
   gboolean          has_tombstone_commits;
 
@@ -104,16 +113,22 @@ typedef struct {
   GBytes           *summary_data_sig;
   GVariant         *summary;
   GHashTable       *summary_deltas_checksums;
+  GHashTable       *summary_inline_deltas; /* Maps delta name to superblock GBytes */
+  GPtrArray        *summary_shards; /* Verified summary shards; see OSTREE_SUMMARY_SHARDS */
+  GHashTable       *delta_index; /* Maps delta name to superblock size */
+  GPtrArray        *used_delta_cache_keys; /* Superblock cache entries to drop on success */
+  gboolean          have_delta_index;
   GPtrArray        *static_delta_superblocks;
   GHashTable       *expected_commit_sizes; /* Maps commit checksum to known size */
   GHashTable       *commit_to_depth; /* Maps commit checksum maximum depth */
-  GHashTable       *scanned_metadata; /* Maps object name to itself */
+  GHashTable       *scanned_metadata; /* Set<OstreeObjectNameBin> */
   GHashTable       *fetched_detached_metadata; /* Set<checksum> */
-  GHashTable       *requested_metadata; /* Maps object name to itself */
-  GHashTable       *requested_content; /* Maps checksum to itself */
+  GHashTable       *requested_metadata; /* Set<OstreeObjectNameBin> */
+  GHashTable       *requested_content; /* Set<binary checksum> */
   GHashTable       *requested_fallback_content; /* Maps checksum to itself */
-  GHashTable       *pending_fetch_metadata; /* Map<ObjectName,FetchObjectData> */
-  GHashTable       *pending_fetch_content; /* Map<checksum,FetchObjectData> */
+  GHashTable       *requested_manifests; /* Set<commit checksum>; object manifests fetched */
+  GHashTable       *pending_fetch_metadata; /* Map<OstreeObjectNameBin,FetchObjectData> */
+  GHashTable       *pending_fetch_content; /* Map<binary checksum,FetchObjectData> */
   GHashTable       *pending_fetch_deltaparts; /* Set<FetchStaticDeltaData> */
   guint             n_outstanding_metadata_fetches;
   guint             n_outstanding_metadata_write_requests;
@@ -121,6 +136,7 @@ typedef struct {
   guint             n_outstanding_content_write_requests;
   guint             n_outstanding_deltapart_fetches;
   guint             n_outstanding_deltapart_write_requests;
+  guint             n_outstanding_gpg_verify_requests;
   guint             n_total_deltaparts;
   guint             n_total_delta_fallbacks;
   guint64           fetched_deltapart_size; /* How much of the delta we have now */
@@ -137,18 +153,41 @@ typedef struct {
   guint             n_fetched_localcache_content;
 
   int               maxdepth;
+  int               deepen;
+  guint             max_outstanding_fetcher_requests;
+  /* Adaptive request window (AIMD); see maybe_adjust_fetcher_concurrency() */
+  guint             target_outstanding_fetcher_requests;
+  gboolean          fetcher_concurrency_is_static;
+  guint64           adapt_last_adjust_usecs;
+  guint             adapt_last_n_completed;
+  guint             stats_window_decreases;
+  /* A fetcher reused from the per-repo cache carries counters from the
+   * previous pull; this baselines the byte counter at pull start */
+  guint64           fetcher_initial_bytes;
   guint64           start_time;
 
+  /* Self-timing data, only gathered with the "stats" pull option */
+  gboolean          dump_stats;
+  guint64           stats_scan_usecs;
+  guint             stats_peak_outstanding;
+  guint             stats_peak_pending;
+
   gboolean          is_mirror;
   gboolean          is_commit_only;
   gboolean          is_untrusted;
   gboolean          is_bareuseronly_files;
+  gboolean          disable_commitmeta_refresh;
 
   GPtrArray        *dirs;
 
-  gboolean      have_previous_bytes;
-  guint64       previous_bytes_sec;
-  guint64       previous_total_downloaded;
+  /* Ring buffer of (timestamp, bytes transferred) samples, appended to
+   * once per progress tick; see update_progress(). */
+  struct {
+    guint64 time_usec;
+    guint64 bytes;
+  }             rate_samples[PROGRESS_RATE_N_SAMPLES];
+  guint         rate_sample_pos;
+  guint         n_rate_samples;
 
   GError       *cached_async_error;
   GError      **async_error;
@@ -156,6 +195,17 @@ typedef struct {
 
   GQueue scan_object_queue;
   GSource *idle_src;
+  GThreadPool *scan_prefetch_pool;
+
+  /* Bounded-memory scanning: when scan_queue_max_in_memory > 0, scan
+   * entries beyond the cap are appended to an anonymous spill file and
+   * re-read as the in-memory queue drains. */
+  guint scan_queue_max_in_memory;
+  GLnxTmpfile scan_spill_tmpf;
+  goffset scan_spill_read_offset;
+  guint scan_spill_count;
+
+  GBytes       *scanned_subtree_index; /* Sorted binary dirtree checksums known complete */
 } OtPullData;
 
 typedef struct {
@@ -194,6 +244,7 @@ static void start_fetch (OtPullData *pull_data, FetchObjectData *fetch);
 static void start_fetch_deltapart (OtPullData *pull_data,
                                    FetchStaticDeltaData *fetch);
 static gboolean fetcher_queue_is_full (OtPullData *pull_data);
+static gboolean fetcher_queue_is_full_for_data (OtPullData *pull_data);
 static void queue_scan_one_metadata_object (OtPullData                *pull_data,
                                             const char                *csum,
                                             OstreeObjectType           objtype,
@@ -208,6 +259,12 @@ static void queue_scan_one_metadata_object_c (OtPullData                *pull_da
                                               guint                      recursion_depth,
                                               const OstreeCollectionRef *ref);
 
+static gboolean scan_spill_refill (OtPullData  *pull_data,
+                                   GError     **error);
+
+static void initiate_object_manifest_request (OtPullData *pull_data,
+                                              const char *to_revision);
+
 static gboolean scan_one_metadata_object_c (OtPullData                 *pull_data,
                                             const guchar               *csum,
                                             OstreeObjectType            objtype,
@@ -217,6 +274,16 @@ static gboolean scan_one_metadata_object_c (OtPullData                 *pull_dat
                                             GCancellable               *cancellable,
                                             GError                    **error);
 
+/* Bytes transferred by this pull, excluding whatever a fetcher reused
+ * from the per-repo cache transferred in its previous life.
+ */
+static guint64
+pull_bytes_transferred (OtPullData *pull_data)
+{
+  return _ostree_fetcher_bytes_transferred (pull_data->fetcher)
+    - pull_data->fetcher_initial_bytes;
+}
+
 static gboolean
 update_progress (gpointer user_data)
 {
@@ -228,6 +295,8 @@ update_progress (gpointer user_data)
   guint requested;
   guint n_scanned_metadata;
   guint64 start_time;
+  guint64 bytes_sec = 0;
+  guint64 est_sec_remaining = 0;
 
   pull_data = user_data;
 
@@ -244,21 +313,53 @@ update_progress (gpointer user_data)
   outstanding_fetches = pull_data->n_outstanding_content_fetches +
     pull_data->n_outstanding_metadata_fetches +
     pull_data->n_outstanding_deltapart_fetches;
-  bytes_transferred = _ostree_fetcher_bytes_transferred (pull_data->fetcher);
+  bytes_transferred = pull_bytes_transferred (pull_data);
   fetched = pull_data->n_fetched_metadata + pull_data->n_fetched_content;
   requested = pull_data->n_requested_metadata + pull_data->n_requested_content;
   n_scanned_metadata = pull_data->n_scanned_metadata;
   start_time = pull_data->start_time;
 
+  /* Record a (now, bytes) sample in the ring buffer and derive a
+   * transfer rate smoothed over the sample window, so that consumers
+   * get a stable number instead of each reimplementing (flickering)
+   * derivative computation.  The byte counter itself is maintained by
+   * the fetcher via atomics; we only sample it here, once per tick.
+   */
+  { guint64 now = g_get_monotonic_time ();
+    pull_data->rate_samples[pull_data->rate_sample_pos].time_usec = now;
+    pull_data->rate_samples[pull_data->rate_sample_pos].bytes = bytes_transferred;
+    pull_data->rate_sample_pos = (pull_data->rate_sample_pos + 1) % PROGRESS_RATE_N_SAMPLES;
+    if (pull_data->n_rate_samples < PROGRESS_RATE_N_SAMPLES)
+      pull_data->n_rate_samples++;
+
+    /* When the buffer has wrapped, the slot we'll overwrite next holds
+     * the oldest sample. */
+    const guint oldest = (pull_data->n_rate_samples == PROGRESS_RATE_N_SAMPLES)
+      ? pull_data->rate_sample_pos : 0;
+    const guint64 window_usec = now - pull_data->rate_samples[oldest].time_usec;
+    const guint64 window_bytes = bytes_transferred - pull_data->rate_samples[oldest].bytes;
+    if (window_usec >= G_USEC_PER_SEC / 2)
+      bytes_sec = window_bytes * G_USEC_PER_SEC / window_usec;
+
+    if (bytes_sec > 0 && pull_data->total_deltapart_size > pull_data->fetched_deltapart_size)
+      est_sec_remaining = (pull_data->total_deltapart_size - pull_data->fetched_deltapart_size) / bytes_sec;
+  }
+
   ostree_async_progress_set (pull_data->progress,
                              "outstanding-fetches", "u", outstanding_fetches,
                              "outstanding-writes", "u", outstanding_writes,
                              "fetched", "u", fetched,
                              "requested", "u", requested,
-                             "scanning", "u", g_queue_is_empty (&pull_data->scan_object_queue) ? 0 : 1,
+                             "scanning", "u", (g_queue_is_empty (&pull_data->scan_object_queue)
+                                               && pull_data->scan_spill_count == 0) ? 0 : 1,
                              "scanned-metadata", "u", n_scanned_metadata,
                              "bytes-transferred", "t", bytes_transferred,
                              "start-time", "t", start_time,
+                             /* Smoothed transfer rate and (for deltas, where the total
+                              * size is known up front) estimated completion time; zero
+                              * when not yet computable. */
+                             "bytes-sec", "t", bytes_sec,
+                             "estimated-sec-remaining", "t", est_sec_remaining,
                              "metadata-fetched-localcache", "u", pull_data->n_fetched_localcache_metadata,
                              "content-fetched-localcache", "u", pull_data->n_fetched_localcache_content,
                              /* Deltas */
@@ -301,8 +402,11 @@ pull_termination_condition (OtPullData          *pull_data)
   gboolean current_write_idle = (pull_data->n_outstanding_metadata_write_requests == 0 &&
                                  pull_data->n_outstanding_content_write_requests == 0 &&
                                  pull_data->n_outstanding_deltapart_write_requests == 0 );
-  gboolean current_scan_idle = g_queue_is_empty (&pull_data->scan_object_queue);
-  gboolean current_idle = current_fetch_idle && current_write_idle && current_scan_idle;
+  gboolean current_scan_idle = (g_queue_is_empty (&pull_data->scan_object_queue)
+                                && pull_data->scan_spill_count == 0);
+  gboolean current_verify_idle = (pull_data->n_outstanding_gpg_verify_requests == 0);
+  gboolean current_idle = current_fetch_idle && current_write_idle && current_scan_idle
+    && current_verify_idle;
 
   /* we only enter the main loop when we're fetching objects */
   g_assert (pull_data->phase == OSTREE_PULL_PHASE_FETCHING_OBJECTS);
@@ -319,6 +423,55 @@ pull_termination_condition (OtPullData          *pull_data)
   return current_idle;
 }
 
+/* AIMD controller for the fetcher request window.  The right number of
+ * outstanding requests is the bandwidth-delay product of the link, which
+ * differs by orders of magnitude between a datacenter mirror and a
+ * cellular device.  We watch the smoothed time-to-first-byte the fetcher
+ * reports: while it stays near the best the link has shown us, grow the
+ * window additively towards the cap; once it builds up well past that
+ * baseline we're queueing (bufferbloat), so back off multiplicatively.
+ */
+#define ADAPT_WINDOW_MIN (4)
+#define ADAPT_ADJUST_INTERVAL_USECS (500 * 1000)
+#define ADAPT_MIN_NEW_SAMPLES (4)
+#define ADAPT_BLOAT_FACTOR (2)
+
+static void
+maybe_adjust_fetcher_concurrency (OtPullData *pull_data)
+{
+  if (pull_data->fetcher_concurrency_is_static)
+    return;
+
+  OstreeFetcherRequestStats stats;
+  _ostree_fetcher_get_request_stats (pull_data->fetcher, &stats);
+  /* Backends without timing leave the stats zeroed; stay static */
+  if (stats.n_completed < pull_data->adapt_last_n_completed + ADAPT_MIN_NEW_SAMPLES)
+    return;
+  const guint64 now = g_get_monotonic_time ();
+  if (now - pull_data->adapt_last_adjust_usecs < ADAPT_ADJUST_INTERVAL_USECS)
+    return;
+  pull_data->adapt_last_adjust_usecs = now;
+  pull_data->adapt_last_n_completed = stats.n_completed;
+
+  const guint old_window = pull_data->target_outstanding_fetcher_requests;
+  guint new_window;
+  if (stats.ewma_ttfb_usecs > stats.min_ttfb_usecs * ADAPT_BLOAT_FACTOR)
+    {
+      new_window = MAX (old_window / 2, ADAPT_WINDOW_MIN);
+      if (new_window < old_window)
+        pull_data->stats_window_decreases++;
+    }
+  else
+    new_window = MIN (old_window + 1, pull_data->max_outstanding_fetcher_requests);
+
+  if (new_window != old_window)
+    {
+      g_debug ("pull: fetcher window %u -> %u (ttfb ewma %" G_GUINT64_FORMAT "us, min %" G_GUINT64_FORMAT "us)",
+               old_window, new_window, stats.ewma_ttfb_usecs, stats.min_ttfb_usecs);
+      pull_data->target_outstanding_fetcher_requests = new_window;
+    }
+}
+
 static void
 check_outstanding_requests_handle_error (OtPullData          *pull_data,
                                          GError             **errorp)
@@ -350,12 +503,14 @@ check_outstanding_requests_handle_error (OtPullData          *pull_data,
        * reporting. Hence here, we process metadata fetches first.
        */
 
+      maybe_adjust_fetcher_concurrency (pull_data);
+
       /* Try filling the queue with metadata we need to fetch */
       g_hash_table_iter_init (&hiter, pull_data->pending_fetch_metadata);
       while (!fetcher_queue_is_full (pull_data) &&
              g_hash_table_iter_next (&hiter, &key, &value))
         {
-          GVariant *objname = key;
+          OstreeObjectNameBin *objname = key;
           FetchObjectData *fetch = value;
 
           /* Steal both key and value */
@@ -363,13 +518,13 @@ check_outstanding_requests_handle_error (OtPullData          *pull_data,
 
           /* This takes ownership of the value */
           start_fetch (pull_data, fetch);
-          /* And unref the key */
-          g_variant_unref (objname);
+          /* And free the key */
+          g_free (objname);
         }
 
       /* Now, process deltapart requests */
       g_hash_table_iter_init (&hiter, pull_data->pending_fetch_deltaparts);
-      while (!fetcher_queue_is_full (pull_data) &&
+      while (!fetcher_queue_is_full_for_data (pull_data) &&
              g_hash_table_iter_next (&hiter, &key, &value))
         {
           FetchStaticDeltaData *fetch = key;
@@ -380,10 +535,10 @@ check_outstanding_requests_handle_error (OtPullData          *pull_data,
 
       /* Next, fill the queue with content */
       g_hash_table_iter_init (&hiter, pull_data->pending_fetch_content);
-      while (!fetcher_queue_is_full (pull_data) &&
+      while (!fetcher_queue_is_full_for_data (pull_data) &&
              g_hash_table_iter_next (&hiter, &key, &value))
         {
-          char *checksum = key;
+          guchar *csum = key;
           FetchObjectData *fetch = value;
 
           /* Steal both key and value */
@@ -391,8 +546,8 @@ check_outstanding_requests_handle_error (OtPullData          *pull_data,
 
           /* This takes ownership of the value */
           start_fetch (pull_data, fetch);
-          /* And unref the key */
-          g_free (checksum);
+          /* And free the key */
+          g_free (csum);
         }
 
     }
@@ -406,11 +561,21 @@ check_outstanding_requests_handle_error (OtPullData          *pull_data,
 static gboolean
 fetcher_queue_is_full (OtPullData *pull_data)
 {
+  const guint total_fetches =
+      (pull_data->n_outstanding_metadata_fetches +
+       pull_data->n_outstanding_content_fetches +
+       pull_data->n_outstanding_deltapart_fetches);
   const gboolean fetch_full =
-      ((pull_data->n_outstanding_metadata_fetches +
-        pull_data->n_outstanding_content_fetches +
-        pull_data->n_outstanding_deltapart_fetches) ==
-         _OSTREE_MAX_OUTSTANDING_FETCHER_REQUESTS);
+      (total_fetches >= pull_data->target_outstanding_fetcher_requests);
+  if (pull_data->dump_stats)
+    {
+      const guint total_pending =
+          (g_hash_table_size (pull_data->pending_fetch_metadata) +
+           g_hash_table_size (pull_data->pending_fetch_content) +
+           g_hash_table_size (pull_data->pending_fetch_deltaparts));
+      pull_data->stats_peak_outstanding = MAX (pull_data->stats_peak_outstanding, total_fetches);
+      pull_data->stats_peak_pending = MAX (pull_data->stats_peak_pending, total_pending);
+    }
   const gboolean deltas_full =
       (pull_data->n_outstanding_deltapart_fetches ==
         _OSTREE_MAX_OUTSTANDING_DELTAPART_REQUESTS);
@@ -422,6 +587,27 @@ fetcher_queue_is_full (OtPullData *pull_data)
   return fetch_full || deltas_full || writes_full;
 }
 
+/* Like fetcher_queue_is_full(), but for content and delta part fetches; a
+ * couple of the request slots are held back for metadata, which gates
+ * discovery of further objects.  Otherwise large content objects fill every
+ * slot and newly scanned metadata sits behind them, leaving the dependency
+ * frontier (and hence the pipeline) to drain.
+ */
+static gboolean
+fetcher_queue_is_full_for_data (OtPullData *pull_data)
+{
+  if (fetcher_queue_is_full (pull_data))
+    return TRUE;
+  /* Nothing to reserve if the (adaptive) total is itself tiny */
+  if (pull_data->target_outstanding_fetcher_requests <=
+      _OSTREE_RESERVED_METADATA_FETCHER_REQUESTS)
+    return FALSE;
+  return ((pull_data->n_outstanding_content_fetches +
+           pull_data->n_outstanding_deltapart_fetches) >=
+            (pull_data->target_outstanding_fetcher_requests -
+             _OSTREE_RESERVED_METADATA_FETCHER_REQUESTS));
+}
+
 static gboolean
 idle_worker (gpointer user_data)
 {
@@ -430,12 +616,22 @@ idle_worker (gpointer user_data)
   g_autoptr(GError) error = NULL;
 
   scan_data = g_queue_pop_head (&pull_data->scan_object_queue);
+  if (scan_data == NULL && pull_data->scan_spill_count > 0)
+    {
+      if (!scan_spill_refill (pull_data, &error))
+        {
+          check_outstanding_requests_handle_error (pull_data, &error);
+          return G_SOURCE_CONTINUE;
+        }
+      scan_data = g_queue_pop_head (&pull_data->scan_object_queue);
+    }
   if (!scan_data)
     {
       g_clear_pointer (&pull_data->idle_src, (GDestroyNotify) g_source_destroy);
       return G_SOURCE_REMOVE;
     }
 
+  const guint64 scan_start_usecs = pull_data->dump_stats ? g_get_monotonic_time () : 0;
   scan_one_metadata_object_c (pull_data,
                               scan_data->csum,
                               scan_data->objtype,
@@ -444,6 +640,8 @@ idle_worker (gpointer user_data)
                               scan_data->requested_ref,
                               pull_data->cancellable,
                               &error);
+  if (pull_data->dump_stats)
+    pull_data->stats_scan_usecs += (g_get_monotonic_time () - scan_start_usecs);
   check_outstanding_requests_handle_error (pull_data, &error);
 
   g_free (scan_data->path);
@@ -453,6 +651,49 @@ idle_worker (gpointer user_data)
   return G_SOURCE_CONTINUE;
 }
 
+typedef struct {
+  guchar csum[OSTREE_SHA256_DIGEST_LEN];
+  OstreeObjectType objtype;
+} ScanPrefetchJob;
+
+/* Runs in a worker thread.  Scanning proper has to happen on the main
+ * context since it drives the fetcher queue, but the dominant cost for
+ * large repos is reading and parsing the metadata objects themselves.
+ * Load them here purely for the side effect of warming the page (and
+ * variant) cache; any errors are deferred to the real scan.
+ */
+static void
+scan_prefetch_worker (gpointer data,
+                      gpointer user_data)
+{
+  ScanPrefetchJob *job = data;
+  OtPullData *pull_data = user_data;
+  g_autofree char *checksum = ostree_checksum_from_bytes (job->csum);
+  g_autoptr(GVariant) variant = NULL;
+
+  (void) ostree_repo_load_variant_if_exists (pull_data->repo, job->objtype,
+                                             checksum, &variant, NULL);
+  g_free (job);
+}
+
+static void
+scan_prefetch_enqueue (OtPullData       *pull_data,
+                       const guchar     *csum,
+                       OstreeObjectType  objtype)
+{
+  ScanPrefetchJob *job;
+
+  if (!pull_data->scan_prefetch_pool)
+    return;
+  if (!OSTREE_OBJECT_TYPE_IS_META (objtype))
+    return;
+
+  job = g_new0 (ScanPrefetchJob, 1);
+  memcpy (job->csum, csum, sizeof (job->csum));
+  job->objtype = objtype;
+  g_thread_pool_push (pull_data->scan_prefetch_pool, job, NULL);
+}
+
 static void
 ensure_idle_queued (OtPullData *pull_data)
 {
@@ -484,7 +725,8 @@ fetch_mirrored_uri_contents_utf8_sync (OstreeFetcher  *fetcher,
   g_autoptr(GBytes) bytes = NULL;
   if (!_ostree_fetcher_mirrored_request_to_membuf (fetcher, mirrorlist,
                                                    filename, OSTREE_FETCHER_REQUEST_NUL_TERMINATION,
-                                                   &bytes,
+                                                   NULL, 0,
+                                                   &bytes, NULL, NULL, NULL,
                                                    OSTREE_MAX_METADATA_SIZE,
                                                    cancellable, error))
     return FALSE;
@@ -528,6 +770,157 @@ write_commitpartial_for (OtPullData *pull_data,
   return TRUE;
 }
 
+static gboolean
+write_shallow_for (OtPullData *pull_data,
+                   const char *checksum,
+                   GError **error)
+{
+  g_autofree char *shallow_path = _ostree_get_shallow_path (checksum);
+  glnx_fd_close int fd = openat (pull_data->repo->repo_dir_fd, shallow_path, O_EXCL | O_CREAT | O_WRONLY | O_CLOEXEC | O_NOCTTY, 0644);
+  if (fd == -1)
+    {
+      if (errno != EEXIST)
+        return glnx_throw_errno_prefix (error, "open(%s)", shallow_path);
+    }
+  return TRUE;
+}
+
+static gboolean
+delete_shallow_for (OtPullData *pull_data,
+                    const char *checksum,
+                    GError **error)
+{
+  g_autofree char *shallow_path = _ostree_get_shallow_path (checksum);
+  if (unlinkat (pull_data->repo->repo_dir_fd, shallow_path, 0) != 0)
+    {
+      if (errno != ENOENT)
+        return glnx_throw_errno_prefix (error, "unlink(%s)", shallow_path);
+    }
+  return TRUE;
+}
+
+/* The scanned-subtree index persists the set of dirtree checksums whose
+ * entire subtree is known to be stored locally, so that repeated pulls
+ * of large, mostly-unchanged trees don't re-walk shared subtrees.  The
+ * format is simply a sorted array of raw SHA256 digests; we binary
+ * search it directly from the loaded bytes.  Pruning invalidates it
+ * wholesale by deleting the file.
+ */
+static int
+compare_csum_bytes (gconstpointer a,
+                    gconstpointer b)
+{
+  return memcmp (a, b, OSTREE_SHA256_DIGEST_LEN);
+}
+
+/* GPtrArray variant of the above; the arguments are pointers into pdata */
+static int
+compare_csum_bytes_p (gconstpointer a,
+                      gconstpointer b)
+{
+  return memcmp (*(const guchar * const *)a, *(const guchar * const *)b,
+                 OSTREE_SHA256_DIGEST_LEN);
+}
+
+static void
+load_scanned_subtree_index (OtPullData *pull_data)
+{
+  glnx_fd_close int fd = -1;
+  g_autoptr(GBytes) bytes = NULL;
+
+  /* Subset (--subpath) and commit-only pulls don't traverse whole
+   * subtrees, so neither consult nor update the index for them.
+   */
+  if (pull_data->dirs != NULL || pull_data->is_commit_only)
+    return;
+
+  fd = openat (pull_data->repo->repo_dir_fd, _OSTREE_SCANNED_SUBTREE_INDEX_PATH,
+               O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return;
+
+  bytes = glnx_fd_readall_bytes (fd, NULL, NULL);
+  if (bytes == NULL)
+    return;
+
+  /* Discard anything that isn't a whole number of digests */
+  if (g_bytes_get_size (bytes) % OSTREE_SHA256_DIGEST_LEN != 0)
+    return;
+
+  pull_data->scanned_subtree_index = g_steal_pointer (&bytes);
+}
+
+static gboolean
+scanned_subtree_index_contains (OtPullData   *pull_data,
+                                const guchar *csum)
+{
+  gsize len;
+  const guchar *data;
+
+  if (pull_data->scanned_subtree_index == NULL)
+    return FALSE;
+
+  data = g_bytes_get_data (pull_data->scanned_subtree_index, &len);
+  return bsearch (csum, data, len / OSTREE_SHA256_DIGEST_LEN,
+                  OSTREE_SHA256_DIGEST_LEN, compare_csum_bytes) != NULL;
+}
+
+/* Called after a fully successful pull; at that point every dirtree we
+ * scanned has all of its children stored, so fold the scanned set into
+ * the persistent index.
+ */
+static gboolean
+save_scanned_subtree_index (OtPullData    *pull_data,
+                            GCancellable  *cancellable,
+                            GError       **error)
+{
+  g_autoptr(GPtrArray) csums = g_ptr_array_new_with_free_func (g_free);
+  g_autoptr(GString) buf = g_string_new (NULL);
+
+  if (pull_data->dirs != NULL || pull_data->is_commit_only)
+    return TRUE;
+
+  GLNX_HASH_TABLE_FOREACH (pull_data->scanned_metadata, OstreeObjectNameBin*, object)
+    {
+      if (object->objtype != OSTREE_OBJECT_TYPE_DIR_TREE)
+        continue;
+
+      g_ptr_array_add (csums, g_memdup (object->csum, OSTREE_SHA256_DIGEST_LEN));
+    }
+
+  if (csums->len == 0)
+    return TRUE;
+
+  if (pull_data->scanned_subtree_index != NULL)
+    {
+      gsize len;
+      const guchar *data = g_bytes_get_data (pull_data->scanned_subtree_index, &len);
+      for (gsize i = 0; i < len / OSTREE_SHA256_DIGEST_LEN; i++)
+        g_ptr_array_add (csums, g_memdup (data + i * OSTREE_SHA256_DIGEST_LEN,
+                                          OSTREE_SHA256_DIGEST_LEN));
+    }
+
+  g_ptr_array_sort (csums, compare_csum_bytes_p);
+
+  for (guint i = 0; i < csums->len; i++)
+    {
+      /* Deduplicate while appending; the array is sorted */
+      if (i > 0 && memcmp (csums->pdata[i-1], csums->pdata[i],
+                           OSTREE_SHA256_DIGEST_LEN) == 0)
+        continue;
+      g_string_append_len (buf, csums->pdata[i], OSTREE_SHA256_DIGEST_LEN);
+    }
+
+  if (!glnx_file_replace_contents_at (pull_data->repo->repo_dir_fd,
+                                      _OSTREE_SCANNED_SUBTREE_INDEX_PATH,
+                                      (guint8*)buf->str, buf->len,
+                                      GLNX_FILE_REPLACE_NODATASYNC,
+                                      cancellable, error))
+    return FALSE;
+
+  return TRUE;
+}
+
 static void
 enqueue_one_object_request (OtPullData                *pull_data,
                             const char                *checksum,
@@ -798,7 +1191,10 @@ scan_dirtree_object (OtPullData   *pull_data,
       if (!pull_matches_subdir (pull_data, path, filename, FALSE))
         continue;
 
-      file_checksum = ostree_checksum_from_bytes_v (csum);
+      const guchar *csum_bytes = ostree_checksum_bytes_peek_validate (csum, error);
+      if (csum_bytes == NULL)
+        return FALSE;
+      file_checksum = ostree_checksum_from_bytes (csum_bytes);
 
       if (!ostree_repo_has_object (pull_data->repo, OSTREE_OBJECT_TYPE_FILE, file_checksum,
                                    &file_is_stored, cancellable, error))
@@ -809,7 +1205,7 @@ scan_dirtree_object (OtPullData   *pull_data,
         continue;
 
       /* Already have a request pending?  If so, move on to the next */
-      if (g_hash_table_lookup (pull_data->requested_content, file_checksum))
+      if (g_hash_table_lookup (pull_data->requested_content, csum_bytes))
         continue;
 
       /* Is this a local repo? */
@@ -819,7 +1215,8 @@ scan_dirtree_object (OtPullData   *pull_data,
                                                  file_checksum, cancellable,
                                                  on_local_object_imported,
                                                  pull_data);
-          g_hash_table_add (pull_data->requested_content, g_steal_pointer (&file_checksum));
+          g_hash_table_add (pull_data->requested_content,
+                            g_memdup (csum_bytes, OSTREE_SHA256_DIGEST_LEN));
           /* Note early loop continue */
           continue;
         }
@@ -840,7 +1237,8 @@ scan_dirtree_object (OtPullData   *pull_data,
                 continue;
               async_import_one_local_content_object (pull_data, localcache_repo, file_checksum, cancellable,
                                                      on_local_object_imported, pull_data);
-              g_hash_table_add (pull_data->requested_content, g_steal_pointer (&file_checksum));
+              g_hash_table_add (pull_data->requested_content,
+                                g_memdup (csum_bytes, OSTREE_SHA256_DIGEST_LEN));
               did_import_from_cache_repo = TRUE;
               pull_data->n_fetched_localcache_content++;
               break;
@@ -850,9 +1248,9 @@ scan_dirtree_object (OtPullData   *pull_data,
         continue; /* Note early continue */
 
       /* Not available locally, queue a HTTP request */
-      g_hash_table_add (pull_data->requested_content, file_checksum);
+      g_hash_table_add (pull_data->requested_content,
+                        g_memdup (csum_bytes, OSTREE_SHA256_DIGEST_LEN));
       enqueue_one_object_request (pull_data, file_checksum, OSTREE_OBJECT_TYPE_FILE, path, FALSE, FALSE, NULL);
-      file_checksum = NULL;  /* Transfer ownership */
     }
 
   g_autoptr(GVariant) dirs_variant = g_variant_get_child_value (tree, 1);
@@ -889,115 +1287,395 @@ scan_dirtree_object (OtPullData   *pull_data,
   return TRUE;
 }
 
-/* Given a @ref, fetch its contents (should be a SHA256 ASCII string) */
-static gboolean
-fetch_ref_contents (OtPullData                 *pull_data,
-                    const char                 *main_collection_id,
-                    const OstreeCollectionRef  *ref,
-                    char                      **out_contents,
-                    GCancellable               *cancellable,
-                    GError                    **error)
+/* Cache of the last resolved (ref file → checksum) pairs for remotes
+ * that have no summary, together with the ETag the server sent for each
+ * ref file.  The next poll resolves those refs with conditional
+ * requests, so an unchanged ref costs a bodyless 304 instead of a full
+ * GET.  Stored per remote in the cache directory as a sorted GVariant
+ * of (ref file, checksum, ETag).  Purely an optimization: any failure
+ * just means unconditional fetches.
+ */
+#define _OSTREE_REF_CACHE_DIR "ref-etags"
+#define OSTREE_REF_CACHE_GVARIANT_STRING "a(sss)"
+
+typedef struct {
+  char *checksum;
+  char *etag;
+} RefCacheEntry;
+
+static void
+ref_cache_entry_free (RefCacheEntry *entry)
 {
-  g_autofree char *filename = NULL;
+  g_free (entry->checksum);
+  g_free (entry->etag);
+  g_free (entry);
+}
 
-  if (ref->collection_id == NULL || g_strcmp0 (ref->collection_id, main_collection_id) == 0)
-    filename = g_build_filename ("refs", "heads", ref->ref_name, NULL);
-  else
-    filename = g_build_filename ("refs", "mirrors", ref->collection_id, ref->ref_name, NULL);
+/* Returns a (ref file → RefCacheEntry) map; empty if there is no usable
+ * cache for @remote. */
+static GHashTable *
+load_ref_cache (OstreeRepo *self,
+                const char *remote)
+{
+  GHashTable *ret = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                           (GDestroyNotify)ref_cache_entry_free);
+  glnx_fd_close int fd = -1;
+  g_autoptr(GVariant) cache = NULL;
 
-  g_autofree char *ret_contents = NULL;
-  if (!fetch_mirrored_uri_contents_utf8_sync (pull_data->fetcher,
-                                              pull_data->meta_mirrorlist,
-                                              filename, &ret_contents,
-                                              cancellable, error))
-    return FALSE;
+  if (self->cache_dir_fd == -1 || remote == NULL)
+    return ret;
 
-  g_strchomp (ret_contents);
+  const char *cache_file = glnx_strjoina (_OSTREE_REF_CACHE_DIR, "/", remote);
+  if (!ot_openat_ignore_enoent (self->cache_dir_fd, cache_file, &fd, NULL))
+    return ret;
+  if (fd < 0)
+    return ret;
 
-  if (!ostree_validate_checksum_string (ret_contents, error))
-    return glnx_prefix_error (error, "Fetching %s", filename);
+  if (!ot_util_variant_map_fd (fd, 0, G_VARIANT_TYPE (OSTREE_REF_CACHE_GVARIANT_STRING),
+                               FALSE, &cache, NULL))
+    return ret;
 
-  ot_transfer_out_value (out_contents, &ret_contents);
-  return TRUE;
+  const gsize n = g_variant_n_children (cache);
+  for (gsize i = 0; i < n; i++)
+    {
+      const char *filename;
+      const char *checksum;
+      const char *etag;
+
+      g_variant_get_child (cache, i, "(&s&s&s)", &filename, &checksum, &etag);
+      /* An entry without an ETag can't be used for a conditional
+       * request anyway */
+      if (*etag == '\0' || !ostree_validate_checksum_string (checksum, NULL))
+        continue;
+
+      RefCacheEntry *entry = g_new0 (RefCacheEntry, 1);
+      entry->checksum = g_strdup (checksum);
+      entry->etag = g_strdup (etag);
+      g_hash_table_replace (ret, g_strdup (filename), entry);
+    }
+
+  return ret;
 }
 
-static gboolean
-lookup_commit_checksum_and_collection_from_summary (OtPullData                 *pull_data,
-                                                    const OstreeCollectionRef  *ref,
-                                                    char                      **out_checksum,
-                                                    gsize                      *out_size,
-                                                    char                      **out_collection_id,
-                                                    GError                    **error)
+static void
+save_ref_cache (OstreeRepo   *self,
+                const char   *remote,
+                GHashTable   *entries,
+                GCancellable *cancellable)
 {
-  g_autoptr(GVariant) additional_metadata = g_variant_get_child_value (pull_data->summary, 1);
-  const gchar *main_collection_id;
+  GVariantBuilder builder;
 
-  if (!g_variant_lookup (additional_metadata, OSTREE_SUMMARY_COLLECTION_ID, "&s", &main_collection_id))
-    main_collection_id = NULL;
+  if (self->cache_dir_fd == -1 || remote == NULL)
+    return;
 
-  g_autoptr(GVariant) refs = NULL;
-  const gchar *resolved_collection_id = NULL;
+  g_variant_builder_init (&builder, G_VARIANT_TYPE (OSTREE_REF_CACHE_GVARIANT_STRING));
 
-  if (ref->collection_id == NULL || g_strcmp0 (ref->collection_id, main_collection_id) == 0)
+  g_autoptr(GList) keys = g_hash_table_get_keys (entries);
+  keys = g_list_sort (keys, (GCompareFunc)strcmp);
+  for (GList *iter = keys; iter != NULL; iter = iter->next)
     {
-      refs = g_variant_get_child_value (pull_data->summary, 0);
-      resolved_collection_id = main_collection_id;
+      const char *filename = iter->data;
+      RefCacheEntry *entry = g_hash_table_lookup (entries, filename);
+      g_variant_builder_add (&builder, "(sss)", filename, entry->checksum, entry->etag);
     }
-  else if (ref->collection_id != NULL)
-    {
-      g_autoptr(GVariant) collection_map = NULL;
 
-      collection_map = g_variant_lookup_value (additional_metadata, OSTREE_SUMMARY_COLLECTION_MAP,
-                                               G_VARIANT_TYPE ("a{sa(s(taya{sv}))}"));
-      if (collection_map != NULL)
-        refs = g_variant_lookup_value (collection_map, ref->collection_id, G_VARIANT_TYPE ("a(s(taya{sv}))"));
-      resolved_collection_id = ref->collection_id;
-    }
+  g_autoptr(GVariant) cache = g_variant_ref_sink (g_variant_builder_end (&builder));
+  const char *cache_file = glnx_strjoina (_OSTREE_REF_CACHE_DIR, "/", remote);
+  g_autoptr(GError) local_error = NULL;
+  if (!glnx_shutil_mkdir_p_at (self->cache_dir_fd, _OSTREE_REF_CACHE_DIR, 0775,
+                               cancellable, &local_error)
+      || !glnx_file_replace_contents_at (self->cache_dir_fd, cache_file,
+                                         g_variant_get_data (cache),
+                                         g_variant_get_size (cache),
+                                         self->disable_fsync ? GLNX_FILE_REPLACE_NODATASYNC : GLNX_FILE_REPLACE_DATASYNC_NEW,
+                                         cancellable, &local_error))
+    g_debug ("Failed to update ref cache for remote %s: %s", remote, local_error->message);
+}
 
-  int i;
-  if (refs == NULL || !ot_variant_bsearch_str (refs, ref->ref_name, &i))
+typedef struct {
+  char     *filename;
+  char     *contents;
+  const char *cached_checksum; /* borrowed from the ref cache */
+  char     *out_etag;
+  gboolean  not_modified;
+  GError   *error;
+  guint    *n_done;
+} FetchRefReq;
+
+static void
+fetch_ref_contents_on_complete (GObject        *object,
+                                GAsyncResult   *result,
+                                gpointer        user_data)
+{
+  FetchRefReq *req = user_data;
+  g_autoptr(GBytes) bytes = NULL;
+
+  if (_ostree_fetcher_request_to_membuf_finish ((OstreeFetcher*)object, result,
+                                                &bytes, &req->not_modified,
+                                                &req->out_etag, NULL,
+                                                &req->error))
     {
-      if (ref->collection_id != NULL)
-        return glnx_throw (error, "No such branch (%s, %s) in repository summary", ref->collection_id, ref->ref_name);
-      else
-        return glnx_throw (error, "No such branch '%s' in repository summary", ref->ref_name);
+      if (!req->not_modified)
+        {
+          gsize len;
+          req->contents = g_bytes_unref_to_data (g_steal_pointer (&bytes), &len);
+        }
     }
+  (*req->n_done)++;
+}
 
-  g_autoptr(GVariant) refdata = g_variant_get_child_value (refs, i);
-  g_autoptr(GVariant) reftargetdata = g_variant_get_child_value (refdata, 1);
-  guint64 commit_size;
-  g_autoptr(GVariant) commit_csum_v = NULL;
-  g_variant_get (reftargetdata, "(t@ay@a{sv})", &commit_size, &commit_csum_v, NULL);
+/* Given a set of @refs, fetch the contents of each (which should be a SHA256
+ * ASCII string) into the parallel array @out_contents.  All of the requests
+ * are issued concurrently; otherwise a multi-ref pull pays one full network
+ * round trip per ref before any object fetching can start.
+ */
+static gboolean
+fetch_ref_contents_many (OtPullData    *pull_data,
+                         const char    *main_collection_id,
+                         GPtrArray     *refs, /* (element-type OstreeCollectionRef) */
+                         char         **out_contents,
+                         GCancellable  *cancellable,
+                         GError       **error)
+{
+  gboolean ret = FALSE;
+  g_autoptr(GMainContext) mainctx = NULL;
+  g_autofree FetchRefReq *reqs = g_new0 (FetchRefReq, refs->len);
+  guint n_done = 0;
+  guint i;
 
-  if (resolved_collection_id != NULL &&
-      !ostree_validate_collection_id (resolved_collection_id, error))
-    return FALSE;
-  if (!ostree_validate_structureof_csum_v (commit_csum_v, error))
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
     return FALSE;
 
-  *out_checksum = ostree_checksum_from_bytes_v (commit_csum_v);
-  *out_size = commit_size;
-  *out_collection_id = g_strdup (resolved_collection_id);
-  return TRUE;
-}
+  mainctx = g_main_context_new ();
+  g_main_context_push_thread_default (mainctx);
 
-static void
-fetch_object_data_free (FetchObjectData *fetch_data)
-{
-  g_variant_unref (fetch_data->object);
-  g_free (fetch_data->path);
-  if (fetch_data->requested_ref)
-    ostree_collection_ref_free (fetch_data->requested_ref);
-  g_free (fetch_data);
-}
+  g_autoptr(GHashTable) ref_cache = load_ref_cache (pull_data->repo, pull_data->remote_name);
 
-static void
-content_fetch_on_write_complete (GObject        *object,
-                                 GAsyncResult   *result,
-                                 gpointer        user_data)
-{
-  FetchObjectData *fetch_data = user_data;
-  OtPullData *pull_data = fetch_data->pull_data;
+  for (i = 0; i < refs->len; i++)
+    {
+      const OstreeCollectionRef *ref = refs->pdata[i];
+      FetchRefReq *req = &reqs[i];
+
+      if (ref->collection_id == NULL || g_strcmp0 (ref->collection_id, main_collection_id) == 0)
+        req->filename = g_build_filename ("refs", "heads", ref->ref_name, NULL);
+      else
+        req->filename = g_build_filename ("refs", "mirrors", ref->collection_id, ref->ref_name, NULL);
+      req->n_done = &n_done;
+
+      const char *if_none_match = NULL;
+      const RefCacheEntry *cached = g_hash_table_lookup (ref_cache, req->filename);
+      if (cached != NULL)
+        {
+          req->cached_checksum = cached->checksum;
+          if_none_match = cached->etag;
+        }
+
+      _ostree_fetcher_request_to_membuf (pull_data->fetcher,
+                                         pull_data->meta_mirrorlist,
+                                         req->filename,
+                                         OSTREE_FETCHER_REQUEST_NUL_TERMINATION,
+                                         if_none_match, 0,
+                                         OSTREE_MAX_METADATA_SIZE,
+                                         OSTREE_FETCHER_DEFAULT_PRIORITY,
+                                         cancellable, fetch_ref_contents_on_complete, req);
+    }
+
+  while (n_done < refs->len)
+    g_main_context_iteration (mainctx, TRUE);
+
+  for (i = 0; i < refs->len; i++)
+    {
+      FetchRefReq *req = &reqs[i];
+
+      if (req->error)
+        {
+          g_propagate_error (error, g_steal_pointer (&req->error));
+          goto out;
+        }
+
+      if (req->not_modified)
+        {
+          /* The server confirmed the checksum we cached from the last
+           * poll is still current; it was validated before caching. */
+          g_assert (req->cached_checksum != NULL);
+          req->contents = g_strdup (req->cached_checksum);
+          continue;
+        }
+
+      if (!g_utf8_validate (req->contents, -1, NULL))
+        {
+          glnx_throw (error, "Fetching %s: Invalid UTF-8", req->filename);
+          goto out;
+        }
+
+      g_strchomp (req->contents);
+
+      if (!ostree_validate_checksum_string (req->contents, error))
+        {
+          glnx_prefix_error (error, "Fetching %s", req->filename);
+          goto out;
+        }
+
+      if (req->out_etag != NULL && *req->out_etag != '\0')
+        {
+          RefCacheEntry *entry = g_new0 (RefCacheEntry, 1);
+          entry->checksum = g_strdup (req->contents);
+          entry->etag = g_strdup (req->out_etag);
+          g_hash_table_replace (ref_cache, g_strdup (req->filename), entry);
+        }
+      else
+        g_hash_table_remove (ref_cache, req->filename);
+    }
+
+  save_ref_cache (pull_data->repo, pull_data->remote_name, ref_cache, cancellable);
+
+  for (i = 0; i < refs->len; i++)
+    out_contents[i] = g_steal_pointer (&reqs[i].contents);
+
+  ret = TRUE;
+ out:
+  for (i = 0; i < refs->len; i++)
+    {
+      g_free (reqs[i].filename);
+      g_free (reqs[i].contents);
+      g_free (reqs[i].out_etag);
+      g_clear_error (&reqs[i].error);
+    }
+  g_main_context_pop_thread_default (mainctx);
+  return ret;
+}
+
+static gboolean
+lookup_commit_checksum_and_collection_from_summary (OtPullData                 *pull_data,
+                                                    const OstreeCollectionRef  *ref,
+                                                    char                      **out_checksum,
+                                                    gsize                      *out_size,
+                                                    char                      **out_collection_id,
+                                                    GError                    **error)
+{
+  g_autoptr(GVariant) additional_metadata = g_variant_get_child_value (pull_data->summary, 1);
+  const gchar *main_collection_id;
+
+  /* If the summary carries a ref-name bloom filter, use it to answer
+   * negative lookups without searching (or even paging in) the ref
+   * arrays of a large summary.
+   */
+  { g_autoptr(GVariant) bloom_v =
+      g_variant_lookup_value (additional_metadata, OSTREE_SUMMARY_REF_BLOOM,
+                              G_VARIANT_TYPE ("(yyay)"));
+    if (bloom_v != NULL)
+      {
+        guint8 k, hash_id;
+        g_autoptr(GVariant) bloom_bits = NULL;
+
+        g_variant_get (bloom_v, "(yy@ay)", &k, &hash_id, &bloom_bits);
+        if (k > 0 && hash_id == OSTREE_SUMMARY_REF_BLOOM_HASH_ID)
+          {
+            g_autoptr(GBytes) bloom_bytes = g_variant_get_data_as_bytes (bloom_bits);
+            g_autoptr(OstreeBloom) bloom =
+              ostree_bloom_new_from_bytes (bloom_bytes, k, ostree_str_bloom_hash);
+
+            if (!ostree_bloom_maybe_contains (bloom, ref->ref_name))
+              {
+                if (ref->collection_id != NULL)
+                  return glnx_throw (error, "No such branch (%s, %s) in repository summary",
+                                     ref->collection_id, ref->ref_name);
+                else
+                  return glnx_throw (error, "No such branch '%s' in repository summary",
+                                     ref->ref_name);
+              }
+          }
+      }
+  }
+
+  if (!g_variant_lookup (additional_metadata, OSTREE_SUMMARY_COLLECTION_ID, "&s", &main_collection_id))
+    main_collection_id = NULL;
+
+  g_autoptr(GVariant) refs = NULL;
+  const gchar *resolved_collection_id = NULL;
+
+  if (ref->collection_id == NULL || g_strcmp0 (ref->collection_id, main_collection_id) == 0)
+    {
+      refs = g_variant_get_child_value (pull_data->summary, 0);
+      resolved_collection_id = main_collection_id;
+    }
+  else if (ref->collection_id != NULL)
+    {
+      g_autoptr(GVariant) collection_map = NULL;
+
+      collection_map = g_variant_lookup_value (additional_metadata, OSTREE_SUMMARY_COLLECTION_MAP,
+                                               G_VARIANT_TYPE ("a{sa(s(taya{sv}))}"));
+      if (collection_map != NULL)
+        refs = g_variant_lookup_value (collection_map, ref->collection_id, G_VARIANT_TYPE ("a(s(taya{sv}))"));
+      resolved_collection_id = ref->collection_id;
+    }
+
+  int i;
+  gboolean found = (refs != NULL && ot_variant_bsearch_str (refs, ref->ref_name, &i));
+
+  /* With a sharded summary the ref may live in one of the shard files
+   * we fetched rather than the root refs array; shards only ever hold
+   * main-collection refs. */
+  if (!found && pull_data->summary_shards != NULL
+      && (ref->collection_id == NULL || g_strcmp0 (ref->collection_id, main_collection_id) == 0))
+    {
+      for (guint j = 0; j < pull_data->summary_shards->len && !found; j++)
+        {
+          GVariant *shard = pull_data->summary_shards->pdata[j];
+          g_autoptr(GVariant) shard_refs = g_variant_get_child_value (shard, 0);
+
+          if (ot_variant_bsearch_str (shard_refs, ref->ref_name, &i))
+            {
+              g_clear_pointer (&refs, g_variant_unref);
+              refs = g_steal_pointer (&shard_refs);
+              found = TRUE;
+            }
+        }
+    }
+
+  if (!found)
+    {
+      if (ref->collection_id != NULL)
+        return glnx_throw (error, "No such branch (%s, %s) in repository summary", ref->collection_id, ref->ref_name);
+      else
+        return glnx_throw (error, "No such branch '%s' in repository summary", ref->ref_name);
+    }
+
+  g_autoptr(GVariant) refdata = g_variant_get_child_value (refs, i);
+  g_autoptr(GVariant) reftargetdata = g_variant_get_child_value (refdata, 1);
+  guint64 commit_size;
+  g_autoptr(GVariant) commit_csum_v = NULL;
+  g_variant_get (reftargetdata, "(t@ay@a{sv})", &commit_size, &commit_csum_v, NULL);
+
+  if (resolved_collection_id != NULL &&
+      !ostree_validate_collection_id (resolved_collection_id, error))
+    return FALSE;
+  if (!ostree_validate_structureof_csum_v (commit_csum_v, error))
+    return FALSE;
+
+  *out_checksum = ostree_checksum_from_bytes_v (commit_csum_v);
+  *out_size = commit_size;
+  *out_collection_id = g_strdup (resolved_collection_id);
+  return TRUE;
+}
+
+static void
+fetch_object_data_free (FetchObjectData *fetch_data)
+{
+  g_variant_unref (fetch_data->object);
+  g_free (fetch_data->path);
+  if (fetch_data->requested_ref)
+    ostree_collection_ref_free (fetch_data->requested_ref);
+  g_free (fetch_data);
+}
+
+static void
+content_fetch_on_write_complete (GObject        *object,
+                                 GAsyncResult   *result,
+                                 gpointer        user_data)
+{
+  FetchObjectData *fetch_data = user_data;
+  OtPullData *pull_data = fetch_data->pull_data;
   g_autoptr(GError) local_error = NULL;
   GError **error = &local_error;
   OstreeObjectType objtype;
@@ -1058,7 +1736,8 @@ content_fetch_on_complete (GObject        *object,
   OstreeObjectType objtype;
   gboolean free_fetch_data = TRUE;
 
-  if (!_ostree_fetcher_request_to_tmpfile_finish (fetcher, result, &tmp_unlinker.path, error))
+  if (!_ostree_fetcher_request_to_tmpfile_finish (fetcher, result, &tmp_unlinker.path,
+                                                  NULL, error))
     goto out;
 
   ostree_object_name_deserialize (fetch_data->object, &checksum, &objtype);
@@ -1067,11 +1746,14 @@ content_fetch_on_complete (GObject        *object,
   checksum_obj = ostree_object_to_string (checksum, objtype);
   g_debug ("fetch of %s complete", checksum_obj);
 
-  /* If we're mirroring and writing into an archive repo, we can directly copy
-   * the content rather than paying the cost of exploding it, checksumming, and
-   * re-gzip.
+  /* If we're writing into an archive repo, the fetched .filez bytes are
+   * already in their final on-disk format, so we can move them directly into
+   * place rather than paying the cost of exploding, checksumming and
+   * re-gzipping them.  We still verify the content checksum by streaming
+   * through the decompressor — that's cheap next to recompression, which is
+   * what this path exists to avoid.
    */
-  if (pull_data->is_mirror && pull_data->repo->mode == OSTREE_REPO_MODE_ARCHIVE_Z2
+  if (pull_data->repo->mode == OSTREE_REPO_MODE_ARCHIVE_Z2
       && !pull_data->is_bareuseronly_files)
     {
       gboolean have_object;
@@ -1082,12 +1764,39 @@ content_fetch_on_complete (GObject        *object,
 
       if (!have_object)
         {
+          if (!ostree_content_file_parse_at (TRUE, _ostree_fetcher_get_dfd (fetcher),
+                                             tmp_unlinker.path, FALSE,
+                                             &file_in, &file_info, &xattrs,
+                                             cancellable, error))
+            goto out;
+
+          { g_autofree guchar *csum = NULL;
+            g_autofree char *actual_checksum = NULL;
+
+            if (!ostree_checksum_file_from_input (file_info, xattrs, file_in,
+                                                  OSTREE_OBJECT_TYPE_FILE,
+                                                  &csum, cancellable, error))
+              goto out;
+
+            actual_checksum = ostree_checksum_from_bytes (csum);
+            if (strcmp (actual_checksum, checksum) != 0)
+              {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                             "Corrupted content object; checksum expected='%s' actual='%s'",
+                             checksum, actual_checksum);
+                goto out;
+              }
+          }
+
           if (!_ostree_repo_commit_path_final (pull_data->repo, checksum, objtype,
                                                &tmp_unlinker,
                                                cancellable, error))
             goto out;
         }
       pull_data->n_fetched_content++;
+      /* Was this a delta fallback? */
+      if (g_hash_table_remove (pull_data->requested_fallback_content, checksum))
+        pull_data->n_fetched_deltapart_fallbacks++;
     }
   else
     {
@@ -1176,6 +1885,33 @@ on_metadata_written (GObject           *object,
   check_outstanding_requests_handle_error (pull_data, &local_error);
 }
 
+/* Structurally validate a fetched metadata object over its mapped buffer.
+ * The validators go through g_variant_is_normal_form(), which walks the
+ * serialized offsets and lengths in place and marks the variant trusted on
+ * success — unlike round-tripping through g_variant_get_normal_form(),
+ * which would copy the data.  This must happen before the object lands in
+ * the store, since loose metadata is mapped as trusted on later loads.
+ */
+static gboolean
+validate_metadata_structure (OstreeObjectType   objtype,
+                             GVariant          *variant,
+                             GError           **error)
+{
+  switch (objtype)
+    {
+    case OSTREE_OBJECT_TYPE_COMMIT:
+      return ostree_validate_structureof_commit (variant, error);
+    case OSTREE_OBJECT_TYPE_DIR_TREE:
+      return ostree_validate_structureof_dirtree (variant, error);
+    case OSTREE_OBJECT_TYPE_DIR_META:
+      return ostree_validate_structureof_dirmeta (variant, error);
+    default:
+      if (!g_variant_is_normal_form (variant))
+        return glnx_throw (error, "Not normal form");
+      return TRUE;
+    }
+}
+
 static void
 meta_fetch_on_complete (GObject           *object,
                         GAsyncResult      *result,
@@ -1188,6 +1924,7 @@ meta_fetch_on_complete (GObject           *object,
   g_auto(OtCleanupUnlinkat) tmp_unlinker = { _ostree_fetcher_get_dfd (fetcher), NULL };
   const char *checksum;
   g_autofree char *checksum_obj = NULL;
+  g_autofree char *fetched_checksum = NULL;
   OstreeObjectType objtype;
   g_autoptr(GError) local_error = NULL;
   GError **error = &local_error;
@@ -1199,7 +1936,8 @@ meta_fetch_on_complete (GObject           *object,
   g_debug ("fetch of %s%s complete", checksum_obj,
            fetch_data->is_detached_meta ? " (detached)" : "");
 
-  if (!_ostree_fetcher_request_to_tmpfile_finish (fetcher, result, &tmp_unlinker.path, error))
+  if (!_ostree_fetcher_request_to_tmpfile_finish (fetcher, result, &tmp_unlinker.path,
+                                                  &fetched_checksum, error))
     {
       if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
         {
@@ -1245,13 +1983,13 @@ meta_fetch_on_complete (GObject           *object,
   if (!glnx_openat_rdonly (_ostree_fetcher_get_dfd (fetcher), tmp_unlinker.path, TRUE, &fd, error))
     goto out;
 
-  /* Now delete it, keeping the fd open as the last reference; see comment in
-   * corresponding content fetch path.
-   */
-  ot_cleanup_unlinkat (&tmp_unlinker);
-
   if (fetch_data->is_detached_meta)
     {
+      /* Now delete it, keeping the fd open as the last reference; see comment
+       * in corresponding content fetch path.
+       */
+      ot_cleanup_unlinkat (&tmp_unlinker);
+
       if (!ot_util_variant_map_fd (fd, 0, G_VARIANT_TYPE ("a{sv}"),
                                    FALSE, &metadata, error))
         goto out;
@@ -1269,10 +2007,6 @@ meta_fetch_on_complete (GObject           *object,
     }
   else
     {
-      if (!ot_util_variant_map_fd (fd, 0, ostree_metadata_variant_type (objtype),
-                                   FALSE, &metadata, error))
-        goto out;
-
       /* Write the commitpartial file now while we're still fetching data */
       if (objtype == OSTREE_OBJECT_TYPE_COMMIT)
         {
@@ -1280,11 +2014,65 @@ meta_fetch_on_complete (GObject           *object,
             goto out;
         }
 
-      ostree_repo_write_metadata_async (pull_data->repo, objtype, checksum, metadata,
-                                        pull_data->cancellable,
-                                        on_metadata_written, fetch_data);
-      pull_data->n_outstanding_metadata_write_requests++;
-      free_fetch_data = FALSE;
+      if (fetched_checksum != NULL)
+        {
+          /* The fetcher checksummed the bytes as they arrived, so we can
+           * verify here and rename the tmpfile straight into the objects
+           * directory, skipping the read-back and rewrite in the metadata
+           * write path.  (The loose representation of a metadata object is
+           * the raw variant bytes in every repo mode.)
+           */
+          if (strcmp (fetched_checksum, checksum) != 0)
+            {
+              g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "Corrupted metadata object; checksum expected='%s' actual='%s'",
+                           checksum, fetched_checksum);
+              goto out;
+            }
+
+          {
+            g_autoptr(GVariant) fetched_variant = NULL;
+            if (!ot_util_variant_map_fd (fd, 0, ostree_metadata_variant_type (objtype),
+                                         FALSE, &fetched_variant, error))
+              goto out;
+            if (!validate_metadata_structure (objtype, fetched_variant, error))
+              goto out;
+          }
+
+          if (fchmod (fd, 0644) < 0)
+            {
+              glnx_set_error_from_errno (error);
+              goto out;
+            }
+
+          if (!_ostree_repo_commit_path_final (pull_data->repo, checksum, objtype,
+                                               &tmp_unlinker,
+                                               pull_data->cancellable, error))
+            goto out;
+
+          queue_scan_one_metadata_object (pull_data, checksum, objtype,
+                                          fetch_data->path, 0, fetch_data->requested_ref);
+        }
+      else
+        {
+          /* Now delete it, keeping the fd open as the last reference; see
+           * comment in corresponding content fetch path.
+           */
+          ot_cleanup_unlinkat (&tmp_unlinker);
+
+          if (!ot_util_variant_map_fd (fd, 0, ostree_metadata_variant_type (objtype),
+                                       FALSE, &metadata, error))
+            goto out;
+
+          if (!validate_metadata_structure (objtype, metadata, error))
+            goto out;
+
+          ostree_repo_write_metadata_async (pull_data->repo, objtype, checksum, metadata,
+                                            pull_data->cancellable,
+                                            on_metadata_written, fetch_data);
+          pull_data->n_outstanding_metadata_write_requests++;
+          free_fetch_data = FALSE;
+        }
     }
 
  out:
@@ -1339,18 +2127,35 @@ static_deltapart_fetch_on_complete (GObject           *object,
   FetchStaticDeltaData *fetch_data = user_data;
   OtPullData *pull_data = fetch_data->pull_data;
   g_autofree char *temp_path = NULL;
+  g_autofree char *fetched_checksum = NULL;
   g_autoptr(GInputStream) in = NULL;
-  g_autoptr(GVariant) part = NULL;
   g_autoptr(GError) local_error = NULL;
   GError **error = &local_error;
   glnx_fd_close int fd = -1;
   gboolean free_fetch_data = TRUE;
+  OstreeStaticDeltaOpenFlags delta_open_flags = 0;
 
   g_debug ("fetch static delta part %s complete", fetch_data->expected_checksum);
 
-  if (!_ostree_fetcher_request_to_tmpfile_finish (fetcher, result, &temp_path, error))
+  if (!_ostree_fetcher_request_to_tmpfile_finish (fetcher, result, &temp_path,
+                                                  &fetched_checksum, error))
     goto out;
 
+  /* If the fetcher checksummed the part as it arrived, verify it here and
+   * skip the redundant checksum read on the worker thread.
+   */
+  if (fetched_checksum != NULL)
+    {
+      if (strcmp (fetched_checksum, fetch_data->expected_checksum) != 0)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Corrupted static delta part; checksum expected='%s' actual='%s'",
+                       fetch_data->expected_checksum, fetched_checksum);
+          goto out;
+        }
+      delta_open_flags |= OSTREE_STATIC_DELTA_OPEN_FLAGS_SKIP_CHECKSUM;
+    }
+
   if (!glnx_openat_rdonly (_ostree_fetcher_get_dfd (fetcher), temp_path, TRUE, &fd, error))
     goto out;
 
@@ -1361,19 +2166,20 @@ static_deltapart_fetch_on_complete (GObject           *object,
       goto out;
     }
 
-  in = g_unix_input_stream_new (fd, FALSE);
-
-  /* TODO - make async */
-  if (!_ostree_static_delta_part_open (in, NULL, 0, fetch_data->expected_checksum,
-                                       &part, pull_data->cancellable, error))
-    goto out;
-
-  _ostree_static_delta_part_execute_async (pull_data->repo,
-                                           fetch_data->objects,
-                                           part,
-                                           pull_data->cancellable,
-                                           on_static_delta_written,
-                                           fetch_data);
+  /* Transfer ownership of the fd to the stream; the open (checksum and
+   * streaming decompression) happens on the worker thread together with
+   * opcode execution.
+   */
+  in = g_unix_input_stream_new (fd, TRUE);
+  fd = -1;
+
+  _ostree_static_delta_part_open_execute_async (pull_data->repo,
+                                                fetch_data->objects,
+                                                in, NULL, delta_open_flags,
+                                                fetch_data->expected_checksum,
+                                                pull_data->cancellable,
+                                                on_static_delta_written,
+                                                fetch_data);
   pull_data->n_outstanding_deltapart_write_requests++;
   free_fetch_data = FALSE;
 
@@ -1408,62 +2214,218 @@ process_verify_result (OtPullData            *pull_data,
   return TRUE;
 }
 
+/* GPG verification runs gpgme, which costs hundreds of milliseconds
+ * per commit; doing that synchronously stalls the fetcher queue.  We
+ * run the gpgme work on a worker thread and queue the result back to
+ * the main context.  The main loop (and hence the transaction commit)
+ * only finishes once every outstanding verify request has drained, so
+ * a bad signature still fails the pull before any ref is written.
+ */
+typedef struct {
+  OtPullData *pull_data;
+  char *checksum;
+  GVariant *commit;            /* Unwritten commit, or NULL when verifying a stored one */
+  GVariant *detached_metadata; /* (nullable) */
+  OstreeCollectionRef *requested_ref;  /* (nullable) */
+} GpgVerifyCommitData;
+
+static void
+gpg_verify_commit_data_free (GpgVerifyCommitData *data)
+{
+  g_free (data->checksum);
+  g_clear_pointer (&data->commit, (GDestroyNotify)g_variant_unref);
+  g_clear_pointer (&data->detached_metadata, (GDestroyNotify)g_variant_unref);
+  if (data->requested_ref != NULL)
+    ostree_collection_ref_free (data->requested_ref);
+  g_free (data);
+}
+
+/* Write the now-verified commit of a static delta: first its detached
+ * metadata (if any), then queue the commit object write itself.
+ */
 static gboolean
-gpg_verify_unwritten_commit (OtPullData         *pull_data,
-                             const char         *checksum,
-                             GVariant           *commit,
-                             GVariant           *detached_metadata,
-                             GCancellable       *cancellable,
-                             GError            **error)
+write_verified_delta_commit (OtPullData                 *pull_data,
+                             const char                 *checksum,
+                             GVariant                   *commit,
+                             GVariant                   *detached_metadata,
+                             const OstreeCollectionRef  *ref,
+                             GError                    **error)
 {
-  if (pull_data->gpg_verify)
-    {
-      g_autoptr(OstreeGpgVerifyResult) result = NULL;
-      g_autoptr(GBytes) signed_data = g_variant_get_data_as_bytes (commit);
+  FetchObjectData *fetch_data;
 
-      if (!detached_metadata)
-        {
-          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                       "Commit %s: no detached metadata found for GPG verification",
-                       checksum);
-          return FALSE;
-        }
+  if (detached_metadata &&
+      !ostree_repo_write_commit_detached_metadata (pull_data->repo,
+                                                   checksum,
+                                                   detached_metadata,
+                                                   pull_data->cancellable,
+                                                   error))
+    return FALSE;
 
-      result = _ostree_repo_gpg_verify_with_metadata (pull_data->repo,
-                                                      signed_data,
-                                                      detached_metadata,
-                                                      pull_data->remote_name,
-                                                      NULL, NULL,
-                                                      cancellable,
-                                                      error);
-      if (!process_verify_result (pull_data, checksum, result, error))
-        return FALSE;
-    }
+  fetch_data = g_new0 (FetchObjectData, 1);
+  fetch_data->pull_data = pull_data;
+  fetch_data->object = ostree_object_name_serialize (checksum, OSTREE_OBJECT_TYPE_COMMIT);
+  fetch_data->is_detached_meta = FALSE;
+  fetch_data->object_is_stored = FALSE;
+  fetch_data->requested_ref = (ref != NULL) ? ostree_collection_ref_dup (ref) : NULL;
 
+  ostree_repo_write_metadata_async (pull_data->repo, OSTREE_OBJECT_TYPE_COMMIT, checksum,
+                                    commit,
+                                    pull_data->cancellable,
+                                    on_metadata_written, fetch_data);
+  pull_data->n_outstanding_metadata_write_requests++;
   return TRUE;
 }
 
-static gboolean
-commitstate_is_partial (OtPullData   *pull_data,
-                        OstreeRepoCommitState commitstate)
+/* Runs in a worker thread */
+static void
+gpg_verify_unwritten_commit_thread (GTask        *task,
+                                    gpointer      source_object,
+                                    gpointer      task_data,
+                                    GCancellable *cancellable)
 {
-  return pull_data->legacy_transaction_resuming
-    || (commitstate & OSTREE_REPO_COMMIT_STATE_PARTIAL) > 0;
+  GpgVerifyCommitData *data = task_data;
+  GError *local_error = NULL;
+  g_autoptr(GBytes) signed_data = g_variant_get_data_as_bytes (data->commit);
+  OstreeGpgVerifyResult *result =
+    _ostree_repo_gpg_verify_with_metadata (data->pull_data->repo,
+                                           signed_data,
+                                           data->detached_metadata,
+                                           data->pull_data->remote_name,
+                                           NULL, NULL,
+                                           cancellable,
+                                           &local_error);
+  if (result == NULL)
+    g_task_return_error (task, local_error);
+  else
+    g_task_return_pointer (task, result, g_object_unref);
 }
 
-#ifdef OSTREE_ENABLE_EXPERIMENTAL_API
-/* Reads the collection-id of a given remote from the repo
- * configuration.
- */
-static char *
-get_real_remote_repo_collection_id (OstreeRepo  *repo,
-                                    const gchar *remote_name)
+static void
+on_gpg_verify_unwritten_complete (GObject      *object,
+                                  GAsyncResult *result,
+                                  gpointer      user_data)
 {
-  g_autofree gchar *remote_collection_id = NULL;
-  if (!ostree_repo_get_remote_option (repo, remote_name, "collection-id", NULL,
-                                      &remote_collection_id, NULL) ||
-      (remote_collection_id == NULL) ||
-      (remote_collection_id[0] == '\0'))
+  GpgVerifyCommitData *data = user_data;
+  OtPullData *pull_data = data->pull_data;
+  g_autoptr(GError) local_error = NULL;
+  GError **error = &local_error;
+  g_autoptr(OstreeGpgVerifyResult) verify_result =
+    g_task_propagate_pointer (G_TASK (result), error);
+
+  if (!process_verify_result (pull_data, data->checksum, verify_result, error))
+    goto out;
+
+  if (!write_verified_delta_commit (pull_data, data->checksum, data->commit,
+                                    data->detached_metadata, data->requested_ref,
+                                    error))
+    goto out;
+
+ out:
+  g_assert (pull_data->n_outstanding_gpg_verify_requests > 0);
+  pull_data->n_outstanding_gpg_verify_requests--;
+  check_outstanding_requests_handle_error (pull_data, &local_error);
+  gpg_verify_commit_data_free (data);
+}
+
+static void
+queue_gpg_verify_unwritten_commit (OtPullData                 *pull_data,
+                                   const char                 *checksum,
+                                   GVariant                   *commit,
+                                   GVariant                   *detached_metadata,
+                                   const OstreeCollectionRef  *ref)
+{
+  GpgVerifyCommitData *data = g_new0 (GpgVerifyCommitData, 1);
+  data->pull_data = pull_data;
+  data->checksum = g_strdup (checksum);
+  data->commit = g_variant_ref (commit);
+  data->detached_metadata = g_variant_ref (detached_metadata);
+  data->requested_ref = (ref != NULL) ? ostree_collection_ref_dup (ref) : NULL;
+
+  g_autoptr(GTask) task = g_task_new (pull_data->repo, pull_data->cancellable,
+                                      on_gpg_verify_unwritten_complete, data);
+  g_task_set_source_tag (task, queue_gpg_verify_unwritten_commit);
+  g_task_set_task_data (task, data, NULL);
+  pull_data->n_outstanding_gpg_verify_requests++;
+  g_task_run_in_thread (task, gpg_verify_unwritten_commit_thread);
+}
+
+/* Runs in a worker thread */
+static void
+gpg_verify_stored_commit_thread (GTask        *task,
+                                 gpointer      source_object,
+                                 gpointer      task_data,
+                                 GCancellable *cancellable)
+{
+  GpgVerifyCommitData *data = task_data;
+  GError *local_error = NULL;
+  OstreeGpgVerifyResult *result =
+    ostree_repo_verify_commit_for_remote (data->pull_data->repo,
+                                          data->checksum,
+                                          data->pull_data->remote_name,
+                                          cancellable,
+                                          &local_error);
+  if (result == NULL)
+    g_task_return_error (task, local_error);
+  else
+    g_task_return_pointer (task, result, g_object_unref);
+}
+
+static void
+on_gpg_verify_stored_complete (GObject      *object,
+                               GAsyncResult *result,
+                               gpointer      user_data)
+{
+  GpgVerifyCommitData *data = user_data;
+  OtPullData *pull_data = data->pull_data;
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(OstreeGpgVerifyResult) verify_result =
+    g_task_propagate_pointer (G_TASK (result), &local_error);
+
+  (void) process_verify_result (pull_data, data->checksum, verify_result, &local_error);
+
+  g_assert (pull_data->n_outstanding_gpg_verify_requests > 0);
+  pull_data->n_outstanding_gpg_verify_requests--;
+  check_outstanding_requests_handle_error (pull_data, &local_error);
+  gpg_verify_commit_data_free (data);
+}
+
+static void
+queue_gpg_verify_stored_commit (OtPullData *pull_data,
+                                const char *checksum)
+{
+  GpgVerifyCommitData *data = g_new0 (GpgVerifyCommitData, 1);
+  data->pull_data = pull_data;
+  data->checksum = g_strdup (checksum);
+
+  g_autoptr(GTask) task = g_task_new (pull_data->repo, pull_data->cancellable,
+                                      on_gpg_verify_stored_complete, data);
+  g_task_set_source_tag (task, queue_gpg_verify_stored_commit);
+  g_task_set_task_data (task, data, NULL);
+  pull_data->n_outstanding_gpg_verify_requests++;
+  g_task_run_in_thread (task, gpg_verify_stored_commit_thread);
+}
+
+static gboolean
+commitstate_is_partial (OtPullData   *pull_data,
+                        OstreeRepoCommitState commitstate)
+{
+  return pull_data->legacy_transaction_resuming
+    || (commitstate & OSTREE_REPO_COMMIT_STATE_PARTIAL) > 0;
+}
+
+#ifdef OSTREE_ENABLE_EXPERIMENTAL_API
+/* Reads the collection-id of a given remote from the repo
+ * configuration.
+ */
+static char *
+get_real_remote_repo_collection_id (OstreeRepo  *repo,
+                                    const gchar *remote_name)
+{
+  g_autofree gchar *remote_collection_id = NULL;
+  if (!ostree_repo_get_remote_option (repo, remote_name, "collection-id", NULL,
+                                      &remote_collection_id, NULL) ||
+      (remote_collection_id == NULL) ||
+      (remote_collection_id[0] == '\0'))
     return NULL;
 
   return g_steal_pointer (&remote_collection_id);
@@ -1618,22 +2580,17 @@ scan_commit_object (OtPullData                 *pull_data,
   else
     {
       depth = pull_data->maxdepth;
-      g_hash_table_insert (pull_data->commit_to_depth, g_strdup (checksum),
+      g_hash_table_insert (pull_data->commit_to_depth,
+                           (char*)_ostree_repo_intern_checksum (pull_data->repo, checksum),
                            GINT_TO_POINTER (depth));
     }
 
+  /* Signature verification happens on a worker thread while we keep
+   * scanning; a failure surfaces through caught_error and aborts the
+   * pull (and its transaction) before any ref is written.
+   */
   if (pull_data->gpg_verify)
-    {
-      g_autoptr(OstreeGpgVerifyResult) result = NULL;
-
-      result = ostree_repo_verify_commit_for_remote (pull_data->repo,
-                                                     checksum,
-                                                     pull_data->remote_name,
-                                                     cancellable,
-                                                     error);
-      if (!process_verify_result (pull_data, checksum, result, error))
-        goto out;
-    }
+    queue_gpg_verify_stored_commit (pull_data, checksum);
 
   if (!ostree_repo_load_commit (pull_data->repo, checksum, &commit, &commitstate, error))
     goto out;
@@ -1659,11 +2616,13 @@ scan_commit_object (OtPullData                 *pull_data,
         goto out;
     }
 
+  gboolean scanning_parent = FALSE;
   if (parent_csum_bytes != NULL && pull_data->maxdepth == -1)
     {
       queue_scan_one_metadata_object_c (pull_data, parent_csum_bytes,
                                         OSTREE_OBJECT_TYPE_COMMIT, NULL,
                                         recursion_depth + 1, NULL);
+      scanning_parent = TRUE;
     }
   else if (parent_csum_bytes != NULL && depth > 0)
     {
@@ -1672,7 +2631,7 @@ scan_commit_object (OtPullData                 *pull_data,
       int parent_depth;
 
       ostree_checksum_inplace_from_bytes (parent_csum_bytes, parent_checksum);
-  
+
       if (g_hash_table_lookup_extended (pull_data->commit_to_depth, parent_checksum,
                                         NULL, &parent_depthp))
         {
@@ -1685,13 +2644,44 @@ scan_commit_object (OtPullData                 *pull_data,
 
       if (parent_depth >= 0)
         {
-          g_hash_table_insert (pull_data->commit_to_depth, g_strdup (parent_checksum),
+          g_hash_table_insert (pull_data->commit_to_depth,
+                               (char*)_ostree_repo_intern_checksum (pull_data->repo, parent_checksum),
                                GINT_TO_POINTER (parent_depth));
           queue_scan_one_metadata_object_c (pull_data, parent_csum_bytes,
                                             OSTREE_OBJECT_TYPE_COMMIT,
                                             NULL,
                                             recursion_depth + 1,
                                             NULL);
+          scanning_parent = TRUE;
+        }
+    }
+
+  /* Maintain the shallow history boundary: a commit whose parent is
+   * missing because of a depth limit gets a state/$checksum.shallow
+   * marker, which the "deepen" pull option later resumes from.  We
+   * only drop a marker once the parent is actually stored, so an
+   * interrupted deepen can't lose the boundary.
+   */
+  if (parent_csum_bytes != NULL)
+    {
+      char parent_checksum[OSTREE_SHA256_STRING_LEN+1];
+      gboolean have_parent;
+
+      ostree_checksum_inplace_from_bytes (parent_csum_bytes, parent_checksum);
+      if (!ostree_repo_has_object (pull_data->repo, OSTREE_OBJECT_TYPE_COMMIT,
+                                   parent_checksum, &have_parent,
+                                   cancellable, error))
+        goto out;
+
+      if (have_parent)
+        {
+          if (!delete_shallow_for (pull_data, checksum, error))
+            goto out;
+        }
+      else if (!scanning_parent)
+        {
+          if (!write_shallow_for (pull_data, checksum, error))
+            goto out;
         }
     }
 
@@ -1729,6 +2719,105 @@ scan_commit_object (OtPullData                 *pull_data,
   return ret;
 }
 
+/* Spill record layout: a guint32 payload length, then the payload:
+ * 32-byte binary checksum, one byte of object type, and three
+ * nul-terminated strings (path, collection id, ref name; the latter two
+ * empty when there is no requested ref). */
+static gboolean
+scan_spill_write_entry (OtPullData                *pull_data,
+                        const guchar              *csum,
+                        OstreeObjectType           objtype,
+                        const char                *path,
+                        const OstreeCollectionRef *ref)
+{
+  g_autoptr(GByteArray) rec = g_byte_array_new ();
+  const guint8 objtype_u8 = (guint8)objtype;
+  const char *pathstr = path ?: "";
+  const char *collection_id = (ref != NULL && ref->collection_id != NULL) ? ref->collection_id : "";
+  const char *ref_name = (ref != NULL) ? ref->ref_name : "";
+  guint32 len = 0;
+
+  if (!pull_data->scan_spill_tmpf.initialized)
+    {
+      if (!glnx_open_anonymous_tmpfile (O_RDWR | O_CLOEXEC,
+                                        &pull_data->scan_spill_tmpf, NULL))
+        return FALSE;
+    }
+
+  g_byte_array_append (rec, (const guint8 *)&len, sizeof (len)); /* Placeholder */
+  g_byte_array_append (rec, csum, OSTREE_SHA256_DIGEST_LEN);
+  g_byte_array_append (rec, &objtype_u8, 1);
+  g_byte_array_append (rec, (const guint8 *)pathstr, strlen (pathstr) + 1);
+  g_byte_array_append (rec, (const guint8 *)collection_id, strlen (collection_id) + 1);
+  g_byte_array_append (rec, (const guint8 *)ref_name, strlen (ref_name) + 1);
+
+  len = rec->len - sizeof (len);
+  memcpy (rec->data, &len, sizeof (len));
+
+  /* Writes append (only they move the fd offset; reads use pread) */
+  if (glnx_loop_write (pull_data->scan_spill_tmpf.fd, rec->data, rec->len) < 0)
+    return FALSE;
+
+  pull_data->scan_spill_count++;
+  return TRUE;
+}
+
+/* Move up to a queue's worth of spilled entries back into memory */
+static gboolean
+scan_spill_refill (OtPullData  *pull_data,
+                   GError     **error)
+{
+  guint budget = MAX (pull_data->scan_queue_max_in_memory, 1);
+
+  while (budget > 0 && pull_data->scan_spill_count > 0)
+    {
+      guint32 len;
+      ssize_t bytes_read;
+
+      bytes_read = TEMP_FAILURE_RETRY (pread (pull_data->scan_spill_tmpf.fd,
+                                              &len, sizeof (len),
+                                              pull_data->scan_spill_read_offset));
+      if (bytes_read != sizeof (len)
+          || len < OSTREE_SHA256_DIGEST_LEN + 1 + 3)
+        {
+          pull_data->scan_spill_count = 0;
+          return glnx_throw (error, "Corrupted scan spill file");
+        }
+
+      g_autofree guint8 *buf = g_malloc (len + 1);
+      bytes_read = TEMP_FAILURE_RETRY (pread (pull_data->scan_spill_tmpf.fd, buf, len,
+                                              pull_data->scan_spill_read_offset + sizeof (len)));
+      if (bytes_read != (ssize_t)len)
+        {
+          pull_data->scan_spill_count = 0;
+          return glnx_throw (error, "Corrupted scan spill file");
+        }
+      buf[len] = '\0';  /* Ensure the trailing string terminates */
+
+      const char *pathstr = (const char *)buf + OSTREE_SHA256_DIGEST_LEN + 1;
+      const char *collection_id = pathstr + strlen (pathstr) + 1;
+      const char *ref_name = collection_id + strlen (collection_id) + 1;
+
+      ScanObjectQueueData *scan_data = g_new0 (ScanObjectQueueData, 1);
+      memcpy (scan_data->csum, buf, sizeof (scan_data->csum));
+      scan_data->objtype = buf[OSTREE_SHA256_DIGEST_LEN];
+      scan_data->path = (*pathstr != '\0') ? g_strdup (pathstr) : NULL;
+      if (*ref_name != '\0')
+        scan_data->requested_ref =
+          ostree_collection_ref_new (*collection_id != '\0' ? collection_id : NULL,
+                                     ref_name);
+
+      g_queue_push_tail (&pull_data->scan_object_queue, scan_data);
+      scan_prefetch_enqueue (pull_data, scan_data->csum, scan_data->objtype);
+
+      pull_data->scan_spill_read_offset += sizeof (len) + len;
+      pull_data->scan_spill_count--;
+      budget--;
+    }
+
+  return TRUE;
+}
+
 static void
 queue_scan_one_metadata_object (OtPullData                *pull_data,
                                 const char                *csum,
@@ -1750,6 +2839,43 @@ queue_scan_one_metadata_object_c (OtPullData                *pull_data,
                                   guint                      recursion_depth,
                                   const OstreeCollectionRef *ref)
 {
+  /* Commit objects jump to the front of the queue (and never spill).
+   * When mirroring history, the next parent link is only discovered by
+   * scanning the current commit; if commit scans queue FIFO behind the
+   * much larger dirtree/dirmeta backlog, the ancestry walk advances by
+   * one commit per full queue drain and the sync degenerates into
+   * per-commit stop-and-go.  Scanning commits first expands the whole
+   * commit frontier breadth-first while content fetches proceed behind
+   * it. */
+  if (objtype == OSTREE_OBJECT_TYPE_COMMIT)
+    {
+      ScanObjectQueueData *scan_data = g_new0 (ScanObjectQueueData, 1);
+
+      memcpy (scan_data->csum, csum, sizeof (scan_data->csum));
+      scan_data->objtype = objtype;
+      scan_data->path = g_strdup (path);
+      scan_data->recursion_depth = recursion_depth;
+      scan_data->requested_ref = (ref != NULL) ? ostree_collection_ref_dup (ref) : NULL;
+
+      g_queue_push_head (&pull_data->scan_object_queue, scan_data);
+      scan_prefetch_enqueue (pull_data, csum, objtype);
+      ensure_idle_queued (pull_data);
+      return;
+    }
+
+  /* Bounded-memory mode: once the in-memory queue is at its cap — or a
+   * spill backlog already exists, to preserve FIFO order — append the
+   * entry to the spill file instead.  On any spill failure just fall
+   * through to the in-memory queue. */
+  if (pull_data->scan_queue_max_in_memory > 0
+      && (pull_data->scan_spill_count > 0
+          || pull_data->scan_object_queue.length >= pull_data->scan_queue_max_in_memory)
+      && scan_spill_write_entry (pull_data, csum, objtype, path, ref))
+    {
+      ensure_idle_queued (pull_data);
+      return;
+    }
+
   ScanObjectQueueData *scan_data = g_new0 (ScanObjectQueueData, 1);
 
   memcpy (scan_data->csum, csum, sizeof (scan_data->csum));
@@ -1759,6 +2885,7 @@ queue_scan_one_metadata_object_c (OtPullData                *pull_data,
   scan_data->requested_ref = (ref != NULL) ? ostree_collection_ref_dup (ref) : NULL;
 
   g_queue_push_tail (&pull_data->scan_object_queue, scan_data);
+  scan_prefetch_enqueue (pull_data, csum, objtype);
   ensure_idle_queued (pull_data);
 }
 
@@ -1773,12 +2900,15 @@ scan_one_metadata_object_c (OtPullData                 *pull_data,
                             GError                    **error)
 {
   g_autofree char *tmp_checksum = ostree_checksum_from_bytes (csum);
-  g_autoptr(GVariant) object = ostree_object_name_serialize (tmp_checksum, objtype);
+  OstreeObjectNameBin object;
+  _ostree_object_name_bin_init (&object, csum, objtype);
+
+  ostree_probe2 (scan_object, tmp_checksum, objtype);
 
-  if (g_hash_table_lookup (pull_data->scanned_metadata, object))
+  if (g_hash_table_lookup (pull_data->scanned_metadata, &object))
     return TRUE;
 
-  gboolean is_requested = g_hash_table_lookup (pull_data->requested_metadata, object) != NULL;
+  gboolean is_requested = g_hash_table_lookup (pull_data->requested_metadata, &object) != NULL;
   gboolean is_stored;
   if (!ostree_repo_has_object (pull_data->repo, objtype, tmp_checksum, &is_stored,
                                cancellable, error))
@@ -1838,7 +2968,7 @@ scan_one_metadata_object_c (OtPullData                 *pull_data,
     {
       gboolean do_fetch_detached;
 
-      g_hash_table_add (pull_data->requested_metadata, g_variant_ref (object));
+      g_hash_table_add (pull_data->requested_metadata, g_memdup (&object, sizeof (object)));
 
       do_fetch_detached = (objtype == OSTREE_OBJECT_TYPE_COMMIT);
       enqueue_one_object_request (pull_data, tmp_checksum, objtype, path, do_fetch_detached, FALSE, ref);
@@ -1847,8 +2977,17 @@ scan_one_metadata_object_c (OtPullData                 *pull_data,
     {
       /* Even though we already have the commit, we always try to (re)fetch the
        * detached metadata before scanning it, in case new signatures appear.
-       * https://github.com/projectatomic/rpm-ostree/issues/630 */
-      if (!g_hash_table_contains (pull_data->fetched_detached_metadata, tmp_checksum))
+       * https://github.com/projectatomic/rpm-ostree/issues/630
+       *
+       * Ref-catalog mirrors can opt out of the refresh via the
+       * disable-commitmeta-refresh pull option: for commit-only syncs
+       * over tens of thousands of mostly-unchanged refs, those
+       * refetches are essentially the entire network cost.  Any
+       * detached metadata the remote had when the commit was fetched
+       * was stored alongside it then.
+       */
+      if (!g_hash_table_contains (pull_data->fetched_detached_metadata, tmp_checksum)
+          && !pull_data->disable_commitmeta_refresh)
         enqueue_one_object_request (pull_data, tmp_checksum, objtype, path, TRUE, TRUE, ref);
       else
         {
@@ -1856,17 +2995,27 @@ scan_one_metadata_object_c (OtPullData                 *pull_data,
                                    pull_data->cancellable, error))
             return FALSE;
 
-          g_hash_table_add (pull_data->scanned_metadata, g_variant_ref (object));
+          g_hash_table_add (pull_data->scanned_metadata, g_memdup (&object, sizeof (object)));
           pull_data->n_scanned_metadata++;
         }
     }
   else if (is_stored && objtype == OSTREE_OBJECT_TYPE_DIR_TREE)
     {
+      /* If a previous successful pull recorded this subtree as fully
+       * present, there's nothing to traverse below it.
+       */
+      if (scanned_subtree_index_contains (pull_data, csum))
+        {
+          g_hash_table_add (pull_data->scanned_metadata, g_memdup (&object, sizeof (object)));
+          pull_data->n_scanned_metadata++;
+          return TRUE;
+        }
+
       if (!scan_dirtree_object (pull_data, tmp_checksum, path, recursion_depth,
                                 pull_data->cancellable, error))
         return FALSE;
 
-      g_hash_table_add (pull_data->scanned_metadata, g_variant_ref (object));
+      g_hash_table_add (pull_data->scanned_metadata, g_memdup (&object, sizeof (object)));
       pull_data->n_scanned_metadata++;
     }
 
@@ -1901,7 +3050,8 @@ enqueue_one_object_request (OtPullData                *pull_data,
     pull_data->n_requested_content++;
 
   /* Are too many requests are in flight? */
-  if (fetcher_queue_is_full (pull_data))
+  if (is_meta ? fetcher_queue_is_full (pull_data)
+              : fetcher_queue_is_full_for_data (pull_data))
     {
       g_debug ("queuing fetch of %s.%s%s", checksum,
                ostree_object_type_to_string (objtype),
@@ -1909,12 +3059,17 @@ enqueue_one_object_request (OtPullData                *pull_data,
 
       if (is_meta)
         {
-          GVariant *objname = ostree_object_name_serialize (checksum, objtype);
+          OstreeObjectNameBin *objname = g_new (OstreeObjectNameBin, 1);
+          guchar csum[OSTREE_SHA256_DIGEST_LEN];
+
+          ostree_checksum_inplace_to_bytes (checksum, csum);
+          _ostree_object_name_bin_init (objname, csum, objtype);
           g_hash_table_insert (pull_data->pending_fetch_metadata, objname, fetch_data);
         }
       else
         {
-          g_hash_table_insert (pull_data->pending_fetch_content, g_strdup (checksum), fetch_data);
+          g_hash_table_insert (pull_data->pending_fetch_content,
+                               ostree_checksum_to_bytes (checksum), fetch_data);
         }
     }
   else
@@ -1962,6 +3117,14 @@ start_fetch (OtPullData *pull_data,
     {
       obj_subpath = _ostree_get_relative_object_path (expected_checksum, objtype, TRUE);
       mirrorlist = pull_data->content_mirrorlist;
+
+      /* For metadata the fetched bytes are exactly the object, so let the
+       * fetcher checksum them in flight; see meta_fetch_on_complete().
+       * (Content objects are fetched in their compressed representation,
+       * whose digest is not the object checksum.)
+       */
+      if (is_meta)
+        flags |= OSTREE_FETCHER_REQUEST_COMPUTE_CHECKSUM;
     }
 
   /* We may have determined maximum sizes from the summary file content; if so,
@@ -2055,16 +3218,17 @@ process_one_static_delta_fallback (OtPullData   *pull_data,
                            ostree_object_type_to_string (objtype));
       else
         {
-          if (!g_hash_table_lookup (pull_data->requested_content, checksum))
+          const guchar *csum_bytes = ostree_checksum_bytes_peek (csum_v);
+          if (!g_hash_table_lookup (pull_data->requested_content, csum_bytes))
             {
               /* Mark this as requested, like we do in the non-delta path */
-              g_hash_table_add (pull_data->requested_content, checksum);
+              g_hash_table_add (pull_data->requested_content,
+                                g_memdup (csum_bytes, OSTREE_SHA256_DIGEST_LEN));
               /* But also record it's a delta fallback object, so we can account
                * for it as logically part of the delta fetch.
                */
               g_hash_table_add (pull_data->requested_fallback_content, g_strdup (checksum));
               enqueue_one_object_request (pull_data, checksum, OSTREE_OBJECT_TYPE_FILE, NULL, FALSE, FALSE, NULL);
-              checksum = NULL;  /* We transferred ownership to the requested_content hash */
             }
         }
     }
@@ -2081,7 +3245,9 @@ start_fetch_deltapart (OtPullData *pull_data,
   g_assert_cmpint (pull_data->n_outstanding_deltapart_fetches, <=, _OSTREE_MAX_OUTSTANDING_DELTAPART_REQUESTS);
   _ostree_fetcher_request_to_tmpfile (pull_data->fetcher,
                                       pull_data->content_mirrorlist,
-                                      deltapart_path, 0, fetch->size,
+                                      deltapart_path,
+                                      OSTREE_FETCHER_REQUEST_COMPUTE_CHECKSUM,
+                                      fetch->size,
                                       OSTREE_FETCHER_DEFAULT_PRIORITY,
                                       pull_data->cancellable,
                                       static_deltapart_fetch_on_complete,
@@ -2147,36 +3313,32 @@ process_one_static_delta (OtPullData                 *pull_data,
     
     if (!have_to_commit)
       {
-        FetchObjectData *fetch_data;
         g_autoptr(GVariant) to_commit = g_variant_get_child_value (delta_superblock, 4);
         g_autofree char *detached_path = _ostree_get_relative_static_delta_path (from_revision, to_revision, "commitmeta");
         g_autoptr(GVariant) detached_data = NULL;
 
         detached_data = g_variant_lookup_value (metadata, detached_path, G_VARIANT_TYPE("a{sv}"));
 
-        if (!gpg_verify_unwritten_commit (pull_data, to_revision, to_commit, detached_data,
-                                          cancellable, error))
-          goto out;
+        if (pull_data->gpg_verify)
+          {
+            if (!detached_data)
+              {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                             "Commit %s: no detached metadata found for GPG verification",
+                             to_revision);
+                goto out;
+              }
 
-        if (detached_data && !ostree_repo_write_commit_detached_metadata (pull_data->repo,
-                                                                          to_revision,
-                                                                          detached_data,
-                                                                          cancellable,
-                                                                          error))
+            /* The commit is written by the completion handler once
+             * verification succeeds; meanwhile the part fetches below
+             * keep the network busy.
+             */
+            queue_gpg_verify_unwritten_commit (pull_data, to_revision, to_commit,
+                                               detached_data, ref);
+          }
+        else if (!write_verified_delta_commit (pull_data, to_revision, to_commit,
+                                               detached_data, ref, error))
           goto out;
-
-        fetch_data = g_new0 (FetchObjectData, 1);
-        fetch_data->pull_data = pull_data;
-        fetch_data->object = ostree_object_name_serialize (to_checksum, OSTREE_OBJECT_TYPE_COMMIT);
-        fetch_data->is_detached_meta = FALSE;
-        fetch_data->object_is_stored = FALSE;
-        fetch_data->requested_ref = (ref != NULL) ? ostree_collection_ref_dup (ref) : NULL;
-
-        ostree_repo_write_metadata_async (pull_data->repo, OSTREE_OBJECT_TYPE_COMMIT, to_checksum,
-                                          to_commit,
-                                          pull_data->cancellable,
-                                          on_metadata_written, fetch_data);
-        pull_data->n_outstanding_metadata_write_requests++;
       }
   }
 
@@ -2257,26 +3419,21 @@ process_one_static_delta (OtPullData                 *pull_data,
       if (inline_part_bytes != NULL)
         {
           g_autoptr(GInputStream) memin = g_memory_input_stream_new_from_bytes (inline_part_bytes);
-          g_autoptr(GVariant) inline_delta_part = NULL;
 
           /* For inline parts we are relying on per-commit GPG, so don't bother checksumming. */
-          if (!_ostree_static_delta_part_open (memin, inline_part_bytes,
-                                               OSTREE_STATIC_DELTA_OPEN_FLAGS_SKIP_CHECKSUM,
-                                               NULL, &inline_delta_part,
-                                               cancellable, error))
-            goto out;
-
-          _ostree_static_delta_part_execute_async (pull_data->repo,
-                                                   fetch_data->objects,
-                                                   inline_delta_part,
-                                                   pull_data->cancellable,
-                                                   on_static_delta_written,
-                                                   fetch_data);
+          _ostree_static_delta_part_open_execute_async (pull_data->repo,
+                                                        fetch_data->objects,
+                                                        memin, inline_part_bytes,
+                                                        OSTREE_STATIC_DELTA_OPEN_FLAGS_SKIP_CHECKSUM,
+                                                        NULL,
+                                                        pull_data->cancellable,
+                                                        on_static_delta_written,
+                                                        fetch_data);
           pull_data->n_outstanding_deltapart_write_requests++;
         }
       else
         {
-          if (!fetcher_queue_is_full (pull_data))
+          if (!fetcher_queue_is_full_for_data (pull_data))
             start_fetch_deltapart (pull_data, fetch_data);
           else
             {
@@ -2337,6 +3494,12 @@ get_best_static_delta_start_for (OtPullData *pull_data,
       g_autofree char *cur_from_rev = NULL;
       g_autofree char *cur_to_rev = NULL;
 
+      /* Dual-endian superblock variant entries ("<delta>.l"/"<delta>.B")
+       * alias a delta already listed under its canonical name.
+       */
+      if (g_str_has_suffix (delta_name, ".l") || g_str_has_suffix (delta_name, ".B"))
+        continue;
+
       /* Gracefully handle corrupted (or malicious) summary files */
       if (!_ostree_parse_delta_name (delta_name, &cur_from_rev, &cur_to_rev, error))
         return FALSE;
@@ -2408,6 +3571,303 @@ set_required_deltas_error (GError **error,
                from_revision, to_revision);
 }
 
+/* Cost model deciding whether applying a static delta actually beats
+ * fetching the changed objects loose.  LZMA-compressed deltas optimize
+ * for bytes on the wire; on a fast LAN the decode is the bottleneck and
+ * pulling the loose objects directly can be faster.  We only have the
+ * superblock to go on, so the model is deliberately rough: the delta
+ * costs its compressed bytes at the measured link bandwidth plus an
+ * LZMA decode of the uncompressed payload; the loose path costs the
+ * changed objects (approximated by the delta's uncompressed payload,
+ * halved for the remote's zlib packing) plus per-request overhead.
+ */
+#define COST_MODEL_MIN_SAMPLE_BYTES (64 * 1024)
+#define COST_MODEL_MIN_SAMPLE_USECS (100 * 1000)
+#define COST_MODEL_XZ_DECODE_BYTES_PER_USEC (64) /* ~64 MB/s */
+#define COST_MODEL_REQUEST_OVERHEAD_USECS (2 * 1000)
+
+static gboolean
+delta_is_worth_applying (OtPullData *pull_data,
+                         GVariant   *delta_superblock,
+                         const char *from_revision,
+                         const char *to_revision)
+{
+  /* No choice to make in these cases; dry-run only works on deltas */
+  if (pull_data->require_static_deltas || pull_data->disable_delta_cost_model
+      || pull_data->dry_run)
+    return TRUE;
+
+  /* Bandwidth as observed so far this pull (summary, delta index,
+   * superblock...).  If we haven't transferred enough to have a
+   * meaningful sample, preserve the historical delta preference.
+   */
+  const guint64 elapsed_usecs = g_get_monotonic_time () - pull_data->start_time;
+  const guint64 bytes_transferred = pull_bytes_transferred (pull_data);
+  if (elapsed_usecs < COST_MODEL_MIN_SAMPLE_USECS
+      || bytes_transferred < COST_MODEL_MIN_SAMPLE_BYTES)
+    return TRUE;
+  const double bytes_per_usec = (double)bytes_transferred / elapsed_usecs;
+
+  const gboolean delta_byteswap = _ostree_delta_needs_byteswap (delta_superblock);
+  g_autoptr(GVariant) headers = g_variant_get_child_value (delta_superblock, 6);
+  guint64 compressed_size = 0;
+  guint64 uncompressed_size = 0;
+  guint64 n_objects = 0;
+  const guint n = g_variant_n_children (headers);
+  for (guint i = 0; i < n; i++)
+    {
+      g_autoptr(GVariant) header = g_variant_get_child_value (headers, i);
+      guint32 version;
+      guint64 size, usize;
+      g_autoptr(GVariant) csum_v = NULL;
+      g_autoptr(GVariant) objects = NULL;
+
+      g_variant_get (header, "(u@aytt@ay)", &version, &csum_v, &size, &usize, &objects);
+      compressed_size += maybe_swap_endian_u64 (delta_byteswap, size);
+      uncompressed_size += maybe_swap_endian_u64 (delta_byteswap, usize);
+      n_objects += g_variant_n_children (objects) / OSTREE_STATIC_DELTA_OBJTYPE_CSUM_LEN;
+    }
+  /* Fallback objects are fetched loose on both paths, so they cancel out */
+
+  const double delta_usecs = compressed_size / bytes_per_usec
+    + (double)uncompressed_size / COST_MODEL_XZ_DECODE_BYTES_PER_USEC;
+  const double loose_usecs = (uncompressed_size / 2) / bytes_per_usec
+    + (double)n_objects * COST_MODEL_REQUEST_OVERHEAD_USECS;
+
+  /* The loose estimate is the shakier of the two, so only skip the
+   * delta when it's clearly slower.
+   */
+  if (delta_usecs > loose_usecs * 2)
+    {
+      g_debug ("Skipping delta %s-%s: estimated %.0fms vs %.0fms loose "
+               "(%" G_GUINT64_FORMAT " compressed, %" G_GUINT64_FORMAT " objects, %.2f MB/s)",
+               from_revision ?: "empty", to_revision,
+               delta_usecs / 1000, loose_usecs / 1000,
+               compressed_size, n_objects, bytes_per_usec);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Parse a fetched object manifest (the sorted `a(sut)` of (checksum,
+ * objtype, stored size) written by ostree_repo_regenerate_summary()),
+ * set-difference it against the local repository, and enqueue a fetch
+ * for every missing object immediately.  The iterative commit scan is
+ * still queued and establishes all the usual invariants (commitpartial
+ * markers, GPG verification, ref writes); it just finds each object
+ * already requested or stored instead of discovering it one dirtree
+ * round-trip at a time.
+ *
+ * The manifest itself is unauthenticated, but every fetched object is
+ * verified against its checksum on write, so a hostile manifest can at
+ * worst cause valid-but-unneeded objects to be fetched.
+ */
+static gboolean
+process_object_manifest (OtPullData  *pull_data,
+                         GBytes      *manifest_data,
+                         GError     **error)
+{
+  g_autoptr(GVariant) manifest =
+    g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE ("a(sut)"),
+                                                  manifest_data, FALSE));
+  if (!g_variant_is_normal_form (manifest))
+    return glnx_throw (error, "Invalid object manifest");
+
+  const gsize n = g_variant_n_children (manifest);
+  g_autoptr(GPtrArray) objects =
+    g_ptr_array_new_full (n, (GDestroyNotify)g_variant_unref);
+
+  for (gsize i = 0; i < n; i++)
+    {
+      const char *checksum;
+      guint32 objtype_u;
+      guint64 size;
+
+      g_variant_get_child (manifest, i, "(&sut)", &checksum, &objtype_u, &size);
+      OstreeObjectType objtype = (OstreeObjectType)GUINT32_FROM_BE (objtype_u);
+
+      if (objtype < OSTREE_OBJECT_TYPE_FILE || objtype > OSTREE_OBJECT_TYPE_COMMIT)
+        continue;
+      if (!ostree_validate_checksum_string (checksum, NULL))
+        return glnx_throw (error, "Invalid checksum in object manifest");
+
+      g_ptr_array_add (objects,
+                       g_variant_ref_sink (ostree_object_name_serialize (checksum, objtype)));
+    }
+
+  g_autoptr(GHashTable) found = NULL;
+  if (!ostree_repo_has_objects_batch (pull_data->repo, objects, &found,
+                                      pull_data->cancellable, error))
+    return FALSE;
+
+  for (guint i = 0; i < objects->len; i++)
+    {
+      GVariant *objname = objects->pdata[i];
+
+      if (g_hash_table_contains (found, objname))
+        continue;
+
+      const char *checksum;
+      OstreeObjectType objtype;
+      ostree_object_name_deserialize (objname, &checksum, &objtype);
+
+      guchar csum[OSTREE_SHA256_DIGEST_LEN];
+      ostree_checksum_inplace_to_bytes (checksum, csum);
+
+      if (objtype == OSTREE_OBJECT_TYPE_FILE)
+        {
+          if (g_hash_table_lookup (pull_data->requested_content, csum))
+            continue;
+          g_hash_table_add (pull_data->requested_content,
+                            g_memdup (csum, OSTREE_SHA256_DIGEST_LEN));
+          enqueue_one_object_request (pull_data, checksum, OSTREE_OBJECT_TYPE_FILE,
+                                      NULL, FALSE, FALSE, NULL);
+        }
+      else
+        {
+          OstreeObjectNameBin object;
+          _ostree_object_name_bin_init (&object, csum, objtype);
+          if (g_hash_table_lookup (pull_data->requested_metadata, &object))
+            continue;
+          g_hash_table_add (pull_data->requested_metadata,
+                            g_memdup (&object, sizeof (object)));
+          enqueue_one_object_request (pull_data, checksum, objtype, NULL,
+                                      objtype == OSTREE_OBJECT_TYPE_COMMIT, FALSE, NULL);
+        }
+    }
+
+  return TRUE;
+}
+
+static void
+on_object_manifest_fetched (GObject      *src,
+                            GAsyncResult *res,
+                            gpointer      data)
+{
+  OtPullData *pull_data = data;
+  g_autoptr(GError) local_error = NULL;
+  GError **error = &local_error;
+  g_autoptr(GBytes) manifest_data = NULL;
+
+  if (!_ostree_fetcher_request_to_membuf_finish ((OstreeFetcher*)src,
+                                                 res,
+                                                 &manifest_data,
+                                                 NULL, NULL, NULL,
+                                                 error))
+    {
+      /* The manifest is an optional accelerator; a repository without
+       * one just takes the iterative scan path that's already queued.
+       */
+      if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+        g_clear_error (&local_error);
+    }
+  else
+    (void) process_object_manifest (pull_data, manifest_data, error);
+
+  g_assert (pull_data->n_outstanding_metadata_fetches > 0);
+  pull_data->n_outstanding_metadata_fetches--;
+  pull_data->n_fetched_metadata++;
+  check_outstanding_requests_handle_error (pull_data, &local_error);
+}
+
+/* Kick off a (deduplicated) fetch of the object manifest for
+ * @to_revision, alongside the commit scan the caller queued.
+ */
+static void
+initiate_object_manifest_request (OtPullData *pull_data,
+                                  const char *to_revision)
+{
+  if (pull_data->remote_repo_local != NULL || pull_data->dry_run)
+    return;
+  if (g_hash_table_contains (pull_data->requested_manifests, to_revision))
+    return;
+  g_hash_table_add (pull_data->requested_manifests, g_strdup (to_revision));
+
+  g_autofree char *manifest_path = _ostree_get_relative_object_manifest_path (to_revision);
+
+  _ostree_fetcher_request_to_membuf (pull_data->fetcher,
+                                     pull_data->content_mirrorlist,
+                                     manifest_path, 0,
+                                     NULL, 0,
+                                     /* ~80 bytes/object; 10x the metadata
+                                      * cap covers multi-million object
+                                      * trees. */
+                                     10 * OSTREE_MAX_METADATA_SIZE,
+                                     OSTREE_REPO_PULL_METADATA_PRIORITY,
+                                     pull_data->cancellable,
+                                     on_object_manifest_fetched, pull_data);
+  pull_data->n_outstanding_metadata_fetches++;
+  pull_data->n_requested_metadata++;
+}
+
+/* Verify @delta_superblock_data against the summary's delta checksum list
+ * and hand it to the static delta machinery (or fall back to object fetches
+ * if the cost model rejects it).  Shared between the superblock fetch
+ * callback and the summary-inlined superblock path.
+ */
+static gboolean
+process_delta_superblock (OtPullData                *pull_data,
+                          const char                *from_revision,
+                          const char                *to_revision,
+                          const OstreeCollectionRef *requested_ref,
+                          GBytes                    *delta_superblock_data,
+                          GError                   **error)
+{
+  g_autofree gchar *delta = NULL;
+  g_autofree guchar *ret_csum = NULL;
+  guchar *summary_csum;
+  g_autoptr (GInputStream) summary_is = NULL;
+  g_autoptr(GVariant) delta_superblock = NULL;
+
+  summary_is = g_memory_input_stream_new_from_data (g_bytes_get_data (delta_superblock_data, NULL),
+                                                    g_bytes_get_size (delta_superblock_data),
+                                                    NULL);
+
+  if (!ot_gio_checksum_stream (summary_is, &ret_csum, pull_data->cancellable, error))
+    return FALSE;
+
+  delta = g_strconcat (from_revision ? from_revision : "", from_revision ? "-" : "", to_revision, NULL);
+  summary_csum = g_hash_table_lookup (pull_data->summary_deltas_checksums, delta);
+
+  /* With dual-endian publishing we may have fetched the native-endian
+   * superblock variant, which carries its own checksum entry in the
+   * (possibly GPG-verified) summary.
+   */
+  g_autofree char *variant_key =
+    g_strconcat (delta, ".", (G_BYTE_ORDER == G_LITTLE_ENDIAN) ? "l" : "B", NULL);
+  guchar *variant_csum = g_hash_table_lookup (pull_data->summary_deltas_checksums, variant_key);
+
+  /* At this point we've GPG verified the data, so in theory
+   * could trust that they provided the right data, but let's
+   * make this a hard error.
+   */
+  if (pull_data->gpg_verify_summary && !summary_csum && !variant_csum)
+    return glnx_throw (error, "GPG verification enabled, but no summary signatures found (use gpg-verify-summary=false in remote config to disable)");
+
+  if ((summary_csum || variant_csum)
+      && !(summary_csum && memcmp (summary_csum, ret_csum, 32) == 0)
+      && !(variant_csum && memcmp (variant_csum, ret_csum, 32) == 0))
+    return glnx_throw (error, "Invalid checksum for static delta %s", delta);
+
+  delta_superblock = g_variant_ref_sink (g_variant_new_from_bytes ((GVariantType*)OSTREE_STATIC_DELTA_SUPERBLOCK_FORMAT,
+                                                                   delta_superblock_data, FALSE));
+
+  if (!delta_is_worth_applying (pull_data, delta_superblock, from_revision, to_revision))
+    {
+      /* The cost model says loose objects win; take the same path
+       * as a missing delta.
+       */
+      queue_scan_one_metadata_object (pull_data, to_revision, OSTREE_OBJECT_TYPE_COMMIT, NULL, 0, requested_ref);
+      initiate_object_manifest_request (pull_data, to_revision);
+      return TRUE;
+    }
+
+  g_ptr_array_add (pull_data->static_delta_superblocks, g_variant_ref (delta_superblock));
+  return process_one_static_delta (pull_data, from_revision, to_revision, delta_superblock, requested_ref,
+                                   pull_data->cancellable, error);
+}
+
 static void
 on_superblock_fetched (GObject   *src,
                        GAsyncResult *res,
@@ -2425,6 +3885,7 @@ on_superblock_fetched (GObject   *src,
   if (!_ostree_fetcher_request_to_membuf_finish ((OstreeFetcher*)src,
                                                  res,
                                                  &delta_superblock_data,
+                                                 NULL, NULL, NULL,
                                                  error))
     {
       if (!g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
@@ -2438,48 +3899,28 @@ on_superblock_fetched (GObject   *src,
         }
 
       queue_scan_one_metadata_object (pull_data, to_revision, OSTREE_OBJECT_TYPE_COMMIT, NULL, 0, fdata->requested_ref);
+      initiate_object_manifest_request (pull_data, to_revision);
     }
   else
     {
-      g_autofree gchar *delta = NULL;
-      g_autofree guchar *ret_csum = NULL;
-      guchar *summary_csum;
-      g_autoptr (GInputStream) summary_is = NULL;
-      g_autoptr(GVariant) delta_superblock = NULL;
-
-      summary_is = g_memory_input_stream_new_from_data (g_bytes_get_data (delta_superblock_data, NULL),
-                                                        g_bytes_get_size (delta_superblock_data),
-                                                        NULL);
-
-      if (!ot_gio_checksum_stream (summary_is, &ret_csum, pull_data->cancellable, error))
-        goto out;
-
-      delta = g_strconcat (from_revision ? from_revision : "", from_revision ? "-" : "", to_revision, NULL);
-      summary_csum = g_hash_table_lookup (pull_data->summary_deltas_checksums, delta);
-
-      /* At this point we've GPG verified the data, so in theory
-       * could trust that they provided the right data, but let's
-       * make this a hard error.
+      /* Cache before processing, so that a pull interrupted during the
+       * delta part fetches can still reuse the superblock on retry;
+       * the cache is revalidated against the summary checksum on load.
        */
-      if (pull_data->gpg_verify_summary && !summary_csum)
+      if (pull_data->remote_name != NULL)
         {
-          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                       "GPG verification enabled, but no summary signatures found (use gpg-verify-summary=false in remote config to disable)");
-          goto out;
-        }
+          g_autofree char *delta_key =
+            g_strconcat (from_revision ?: "", from_revision ? "-" : "", to_revision, NULL);
 
-      if (summary_csum && memcmp (summary_csum, ret_csum, 32))
-        {
-          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Invalid checksum for static delta %s", delta);
-          goto out;
+          _ostree_repo_cache_delta_superblock (pull_data->repo, pull_data->remote_name,
+                                               delta_key, delta_superblock_data,
+                                               pull_data->cancellable);
+          g_ptr_array_add (pull_data->used_delta_cache_keys, g_steal_pointer (&delta_key));
         }
 
-      delta_superblock = g_variant_ref_sink (g_variant_new_from_bytes ((GVariantType*)OSTREE_STATIC_DELTA_SUPERBLOCK_FORMAT,
-                                                                       delta_superblock_data, FALSE));
-
-      g_ptr_array_add (pull_data->static_delta_superblocks, g_variant_ref (delta_superblock));
-      if (!process_one_static_delta (pull_data, from_revision, to_revision, delta_superblock, fdata->requested_ref,
-                                     pull_data->cancellable, error))
+      if (!process_delta_superblock (pull_data, from_revision, to_revision,
+                                     fdata->requested_ref, delta_superblock_data,
+                                     error))
         goto out;
     }
 
@@ -2549,76 +3990,438 @@ _ostree_repo_load_cache_summary_if_same_sig (OstreeRepo        *self,
   if (!old_sig_contents)
     goto out;
 
-  if (g_bytes_compare (old_sig_contents, summary_sig) == 0)
+  if (g_bytes_compare (old_sig_contents, summary_sig) == 0)
+    {
+      const char *summary_cache_file = glnx_strjoina (_OSTREE_SUMMARY_CACHE_DIR, "/", remote);
+      glnx_fd_close int summary_fd = -1;
+      GBytes *summary_data;
+
+
+      summary_fd = openat (self->cache_dir_fd, summary_cache_file, O_CLOEXEC | O_RDONLY);
+      if (summary_fd < 0)
+        {
+          if (errno == ENOENT)
+            {
+              (void) unlinkat (self->cache_dir_fd, summary_cache_sig_file, 0);
+              ret = TRUE;
+              goto out;
+            }
+
+          glnx_set_error_from_errno (error);
+          goto out;
+        }
+
+      summary_data = glnx_fd_readall_bytes (summary_fd, cancellable, error);
+      if (!summary_data)
+        goto out;
+      *summary = summary_data;
+    }
+  ret = TRUE;
+
+ out:
+  return ret;
+}
+
+static gboolean
+_ostree_repo_cache_summary (OstreeRepo        *self,
+                            const char        *remote,
+                            GBytes            *summary,
+                            GBytes            *summary_sig,
+                            GCancellable      *cancellable,
+                            GError           **error)
+{
+  gboolean ret = FALSE;
+  const char *summary_cache_file = glnx_strjoina (_OSTREE_SUMMARY_CACHE_DIR, "/", remote);
+  const char *summary_cache_sig_file = glnx_strjoina (_OSTREE_SUMMARY_CACHE_DIR, "/", remote, ".sig");
+
+  if (self->cache_dir_fd == -1)
+    return TRUE;
+
+  if (!glnx_shutil_mkdir_p_at (self->cache_dir_fd, _OSTREE_SUMMARY_CACHE_DIR, 0775, cancellable, error))
+    goto out;
+
+  if (!glnx_file_replace_contents_at (self->cache_dir_fd,
+                                      summary_cache_file,
+                                      g_bytes_get_data (summary, NULL),
+                                      g_bytes_get_size (summary),
+                                      self->disable_fsync ? GLNX_FILE_REPLACE_NODATASYNC : GLNX_FILE_REPLACE_DATASYNC_NEW,
+                                      cancellable, error))
+    goto out;
+
+  if (!glnx_file_replace_contents_at (self->cache_dir_fd,
+                                      summary_cache_sig_file,
+                                      g_bytes_get_data (summary_sig, NULL),
+                                      g_bytes_get_size (summary_sig),
+                                      self->disable_fsync ? GLNX_FILE_REPLACE_NODATASYNC : GLNX_FILE_REPLACE_DATASYNC_NEW,
+                                      cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  return ret;
+
+}
+
+/* Load a file from the summary cache as written by
+ * _ostree_repo_cache_summary(); @extension is "" for the summary itself or
+ * ".sig" for its signature.  Used when the server answers a conditional
+ * request for summary.sig with 304 Not Modified.  A missing file is not an
+ * error; *out_data is left as %NULL. */
+static gboolean
+_ostree_repo_load_cache_summary_file (OstreeRepo    *self,
+                                      const char    *remote,
+                                      const char    *extension,
+                                      GBytes       **out_data,
+                                      GCancellable  *cancellable,
+                                      GError       **error)
+{
+  gboolean ret = FALSE;
+  const char *summary_cache_file = glnx_strjoina (_OSTREE_SUMMARY_CACHE_DIR, "/", remote, extension);
+  glnx_fd_close int fd = -1;
+
+  *out_data = NULL;
+
+  if (self->cache_dir_fd == -1)
+    return TRUE;
+
+  if (!ot_openat_ignore_enoent (self->cache_dir_fd, summary_cache_file, &fd, error))
+    goto out;
+
+  if (fd >= 0)
+    {
+      GBytes *data = glnx_fd_readall_bytes (fd, cancellable, error);
+      if (!data)
+        goto out;
+      *out_data = data;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/* Cached static delta superblocks, so retrying an interrupted pull of
+ * the same from→to pair doesn't re-download a multi-MB superblock.
+ * Entries live under cache/delta-superblocks/ named by remote and delta
+ * key, are written opportunistically after a successful fetch, are
+ * revalidated on load against the (possibly GPG-verified) delta
+ * checksum from the current summary, and are deleted when the pull that
+ * used them completes.
+ */
+static gboolean
+_ostree_repo_load_cache_delta_superblock (OstreeRepo    *self,
+                                          const char    *remote,
+                                          const char    *delta_key,
+                                          const guchar  *expected_csum,
+                                          GBytes       **out_data,
+                                          GCancellable  *cancellable,
+                                          GError       **error)
+{
+  const char *cache_file = glnx_strjoina (_OSTREE_DELTA_CACHE_DIR, "/", remote, ".", delta_key);
+  glnx_fd_close int fd = -1;
+  g_autoptr(GBytes) data = NULL;
+
+  *out_data = NULL;
+
+  if (self->cache_dir_fd == -1)
+    return TRUE;
+
+  if (!ot_openat_ignore_enoent (self->cache_dir_fd, cache_file, &fd, error))
+    return FALSE;
+  if (fd < 0)
+    return TRUE;
+
+  data = glnx_fd_readall_bytes (fd, cancellable, error);
+  if (!data)
+    return FALSE;
+
+  { g_autofree guchar *actual_csum = NULL;
+    g_autoptr(GInputStream) is = g_memory_input_stream_new_from_bytes (data);
+
+    if (!ot_gio_checksum_stream (is, &actual_csum, cancellable, error))
+      return FALSE;
+
+    if (memcmp (actual_csum, expected_csum, OSTREE_SHA256_DIGEST_LEN) != 0)
+      {
+        /* Stale - the delta was regenerated; drop it and refetch */
+        (void) unlinkat (self->cache_dir_fd, cache_file, 0);
+        return TRUE;
+      }
+  }
+
+  *out_data = g_steal_pointer (&data);
+  return TRUE;
+}
+
+/* Best-effort; the cache is an optimization, so failure to write it
+ * (e.g. an unprivileged user pulling from a system repo) is not a
+ * pull error. */
+static void
+_ostree_repo_cache_delta_superblock (OstreeRepo    *self,
+                                     const char    *remote,
+                                     const char    *delta_key,
+                                     GBytes        *data,
+                                     GCancellable  *cancellable)
+{
+  const char *cache_file = glnx_strjoina (_OSTREE_DELTA_CACHE_DIR, "/", remote, ".", delta_key);
+  g_autoptr(GError) local_error = NULL;
+
+  if (self->cache_dir_fd == -1)
+    return;
+
+  if (!glnx_shutil_mkdir_p_at (self->cache_dir_fd, _OSTREE_DELTA_CACHE_DIR, 0775,
+                               cancellable, &local_error)
+      || !glnx_file_replace_contents_at (self->cache_dir_fd, cache_file,
+                                         g_bytes_get_data (data, NULL),
+                                         g_bytes_get_size (data),
+                                         GLNX_FILE_REPLACE_NODATASYNC,
+                                         cancellable, &local_error))
+    g_debug ("Failed to cache delta superblock %s: %s", delta_key, local_error->message);
+}
+
+/* The HTTP validators (ETag and Last-Modified) the server returned with the
+ * cached summary signature are kept in a small sidecar file, so the next
+ * poll can be a conditional request that normally costs a single 304 round
+ * trip.  The format is two lines: the ETag (possibly empty) and the
+ * Last-Modified time in seconds since the epoch; an optional third line
+ * "signed" records that the validators belong to the combined
+ * summary.signed artifact rather than summary.sig.  Returns whether the
+ * sidecar existed and parsed. */
+static gboolean
+_ostree_repo_load_cache_summary_validators (OstreeRepo  *self,
+                                            const char  *remote,
+                                            char       **out_etag,
+                                            guint64     *out_last_modified,
+                                            gboolean    *out_from_signed)
+{
+  const char *validators_file = glnx_strjoina (_OSTREE_SUMMARY_CACHE_DIR, "/", remote, ".sig.validators");
+  g_autofree char *contents = NULL;
+  char *newline;
+  char *next;
+
+  *out_etag = NULL;
+  *out_last_modified = 0;
+  *out_from_signed = FALSE;
+
+  if (self->cache_dir_fd == -1)
+    return FALSE;
+
+  /* This is an optimization; any parse failure just means an
+   * unconditional fetch. */
+  contents = glnx_file_get_contents_utf8_at (self->cache_dir_fd, validators_file,
+                                             NULL, NULL, NULL);
+  if (contents == NULL)
+    return FALSE;
+
+  newline = strchr (contents, '\n');
+  if (newline == NULL)
+    return FALSE;
+  *newline = '\0';
+
+  if (*contents != '\0')
+    *out_etag = g_strdup (contents);
+  *out_last_modified = g_ascii_strtoull (newline + 1, &next, 10);
+  if (next != NULL && *next == '\n' &&
+      g_str_has_prefix (next + 1, "signed"))
+    *out_from_signed = TRUE;
+  return TRUE;
+}
+
+static gboolean
+_ostree_repo_save_cache_summary_validators (OstreeRepo    *self,
+                                            const char    *remote,
+                                            const char    *etag,
+                                            guint64        last_modified,
+                                            gboolean       from_signed,
+                                            GCancellable  *cancellable,
+                                            GError       **error)
+{
+  const char *validators_file = glnx_strjoina (_OSTREE_SUMMARY_CACHE_DIR, "/", remote, ".sig.validators");
+  g_autofree char *contents = NULL;
+
+  if (self->cache_dir_fd == -1)
+    return TRUE;
+
+  contents = g_strdup_printf ("%s\n%" G_GUINT64_FORMAT "\n%s",
+                              etag != NULL ? etag : "",
+                              last_modified,
+                              from_signed ? "signed\n" : "");
+
+  return glnx_file_replace_contents_at (self->cache_dir_fd,
+                                        validators_file,
+                                        (guint8*)contents, strlen (contents),
+                                        self->disable_fsync ? GLNX_FILE_REPLACE_NODATASYNC : GLNX_FILE_REPLACE_DATASYNC_NEW,
+                                        cancellable, error);
+}
+
+/* Historical per-remote throughput, recorded after each successful pull
+ * and used by ostree_repo_find_remotes_async() to rank otherwise equal
+ * results, so steady-state update checks go straight to the
+ * historically fastest source.  Stored in the cache directory as a
+ * GVariant of (remote name, bytes/sec moving average), sorted by name.
+ * Purely an optimization: every failure here is silently treated as "no
+ * history". */
+#define _OSTREE_THROUGHPUT_CACHE_FILE "remote-throughput"
+#define OSTREE_THROUGHPUT_CACHE_GVARIANT_STRING "a(st)"
+/* Transfers below these bounds are dominated by latency, not bandwidth */
+#define THROUGHPUT_CACHE_MIN_SAMPLE_BYTES (128 * 1024)
+#define THROUGHPUT_CACHE_MIN_SAMPLE_USECS (250 * 1000)
+
+static GVariant *
+load_throughput_cache (OstreeRepo *self)
+{
+  glnx_fd_close int fd = -1;
+  g_autoptr(GVariant) cache = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  if (self->cache_dir_fd == -1)
+    return NULL;
+
+  if (!ot_openat_ignore_enoent (self->cache_dir_fd, _OSTREE_THROUGHPUT_CACHE_FILE,
+                                &fd, NULL))
+    return NULL;
+  if (fd < 0)
+    return NULL;
+
+  if (!ot_util_variant_map_fd (fd, 0,
+                               G_VARIANT_TYPE (OSTREE_THROUGHPUT_CACHE_GVARIANT_STRING),
+                               FALSE, &cache, &local_error))
+    return NULL;
+
+  return g_steal_pointer (&cache);
+}
+
+static void
+_ostree_repo_record_remote_throughput (OstreeRepo   *self,
+                                       const char   *remote_name,
+                                       guint64       bytes_per_sec,
+                                       GCancellable *cancellable)
+{
+  g_autoptr(GVariant) cache = NULL;
+  GVariantBuilder builder;
+  gboolean inserted = FALSE;
+
+  if (self->cache_dir_fd == -1)
+    return;
+
+  cache = load_throughput_cache (self);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE (OSTREE_THROUGHPUT_CACHE_GVARIANT_STRING));
+
+  const gsize n = (cache != NULL) ? g_variant_n_children (cache) : 0;
+  for (gsize i = 0; i < n; i++)
     {
-      const char *summary_cache_file = glnx_strjoina (_OSTREE_SUMMARY_CACHE_DIR, "/", remote);
-      glnx_fd_close int summary_fd = -1;
-      GBytes *summary_data;
+      const char *name;
+      guint64 prev;
+      int cmp;
 
-
-      summary_fd = openat (self->cache_dir_fd, summary_cache_file, O_CLOEXEC | O_RDONLY);
-      if (summary_fd < 0)
+      g_variant_get_child (cache, i, "(&st)", &name, &prev);
+      cmp = strcmp (name, remote_name);
+      if (cmp == 0)
         {
-          if (errno == ENOENT)
+          /* Smooth over per-pull variance */
+          g_variant_builder_add (&builder, "(st)", name, (3 * prev + bytes_per_sec) / 4);
+          inserted = TRUE;
+        }
+      else
+        {
+          if (cmp > 0 && !inserted)
             {
-              (void) unlinkat (self->cache_dir_fd, summary_cache_sig_file, 0);
-              ret = TRUE;
-              goto out;
+              g_variant_builder_add (&builder, "(st)", remote_name, bytes_per_sec);
+              inserted = TRUE;
             }
-
-          glnx_set_error_from_errno (error);
-          goto out;
+          g_variant_builder_add (&builder, "(st)", name, prev);
         }
-
-      summary_data = glnx_fd_readall_bytes (summary_fd, cancellable, error);
-      if (!summary_data)
-        goto out;
-      *summary = summary_data;
     }
-  ret = TRUE;
+  if (!inserted)
+    g_variant_builder_add (&builder, "(st)", remote_name, bytes_per_sec);
 
- out:
-  return ret;
+  g_autoptr(GVariant) new_cache = g_variant_ref_sink (g_variant_builder_end (&builder));
+  g_autoptr(GError) local_error = NULL;
+  if (!glnx_file_replace_contents_at (self->cache_dir_fd, _OSTREE_THROUGHPUT_CACHE_FILE,
+                                      g_variant_get_data (new_cache),
+                                      g_variant_get_size (new_cache),
+                                      self->disable_fsync ? GLNX_FILE_REPLACE_NODATASYNC : GLNX_FILE_REPLACE_DATASYNC_NEW,
+                                      cancellable, &local_error))
+    g_debug ("Failed to update remote throughput cache: %s", local_error->message);
 }
 
-static gboolean
-_ostree_repo_cache_summary (OstreeRepo        *self,
-                            const char        *remote,
-                            GBytes            *summary,
-                            GBytes            *summary_sig,
-                            GCancellable      *cancellable,
-                            GError           **error)
+/* How long a fetcher released back to the per-repo cache stays
+ * reusable.  Past this, keepalive connections have likely been dropped
+ * by the server or intervening middleboxes anyway.
+ */
+#define FETCHER_CACHE_EXPIRY_SECONDS (60)
+
+typedef struct {
+  OstreeFetcher *fetcher;
+  gint64 released_usec;
+} CachedFetcher;
+
+static void
+cached_fetcher_free (CachedFetcher *cached)
 {
-  gboolean ret = FALSE;
-  const char *summary_cache_file = glnx_strjoina (_OSTREE_SUMMARY_CACHE_DIR, "/", remote);
-  const char *summary_cache_sig_file = glnx_strjoina (_OSTREE_SUMMARY_CACHE_DIR, "/", remote, ".sig");
+  g_object_unref (cached->fetcher);
+  g_free (cached);
+}
 
-  if (self->cache_dir_fd == -1)
-    return TRUE;
+/* Return @fetcher to the per-repo cache, keyed by the configuration it
+ * was built from, so a subsequent pull from the same remote can reuse
+ * its open connections and TLS sessions instead of reconnecting.  Only
+ * call this when the operation completed successfully - a fetcher torn
+ * down mid-request is still entangled with the operation's main context
+ * and must simply be unreffed.
+ */
+static void
+repo_fetcher_release (OstreeRepo     *self,
+                      OstreeFetcher **fetcher)
+{
+  g_autoptr(OstreeFetcher) released = g_steal_pointer (fetcher);
+  const char *cache_key =
+    g_object_get_data (G_OBJECT (released), "ostree-fetcher-cache-key");
 
-  if (!glnx_shutil_mkdir_p_at (self->cache_dir_fd, _OSTREE_SUMMARY_CACHE_DIR, 0775, cancellable, error))
-    goto out;
+  if (cache_key == NULL)
+    return;
 
-  if (!glnx_file_replace_contents_at (self->cache_dir_fd,
-                                      summary_cache_file,
-                                      g_bytes_get_data (summary, NULL),
-                                      g_bytes_get_size (summary),
-                                      self->disable_fsync ? GLNX_FILE_REPLACE_NODATASYNC : GLNX_FILE_REPLACE_DATASYNC_NEW,
-                                      cancellable, error))
-    goto out;
+  CachedFetcher *cached = g_new0 (CachedFetcher, 1);
+  cached->fetcher = g_steal_pointer (&released);
+  cached->released_usec = g_get_monotonic_time ();
+
+  g_mutex_lock (&self->cache_lock);
+  if (self->remote_fetchers == NULL)
+    self->remote_fetchers = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                   g_free,
+                                                   (GDestroyNotify)cached_fetcher_free);
+  g_hash_table_replace (self->remote_fetchers, g_strdup (cache_key), cached);
+  g_mutex_unlock (&self->cache_lock);
+}
 
-  if (!glnx_file_replace_contents_at (self->cache_dir_fd,
-                                      summary_cache_sig_file,
-                                      g_bytes_get_data (summary_sig, NULL),
-                                      g_bytes_get_size (summary_sig),
-                                      self->disable_fsync ? GLNX_FILE_REPLACE_NODATASYNC : GLNX_FILE_REPLACE_DATASYNC_NEW,
-                                      cancellable, error))
-    goto out;
+/* Take a previously released fetcher matching @cache_key out of the
+ * per-repo cache, or %NULL.  The entry is removed either way: it was
+ * taken, or it expired.  Since entries are only present between
+ * operations and removed on checkout, a cached fetcher is never shared
+ * by two concurrent pulls.
+ */
+static OstreeFetcher *
+repo_fetcher_checkout (OstreeRepo *self,
+                       const char *cache_key)
+{
+  OstreeFetcher *fetcher = NULL;
 
-  ret = TRUE;
- out:
-  return ret;
+  g_mutex_lock (&self->cache_lock);
+  if (self->remote_fetchers != NULL)
+    {
+      CachedFetcher *cached = g_hash_table_lookup (self->remote_fetchers, cache_key);
+      if (cached != NULL)
+        {
+          const gint64 idle_usec = g_get_monotonic_time () - cached->released_usec;
+          if (idle_usec <= (gint64)FETCHER_CACHE_EXPIRY_SECONDS * G_USEC_PER_SEC)
+            fetcher = g_object_ref (cached->fetcher);
+          g_hash_table_remove (self->remote_fetchers, cache_key);
+        }
+    }
+  g_mutex_unlock (&self->cache_lock);
 
+  return fetcher;
 }
 
 static OstreeFetcher *
@@ -2631,6 +4434,13 @@ _ostree_repo_remote_new_fetcher (OstreeRepo  *self,
   OstreeFetcher *fetcher = NULL;
   OstreeFetcherConfigFlags fetcher_flags = 0;
   gboolean tls_permissive = FALSE;
+  gboolean tcp_fastopen = FALSE;
+  g_autofree char *tls_client_cert_path = NULL;
+  g_autofree char *tls_client_key_path = NULL;
+  g_autofree char *tls_ca_path = NULL;
+  g_autofree char *http_proxy = NULL;
+  g_autofree char *jar_path = NULL;
+  gboolean have_cookie_jar = FALSE;
   OstreeFetcherSecurityState ret_state = OSTREE_FETCHER_SECURITY_STATE_TLS;
   gboolean success = FALSE;
 
@@ -2651,76 +4461,103 @@ _ostree_repo_remote_new_fetcher (OstreeRepo  *self,
   if (gzip)
     fetcher_flags |= OSTREE_FETCHER_FLAGS_TRANSFER_GZIP;
 
-  fetcher = _ostree_fetcher_new (self->tmp_dir_fd, remote_name, fetcher_flags);
+  if (!ostree_repo_get_remote_boolean_option (self, remote_name,
+                                              "tcp-fastopen", FALSE,
+                                              &tcp_fastopen, error))
+    goto out;
+  if (tcp_fastopen)
+    fetcher_flags |= OSTREE_FETCHER_FLAGS_TCP_FASTOPEN;
 
-  {
-    g_autofree char *tls_client_cert_path = NULL;
-    g_autofree char *tls_client_key_path = NULL;
+  if (!ostree_repo_get_remote_option (self, remote_name,
+                                      "tls-client-cert-path", NULL,
+                                      &tls_client_cert_path, error))
+    goto out;
+  if (!ostree_repo_get_remote_option (self, remote_name,
+                                      "tls-client-key-path", NULL,
+                                      &tls_client_key_path, error))
+    goto out;
 
-    if (!ostree_repo_get_remote_option (self, remote_name,
-                                        "tls-client-cert-path", NULL,
-                                        &tls_client_cert_path, error))
-      goto out;
-    if (!ostree_repo_get_remote_option (self, remote_name,
-                                        "tls-client-key-path", NULL,
-                                        &tls_client_key_path, error))
+  if ((tls_client_cert_path != NULL) != (tls_client_key_path != NULL))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Remote \"%s\" must specify both "
+                   "\"tls-client-cert-path\" and \"tls-client-key-path\"",
+                   remote_name);
       goto out;
+    }
 
-    if ((tls_client_cert_path != NULL) != (tls_client_key_path != NULL))
-      {
-        g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                     "Remote \"%s\" must specify both "
-                     "\"tls-client-cert-path\" and \"tls-client-key-path\"",
-                     remote_name);
-        goto out;
-      }
-    else if (tls_client_cert_path != NULL)
-      {
-        _ostree_fetcher_set_client_cert (fetcher, tls_client_cert_path, tls_client_key_path);
-      }
-  }
+  if (!ostree_repo_get_remote_option (self, remote_name,
+                                      "tls-ca-path", NULL,
+                                      &tls_ca_path, error))
+    goto out;
+
+  if (tls_ca_path != NULL)
+    {
+      /* Don't change if it's already _INSECURE */
+      if (ret_state == OSTREE_FETCHER_SECURITY_STATE_TLS)
+        ret_state = OSTREE_FETCHER_SECURITY_STATE_CA_PINNED;
+    }
+
+  if (!ostree_repo_get_remote_option (self, remote_name,
+                                      "proxy", NULL,
+                                      &http_proxy, error))
+    goto out;
 
   {
-    g_autofree char *tls_ca_path = NULL;
+    g_autofree char *cookie_file = g_strdup_printf ("%s.cookies.txt", remote_name);
+    /* TODO; port away from this; a bit hard since both libsoup and libcurl
+     * expect a file. Doing ot_fdrel_to_gfile() works for now though.
+     */
+    GFile*repo_path = ostree_repo_get_path (self);
+    jar_path =
+      g_build_filename (gs_file_get_path_cached (repo_path), cookie_file, NULL);
 
-    if (!ostree_repo_get_remote_option (self, remote_name,
-                                        "tls-ca-path", NULL,
-                                        &tls_ca_path, error))
-      goto out;
+    have_cookie_jar = g_file_test (jar_path, G_FILE_TEST_IS_REGULAR);
+  }
 
-    if (tls_ca_path != NULL)
+  /* Everything read above, flattened; a cached fetcher is only reused
+   * while this matches, so editing the remote config still takes effect
+   * on the next operation.
+   */
+  { g_autofree char *cache_key =
+      g_strdup_printf ("%s\n%u\n%s\n%s\n%s\n%s\n%s", remote_name,
+                       (guint)fetcher_flags,
+                       tls_client_cert_path ?: "", tls_client_key_path ?: "",
+                       tls_ca_path ?: "", http_proxy ?: "",
+                       have_cookie_jar ? jar_path : "");
+
+    fetcher = repo_fetcher_checkout (self, cache_key);
+    if (fetcher != NULL)
       {
-        _ostree_fetcher_set_tls_database (fetcher, tls_ca_path);
-
-        /* Don't change if it's already _INSECURE */
-        if (ret_state == OSTREE_FETCHER_SECURITY_STATE_TLS)
-          ret_state = OSTREE_FETCHER_SECURITY_STATE_CA_PINNED;
+        success = TRUE;
+        goto out;
       }
+
+    fetcher = _ostree_fetcher_new (self->tmp_dir_fd, remote_name, fetcher_flags);
+    g_object_set_data_full (G_OBJECT (fetcher), "ostree-fetcher-cache-key",
+                            g_strdup (cache_key), g_free);
   }
 
-  {
-    g_autofree char *http_proxy = NULL;
+  if (tls_client_cert_path != NULL)
+    _ostree_fetcher_set_client_cert (fetcher, tls_client_cert_path, tls_client_key_path);
 
-    if (!ostree_repo_get_remote_option (self, remote_name,
-                                        "proxy", NULL,
-                                        &http_proxy, error))
-      goto out;
+  if (tls_ca_path != NULL)
+    _ostree_fetcher_set_tls_database (fetcher, tls_ca_path);
 
-    if (http_proxy != NULL)
-      _ostree_fetcher_set_proxy (fetcher, http_proxy);
-  }
+  if (http_proxy != NULL)
+    _ostree_fetcher_set_proxy (fetcher, http_proxy);
 
-  {
-    g_autofree char *cookie_file = g_strdup_printf ("%s.cookies.txt", remote_name);
-    /* TODO; port away from this; a bit hard since both libsoup and libcurl
-     * expect a file. Doing ot_fdrel_to_gfile() works for now though.
-     */
-    GFile*repo_path = ostree_repo_get_path (self);
-    g_autofree char *jar_path =
-      g_build_filename (gs_file_get_path_cached (repo_path), cookie_file, NULL);
+  if (have_cookie_jar)
+    _ostree_fetcher_set_cookie_jar (fetcher, jar_path);
 
-    if (g_file_test (jar_path, G_FILE_TEST_IS_REGULAR))
-      _ostree_fetcher_set_cookie_jar (fetcher, jar_path);
+  /* Persist resolved server addresses per remote, so short-lived poll
+   * processes don't redo DNS for every wakeup.
+   */
+  { g_autofree char *dns_cache_file = g_strdup_printf ("state/%s.dns-cache", remote_name);
+    GFile *repo_path = ostree_repo_get_path (self);
+    g_autofree char *dns_cache_path =
+      g_build_filename (gs_file_get_path_cached (repo_path), dns_cache_file, NULL);
+    _ostree_fetcher_set_dns_cache (fetcher, dns_cache_path);
   }
 
   success = TRUE;
@@ -2740,7 +4577,12 @@ _ostree_preload_metadata_file (OstreeRepo    *self,
                                GPtrArray     *mirrorlist,
                                const char    *filename,
                                gboolean      is_metalink,
+                               const char    *if_none_match,
+                               guint64        if_modified_since,
                                GBytes        **out_bytes,
+                               gboolean      *out_not_modified,
+                               char         **out_etag,
+                               guint64       *out_last_modified,
                                GCancellable  *cancellable,
                                GError        **error)
 {
@@ -2751,6 +4593,14 @@ _ostree_preload_metadata_file (OstreeRepo    *self,
       g_autoptr(OstreeMetalink) metalink = NULL;
       GError *local_error = NULL;
 
+      /* Metalink requests don't support conditional fetches */
+      if (out_not_modified != NULL)
+        *out_not_modified = FALSE;
+      if (out_etag != NULL)
+        *out_etag = NULL;
+      if (out_last_modified != NULL)
+        *out_last_modified = 0;
+
       /* the metalink uri is buried in the mirrorlist as the first (and only)
        * element */
       metalink = _ostree_metalink_new (fetcher, filename,
@@ -2776,7 +4626,9 @@ _ostree_preload_metadata_file (OstreeRepo    *self,
       ret = _ostree_fetcher_mirrored_request_to_membuf (fetcher, mirrorlist,
                                                         filename,
                                                         OSTREE_FETCHER_REQUEST_OPTIONAL_CONTENT,
+                                                        if_none_match, if_modified_since,
                                                         out_bytes,
+                                                        out_not_modified, out_etag, out_last_modified,
                                                         OSTREE_MAX_METADATA_SIZE,
                                                         cancellable, error);
 
@@ -2905,6 +4757,9 @@ repo_remote_fetch_summary (OstreeRepo    *self,
   const char *url_override = NULL;
   g_autoptr(GVariant) extra_headers = NULL;
   g_autoptr(GPtrArray) mirrorlist = NULL;
+  gboolean summary_sig_not_modified = FALSE;
+  g_autofree char *summary_sig_etag = NULL;
+  guint64 summary_sig_last_modified = 0;
 
   if (options)
     {
@@ -2919,8 +4774,7 @@ repo_remote_fetch_summary (OstreeRepo    *self,
   if (fetcher == NULL)
     goto out;
 
-  if (extra_headers)
-    _ostree_fetcher_set_extra_headers (fetcher, extra_headers);
+  _ostree_fetcher_set_extra_headers (fetcher, extra_headers);
 
   {
     g_autofree char *url_string = NULL;
@@ -2951,22 +4805,73 @@ repo_remote_fetch_summary (OstreeRepo    *self,
       }
   }
 
-  /* FIXME: Send the ETag from the cache with the request for summary.sig to
-   * avoid downloading summary.sig unnecessarily. This won’t normally provide
-   * any benefits (but won’t do any harm) since summary.sig is typically 500B
-   * in size. But if a repository has multiple keys, the signature file will
-   * grow and this optimisation may be useful. */
-  if (!_ostree_preload_metadata_file (self,
-                                      fetcher,
-                                      mirrorlist,
-                                      "summary.sig",
-                                      metalink_url_string ? TRUE : FALSE,
-                                      out_signatures,
-                                      cancellable,
-                                      error))
-    goto out;
+  {
+    g_autofree char *cached_etag = NULL;
+    guint64 cached_last_modified = 0;
+
+    _ostree_repo_load_cache_summary_validators (self, name, &cached_etag,
+                                                &cached_last_modified);
+
+    /* Send the validators from the cached copy of summary.sig with the
+     * request, so that an unchanged repository costs a single 304 Not
+     * Modified round trip rather than a download plus signature
+     * verification. */
+    if (!_ostree_preload_metadata_file (self,
+                                        fetcher,
+                                        mirrorlist,
+                                        "summary.sig",
+                                        metalink_url_string ? TRUE : FALSE,
+                                        cached_etag, cached_last_modified,
+                                        out_signatures,
+                                        &summary_sig_not_modified,
+                                        &summary_sig_etag,
+                                        &summary_sig_last_modified,
+                                        cancellable,
+                                        error))
+      goto out;
+  }
+
+  if (summary_sig_not_modified)
+    {
+      /* The server confirmed the summary.sig we cached is still current;
+       * reuse the cached signature and summary pair. */
+      if (!_ostree_repo_load_cache_summary_file (self, name, ".sig",
+                                                 out_signatures,
+                                                 cancellable, error))
+        goto out;
+      if (*out_signatures &&
+          !_ostree_repo_load_cache_summary_file (self, name, "",
+                                                 out_summary,
+                                                 cancellable, error))
+        goto out;
+
+      if (*out_signatures == NULL || *out_summary == NULL)
+        {
+          /* The cached pair was pruned since we recorded its validators;
+           * refetch unconditionally. */
+          g_clear_pointer (out_signatures, (GDestroyNotify)g_bytes_unref);
+          g_clear_pointer (out_summary, (GDestroyNotify)g_bytes_unref);
+          g_clear_pointer (&summary_sig_etag, g_free);
+          summary_sig_last_modified = 0;
+          summary_sig_not_modified = FALSE;
+
+          if (!_ostree_preload_metadata_file (self,
+                                              fetcher,
+                                              mirrorlist,
+                                              "summary.sig",
+                                              metalink_url_string ? TRUE : FALSE,
+                                              NULL, 0,
+                                              out_signatures,
+                                              NULL,
+                                              &summary_sig_etag,
+                                              &summary_sig_last_modified,
+                                              cancellable,
+                                              error))
+            goto out;
+        }
+    }
 
-  if (*out_signatures)
+  if (!*out_summary && *out_signatures)
     {
       if (!_ostree_repo_load_cache_summary_if_same_sig (self,
                                                         name,
@@ -2986,7 +4891,9 @@ repo_remote_fetch_summary (OstreeRepo    *self,
                                           mirrorlist,
                                           "summary",
                                           metalink_url_string ? TRUE : FALSE,
+                                          NULL, 0,
                                           out_summary,
+                                          NULL, NULL, NULL,
                                           cancellable,
                                           error))
         goto out;
@@ -3013,9 +4920,22 @@ repo_remote_fetch_summary (OstreeRepo    *self,
         }
     }
 
+  /* Remember the validators for the summary.sig we just fetched (the
+   * from_cache case means the signature bytes were downloaded but matched
+   * the cache, so a fresh ETag may still have come back).  Purely an
+   * optimization, so failures here are ignored. */
+  if (!summary_sig_not_modified && *out_summary && *out_signatures &&
+      (summary_sig_etag != NULL || summary_sig_last_modified > 0))
+    (void) _ostree_repo_save_cache_summary_validators (self, name,
+                                                       summary_sig_etag,
+                                                       summary_sig_last_modified,
+                                                       cancellable, NULL);
+
   ret = TRUE;
 
  out:
+  if (ret && fetcher != NULL)
+    repo_fetcher_release (self, &fetcher);
   if (mainctx)
     g_main_context_pop_thread_default (mainctx);
   return ret;
@@ -3035,21 +4955,118 @@ reinitialize_fetcher (OtPullData *pull_data, const char *remote_name,
   if (pull_data->fetcher == NULL)
     return FALSE;
 
-  if (pull_data->extra_headers)
-    _ostree_fetcher_set_extra_headers (pull_data->fetcher, pull_data->extra_headers);
+  /* A fetcher reused from the cache carries stats from its previous
+   * life; baseline our counters so this pull only sees its own traffic.
+   */
+  { OstreeFetcherRequestStats stats;
+    _ostree_fetcher_get_request_stats (pull_data->fetcher, &stats);
+    pull_data->adapt_last_n_completed = stats.n_completed;
+  }
+  pull_data->fetcher_initial_bytes = _ostree_fetcher_bytes_transferred (pull_data->fetcher);
+
+  /* Unconditionally, so a reused fetcher drops headers from the
+   * previous pull */
+  _ostree_fetcher_set_extra_headers (pull_data->fetcher, pull_data->extra_headers);
 
   return TRUE;
 }
 
-/* Start a request for a static delta */
-static void
+/* Start a request for a static delta.  If we fetched a delta index
+ * from the remote, consult it first so we never issue a superblock
+ * request that's just going to 404.
+ */
+static gboolean
 initiate_delta_request (OtPullData *pull_data,
                         const char *from_revision,
                         const char *to_revision,
-                        const OstreeCollectionRef *ref)
+                        const OstreeCollectionRef *ref,
+                        GError    **error)
 {
+  if (pull_data->have_delta_index)
+    {
+      g_autofree char *delta_key =
+        g_strconcat (from_revision ?: "", from_revision ? "-" : "", to_revision, NULL);
+
+      if (!g_hash_table_contains (pull_data->delta_index, delta_key))
+        {
+          if (pull_data->require_static_deltas)
+            {
+              set_required_deltas_error (error, (ref != NULL) ? ref->ref_name : "", to_revision);
+              return FALSE;
+            }
+
+          queue_scan_one_metadata_object (pull_data, to_revision, OSTREE_OBJECT_TYPE_COMMIT, NULL, 0, ref);
+          initiate_object_manifest_request (pull_data, to_revision);
+          return TRUE;
+        }
+    }
+
+  /* If the summary embedded this superblock, process it with no further
+   * network requests; the checksum verification against the (possibly
+   * GPG-verified) summary delta list still applies.
+   */
+  if (pull_data->summary_inline_deltas != NULL)
+    {
+      g_autofree char *delta_key =
+        g_strconcat (from_revision ?: "", from_revision ? "-" : "", to_revision, NULL);
+      GBytes *inline_superblock =
+        g_hash_table_lookup (pull_data->summary_inline_deltas, delta_key);
+
+      if (inline_superblock != NULL)
+        return process_delta_superblock (pull_data, from_revision, to_revision,
+                                         ref, inline_superblock, error);
+    }
+
+  /* If the repository publishes dual-endian superblock variants, the
+   * summary advertises a per-variant checksum keyed by the delta name
+   * plus the endianness character.  Fetch our native-endian variant so
+   * delta apply skips the byteswap pass; when nothing is advertised,
+   * fall back to the canonical superblock with no extra round trip.
+   */
+  const char *native_suffix = (G_BYTE_ORDER == G_LITTLE_ENDIAN) ? "l" : "B";
+  g_autofree char *native_variant_key =
+    g_strconcat (from_revision ?: "", from_revision ? "-" : "", to_revision, ".", native_suffix, NULL);
+  const gboolean use_native_variant =
+    g_hash_table_contains (pull_data->summary_deltas_checksums, native_variant_key);
+
+  /* A retry of an interrupted pull?  Reuse a cached superblock if it
+   * still matches the delta checksum from the current summary, so that
+   * retry storms on flaky links don't re-download it every attempt.
+   */
+  if (pull_data->remote_name != NULL)
+    {
+      g_autofree char *delta_key =
+        g_strconcat (from_revision ?: "", from_revision ? "-" : "", to_revision, NULL);
+      guchar *summary_csum =
+        g_hash_table_lookup (pull_data->summary_deltas_checksums,
+                             use_native_variant ? native_variant_key : delta_key);
+
+      if (summary_csum != NULL)
+        {
+          g_autoptr(GBytes) cached_superblock = NULL;
+
+          if (!_ostree_repo_load_cache_delta_superblock (pull_data->repo, pull_data->remote_name,
+                                                         delta_key, summary_csum,
+                                                         &cached_superblock,
+                                                         pull_data->cancellable, error))
+            return FALSE;
+
+          if (cached_superblock != NULL)
+            {
+              g_ptr_array_add (pull_data->used_delta_cache_keys, g_steal_pointer (&delta_key));
+              return process_delta_superblock (pull_data, from_revision, to_revision,
+                                               ref, cached_superblock, error);
+            }
+        }
+    }
+
   g_autofree char *delta_name =
     _ostree_get_relative_static_delta_superblock_path (from_revision, to_revision);
+  if (use_native_variant)
+    {
+      g_autofree char *canonical_name = g_steal_pointer (&delta_name);
+      delta_name = g_strconcat (canonical_name, ".", native_suffix, NULL);
+    }
   FetchDeltaSuperData *fdata = g_new0(FetchDeltaSuperData, 1);
   fdata->pull_data = pull_data;
   fdata->from_revision = g_strdup (from_revision);
@@ -3059,11 +5076,14 @@ initiate_delta_request (OtPullData *pull_data,
   _ostree_fetcher_request_to_membuf (pull_data->fetcher,
                                      pull_data->content_mirrorlist,
                                      delta_name, 0,
+                                     NULL, 0,
                                      OSTREE_MAX_METADATA_SIZE,
-                                     0, pull_data->cancellable,
+                                     OSTREE_REPO_PULL_METADATA_PRIORITY,
+                                     pull_data->cancellable,
                                      on_superblock_fetched, fdata);
   pull_data->n_outstanding_metadata_fetches++;
   pull_data->n_requested_metadata++;
+  return TRUE;
 }
 
 /*
@@ -3077,6 +5097,50 @@ initiate_delta_request (OtPullData *pull_data,
  * This function primarily handles the semantics around
  * `disable_static_deltas` and `require_static_deltas`.
  */
+/* Resume fetching history at the recorded shallow boundary: queue a
+ * commit scan for every state/$checksum.shallow marker, preset to fetch
+ * @deepen further parent generations.  This deepens a previous
+ * depth-limited pull without re-traversing history from the refs.
+ */
+static gboolean
+initiate_deepen_requests (OtPullData  *pull_data,
+                          GError     **error)
+{
+  g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
+  const size_t suffix_len = strlen (".shallow");
+
+  if (!glnx_dirfd_iterator_init_at (pull_data->repo->repo_dir_fd, "state", FALSE,
+                                    &dfd_iter, error))
+    return FALSE;
+
+  while (TRUE)
+    {
+      struct dirent *dent;
+      if (!glnx_dirfd_iterator_next_dent (&dfd_iter, &dent, pull_data->cancellable, error))
+        return FALSE;
+      if (dent == NULL)
+        break;
+
+      if (strlen (dent->d_name) != OSTREE_SHA256_STRING_LEN + suffix_len
+          || !g_str_has_suffix (dent->d_name, ".shallow"))
+        continue;
+
+      char checksum[OSTREE_SHA256_STRING_LEN+1];
+      memcpy (checksum, dent->d_name, OSTREE_SHA256_STRING_LEN);
+      checksum[OSTREE_SHA256_STRING_LEN] = '\0';
+      if (!ostree_validate_checksum_string (checksum, NULL))
+        continue;
+
+      g_hash_table_insert (pull_data->commit_to_depth,
+                           (char*)_ostree_repo_intern_checksum (pull_data->repo, checksum),
+                           GINT_TO_POINTER (pull_data->deepen));
+      queue_scan_one_metadata_object (pull_data, checksum, OSTREE_OBJECT_TYPE_COMMIT,
+                                      NULL, 0, NULL);
+    }
+
+  return TRUE;
+}
+
 static gboolean
 initiate_request (OtPullData                 *pull_data,
                   const OstreeCollectionRef  *ref,
@@ -3089,6 +5153,7 @@ initiate_request (OtPullData                 *pull_data,
   if (pull_data->disable_static_deltas)
     {
       queue_scan_one_metadata_object (pull_data, to_revision, OSTREE_OBJECT_TYPE_COMMIT, NULL, 0, ref);
+      initiate_object_manifest_request (pull_data, to_revision);
       return TRUE;
     }
 
@@ -3104,16 +5169,25 @@ initiate_request (OtPullData                 *pull_data,
         return FALSE;
 
       if (delta_from_revision)   /* Did we find a delta FROM commit? */
-        initiate_delta_request (pull_data, delta_from_revision, to_revision, ref);
+        {
+          if (!initiate_delta_request (pull_data, delta_from_revision, to_revision, ref, error))
+            return FALSE;
+        }
       else if (have_scratch_delta)    /* No delta FROM, do we have a scratch? */
-        initiate_delta_request (pull_data, NULL, to_revision, ref);
+        {
+          if (!initiate_delta_request (pull_data, NULL, to_revision, ref, error))
+            return FALSE;
+        }
       else if (pull_data->require_static_deltas) /* No deltas found; are they required? */
         {
           set_required_deltas_error (error, (ref != NULL) ? ref->ref_name : "", to_revision);
           return FALSE;
         }
       else /* No deltas, fall back to object fetches. */
-        queue_scan_one_metadata_object (pull_data, to_revision, OSTREE_OBJECT_TYPE_COMMIT, NULL, 0, ref);
+        {
+          queue_scan_one_metadata_object (pull_data, to_revision, OSTREE_OBJECT_TYPE_COMMIT, NULL, 0, ref);
+          initiate_object_manifest_request (pull_data, to_revision);
+        }
     }
   else if (ref != NULL)
     {
@@ -3147,14 +5221,146 @@ initiate_request (OtPullData                 *pull_data,
       /* This is similar to the below, except we *might* use the previous
        * commit, or we might do a scratch delta first.
        */
-      initiate_delta_request (pull_data, delta_from_revision ?: NULL, to_revision, ref);
+      if (!initiate_delta_request (pull_data, delta_from_revision ?: NULL, to_revision, ref, error))
+        return FALSE;
     }
   else
     {
       /* Legacy path without a summary file - let's try a scratch delta, if that
        * doesn't work, it'll drop down to object requests.
        */
-      initiate_delta_request (pull_data, NULL, to_revision, NULL);
+      if (!initiate_delta_request (pull_data, NULL, to_revision, NULL, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Fetch, verify and parse the summary shard files covering the refs in
+ * @requested_refs_to_fetch, per the OSTREE_SUMMARY_SHARDS index in the
+ * root summary (a no-op when the summary isn't sharded).  When
+ * @fetch_all_refs (mirror mode), every shard is fetched and its refs
+ * are added to @requested_refs_to_fetch.  Each shard's checksum is
+ * hard-verified against the index, which extends the root summary's
+ * GPG signature to the shards; delta checksums advertised by fetched
+ * shards are merged into summary_deltas_checksums.
+ */
+static gboolean
+fetch_summary_shards (OtPullData    *pull_data,
+                      gboolean       fetch_all_refs,
+                      GHashTable    *requested_refs_to_fetch,
+                      GCancellable  *cancellable,
+                      GError       **error)
+{
+  g_autoptr(GVariant) additional_metadata = g_variant_get_child_value (pull_data->summary, 1);
+  const char *main_collection_id;
+
+  if (!g_variant_lookup (additional_metadata, OSTREE_SUMMARY_COLLECTION_ID, "&s", &main_collection_id))
+    main_collection_id = NULL;
+
+  g_autoptr(GVariant) shard_index =
+    g_variant_lookup_value (additional_metadata, OSTREE_SUMMARY_SHARDS, G_VARIANT_TYPE ("a(say)"));
+  if (shard_index == NULL)
+    return TRUE;
+
+  gsize n_shards = g_variant_n_children (shard_index);
+  for (gsize i = 0; i < n_shards; i++)
+    {
+      const char *prefix;
+      g_autoptr(GVariant) expected_csum_v = NULL;
+
+      g_variant_get_child (shard_index, i, "(&s@ay)", &prefix, &expected_csum_v);
+
+      if (!ostree_validate_structureof_csum_v (expected_csum_v, error))
+        return glnx_prefix_error (error, "Summary shard index");
+
+      gboolean want = fetch_all_refs;
+      if (!want)
+        {
+          size_t prefix_len = strlen (prefix);
+          GLNX_HASH_TABLE_FOREACH (requested_refs_to_fetch, const OstreeCollectionRef*, ref)
+            {
+              if (strncmp (ref->ref_name, prefix, prefix_len) == 0
+                  && (ref->ref_name[prefix_len] == '\0' || ref->ref_name[prefix_len] == '/'))
+                {
+                  want = TRUE;
+                  break;
+                }
+            }
+        }
+      if (!want)
+        continue;
+
+      g_autofree char *shard_fn = _ostree_summary_shard_filename (prefix);
+      g_autoptr(GBytes) shard_bytes = NULL;
+      if (!_ostree_fetcher_mirrored_request_to_membuf (pull_data->fetcher,
+                                                       pull_data->meta_mirrorlist,
+                                                       shard_fn, 0,
+                                                       NULL, 0,
+                                                       &shard_bytes, NULL, NULL, NULL,
+                                                       OSTREE_MAX_METADATA_SIZE,
+                                                       cancellable, error))
+        return FALSE;
+
+      g_autofree char *expected_checksum = ostree_checksum_from_bytes_v (expected_csum_v);
+      g_autofree char *actual_checksum =
+        g_compute_checksum_for_bytes (G_CHECKSUM_SHA256, shard_bytes);
+      if (strcmp (actual_checksum, expected_checksum) != 0)
+        return glnx_throw (error, "Summary shard %s: checksum mismatch; expected=%s actual=%s",
+                           shard_fn, expected_checksum, actual_checksum);
+
+      g_autoptr(GVariant) shard =
+        g_variant_ref_sink (g_variant_new_from_bytes (OSTREE_SUMMARY_GVARIANT_FORMAT,
+                                                      shard_bytes, FALSE));
+      if (!g_variant_is_normal_form (shard) ||
+          !g_variant_is_of_type (shard, OSTREE_SUMMARY_GVARIANT_FORMAT))
+        return glnx_throw (error, "Summary shard %s: not normal form", shard_fn);
+
+      g_autoptr(GVariant) shard_refs = g_variant_get_child_value (shard, 0);
+      gsize n_refs = g_variant_n_children (shard_refs);
+      for (gsize j = 0; j < n_refs; j++)
+        {
+          const char *refname;
+          g_autoptr(GVariant) ref = g_variant_get_child_value (shard_refs, j);
+
+          g_variant_get_child (ref, 0, "&s", &refname);
+
+          if (!ostree_validate_rev (refname, error))
+            return FALSE;
+
+          if (fetch_all_refs)
+            g_hash_table_insert (requested_refs_to_fetch,
+                                 ostree_collection_ref_new (main_collection_id, refname), NULL);
+        }
+
+      g_autoptr(GVariant) shard_metadata = g_variant_get_child_value (shard, 1);
+      g_autoptr(GVariant) shard_deltas =
+        g_variant_lookup_value (shard_metadata, OSTREE_SUMMARY_STATIC_DELTAS,
+                                G_VARIANT_TYPE ("a{sv}"));
+      gsize n_deltas = shard_deltas ? g_variant_n_children (shard_deltas) : 0;
+      for (gsize j = 0; j < n_deltas; j++)
+        {
+          const char *delta;
+          g_autoptr(GVariant) csum_v = NULL;
+          g_autoptr(GVariant) entry = g_variant_get_child_value (shard_deltas, j);
+
+          g_variant_get_child (entry, 0, "&s", &delta);
+          g_variant_get_child (entry, 1, "v", &csum_v);
+
+          if (!validate_variant_is_csum (csum_v, error))
+            return FALSE;
+
+          guchar *csum_data = g_malloc (OSTREE_SHA256_DIGEST_LEN);
+          memcpy (csum_data, ostree_checksum_bytes_peek (csum_v), 32);
+          g_hash_table_insert (pull_data->summary_deltas_checksums,
+                               g_strdup (delta),
+                               csum_data);
+        }
+
+      if (pull_data->summary_shards == NULL)
+        pull_data->summary_shards =
+          g_ptr_array_new_with_free_func ((GDestroyNotify) g_variant_unref);
+      g_ptr_array_add (pull_data->summary_shards, g_steal_pointer (&shard));
     }
 
   return TRUE;
@@ -3191,6 +5397,8 @@ initiate_request (OtPullData                 *pull_data,
  *   * depth (i): How far in the history to traverse; default is 0, -1 means infinite
  *   * disable-static-deltas (b): Do not use static deltas
  *   * require-static-deltas (b): Require static deltas
+ *   * disable-delta-cost-model (b): Always apply available static deltas, even when the cost model estimates fetching loose objects would be faster
+ *   * disable-commitmeta-refresh (b): Don't refetch detached metadata for commits that are already stored; avoids one HTTP request per unchanged ref, at the cost of not picking up signatures added to existing commits.  Mainly useful with %OSTREE_REPO_PULL_FLAGS_COMMIT_ONLY for large ref-catalog mirrors
  *   * override-commit-ids (as): Array of specific commit IDs to fetch for refs
  *   * dry-run (b): Only print information on what will be downloaded (requires static deltas)
  *   * override-url (s): Fetch objects from this URL if remote specifies no metalink in options
@@ -3198,6 +5406,7 @@ initiate_request (OtPullData                 *pull_data,
  *   * http-headers (a(ss)): Additional headers to add to all HTTP requests
  *   * update-frequency (u): Frequency to call the async progress callback in milliseconds, if any; only values higher than 0 are valid
  *   * localcache-repos (as): File paths for local repos to use as caches when doing remote fetches
+ *   * fetch-objects (as): Fetch exactly these objects ("checksum.objtype" as printed by ostree_object_to_string()) instead of resolving refs; used for targeted repair of missing or corrupted objects
  */
 gboolean
 ostree_repo_pull_with_options (OstreeRepo             *self,
@@ -3225,6 +5434,7 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
   const char *dir_to_pull = NULL;
   g_autofree char **dirs_to_pull = NULL;
   g_autofree char **refs_to_fetch = NULL;
+  g_autofree char **fetch_objects = NULL;
   g_autoptr(GVariantIter) collection_refs_iter = NULL;
   g_autofree char **override_commit_ids = NULL;
   GSource *update_timeout = NULL;
@@ -3235,6 +5445,7 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
   const char *url_override = NULL;
   gboolean inherit_transaction = FALSE;
   g_autoptr(GHashTable) updated_requested_refs_to_fetch = NULL;  /* (element-type OstreeCollectionRef utf8) */
+  g_autoptr(GPtrArray) refs_to_resolve = NULL;
   int i;
   g_autofree char **opt_localcache_repos = NULL;
   /* If refs or collection-refs has exactly one value, this will point to that
@@ -3259,8 +5470,13 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
       opt_gpg_verify_summary_set =
         g_variant_lookup (options, "gpg-verify-summary", "b", &pull_data->gpg_verify_summary);
       (void) g_variant_lookup (options, "depth", "i", &pull_data->maxdepth);
+      (void) g_variant_lookup (options, "deepen", "i", &pull_data->deepen);
+      (void) g_variant_lookup (options, "stats", "b", &pull_data->dump_stats);
+      (void) g_variant_lookup (options, "scan-queue-limit", "u", &pull_data->scan_queue_max_in_memory);
       (void) g_variant_lookup (options, "disable-static-deltas", "b", &pull_data->disable_static_deltas);
       (void) g_variant_lookup (options, "require-static-deltas", "b", &pull_data->require_static_deltas);
+      (void) g_variant_lookup (options, "disable-delta-cost-model", "b", &pull_data->disable_delta_cost_model);
+      (void) g_variant_lookup (options, "disable-commitmeta-refresh", "b", &pull_data->disable_commitmeta_refresh);
       (void) g_variant_lookup (options, "override-commit-ids", "^a&s", &override_commit_ids);
       (void) g_variant_lookup (options, "dry-run", "b", &pull_data->dry_run);
       (void) g_variant_lookup (options, "override-url", "&s", &url_override);
@@ -3268,11 +5484,18 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
       (void) g_variant_lookup (options, "http-headers", "@a(ss)", &pull_data->extra_headers);
       (void) g_variant_lookup (options, "update-frequency", "u", &update_frequency);
       (void) g_variant_lookup (options, "localcache-repos", "^a&s", &opt_localcache_repos);
+      (void) g_variant_lookup (options, "fetch-objects", "^a&s", &fetch_objects);
     }
 
   g_return_val_if_fail (pull_data->maxdepth >= -1, FALSE);
+  g_return_val_if_fail (pull_data->deepen >= 0, FALSE);
   g_return_val_if_fail (!opt_collection_refs_set ||
                         (refs_to_fetch == NULL && override_commit_ids == NULL), FALSE);
+  /* An explicit object set stands alone; it doesn't combine with ref
+   * or commit requests. */
+  g_return_val_if_fail (fetch_objects == NULL ||
+                        (refs_to_fetch == NULL && !opt_collection_refs_set
+                         && override_commit_ids == NULL), FALSE);
   if (refs_to_fetch && override_commit_ids)
     g_return_val_if_fail (g_strv_length (refs_to_fetch) == g_strv_length (override_commit_ids), FALSE);
 
@@ -3304,31 +5527,49 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
 
   pull_data->repo = self;
   pull_data->progress = progress;
+  pull_data->max_outstanding_fetcher_requests = _OSTREE_MAX_OUTSTANDING_FETCHER_REQUESTS;
 
   pull_data->expected_commit_sizes = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                             (GDestroyNotify)g_free,
                                                             (GDestroyNotify)g_free);
+  /* Keys are interned in the repo's checksum table */
   pull_data->commit_to_depth = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                      (GDestroyNotify)g_free,
-                                                      NULL);
+                                                      NULL, NULL);
   pull_data->summary_deltas_checksums = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                                (GDestroyNotify)g_free,
                                                                (GDestroyNotify)g_free);
-  pull_data->scanned_metadata = g_hash_table_new_full (ostree_hash_object_name, g_variant_equal,
-                                                       (GDestroyNotify)g_variant_unref, NULL);
+  pull_data->delta_index = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                  (GDestroyNotify)g_free,
+                                                  (GDestroyNotify)g_free);
+  pull_data->scanned_metadata = g_hash_table_new_full (_ostree_object_name_bin_hash,
+                                                       _ostree_object_name_bin_equal,
+                                                       (GDestroyNotify)g_free, NULL);
+  /* Page in metadata objects concurrently while the main context walks
+   * them; see scan_prefetch_worker().  Best-effort, so a failure to
+   * spawn the pool just leaves us with the old serial behavior.
+   */
+  pull_data->scan_prefetch_pool = g_thread_pool_new (scan_prefetch_worker, pull_data,
+                                                     MIN (g_get_num_processors (), 8),
+                                                     FALSE, NULL);
   pull_data->fetched_detached_metadata = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                        (GDestroyNotify)g_free, NULL);
-  pull_data->requested_content = g_hash_table_new_full (g_str_hash, g_str_equal,
+  pull_data->requested_content = g_hash_table_new_full (_ostree_checksum_bytes_hash,
+                                                        _ostree_checksum_bytes_equal,
                                                         (GDestroyNotify)g_free, NULL);
   pull_data->requested_fallback_content = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                                  (GDestroyNotify)g_free, NULL);
-  pull_data->requested_metadata = g_hash_table_new_full (ostree_hash_object_name, g_variant_equal,
-                                                         (GDestroyNotify)g_variant_unref, NULL);
-  pull_data->pending_fetch_content = g_hash_table_new_full (g_str_hash, g_str_equal,
+  pull_data->requested_manifests = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                          (GDestroyNotify)g_free, NULL);
+  pull_data->requested_metadata = g_hash_table_new_full (_ostree_object_name_bin_hash,
+                                                         _ostree_object_name_bin_equal,
+                                                         (GDestroyNotify)g_free, NULL);
+  pull_data->pending_fetch_content = g_hash_table_new_full (_ostree_checksum_bytes_hash,
+                                                            _ostree_checksum_bytes_equal,
                                                             (GDestroyNotify)g_free,
                                                             (GDestroyNotify)fetch_object_data_free);
-  pull_data->pending_fetch_metadata = g_hash_table_new_full (ostree_hash_object_name, g_variant_equal,
-                                                             (GDestroyNotify)g_variant_unref,
+  pull_data->pending_fetch_metadata = g_hash_table_new_full (_ostree_object_name_bin_hash,
+                                                             _ostree_object_name_bin_equal,
+                                                             (GDestroyNotify)g_free,
                                                              (GDestroyNotify)fetch_object_data_free);
   pull_data->pending_fetch_deltaparts = g_hash_table_new_full (NULL, NULL, (GDestroyNotify)fetch_static_delta_data_free, NULL);
 
@@ -3411,6 +5652,42 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
         }
     }
 
+  /* With HTTP/2 the curl fetcher multiplexes requests as concurrent
+   * streams over a few connections, so a much deeper request queue
+   * keeps high-RTT links busy.  Let users opt in per-remote; the
+   * historical default stays conservative for HTTP/1.1 servers.
+   */
+  {
+    g_autofree char *max_outstanding_str = NULL;
+
+    if (!ostree_repo_get_remote_option (self, remote_name_or_baseurl,
+                                        "max-outstanding-requests", NULL,
+                                        &max_outstanding_str, error))
+      goto out;
+
+    if (max_outstanding_str != NULL)
+      {
+        guint64 v = g_ascii_strtoull (max_outstanding_str, NULL, 10);
+        if (v == 0 || v > 65536)
+          {
+            g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                         "Invalid max-outstanding-requests '%s'", max_outstanding_str);
+            goto out;
+          }
+        pull_data->max_outstanding_fetcher_requests = (guint) v;
+        /* An explicitly configured limit is honored as-is */
+        pull_data->fetcher_concurrency_is_static = TRUE;
+      }
+  }
+
+  /* Without explicit configuration, start from the historical default
+   * and let the AIMD controller find the link's bandwidth-delay product
+   * within a generous ceiling.
+   */
+  pull_data->target_outstanding_fetcher_requests = pull_data->max_outstanding_fetcher_requests;
+  if (!pull_data->fetcher_concurrency_is_static)
+    pull_data->max_outstanding_fetcher_requests = _OSTREE_ADAPTIVE_MAX_OUTSTANDING_FETCHER_REQUESTS;
+
   pull_data->phase = OSTREE_PULL_PHASE_FETCHING_REFS;
 
   if (!reinitialize_fetcher (pull_data, remote_name_or_baseurl, error))
@@ -3606,6 +5883,7 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
     pull_data->disable_static_deltas = TRUE;
 
   pull_data->static_delta_superblocks = g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
+  pull_data->used_delta_cache_keys = g_ptr_array_new_with_free_func (g_free);
 
   {
     g_autoptr(GBytes) bytes_sig = NULL;
@@ -3614,19 +5892,140 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
     g_autoptr(GVariant) deltas = NULL;
     g_autoptr(GVariant) additional_metadata = NULL;
     gboolean summary_from_cache = FALSE;
+    gboolean fetched_signed = FALSE;
+    gboolean summary_sig_not_modified = FALSE;
+    g_autofree char *summary_sig_etag = NULL;
+    guint64 summary_sig_last_modified = 0;
 
     if (!pull_data->summary_data_sig)
       {
-        if (!_ostree_fetcher_mirrored_request_to_membuf (pull_data->fetcher,
-                                                         pull_data->meta_mirrorlist,
-                                                         "summary.sig", OSTREE_FETCHER_REQUEST_OPTIONAL_CONTENT,
-                                                         &bytes_sig,
-                                                         OSTREE_MAX_METADATA_SIZE,
-                                                         cancellable, error))
+        g_autofree char *cached_etag = NULL;
+        guint64 cached_last_modified = 0;
+        gboolean have_validators = FALSE;
+        gboolean validators_from_signed = FALSE;
+
+        /* Issue a conditional request using the validators saved with the
+         * cached signature, so an unchanged repository costs a 304
+         * round trip instead of a download plus signature verification. */
+        if (!pull_data->remote_repo_local)
+          have_validators =
+            _ostree_repo_load_cache_summary_validators (self, remote_name_or_baseurl,
+                                                        &cached_etag, &cached_last_modified,
+                                                        &validators_from_signed);
+
+        /* Prefer the combined summary.signed artifact, which delivers the
+         * summary and its signature in one request.  Only probe for it if
+         * this server has previously offered it or we have no history at
+         * all; once the sidecar records plain summary.sig validators, a
+         * legacy server doesn't pay a 404 on every poll. */
+        if (!have_validators || validators_from_signed)
+          {
+            g_autoptr(GBytes) bytes_signed = NULL;
+
+            if (!_ostree_fetcher_mirrored_request_to_membuf (pull_data->fetcher,
+                                                             pull_data->meta_mirrorlist,
+                                                             _OSTREE_SUMMARY_SIGNED_PATH, OSTREE_FETCHER_REQUEST_OPTIONAL_CONTENT,
+                                                             validators_from_signed ? cached_etag : NULL,
+                                                             validators_from_signed ? cached_last_modified : 0,
+                                                             &bytes_signed,
+                                                             &summary_sig_not_modified,
+                                                             &summary_sig_etag,
+                                                             &summary_sig_last_modified,
+                                                             OSTREE_MAX_METADATA_SIZE,
+                                                             cancellable, error))
+              goto out;
+
+            if (bytes_signed)
+              {
+                if (!_ostree_repo_summary_signed_split (bytes_signed,
+                                                        &bytes_summary, &bytes_sig,
+                                                        error))
+                  goto out;
+                fetched_signed = TRUE;
+              }
+          }
+
+        if (!fetched_signed && !summary_sig_not_modified)
+          {
+            g_clear_pointer (&summary_sig_etag, g_free);
+            summary_sig_last_modified = 0;
+
+            if (!_ostree_fetcher_mirrored_request_to_membuf (pull_data->fetcher,
+                                                             pull_data->meta_mirrorlist,
+                                                             "summary.sig", OSTREE_FETCHER_REQUEST_OPTIONAL_CONTENT,
+                                                             validators_from_signed ? NULL : cached_etag,
+                                                             validators_from_signed ? 0 : cached_last_modified,
+                                                             &bytes_sig,
+                                                             &summary_sig_not_modified,
+                                                             &summary_sig_etag,
+                                                             &summary_sig_last_modified,
+                                                             OSTREE_MAX_METADATA_SIZE,
+                                                             cancellable, error))
+              goto out;
+          }
+      }
+
+    if (summary_sig_not_modified)
+      {
+        /* The server confirmed the cached signature is still current;
+         * reuse the cached signature and summary pair. */
+        if (!_ostree_repo_load_cache_summary_file (self, remote_name_or_baseurl, ".sig",
+                                                   &bytes_sig,
+                                                   cancellable, error))
+          goto out;
+        if (bytes_sig &&
+            !_ostree_repo_load_cache_summary_file (self, remote_name_or_baseurl, "",
+                                                   &bytes_summary,
+                                                   cancellable, error))
           goto out;
+
+        if (bytes_sig == NULL || bytes_summary == NULL)
+          {
+            /* The cached pair was pruned since we recorded its validators;
+             * refetch unconditionally. */
+            g_clear_pointer (&bytes_sig, (GDestroyNotify)g_bytes_unref);
+            g_clear_pointer (&bytes_summary, (GDestroyNotify)g_bytes_unref);
+            g_clear_pointer (&summary_sig_etag, g_free);
+            summary_sig_last_modified = 0;
+            summary_sig_not_modified = FALSE;
+
+            g_autoptr(GBytes) bytes_signed = NULL;
+            if (!_ostree_fetcher_mirrored_request_to_membuf (pull_data->fetcher,
+                                                             pull_data->meta_mirrorlist,
+                                                             _OSTREE_SUMMARY_SIGNED_PATH, OSTREE_FETCHER_REQUEST_OPTIONAL_CONTENT,
+                                                             NULL, 0,
+                                                             &bytes_signed,
+                                                             NULL,
+                                                             &summary_sig_etag,
+                                                             &summary_sig_last_modified,
+                                                             OSTREE_MAX_METADATA_SIZE,
+                                                             cancellable, error))
+              goto out;
+
+            if (bytes_signed)
+              {
+                if (!_ostree_repo_summary_signed_split (bytes_signed,
+                                                        &bytes_summary, &bytes_sig,
+                                                        error))
+                  goto out;
+                fetched_signed = TRUE;
+              }
+            else if (!_ostree_fetcher_mirrored_request_to_membuf (pull_data->fetcher,
+                                                                  pull_data->meta_mirrorlist,
+                                                                  "summary.sig", OSTREE_FETCHER_REQUEST_OPTIONAL_CONTENT,
+                                                                  NULL, 0,
+                                                                  &bytes_sig,
+                                                                  NULL,
+                                                                  &summary_sig_etag,
+                                                                  &summary_sig_last_modified,
+                                                                  OSTREE_MAX_METADATA_SIZE,
+                                                                  cancellable, error))
+              goto out;
+          }
       }
 
-    if (bytes_sig &&
+    if (!bytes_summary &&
+        bytes_sig &&
         !pull_data->remote_repo_local &&
         !_ostree_repo_load_cache_summary_if_same_sig (self,
                                                       remote_name_or_baseurl,
@@ -3636,7 +6035,7 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
                                                       error))
       goto out;
 
-    if (bytes_summary)
+    if (bytes_summary && !fetched_signed)
       summary_from_cache = TRUE;
 
     if (!pull_data->summary && !bytes_summary)
@@ -3644,7 +6043,8 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
         if (!_ostree_fetcher_mirrored_request_to_membuf (pull_data->fetcher,
                                                          pull_data->meta_mirrorlist,
                                                          "summary", OSTREE_FETCHER_REQUEST_OPTIONAL_CONTENT,
-                                                         &bytes_summary,
+                                                         NULL, 0,
+                                                         &bytes_summary, NULL, NULL, NULL,
                                                          OSTREE_MAX_METADATA_SIZE,
                                                          cancellable, error))
           goto out;
@@ -3717,6 +6117,18 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
           goto out;
       }
 
+    /* Save the validators for the signature artifact we just fetched so the
+     * next pull can issue a conditional request.  Purely an optimization, so
+     * failures here are ignored. */
+    if (!summary_sig_not_modified && !pull_data->remote_repo_local &&
+        bytes_summary && bytes_sig &&
+        (summary_sig_etag != NULL || summary_sig_last_modified > 0))
+      (void) _ostree_repo_save_cache_summary_validators (self, remote_name_or_baseurl,
+                                                         summary_sig_etag,
+                                                         summary_sig_last_modified,
+                                                         fetched_signed,
+                                                         cancellable, NULL);
+
     if (pull_data->summary)
       {
         additional_metadata = g_variant_get_child_value (pull_data->summary, 1);
@@ -3798,9 +6210,63 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
                                  g_strdup (delta),
                                  csum_data);
           }
+
+        g_autoptr(GVariant) inline_deltas =
+          g_variant_lookup_value (additional_metadata, OSTREE_SUMMARY_INLINE_DELTAS, G_VARIANT_TYPE ("a{sv}"));
+        n = inline_deltas ? g_variant_n_children (inline_deltas) : 0;
+        if (n > 0)
+          pull_data->summary_inline_deltas =
+            g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                   (GDestroyNotify) g_bytes_unref);
+        for (i = 0; i < n; i++)
+          {
+            const char *delta;
+            g_autoptr(GVariant) superblock_v = NULL;
+            g_autoptr(GVariant) entry = g_variant_get_child_value (inline_deltas, i);
+
+            g_variant_get_child (entry, 0, "&s", &delta);
+            g_variant_get_child (entry, 1, "v", &superblock_v);
+
+            if (!g_variant_is_of_type (superblock_v, G_VARIANT_TYPE ("ay")))
+              continue;
+
+            g_hash_table_insert (pull_data->summary_inline_deltas,
+                                 g_strdup (delta),
+                                 g_variant_get_data_as_bytes (superblock_v));
+          }
       }
   }
 
+  /* Without a summary we'd normally probe superblock URLs and fall
+   * back on 404; try the compact delta index first so we know up front
+   * which deltas the remote actually has.  The index is advisory -
+   * missing or malformed just means we keep the probing behavior.
+   */
+  if (!pull_data->summary && !pull_data->disable_static_deltas)
+    {
+      g_autoptr(GBytes) bytes_index = NULL;
+
+      if (!_ostree_fetcher_mirrored_request_to_membuf (pull_data->fetcher,
+                                                       pull_data->meta_mirrorlist,
+                                                       _OSTREE_STATIC_DELTA_INDEX_PATH,
+                                                       OSTREE_FETCHER_REQUEST_OPTIONAL_CONTENT,
+                                                       NULL, 0,
+                                                       &bytes_index, NULL, NULL, NULL,
+                                                       OSTREE_MAX_METADATA_SIZE,
+                                                       cancellable, error))
+        goto out;
+
+      if (bytes_index)
+        {
+          g_autoptr(GError) local_error = NULL;
+
+          if (_ostree_static_delta_index_parse (bytes_index, pull_data->delta_index, &local_error))
+            pull_data->have_delta_index = TRUE;
+          else
+            g_debug ("Ignoring delta index: %s", local_error->message);
+        }
+    }
+
   if (pull_data->is_mirror && !refs_to_fetch && !opt_collection_refs_set && !configured_branches)
     {
       if (!bytes_summary)
@@ -3850,7 +6316,7 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
             commitid_strviter++;
         }
     }
-  else
+  else if (fetch_objects == NULL)
     {
       char **branches_iter;
 
@@ -3871,6 +6337,18 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
         }
     }
 
+  /* If the summary is sharded, fetch just the shards covering the
+   * requested refs (all of them in mirror mode), now that the
+   * requested set is known. */
+  if (pull_data->summary != NULL)
+    {
+      gboolean fetch_all_refs = pull_data->is_mirror && !refs_to_fetch && !opt_collection_refs_set;
+
+      if (!fetch_summary_shards (pull_data, fetch_all_refs, requested_refs_to_fetch,
+                                 cancellable, error))
+        goto out;
+    }
+
   /* Resolve the checksum for each ref. This has to be done into a new hash table,
    * since we can’t modify the keys of @requested_refs_to_fetch while iterating
    * over it, and we need to ensure the collection IDs are resolved too. */
@@ -3878,6 +6356,7 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
                                                            ostree_collection_ref_equal,
                                                            (GDestroyNotify) ostree_collection_ref_free,
                                                            g_free);
+  refs_to_resolve = g_ptr_array_new ();
   GLNX_HASH_TABLE_FOREACH_KV (requested_refs_to_fetch, const OstreeCollectionRef*, ref,
                                                        const char*, override_commitid)
     {
@@ -3888,37 +6367,50 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
         {
           g_hash_table_replace (updated_requested_refs_to_fetch, ostree_collection_ref_dup (ref), g_strdup (override_commitid));
         }
-      else
+      else if (pull_data->summary)
         {
           g_autoptr(OstreeCollectionRef) ref_with_collection = NULL;
+          gsize commit_size = 0;
+          guint64 *malloced_size;
+          g_autofree gchar *collection_id = NULL;
 
-          if (pull_data->summary)
-            {
-              gsize commit_size = 0;
-              guint64 *malloced_size;
-              g_autofree gchar *collection_id = NULL;
-
-              if (!lookup_commit_checksum_and_collection_from_summary (pull_data, ref, &contents, &commit_size, &collection_id, error))
-                goto out;
-
-              ref_with_collection = ostree_collection_ref_new (collection_id, ref->ref_name);
+          if (!lookup_commit_checksum_and_collection_from_summary (pull_data, ref, &contents, &commit_size, &collection_id, error))
+            goto out;
 
-              malloced_size = g_new0 (guint64, 1);
-              *malloced_size = commit_size;
-              g_hash_table_insert (pull_data->expected_commit_sizes, g_strdup (contents), malloced_size);
-            }
-          else
-            {
-              if (!fetch_ref_contents (pull_data, main_collection_id, ref, &contents, cancellable, error))
-                goto out;
+          ref_with_collection = ostree_collection_ref_new (collection_id, ref->ref_name);
 
-              ref_with_collection = ostree_collection_ref_dup (ref);
-            }
+          malloced_size = g_new0 (guint64, 1);
+          *malloced_size = commit_size;
+          g_hash_table_insert (pull_data->expected_commit_sizes, g_strdup (contents), malloced_size);
 
           g_hash_table_replace (updated_requested_refs_to_fetch,
                                 g_steal_pointer (&ref_with_collection),
                                 g_steal_pointer (&contents));
         }
+      else
+        {
+          /* No summary; we have to fetch each refs/heads file.  Batch those
+           * up so the requests run concurrently. */
+          g_ptr_array_add (refs_to_resolve, (gpointer)ref);
+        }
+    }
+
+  if (refs_to_resolve->len > 0)
+    {
+      g_autofree char **resolved_contents = g_new0 (char *, refs_to_resolve->len);
+
+      if (!fetch_ref_contents_many (pull_data, main_collection_id, refs_to_resolve,
+                                    resolved_contents, cancellable, error))
+        goto out;
+
+      for (i = 0; i < (int)refs_to_resolve->len; i++)
+        {
+          const OstreeCollectionRef *ref = refs_to_resolve->pdata[i];
+
+          g_hash_table_replace (updated_requested_refs_to_fetch,
+                                ostree_collection_ref_dup (ref),
+                                resolved_contents[i]);
+        }
     }
 
   g_hash_table_unref (requested_refs_to_fetch);
@@ -3945,6 +6437,8 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
         }
     }
 
+  load_scanned_subtree_index (pull_data);
+
   pull_data->phase = OSTREE_PULL_PHASE_FETCHING_OBJECTS;
 
   /* Now discard the previous fetcher, as it was bound to a temporary main context
@@ -3969,6 +6463,67 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
         goto out;
     }
 
+  /* Initiate requests for an explicitly listed object set (targeted
+   * repair, see `ostree fsck --repair-from-remote`).  The objects go
+   * through the regular fetch-and-write path, but nothing is resolved
+   * or traversed: the cost is proportional to the listed set, not the
+   * repository.
+   */
+  for (char **iter = fetch_objects; iter != NULL && *iter != NULL; iter++)
+    {
+      const char *dot = strrchr (*iter, '.');
+      if (dot == NULL)
+        {
+          glnx_throw (error, "Invalid object name '%s' in fetch-objects", *iter);
+          goto out;
+        }
+      g_autofree char *checksum = g_strndup (*iter, dot - *iter);
+      if (!ostree_validate_checksum_string (checksum, error))
+        goto out;
+
+      const char *typestr = dot + 1;
+      OstreeObjectType objtype;
+      if (g_str_equal (typestr, "file"))
+        objtype = OSTREE_OBJECT_TYPE_FILE;
+      else if (g_str_equal (typestr, "dirtree"))
+        objtype = OSTREE_OBJECT_TYPE_DIR_TREE;
+      else if (g_str_equal (typestr, "dirmeta"))
+        objtype = OSTREE_OBJECT_TYPE_DIR_META;
+      else if (g_str_equal (typestr, "commit"))
+        objtype = OSTREE_OBJECT_TYPE_COMMIT;
+      else
+        {
+          glnx_throw (error, "Unsupported object type '%s' in fetch-objects", typestr);
+          goto out;
+        }
+
+      guint8 csum[OSTREE_SHA256_DIGEST_LEN];
+      ostree_checksum_inplace_to_bytes (checksum, csum);
+
+      if (OSTREE_OBJECT_TYPE_IS_META (objtype))
+        {
+          OstreeObjectNameBin object;
+          _ostree_object_name_bin_init (&object, csum, objtype);
+          if (g_hash_table_lookup (pull_data->requested_metadata, &object))
+            continue;
+          g_hash_table_add (pull_data->requested_metadata,
+                            g_memdup (&object, sizeof (object)));
+          /* For commits, chain through the detached metadata fetch as
+           * the regular scan path would. */
+          enqueue_one_object_request (pull_data, checksum, objtype, NULL,
+                                      objtype == OSTREE_OBJECT_TYPE_COMMIT, FALSE, NULL);
+        }
+      else
+        {
+          if (g_hash_table_lookup (pull_data->requested_content, csum))
+            continue;
+          g_hash_table_add (pull_data->requested_content,
+                            g_memdup (csum, OSTREE_SHA256_DIGEST_LEN));
+          enqueue_one_object_request (pull_data, checksum, OSTREE_OBJECT_TYPE_FILE,
+                                      NULL, FALSE, FALSE, NULL);
+        }
+    }
+
   /* Initiate requests for refs */
   GLNX_HASH_TABLE_FOREACH_KV (requested_refs_to_fetch, const OstreeCollectionRef*, ref,
                                                        const char*, to_revision)
@@ -3977,6 +6532,13 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
         goto out;
     }
 
+  /* And resume at the shallow boundary if deepening was requested */
+  if (pull_data->deepen > 0)
+    {
+      if (!initiate_deepen_requests (pull_data, error))
+        goto out;
+    }
+
   if (pull_data->progress)
     {
       /* Setup a custom frequency if set */
@@ -3995,6 +6557,41 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
   while (!pull_termination_condition (pull_data))
     g_main_context_iteration (pull_data->main_context, TRUE);
 
+  if (pull_data->dump_stats)
+    {
+      const guint64 wall_usecs = g_get_monotonic_time () - pull_data->start_time;
+      OstreeFetcherRequestStats request_stats;
+      _ostree_fetcher_get_request_stats (pull_data->fetcher, &request_stats);
+      g_printerr ("Pull statistics:\n"
+                  "  wall time: %0.3fs\n"
+                  "  bytes transferred: %" G_GUINT64_FORMAT "\n"
+                  "  metadata fetched: %u\n"
+                  "  content fetched: %u\n"
+                  "  delta parts fetched: %u\n"
+                  "  metadata scanned: %u in %0.3fs\n"
+                  "  peak outstanding fetches: %u\n"
+                  "  peak pending queue: %u\n"
+                  "  request window: final %u (%s), %u backoffs\n"
+                  "  request ttfb: ewma %0.1fms, min %0.1fms\n"
+                  "  request throughput: ewma %" G_GUINT64_FORMAT " B/s over %u requests\n",
+                  wall_usecs / (double)G_USEC_PER_SEC,
+                  pull_bytes_transferred (pull_data),
+                  pull_data->n_fetched_metadata,
+                  pull_data->n_fetched_content,
+                  pull_data->n_fetched_deltaparts,
+                  pull_data->n_scanned_metadata,
+                  pull_data->stats_scan_usecs / (double)G_USEC_PER_SEC,
+                  pull_data->stats_peak_outstanding,
+                  pull_data->stats_peak_pending,
+                  pull_data->target_outstanding_fetcher_requests,
+                  pull_data->fetcher_concurrency_is_static ? "static" : "adaptive",
+                  pull_data->stats_window_decreases,
+                  request_stats.ewma_ttfb_usecs / 1000.0,
+                  request_stats.min_ttfb_usecs / 1000.0,
+                  request_stats.ewma_bytes_per_sec,
+                  request_stats.n_completed);
+    }
+
   if (pull_data->caught_error)
     goto out;
 
@@ -4065,7 +6662,18 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
 
   end_time = g_get_monotonic_time ();
 
-  bytes_transferred = _ostree_fetcher_bytes_transferred (pull_data->fetcher);
+  bytes_transferred = pull_bytes_transferred (pull_data);
+
+  /* Record the observed throughput for this remote so later
+   * find-remotes calls can rank it against its peers. */
+  if (pull_data->remote_name != NULL
+      && bytes_transferred >= THROUGHPUT_CACHE_MIN_SAMPLE_BYTES
+      && end_time - pull_data->start_time >= THROUGHPUT_CACHE_MIN_SAMPLE_USECS)
+    _ostree_repo_record_remote_throughput (pull_data->repo, pull_data->remote_name,
+                                           bytes_transferred * G_USEC_PER_SEC
+                                             / (end_time - pull_data->start_time),
+                                           cancellable);
+
   if (bytes_transferred > 0 && pull_data->progress)
     {
       guint shift;
@@ -4179,6 +6787,23 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
           if (!ot_ensure_unlinked_at (pull_data->repo->repo_dir_fd, commitpartial_path, 0))
             goto out;
         }
+
+      if (!save_scanned_subtree_index (pull_data, cancellable, error))
+        goto out;
+
+      /* The superblock cache only exists to service retries of an
+       * interrupted pull; drop the entries we used now that it
+       * completed. */
+      if (pull_data->remote_name != NULL && pull_data->repo->cache_dir_fd != -1)
+        {
+          for (i = 0; i < (int)pull_data->used_delta_cache_keys->len; i++)
+            {
+              const char *delta_key = pull_data->used_delta_cache_keys->pdata[i];
+              const char *cache_file = glnx_strjoina (_OSTREE_DELTA_CACHE_DIR, "/",
+                                                      pull_data->remote_name, ".", delta_key);
+              (void) unlinkat (pull_data->repo->cache_dir_fd, cache_file, 0);
+            }
+        }
     }
 
   ret = TRUE;
@@ -4198,6 +6823,14 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
   if (update_timeout)
     g_source_destroy (update_timeout);
   g_strfreev (configured_branches);
+  if (pull_data->scan_prefetch_pool)
+    {
+      /* Drain rather than discard, so queued jobs don't leak */
+      g_thread_pool_free (pull_data->scan_prefetch_pool, FALSE, TRUE);
+      pull_data->scan_prefetch_pool = NULL;
+    }
+  if (ret && pull_data->fetcher != NULL)
+    repo_fetcher_release (pull_data->repo, &pull_data->fetcher);
   g_clear_object (&pull_data->fetcher);
   g_clear_pointer (&pull_data->extra_headers, (GDestroyNotify)g_variant_unref);
   g_clear_object (&pull_data->cancellable);
@@ -4213,15 +6846,22 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
   g_clear_pointer (&pull_data->commit_to_depth, (GDestroyNotify) g_hash_table_unref);
   g_clear_pointer (&pull_data->expected_commit_sizes, (GDestroyNotify) g_hash_table_unref);
   g_clear_pointer (&pull_data->scanned_metadata, (GDestroyNotify) g_hash_table_unref);
+  g_clear_pointer (&pull_data->scanned_subtree_index, (GDestroyNotify) g_bytes_unref);
   g_clear_pointer (&pull_data->fetched_detached_metadata, (GDestroyNotify) g_hash_table_unref);
   g_clear_pointer (&pull_data->summary_deltas_checksums, (GDestroyNotify) g_hash_table_unref);
+  g_clear_pointer (&pull_data->summary_inline_deltas, (GDestroyNotify) g_hash_table_unref);
+  g_clear_pointer (&pull_data->summary_shards, (GDestroyNotify) g_ptr_array_unref);
+  g_clear_pointer (&pull_data->delta_index, (GDestroyNotify) g_hash_table_unref);
+  g_clear_pointer (&pull_data->used_delta_cache_keys, (GDestroyNotify) g_ptr_array_unref);
   g_clear_pointer (&pull_data->requested_content, (GDestroyNotify) g_hash_table_unref);
   g_clear_pointer (&pull_data->requested_fallback_content, (GDestroyNotify) g_hash_table_unref);
+  g_clear_pointer (&pull_data->requested_manifests, (GDestroyNotify) g_hash_table_unref);
   g_clear_pointer (&pull_data->requested_metadata, (GDestroyNotify) g_hash_table_unref);
   g_clear_pointer (&pull_data->pending_fetch_content, (GDestroyNotify) g_hash_table_unref);
   g_clear_pointer (&pull_data->pending_fetch_metadata, (GDestroyNotify) g_hash_table_unref);
   g_clear_pointer (&pull_data->pending_fetch_deltaparts, (GDestroyNotify) g_hash_table_unref);
   g_clear_pointer (&pull_data->idle_src, (GDestroyNotify) g_source_destroy);
+  glnx_tmpfile_clear (&pull_data->scan_spill_tmpf);
   g_clear_pointer (&pull_data->dirs, (GDestroyNotify) g_ptr_array_unref);
   g_clear_pointer (&remote_config, (GDestroyNotify) g_key_file_unref);
   return ret;
@@ -4441,6 +7081,48 @@ sort_results_cb (gconstpointer a,
   return ostree_repo_finder_result_compare (*result_a, *result_b);
 }
 
+static guint64
+lookup_remote_throughput (GVariant   *cache,
+                          const char *remote_name)
+{
+  int idx;
+  guint64 bytes_per_sec;
+
+  if (cache == NULL)
+    return 0;
+  if (!ot_variant_bsearch_str (cache, remote_name, &idx))
+    return 0;
+
+  g_autoptr(GVariant) child = g_variant_get_child_value (cache, idx);
+  g_variant_get (child, "(&st)", NULL, &bytes_per_sec);
+  return bytes_per_sec;
+}
+
+/* Like sort_results_cb(), but breaks ties between results of equal
+ * priority using the recorded per-remote throughput, so the
+ * historically fastest source is tried first.  @user_data is the
+ * throughput cache variant, or %NULL for no history. */
+static gint
+sort_results_ranked_cb (gconstpointer a,
+                        gconstpointer b,
+                        gpointer      user_data)
+{
+  const OstreeRepoFinderResult *result_a = *((const OstreeRepoFinderResult **) a);
+  const OstreeRepoFinderResult *result_b = *((const OstreeRepoFinderResult **) b);
+  GVariant *throughput_cache = user_data;
+
+  if (result_a->priority == result_b->priority && throughput_cache != NULL)
+    {
+      const guint64 bps_a = lookup_remote_throughput (throughput_cache, result_a->remote->name);
+      const guint64 bps_b = lookup_remote_throughput (throughput_cache, result_b->remote->name);
+
+      if (bps_a != bps_b)
+        return (bps_a > bps_b) ? -1 : 1;
+    }
+
+  return sort_results_cb (a, b);
+}
+
 static void
 repo_finder_result_free0 (OstreeRepoFinderResult *result)
 {
@@ -4715,6 +7397,55 @@ find_remotes_process_refs (OstreeRepo                        *self,
   return TRUE;
 }
 
+/* Summary data for one finder result, produced by a worker thread in
+ * find_remotes_cb(). */
+typedef struct
+{
+  GBytes *summary_bytes;
+  GBytes *summary_sig_bytes;
+  GError *error;
+} FetchedSummary;
+
+static void
+fetched_summary_clear (FetchedSummary *fetched)
+{
+  g_clear_pointer (&fetched->summary_bytes, g_bytes_unref);
+  g_clear_pointer (&fetched->summary_sig_bytes, g_bytes_unref);
+  g_clear_error (&fetched->error);
+}
+
+typedef struct
+{
+  OstreeRepo *repo;
+  GPtrArray *results;  /* (element-type OstreeRepoFinderResult) */
+  GCancellable *cancellable;
+  FetchedSummary *fetched;  /* one slot per result */
+} FetchSummariesData;
+
+/* Download one result's summary and signature; each worker uses its own
+ * fetcher and main context, so the fetches are independent. The index is
+ * passed biased by 1 since %NULL is not a valid GThreadPool work item. */
+static void
+fetch_summary_worker (gpointer itemp,
+                      gpointer user_data)
+{
+  FetchSummariesData *data = user_data;
+  const gsize i = GPOINTER_TO_SIZE (itemp) - 1;
+  const OstreeRepoFinderResult *result = g_ptr_array_index (data->results, i);
+  FetchedSummary *fetched = &data->fetched[i];
+
+  g_debug ("%s: Fetching summary for remote ‘%s’ with keyring ‘%s’.",
+           G_STRFUNC, result->remote->name, result->remote->keyring);
+
+  ostree_repo_remote_fetch_summary_with_options (data->repo,
+                                                 result->remote->name,
+                                                 NULL,  /* no options */
+                                                 &fetched->summary_bytes,
+                                                 &fetched->summary_sig_bytes,
+                                                 data->cancellable,
+                                                 &fetched->error);
+}
+
 static void
 find_remotes_cb (GObject      *obj,
                  GAsyncResult *result,
@@ -4737,6 +7468,7 @@ find_remotes_cb (GObject      *obj,
   gsize n_refs;
   g_autoptr(GPtrArray) remotes_to_remove = NULL;  /* (element-type OstreeRemote) */
   g_autoptr(GPtrArray) final_results = NULL;  /* (element-type OstreeRepoFinderResult) */
+  g_autofree FetchedSummary *fetched_summaries = NULL;  /* indexed as @results */
 
   task = G_TASK (user_data);
   self = OSTREE_REPO (g_task_get_source_object (task));
@@ -4790,9 +7522,63 @@ find_remotes_cb (GObject      *obj,
   refs_and_remotes_table = pointer_table_new (n_refs, results->len);
   remotes_to_remove = g_ptr_array_new_with_free_func (NULL);
 
-  /* Fetch and validate the summary file for each result. */
-  /* FIXME: All these downloads could be parallelised; that requires the
-   * ostree_repo_remote_fetch_summary_with_options() API to be async. */
+  /* Add each result’s remote to our internal list of remotes first, so other
+   * libostree API (including the fetchers below) can access it. */
+  for (i = 0; i < results->len; i++)
+    {
+      OstreeRepoFinderResult *result = g_ptr_array_index (results, i);
+
+      if (!_ostree_repo_add_remote (self, result->remote))
+        g_ptr_array_add (remotes_to_remove, result->remote);
+    }
+
+  /* Download the summary and signature for each result concurrently, and
+   * validate the signatures. The downloads will load from the cache if
+   * possible. All the fetches share @cancellable as their deadline; the
+   * validation below stays in result (priority) order. */
+  fetched_summaries = g_new0 (FetchedSummary, results->len);
+
+  {
+    FetchSummariesData fetch_data = { self, results, cancellable, fetched_summaries };
+    GThreadPool *pool = NULL;
+
+    if (results->len > 1)
+      {
+        /* The fetches are network bound, so cap the fan-out rather than
+         * scaling with the local processor count. */
+        pool = g_thread_pool_new (fetch_summary_worker, &fetch_data,
+                                  MIN (results->len, 8u), FALSE, NULL);
+      }
+
+    if (pool != NULL)
+      {
+        for (i = 0; i < results->len; i++)
+          g_thread_pool_push (pool, GSIZE_TO_POINTER (i + 1), NULL);
+
+        /* Waits for the queue to drain */
+        g_thread_pool_free (pool, FALSE, TRUE);
+      }
+    else
+      {
+        /* Single result, or pool creation failed */
+        for (i = 0; i < results->len; i++)
+          fetch_summary_worker (GSIZE_TO_POINTER (i + 1), &fetch_data);
+      }
+  }
+
+  /* A cancellation outranks any per-remote failure. */
+  for (i = 0; i < results->len; i++)
+    {
+      if (g_error_matches (fetched_summaries[i].error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+          error = g_steal_pointer (&fetched_summaries[i].error);
+          for (i = 0; i < results->len; i++)
+            fetched_summary_clear (&fetched_summaries[i]);
+          goto error;
+        }
+    }
+
+  /* Validate the summary file for each result. */
   for (i = 0; i < results->len; i++)
     {
       OstreeRepoFinderResult *result = g_ptr_array_index (results, i);
@@ -4805,27 +7591,11 @@ find_remotes_cb (GObject      *obj,
       g_autoptr(GVariantIter) summary_collection_map = NULL;
       gboolean invalid_result = FALSE;
 
-      /* Add the remote to our internal list of remotes, so other libostree
-       * API can access it. */
-      if (!_ostree_repo_add_remote (self, result->remote))
-        g_ptr_array_add (remotes_to_remove, result->remote);
-
-      g_debug ("%s: Fetching summary for remote ‘%s’ with keyring ‘%s’.",
-               G_STRFUNC, result->remote->name, result->remote->keyring);
+      summary_bytes = g_steal_pointer (&fetched_summaries[i].summary_bytes);
+      summary_sig_bytes = g_steal_pointer (&fetched_summaries[i].summary_sig_bytes);
+      error = g_steal_pointer (&fetched_summaries[i].error);
 
-      /* Download the summary and signature, and validate the signature. This
-       * will load from the cache if possible. */
-      ostree_repo_remote_fetch_summary_with_options (self,
-                                                     result->remote->name,
-                                                     NULL,  /* no options */
-                                                     &summary_bytes,
-                                                     &summary_sig_bytes,
-                                                     cancellable,
-                                                     &error);
-
-      if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-        goto error;
-      else if (error != NULL)
+      if (error != NULL)
         {
           g_debug ("%s: Failed to download summary for result ‘%s’. Ignoring. %s",
                    G_STRFUNC, result->remote->name, error->message);
@@ -4954,7 +7724,8 @@ find_remotes_cb (GObject      *obj,
                                                                mirrorlist,
                                                                commit_filename,
                                                                OSTREE_FETCHER_REQUEST_OPTIONAL_CONTENT,
-                                                               &commit_bytes,
+                                                               NULL, 0,
+                                                               &commit_bytes, NULL, NULL, NULL,
                                                                0,  /* no maximum size */
                                                                cancellable,
                                                                &error))
@@ -5112,8 +7883,12 @@ find_remotes_cb (GObject      *obj,
       g_ptr_array_add (final_results, g_steal_pointer (&g_ptr_array_index (results, i)));
     }
 
-  /* Ensure the updated results are still in priority order. */
-  g_ptr_array_sort (final_results, sort_results_cb);
+  /* Ensure the updated results are still in priority order, with recorded
+   * per-remote throughput breaking ties. */
+  {
+    g_autoptr(GVariant) throughput_cache = load_throughput_cache (self);
+    g_ptr_array_sort_with_data (final_results, sort_results_ranked_cb, throughput_cache);
+  }
 
   /* Remove the remotes we temporarily added.
    * FIXME: It would be so much better if we could pass #OstreeRemote pointers
@@ -5662,3 +8437,117 @@ ostree_repo_remote_fetch_summary_with_options (OstreeRepo    *self,
 }
 
 #endif /* HAVE_LIBCURL_OR_LIBSOUP */
+
+typedef struct {
+  char *remote_name_or_baseurl;
+  GVariant *options;
+  OstreeAsyncProgress *progress;
+} PullWithOptionsAsyncData;
+
+static void
+pull_with_options_async_data_free (PullWithOptionsAsyncData *data)
+{
+  g_free (data->remote_name_or_baseurl);
+  g_clear_pointer (&data->options, g_variant_unref);
+  g_clear_object (&data->progress);
+  g_free (data);
+}
+
+static void
+pull_with_options_thread (GTask        *task,
+                          gpointer      source,
+                          gpointer      task_data,
+                          GCancellable *cancellable)
+{
+  OstreeRepo *repo = source;
+  PullWithOptionsAsyncData *data = task_data;
+  GError *local_error = NULL;
+
+  /* Run the whole pull state machine against a fresh main context
+   * owned by this thread: its per-object dispatch then never contends
+   * with other sources, and the caller's loop only sees the progress
+   * updates and the completion callback. */
+  g_autoptr(GMainContext) mainctx = g_main_context_new ();
+  g_main_context_push_thread_default (mainctx);
+
+  gboolean ret = ostree_repo_pull_with_options (repo, data->remote_name_or_baseurl,
+                                                data->options, data->progress,
+                                                cancellable, &local_error);
+
+  g_main_context_pop_thread_default (mainctx);
+
+  if (ret)
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, local_error);
+}
+
+/**
+ * ostree_repo_pull_with_options_async:
+ * @self: Repo
+ * @remote_name_or_baseurl: Name of remote or file:// url
+ * @options: A GVariant a{sv} with an extensible set of flags; see
+ *    ostree_repo_pull_with_options()
+ * @progress: (allow-none): Progress
+ * @cancellable: Cancellable
+ * @callback: Invoked when the pull completes
+ * @user_data: User data for @callback
+ *
+ * Like ostree_repo_pull_with_options(), but the entire operation runs
+ * on an internal thread with its own main context, so the calling
+ * thread's main loop does not need to be iterated for the pull to make
+ * progress.  @callback is invoked in the thread-default main context
+ * of the caller; progress updates are reported through @progress as
+ * usual, in the main context @progress was constructed in.
+ *
+ * Since: 2017.10
+ */
+void
+ostree_repo_pull_with_options_async (OstreeRepo             *self,
+                                     const char             *remote_name_or_baseurl,
+                                     GVariant               *options,
+                                     OstreeAsyncProgress    *progress,
+                                     GCancellable           *cancellable,
+                                     GAsyncReadyCallback     callback,
+                                     gpointer                user_data)
+{
+  g_return_if_fail (OSTREE_IS_REPO (self));
+  g_return_if_fail (remote_name_or_baseurl != NULL);
+  g_return_if_fail (options == NULL || g_variant_is_of_type (options, G_VARIANT_TYPE ("a{sv}")));
+  g_return_if_fail (progress == NULL || OSTREE_IS_ASYNC_PROGRESS (progress));
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+  PullWithOptionsAsyncData *data = g_new0 (PullWithOptionsAsyncData, 1);
+  data->remote_name_or_baseurl = g_strdup (remote_name_or_baseurl);
+  data->options = options ? g_variant_ref_sink (options) : NULL;
+  data->progress = progress ? g_object_ref (progress) : NULL;
+
+  g_autoptr(GTask) task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, ostree_repo_pull_with_options_async);
+  g_task_set_task_data (task, data, (GDestroyNotify)pull_with_options_async_data_free);
+  g_task_run_in_thread (task, pull_with_options_thread);
+}
+
+/**
+ * ostree_repo_pull_with_options_finish:
+ * @self: Repo
+ * @result: the #GAsyncResult passed to the callback
+ * @error: Error
+ *
+ * Finish an asynchronous pull operation started with
+ * ostree_repo_pull_with_options_async().
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 2017.10
+ */
+gboolean
+ostree_repo_pull_with_options_finish (OstreeRepo    *self,
+                                      GAsyncResult  *result,
+                                      GError       **error)
+{
+  g_return_val_if_fail (OSTREE_IS_REPO (self), FALSE);
+  g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+  g_return_val_if_fail (g_async_result_is_tagged (result, ostree_repo_pull_with_options_async), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
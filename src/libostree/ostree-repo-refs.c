@@ -183,6 +183,169 @@ find_ref_in_remotes (OstreeRepo         *self,
   return TRUE;
 }
 
+/* Packed local refs: a name-sorted a(ss) array of (refname, checksum) mapped
+ * from refs/packed, written by _ostree_repo_pack_refs().  Loose files under
+ * refs/heads always win, so ref writes stay O(1); ref deletion rewrites the
+ * packed file so that a deleted ref can't resurrect from it.
+ */
+#define OSTREE_PACKED_REFS_GVARIANT_STRING "a(ss)"
+
+/* Writers of refs/packed serialize on this flock: every update is a
+ * read-merge-write of the whole file, so two unserialized writers would
+ * each rewrite it from their own stale snapshot and drop the other's
+ * refs.  Readers take no lock - the file is only ever replaced
+ * atomically.  The in-memory mapping is invalidated after the lock is
+ * acquired, since another writer may have replaced the file while we
+ * waited.
+ */
+static gboolean
+packed_refs_lock (OstreeRepo    *self,
+                  GLnxLockFile  *lockfile,
+                  GError       **error)
+{
+  if (!glnx_make_lock_file (self->repo_dir_fd, _OSTREE_PACKED_REFS_PATH ".lock",
+                            LOCK_EX, lockfile, error))
+    return FALSE;
+
+  g_clear_pointer (&self->packed_refs, g_variant_unref);
+  self->packed_refs_checked = FALSE;
+  return TRUE;
+}
+
+static gboolean
+packed_refs_ensure (OstreeRepo  *self,
+                    GError     **error)
+{
+  if (self->packed_refs_checked)
+    return TRUE;
+
+  glnx_fd_close int fd = openat (self->repo_dir_fd, _OSTREE_PACKED_REFS_PATH,
+                                 O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    {
+      if (errno != ENOENT)
+        return glnx_throw_errno_prefix (error, "openat(%s)", _OSTREE_PACKED_REFS_PATH);
+    }
+  else
+    {
+      if (!ot_util_variant_map_fd (fd, 0, G_VARIANT_TYPE (OSTREE_PACKED_REFS_GVARIANT_STRING),
+                                   FALSE, &self->packed_refs, error))
+        return glnx_prefix_error (error, "Mapping %s", _OSTREE_PACKED_REFS_PATH);
+    }
+
+  self->packed_refs_checked = TRUE;
+  return TRUE;
+}
+
+static gboolean
+packed_refs_lookup (OstreeRepo  *self,
+                    const char  *refname,
+                    char       **out_rev,
+                    GError     **error)
+{
+  *out_rev = NULL;
+
+  if (!packed_refs_ensure (self, error))
+    return FALSE;
+  if (self->packed_refs == NULL)
+    return TRUE;
+
+  int pos;
+  if (ot_variant_bsearch_str (self->packed_refs, refname, &pos))
+    {
+      const char *rev;
+      g_autoptr(GVariant) child = g_variant_get_child_value (self->packed_refs, pos);
+      g_variant_get_child (child, 1, "&s", &rev);
+      *out_rev = g_strdup (rev);
+    }
+  return TRUE;
+}
+
+/* Fold packed refs not shadowed by a loose file into @refs, using the same
+ * prefix semantics as the loose enumeration.
+ */
+static gboolean
+packed_refs_merge_into (OstreeRepo  *self,
+                        const char  *ref_prefix,
+                        gboolean     cut_prefix,
+                        GHashTable  *refs,
+                        GError     **error)
+{
+  if (!packed_refs_ensure (self, error))
+    return FALSE;
+  if (self->packed_refs == NULL)
+    return TRUE;
+
+  const gsize n = g_variant_n_children (self->packed_refs);
+  const gsize prefix_len = ref_prefix ? strlen (ref_prefix) : 0;
+  for (gsize i = 0; i < n; i++)
+    {
+      const char *name, *rev;
+      g_variant_get_child (self->packed_refs, i, "(&s&s)", &name, &rev);
+
+      const char *key = name;
+      if (ref_prefix != NULL)
+        {
+          if (strncmp (name, ref_prefix, prefix_len) != 0)
+            continue;
+          if (name[prefix_len] == '/')
+            {
+              if (cut_prefix)
+                key = name + prefix_len + 1;
+            }
+          else if (name[prefix_len] != '\0')
+            continue;
+        }
+
+      if (!g_hash_table_contains (refs, key))
+        g_hash_table_insert (refs, g_strdup (key), g_strdup (rev));
+    }
+  return TRUE;
+}
+
+static gboolean
+packed_refs_remove (OstreeRepo    *self,
+                    const char    *refname,
+                    GCancellable  *cancellable,
+                    GError       **error)
+{
+  g_auto(GLnxLockFile) lockfile = GLNX_LOCK_FILE_INIT;
+  if (!packed_refs_lock (self, &lockfile, error))
+    return FALSE;
+
+  if (!packed_refs_ensure (self, error))
+    return FALSE;
+  if (self->packed_refs == NULL)
+    return TRUE;
+
+  int pos;
+  if (!ot_variant_bsearch_str (self->packed_refs, refname, &pos))
+    return TRUE;
+
+  g_auto(GVariantBuilder) builder = OT_VARIANT_BUILDER_INITIALIZER;
+  g_variant_builder_init (&builder, G_VARIANT_TYPE (OSTREE_PACKED_REFS_GVARIANT_STRING));
+  const gsize n = g_variant_n_children (self->packed_refs);
+  for (gsize i = 0; i < n; i++)
+    {
+      const char *name, *rev;
+      g_variant_get_child (self->packed_refs, i, "(&s&s)", &name, &rev);
+      if (strcmp (name, refname) == 0)
+        continue;
+      g_variant_builder_add (&builder, "(ss)", name, rev);
+    }
+
+  g_autoptr(GVariant) new_packed = g_variant_ref_sink (g_variant_builder_end (&builder));
+  if (!_ostree_repo_file_replace_contents (self, self->repo_dir_fd, _OSTREE_PACKED_REFS_PATH,
+                                           g_variant_get_data (new_packed),
+                                           g_variant_get_size (new_packed),
+                                           cancellable, error))
+    return FALSE;
+
+  g_clear_pointer (&self->packed_refs, g_variant_unref);
+  self->packed_refs = g_steal_pointer (&new_packed);
+  return TRUE;
+}
+
 static gboolean
 resolve_refspec (OstreeRepo     *self,
                  const char     *remote,
@@ -258,7 +421,14 @@ resolve_refspec (OstreeRepo     *self,
       if (!ot_openat_ignore_enoent (self->repo_dir_fd, local_ref, &target_fd, error))
         return FALSE;
 
-      if (target_fd == -1 && fallback_remote)
+      /* Loose files shadow the packed file, so recent writes win */
+      if (target_fd == -1)
+        {
+          if (!packed_refs_lookup (self, ref, &ret_rev, error))
+            return FALSE;
+        }
+
+      if (target_fd == -1 && ret_rev == NULL && fallback_remote)
         {
           local_ref = glnx_strjoina ("refs/remotes/", ref);
 
@@ -286,7 +456,7 @@ resolve_refspec (OstreeRepo     *self,
       if (!ostree_validate_checksum_string (ret_rev, error))
         return FALSE;
     }
-  else
+  else if (ret_rev == NULL)
     {
       if (!resolve_refspec_fallback (self, remote, ref, allow_noent, fallback_remote,
                                      &ret_rev, cancellable, error))
@@ -389,7 +559,6 @@ _ostree_repo_resolve_rev_internal (OstreeRepo     *self,
         {
           g_autofree char *parent_refspec = NULL;
           g_autofree char *parent_rev = NULL;
-          g_autoptr(GVariant) commit = NULL;
 
           parent_refspec = g_strdup (refspec);
           parent_refspec[strlen(parent_refspec) - 1] = '\0';
@@ -397,12 +566,36 @@ _ostree_repo_resolve_rev_internal (OstreeRepo     *self,
           if (!ostree_repo_resolve_rev (self, parent_refspec, allow_noent, &parent_rev, error))
             return FALSE;
 
-          if (!ostree_repo_load_variant (self, OSTREE_OBJECT_TYPE_COMMIT, parent_rev,
-                                         &commit, error))
+          /* The commit graph can answer the parent pointer without
+           * loading the commit object; since the graph may predate a
+           * prune, check that the parent object still exists before
+           * trusting it.
+           */
+          gboolean found_in_graph = FALSE;
+          g_autofree char *graph_parent = NULL;
+          if (!_ostree_repo_commit_graph_lookup (self, parent_rev, &found_in_graph,
+                                                 &graph_parent, NULL, NULL, error))
             return FALSE;
+          if (found_in_graph && graph_parent != NULL)
+            {
+              gboolean have_parent = FALSE;
+              if (!ostree_repo_has_object (self, OSTREE_OBJECT_TYPE_COMMIT, graph_parent,
+                                           &have_parent, NULL, error))
+                return FALSE;
+              if (have_parent)
+                ret_rev = g_steal_pointer (&graph_parent);
+            }
+
+          if (!ret_rev)
+            {
+              g_autoptr(GVariant) commit = NULL;
+              if (!ostree_repo_load_variant (self, OSTREE_OBJECT_TYPE_COMMIT, parent_rev,
+                                             &commit, error))
+                return FALSE;
 
-          if (!(ret_rev = ostree_commit_get_parent (commit)))
-            return glnx_throw (error, "Commit %s has no parent", parent_rev);
+              if (!(ret_rev = ostree_commit_get_parent (commit)))
+                return glnx_throw (error, "Commit %s has no parent", parent_rev);
+            }
         }
       else
         {
@@ -548,6 +741,7 @@ _ostree_repo_list_refs_internal (OstreeRepo       *self,
   g_autoptr(GHashTable) ret_all_refs = NULL;
   g_autofree char *remote = NULL;
   g_autofree char *ref_prefix = NULL;
+  const gboolean aliases_only = (flags & OSTREE_REPO_LIST_REFS_EXT_ALIASES) > 0;
 
   ret_all_refs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
 
@@ -605,6 +799,13 @@ _ostree_repo_list_refs_internal (OstreeRepo       *self,
                 return FALSE;
             }
         }
+
+      /* The packed file only covers local refs, and holds no aliases */
+      if (remote == NULL && !aliases_only)
+        {
+          if (!packed_refs_merge_into (self, ref_prefix, cut_prefix, ret_all_refs, error))
+            return FALSE;
+        }
     }
   else
     {
@@ -620,6 +821,12 @@ _ostree_repo_list_refs_internal (OstreeRepo       *self,
                                    ret_all_refs, cancellable, error))
         return FALSE;
 
+      if (!aliases_only)
+        {
+          if (!packed_refs_merge_into (self, NULL, FALSE, ret_all_refs, error))
+            return FALSE;
+        }
+
       g_string_truncate (base_path, 0);
 
       if (!glnx_dirfd_iterator_init_at (self->repo_dir_fd, "refs/remotes", TRUE, &dfd_iter, error))
@@ -890,6 +1097,16 @@ _ostree_repo_write_ref (OstreeRepo                 *self,
                 return glnx_throw_errno (error);
             }
         }
+
+      /* A deleted local ref must also leave the packed file, or it would
+       * resurrect from there.
+       */
+      if (remote == NULL &&
+          (ref->collection_id == NULL || g_strcmp0 (ref->collection_id, ostree_repo_get_collection_id (self)) == 0))
+        {
+          if (!packed_refs_remove (self, ref->ref_name, cancellable, error))
+            return FALSE;
+        }
     }
   else if (rev != NULL)
     {
@@ -924,6 +1141,12 @@ _ostree_repo_write_ref (OstreeRepo                 *self,
   return TRUE;
 }
 
+static gboolean
+update_local_refs_packed (OstreeRepo    *self,
+                          GHashTable    *updates,  /* (element-type utf8 utf8) */
+                          GCancellable  *cancellable,
+                          GError       **error);
+
 gboolean
 _ostree_repo_update_refs (OstreeRepo        *self,
                           GHashTable        *refs,  /* (element-type utf8 utf8) */
@@ -932,6 +1155,44 @@ _ostree_repo_update_refs (OstreeRepo        *self,
 {
   GHashTableIter hash_iter;
   gpointer key, value;
+  g_autoptr(GHashTable) packed_updates = NULL;
+
+  /* If the repository opted into packed refs (ostree refs --pack), batch
+   * the local ref updates into a single atomic replacement of the packed
+   * file: one temp file, one fsync, one rename for the whole set, rather
+   * than a write+rename per ref.  The replacement is also all-or-nothing,
+   * so a crash can't leave a half-updated release.  Remote refs and
+   * deletions are rare and keep the per-ref loose path.
+   */
+  if (!packed_refs_ensure (self, error))
+    return FALSE;
+  if (self->packed_refs != NULL && g_hash_table_size (refs) > 1)
+    {
+      packed_updates = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+      g_hash_table_iter_init (&hash_iter, refs);
+      while (g_hash_table_iter_next (&hash_iter, &key, &value))
+        {
+          const char *refspec = key;
+          const char *rev = value;
+          g_autofree char *remote = NULL;
+          g_autofree char *ref_name = NULL;
+
+          if (!ostree_parse_refspec (refspec, &remote, &ref_name, error))
+            return FALSE;
+
+          if (remote == NULL && rev != NULL)
+            g_hash_table_insert (packed_updates, g_steal_pointer (&ref_name), g_strdup (rev));
+        }
+
+      if (g_hash_table_size (packed_updates) > 1)
+        {
+          if (!update_local_refs_packed (self, packed_updates, cancellable, error))
+            return FALSE;
+        }
+      else
+        g_clear_pointer (&packed_updates, g_hash_table_unref);
+    }
 
   g_hash_table_iter_init (&hash_iter, refs);
   while (g_hash_table_iter_next (&hash_iter, &key, &value))
@@ -944,6 +1205,11 @@ _ostree_repo_update_refs (OstreeRepo        *self,
       if (!ostree_parse_refspec (refspec, &remote, &ref_name, error))
         return FALSE;
 
+      /* Already part of the batched packed update above? */
+      if (packed_updates != NULL && remote == NULL && rev != NULL
+          && g_hash_table_contains (packed_updates, ref_name))
+        continue;
+
       const OstreeCollectionRef ref = { NULL, ref_name };
       if (!_ostree_repo_write_ref (self, remote, &ref, rev, NULL,
                                    cancellable, error))
@@ -953,6 +1219,196 @@ _ostree_repo_update_refs (OstreeRepo        *self,
   return TRUE;
 }
 
+static int
+compare_strings_p (gconstpointer a,
+                   gconstpointer b)
+{
+  return strcmp (*(const char * const *)a, *(const char * const *)b);
+}
+
+/* Atomically replace the packed file with the sorted contents of @all_refs
+ * (refname → checksum), and update the in-memory mapping.
+ */
+static gboolean
+packed_refs_write (OstreeRepo    *self,
+                   GHashTable    *all_refs,
+                   GCancellable  *cancellable,
+                   GError       **error)
+{
+  g_autoptr(GPtrArray) sorted_names = g_ptr_array_new ();
+  GLNX_HASH_TABLE_FOREACH (all_refs, const char *, name)
+    g_ptr_array_add (sorted_names, (char*)name);
+  g_ptr_array_sort (sorted_names, compare_strings_p);
+
+  g_auto(GVariantBuilder) builder = OT_VARIANT_BUILDER_INITIALIZER;
+  g_variant_builder_init (&builder, G_VARIANT_TYPE (OSTREE_PACKED_REFS_GVARIANT_STRING));
+  for (guint i = 0; i < sorted_names->len; i++)
+    {
+      const char *name = sorted_names->pdata[i];
+      g_variant_builder_add (&builder, "(ss)", name,
+                             (const char*)g_hash_table_lookup (all_refs, name));
+    }
+
+  g_autoptr(GVariant) new_packed = g_variant_ref_sink (g_variant_builder_end (&builder));
+  if (!_ostree_repo_file_replace_contents (self, self->repo_dir_fd, _OSTREE_PACKED_REFS_PATH,
+                                           g_variant_get_data (new_packed),
+                                           g_variant_get_size (new_packed),
+                                           cancellable, error))
+    return FALSE;
+
+  g_clear_pointer (&self->packed_refs, g_variant_unref);
+  self->packed_refs = g_steal_pointer (&new_packed);
+  self->packed_refs_checked = TRUE;
+
+  return TRUE;
+}
+
+/* Fold all loose refs under refs/heads together with any previous packed
+ * generation into a single sorted refs/packed file, then remove the loose
+ * files.  Symlink aliases stay loose, since the packed format only holds
+ * resolved checksums.  The caller must hold the packed_refs_lock().
+ */
+static gboolean
+pack_refs_locked (OstreeRepo    *self,
+                  GCancellable  *cancellable,
+                  GError       **error)
+{
+  g_autoptr(GHashTable) loose_refs = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                            g_free, g_free);
+  g_autoptr(GString) base_path = g_string_new ("");
+  glnx_fd_close int refs_heads_dfd = -1;
+
+  if (!glnx_opendirat (self->repo_dir_fd, "refs/heads", TRUE, &refs_heads_dfd, error))
+    return FALSE;
+
+  if (!enumerate_refs_recurse (self, NULL, OSTREE_REPO_LIST_REFS_EXT_NONE, NULL,
+                               refs_heads_dfd, base_path,
+                               refs_heads_dfd, ".",
+                               loose_refs, cancellable, error))
+    return FALSE;
+
+  g_autoptr(GHashTable) all_refs = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                          g_free, g_free);
+  GLNX_HASH_TABLE_FOREACH_KV (loose_refs, const char *, name, const char *, rev)
+    g_hash_table_insert (all_refs, g_strdup (name), g_strdup (rev));
+  if (!packed_refs_merge_into (self, NULL, FALSE, all_refs, error))
+    return FALSE;
+
+  if (!packed_refs_write (self, all_refs, cancellable, error))
+    return FALSE;
+
+  /* Now that the packed file covers them, drop the loose files; aliases
+   * (symlinks) are kept, they simply shadow their packed entry.  A ref
+   * update may have landed since we enumerated, so each loose file is
+   * unlinked only if its contents still match what we packed - a
+   * mismatched file stays and shadows its (stale) packed entry, which
+   * the next pack folds in.  This mirrors git's pack-refs protocol.
+   */
+  GLNX_HASH_TABLE_FOREACH_KV (loose_refs, const char *, name, const char *, rev)
+    {
+      struct stat stbuf;
+      if (fstatat (refs_heads_dfd, name, &stbuf, AT_SYMLINK_NOFOLLOW) != 0)
+        continue;
+      if (S_ISLNK (stbuf.st_mode))
+        continue;
+
+      g_autofree char *current =
+        glnx_file_get_contents_utf8_at (refs_heads_dfd, name, NULL, cancellable, NULL);
+      if (current == NULL)
+        continue;  /* Deleted underneath us; nothing to unlink */
+      g_strchomp (current);
+      if (strcmp (current, rev) != 0)
+        continue;
+
+      if (unlinkat (refs_heads_dfd, name, 0) != 0 && errno != ENOENT)
+        return glnx_throw_errno_prefix (error, "unlinkat(%s)", name);
+    }
+
+  if (!_ostree_repo_update_mtime (self, error))
+    return FALSE;
+
+  return TRUE;
+}
+
+gboolean
+_ostree_repo_pack_refs (OstreeRepo    *self,
+                        GCancellable  *cancellable,
+                        GError       **error)
+{
+  g_auto(GLnxLockFile) lockfile = GLNX_LOCK_FILE_INIT;
+  if (!packed_refs_lock (self, &lockfile, error))
+    return FALSE;
+
+  return pack_refs_locked (self, cancellable, error);
+}
+
+/* Batched all-or-nothing update of local refs via the packed file.  We
+ * first fold the current loose refs into the packed file at their current
+ * values (value-preserving, so a crash there changes nothing visible);
+ * that guarantees no stale loose file can shadow the batch.  Then the new
+ * values for every ref in @updates are applied in one atomic replacement
+ * of the packed file - the single commit point (and single sync) for the
+ * whole set.
+ */
+static gboolean
+update_local_refs_packed (OstreeRepo    *self,
+                          GHashTable    *updates,  /* (element-type utf8 utf8) */
+                          GCancellable  *cancellable,
+                          GError       **error)
+{
+  /* Validate everything up front; nothing may fail after we start writing */
+  GLNX_HASH_TABLE_FOREACH_KV (updates, const char *, name, const char *, rev)
+    {
+      if (!ostree_validate_rev (name, error))
+        return FALSE;
+      if (!ostree_validate_checksum_string (rev, error))
+        return FALSE;
+    }
+
+  /* Hold the writer lock across the whole fold-merge-write cycle, so a
+   * concurrent transaction can't interleave its own rewrite and lose
+   * one side's refs.
+   */
+  g_auto(GLnxLockFile) lockfile = GLNX_LOCK_FILE_INIT;
+  if (!packed_refs_lock (self, &lockfile, error))
+    return FALSE;
+
+  if (!pack_refs_locked (self, cancellable, error))
+    return FALSE;
+
+  g_autoptr(GHashTable) all_refs = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                          g_free, g_free);
+  if (!packed_refs_merge_into (self, NULL, FALSE, all_refs, error))
+    return FALSE;
+
+  GLNX_HASH_TABLE_FOREACH_KV (updates, const char *, name, const char *, rev)
+    g_hash_table_replace (all_refs, g_strdup (name), g_strdup (rev));
+
+  if (!packed_refs_write (self, all_refs, cancellable, error))
+    return FALSE;
+
+  /* Packing leaves symlink aliases loose, and loose entries shadow packed
+   * ones; an update targeting a ref that's currently an alias must replace
+   * it, as the loose path would have.
+   */
+  GLNX_HASH_TABLE_FOREACH (updates, const char *, name)
+    {
+      g_autofree char *path = g_strconcat ("refs/heads/", name, NULL);
+      struct stat stbuf;
+
+      if (fstatat (self->repo_dir_fd, path, &stbuf, AT_SYMLINK_NOFOLLOW) != 0)
+        continue;
+      if (S_ISLNK (stbuf.st_mode) &&
+          unlinkat (self->repo_dir_fd, path, 0) != 0 && errno != ENOENT)
+        return glnx_throw_errno_prefix (error, "unlinkat(%s)", path);
+    }
+
+  if (!_ostree_repo_update_mtime (self, error))
+    return FALSE;
+
+  return TRUE;
+}
+
 gboolean
 _ostree_repo_update_collection_refs (OstreeRepo        *self,
                                      GHashTable        *refs,  /* (element-type OstreeCollectionRef utf8) */
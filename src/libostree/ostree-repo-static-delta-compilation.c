@@ -28,6 +28,10 @@
 #include "ostree-core-private.h"
 #include "ostree-repo-private.h"
 #include "ostree-lzma-compressor.h"
+#ifdef HAVE_ZSTD
+#include "ostree-zstd-compressor.h"
+#include <zstd.h>
+#endif
 #include "ostree-repo-static-delta-private.h"
 #include "ostree-diff.h"
 #include "ostree-rollsum.h"
@@ -55,10 +59,13 @@ typedef struct {
   guint64 loose_compressed_size;
   guint64 min_fallback_size_bytes;
   guint64 max_bsdiff_size_bytes;
+  guint64 max_bsdiff_memory_bytes;
+  guint64 zstd_diff_min_size_bytes;
   guint64 max_chunk_size_bytes;
   guint64 rollsum_size;
   guint n_rollsum;
   guint n_bsdiff;
+  guint n_zstd_diff;
   guint n_fallback;
   gboolean swap_endian;
 } OstreeStaticDeltaBuilder;
@@ -405,6 +412,10 @@ process_one_object (OstreeRepo                       *repo,
 
 typedef struct {
   char *from_checksum;
+  /* If TRUE, emit a zstd-dictionary patch (OP_ZDPATCH) for this pair
+   * instead of running bsdiff; see the zstd-diff-min-size param.
+   */
+  gboolean use_zstd;
 } ContentBsdiff;
 
 typedef struct {
@@ -455,6 +466,8 @@ try_content_bsdiff (OstreeRepo                       *repo,
                     const char                       *to,
                     ContentBsdiff                    **out_bsdiff,
                     guint64                          max_bsdiff_size_bytes,
+                    guint64                          max_bsdiff_memory_bytes,
+                    guint64                          zstd_diff_min_size_bytes,
                     GCancellable                     *cancellable,
                     GError                           **error)
 {
@@ -471,17 +484,95 @@ try_content_bsdiff (OstreeRepo                       *repo,
 
   *out_bsdiff = NULL;
 
-  /* Ignore this if it's too large */
-  if (g_file_info_get_size (to_finfo) + g_file_info_get_size (from_finfo) > max_bsdiff_size_bytes)
-    return TRUE;
+  const guint64 total_size =
+    (guint64)g_file_info_get_size (to_finfo) + (guint64)g_file_info_get_size (from_finfo);
+
+  /* At or above the (optional) threshold we switch to the
+   * zstd-dictionary engine, which is much faster than bsdiff on large
+   * objects and whose working set is linear in the input size, so the
+   * bsdiff size and memory caps below don't apply to it.
+   */
+  const gboolean use_zstd =
+    zstd_diff_min_size_bytes > 0 && total_size >= zstd_diff_min_size_bytes;
+
+  if (!use_zstd)
+    {
+      /* Ignore this if it's too large */
+      if (total_size > max_bsdiff_size_bytes)
+        return TRUE;
+
+      /* Also skip pairs whose estimated bsdiff working set would exceed the
+       * configured memory cap: the suffix array alone is 8 bytes per byte of
+       * the from object, on top of the mapped copies of both objects and the
+       * patch buffer.  Skipped pairs fall back to rollsum or plain
+       * compression rather than OOMing the builder.
+       */
+      if (max_bsdiff_memory_bytes > 0)
+        {
+          const guint64 estimated_memory =
+            ((guint64)g_file_info_get_size (from_finfo)) * 9 +
+            ((guint64)g_file_info_get_size (to_finfo)) * 2;
+          if (estimated_memory > max_bsdiff_memory_bytes)
+            return TRUE;
+        }
+    }
 
   ContentBsdiff *ret_bsdiff = g_new0 (ContentBsdiff, 1);
   ret_bsdiff->from_checksum = g_strdup (from);
+  ret_bsdiff->use_zstd = use_zstd;
 
   ot_transfer_out_value (out_bsdiff, &ret_bsdiff);
   return TRUE;
 }
 
+/* Fetch the rollsum chunk table of the content object named by
+ * @checksum, from the repo cache directory if we've computed it before
+ * (the table is a pure function of the content, so the content checksum
+ * fully keys it).  Repeated delta builds against the same baseline
+ * re-roll gigabytes of unchanged objects otherwise.  Best-effort: on
+ * any cache problem we just compute the table, and a cache write
+ * failure is ignored.
+ */
+static GVariant *
+rollsum_chunk_table_cached (OstreeRepo    *repo,
+                            const char    *checksum,
+                            GBytes        *content,
+                            GCancellable  *cancellable)
+{
+  GVariant *ret = NULL;
+
+  if (repo->cache_dir_fd != -1)
+    {
+      const char *path = glnx_strjoina (_OSTREE_ROLLSUM_CACHE_DIR, "/", checksum);
+      glnx_fd_close int fd = -1;
+
+      if (ot_openat_ignore_enoent (repo->cache_dir_fd, path, &fd, NULL) && fd != -1)
+        {
+          if (ot_util_variant_map_fd (fd, 0, G_VARIANT_TYPE ("a(utt)"),
+                                      FALSE, &ret, NULL))
+            return ret;
+        }
+    }
+
+  ret = _ostree_rollsum_chunk_table (content);
+
+  if (repo->cache_dir_fd != -1
+      && glnx_shutil_mkdir_p_at (repo->cache_dir_fd, _OSTREE_ROLLSUM_CACHE_DIR,
+                                 0775, cancellable, NULL))
+    {
+      const char *path = glnx_strjoina (_OSTREE_ROLLSUM_CACHE_DIR, "/", checksum);
+      g_autoptr(GVariant) normalized = g_variant_get_normal_form (ret);
+
+      (void) glnx_file_replace_contents_at (repo->cache_dir_fd, path,
+                                            g_variant_get_data (normalized),
+                                            g_variant_get_size (normalized),
+                                            GLNX_FILE_REPLACE_NODATASYNC,
+                                            cancellable, NULL);
+    }
+
+  return ret;
+}
+
 static gboolean
 try_content_rollsum (OstreeRepo                       *repo,
                      DeltaOpts                        opts,
@@ -503,7 +594,15 @@ try_content_rollsum (OstreeRepo                       *repo,
   if (!get_unpacked_unlinked_content (repo, to, &tmp_to, cancellable, error))
     return FALSE;
 
-  OstreeRollsumMatches *matches = _ostree_compute_rollsum_matches (tmp_from, tmp_to);
+  g_autoptr(GVariant) from_chunk_table =
+    rollsum_chunk_table_cached (repo, from, tmp_from, cancellable);
+  /* The 'to' side is worth caching too; it's next build's 'from' */
+  g_autoptr(GVariant) to_chunk_table =
+    rollsum_chunk_table_cached (repo, to, tmp_to, cancellable);
+
+  OstreeRollsumMatches *matches =
+    _ostree_compute_rollsum_matches_full (tmp_from, tmp_to,
+                                          from_chunk_table, to_chunk_table);
 
   const guint match_ratio = (matches->bufmatches*100)/matches->total;
 
@@ -741,7 +840,40 @@ process_one_bsdiff (OstreeRepo                       *repo,
     _ostree_write_varuint64 (current_part->operations, xattr_offset);
     _ostree_write_varuint64 (current_part->operations, content_size);
 
-    {
+    if (bsdiff_content->use_zstd)
+      {
+#ifdef HAVE_ZSTD
+        /* zstd-dictionary engine: compress the new object using the old
+         * one as a dictionary.  Level 10 matches the default of the
+         * zstd part compressor.
+         */
+        const size_t bound = ZSTD_compressBound (tmp_to_len);
+        g_autofree guint8 *patch = g_malloc (bound);
+        ZSTD_CCtx *cctx = ZSTD_createCCtx ();
+        if (cctx == NULL)
+          return glnx_throw (error, "zstd: failed to create compression context");
+        const size_t res = ZSTD_compress_usingDict (cctx, patch, bound,
+                                                    tmp_to_buf, tmp_to_len,
+                                                    tmp_from_buf, tmp_from_len,
+                                                    10);
+        ZSTD_freeCCtx (cctx);
+        if (ZSTD_isError (res))
+          return glnx_throw (error, "zstd: %s", ZSTD_getErrorName (res));
+
+        g_string_append_c (current_part->operations, (gchar)OSTREE_STATIC_DELTA_OP_ZDPATCH);
+        _ostree_write_varuint64 (current_part->operations, current_part->payload->len);
+        _ostree_write_varuint64 (current_part->operations, res);
+
+        g_string_append_len (current_part->payload, (char*)patch, res);
+#else
+        /* Parameter validation rejects zstd-diff-min-size when built
+         * without zstd.
+         */
+        g_assert_not_reached ();
+#endif
+      }
+    else
+      {
       struct bsdiff_stream stream;
       struct bzdiff_opaque_s op;
       const gchar *payload;
@@ -765,7 +897,7 @@ process_one_bsdiff (OstreeRepo                       *repo,
       _ostree_write_varuint64 (current_part->operations, payload_size);
 
       g_string_append_len (current_part->payload, payload, payload_size);
-    }
+      }
     g_string_append_c (current_part->operations, (gchar)OSTREE_STATIC_DELTA_OP_CLOSE);
   }
 
@@ -774,6 +906,46 @@ process_one_bsdiff (OstreeRepo                       *repo,
   return TRUE;
 }
 
+/* Cheap compressibility probe for a delta part payload: measure how far
+ * the byte histogram of (up to) the first 256KiB deviates from uniform.
+ * Random-looking data - mostly file content that's already compressed -
+ * stays close to uniform, and the default xz preset buys almost nothing
+ * there while costing the most CPU, so such parts get a fast preset
+ * instead.  Integer-only on purpose; we don't link against libm.
+ */
+static guint32
+delta_part_pick_preset (GBytes *payload)
+{
+  gsize len;
+  const guint8 *data = g_bytes_get_data (payload, &len);
+  const gsize sample = MIN (len, (gsize)256 * 1024);
+  gsize counts[256] = { 0, };
+  const gsize expected = sample / G_N_ELEMENTS (counts);
+  gsize deviation = 0;
+
+  /* Tiny payloads compress quickly no matter what */
+  if (expected == 0)
+    return 8;
+
+  for (gsize i = 0; i < sample; i++)
+    counts[data[i]]++;
+
+  for (guint i = 0; i < G_N_ELEMENTS (counts); i++)
+    {
+      if (counts[i] > expected)
+        deviation += counts[i] - expected;
+      else
+        deviation += expected - counts[i];
+    }
+
+  /* Uniformly random data lands around 2-3% total deviation; anything
+   * structured enough for xz to earn its keep is far above 12.5%.
+   */
+  if (deviation < sample / 8)
+    return 1;
+  return 8;
+}
+
 static gboolean
 check_object_world_readable (OstreeRepo   *repo,
                              const char   *checksum,
@@ -793,6 +965,80 @@ check_object_world_readable (OstreeRepo   *repo,
   return TRUE;
 }
 
+/* Per-object rollsum/bsdiff analysis is by far the hottest part of
+ * delta generation and each modified file is independent, so we fan it
+ * out over a thread pool.  Each task owns its own buffers; results are
+ * only folded back into the shared tables after the pool has drained.
+ */
+typedef struct {
+  OstreeRepo *repo;
+  DeltaOpts opts;
+  guint64 max_bsdiff_size_bytes;
+  guint64 max_bsdiff_memory_bytes;
+  guint64 zstd_diff_min_size_bytes;
+  GCancellable *cancellable;
+} DeltaAnalysisCtx;
+
+typedef struct {
+  char *from_checksum;
+  char *to_checksum;
+  ContentRollsum *rollsum;
+  ContentBsdiff *bsdiff;
+  GError *error;
+} DeltaAnalysisTask;
+
+static void
+delta_analysis_task_free (DeltaAnalysisTask *task)
+{
+  g_free (task->from_checksum);
+  g_free (task->to_checksum);
+  if (task->rollsum)
+    content_rollsums_free (task->rollsum);
+  if (task->bsdiff)
+    content_bsdiffs_free (task->bsdiff);
+  g_clear_error (&task->error);
+  g_free (task);
+}
+
+static void
+delta_analysis_worker (gpointer data,
+                       gpointer user_data)
+{
+  DeltaAnalysisTask *task = data;
+  DeltaAnalysisCtx *ctx = user_data;
+  gboolean from_world_readable = FALSE;
+
+  /* We only want to include in the delta objects that we are sure will
+   * be readable by the client when applying the delta, regardless its
+   * access privileges, so that we don't run into permissions problems
+   * when the client is trying to update a bare-user repository with a
+   * bare repository defined as its parent.
+   */
+  if (!check_object_world_readable (ctx->repo, task->from_checksum,
+                                    &from_world_readable, ctx->cancellable,
+                                    &task->error))
+    return;
+  if (!from_world_readable)
+    return;
+
+  if (!try_content_rollsum (ctx->repo, ctx->opts,
+                            task->from_checksum, task->to_checksum,
+                            &task->rollsum, ctx->cancellable, &task->error))
+    return;
+  if (task->rollsum)
+    return;
+
+  if (!(ctx->opts & DELTAOPT_FLAG_DISABLE_BSDIFF))
+    {
+      if (!try_content_bsdiff (ctx->repo, task->from_checksum, task->to_checksum,
+                               &task->bsdiff, ctx->max_bsdiff_size_bytes,
+                               ctx->max_bsdiff_memory_bytes,
+                               ctx->zstd_diff_min_size_bytes,
+                               ctx->cancellable, &task->error))
+        return;
+    }
+}
+
 static gboolean
 generate_delta_lowlatency (OstreeRepo                       *repo,
                            const char                       *from,
@@ -915,48 +1161,55 @@ generate_delta_lowlatency (OstreeRepo                       *repo,
                                                             g_free,
                                                             (GDestroyNotify) content_bsdiffs_free);
 
-  g_hash_table_iter_init (&hashiter, modified_regfile_content);
-  while (g_hash_table_iter_next (&hashiter, &key, &value))
-    {
-      const char *to_checksum = key;
-      const char *from_checksum = value;
-      ContentRollsum *rollsum;
-      ContentBsdiff *bsdiff;
-      gboolean from_world_readable = FALSE;
-
-      /* We only want to include in the delta objects that we are sure will
-       * be readable by the client when applying the delta, regardless its
-       * access privileges, so that we don't run into permissions problems
-       * when the client is trying to update a bare-user repository with a
-       * bare repository defined as its parent.
-       */
-      if (!check_object_world_readable (repo, from_checksum, &from_world_readable, cancellable, error))
-        return FALSE;
-      if (!from_world_readable)
-        continue;
+  { DeltaAnalysisCtx analysis_ctx = { repo, opts, builder->max_bsdiff_size_bytes,
+                                      builder->max_bsdiff_memory_bytes,
+                                      builder->zstd_diff_min_size_bytes, cancellable };
+    g_autoptr(GPtrArray) analysis_tasks =
+      g_ptr_array_new_with_free_func ((GDestroyNotify)delta_analysis_task_free);
+    GThreadPool *pool = g_thread_pool_new (delta_analysis_worker, &analysis_ctx,
+                                           g_get_num_processors (), FALSE, NULL);
 
-      if (!try_content_rollsum (repo, opts, from_checksum, to_checksum,
-                                &rollsum, cancellable, error))
-        return FALSE;
+    g_hash_table_iter_init (&hashiter, modified_regfile_content);
+    while (g_hash_table_iter_next (&hashiter, &key, &value))
+      {
+        DeltaAnalysisTask *task = g_new0 (DeltaAnalysisTask, 1);
+
+        task->to_checksum = g_strdup (key);
+        task->from_checksum = g_strdup (value);
+        g_ptr_array_add (analysis_tasks, task);
+        if (pool)
+          g_thread_pool_push (pool, task, NULL);
+        else
+          delta_analysis_worker (task, &analysis_ctx);
+      }
 
-      if (rollsum)
-        {
-          g_hash_table_insert (rollsum_optimized_content_objects, g_strdup (to_checksum), rollsum);
-          builder->rollsum_size += rollsum->matches->match_size;
-          continue;
-        }
+    /* Blocks until all queued tasks have run */
+    if (pool)
+      g_thread_pool_free (pool, FALSE, TRUE);
 
-      if (!(opts & DELTAOPT_FLAG_DISABLE_BSDIFF))
-        {
-          if (!try_content_bsdiff (repo, from_checksum, to_checksum,
-                                   &bsdiff, builder->max_bsdiff_size_bytes,
-                                   cancellable, error))
-            return FALSE;
+    for (guint i = 0; i < analysis_tasks->len; i++)
+      {
+        DeltaAnalysisTask *task = analysis_tasks->pdata[i];
 
-          if (bsdiff)
-            g_hash_table_insert (bsdiff_optimized_content_objects, g_strdup (to_checksum), bsdiff);
-        }
-    }
+        if (task->error != NULL)
+          {
+            g_propagate_error (error, g_steal_pointer (&task->error));
+            return FALSE;
+          }
+
+        if (task->rollsum)
+          {
+            builder->rollsum_size += task->rollsum->matches->match_size;
+            g_hash_table_insert (rollsum_optimized_content_objects,
+                                 g_strdup (task->to_checksum),
+                                 g_steal_pointer (&task->rollsum));
+          }
+        else if (task->bsdiff)
+          g_hash_table_insert (bsdiff_optimized_content_objects,
+                               g_strdup (task->to_checksum),
+                               g_steal_pointer (&task->bsdiff));
+      }
+  }
 
   if (opts & DELTAOPT_FLAG_VERBOSE)
     {
@@ -1012,7 +1265,10 @@ generate_delta_lowlatency (OstreeRepo                       *repo,
                                cancellable, error))
         return FALSE;
 
-      builder->n_bsdiff++;
+      if (bsdiff->use_zstd)
+        builder->n_zstd_diff++;
+      else
+        builder->n_bsdiff++;
     }
 
   /* Scan for large objects, so we can fall back to plain HTTP-based
@@ -1142,6 +1398,171 @@ get_fallback_headers (OstreeRepo               *self,
   return TRUE;
 }
 
+/* Read one varuint operand while peephole-optimizing; the opcode stream
+ * was generated by us just above, so a parse failure is a programmer
+ * error, not input corruption.
+ */
+static guint64
+peephole_read_varuint (const guint8 **op,
+                       gsize         *remaining)
+{
+  guint64 value;
+  gsize bytes_read;
+  gboolean valid = _ostree_read_varuint64 (*op, *remaining, &value, &bytes_read);
+
+  g_assert (valid);
+  *op += bytes_read;
+  *remaining -= bytes_read;
+  return value;
+}
+
+static void
+peephole_flush_write (GString  *out,
+                      gboolean *have_pending,
+                      guint64   pending_length,
+                      guint64   pending_offset)
+{
+  if (!*have_pending)
+    return;
+  g_string_append_c (out, (gchar)OSTREE_STATIC_DELTA_OP_WRITE);
+  _ostree_write_varuint64 (out, pending_length);
+  _ostree_write_varuint64 (out, pending_offset);
+  *have_pending = FALSE;
+}
+
+/* Peephole-optimize a part's opcode stream before serialization.  The
+ * generators above emit one OP_WRITE per rollsum match and don't look
+ * across object boundaries, so the stream contains long runs of writes
+ * from contiguous source (or payload) ranges, plus read-source
+ * bookkeeping that the interpreter state makes redundant (OP_CLOSE
+ * already unsets the read source).  Merging and dropping those here
+ * shrinks the (compressed) opcode stream and saves the interpreter a
+ * read()/lseek() round per dropped op, which is measurable on slow CPUs
+ * applying deltas with millions of ops.  Semantics are unchanged: writes
+ * are only merged when both their source ranges and (implicitly, since
+ * output is sequential) their output ranges are adjacent, so the applied
+ * bytes are byte-identical.
+ */
+static void
+peephole_optimize_operations (OstreeStaticDeltaPartBuilder *part_builder)
+{
+  const guint8 *op = (const guint8*)part_builder->operations->str;
+  gsize remaining = part_builder->operations->len;
+  GString *out = g_string_sized_new (part_builder->operations->len);
+  guint obj_index = 0;
+  /* Payload offset of the active read source's checksum, or -1; mirrors
+   * read_source_fd in the StaticDeltaExecutionState.
+   */
+  gint64 read_source = -1;
+  gboolean have_pending = FALSE;
+  guint64 pending_length = 0;
+  guint64 pending_offset = 0;
+  gint64 pending_source = -1;
+
+  while (remaining > 0)
+    {
+      const guint8 opcode = *op;
+      op++;
+      remaining--;
+
+      if (opcode == OSTREE_STATIC_DELTA_OP_WRITE)
+        {
+          const guint64 length = peephole_read_varuint (&op, &remaining);
+          const guint64 offset = peephole_read_varuint (&op, &remaining);
+
+          if (have_pending
+              && pending_source == read_source
+              && offset == pending_offset + pending_length
+              && pending_length + length >= pending_length)
+            {
+              pending_length += length;
+            }
+          else
+            {
+              peephole_flush_write (out, &have_pending, pending_length, pending_offset);
+              have_pending = TRUE;
+              pending_length = length;
+              pending_offset = offset;
+              pending_source = read_source;
+            }
+          continue;
+        }
+
+      peephole_flush_write (out, &have_pending, pending_length, pending_offset);
+
+      switch (opcode)
+        {
+        case OSTREE_STATIC_DELTA_OP_SET_READ_SOURCE:
+          {
+            const guint64 source_offset = peephole_read_varuint (&op, &remaining);
+            /* Re-setting the active source would just close and reopen
+             * the same object.
+             */
+            if (read_source == (gint64)source_offset)
+              break;
+            g_string_append_c (out, (gchar)opcode);
+            _ostree_write_varuint64 (out, source_offset);
+            read_source = (gint64)source_offset;
+          }
+          break;
+        case OSTREE_STATIC_DELTA_OP_UNSET_READ_SOURCE:
+          if (read_source == -1)
+            break;
+          read_source = -1;
+          /* A directly following OP_CLOSE unsets the source itself */
+          if (remaining > 0 && *op == OSTREE_STATIC_DELTA_OP_CLOSE)
+            break;
+          g_string_append_c (out, (gchar)opcode);
+          break;
+        case OSTREE_STATIC_DELTA_OP_CLOSE:
+          /* dispatch_close() also unsets the read source */
+          g_string_append_c (out, (gchar)opcode);
+          read_source = -1;
+          break;
+        case OSTREE_STATIC_DELTA_OP_OPEN:
+          g_string_append_c (out, (gchar)opcode);
+          for (guint j = 0; j < 3; j++)
+            _ostree_write_varuint64 (out, peephole_read_varuint (&op, &remaining));
+          obj_index++;
+          break;
+        case OSTREE_STATIC_DELTA_OP_BSPATCH:
+        case OSTREE_STATIC_DELTA_OP_ZDPATCH:
+          g_string_append_c (out, (gchar)opcode);
+          for (guint j = 0; j < 2; j++)
+            _ostree_write_varuint64 (out, peephole_read_varuint (&op, &remaining));
+          break;
+        case OSTREE_STATIC_DELTA_OP_OPEN_SPLICE_AND_CLOSE:
+          {
+            /* The operand count depends on whether the spliced object is
+             * metadata, which the interpreter learns from the checksum
+             * stream; we track the same object cursor here.
+             */
+            OstreeObjectType objtype;
+            const char *checksum;
+            guint n_args;
+
+            g_assert_cmpuint (obj_index, <, part_builder->objects->len);
+            ostree_object_name_deserialize (part_builder->objects->pdata[obj_index],
+                                            &checksum, &objtype);
+            n_args = OSTREE_OBJECT_TYPE_IS_META (objtype) ? 2 : 4;
+
+            g_string_append_c (out, (gchar)opcode);
+            for (guint j = 0; j < n_args; j++)
+              _ostree_write_varuint64 (out, peephole_read_varuint (&op, &remaining));
+            obj_index++;
+          }
+          break;
+        default:
+          g_assert_not_reached ();
+        }
+    }
+
+  peephole_flush_write (out, &have_pending, pending_length, pending_offset);
+
+  g_string_free (part_builder->operations, TRUE);
+  part_builder->operations = out;
+}
+
 /**
  * ostree_repo_static_delta_generate:
  * @self: Repo
@@ -1164,11 +1585,22 @@ get_fallback_headers (OstreeRepo               *self,
  *   - max-chunk-size: u: Maximum size in megabytes of a delta part
  *   - max-bsdiff-size: u: Maximum size in megabytes to consider bsdiff compression
  *   for input files
- *   - compression: y: Compression type: 0=none, x=lzma, g=gzip
+ *   - max-bsdiff-memory: u: Maximum estimated bsdiff working set in megabytes; pairs
+ *   over the cap fall back to other compression.  0 (the default) for unlimited
+ *   - zstd-diff-min-size: u: Pairs whose combined size is at least this many megabytes
+ *   are diffed with the (much faster, linear-memory) zstd-dictionary engine instead
+ *   of bsdiff; the bsdiff size and memory caps don't apply to them.  Requires zstd
+ *   support on both ends.  0 (the default) disables the engine
+ *   - compression: y: Compression type: 0=none, x=lzma, z=zstd, g=gzip
+ *   - compression-threads: u: Number of threads for part compression; >1 uses
+ *   the multi-threaded xz encoder when available, 0 means one per CPU.  Default 1.
+ *   - auto-preset: b: Pick a faster xz preset for parts whose payload looks
+ *   incompressible.  Default FALSE.
  *   - bsdiff-enabled: b: Enable bsdiff compression.  Default TRUE.
  *   - inline-parts: b: Put part data in header, to get a single file delta.  Default FALSE.
  *   - verbose: b: Print diagnostic messages.  Default FALSE.
  *   - endianness: b: Deltas use host byte order by default; this option allows choosing (G_BIG_ENDIAN or G_LITTLE_ENDIAN)
+ *   - dual-endian: b: Additionally publish both endianness variants of the superblock (as `superblock.l` and `superblock.B`), sharing all part files, so clients of either endianness can apply without a byteswap pass.  Default FALSE.
  *   - filename: ay: Save delta superblock to this filename, and parts in the same directory.  Default saves to repository.
  */
 gboolean
@@ -1186,7 +1618,11 @@ ostree_repo_static_delta_generate (OstreeRepo                   *self,
   guint i;
   guint min_fallback_size;
   guint max_bsdiff_size;
+  guint max_bsdiff_memory;
+  guint zstd_diff_min_size;
   guint max_chunk_size;
+  guint compression_threads;
+  gboolean auto_preset;
   g_auto(GVariantBuilder) metadata_builder = OT_VARIANT_BUILDER_INITIALIZER;
   DeltaOpts delta_opts = DELTAOPT_FLAG_NONE;
   guint64 total_compressed_size = 0;
@@ -1196,12 +1632,15 @@ ostree_repo_static_delta_generate (OstreeRepo                   *self,
   g_autoptr(GVariant) delta_descriptor = NULL;
   g_autoptr(GVariant) to_commit = NULL;
   const char *opt_filename;
+  const char *opt_compression = NULL;
+  g_autofree char *compression_from_config = NULL;
   g_autofree char *descriptor_name = NULL;
   glnx_fd_close int descriptor_dfd = -1;
   g_autoptr(GVariant) fallback_headers = NULL;
   g_autoptr(GVariant) detached = NULL;
   gboolean inline_parts;
   guint endianness = G_BYTE_ORDER;
+  gboolean dual_endian = FALSE;
   glnx_fd_close int tmp_dfd = -1;
   builder.parts = g_ptr_array_new_with_free_func ((GDestroyNotify)ostree_static_delta_part_builder_unref);
   builder.fallback_objects = g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
@@ -1213,15 +1652,65 @@ ostree_repo_static_delta_generate (OstreeRepo                   *self,
   if (!g_variant_lookup (params, "max-bsdiff-size", "u", &max_bsdiff_size))
     max_bsdiff_size = 128;
   builder.max_bsdiff_size_bytes = ((guint64)max_bsdiff_size) * 1000 * 1000;
+  if (!g_variant_lookup (params, "max-bsdiff-memory", "u", &max_bsdiff_memory))
+    max_bsdiff_memory = 0;
+  builder.max_bsdiff_memory_bytes = ((guint64)max_bsdiff_memory) * 1000 * 1000;
+  if (!g_variant_lookup (params, "zstd-diff-min-size", "u", &zstd_diff_min_size))
+    zstd_diff_min_size = 0;
+  builder.zstd_diff_min_size_bytes = ((guint64)zstd_diff_min_size) * 1000 * 1000;
+#ifndef HAVE_ZSTD
+  if (builder.zstd_diff_min_size_bytes > 0)
+    {
+      glnx_throw (error, "zstd-diff-min-size requested, but ostree was built without zstd support");
+      goto out;
+    }
+#endif
   if (!g_variant_lookup (params, "max-chunk-size", "u", &max_chunk_size))
     max_chunk_size = 32;
   builder.max_chunk_size_bytes = ((guint64)max_chunk_size) * 1000 * 1000;
 
+  if (!g_variant_lookup (params, "compression-threads", "u", &compression_threads))
+    compression_threads = 1;
+  if (compression_threads == 0)
+    compression_threads = g_get_num_processors ();
+
+  /* Part compression format: the "compression" param wins, then the
+   * core.delta-compression repo config key, then xz.  zstd trades a
+   * little compression ratio for much faster generation and on-device
+   * application, but requires clients built with zstd support.
+   */
+  if (!g_variant_lookup (params, "compression", "&s", &opt_compression))
+    {
+      if (!ot_keyfile_get_value_with_default (self->config, "core", "delta-compression",
+                                              "xz", &compression_from_config, error))
+        goto out;
+      opt_compression = compression_from_config;
+    }
+  if (g_strcmp0 (opt_compression, "zstd") == 0)
+    {
+#ifndef HAVE_ZSTD
+      glnx_throw (error, "zstd delta compression requested, but ostree was built without zstd support");
+      goto out;
+#endif
+    }
+  else if (g_strcmp0 (opt_compression, "xz") != 0)
+    {
+      glnx_throw (error, "Invalid delta compression '%s'", opt_compression);
+      goto out;
+    }
+  if (!g_variant_lookup (params, "auto-preset", "b", &auto_preset))
+    auto_preset = FALSE;
+
   (void) g_variant_lookup (params, "endianness", "u", &endianness);
   g_return_val_if_fail (endianness == G_BIG_ENDIAN || endianness == G_LITTLE_ENDIAN, FALSE);
 
   builder.swap_endian = endianness != G_BYTE_ORDER;
 
+  { gboolean dual_endian_b;
+    if (g_variant_lookup (params, "dual-endian", "b", &dual_endian_b))
+      dual_endian = dual_endian_b;
+  }
+
   { gboolean use_bsdiff;
     if (!g_variant_lookup (params, "bsdiff-enabled", "b", &use_bsdiff))
       use_bsdiff = TRUE;
@@ -1338,6 +1827,13 @@ ostree_repo_static_delta_generate (OstreeRepo                   *self,
       payload_b = g_string_free_to_bytes (part_builder->payload);
       part_builder->payload = NULL;
 
+      { const gsize unoptimized_len = part_builder->operations->len;
+        peephole_optimize_operations (part_builder);
+        if (delta_opts & DELTAOPT_FLAG_VERBOSE)
+          g_printerr ("part %u opcode stream: %" G_GSIZE_FORMAT " -> %" G_GSIZE_FORMAT " bytes\n",
+                      i, unoptimized_len, part_builder->operations->len);
+      }
+
       operations_b = g_string_free_to_bytes (part_builder->operations);
       part_builder->operations = NULL;
       /* FIXME - avoid duplicating memory here */
@@ -1347,9 +1843,27 @@ ostree_repo_static_delta_generate (OstreeRepo                   *self,
                                           ot_gvariant_new_ay_bytes (operations_b));
       g_variant_ref_sink (delta_part_content);
 
-      /* Hardcode xz for now */
-      compressor = (GConverter*)_ostree_lzma_compressor_new (NULL);
-      compression_type_char = 'x';
+#ifdef HAVE_ZSTD
+      if (g_strcmp0 (opt_compression, "zstd") == 0)
+        {
+          compressor = (GConverter*)_ostree_zstd_compressor_new (NULL);
+          compression_type_char = 'z';
+        }
+      else
+#endif
+      { g_autoptr(GVariant) compressor_params = NULL;
+        GVariantBuilder compressor_params_builder;
+
+        g_variant_builder_init (&compressor_params_builder, G_VARIANT_TYPE ("a{sv}"));
+        g_variant_builder_add (&compressor_params_builder, "{sv}", "threads",
+                               g_variant_new_uint32 (compression_threads));
+        g_variant_builder_add (&compressor_params_builder, "{sv}", "preset",
+                               g_variant_new_uint32 (auto_preset ?
+                                                     delta_part_pick_preset (payload_b) : 8));
+        compressor_params = g_variant_ref_sink (g_variant_builder_end (&compressor_params_builder));
+        compressor = (GConverter*)_ostree_lzma_compressor_new (compressor_params);
+        compression_type_char = 'x';
+      }
       part_payload_in = ot_variant_read (delta_part_content);
       part_payload_out = (GMemoryOutputStream*)g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
       part_payload_compressor = (GConverterOutputStream*)g_converter_output_stream_new ((GOutputStream*)part_payload_out, compressor);
@@ -1502,6 +2016,8 @@ ostree_repo_static_delta_generate (OstreeRepo                   *self,
                   builder.n_rollsum,
                   builder.rollsum_size);
       g_printerr ("bsdiff=%u objects\n", builder.n_bsdiff);
+      if (builder.zstd_diff_min_size_bytes > 0)
+        g_printerr ("zstd-diff=%u objects\n", builder.n_zstd_diff);
     }
 
   if (!glnx_file_replace_contents_at (descriptor_dfd, descriptor_name,
@@ -1510,6 +2026,54 @@ ostree_repo_static_delta_generate (OstreeRepo                   *self,
                                       0, cancellable, error))
     goto out;
 
+  /* Dual-endian publishing: write both endianness variants of the
+   * superblock next to the canonical one, named by their endianness
+   * character.  The variants share every part file (part payloads are
+   * endianness-independent), so this costs two small files; a client
+   * whose native order differs from the canonical superblock fetches
+   * its variant and skips the apply-time byteswap pass entirely.
+   */
+  if (!dual_endian)
+    {
+      /* Regenerating without dual-endian must not leave stale variants
+       * behind for the summary to advertise.
+       */
+      const char *suffixes[2] = { "l", "B" };
+      for (i = 0; i < 2; i++)
+        {
+          g_autofree char *variant_name = g_strconcat (descriptor_name, ".", suffixes[i], NULL);
+          if (!ot_ensure_unlinked_at (descriptor_dfd, variant_name, error))
+            goto out;
+        }
+    }
+  else
+    {
+      g_autoptr(GVariant) swapped = _ostree_static_delta_superblock_byteswap (delta_descriptor);
+      GVariant *variants[2];
+
+      if (endianness == G_LITTLE_ENDIAN)
+        {
+          variants[0] = delta_descriptor;  /* .l */
+          variants[1] = swapped;           /* .B */
+        }
+      else
+        {
+          variants[0] = swapped;
+          variants[1] = delta_descriptor;
+        }
+
+      const char *suffixes[2] = { "l", "B" };
+      for (i = 0; i < 2; i++)
+        {
+          g_autofree char *variant_name = g_strconcat (descriptor_name, ".", suffixes[i], NULL);
+          if (!glnx_file_replace_contents_at (descriptor_dfd, variant_name,
+                                              g_variant_get_data (variants[i]),
+                                              g_variant_get_size (variants[i]),
+                                              0, cancellable, error))
+            goto out;
+        }
+    }
+
   ret = TRUE;
  out:
   g_clear_pointer (&builder.parts, g_ptr_array_unref);
@@ -26,9 +26,13 @@
 #include "ostree-core-private.h"
 #include "ostree-repo-private.h"
 #include "ostree-lzma-decompressor.h"
+#ifdef HAVE_ZSTD
+#include "ostree-zstd-decompressor.h"
+#endif
 #include "ostree-cmdprivate.h"
 #include "ostree-checksum-input-stream.h"
 #include "ostree-repo-static-delta-private.h"
+#include "ostree-varint.h"
 #include "otutil.h"
 
 gboolean
@@ -158,6 +162,95 @@ ostree_repo_list_static_delta_names (OstreeRepo                  *self,
   return TRUE;
 }
 
+/* Write the compact delta index for @delta_names; see
+ * _OSTREE_STATIC_DELTA_INDEX_PATH for the format.  We always write the
+ * file, even when there are no deltas, so that clients which find an
+ * empty index know they can skip superblock probing entirely.
+ */
+gboolean
+_ostree_repo_static_delta_index_regenerate (OstreeRepo    *self,
+                                            GPtrArray     *delta_names,
+                                            GCancellable  *cancellable,
+                                            GError       **error)
+{
+  g_autoptr(GString) buf = g_string_new ("ODIX");
+
+  g_string_append_c (buf, _OSTREE_STATIC_DELTA_INDEX_VERSION);
+
+  for (guint i = 0; i < delta_names->len; i++)
+    {
+      const char *delta_name = delta_names->pdata[i];
+      g_autofree char *from = NULL;
+      g_autofree char *to = NULL;
+      struct stat stbuf;
+
+      if (!_ostree_parse_delta_name (delta_name, &from, &to, error))
+        return FALSE;
+
+      g_autofree char *superblock =
+        _ostree_get_relative_static_delta_superblock_path ((from && from[0]) ? from : NULL, to);
+      if (!glnx_fstatat (self->repo_dir_fd, superblock, &stbuf, 0, error))
+        return FALSE;
+
+      _ostree_write_varuint64 (buf, strlen (delta_name));
+      g_string_append (buf, delta_name);
+      _ostree_write_varuint64 (buf, (guint64) stbuf.st_size);
+    }
+
+  if (!_ostree_repo_file_replace_contents (self, self->repo_dir_fd,
+                                           _OSTREE_STATIC_DELTA_INDEX_PATH,
+                                           (const guint8*)buf->str, buf->len,
+                                           cancellable, error))
+    return FALSE;
+
+  return TRUE;
+}
+
+/* Parse a delta index into @inout_deltas, mapping delta name to its
+ * superblock size (as a boxed guint64).  Unlike most parsers here we
+ * return a hard error for malformed data; callers fetching the index
+ * over the network treat any error as "no index available".
+ */
+gboolean
+_ostree_static_delta_index_parse (GBytes      *data,
+                                  GHashTable  *inout_deltas,
+                                  GError     **error)
+{
+  gsize len;
+  const guint8 *buf = g_bytes_get_data (data, &len);
+  gsize pos = 5;
+
+  if (len < 5 || memcmp (buf, "ODIX", 4) != 0)
+    return glnx_throw (error, "Invalid static delta index header");
+  if (buf[4] != _OSTREE_STATIC_DELTA_INDEX_VERSION)
+    return glnx_throw (error, "Unsupported static delta index version %u", buf[4]);
+
+  while (pos < len)
+    {
+      guint64 name_len;
+      guint64 size;
+      gsize bytes_read;
+
+      if (!_ostree_read_varuint64 (buf + pos, len - pos, &name_len, &bytes_read))
+        return glnx_throw (error, "Truncated static delta index");
+      pos += bytes_read;
+
+      if (name_len == 0 || name_len > len - pos)
+        return glnx_throw (error, "Invalid delta name length in static delta index");
+      g_autofree char *name = g_strndup ((const char*)buf + pos, name_len);
+      pos += name_len;
+
+      if (!_ostree_read_varuint64 (buf + pos, len - pos, &size, &bytes_read))
+        return glnx_throw (error, "Truncated static delta index");
+      pos += bytes_read;
+
+      g_hash_table_replace (inout_deltas, g_steal_pointer (&name),
+                            g_memdup (&size, sizeof (size)));
+    }
+
+  return TRUE;
+}
+
 gboolean
 _ostree_repo_static_delta_part_have_all_objects (OstreeRepo             *repo,
                                                  GVariant               *checksum_array,
@@ -393,6 +486,7 @@ ostree_repo_static_delta_execute_offline (OstreeRepo                    *self,
         }
 
       if (!_ostree_static_delta_part_execute (self, objects, part, skip_validation,
+                                              inline_part_data == NULL,
                                               NULL, cancellable, error))
         return glnx_prefix_error (error, "Executing delta part %i", i);
     }
@@ -479,6 +573,22 @@ _ostree_static_delta_part_open (GInputStream   *part_in,
                                              buf, FALSE);
       }
       break;
+    case 'z':
+      {
+#ifdef HAVE_ZSTD
+        g_autoptr(GConverter) decomp = (GConverter*) _ostree_zstd_decompressor_new ();
+        g_autoptr(GInputStream) convin = g_converter_input_stream_new (source_in, decomp);
+        g_autoptr(GBytes) buf = ot_map_anonymous_tmpfile_from_content (convin, cancellable, error);
+        if (!buf)
+          return FALSE;
+
+        ret_part = g_variant_new_from_bytes (G_VARIANT_TYPE (OSTREE_STATIC_DELTA_PART_PAYLOAD_FORMAT_V0),
+                                             buf, FALSE);
+#else
+        return glnx_throw (error, "Delta part is zstd-compressed, but ostree was built without zstd support");
+#endif
+      }
+      break;
     default:
       return glnx_throw (error, "Invalid compression type '%u'", comptype);
     }
@@ -559,14 +669,15 @@ show_one_part (OstreeRepo                    *self,
              (guint64)g_variant_n_children (ops));
 
     if (!_ostree_static_delta_part_execute (self, objects,
-                                            part, TRUE,
+                                            part, TRUE, TRUE,
                                             &stats, cancellable, error))
       return FALSE;
 
     { const guint *n_ops = stats.n_ops_executed;
       g_print ("PartPayloadOps%u: openspliceclose=%u open=%u write=%u setread=%u "
-               "unsetread=%u close=%u bspatch=%u\n",
-               i, n_ops[0], n_ops[1], n_ops[2], n_ops[3], n_ops[4], n_ops[5], n_ops[6]);
+               "unsetread=%u close=%u bspatch=%u zdpatch=%u\n",
+               i, n_ops[0], n_ops[1], n_ops[2], n_ops[3], n_ops[4], n_ops[5], n_ops[6],
+               n_ops[7]);
     }
   }
 
@@ -686,6 +797,79 @@ _ostree_delta_needs_byteswap (GVariant *superblock)
     }
 }
 
+/* Return a copy of @superblock with every non-canonical-endian field
+ * (part header version/size/usize, fallback sizes) byteswapped and the
+ * ostree.endianness marker flipped.  The timestamp is always big
+ * endian and the part payloads store their modes big endian, so
+ * nothing outside the superblock differs between the two variants;
+ * this is what lets dual-endian publishing share all part files.
+ */
+GVariant *
+_ostree_static_delta_superblock_byteswap (GVariant *superblock)
+{
+  g_autoptr(GVariant) metadata = g_variant_get_child_value (superblock, 0);
+  guint64 timestamp;
+  g_variant_get_child (superblock, 1, "t", &timestamp);
+  g_autoptr(GVariant) from_csum_v = g_variant_get_child_value (superblock, 2);
+  g_autoptr(GVariant) to_csum_v = g_variant_get_child_value (superblock, 3);
+  g_autoptr(GVariant) commit_v = g_variant_get_child_value (superblock, 4);
+  g_autoptr(GVariant) prereq_v = g_variant_get_child_value (superblock, 5);
+  g_autoptr(GVariant) parts_v = g_variant_get_child_value (superblock, 6);
+  g_autoptr(GVariant) fallbacks_v = g_variant_get_child_value (superblock, 7);
+
+  g_auto(GVariantDict) metadict = OT_VARIANT_BUILDER_INITIALIZER;
+  g_variant_dict_init (&metadict, metadata);
+  { guint8 endianness_char;
+    if (!g_variant_dict_lookup (&metadict, "ostree.endianness", "y", &endianness_char))
+      endianness_char = (G_BYTE_ORDER == G_LITTLE_ENDIAN) ? 'l' : 'B';
+    g_variant_dict_insert_value (&metadict, "ostree.endianness",
+                                 g_variant_new_byte (endianness_char == 'l' ? 'B' : 'l'));
+  }
+
+  g_auto(GVariantBuilder) parts_builder = OT_VARIANT_BUILDER_INITIALIZER;
+  g_variant_builder_init (&parts_builder, G_VARIANT_TYPE ("a" OSTREE_STATIC_DELTA_META_ENTRY_FORMAT));
+  const gsize n_parts = g_variant_n_children (parts_v);
+  for (gsize i = 0; i < n_parts; i++)
+    {
+      guint32 version;
+      g_autoptr(GVariant) csum_v = NULL;
+      guint64 size, usize;
+      g_autoptr(GVariant) objects_v = NULL;
+
+      g_variant_get_child (parts_v, i, "(u@aytt@ay)",
+                           &version, &csum_v, &size, &usize, &objects_v);
+      g_variant_builder_add (&parts_builder, "(u@aytt@ay)",
+                             GUINT32_SWAP_LE_BE (version), csum_v,
+                             GUINT64_SWAP_LE_BE (size),
+                             GUINT64_SWAP_LE_BE (usize), objects_v);
+    }
+
+  g_auto(GVariantBuilder) fallback_builder = OT_VARIANT_BUILDER_INITIALIZER;
+  g_variant_builder_init (&fallback_builder, G_VARIANT_TYPE ("a" OSTREE_STATIC_DELTA_FALLBACK_FORMAT));
+  const gsize n_fallbacks = g_variant_n_children (fallbacks_v);
+  for (gsize i = 0; i < n_fallbacks; i++)
+    {
+      guint8 objtype;
+      g_autoptr(GVariant) csum_v = NULL;
+      guint64 compressed_size, uncompressed_size;
+
+      g_variant_get_child (fallbacks_v, i, "(y@aytt)",
+                           &objtype, &csum_v, &compressed_size, &uncompressed_size);
+      g_variant_builder_add (&fallback_builder, "(y@aytt)",
+                             objtype, csum_v,
+                             GUINT64_SWAP_LE_BE (compressed_size),
+                             GUINT64_SWAP_LE_BE (uncompressed_size));
+    }
+
+  return g_variant_ref_sink (g_variant_new ("(@a{sv}t@ay@ay@" OSTREE_COMMIT_GVARIANT_STRING "@ay"
+                                            "a" OSTREE_STATIC_DELTA_META_ENTRY_FORMAT
+                                            "a" OSTREE_STATIC_DELTA_FALLBACK_FORMAT ")",
+                                            g_variant_dict_end (&metadict),
+                                            timestamp,
+                                            from_csum_v, to_csum_v, commit_v, prereq_v,
+                                            &parts_builder, &fallback_builder));
+}
+
 gboolean
 _ostree_repo_static_delta_delete (OstreeRepo                    *self,
                                   const char                    *delta_id,
@@ -30,6 +30,31 @@ G_BEGIN_DECLS
 #define OSTREE_STATIC_DELTA_OBJTYPE_CSUM_LEN 33
 
 #define OSTREE_SUMMARY_STATIC_DELTAS "ostree.static-deltas"
+/* Maps delta name → (ay) raw superblock bytes, for superblocks small enough
+ * to embed in the summary; see the summary-inline-delta-max-bytes repo
+ * config option. */
+#define OSTREE_SUMMARY_INLINE_DELTAS "ostree.inline-deltas"
+
+/* Compact varint-encoded index of available static deltas, written
+ * next to the summary so clients can learn which deltas exist without
+ * probing deltas/XX/YYY superblock URLs one by one.  Layout: the magic
+ * bytes "ODIX", a single version byte, then for each delta a varint
+ * length-prefixed name ("FROM-TO" or just "TO") followed by the varint
+ * size in bytes of its superblock.
+ */
+#define _OSTREE_STATIC_DELTA_INDEX_PATH "delta-index"
+#define _OSTREE_STATIC_DELTA_INDEX_VERSION 0
+
+gboolean
+_ostree_repo_static_delta_index_regenerate (OstreeRepo    *self,
+                                            GPtrArray     *delta_names,
+                                            GCancellable  *cancellable,
+                                            GError       **error);
+
+gboolean
+_ostree_static_delta_index_parse (GBytes      *data,
+                                  GHashTable  *inout_deltas,
+                                  GError     **error);
 
 /**
  * OSTREE_STATIC_DELTA_PART_PAYLOAD_FORMAT_V0:
@@ -116,9 +141,15 @@ typedef enum {
   OSTREE_STATIC_DELTA_OP_SET_READ_SOURCE = 'r',
   OSTREE_STATIC_DELTA_OP_UNSET_READ_SOURCE = 'R',
   OSTREE_STATIC_DELTA_OP_CLOSE = 'c',
-  OSTREE_STATIC_DELTA_OP_BSPATCH = 'B'
+  OSTREE_STATIC_DELTA_OP_BSPATCH = 'B',
+  /* Like BSPATCH, but the payload is the target object compressed with
+   * zstd using the read source as a dictionary.  Only emitted when the
+   * compiler was asked for it (zstd-diff-min-size); requires a client
+   * built with zstd support to apply.
+   */
+  OSTREE_STATIC_DELTA_OP_ZDPATCH = 'Z'
 } OstreeStaticDeltaOpCode;
-#define OSTREE_STATIC_DELTA_N_OPS 7
+#define OSTREE_STATIC_DELTA_N_OPS 8
 
 gboolean
 _ostree_static_delta_part_open (GInputStream   *part_in,
@@ -142,16 +173,20 @@ gboolean _ostree_static_delta_part_execute (OstreeRepo      *repo,
                                             GVariant        *header,
                                             GVariant        *part_payload,
                                             gboolean         stats_only,
+                                            gboolean         payload_mapped,
                                             OstreeDeltaExecuteStats *stats,
                                             GCancellable    *cancellable,
                                             GError         **error);
 
-void _ostree_static_delta_part_execute_async (OstreeRepo      *repo,
-                                              GVariant        *header,
-                                              GVariant        *part_payload,
-                                              GCancellable    *cancellable,
-                                              GAsyncReadyCallback  callback,
-                                              gpointer         user_data);
+void _ostree_static_delta_part_open_execute_async (OstreeRepo      *repo,
+                                                   GVariant        *header,
+                                                   GInputStream    *part_in,
+                                                   GBytes          *inline_part_bytes,
+                                                   OstreeStaticDeltaOpenFlags flags,
+                                                   const char      *expected_checksum,
+                                                   GCancellable    *cancellable,
+                                                   GAsyncReadyCallback  callback,
+                                                   gpointer         user_data);
 
 gboolean _ostree_static_delta_part_execute_finish (OstreeRepo      *repo,
                                                    GAsyncResult    *result,
@@ -240,4 +275,6 @@ OstreeDeltaEndianness _ostree_delta_get_endianness (GVariant *superblock, gboole
 
 gboolean _ostree_delta_needs_byteswap (GVariant *superblock);
 
+GVariant *_ostree_static_delta_superblock_byteswap (GVariant *superblock);
+
 G_END_DECLS
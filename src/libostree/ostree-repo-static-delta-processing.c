@@ -21,6 +21,8 @@
 #include "config.h"
 
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include <glib-unix.h>
 #include <gio/gunixinputstream.h>
@@ -34,6 +36,9 @@
 #include "otutil.h"
 #include "ostree-varint.h"
 #include "bsdiff/bspatch.h"
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 /* This should really always be true, but hey, let's just assert it */
 G_STATIC_ASSERT (sizeof (guint) >= sizeof (guint32));
@@ -74,6 +79,8 @@ typedef struct {
 
   const guint8   *payload_data;
   guint64         payload_size;
+  gboolean        payload_mapped;
+  guint64         payload_reclaimed;
 } StaticDeltaExecutionState;
 
 typedef struct {
@@ -99,6 +106,7 @@ OPPROTO(set_read_source)
 OPPROTO(unset_read_source)
 OPPROTO(close)
 OPPROTO(bspatch)
+OPPROTO(zdpatch)
 #undef OPPROTO
 
 static void
@@ -122,6 +130,26 @@ read_varuint64 (StaticDeltaExecutionState  *state,
   return TRUE;
 }
 
+/* Decode @n_values consecutive varint operands in one pass; most
+ * opcodes carry two or more, and the single-pass decoder has a fast
+ * path for the short encodings that dominate real opcode streams.
+ */
+static gboolean
+read_varuint64_run (StaticDeltaExecutionState  *state,
+                    guint64                    *out_values,
+                    gsize                       n_values,
+                    GError                    **error)
+{
+  gsize bytes_read;
+  if (!_ostree_read_varuint64_run (state->opdata, state->oplen, out_values, n_values, &bytes_read))
+    {
+      return glnx_throw (error, "%s", "Unexpected EOF reading varint");
+    }
+  state->opdata += bytes_read;
+  state->oplen -= bytes_read;
+  return TRUE;
+}
+
 static gboolean
 open_output_target (StaticDeltaExecutionState   *state,
                     GCancellable                *cancellable,
@@ -163,6 +191,8 @@ delta_opcode_index (OstreeStaticDeltaOpCode op)
       return 5;
     case OSTREE_STATIC_DELTA_OP_BSPATCH:
       return 6;
+    case OSTREE_STATIC_DELTA_OP_ZDPATCH:
+      return 7;
     default:
       g_assert_not_reached ();
     }
@@ -173,6 +203,7 @@ _ostree_static_delta_part_execute (OstreeRepo      *repo,
                                    GVariant        *objects,
                                    GVariant        *part,
                                    gboolean         stats_only,
+                                   gboolean         payload_mapped,
                                    OstreeDeltaExecuteStats *stats,
                                    GCancellable    *cancellable,
                                    GError         **error)
@@ -218,6 +249,16 @@ _ostree_static_delta_part_execute (OstreeRepo      *repo,
 
   state->payload_data = g_variant_get_data (payload);
   state->payload_size = g_variant_get_size (payload);
+  state->payload_mapped = payload_mapped;
+
+  if (payload_mapped)
+    {
+      const uintptr_t pagemask = sysconf (_SC_PAGESIZE) - 1;
+      uintptr_t start = (uintptr_t)state->payload_data & ~pagemask;
+      uintptr_t end = (uintptr_t)state->payload_data + state->payload_size;
+
+      (void) madvise ((void*)start, end - start, MADV_SEQUENTIAL);
+    }
 
   state->oplen = g_variant_n_children (ops);
   state->opdata = g_variant_get_data (ops);
@@ -260,6 +301,10 @@ _ostree_static_delta_part_execute (OstreeRepo      *repo,
           if (!dispatch_bspatch (repo, state, cancellable, error))
             goto out;
           break;
+        case OSTREE_STATIC_DELTA_OP_ZDPATCH:
+          if (!dispatch_zdpatch (repo, state, cancellable, error))
+            goto out;
+          break;
         default:
           g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
                        "Unknown opcode %u at offset %u", opcode, n_executed);
@@ -283,11 +328,11 @@ _ostree_static_delta_part_execute (OstreeRepo      *repo,
 }
 
 typedef struct {
-  OstreeRepo *repo;
   GVariant *header;
-  GVariant *part;
-  GCancellable *cancellable;
-  GSimpleAsyncResult *result;
+  GInputStream *part_in;
+  GBytes *inline_part_bytes;
+  OstreeStaticDeltaOpenFlags flags;
+  char *expected_checksum;
 } StaticDeltaPartExecuteAsyncData;
 
 static void
@@ -295,54 +340,78 @@ static_delta_part_execute_async_data_free (gpointer user_data)
 {
   StaticDeltaPartExecuteAsyncData *data = user_data;
 
-  g_clear_object (&data->repo);
   g_variant_unref (data->header);
-  g_variant_unref (data->part);
-  g_clear_object (&data->cancellable);
+  g_clear_object (&data->part_in);
+  g_clear_pointer (&data->inline_part_bytes, g_bytes_unref);
+  g_free (data->expected_checksum);
   g_free (data);
 }
 
 static void
-static_delta_part_execute_thread (GSimpleAsyncResult  *res,
-                                  GObject             *object,
-                                  GCancellable        *cancellable)
+static_delta_part_open_execute_thread (GTask         *task,
+                                       gpointer       source,
+                                       gpointer       task_data,
+                                       GCancellable  *cancellable)
 {
-  GError *error = NULL;
-  StaticDeltaPartExecuteAsyncData *data;
-
-  data = g_simple_async_result_get_op_res_gpointer (res);
-  if (!_ostree_static_delta_part_execute (data->repo,
-                                          data->header,
-                                          data->part,
-                                          FALSE, NULL,
-                                          cancellable, &error))
-    g_simple_async_result_take_error (res, error);
+  StaticDeltaPartExecuteAsyncData *data = task_data;
+  OstreeRepo *repo = source;
+  g_autoptr(GVariant) part = NULL;
+  GError *local_error = NULL;
+
+  /* Both the checksumming and (for compressed parts) the streaming LZMA
+   * decompression into a disk-backed anonymous tmpfile happen here on the
+   * worker thread, rather than blocking the pull main context.  The
+   * decompressed payload is mmap()ed from that tmpfile, so its pages stay
+   * reclaimable on memory-constrained devices.
+   */
+  if (!_ostree_static_delta_part_open (data->part_in, data->inline_part_bytes,
+                                       data->flags, data->expected_checksum,
+                                       &part, cancellable, &local_error))
+    {
+      g_task_return_error (task, local_error);
+      return;
+    }
+
+  /* The payload is file-backed unless the part was inlined in the
+   * superblock (and even then the compressed case decompresses through a
+   * tmpfile); be conservative and only claim a mapping we are sure of. */
+  if (!_ostree_static_delta_part_execute (repo, data->header, part,
+                                          FALSE, data->inline_part_bytes == NULL,
+                                          NULL,
+                                          cancellable, &local_error))
+    {
+      g_task_return_error (task, local_error);
+      return;
+    }
+
+  g_task_return_boolean (task, TRUE);
 }
 
 void
-_ostree_static_delta_part_execute_async (OstreeRepo      *repo,
-                                         GVariant        *header,
-                                         GVariant        *part,
-                                         GCancellable    *cancellable,
-                                         GAsyncReadyCallback  callback,
-                                         gpointer         user_data)
+_ostree_static_delta_part_open_execute_async (OstreeRepo      *repo,
+                                              GVariant        *header,
+                                              GInputStream    *part_in,
+                                              GBytes          *inline_part_bytes,
+                                              OstreeStaticDeltaOpenFlags flags,
+                                              const char      *expected_checksum,
+                                              GCancellable    *cancellable,
+                                              GAsyncReadyCallback  callback,
+                                              gpointer         user_data)
 {
   StaticDeltaPartExecuteAsyncData *asyncdata;
+  g_autoptr(GTask) task = NULL;
 
   asyncdata = g_new0 (StaticDeltaPartExecuteAsyncData, 1);
-  asyncdata->repo = g_object_ref (repo);
   asyncdata->header = g_variant_ref (header);
-  asyncdata->part = g_variant_ref (part);
-  asyncdata->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
-
-  asyncdata->result = g_simple_async_result_new ((GObject*) repo,
-                                                 callback, user_data,
-                                                 _ostree_static_delta_part_execute_async);
-
-  g_simple_async_result_set_op_res_gpointer (asyncdata->result, asyncdata,
-                                             static_delta_part_execute_async_data_free);
-  g_simple_async_result_run_in_thread (asyncdata->result, static_delta_part_execute_thread, G_PRIORITY_DEFAULT, cancellable);
-  g_object_unref (asyncdata->result);
+  asyncdata->part_in = g_object_ref (part_in);
+  asyncdata->inline_part_bytes = inline_part_bytes ? g_bytes_ref (inline_part_bytes) : NULL;
+  asyncdata->flags = flags;
+  asyncdata->expected_checksum = g_strdup (expected_checksum);
+
+  task = g_task_new (repo, cancellable, callback, user_data);
+  g_task_set_source_tag (task, _ostree_static_delta_part_open_execute_async);
+  g_task_set_task_data (task, asyncdata, static_delta_part_execute_async_data_free);
+  g_task_run_in_thread (task, static_delta_part_open_execute_thread);
 }
 
 gboolean
@@ -350,13 +419,10 @@ _ostree_static_delta_part_execute_finish (OstreeRepo      *repo,
                                           GAsyncResult    *result,
                                           GError         **error)
 {
-  GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (result);
-
-  g_warn_if_fail (g_simple_async_result_get_source_tag (simple) == _ostree_static_delta_part_execute_async);
+  g_return_val_if_fail (g_task_is_valid (result, repo), FALSE);
+  g_warn_if_fail (g_async_result_is_tagged (result, _ostree_static_delta_part_open_execute_async));
 
-  if (g_simple_async_result_propagate_error (simple, error))
-    return FALSE;
-  return TRUE;
+  return g_task_propagate_boolean (G_TASK (result), error);
 }
 
 static gboolean
@@ -376,6 +442,40 @@ validate_ofs (StaticDeltaExecutionState  *state,
   return TRUE;
 }
 
+/* Reclaim already-consumed pages of the mmap()ed part payload every few
+ * megabytes, so applying a part much larger than available memory keeps
+ * apply RSS roughly flat.  The payload is laid out in execution order, so
+ * everything before the high-water mark is (almost always) dead; the odd
+ * backwards reference just re-faults from the backing file.  Only called
+ * when the payload really is file-backed — MADV_DONTNEED would zero-fill
+ * heap memory.
+ */
+#define DELTA_PAYLOAD_RECLAIM_CHUNK (4 * 1024 * 1024)
+
+static void
+maybe_reclaim_payload (StaticDeltaExecutionState *state,
+                       guint64                    consumed)
+{
+  uintptr_t start, end;
+  const uintptr_t pagemask = sysconf (_SC_PAGESIZE) - 1;
+
+  if (!state->payload_mapped)
+    return;
+  if (consumed <= state->payload_reclaimed ||
+      consumed - state->payload_reclaimed < DELTA_PAYLOAD_RECLAIM_CHUNK)
+    return;
+
+  /* Round inward to whole pages; the payload pointer itself is not
+   * necessarily page-aligned, since it sits inside the part variant. */
+  start = ((uintptr_t)state->payload_data + pagemask) & ~pagemask;
+  end = ((uintptr_t)state->payload_data + consumed) & ~pagemask;
+
+  if (end > start)
+    (void) madvise ((void*)start, end - start, MADV_DONTNEED);
+
+  state->payload_reclaimed = consumed;
+}
+
 static gboolean
 content_out_write (OstreeRepo                 *repo,
                    StaticDeltaExecutionState  *state,
@@ -405,13 +505,12 @@ do_content_open_generic (OstreeRepo                 *repo,
                          GCancellable               *cancellable,
                          GError                    **error)
 {
-  guint64 mode_offset;
-  guint64 xattr_offset;
+  guint64 offsets[2];
 
-  if (!read_varuint64 (state, &mode_offset, error))
-    return FALSE;
-  if (!read_varuint64 (state, &xattr_offset, error))
+  if (!read_varuint64_run (state, offsets, 2, error))
     return FALSE;
+  guint64 mode_offset = offsets[0];
+  guint64 xattr_offset = offsets[1];
 
   g_autoptr(GVariant) modev = g_variant_get_child_value (state->mode_dict, mode_offset);
   guint32 uid, gid, mode;
@@ -451,12 +550,12 @@ dispatch_bspatch (OstreeRepo                 *repo,
                   GCancellable               *cancellable,
                   GError                    **error)
 {
-  guint64 offset, length;
+  guint64 args[2];
 
-  if (!read_varuint64 (state, &offset, error))
-    return FALSE;
-  if (!read_varuint64 (state, &length, error))
+  if (!read_varuint64_run (state, args, 2, error))
     return FALSE;
+  guint64 offset = args[0];
+  guint64 length = args[1];
 
   if (state->stats_only)
     return TRUE; /* Early return */
@@ -486,6 +585,64 @@ dispatch_bspatch (OstreeRepo                 *repo,
       if (!content_out_write (repo, state, buf, state->content_size,
                               cancellable, error))
         return FALSE;
+
+      maybe_reclaim_payload (state, offset + length);
+    }
+
+  return TRUE;
+}
+
+static gboolean
+dispatch_zdpatch (OstreeRepo                 *repo,
+                  StaticDeltaExecutionState  *state,
+                  GCancellable               *cancellable,
+                  GError                    **error)
+{
+  guint64 args[2];
+
+  if (!read_varuint64_run (state, args, 2, error))
+    return FALSE;
+  guint64 offset = args[0];
+  guint64 length = args[1];
+
+  if (state->stats_only)
+    return TRUE; /* Early return */
+
+  if (offset > state->payload_size || length > state->payload_size - offset)
+    return glnx_throw (error, "Invalid zdpatch payload offset/length");
+
+  if (!state->have_obj)
+    {
+#ifdef HAVE_ZSTD
+      g_autoptr(GMappedFile) input_mfile = g_mapped_file_new_from_fd (state->read_source_fd, FALSE, error);
+      if (!input_mfile)
+        return FALSE;
+
+      g_autofree guchar *buf = g_malloc0 (state->content_size);
+
+      ZSTD_DCtx *dctx = ZSTD_createDCtx ();
+      if (dctx == NULL)
+        return glnx_throw (error, "zstd: failed to create decompression context");
+      const size_t res =
+        ZSTD_decompress_usingDict (dctx, buf, state->content_size,
+                                   state->payload_data + offset, length,
+                                   g_mapped_file_get_contents (input_mfile),
+                                   g_mapped_file_get_length (input_mfile));
+      ZSTD_freeDCtx (dctx);
+      if (ZSTD_isError (res))
+        return glnx_throw (error, "zstd: %s", ZSTD_getErrorName (res));
+      if (res != state->content_size)
+        return glnx_throw (error, "zdpatch produced %" G_GUINT64_FORMAT " bytes, expected %" G_GUINT64_FORMAT,
+                           (guint64)res, state->content_size);
+
+      if (!content_out_write (repo, state, buf, state->content_size,
+                              cancellable, error))
+        return FALSE;
+
+      maybe_reclaim_payload (state, offset + length);
+#else
+      return glnx_throw (error, "Delta requires zstd, but ostree was built without zstd support");
+#endif
     }
 
   return TRUE;
@@ -528,13 +685,12 @@ dispatch_open_splice_and_close (OstreeRepo                 *repo,
   if (OSTREE_OBJECT_TYPE_IS_META (state->output_objtype))
     {
       g_autoptr(GVariant) metadata = NULL;
-      guint64 offset;
-      guint64 length;
+      guint64 args[2];
 
-      if (!read_varuint64 (state, &length, error))
-        goto out;
-      if (!read_varuint64 (state, &offset, error))
+      if (!read_varuint64_run (state, args, 2, error))
         goto out;
+      guint64 length = args[0];
+      guint64 offset = args[1];
       if (!validate_ofs (state, offset, length, error))
         goto out;
 
@@ -557,10 +713,12 @@ dispatch_open_splice_and_close (OstreeRepo                 *repo,
                                          error))
           goto out;
       }
+
+      maybe_reclaim_payload (state, offset + length);
     }
   else
     {
-      guint64 content_offset;
+      guint64 args[2];
       guint64 objlen;
       g_autoptr(GInputStream) object_input = NULL;
       g_autoptr(GInputStream) memin = NULL;
@@ -568,10 +726,10 @@ dispatch_open_splice_and_close (OstreeRepo                 *repo,
       if (!do_content_open_generic (repo, state, cancellable, error))
         goto out;
 
-      if (!read_varuint64 (state, &state->content_size, error))
-        goto out;
-      if (!read_varuint64 (state, &content_offset, error))
+      if (!read_varuint64_run (state, args, 2, error))
         goto out;
+      state->content_size = args[0];
+      guint64 content_offset = args[1];
       if (!validate_ofs (state, content_offset, state->content_size, error))
         goto out;
 
@@ -642,6 +800,8 @@ dispatch_open_splice_and_close (OstreeRepo                 *repo,
               goto out;
           }
         }
+
+      maybe_reclaim_payload (state, content_offset + state->content_size);
     }
 
   if (!dispatch_close (repo, state, cancellable, error))
@@ -707,13 +867,12 @@ dispatch_write (OstreeRepo                 *repo,
                GError                    **error)
 {
   GLNX_AUTO_PREFIX_ERROR("opcode open-splice-and-close", error);
-  guint64 content_size;
-  guint64 content_offset;
+  guint64 args[2];
 
-  if (!read_varuint64 (state, &content_size, error))
-    return FALSE;
-  if (!read_varuint64 (state, &content_offset, error))
+  if (!read_varuint64_run (state, args, 2, error))
     return FALSE;
+  guint64 content_size = args[0];
+  guint64 content_offset = args[1];
 
   if (state->stats_only)
     return TRUE; /* Early return */
@@ -752,6 +911,8 @@ dispatch_write (OstreeRepo                 *repo,
           if (!content_out_write (repo, state, state->payload_data + content_offset, content_size,
                                   cancellable, error))
             return FALSE;
+
+          maybe_reclaim_payload (state, content_offset + content_size);
         }
     }
 
@@ -24,6 +24,7 @@
 
 #include "libglnx.h"
 #include "ostree.h"
+#include "ostree-repo-private.h"
 #include "otutil.h"
 
 struct _OstreeRepoRealCommitTraverseIter {
@@ -551,3 +552,241 @@ ostree_repo_traverse_commit (OstreeRepo      *repo,
  out:
   return ret;
 }
+
+static gboolean
+traverse_visit_dirtree (OstreeRepo                       *repo,
+                        const char                       *checksum,
+                        OstreeRepoCommitTraverseVisitor   visitor,
+                        gpointer                          user_data,
+                        gboolean                          ignore_missing_dirs,
+                        GCancellable                     *cancellable,
+                        GError                          **error);
+
+static gboolean
+traverse_visit_iter (OstreeRepo                       *repo,
+                     OstreeRepoCommitTraverseIter     *iter,
+                     OstreeRepoCommitTraverseVisitor   visitor,
+                     gpointer                          user_data,
+                     gboolean                          ignore_missing_dirs,
+                     GCancellable                     *cancellable,
+                     GError                          **error)
+{
+  gboolean ret = FALSE;
+
+  while (TRUE)
+    {
+      guchar csum[OSTREE_SHA256_DIGEST_LEN];
+      g_autoptr(GError) local_error = NULL;
+      OstreeRepoCommitIterResult iterres =
+        ostree_repo_commit_traverse_iter_next (iter, cancellable, &local_error);
+
+      if (iterres == OSTREE_REPO_COMMIT_ITER_RESULT_ERROR)
+        {
+          /* Match traverse_iter(): tolerate a missing dirtree in partial
+           * commits, skipping the whole subtree. */
+          if (ignore_missing_dirs &&
+              g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+            {
+              g_debug ("Ignoring not-found dirmeta");
+              ret = TRUE;
+            }
+          else
+            g_propagate_error (error, g_steal_pointer (&local_error));
+
+          goto out;
+        }
+      else if (iterres == OSTREE_REPO_COMMIT_ITER_RESULT_END)
+        break;
+      else if (iterres == OSTREE_REPO_COMMIT_ITER_RESULT_FILE)
+        {
+          char *name;
+          char *checksum;
+
+          ostree_repo_commit_traverse_iter_get_file (iter, &name, &checksum);
+
+          ostree_checksum_inplace_to_bytes (checksum, csum);
+          if (!visitor (repo, OSTREE_OBJECT_TYPE_FILE, csum, NULL,
+                        user_data, error))
+            goto out;
+        }
+      else if (iterres == OSTREE_REPO_COMMIT_ITER_RESULT_DIR)
+        {
+          char *name;
+          char *content_checksum;
+          char *meta_checksum;
+          gboolean recurse = TRUE;
+
+          ostree_repo_commit_traverse_iter_get_dir (iter, &name, &content_checksum,
+                                                    &meta_checksum);
+
+          ostree_checksum_inplace_to_bytes (meta_checksum, csum);
+          if (!visitor (repo, OSTREE_OBJECT_TYPE_DIR_META, csum, NULL,
+                        user_data, error))
+            goto out;
+
+          ostree_checksum_inplace_to_bytes (content_checksum, csum);
+          if (!visitor (repo, OSTREE_OBJECT_TYPE_DIR_TREE, csum, &recurse,
+                        user_data, error))
+            goto out;
+
+          if (recurse)
+            {
+              if (!traverse_visit_dirtree (repo, content_checksum, visitor, user_data,
+                                           ignore_missing_dirs, cancellable, error))
+                goto out;
+            }
+        }
+      else
+        g_assert_not_reached ();
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static gboolean
+traverse_visit_dirtree (OstreeRepo                       *repo,
+                        const char                       *checksum,
+                        OstreeRepoCommitTraverseVisitor   visitor,
+                        gpointer                          user_data,
+                        gboolean                          ignore_missing_dirs,
+                        GCancellable                     *cancellable,
+                        GError                          **error)
+{
+  gboolean ret = FALSE;
+  g_autoptr(GVariant) dirtree = NULL;
+  ostree_cleanup_repo_commit_traverse_iter
+    OstreeRepoCommitTraverseIter iter = { 0, };
+  g_autoptr(GError) local_error = NULL;
+
+  if (!ostree_repo_load_variant (repo, OSTREE_OBJECT_TYPE_DIR_TREE, checksum,
+                                 &dirtree, &local_error))
+    {
+      if (ignore_missing_dirs &&
+          g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+        {
+          g_debug ("Ignoring not-found dirmeta %s", checksum);
+          ret = TRUE;
+        }
+      else
+        g_propagate_error (error, g_steal_pointer (&local_error));
+
+      goto out;
+    }
+
+  if (!ostree_repo_commit_traverse_iter_init_dirtree (&iter, repo, dirtree,
+                                                      OSTREE_REPO_COMMIT_TRAVERSE_FLAG_NONE,
+                                                      error))
+    goto out;
+
+  if (!traverse_visit_iter (repo, &iter, visitor, user_data,
+                            ignore_missing_dirs, cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/*
+ * _ostree_repo_traverse_commit_visit:
+ * @repo: Repo
+ * @commit_checksum: ASCII SHA256 checksum
+ * @maxdepth: Traverse this many parent commits, -1 for unlimited
+ * @visitor: Called once per reachable object
+ * @user_data: Data for @visitor
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Streaming variant of ostree_repo_traverse_commit_union(): invoke
+ * @visitor for every object reachable from @commit_checksum instead of
+ * accumulating a hash table of serialized object names.  Only the
+ * iterator state for the directory chain currently being walked is kept
+ * live, so memory use is O(tree depth) regardless of commit size.
+ *
+ * Unlike the hash table API, this performs no deduplication itself;
+ * the same object may be visited multiple times if it is referenced
+ * from several directories.  Callers that track visited objects (in
+ * whatever compact form suits them) should clear *out_recurse for
+ * already-seen commits and dirtrees to prune the walk.
+ */
+gboolean
+_ostree_repo_traverse_commit_visit (OstreeRepo                       *repo,
+                                    const char                       *commit_checksum,
+                                    int                               maxdepth,
+                                    OstreeRepoCommitTraverseVisitor   visitor,
+                                    gpointer                          user_data,
+                                    GCancellable                     *cancellable,
+                                    GError                          **error)
+{
+  gboolean ret = FALSE;
+  g_autofree char *tmp_checksum = NULL;
+
+  while (TRUE)
+    {
+      gboolean recurse = FALSE;
+      gboolean visit_contents = TRUE;
+      guchar csum[OSTREE_SHA256_DIGEST_LEN];
+      g_autoptr(GVariant) commit = NULL;
+      ostree_cleanup_repo_commit_traverse_iter
+        OstreeRepoCommitTraverseIter iter = { 0, };
+      OstreeRepoCommitState commitstate;
+      gboolean ignore_missing_dirs = FALSE;
+
+      if (!ostree_repo_load_variant_if_exists (repo, OSTREE_OBJECT_TYPE_COMMIT,
+                                               commit_checksum, &commit,
+                                               error))
+        goto out;
+
+      /* Just return if the parent isn't found; we do expect most
+       * people to have partial repositories.
+       */
+      if (!commit)
+        break;
+
+      /* See if the commit is partial, if so it's not an error to lack objects */
+      if (!ostree_repo_load_commit (repo, commit_checksum, NULL, &commitstate,
+                                    error))
+        goto out;
+
+      if ((commitstate & OSTREE_REPO_COMMIT_STATE_PARTIAL) != 0)
+        ignore_missing_dirs = TRUE;
+
+      ostree_checksum_inplace_to_bytes (commit_checksum, csum);
+      if (!visitor (repo, OSTREE_OBJECT_TYPE_COMMIT, csum, &visit_contents,
+                    user_data, error))
+        goto out;
+      if (!visit_contents)
+        break;
+
+      g_debug ("Traversing commit %s", commit_checksum);
+      if (!ostree_repo_commit_traverse_iter_init_commit (&iter, repo, commit,
+                                                         OSTREE_REPO_COMMIT_TRAVERSE_FLAG_NONE,
+                                                         error))
+        goto out;
+
+      if (!traverse_visit_iter (repo, &iter, visitor, user_data,
+                                ignore_missing_dirs, cancellable, error))
+        goto out;
+
+      if (maxdepth == -1 || maxdepth > 0)
+        {
+          g_free (tmp_checksum);
+          tmp_checksum = ostree_commit_get_parent (commit);
+          if (tmp_checksum)
+            {
+              commit_checksum = tmp_checksum;
+              if (maxdepth > 0)
+                maxdepth -= 1;
+              recurse = TRUE;
+            }
+        }
+      if (!recurse)
+        break;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
@@ -39,14 +39,21 @@
 #include "ostree-repo-file-enumerator.h"
 #include "ostree-gpg-verifier.h"
 #include "ostree-repo-static-delta-private.h"
+#include "ostree-bloom-private.h"
 #include "ot-fs-utils.h"
 #include "ostree-autocleanups.h"
 
 #include <locale.h>
 #include <glib/gstdio.h>
 #include <sys/file.h>
+#include <sys/ioctl.h>
 #include <sys/statvfs.h>
 
+/* Linux 4.5 (and older btrfs-specific) clone/reflink ioctl */
+#ifndef FICLONE
+#define FICLONE _IOW (0x94, 9, int)
+#endif
+
 /**
  * SECTION:ostree-repo
  * @title: Content-addressed object store
@@ -105,6 +112,7 @@ typedef struct {
   void (*gpg_verify_result) (OstreeRepo *self,
                              const char *checksum,
                              OstreeGpgVerifyResult *result);
+  void (*refs_changed) (OstreeRepo *self);
 } OstreeRepoClass;
 
 enum {
@@ -117,6 +125,7 @@ enum {
 
 enum {
   GPG_VERIFY_RESULT,
+  REFS_CHANGED,
   LAST_SIGNAL
 };
 
@@ -130,6 +139,8 @@ static GFile *
 get_remotes_d_dir (OstreeRepo          *self,
                    GFile               *sysroot);
 
+static gboolean ensure_remotes_d_loaded (OstreeRepo *self, GCancellable *cancellable, GError **error);
+
 OstreeRemote *
 _ostree_repo_get_remote (OstreeRepo  *self,
                          const char  *name,
@@ -139,6 +150,9 @@ _ostree_repo_get_remote (OstreeRepo  *self,
 
   g_return_val_if_fail (name != NULL, NULL);
 
+  if (!ensure_remotes_d_loaded (self, NULL, error))
+    return NULL;
+
   g_mutex_lock (&self->remotes_lock);
 
   remote = g_hash_table_lookup (self->remotes, name);
@@ -213,6 +227,24 @@ _ostree_repo_remove_remote (OstreeRepo   *self,
   return removed;
 }
 
+/* Drop the cached GPG verifier for @name (all remotes if %NULL); called
+ * whenever a remote's configuration or keys change.
+ */
+static void
+repo_remote_verifier_invalidate (OstreeRepo *self,
+                                 const char *name)
+{
+  g_mutex_lock (&self->remotes_lock);
+  if (self->remote_verifiers != NULL)
+    {
+      if (name != NULL)
+        g_hash_table_remove (self->remote_verifiers, name);
+      else
+        g_hash_table_remove_all (self->remote_verifiers);
+    }
+  g_mutex_unlock (&self->remotes_lock);
+}
+
 gboolean
 _ostree_repo_remote_name_is_file (const char *remote_name)
 {
@@ -454,6 +486,8 @@ ostree_repo_finalize (GObject *object)
   OstreeRepo *self = OSTREE_REPO (object);
 
   g_clear_object (&self->parent_repo);
+  g_clear_pointer (&self->alternate_repos, g_ptr_array_unref);
+  g_clear_pointer (&self->alternate_blooms, g_ptr_array_unref);
 
   g_free (self->stagedir_prefix);
   g_clear_object (&self->repodir);
@@ -467,8 +501,14 @@ ostree_repo_finalize (GObject *object)
     (void) close (self->tmp_dir_fd);
   if (self->cache_dir_fd != -1)
     (void) close (self->cache_dir_fd);
+  if (self->commit_stagedir_journal_fd != -1)
+    (void) close (self->commit_stagedir_journal_fd);
+  g_clear_pointer (&self->txn_staged_objects, g_hash_table_destroy);
   if (self->objects_dir_fd != -1)
     (void) close (self->objects_dir_fd);
+  for (guint i = 0; i < G_N_ELEMENTS (self->objects_fanout_dfds); i++)
+    if (self->objects_fanout_dfds[i] != -1)
+      (void) close (self->objects_fanout_dfds[i]);
   if (self->uncompressed_objects_dir_fd != -1)
     (void) close (self->uncompressed_objects_dir_fd);
   g_clear_object (&self->sysroot_dir);
@@ -477,20 +517,54 @@ ostree_repo_finalize (GObject *object)
 
   if (self->loose_object_devino_hash)
     g_hash_table_destroy (self->loose_object_devino_hash);
+  if (self->commit_stat_cache)
+    g_hash_table_destroy (self->commit_stat_cache);
+  g_clear_pointer (&self->packed_refs, g_variant_unref);
+  g_clear_pointer (&self->commit_graph, g_variant_unref);
+  g_clear_pointer (&self->content_packs, g_ptr_array_unref);
+  g_clear_pointer (&self->path_indexes, g_hash_table_unref);
+  g_clear_pointer (&self->remote_fetchers, g_hash_table_unref);
   if (self->updated_uncompressed_dirs)
     g_hash_table_destroy (self->updated_uncompressed_dirs);
   if (self->config)
     g_key_file_free (self->config);
   g_clear_pointer (&self->txn_refs, g_hash_table_destroy);
   g_clear_pointer (&self->txn_collection_refs, g_hash_table_destroy);
+  g_clear_pointer (&self->txn_written_commits, g_hash_table_destroy);
   g_clear_error (&self->writable_error);
   g_clear_pointer (&self->object_sizes, (GDestroyNotify) g_hash_table_unref);
-  g_clear_pointer (&self->dirmeta_cache, (GDestroyNotify) g_hash_table_unref);
+  if (self->meta_cache_hits + self->meta_cache_misses > 0)
+    g_debug ("metadata cache: %" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT " misses",
+             self->meta_cache_hits, self->meta_cache_misses);
+  g_clear_pointer (&self->meta_cache, (GDestroyNotify) g_hash_table_unref);
+  g_queue_clear (&self->meta_cache_lru);
+  if (self->small_content_cache_hits + self->small_content_cache_misses > 0)
+    g_debug ("small content cache: %" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT " misses",
+             self->small_content_cache_hits, self->small_content_cache_misses);
+  g_clear_pointer (&self->small_content_cache, (GDestroyNotify) g_hash_table_unref);
+  g_queue_clear (&self->small_content_cache_lru);
+  g_clear_pointer (&self->dirmeta_parse_cache, (GDestroyNotify) g_hash_table_unref);
+  if (self->refs_changed_source)
+    {
+      g_source_destroy (self->refs_changed_source);
+      g_clear_pointer (&self->refs_changed_source, (GDestroyNotify) g_source_unref);
+    }
+  if (self->ref_monitors)
+    {
+      for (guint i = 0; i < self->ref_monitors->len; i++)
+        g_file_monitor_cancel (self->ref_monitors->pdata[i]);
+      g_clear_pointer (&self->ref_monitors, g_ptr_array_unref);
+    }
+  g_clear_pointer (&self->ref_monitor_context, g_main_context_unref);
+  g_clear_pointer (&self->interned_checksums, g_string_chunk_free);
+  g_mutex_clear (&self->interned_checksums_lock);
   g_mutex_clear (&self->cache_lock);
   g_mutex_clear (&self->txn_stats_lock);
   g_free (self->collection_id);
+  g_strfreev (self->summary_shard_prefixes);
 
   g_clear_pointer (&self->remotes, g_hash_table_destroy);
+  g_clear_pointer (&self->remote_verifiers, (GDestroyNotify) g_hash_table_unref);
   g_mutex_clear (&self->remotes_lock);
 
   G_OBJECT_CLASS (ostree_repo_parent_class)->finalize (object);
@@ -611,6 +685,28 @@ ostree_repo_class_init (OstreeRepoClass *klass)
                                              G_TYPE_NONE, 2,
                                              G_TYPE_STRING,
                                              OSTREE_TYPE_GPG_VERIFY_RESULT);
+
+  /**
+   * OstreeRepo::refs-changed:
+   * @self: an #OstreeRepo
+   *
+   * Emitted when a ref in the repository was created, updated or
+   * deleted, if watching was enabled via ostree_repo_watch_refs().
+   * Multiple changes in quick succession are coalesced into a single
+   * emission.
+   *
+   * The signal is emitted from the #GMainContext that was the
+   * thread-default at the point when ostree_repo_watch_refs() was
+   * called.
+   *
+   * Since: 2017.10
+   */
+  signals[REFS_CHANGED] = g_signal_new ("refs-changed",
+                                        OSTREE_TYPE_REPO,
+                                        G_SIGNAL_RUN_LAST,
+                                        G_STRUCT_OFFSET (OstreeRepoClass, refs_changed),
+                                        NULL, NULL, NULL,
+                                        G_TYPE_NONE, 0);
 }
 
 static void
@@ -634,6 +730,7 @@ ostree_repo_init (OstreeRepo *self)
 
   g_mutex_init (&self->cache_lock);
   g_mutex_init (&self->txn_stats_lock);
+  g_mutex_init (&self->interned_checksums_lock);
 
   self->remotes = g_hash_table_new_full (g_str_hash, g_str_equal,
                                          (GDestroyNotify) NULL,
@@ -644,7 +741,10 @@ ostree_repo_init (OstreeRepo *self)
   self->cache_dir_fd = -1;
   self->tmp_dir_fd = -1;
   self->commit_stagedir_fd = -1;
+  self->commit_stagedir_journal_fd = -1;
   self->objects_dir_fd = -1;
+  for (guint i = 0; i < G_N_ELEMENTS (self->objects_fanout_dfds); i++)
+    self->objects_fanout_dfds[i] = -1;
   self->uncompressed_objects_dir_fd = -1;
   self->commit_stagedir_lock = empty_lockfile;
   self->sysroot_kind = OSTREE_REPO_SYSROOT_KIND_UNKNOWN;
@@ -1061,6 +1161,7 @@ impl_repo_remote_delete (OstreeRepo     *self,
     return FALSE;
 
   _ostree_repo_remove_remote (self, remote);
+  repo_remote_verifier_invalidate (self, name);
 
   return TRUE;
 }
@@ -1137,6 +1238,8 @@ _ostree_repo_remote_list (OstreeRepo *self,
   GHashTableIter iter;
   gpointer key, value;
 
+  (void) ensure_remotes_d_loaded (self, NULL, NULL);
+
   g_mutex_lock (&self->remotes_lock);
 
   g_hash_table_iter_init (&iter, self->remotes);
@@ -1557,6 +1660,8 @@ ostree_repo_remote_gpg_import (OstreeRepo         *self,
   if (out_imported != NULL)
     *out_imported = (guint) import_result->imported;
 
+  repo_remote_verifier_invalidate (self, name);
+
   ret = TRUE;
 
 out:
@@ -1852,17 +1957,91 @@ add_remotes_from_keyfile (OstreeRepo *self,
 static gboolean
 append_one_remote_config (OstreeRepo      *self,
                           GFile           *path,
+                          const char      *contents,
                           GCancellable    *cancellable,
                           GError         **error)
 {
   g_autoptr(GKeyFile) remotedata = g_key_file_new ();
-  if (!g_key_file_load_from_file (remotedata, gs_file_get_path_cached (path),
-                                  0, error))
-    return FALSE;
+  if (!g_key_file_load_from_data (remotedata, contents, -1, 0, error))
+    return glnx_prefix_error (error, "Parsing %s", gs_file_get_path_cached (path));
 
   return add_remotes_from_keyfile (self, remotedata, path, error);
 }
 
+/* To amortize parsing remotes.d across the many short-lived processes which
+ * open the system repository, we keep an mtime-validated cache of the config
+ * file contents in the repository cache directory, refreshed only when a file
+ * changes.  It holds the keyfile text rather than a parsed form, since
+ * #OstreeRemote wraps a #GKeyFile; the win is replacing an open+read per
+ * config file with a single mapped read. */
+#define REMOTES_CACHE_NAME "remotes.d-cache"
+#define REMOTES_CACHE_GVARIANT_STRING "a(sxxs)"  /* (name, mtime sec, mtime nsec, contents) */
+
+/* Load the cached remotes.d contents, if any.  Any error just means we fall
+ * back to reading the config files themselves. */
+static GVariant *
+remotes_config_cache_load (OstreeRepo *self)
+{
+  glnx_fd_close int fd = -1;
+  g_autoptr(GVariant) cache = NULL;
+
+  if (self->cache_dir_fd == -1)
+    return NULL;
+
+  if (!ot_openat_ignore_enoent (self->cache_dir_fd, REMOTES_CACHE_NAME, &fd, NULL))
+    return NULL;
+  if (fd == -1)
+    return NULL;
+
+  if (!ot_util_variant_map_fd (fd, 0, G_VARIANT_TYPE (REMOTES_CACHE_GVARIANT_STRING),
+                               TRUE, &cache, NULL))
+    return NULL;
+
+  return g_steal_pointer (&cache);
+}
+
+/* Look up the cached contents of the config file @name, returning them only
+ * if the cached modification time matches @stbuf. */
+static const char *
+remotes_config_cache_lookup (GVariant          *cache,
+                             const char        *name,
+                             const struct stat *stbuf)
+{
+  gsize n, i;
+
+  n = g_variant_n_children (cache);
+  for (i = 0; i < n; i++)
+    {
+      const char *cached_name;
+      gint64 sec, nsec;
+      const char *contents;
+
+      g_variant_get_child (cache, i, "(&sxx&s)", &cached_name, &sec, &nsec, &contents);
+
+      if (g_str_equal (cached_name, name) &&
+          sec == (gint64) stbuf->st_mtim.tv_sec &&
+          nsec == (gint64) stbuf->st_mtim.tv_nsec)
+        return contents;
+    }
+
+  return NULL;
+}
+
+/* Best-effort; if this fails, the cache is simply rebuilt on the next run. */
+static void
+remotes_config_cache_save (OstreeRepo *self,
+                           GVariant   *cache)
+{
+  if (self->cache_dir_fd == -1)
+    return;
+
+  (void) glnx_file_replace_contents_at (self->cache_dir_fd, REMOTES_CACHE_NAME,
+                                        g_variant_get_data (cache),
+                                        g_variant_get_size (cache),
+                                        GLNX_FILE_REPLACE_NODATASYNC,
+                                        NULL, NULL);
+}
+
 static GFile *
 get_remotes_d_dir (OstreeRepo          *self,
                    GFile               *sysroot)
@@ -1915,6 +2094,16 @@ get_remotes_d_dir (OstreeRepo          *self,
     return g_file_resolve_relative_path (sysroot, SYSCONF_REMOTES);
 }
 
+/* GDestroyNotify for alternate_blooms; entries stay NULL until the
+ * filter for that alternate is first built.
+ */
+static void
+free_object_bloom (gpointer data)
+{
+  if (data != NULL)
+    ostree_bloom_unref (data);
+}
+
 static gboolean
 reload_core_config (OstreeRepo          *self,
                     GCancellable        *cancellable,
@@ -1972,6 +2161,42 @@ reload_core_config (OstreeRepo          *self,
   else
     self->enable_uncompressed_cache = FALSE;
 
+  { g_autofree char *cache_max_size_str = NULL;
+
+    if (!ot_keyfile_get_value_with_default (self->config, "core", "uncompressed-cache-max-size-mb",
+                                            "0", &cache_max_size_str, error))
+      return FALSE;
+
+    self->uncompressed_cache_max_size_bytes =
+      g_ascii_strtoull (cache_max_size_str, NULL, 10) * 1000 * 1000;
+  }
+
+  { g_autofree char *inline_delta_max_str = NULL;
+
+    if (!ot_keyfile_get_value_with_default (self->config, "core", "summary-inline-delta-max-bytes",
+                                            "0", &inline_delta_max_str, error))
+      return FALSE;
+
+    self->summary_inline_delta_max_bytes =
+      g_ascii_strtoull (inline_delta_max_str, NULL, 10);
+  }
+
+  {
+    g_clear_pointer (&self->summary_shard_prefixes, g_strfreev);
+    self->summary_shard_prefixes =
+      g_key_file_get_string_list (self->config, "core", "summary-shard-prefixes", NULL, NULL);
+  }
+
+  { g_autofree char *pack_max_str = NULL;
+
+    if (!ot_keyfile_get_value_with_default (self->config, "core", "pack-small-objects-max-bytes",
+                                            "0", &pack_max_str, error))
+      return FALSE;
+
+    self->pack_small_objects_max_bytes =
+      g_ascii_strtoull (pack_max_str, NULL, 10);
+  }
+
   {
     gboolean do_fsync;
 
@@ -1988,6 +2213,10 @@ reload_core_config (OstreeRepo          *self,
                                             FALSE, &self->disable_xattrs, error))
     return FALSE;
 
+  if (!ot_keyfile_get_boolean_with_default (self->config, "core", "commit-stat-cache",
+                                            FALSE, &self->enable_commit_stat_cache, error))
+    return FALSE;
+
   { g_autofree char *tmp_expiry_seconds = NULL;
 
     /* 86400 secs = one day */
@@ -2025,6 +2254,49 @@ reload_core_config (OstreeRepo          *self,
       return glnx_throw (error, "Invalid min-free-space-percent '%s'", min_free_space_percent_str);
   }
 
+  { g_autofree char *watermark_str = NULL;
+    g_autofree char *auto_prune_depth_str = NULL;
+
+    /* 0 (the default) disables background reclamation */
+    if (!ot_keyfile_get_value_with_default (self->config, "core", "auto-prune-watermark-percent",
+                                            "0", &watermark_str, error))
+      return FALSE;
+
+    self->auto_prune_watermark_percent = g_ascii_strtoull (watermark_str, NULL, 10);
+    if (self->auto_prune_watermark_percent > 99)
+      return glnx_throw (error, "Invalid auto-prune-watermark-percent '%s'", watermark_str);
+
+    if (!ot_keyfile_get_value_with_default (self->config, "core", "auto-prune-depth",
+                                            "0", &auto_prune_depth_str, error))
+      return FALSE;
+
+    self->auto_prune_depth = g_ascii_strtoll (auto_prune_depth_str, NULL, 10);
+  }
+
+  { g_autofree char *extra_algos = NULL;
+
+    if (!ot_keyfile_get_value_with_default (self->config, "core", "extra-checksum-algos",
+                                            NULL, &extra_algos, error))
+      return FALSE;
+
+    self->record_sha512 = FALSE;
+    if (extra_algos != NULL)
+      {
+        g_auto(GStrv) algos = g_strsplit (extra_algos, ",", -1);
+        for (char **iter = algos; iter && *iter; iter++)
+          {
+            if (strcmp (*iter, "sha512") == 0)
+              self->record_sha512 = TRUE;
+            else if ((*iter)[0] != '\0' && strcmp (*iter, "sha256") != 0)
+              return glnx_throw (error, "Invalid extra-checksum-algos '%s'; only sha512 is supported", *iter);
+          }
+      }
+  }
+
+  if (!ot_keyfile_get_boolean_with_default (self->config, "core", "crc32c-index",
+                                            FALSE, &self->record_crc32c, error))
+    return FALSE;
+
   {
     g_clear_pointer (&self->collection_id, g_free);
     if (!ot_keyfile_get_value_with_default (self->config, "core", "collection-id",
@@ -2051,6 +2323,35 @@ reload_core_config (OstreeRepo          *self,
         }
     }
 
+  {
+    g_clear_pointer (&self->alternate_repos, g_ptr_array_unref);
+    g_clear_pointer (&self->alternate_blooms, g_ptr_array_unref);
+
+    g_auto(GStrv) alternates =
+      g_key_file_get_string_list (self->config, "core", "alternates", NULL, NULL);
+    if (alternates != NULL && alternates[0] != NULL)
+      {
+        self->alternate_repos = g_ptr_array_new_with_free_func (g_object_unref);
+        self->alternate_blooms = g_ptr_array_new_with_free_func (free_object_bloom);
+
+        for (char **iter = alternates; *iter != NULL; iter++)
+          {
+            g_autoptr(GFile) alternate_f = g_file_new_for_path (*iter);
+            g_autoptr(OstreeRepo) alternate = ostree_repo_new (alternate_f);
+
+            if (!ostree_repo_open (alternate, cancellable, error))
+              {
+                g_prefix_error (error, "While checking alternate repository '%s': ",
+                                gs_file_get_path_cached (alternate_f));
+                return FALSE;
+              }
+
+            g_ptr_array_add (self->alternate_repos, g_steal_pointer (&alternate));
+            g_ptr_array_add (self->alternate_blooms, NULL);
+          }
+      }
+  }
+
   return TRUE;
 }
 
@@ -2062,11 +2363,22 @@ reload_remote_config (OstreeRepo          *self,
 
   g_mutex_lock (&self->remotes_lock);
   g_hash_table_remove_all (self->remotes);
+  self->remotes_d_loaded = FALSE;
   g_mutex_unlock (&self->remotes_lock);
 
-  if (!add_remotes_from_keyfile (self, self->config, NULL, error))
-    return FALSE;
+  return add_remotes_from_keyfile (self, self->config, NULL, error);
+}
 
+/* The remotes.d half of reload_remote_config(); deferred until the
+ * first remote lookup or listing, since many short-lived commands
+ * never touch remote configuration and the directory enumeration plus
+ * per-file parse is a measurable part of ostree_repo_open().
+ */
+static gboolean
+load_remotes_d_config (OstreeRepo          *self,
+                       GCancellable        *cancellable,
+                       GError             **error)
+{
   g_autoptr(GFile) remotes_d = get_remotes_d_dir (self, NULL);
   if (remotes_d == NULL)
     return TRUE;
@@ -2078,6 +2390,13 @@ reload_remote_config (OstreeRepo          *self,
     return FALSE;
   if (direnum)
     {
+      g_autoptr(GVariant) cache = remotes_config_cache_load (self);
+      g_auto(GVariantBuilder) new_cache_builder = OT_VARIANT_BUILDER_INITIALIZER;
+      gboolean cache_dirty = FALSE;
+      gsize n_configs = 0;
+
+      g_variant_builder_init (&new_cache_builder, G_VARIANT_TYPE (REMOTES_CACHE_GVARIANT_STRING));
+
       while (TRUE)
         {
           GFileInfo *file_info;
@@ -2097,15 +2416,63 @@ reload_remote_config (OstreeRepo          *self,
           if (type == G_FILE_TYPE_REGULAR &&
               g_str_has_suffix (name, ".conf"))
             {
-              if (!append_one_remote_config (self, path, cancellable, error))
+              struct stat stbuf;
+              const char *contents = NULL;
+              g_autofree char *loaded_contents = NULL;
+
+              /* Capture the mtime before reading, so a concurrent rewrite
+               * invalidates the entry rather than being masked by it. */
+              if (!glnx_fstatat (AT_FDCWD, gs_file_get_path_cached (path), &stbuf, 0, error))
+                return FALSE;
+
+              if (cache != NULL)
+                contents = remotes_config_cache_lookup (cache, name, &stbuf);
+
+              if (contents == NULL)
+                {
+                  cache_dirty = TRUE;
+                  if (!g_file_get_contents (gs_file_get_path_cached (path),
+                                            &loaded_contents, NULL, error))
+                    return FALSE;
+                  contents = loaded_contents;
+                }
+
+              if (!append_one_remote_config (self, path, contents, cancellable, error))
                 return FALSE;
+
+              g_variant_builder_add (&new_cache_builder, "(sxxs)", name,
+                                     (gint64) stbuf.st_mtim.tv_sec,
+                                     (gint64) stbuf.st_mtim.tv_nsec, contents);
+              n_configs++;
             }
         }
+
+      /* A deleted config file shows up as a count mismatch. */
+      if (cache == NULL || cache_dirty || n_configs != g_variant_n_children (cache))
+        {
+          g_autoptr(GVariant) new_cache = g_variant_ref_sink (g_variant_builder_end (&new_cache_builder));
+          remotes_config_cache_save (self, new_cache);
+        }
     }
 
   return TRUE;
 }
 
+static gboolean
+ensure_remotes_d_loaded (OstreeRepo    *self,
+                         GCancellable  *cancellable,
+                         GError       **error)
+{
+  g_mutex_lock (&self->remotes_lock);
+  gboolean needed = !self->remotes_d_loaded;
+  self->remotes_d_loaded = TRUE;
+  g_mutex_unlock (&self->remotes_lock);
+
+  if (!needed)
+    return TRUE;
+  return load_remotes_d_config (self, cancellable, error);
+}
+
 /**
  * ostree_repo_reload_config:
  * @self: repo
@@ -2251,22 +2618,35 @@ ostree_repo_open (OstreeRepo    *self,
   if (!ostree_repo_reload_config (self, cancellable, error))
     return FALSE;
 
-  /* TODO - delete this */
-  if (self->mode == OSTREE_REPO_MODE_ARCHIVE_Z2 && self->enable_uncompressed_cache)
-    {
-      if (!glnx_shutil_mkdir_p_at (self->repo_dir_fd, "uncompressed-objects-cache", 0755,
-                                   cancellable, error))
-        return FALSE;
-      if (!glnx_opendirat (self->repo_dir_fd, "uncompressed-objects-cache", TRUE,
-                           &self->uncompressed_objects_dir_fd,
-                           error))
-        return FALSE;
-    }
-
   self->inited = TRUE;
   return TRUE;
 }
 
+/* The uncompressed-objects-cache/ directory is only used by archive
+ * repositories during checkouts and devino scans; open (and create) it
+ * on first use rather than in ostree_repo_open().  A no-op (leaving
+ * uncompressed_objects_dir_fd at -1) when the cache doesn't apply.
+ */
+gboolean
+_ostree_repo_ensure_uncompressed_cache (OstreeRepo  *self,
+                                        GError     **error)
+{
+  if (self->uncompressed_objects_dir_fd != -1)
+    return TRUE;
+  if (!(self->mode == OSTREE_REPO_MODE_ARCHIVE_Z2 && self->enable_uncompressed_cache))
+    return TRUE;
+
+  if (!glnx_shutil_mkdir_p_at (self->repo_dir_fd, "uncompressed-objects-cache", 0755,
+                               NULL, error))
+    return FALSE;
+  if (!glnx_opendirat (self->repo_dir_fd, "uncompressed-objects-cache", TRUE,
+                       &self->uncompressed_objects_dir_fd,
+                       error))
+    return FALSE;
+
+  return TRUE;
+}
+
 /**
  * ostree_repo_set_disable_fsync:
  * @self: An #OstreeRepo
@@ -2400,39 +2780,41 @@ ostree_repo_get_parent (OstreeRepo  *self)
   return self->parent_repo;
 }
 
+/* Internal visitor for loose object enumeration; @checksum is the
+ * ASCII form.  Return FALSE with @error set to abort the walk.
+ */
+typedef gboolean (*LooseObjectVisitor) (OstreeRepo       *repo,
+                                        const char       *checksum,
+                                        OstreeObjectType  objtype,
+                                        gpointer          user_data,
+                                        GError          **error);
+
 static gboolean
 list_loose_objects_at (OstreeRepo             *self,
-                       GHashTable             *inout_objects,
+                       LooseObjectVisitor      visitor,
+                       gpointer                visitor_data,
                        int                     dfd,
                        const char             *prefix,
                        const char             *commit_starting_with,
                        GCancellable           *cancellable,
                        GError                **error)
 {
-  GVariant *key, *value;
-
-  g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
+  g_autoptr(GPtrArray) entries = NULL;
   gboolean exists;
-  if (!ot_dfd_iter_init_allow_noent (dfd, prefix, &dfd_iter, &exists, error))
+  if (!ot_dfd_list_sorted_allow_noent (dfd, prefix, &entries, &exists, error))
     return FALSE;
   /* Note early return */
   if (!exists)
     return TRUE;
 
-  while (TRUE)
-    {
-      struct dirent *dent;
-
-      if (!glnx_dirfd_iterator_next_dent (&dfd_iter, &dent, cancellable, error))
-        return FALSE;
-      if (dent == NULL)
-        break;
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return FALSE;
 
-      const char *name = dent->d_name;
-      if (strcmp (name, ".") == 0 ||
-          strcmp (name, "..") == 0)
-        continue;
+  for (guint i = 0; i < entries->len; i++)
+    {
+      const OtBulkDirent *dent = entries->pdata[i];
 
+      const char *name = dent->name;
       const char *dot = strrchr (name, '.');
       if (!dot)
         continue;
@@ -2475,20 +2857,38 @@ list_loose_objects_at (OstreeRepo             *self,
             continue;
         }
 
-      key = ostree_object_name_serialize (buf, objtype);
-      value = g_variant_new ("(b@as)",
-                             TRUE, g_variant_new_strv (NULL, 0));
-      /* transfer ownership */
-      g_hash_table_replace (inout_objects, g_variant_ref_sink (key),
-                            g_variant_ref_sink (value));
+      if (!visitor (self, buf, objtype, visitor_data, error))
+        return FALSE;
     }
 
   return TRUE;
 }
 
+/* A LooseObjectVisitor filling the (object name) → (bas) map returned
+ * by ostree_repo_list_objects().
+ */
+static gboolean
+insert_loose_object_to_hash_cb (OstreeRepo       *repo,
+                                const char       *checksum,
+                                OstreeObjectType  objtype,
+                                gpointer          user_data,
+                                GError          **error)
+{
+  GHashTable *inout_objects = user_data;
+
+  GVariant *key = ostree_object_name_serialize (checksum, objtype);
+  GVariant *value = g_variant_new ("(b@as)",
+                                   TRUE, g_variant_new_strv (NULL, 0));
+  /* transfer ownership */
+  g_hash_table_replace (inout_objects, g_variant_ref_sink (key),
+                        g_variant_ref_sink (value));
+  return TRUE;
+}
+
 static gboolean
 list_loose_objects (OstreeRepo                     *self,
-                    GHashTable                     *inout_objects,
+                    LooseObjectVisitor              visitor,
+                    gpointer                        visitor_data,
                     const char                     *commit_starting_with,
                     GCancellable                   *cancellable,
                     GError                        **error)
@@ -2501,7 +2901,7 @@ list_loose_objects (OstreeRepo                     *self,
       buf[0] = hexchars[c >> 4];
       buf[1] = hexchars[c & 0xF];
       buf[2] = '\0';
-      if (!list_loose_objects_at (self, inout_objects, self->objects_dir_fd, buf,
+      if (!list_loose_objects_at (self, visitor, visitor_data, self->objects_dir_fd, buf,
                                   commit_starting_with,
                                   cancellable, error))
         return FALSE;
@@ -2510,76 +2910,351 @@ list_loose_objects (OstreeRepo                     *self,
   return TRUE;
 }
 
-static gboolean
-load_metadata_internal (OstreeRepo       *self,
-                        OstreeObjectType  objtype,
-                        const char       *sha256,
-                        gboolean          error_if_not_found,
-                        GVariant        **out_variant,
-                        GInputStream    **out_stream,
-                        guint64          *out_size,
-                        GCancellable     *cancellable,
-                        GError          **error)
+/* In-memory LRU cache for dirmeta and dirtree variants.  Pull,
+ * traverse, diff and checkout all load the same small set of directory
+ * metadata objects over and over; mapping them from disk each time is
+ * pure overhead.  Entries live in both a hash table (for lookup) and a
+ * queue ordered most-recently-used first (for eviction); both are
+ * protected by cache_lock.  Hit/miss counters are dumped via g_debug()
+ * at finalize for tuning.
+ */
+#define META_CACHE_MAX_ENTRIES 512
+
+typedef struct {
+  char *key;
+  GVariant *variant;
+  GList *link;  /* Position in meta_cache_lru; head is most recent */
+} MetaCacheEntry;
+
+static void
+meta_cache_entry_free (MetaCacheEntry *entry)
 {
-  char loose_path_buf[_OSTREE_LOOSE_PATH_MAX];
-  struct stat stbuf;
-  glnx_fd_close int fd = -1;
-  g_autoptr(GInputStream) ret_stream = NULL;
-  g_autoptr(GVariant) ret_variant = NULL;
+  g_free (entry->key);
+  g_variant_unref (entry->variant);
+  g_free (entry);
+}
 
-  g_return_val_if_fail (OSTREE_OBJECT_TYPE_IS_META (objtype), FALSE);
+/* Must hold cache_lock */
+static GVariant *
+meta_cache_lookup (OstreeRepo *self,
+                   const char *key)
+{
+  MetaCacheEntry *entry = NULL;
 
-  /* Special caching for dirmeta objects, since they're commonly referenced many
-   * times.
-   */
-  const gboolean is_dirmeta_cachable =
-    (objtype == OSTREE_OBJECT_TYPE_DIR_META && out_variant && !out_stream);
-  if (is_dirmeta_cachable)
-    {
-      GMutex *lock = &self->cache_lock;
-      g_mutex_lock (lock);
-      GVariant *cache_hit = NULL;
-      /* Look it up, if we have a cache */
-      if (self->dirmeta_cache)
-        cache_hit = g_hash_table_lookup (self->dirmeta_cache, sha256);
-      if (cache_hit)
-        *out_variant = g_variant_ref (cache_hit);
-      g_mutex_unlock (lock);
-      if (cache_hit)
-        return TRUE;
+  if (self->meta_cache)
+    entry = g_hash_table_lookup (self->meta_cache, key);
+  if (entry == NULL)
+    {
+      self->meta_cache_misses++;
+      return NULL;
     }
 
-  _ostree_loose_path (loose_path_buf, sha256, objtype, self->mode);
+  self->meta_cache_hits++;
+  g_queue_unlink (&self->meta_cache_lru, entry->link);
+  g_queue_push_head_link (&self->meta_cache_lru, entry->link);
+  return g_variant_ref (entry->variant);
+}
 
- if (!ot_openat_ignore_enoent (self->objects_dir_fd, loose_path_buf, &fd,
-                               error))
-    return FALSE;
+/* Must hold cache_lock */
+static void
+meta_cache_insert (OstreeRepo *self,
+                   const char *key,
+                   GVariant   *variant)
+{
+  if (self->meta_cache == NULL)
+    self->meta_cache = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                              (GDestroyNotify)meta_cache_entry_free);
 
-  if (fd < 0 && self->commit_stagedir_fd != -1)
+  /* A racing loader may have inserted it already */
+  if (g_hash_table_contains (self->meta_cache, key))
+    return;
+
+  MetaCacheEntry *entry = g_new0 (MetaCacheEntry, 1);
+  entry->key = g_strdup (key);
+  entry->variant = g_variant_ref (variant);
+  g_queue_push_head (&self->meta_cache_lru, entry);
+  entry->link = self->meta_cache_lru.head;
+  g_hash_table_replace (self->meta_cache, entry->key, entry);
+
+  if (self->meta_cache_lru.length > META_CACHE_MAX_ENTRIES)
     {
-      if (!ot_openat_ignore_enoent (self->commit_stagedir_fd, loose_path_buf, &fd,
-                                    error))
-        return FALSE;
+      MetaCacheEntry *oldest = g_queue_pop_tail (&self->meta_cache_lru);
+      g_hash_table_remove (self->meta_cache, oldest->key);
     }
+}
 
-  if (fd != -1)
+/* Companion cache for tiny content objects.  Config-heavy trees are
+ * dominated by files well under a kilobyte (licenses, unit files,
+ * snippets), many of them identical across paths and checkouts; the
+ * checkout copy path pays an open/read/close on the loose object for
+ * every instance.  Keep the payload and xattrs of content objects up to
+ * _OSTREE_SMALL_CONTENT_CACHE_THRESHOLD bytes in memory instead.
+ * Structure and locking mirror the metadata cache above.
+ */
+#define SMALL_CONTENT_CACHE_MAX_ENTRIES 2048
+
+typedef struct {
+  char *key;
+  GBytes *content;
+  GVariant *xattrs;  /* maybe NULL */
+  GList *link;  /* Position in small_content_cache_lru; head is most recent */
+} SmallContentCacheEntry;
+
+static void
+small_content_cache_entry_free (SmallContentCacheEntry *entry)
+{
+  g_free (entry->key);
+  g_bytes_unref (entry->content);
+  g_clear_pointer (&entry->xattrs, (GDestroyNotify)g_variant_unref);
+  g_free (entry);
+}
+
+gboolean
+_ostree_repo_small_content_cache_lookup (OstreeRepo  *self,
+                                         const char  *checksum,
+                                         GBytes     **out_content,
+                                         GVariant   **out_xattrs)
+{
+  SmallContentCacheEntry *entry = NULL;
+
+  g_mutex_lock (&self->cache_lock);
+  if (self->small_content_cache)
+    entry = g_hash_table_lookup (self->small_content_cache, checksum);
+  if (entry != NULL)
     {
-      if (fstat (fd, &stbuf) < 0)
-        return glnx_throw_errno (error);
+      self->small_content_cache_hits++;
+      g_queue_unlink (&self->small_content_cache_lru, entry->link);
+      g_queue_push_head_link (&self->small_content_cache_lru, entry->link);
+      *out_content = g_bytes_ref (entry->content);
+      *out_xattrs = entry->xattrs ? g_variant_ref (entry->xattrs) : NULL;
+    }
+  else
+    self->small_content_cache_misses++;
+  g_mutex_unlock (&self->cache_lock);
 
-      if (out_variant)
+  return entry != NULL;
+}
+
+void
+_ostree_repo_small_content_cache_insert (OstreeRepo  *self,
+                                         const char  *checksum,
+                                         GBytes      *content,
+                                         GVariant    *xattrs)
+{
+  if (g_bytes_get_size (content) > _OSTREE_SMALL_CONTENT_CACHE_THRESHOLD)
+    return;
+
+  g_mutex_lock (&self->cache_lock);
+  if (self->small_content_cache == NULL)
+    self->small_content_cache =
+      g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                             (GDestroyNotify)small_content_cache_entry_free);
+
+  if (!g_hash_table_contains (self->small_content_cache, checksum))
+    {
+      SmallContentCacheEntry *entry = g_new0 (SmallContentCacheEntry, 1);
+      entry->key = g_strdup (checksum);
+      entry->content = g_bytes_ref (content);
+      entry->xattrs = xattrs ? g_variant_ref (xattrs) : NULL;
+      g_queue_push_head (&self->small_content_cache_lru, entry);
+      entry->link = self->small_content_cache_lru.head;
+      g_hash_table_replace (self->small_content_cache, entry->key, entry);
+
+      if (self->small_content_cache_lru.length > SMALL_CONTENT_CACHE_MAX_ENTRIES)
         {
-          /* http://stackoverflow.com/questions/258091/when-should-i-use-mmap-for-file-access */
-          if (stbuf.st_size > 16*1024)
+          SmallContentCacheEntry *oldest = g_queue_pop_tail (&self->small_content_cache_lru);
+          g_hash_table_remove (self->small_content_cache, oldest->key);
+        }
+    }
+  g_mutex_unlock (&self->cache_lock);
+}
+
+/* Lazily build (under cache_lock) a bloom filter over the loose object
+ * names of alternate @i, so that walking a chain of alternates on a miss
+ * normally costs only in-memory hash probes rather than one stat() per
+ * alternate.  Sized at ~10 bits per element with k=8 for a false
+ * positive rate of < 1%.
+ *
+ * The filter is a per-process snapshot: objects added to the alternate
+ * after it was built won't be found through us until we're reopened.
+ * Alternates are expected to hold stable base content, so that's an
+ * acceptable trade for O(1) misses.  Returns %NULL if the filter
+ * couldn't be built, in which case the caller should just probe the
+ * alternate directly.
+ */
+static OstreeBloom *
+alternate_repo_get_bloom (OstreeRepo    *self,
+                          guint          i,
+                          GCancellable  *cancellable)
+{
+  g_mutex_lock (&self->cache_lock);
+  OstreeBloom *bloom = self->alternate_blooms->pdata[i];
+  if (bloom == NULL)
+    {
+      OstreeRepo *alternate = self->alternate_repos->pdata[i];
+      g_autoptr(GHashTable) objects = NULL;
+
+      if (ostree_repo_list_objects (alternate,
+                                    OSTREE_REPO_LIST_OBJECTS_LOOSE | OSTREE_REPO_LIST_OBJECTS_NO_PARENTS,
+                                    &objects, cancellable, NULL))
+        {
+          const guint n = g_hash_table_size (objects);
+          gsize n_bytes = MAX (((gsize)n * 10 + 7) / 8, (gsize)32);
+
+          bloom = ostree_bloom_new (n_bytes, 8, ostree_str_bloom_hash);
+          GLNX_HASH_TABLE_FOREACH (objects, GVariant*, object)
             {
-              GMappedFile *mfile;
+              const char *checksum;
+              OstreeObjectType objtype;
+              ostree_object_name_deserialize (object, &checksum, &objtype);
+              g_autofree char *objname = ostree_object_to_string (checksum, objtype);
+              ostree_bloom_add_element (bloom, objname);
+            }
+          self->alternate_blooms->pdata[i] = bloom;
+        }
+    }
+  g_mutex_unlock (&self->cache_lock);
 
-              mfile = g_mapped_file_new_from_fd (fd, FALSE, error);
-              if (!mfile)
-                return FALSE;
-              ret_variant = g_variant_new_from_data (ostree_metadata_variant_type (objtype),
-                                                     g_mapped_file_get_contents (mfile),
-                                                     g_mapped_file_get_length (mfile),
+  return bloom;
+}
+
+/* Walk the fallback object stores - the parent repo first, then each
+ * configured alternate in order - and return in @out_repo the first one
+ * containing @checksum, or %NULL if none does.  Alternates are gated by
+ * their bloom filter so a fully missing object usually touches no
+ * alternate on disk at all.
+ */
+static gboolean
+fallback_repos_lookup (OstreeRepo        *self,
+                       OstreeObjectType   objtype,
+                       const char        *checksum,
+                       OstreeRepo       **out_repo,
+                       GCancellable      *cancellable,
+                       GError           **error)
+{
+  *out_repo = NULL;
+
+  if (self->parent_repo != NULL)
+    {
+      gboolean have_object;
+      if (!ostree_repo_has_object (self->parent_repo, objtype, checksum,
+                                   &have_object, cancellable, error))
+        return FALSE;
+      if (have_object)
+        {
+          *out_repo = self->parent_repo;
+          return TRUE;
+        }
+    }
+
+  if (self->alternate_repos == NULL)
+    return TRUE;
+
+  g_autofree char *objname = ostree_object_to_string (checksum, objtype);
+  for (guint i = 0; i < self->alternate_repos->len; i++)
+    {
+      OstreeRepo *alternate = self->alternate_repos->pdata[i];
+
+      /* A bare repo can only serve content payloads out of a bare-mode
+       * store; metadata objects are byte-identical across modes.
+       */
+      if (objtype == OSTREE_OBJECT_TYPE_FILE
+          && _ostree_repo_mode_is_bare (self->mode)
+          && !_ostree_repo_mode_is_bare (alternate->mode))
+        continue;
+
+      OstreeBloom *bloom = alternate_repo_get_bloom (self, i, cancellable);
+      if (bloom != NULL && !ostree_bloom_maybe_contains (bloom, objname))
+        continue;
+
+      gboolean have_object;
+      if (!ostree_repo_has_object (alternate, objtype, checksum,
+                                   &have_object, cancellable, error))
+        return FALSE;
+      if (have_object)
+        {
+          *out_repo = alternate;
+          return TRUE;
+        }
+    }
+
+  return TRUE;
+}
+
+static gboolean
+load_metadata_internal (OstreeRepo       *self,
+                        OstreeObjectType  objtype,
+                        const char       *sha256,
+                        gboolean          error_if_not_found,
+                        GVariant        **out_variant,
+                        GInputStream    **out_stream,
+                        guint64          *out_size,
+                        GCancellable     *cancellable,
+                        GError          **error)
+{
+  char loose_path_buf[_OSTREE_LOOSE_PATH_MAX];
+  struct stat stbuf;
+  glnx_fd_close int fd = -1;
+  g_autoptr(GInputStream) ret_stream = NULL;
+  g_autoptr(GVariant) ret_variant = NULL;
+
+  g_return_val_if_fail (OSTREE_OBJECT_TYPE_IS_META (objtype), FALSE);
+
+  /* Special caching for dirmeta and dirtree objects, since they're
+   * commonly referenced many times.
+   */
+  const gboolean is_meta_cachable =
+    ((objtype == OSTREE_OBJECT_TYPE_DIR_META || objtype == OSTREE_OBJECT_TYPE_DIR_TREE)
+     && out_variant && !out_stream);
+  char cache_key[_OSTREE_LOOSE_PATH_MAX];
+  if (is_meta_cachable)
+    {
+      g_snprintf (cache_key, sizeof (cache_key), "%d.%s", (int)objtype, sha256);
+      g_mutex_lock (&self->cache_lock);
+      GVariant *cache_hit = meta_cache_lookup (self, cache_key);
+      g_mutex_unlock (&self->cache_lock);
+      if (cache_hit)
+        {
+          *out_variant = cache_hit;
+          return TRUE;
+        }
+    }
+
+  _ostree_loose_path (loose_path_buf, sha256, objtype, self->mode);
+
+  int fanout_dfd = _ostree_repo_fanout_dfd (self, loose_path_buf);
+  if (fanout_dfd != -1)
+    {
+      if (!ot_openat_ignore_enoent (fanout_dfd, loose_path_buf + 3, &fd,
+                                    error))
+        return FALSE;
+    }
+
+  if (fd < 0 && self->commit_stagedir_fd != -1)
+    {
+      if (!ot_openat_ignore_enoent (self->commit_stagedir_fd, loose_path_buf, &fd,
+                                    error))
+        return FALSE;
+    }
+
+  if (fd != -1)
+    {
+      if (fstat (fd, &stbuf) < 0)
+        return glnx_throw_errno (error);
+
+      if (out_variant)
+        {
+          /* http://stackoverflow.com/questions/258091/when-should-i-use-mmap-for-file-access */
+          if (stbuf.st_size > 16*1024)
+            {
+              GMappedFile *mfile;
+
+              mfile = g_mapped_file_new_from_fd (fd, FALSE, error);
+              if (!mfile)
+                return FALSE;
+              ret_variant = g_variant_new_from_data (ostree_metadata_variant_type (objtype),
+                                                     g_mapped_file_get_contents (mfile),
+                                                     g_mapped_file_get_length (mfile),
                                                      TRUE,
                                                      (GDestroyNotify) g_mapped_file_unref,
                                                      mfile);
@@ -2596,13 +3271,11 @@ load_metadata_internal (OstreeRepo       *self,
             }
 
           /* Now, let's put it in the cache */
-          if (is_dirmeta_cachable)
+          if (is_meta_cachable)
             {
-              GMutex *lock = &self->cache_lock;
-              g_mutex_lock (lock);
-              if (self->dirmeta_cache)
-                g_hash_table_replace (self->dirmeta_cache, g_strdup (sha256), g_variant_ref (ret_variant));
-              g_mutex_unlock (lock);
+              g_mutex_lock (&self->cache_lock);
+              meta_cache_insert (self, cache_key, ret_variant);
+              g_mutex_unlock (&self->cache_lock);
             }
         }
       else if (out_stream)
@@ -2616,10 +3289,24 @@ load_metadata_internal (OstreeRepo       *self,
       if (out_size)
         *out_size = stbuf.st_size;
     }
-  else if (self->parent_repo)
+  else if (self->parent_repo || self->alternate_repos)
     {
-      if (!ostree_repo_load_variant (self->parent_repo, objtype, sha256, &ret_variant, error))
+      OstreeRepo *fallback = NULL;
+      if (!fallback_repos_lookup (self, objtype, sha256, &fallback,
+                                  cancellable, error))
         return FALSE;
+      if (fallback != NULL)
+        {
+          if (!ostree_repo_load_variant (fallback, objtype, sha256, &ret_variant, error))
+            return FALSE;
+        }
+      else if (error_if_not_found)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                       "No such metadata object %s.%s",
+                       sha256, ostree_object_type_to_string (objtype));
+          return FALSE;
+        }
     }
   else if (error_if_not_found)
     {
@@ -2664,9 +3351,13 @@ repo_load_file_archive (OstreeRepo *self,
   _ostree_loose_path (loose_path_buf, checksum, OSTREE_OBJECT_TYPE_FILE, self->mode);
 
   glnx_fd_close int fd = -1;
-  if (!ot_openat_ignore_enoent (self->objects_dir_fd, loose_path_buf, &fd,
-                                error))
-    return FALSE;
+  int fanout_dfd = _ostree_repo_fanout_dfd (self, loose_path_buf);
+  if (fanout_dfd != -1)
+    {
+      if (!ot_openat_ignore_enoent (fanout_dfd, loose_path_buf + 3, &fd,
+                                    error))
+        return FALSE;
+    }
 
   if (fd < 0 && self->commit_stagedir_fd != -1)
     {
@@ -2686,11 +3377,35 @@ repo_load_file_archive (OstreeRepo *self,
                                           out_input, out_file_info, out_xattrs,
                                           cancellable, error);
     }
-  else if (self->parent_repo)
+
+  /* Small objects may have been folded into a content pack */
+  gboolean found_in_pack = FALSE;
+  g_autoptr(GBytes) pack_data = NULL;
+  if (!_ostree_repo_content_pack_lookup (self, checksum, &found_in_pack, NULL,
+                                         &pack_data, cancellable, error))
+    return FALSE;
+  if (found_in_pack)
+    {
+      g_autoptr(GInputStream) tmp_stream = g_memory_input_stream_new_from_bytes (pack_data);
+      /* Note return here */
+      return ostree_content_stream_parse (TRUE, tmp_stream, g_bytes_get_size (pack_data), TRUE,
+                                          out_input, out_file_info, out_xattrs,
+                                          cancellable, error);
+    }
+
+  if (self->parent_repo || self->alternate_repos)
     {
-      return ostree_repo_load_file (self->parent_repo, checksum,
-                                    out_input, out_file_info, out_xattrs,
-                                    cancellable, error);
+      OstreeRepo *fallback = NULL;
+      if (!fallback_repos_lookup (self, OSTREE_OBJECT_TYPE_FILE, checksum,
+                                  &fallback, cancellable, error))
+        return FALSE;
+      if (fallback != NULL)
+        return ostree_repo_load_file (fallback, checksum,
+                                      out_input, out_file_info, out_xattrs,
+                                      cancellable, error);
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                   "Couldn't find file object '%s'", checksum);
+      return FALSE;
     }
   else
     {
@@ -2725,21 +3440,44 @@ _ostree_repo_load_file_bare (OstreeRepo         *self,
   char loose_path_buf[_OSTREE_LOOSE_PATH_MAX];
   _ostree_loose_path (loose_path_buf, checksum, OSTREE_OBJECT_TYPE_FILE, self->mode);
 
-  /* Do a fstatat() and find the object directory that contains this object */
+  /* Do a fstatat() and find the object directory that contains this object;
+   * @loose_rel tracks the path relative to @objdir_fd, which is just the
+   * basename when we have a cached fanout dirfd.
+   */
   int objdir_fd = self->objects_dir_fd;
+  const char *loose_rel = loose_path_buf;
+  int fanout_dfd = _ostree_repo_fanout_dfd (self, loose_path_buf);
+  if (fanout_dfd != -1)
+    {
+      objdir_fd = fanout_dfd;
+      loose_rel = loose_path_buf + 3;
+    }
   int res;
-  if ((res = TEMP_FAILURE_RETRY (fstatat (objdir_fd, loose_path_buf, &stbuf, AT_SYMLINK_NOFOLLOW))) < 0
+  if ((res = TEMP_FAILURE_RETRY (fstatat (objdir_fd, loose_rel, &stbuf, AT_SYMLINK_NOFOLLOW))) < 0
       && errno == ENOENT && self->commit_stagedir_fd != -1)
     {
       objdir_fd = self->commit_stagedir_fd;
-      res = TEMP_FAILURE_RETRY (fstatat (objdir_fd, loose_path_buf, &stbuf, AT_SYMLINK_NOFOLLOW));
+      loose_rel = loose_path_buf;
+      res = TEMP_FAILURE_RETRY (fstatat (objdir_fd, loose_rel, &stbuf, AT_SYMLINK_NOFOLLOW));
     }
   if (res < 0 && errno != ENOENT)
     return glnx_throw_errno_prefix (error, "fstat");
   else if (res < 0)
     {
       g_assert (errno == ENOENT);
-      return _ostree_repo_load_file_bare (self->parent_repo, checksum, out_fd,
+      OstreeRepo *fallback = self->parent_repo;
+      if (self->alternate_repos != NULL)
+        {
+          /* Only bare-mode alternates can serve us here (archive
+           * alternates store file objects compressed);
+           * fallback_repos_lookup() already skips the others.  A NULL
+           * result recurses to the not-found case below.
+           */
+          if (!fallback_repos_lookup (self, OSTREE_OBJECT_TYPE_FILE, checksum,
+                                      &fallback, cancellable, error))
+            return FALSE;
+        }
+      return _ostree_repo_load_file_bare (fallback, checksum, out_fd,
                                           out_stbuf, out_symlink, out_xattrs,
                                           cancellable, error);
     }
@@ -2752,7 +3490,7 @@ _ostree_repo_load_file_bare (OstreeRepo         *self,
    */
   if (need_open && S_ISREG (stbuf.st_mode))
     {
-      fd = openat (objdir_fd, loose_path_buf, O_CLOEXEC | O_RDONLY);
+      fd = openat (objdir_fd, loose_rel, O_CLOEXEC | O_RDONLY);
       if (fd < 0)
         return glnx_throw_errno_prefix (error, "openat");
     }
@@ -2764,7 +3502,7 @@ _ostree_repo_load_file_bare (OstreeRepo         *self,
   if (self->mode != OSTREE_REPO_MODE_BARE_USER
       && S_ISLNK (stbuf.st_mode) && out_symlink)
     {
-      ret_symlink = glnx_readlinkat_malloc (objdir_fd, loose_path_buf,
+      ret_symlink = glnx_readlinkat_malloc (objdir_fd, loose_rel,
                                             cancellable, error);
       if (!ret_symlink)
         return FALSE;
@@ -2826,7 +3564,7 @@ _ostree_repo_load_file_bare (OstreeRepo         *self,
         {
           if (self->disable_xattrs)
             ret_xattrs = g_variant_ref_sink (g_variant_new_array (G_VARIANT_TYPE ("(ayay)"), NULL, 0));
-          else if (!glnx_dfd_name_get_all_xattrs (objdir_fd, loose_path_buf,
+          else if (!glnx_dfd_name_get_all_xattrs (objdir_fd, loose_rel,
                                                   &ret_xattrs,
                                                   cancellable, error))
             return FALSE;
@@ -2956,6 +3694,73 @@ ostree_repo_load_object_stream (OstreeRepo         *self,
   return TRUE;
 }
 
+/*
+ * _ostree_repo_fanout_dfd:
+ * @loose_path: A loose object path as written by _ostree_loose_path()
+ *
+ * Return a dirfd for the objects/XX fanout directory named by the two
+ * leading hex characters of @loose_path, or -1 if that directory
+ * doesn't exist (yet).  The returned fd is owned by the repo - do not
+ * close it.  Callers holding a non-negative return can then openat()
+ * or fstatat() with `loose_path + 3` (the basename), saving the kernel
+ * a path component resolution on every object access; that adds up
+ * over the millions of lookups a mirror pull or fsck performs.
+ *
+ * The fds are opened lazily and cached for the lifetime of the repo
+ * handle; this relies on fanout directories never being deleted, which
+ * holds for ostree itself (prune only unlinks objects within them).
+ */
+int
+_ostree_repo_fanout_dfd (OstreeRepo           *self,
+                         const char           *loose_path)
+{
+  guint idx = (g_ascii_xdigit_value (loose_path[0]) << 4)
+    | g_ascii_xdigit_value (loose_path[1]);
+  int *slot = &self->objects_fanout_dfds[idx];
+
+  int fd = g_atomic_int_get (slot);
+  while (fd == -1)
+    {
+      char name[3] = { loose_path[0], loose_path[1], '\0' };
+      fd = TEMP_FAILURE_RETRY (openat (self->objects_dir_fd, name,
+                                       O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+      if (fd == -1)
+        break; /* Not cached; a later commit may create the directory */
+      if (!g_atomic_int_compare_and_exchange (slot, -1, fd))
+        {
+          /* Lost a race with another thread; use its fd */
+          (void) close (fd);
+          fd = g_atomic_int_get (slot);
+        }
+    }
+  return fd;
+}
+
+/* Mark a loose object as belonging to the current prune generation;
+ * see get_prune_epoch() in ostree-repo-prune.c, whose sweep skips any
+ * object whose mtime *or* ctime is at least the epoch.  In bare modes
+ * the mtime is pinned to OSTREE_TIMESTAMP and the inode is hardlinked
+ * into checkouts and deployments, so stamping the current time there
+ * would leak into deployed trees; instead we re-assert the pinned
+ * mtime, which is still a metadata change and thus refreshes the
+ * ctime the sweep checks.  Failure (e.g. we don't own the file) is
+ * ignored - that's the pre-pinning behavior.
+ */
+static void
+bump_loose_object_generation (OstreeRepo  *self,
+                              const char  *loose_path_buf)
+{
+  const struct timespec bare_times[2] = { { 0, UTIME_OMIT }, { OSTREE_TIMESTAMP, 0 } };
+  const struct timespec *times =
+    _ostree_repo_mode_is_bare (self->mode) ? bare_times : NULL;
+
+  int fanout_dfd = _ostree_repo_fanout_dfd (self, loose_path_buf);
+  if (fanout_dfd != -1)
+    (void) utimensat (fanout_dfd, loose_path_buf + 3, times, AT_SYMLINK_NOFOLLOW);
+  else
+    (void) utimensat (self->objects_dir_fd, loose_path_buf, times, AT_SYMLINK_NOFOLLOW);
+}
+
 /*
  * _ostree_repo_has_loose_object:
  * @loose_path_buf: Buffer of size _OSTREE_LOOSE_PATH_MAX
@@ -2975,25 +3780,55 @@ _ostree_repo_has_loose_object (OstreeRepo           *self,
   _ostree_loose_path (loose_path_buf, checksum, objtype, self->mode);
 
   gboolean found = FALSE;
-  /* It's easier to share code if we make this an array */
-  const int dfd_searches[] = { self->commit_stagedir_fd, self->objects_dir_fd };
-  for (guint i = 0; i < G_N_ELEMENTS (dfd_searches); i++)
+
+  /* The staging journal's in-memory set mirrors the staging directory,
+   * so an active transaction answers this without a stat per probe.
+   */
+  if (self->txn_staged_objects != NULL)
+    {
+      g_mutex_lock (&self->txn_stats_lock);
+      found = g_hash_table_contains (self->txn_staged_objects, loose_path_buf);
+      g_mutex_unlock (&self->txn_stats_lock);
+    }
+  else if (self->commit_stagedir_fd != -1)
     {
-      int dfd = dfd_searches[i];
-      if (dfd == -1)
-        continue;
       struct stat stbuf;
-      if (TEMP_FAILURE_RETRY (fstatat (dfd, loose_path_buf, &stbuf, AT_SYMLINK_NOFOLLOW)) < 0)
+      if (TEMP_FAILURE_RETRY (fstatat (self->commit_stagedir_fd, loose_path_buf,
+                                       &stbuf, AT_SYMLINK_NOFOLLOW)) < 0)
         {
-          if (errno == ENOENT)
-            ; /* Next dfd */
-          else
+          if (errno != ENOENT)
+            return glnx_throw_errno (error);
+        }
+      else
+        found = TRUE;
+    }
+
+  if (!found)
+    {
+      struct stat stbuf;
+      int fanout_dfd = _ostree_repo_fanout_dfd (self, loose_path_buf);
+      int res;
+      if (fanout_dfd != -1)
+        res = TEMP_FAILURE_RETRY (fstatat (fanout_dfd, loose_path_buf + 3,
+                                           &stbuf, AT_SYMLINK_NOFOLLOW));
+      else
+        res = TEMP_FAILURE_RETRY (fstatat (self->objects_dir_fd, loose_path_buf,
+                                           &stbuf, AT_SYMLINK_NOFOLLOW));
+      if (res < 0)
+        {
+          if (errno != ENOENT)
             return glnx_throw_errno (error);
         }
       else
         {
+          /* If a transaction dedups against an existing loose object,
+           * refresh its generation so that a concurrently running
+           * prune sees it as part of our generation and won't sweep it
+           * before our refs are published.
+           */
+          if (self->in_transaction)
+            bump_loose_object_generation (self, loose_path_buf);
           found = TRUE;
-          break;
         }
     }
 
@@ -3029,13 +3864,22 @@ ostree_repo_has_object (OstreeRepo           *self,
                                       cancellable, error))
     return FALSE;
 
-  /* In the future, here is where we would also look up in metadata pack files */
+  /* Small content objects may live in a content pack rather than loose */
+  if (!ret_have_object && objtype == OSTREE_OBJECT_TYPE_FILE
+      && self->mode == OSTREE_REPO_MODE_ARCHIVE_Z2)
+    {
+      if (!_ostree_repo_content_pack_lookup (self, checksum, &ret_have_object,
+                                             NULL, NULL, cancellable, error))
+        return FALSE;
+    }
 
-  if (!ret_have_object && self->parent_repo)
+  if (!ret_have_object && (self->parent_repo || self->alternate_repos))
     {
-      if (!ostree_repo_has_object (self->parent_repo, objtype, checksum,
-                                   &ret_have_object, cancellable, error))
+      OstreeRepo *fallback = NULL;
+      if (!fallback_repos_lookup (self, objtype, checksum, &fallback,
+                                  cancellable, error))
         return FALSE;
+      ret_have_object = (fallback != NULL);
     }
 
   if (out_have_object)
@@ -3043,6 +3887,211 @@ ostree_repo_has_object (OstreeRepo           *self,
   return TRUE;
 }
 
+static gint
+compare_object_names (gconstpointer ap,
+                      gconstpointer bp)
+{
+  GVariant *a = *((GVariant**)ap);
+  GVariant *b = *((GVariant**)bp);
+  const char *checksum_a;
+  const char *checksum_b;
+  OstreeObjectType objtype_a;
+  OstreeObjectType objtype_b;
+  int c;
+
+  ostree_object_name_deserialize (a, &checksum_a, &objtype_a);
+  ostree_object_name_deserialize (b, &checksum_b, &objtype_b);
+
+  c = strcmp (checksum_a, checksum_b);
+  if (c != 0)
+    return c;
+  return (int)objtype_a - (int)objtype_b;
+}
+
+/**
+ * ostree_repo_has_objects_batch:
+ * @self: Repo
+ * @objects: (element-type GVariant): Object names, as returned by ostree_object_name_serialize()
+ * @out_found: (out) (transfer container) (element-type GVariant GVariant): Set of objects present in @self
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Check many objects for presence at once.  The lookups are performed
+ * in checksum order, which matches the objects/ directory fanout on
+ * disk; when enough queries land in one fanout directory its entries
+ * are read in a single bulk pass and probed from memory, so the
+ * existence phase of a large incremental pull is a sequential sweep of
+ * the directory blocks rather than a random dentry access per object.
+ * @out_found uses ostree_hash_object_name() and holds one entry for
+ * each object found; duplicate entries in @objects are checked only
+ * once.
+ *
+ * Returns: %FALSE if an unexpected error occurred, %TRUE otherwise
+ */
+gboolean
+ostree_repo_has_objects_batch (OstreeRepo    *self,
+                               GPtrArray     *objects,
+                               GHashTable   **out_found,
+                               GCancellable  *cancellable,
+                               GError       **error)
+{
+  /* Below this many probes of one fanout directory, an fstatat() per
+   * object beats reading and sorting the whole directory.
+   */
+  const guint min_snapshot_probes = 4;
+
+  g_autoptr(GPtrArray) sorted = g_ptr_array_sized_new (objects->len);
+  g_autoptr(GHashTable) ret_found =
+    g_hash_table_new_full (ostree_hash_object_name, g_variant_equal,
+                           (GDestroyNotify)g_variant_unref, NULL);
+
+  for (guint i = 0; i < objects->len; i++)
+    g_ptr_array_add (sorted, objects->pdata[i]);
+  g_ptr_array_sort (sorted, compare_object_names);
+
+  /* Entry-name snapshot of the fanout directory currently being
+   * swept; snapshot_names borrows the names owned by snapshot_entries.
+   */
+  char snapshot_prefix[2] = { 0, 0 };
+  gboolean snapshot_prefix_set = FALSE;
+  g_autoptr(GPtrArray) snapshot_entries = NULL;
+  g_autoptr(GHashTable) snapshot_names = NULL;
+
+  for (guint i = 0; i < sorted->len; i++)
+    {
+      GVariant *objname = sorted->pdata[i];
+      const char *checksum;
+      OstreeObjectType objtype;
+
+      /* Duplicates are adjacent after sorting */
+      if (i > 0 && g_variant_equal (objname, sorted->pdata[i-1]))
+        continue;
+
+      ostree_object_name_deserialize (objname, &checksum, &objtype);
+
+      char loose_path_buf[_OSTREE_LOOSE_PATH_MAX];
+      _ostree_loose_path (loose_path_buf, checksum, objtype, self->mode);
+
+      /* Crossing into a new fanout directory; snapshot it if enough of
+       * the remaining queries will probe it.
+       */
+      if (!snapshot_prefix_set || memcmp (checksum, snapshot_prefix, 2) != 0)
+        {
+          if (g_cancellable_set_error_if_cancelled (cancellable, error))
+            return FALSE;
+
+          memcpy (snapshot_prefix, checksum, 2);
+          snapshot_prefix_set = TRUE;
+          g_clear_pointer (&snapshot_names, g_hash_table_unref);
+          g_clear_pointer (&snapshot_entries, g_ptr_array_unref);
+
+          guint n_probes = 1;
+          for (guint j = i + 1; j < sorted->len && n_probes < min_snapshot_probes; j++)
+            {
+              const char *next_checksum;
+              OstreeObjectType next_objtype;
+              ostree_object_name_deserialize (sorted->pdata[j], &next_checksum, &next_objtype);
+              if (memcmp (next_checksum, checksum, 2) != 0)
+                break;
+              n_probes++;
+            }
+
+          if (n_probes >= min_snapshot_probes)
+            {
+              char fanout_name[3] = { checksum[0], checksum[1], '\0' };
+              gboolean exists;
+              if (!ot_dfd_list_sorted_allow_noent (self->objects_dir_fd, fanout_name,
+                                                   &snapshot_entries, &exists, error))
+                return FALSE;
+              snapshot_names = g_hash_table_new (g_str_hash, g_str_equal);
+              if (exists)
+                {
+                  for (guint j = 0; j < snapshot_entries->len; j++)
+                    {
+                      OtBulkDirent *dent = snapshot_entries->pdata[j];
+                      g_hash_table_add (snapshot_names, dent->name);
+                    }
+                }
+            }
+        }
+
+      gboolean have_object = FALSE;
+
+      /* Staged objects first, as in _ostree_repo_has_loose_object() */
+      if (self->txn_staged_objects != NULL)
+        {
+          g_mutex_lock (&self->txn_stats_lock);
+          have_object = g_hash_table_contains (self->txn_staged_objects, loose_path_buf);
+          g_mutex_unlock (&self->txn_stats_lock);
+        }
+      else if (self->commit_stagedir_fd != -1)
+        {
+          struct stat stbuf;
+          if (TEMP_FAILURE_RETRY (fstatat (self->commit_stagedir_fd, loose_path_buf,
+                                           &stbuf, AT_SYMLINK_NOFOLLOW)) < 0)
+            {
+              if (errno != ENOENT)
+                return glnx_throw_errno (error);
+            }
+          else
+            have_object = TRUE;
+        }
+
+      if (!have_object)
+        {
+          if (snapshot_names != NULL)
+            have_object = g_hash_table_contains (snapshot_names, loose_path_buf + 3);
+          else
+            {
+              struct stat stbuf;
+              int fanout_dfd = _ostree_repo_fanout_dfd (self, loose_path_buf);
+              int res;
+              if (fanout_dfd != -1)
+                res = TEMP_FAILURE_RETRY (fstatat (fanout_dfd, loose_path_buf + 3,
+                                                   &stbuf, AT_SYMLINK_NOFOLLOW));
+              else
+                res = TEMP_FAILURE_RETRY (fstatat (self->objects_dir_fd, loose_path_buf,
+                                                   &stbuf, AT_SYMLINK_NOFOLLOW));
+              if (res < 0)
+                {
+                  if (errno != ENOENT)
+                    return glnx_throw_errno (error);
+                }
+              else
+                have_object = TRUE;
+            }
+
+          /* Keep the prune-epoch refresh of the per-object path */
+          if (have_object && self->in_transaction)
+            bump_loose_object_generation (self, loose_path_buf);
+        }
+
+      /* Small content objects may live in a content pack rather than loose */
+      if (!have_object && objtype == OSTREE_OBJECT_TYPE_FILE
+          && self->mode == OSTREE_REPO_MODE_ARCHIVE_Z2)
+        {
+          if (!_ostree_repo_content_pack_lookup (self, checksum, &have_object,
+                                                 NULL, NULL, cancellable, error))
+            return FALSE;
+        }
+
+      if (!have_object && (self->parent_repo || self->alternate_repos))
+        {
+          OstreeRepo *fallback = NULL;
+          if (!fallback_repos_lookup (self, objtype, checksum, &fallback,
+                                      cancellable, error))
+            return FALSE;
+          have_object = (fallback != NULL);
+        }
+
+      if (have_object)
+        g_hash_table_add (ret_found, g_variant_ref (objname));
+    }
+
+  ot_transfer_out_value (out_found, &ret_found);
+  return TRUE;
+}
+
 /**
  * ostree_repo_delete_object:
  * @self: Repo
@@ -3081,6 +4130,13 @@ ostree_repo_delete_object (OstreeRepo           *self,
   if (TEMP_FAILURE_RETRY (unlinkat (self->objects_dir_fd, loose_path, 0)) < 0)
     return glnx_throw_errno_prefix (error, "Deleting object %s.%s", sha256, ostree_object_type_to_string (objtype));
 
+  /* A deleted object invalidates the scanned-subtree index pull
+   * maintains: any subtree it marks complete may have referenced the
+   * object, and a repair pull must rescan rather than trust it.
+   */
+  if (!ot_ensure_unlinked_at (self->repo_dir_fd, _OSTREE_SCANNED_SUBTREE_INDEX_PATH, error))
+    return FALSE;
+
   /* If the repository is configured to use tombstone commits, create one when deleting a commit.  */
   if (objtype == OSTREE_OBJECT_TYPE_COMMIT)
     {
@@ -3195,10 +4251,11 @@ import_one_object_link (OstreeRepo    *self,
     {
       if (errno == EEXIST)
         return TRUE;
-      else if (errno == EMLINK || errno == EXDEV || errno == EPERM)
+      else if (errno == EMLINK || errno == EXDEV || errno == EPERM || errno == ENOENT)
         {
           /* EMLINK, EXDEV and EPERM shouldn't be fatal; we just can't do the
-           * optimization of hardlinking instead of copying.
+           * optimization of hardlinking instead of copying.  ENOENT means
+           * the source object isn't loose (e.g. it's in a content pack).
            */
           *out_was_supported = FALSE;
           return TRUE;
@@ -3216,21 +4273,129 @@ import_one_object_link (OstreeRepo    *self,
   return TRUE;
 }
 
-/**
- * ostree_repo_import_object_from:
- * @self: Destination repo
- * @source: Source repo
- * @objtype: Object type
- * @checksum: checksum
- * @cancellable: Cancellable
- * @error: Error
- *
- * Copy object named by @objtype and @checksum into @self from the
- * source repository @source.  If both repositories are of the same
- * type and on the same filesystem, this will simply be a fast Unix
- * hard link operation.
- *
- * Otherwise, a copy will be performed.
+/* Try to reflink (FICLONE) the loose object file from @source into place in
+ * @self.  This requires equal repository modes so the loose representation is
+ * identical, but unlike a hardlink works across owner uids and when the
+ * filesystem refuses new links to the inode, sharing extents on e.g. XFS and
+ * btrfs instead of copying payloads.  If the filesystem can't do it,
+ * @out_was_supported will be %FALSE and the caller falls back to a copy.
+ */
+static gboolean
+import_one_object_reflink (OstreeRepo    *self,
+                           OstreeRepo    *source,
+                           const char   *checksum,
+                           OstreeObjectType objtype,
+                           gboolean       *out_was_supported,
+                           GCancellable  *cancellable,
+                           GError        **error)
+{
+  char loose_path_buf[_OSTREE_LOOSE_PATH_MAX];
+  g_assert (self->mode == source->mode);
+  _ostree_loose_path (loose_path_buf, checksum, objtype, self->mode);
+
+  *out_was_supported = FALSE;
+
+  glnx_autofd int src_fd = -1;
+  if (!ot_openat_ignore_enoent (source->objects_dir_fd, loose_path_buf,
+                                &src_fd, error))
+    return FALSE;
+  /* Not loose (e.g. in a content pack); fall back to the copy path.
+   * NOTE early return.
+   */
+  if (src_fd == -1)
+    return TRUE;
+
+  struct stat stbuf;
+  if (!glnx_fstat (src_fd, &stbuf, error))
+    return FALSE;
+  /* In the bare modes symlink objects are stored as symlinks; those can't
+   * be cloned.  NOTE early return.
+   */
+  if (!S_ISREG (stbuf.st_mode))
+    return TRUE;
+
+  g_auto(GLnxTmpfile) tmpf = { 0, };
+  if (!glnx_open_tmpfile_linkable_at (self->tmp_dir_fd, ".", O_WRONLY|O_CLOEXEC,
+                                      &tmpf, error))
+    return FALSE;
+
+  if (ioctl (tmpf.fd, FICLONE, src_fd) != 0)
+    {
+      /* The filesystem (or the source/dest pairing) doesn't support
+       * cloning; leave *out_was_supported at FALSE.  NOTE early return.
+       */
+      if (G_IN_SET (errno, EOPNOTSUPP, ENOSYS, ENOTTY, EXDEV, EINVAL, EBADF))
+        return TRUE;
+      return glnx_throw_errno_prefix (error, "ioctl(FICLONE)");
+    }
+
+  /* In the bare modes the loose inode's metadata is object state; replicate
+   * it onto the clone.  (For archive and metadata objects the permission
+   * bits are all that matter.)
+   */
+  if (self->mode == OSTREE_REPO_MODE_BARE)
+    {
+      if (TEMP_FAILURE_RETRY (fchown (tmpf.fd, stbuf.st_uid, stbuf.st_gid)) < 0)
+        {
+          /* Not privileged enough to replicate ownership; let the copy
+           * path produce its usual error instead.  NOTE early return.
+           */
+          if (errno == EPERM)
+            return TRUE;
+          return glnx_throw_errno_prefix (error, "fchown");
+        }
+    }
+  if (TEMP_FAILURE_RETRY (fchmod (tmpf.fd, stbuf.st_mode & 07777)) < 0)
+    return glnx_throw_errno_prefix (error, "fchmod");
+  if (_ostree_repo_mode_is_bare (self->mode))
+    {
+      g_autoptr(GVariant) xattrs = NULL;
+
+      if (!glnx_fd_get_all_xattrs (src_fd, &xattrs, cancellable, error))
+        return FALSE;
+      if (!glnx_fd_set_all_xattrs (tmpf.fd, xattrs, cancellable, error))
+        return FALSE;
+
+      const struct timespec times[2] = { { OSTREE_TIMESTAMP, UTIME_OMIT }, { OSTREE_TIMESTAMP, 0} };
+      if (TEMP_FAILURE_RETRY (futimens (tmpf.fd, times)) < 0)
+        return glnx_throw_errno_prefix (error, "futimens");
+    }
+
+  if (!self->in_transaction && !self->disable_fsync)
+    {
+      if (fsync (tmpf.fd) == -1)
+        return glnx_throw_errno_prefix (error, "fsync");
+    }
+
+  if (!_ostree_repo_commit_tmpf_final (self, checksum, objtype,
+                                       &tmpf, cancellable, error))
+    return FALSE;
+
+  if (objtype == OSTREE_OBJECT_TYPE_COMMIT)
+    {
+      if (!copy_detached_metadata (self, source, checksum, cancellable, error))
+        return FALSE;
+    }
+
+  *out_was_supported = TRUE;
+  return TRUE;
+}
+
+/**
+ * ostree_repo_import_object_from:
+ * @self: Destination repo
+ * @source: Source repo
+ * @objtype: Object type
+ * @checksum: checksum
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Copy object named by @objtype and @checksum into @self from the
+ * source repository @source.  If both repositories are of the same
+ * type and on the same filesystem, this will simply be a fast Unix
+ * hard link operation.
+ *
+ * Otherwise, a copy will be performed.
  */
 gboolean
 ostree_repo_import_object_from (OstreeRepo           *self,
@@ -3323,6 +4488,24 @@ ostree_repo_import_object_from_with_trust (OstreeRepo           *self,
   if (has_object)
     return TRUE;
 
+  /* Next best after a hardlink: clone the loose file.  This covers the
+   * common same-filesystem promotion case where the hardlink was refused
+   * (differing owner uid, or EMLINK/EPERM from the kernel) but the loose
+   * representation is still byte-identical.
+   */
+  if (trusted && source->mode == self->mode)
+    {
+      gboolean reflink_was_supported = FALSE;
+
+      if (!import_one_object_reflink (self, source, checksum, objtype,
+                                      &reflink_was_supported,
+                                      cancellable, error))
+        return FALSE;
+
+      if (reflink_was_supported)
+        return TRUE;
+    }
+
   if (OSTREE_OBJECT_TYPE_IS_META (objtype))
     {
       /* Metadata object */
@@ -3419,6 +4602,22 @@ ostree_repo_query_object_storage_size (OstreeRepo           *self,
   if (res < 0 && errno == ENOENT && self->commit_stagedir_fd != -1)
     res = TEMP_FAILURE_RETRY (fstatat (self->commit_stagedir_fd, loose_path, &stbuf, AT_SYMLINK_NOFOLLOW));
 
+  if (res < 0 && errno == ENOENT && objtype == OSTREE_OBJECT_TYPE_FILE
+      && self->mode == OSTREE_REPO_MODE_ARCHIVE_Z2)
+    {
+      gboolean found_in_pack = FALSE;
+      guint64 packed_size = 0;
+      if (!_ostree_repo_content_pack_lookup (self, sha256, &found_in_pack, &packed_size,
+                                             NULL, cancellable, error))
+        return FALSE;
+      if (found_in_pack)
+        {
+          *out_size = packed_size;
+          return TRUE;
+        }
+      errno = ENOENT;  /* The pack lookup may clobber it */
+    }
+
   if (res < 0)
     return glnx_throw_errno_prefix (error, "Querying object %s.%s", sha256, ostree_object_type_to_string (objtype));
 
@@ -3426,6 +4625,104 @@ ostree_repo_query_object_storage_size (OstreeRepo           *self,
   return TRUE;
 }
 
+/**
+ * ostree_repo_get_commit_sizes:
+ * @self: Repo
+ * @checksum: ASCII SHA256 checksum of a commit
+ * @out_total: (out) (allow-none): Total storage bytes of the commit's closure
+ * @out_unique: (out) (allow-none): Bytes of objects reachable from no other commit
+ * @out_shared: (out) (allow-none): Bytes of objects shared with at least one other commit
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Answer "how much disk does this commit occupy, and how much would
+ * deleting it free?" from the per-commit size closures cached under
+ * `state/size-closures/`, which are maintained as transactions commit
+ * and cleaned up by prune.  No objects are loaded; on repositories
+ * predating the cache, the first call builds the missing closures and
+ * later calls only read them.
+ *
+ * @out_unique counts objects reachable from no other non-partial
+ * commit in the repository: deleting every ref to this commit and
+ * pruning with `--depth=0` would free that many bytes.  Partial
+ * commits contribute nothing to the shared calculation, and querying
+ * one is an error.
+ */
+gboolean
+ostree_repo_get_commit_sizes (OstreeRepo    *self,
+                              const char    *checksum,
+                              guint64       *out_total,
+                              guint64       *out_unique,
+                              guint64       *out_shared,
+                              GCancellable  *cancellable,
+                              GError       **error)
+{
+  g_autoptr(GVariant) closure = NULL;
+  if (!_ostree_repo_size_closure_ensure (self, checksum, &closure, cancellable, error))
+    return FALSE;
+  if (closure == NULL)
+    return glnx_throw (error, "Commit %s is partial; cannot compute sizes", checksum);
+
+  /* Serialized object names reachable from any other commit */
+  g_autoptr(GHashTable) elsewhere = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  g_autoptr(GHashTable) commits = NULL;
+  if (!ostree_repo_list_commit_objects_starting_with (self, "", &commits,
+                                                      cancellable, error))
+    return FALSE;
+
+  GLNX_HASH_TABLE_FOREACH (commits, GVariant*, commit_key)
+    {
+      const char *other_checksum;
+      OstreeObjectType objtype;
+
+      ostree_object_name_deserialize (commit_key, &other_checksum, &objtype);
+      if (strcmp (other_checksum, checksum) == 0)
+        continue;
+
+      g_autoptr(GVariant) other_closure = NULL;
+      if (!_ostree_repo_size_closure_ensure (self, other_checksum, &other_closure,
+                                             cancellable, error))
+        return FALSE;
+      if (other_closure == NULL)
+        continue;  /* Partial commit */
+
+      const gsize n = g_variant_n_children (other_closure);
+      for (gsize i = 0; i < n; i++)
+        {
+          const char *obj_checksum;
+          guint32 objtype_u;
+          guint64 size;
+
+          g_variant_get_child (other_closure, i, "(&sut)", &obj_checksum, &objtype_u, &size);
+          g_hash_table_add (elsewhere, g_strdup_printf ("%s.%u", obj_checksum, objtype_u));
+        }
+    }
+
+  guint64 total = 0;
+  guint64 unique = 0;
+  const gsize n = g_variant_n_children (closure);
+  for (gsize i = 0; i < n; i++)
+    {
+      const char *obj_checksum;
+      guint32 objtype_u;
+      guint64 size;
+
+      g_variant_get_child (closure, i, "(&sut)", &obj_checksum, &objtype_u, &size);
+      total += size;
+      g_autofree char *key = g_strdup_printf ("%s.%u", obj_checksum, objtype_u);
+      if (!g_hash_table_contains (elsewhere, key))
+        unique += size;
+    }
+
+  if (out_total)
+    *out_total = total;
+  if (out_unique)
+    *out_unique = unique;
+  if (out_shared)
+    *out_shared = total - unique;
+  return TRUE;
+}
+
 /**
  * ostree_repo_load_variant_if_exists:
  * @self: Repo
@@ -3554,11 +4851,13 @@ ostree_repo_list_objects (OstreeRepo                  *self,
 
   if (flags & OSTREE_REPO_LIST_OBJECTS_LOOSE)
     {
-      if (!list_loose_objects (self, ret_objects, NULL, cancellable, error))
+      if (!list_loose_objects (self, insert_loose_object_to_hash_cb, ret_objects,
+                               NULL, cancellable, error))
         return FALSE;
       if ((flags & OSTREE_REPO_LIST_OBJECTS_NO_PARENTS) == 0 && self->parent_repo)
         {
-          if (!list_loose_objects (self->parent_repo, ret_objects, NULL, cancellable, error))
+          if (!list_loose_objects (self->parent_repo, insert_loose_object_to_hash_cb,
+                                   ret_objects, NULL, cancellable, error))
             return FALSE;
         }
     }
@@ -3572,6 +4871,85 @@ ostree_repo_list_objects (OstreeRepo                  *self,
   return TRUE;
 }
 
+typedef struct {
+  OstreeRepoListObjectsForeachFunc callback;
+  gpointer user_data;
+} ForeachObjectsData;
+
+static gboolean
+foreach_objects_visitor (OstreeRepo       *repo,
+                         const char       *checksum,
+                         OstreeObjectType  objtype,
+                         gpointer          user_data,
+                         GError          **error)
+{
+  ForeachObjectsData *data = user_data;
+  guchar csum[OSTREE_SHA256_DIGEST_LEN];
+
+  ostree_checksum_inplace_to_bytes (checksum, csum);
+  return data->callback (repo, csum, objtype, data->user_data, error);
+}
+
+/**
+ * ostree_repo_list_objects_foreach:
+ * @self: Repo
+ * @flags: Flags controlling enumeration
+ * @callback: (scope call): Invoked for each object
+ * @user_data: Data for @callback
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Streaming variant of ostree_repo_list_objects(): invoke @callback
+ * for every object in the repository without materializing the full
+ * object set in memory first.  Objects are visited grouped by loose
+ * fanout directory, so consumers that stat, open or unlink each object
+ * get good locality for free.  The repository passed to @callback is
+ * the one actually holding the object, which differs from @self when
+ * parent repositories are enumerated.
+ *
+ * No object may be inserted into or deleted from @self by other means
+ * while the enumeration runs; deleting the currently visited object
+ * from @callback is allowed.
+ *
+ * Returns: %TRUE on success, %FALSE if @callback or enumeration failed
+ */
+gboolean
+ostree_repo_list_objects_foreach (OstreeRepo                       *self,
+                                  OstreeRepoListObjectsFlags        flags,
+                                  OstreeRepoListObjectsForeachFunc  callback,
+                                  gpointer                          user_data,
+                                  GCancellable                     *cancellable,
+                                  GError                          **error)
+{
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+  g_return_val_if_fail (self->inited, FALSE);
+
+  ForeachObjectsData data = { callback, user_data };
+
+  if (flags & OSTREE_REPO_LIST_OBJECTS_ALL)
+    flags |= (OSTREE_REPO_LIST_OBJECTS_LOOSE | OSTREE_REPO_LIST_OBJECTS_PACKED);
+
+  if (flags & OSTREE_REPO_LIST_OBJECTS_LOOSE)
+    {
+      if (!list_loose_objects (self, foreach_objects_visitor, &data,
+                               NULL, cancellable, error))
+        return FALSE;
+      if ((flags & OSTREE_REPO_LIST_OBJECTS_NO_PARENTS) == 0 && self->parent_repo)
+        {
+          if (!list_loose_objects (self->parent_repo, foreach_objects_visitor,
+                                   &data, NULL, cancellable, error))
+            return FALSE;
+        }
+    }
+
+  if (flags & OSTREE_REPO_LIST_OBJECTS_PACKED)
+    {
+      /* Nothing for now... */
+    }
+
+  return TRUE;
+}
+
 /**
  * ostree_repo_list_commit_objects_starting_with:
  * @self: Repo
@@ -3601,13 +4979,14 @@ ostree_repo_list_commit_objects_starting_with (OstreeRepo                  *self
                            (GDestroyNotify) g_variant_unref,
                            (GDestroyNotify) g_variant_unref);
 
-  if (!list_loose_objects (self, ret_commits, start, cancellable, error))
+  if (!list_loose_objects (self, insert_loose_object_to_hash_cb, ret_commits,
+                           start, cancellable, error))
     return FALSE;
 
   if (self->parent_repo)
     {
-      if (!list_loose_objects (self->parent_repo, ret_commits, start,
-                               cancellable, error))
+      if (!list_loose_objects (self->parent_repo, insert_loose_object_to_hash_cb,
+                               ret_commits, start, cancellable, error))
         return FALSE;
     }
 
@@ -3835,12 +5214,20 @@ ostree_repo_pull_default_console_progress_changed (OstreeAsyncProgress *progress
 
       formatted_bytes_transferred = g_format_size_full (bytes_transferred, 0);
 
+      /* Prefer the smoothed rate computed by the progress producer; it
+       * may be absent or still zero early on, in which case fall back
+       * to a whole-transfer average.
+       */
+      bytes_sec = ostree_async_progress_get_uint64 (progress, "bytes-sec");
+      if (bytes_sec > 0)
+        {
+          formatted_bytes_sec = g_format_size (bytes_sec);
+        }
       /* Ignore the first second, or when we haven't transferred any
        * data, since those could cause divide by zero below.
        */
-      if ((current_time - start_time) < G_USEC_PER_SEC || bytes_transferred == 0)
+      else if ((current_time - start_time) < G_USEC_PER_SEC || bytes_transferred == 0)
         {
-          bytes_sec = 0;
           formatted_bytes_sec = g_strdup ("-");
         }
       else
@@ -3865,8 +5252,10 @@ ostree_repo_pull_default_console_progress_changed (OstreeAsyncProgress *progress
 
           if (bytes_sec > 0)
             {
-              /* MAX(0, value) here just to be defensive */
-              guint64 est_time_remaining = MAX(0, (total_delta_part_size - fetched_delta_part_size)) / bytes_sec;
+              guint64 est_time_remaining = ostree_async_progress_get_uint64 (progress, "estimated-sec-remaining");
+              if (est_time_remaining == 0)
+                /* MAX(0, value) here just to be defensive */
+                est_time_remaining = MAX(0, (total_delta_part_size - fetched_delta_part_size)) / bytes_sec;
               g_autofree char *formatted_est_time_remaining = _formatted_time_remaining_from_seconds (est_time_remaining);
               /* No space between %s and remaining, since formatted_est_time_remaining has a trailing space */
               g_string_append_printf (buf, "Receiving delta parts: %u/%u %s/%s %s/s %sremaining",
@@ -4157,6 +5546,51 @@ ostree_repo_sign_delta (OstreeRepo     *self,
  *
  * Add a GPG signature to a summary file.
  */
+/* Build the combined _OSTREE_SUMMARY_SIGNED_PATH artifact from the raw
+ * bytes of the summary and its signature file.
+ */
+GVariant *
+_ostree_repo_summary_signed_new (GBytes *summary,
+                                 GBytes *signatures)
+{
+  GVariantBuilder builder;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+  g_variant_builder_add (&builder, "{sv}", _OSTREE_SUMMARY_SIGNED_KEY_SUMMARY,
+                         ot_gvariant_new_ay_bytes (summary));
+  g_variant_builder_add (&builder, "{sv}", _OSTREE_SUMMARY_SIGNED_KEY_SIG,
+                         ot_gvariant_new_ay_bytes (signatures));
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+/* Inverse of _ostree_repo_summary_signed_new(); validates untrusted
+ * data fetched from a remote.
+ */
+gboolean
+_ostree_repo_summary_signed_split (GBytes   *signed_data,
+                                   GBytes  **out_summary,
+                                   GBytes  **out_signatures,
+                                   GError  **error)
+{
+  g_autoptr(GVariant) combined =
+    g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE ("a{sv}"),
+                                                  signed_data, FALSE));
+
+  if (!g_variant_is_normal_form (combined))
+    return glnx_throw (error, "Invalid %s: not normal form", _OSTREE_SUMMARY_SIGNED_PATH);
+
+  g_autoptr(GVariant) summary_v =
+    g_variant_lookup_value (combined, _OSTREE_SUMMARY_SIGNED_KEY_SUMMARY, G_VARIANT_TYPE ("ay"));
+  g_autoptr(GVariant) sig_v =
+    g_variant_lookup_value (combined, _OSTREE_SUMMARY_SIGNED_KEY_SIG, G_VARIANT_TYPE ("ay"));
+  if (summary_v == NULL || sig_v == NULL)
+    return glnx_throw (error, "Invalid %s: missing summary or signature", _OSTREE_SUMMARY_SIGNED_PATH);
+
+  *out_summary = g_variant_get_data_as_bytes (summary_v);
+  *out_signatures = g_variant_get_data_as_bytes (sig_v);
+  return TRUE;
+}
+
 gboolean
 ostree_repo_add_gpg_signature_summary (OstreeRepo     *self,
                                        const gchar    **key_id,
@@ -4196,6 +5630,21 @@ ostree_repo_add_gpg_signature_summary (OstreeRepo     *self,
                                            cancellable, error))
     return FALSE;
 
+  /* Also publish the combined artifact, so clients can poll the signed
+   * summary with a single conditional GET.
+   */
+  { g_autoptr(GBytes) sig_bytes = g_variant_get_data_as_bytes (normalized);
+    g_autoptr(GVariant) combined = _ostree_repo_summary_signed_new (summary_data, sig_bytes);
+
+    if (!_ostree_repo_file_replace_contents (self,
+                                             self->repo_dir_fd,
+                                             _OSTREE_SUMMARY_SIGNED_PATH,
+                                             g_variant_get_data (combined),
+                                             g_variant_get_size (combined),
+                                             cancellable, error))
+      return FALSE;
+  }
+
   return TRUE;
 }
 
@@ -4229,19 +5678,38 @@ find_keyring (OstreeRepo          *self,
   return NULL;
 }
 
-static OstreeGpgVerifyResult *
-_ostree_repo_gpg_verify_data_internal (OstreeRepo    *self,
-                                       const gchar   *remote_name,
-                                       GBytes        *data,
-                                       GBytes        *signatures,
-                                       GFile         *keyringdir,
-                                       GFile         *extra_keyring,
-                                       GCancellable  *cancellable,
-                                       GError       **error)
+/* Build the #OstreeGpgVerifier configured for @remote_name (possibly
+ * OSTREE_ALL_REMOTES), plus any ad-hoc @keyringdir and @extra_keyring. */
+static OstreeGpgVerifier *
+get_gpg_verifier (OstreeRepo    *self,
+                  const gchar   *remote_name,
+                  GFile         *keyringdir,
+                  GFile         *extra_keyring,
+                  GCancellable  *cancellable,
+                  GError       **error)
 {
   g_autoptr(OstreeGpgVerifier) verifier = NULL;
   gboolean add_global_keyring_dir = TRUE;
 
+  /* The common pull path verifies many signatures against the same
+   * remote; cache the verifier (whose keyring home dir is assembled
+   * once, lazily) keyed by remote name.  Requests with ad-hoc keyrings
+   * aren't cachable.
+   */
+  const gboolean verifier_cachable =
+    (remote_name != NULL && remote_name != OSTREE_ALL_REMOTES &&
+     keyringdir == NULL && extra_keyring == NULL);
+  if (verifier_cachable)
+    {
+      g_mutex_lock (&self->remotes_lock);
+      if (self->remote_verifiers != NULL)
+        verifier = ot_gobject_refz (g_hash_table_lookup (self->remote_verifiers, remote_name));
+      g_mutex_unlock (&self->remotes_lock);
+
+      if (verifier != NULL)
+        return g_steal_pointer (&verifier);
+    }
+
   verifier = _ostree_gpg_verifier_new ();
 
   if (remote_name == OSTREE_ALL_REMOTES)
@@ -4300,6 +5768,36 @@ _ostree_repo_gpg_verify_data_internal (OstreeRepo    *self,
       _ostree_gpg_verifier_add_keyring (verifier, extra_keyring);
     }
 
+  if (verifier_cachable)
+    {
+      g_mutex_lock (&self->remotes_lock);
+      if (self->remote_verifiers == NULL)
+        self->remote_verifiers = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                        g_free, g_object_unref);
+      g_hash_table_replace (self->remote_verifiers, g_strdup (remote_name),
+                            g_object_ref (verifier));
+      g_mutex_unlock (&self->remotes_lock);
+    }
+
+  return g_steal_pointer (&verifier);
+}
+
+static OstreeGpgVerifyResult *
+_ostree_repo_gpg_verify_data_internal (OstreeRepo    *self,
+                                       const gchar   *remote_name,
+                                       GBytes        *data,
+                                       GBytes        *signatures,
+                                       GFile         *keyringdir,
+                                       GFile         *extra_keyring,
+                                       GCancellable  *cancellable,
+                                       GError       **error)
+{
+  g_autoptr(OstreeGpgVerifier) verifier =
+    get_gpg_verifier (self, remote_name, keyringdir, extra_keyring,
+                      cancellable, error);
+  if (verifier == NULL)
+    return NULL;
+
   return _ostree_gpg_verifier_check_signature (verifier,
                                                data,
                                                signatures,
@@ -4419,6 +5917,82 @@ out:
   return result;
 }
 
+/* Persistent cache of successful commit signature verifications.  Each
+ * entry is an empty file under cachedir named by a digest over the
+ * commit checksum, the detached metadata carrying the signatures, and
+ * the state of every keyring the verifier would consult; agents that
+ * re-verify unchanged commits periodically then skip the GPGME round
+ * trips entirely.  Any change to the commitmeta or to a keyring file
+ * changes the digest, naturally invalidating the old entry. */
+
+static char *
+verify_commit_cache_key (OstreeRepo    *self,
+                         const gchar   *commit_checksum,
+                         GFile         *keyringdir,
+                         GFile         *extra_keyring,
+                         GCancellable  *cancellable)
+{
+  g_autoptr(GVariant) metadata = NULL;
+  g_autoptr(OstreeGpgVerifier) verifier = NULL;
+  GChecksum *checksum;
+  char *ret;
+
+  if (self->cache_dir_fd == -1)
+    return NULL;
+
+  /* Without detached metadata there's nothing to verify; let the
+   * uncached path produce its usual error. */
+  if (!ostree_repo_read_commit_detached_metadata (self, commit_checksum,
+                                                  &metadata, cancellable, NULL))
+    return NULL;
+  if (metadata == NULL)
+    return NULL;
+
+  verifier = get_gpg_verifier (self, OSTREE_ALL_REMOTES, keyringdir,
+                               extra_keyring, cancellable, NULL);
+  if (verifier == NULL)
+    return NULL;
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  g_checksum_update (checksum, (const guchar *)commit_checksum,
+                     strlen (commit_checksum) + 1);
+  g_checksum_update (checksum, g_variant_get_data (metadata),
+                     g_variant_get_size (metadata));
+  _ostree_gpg_verifier_add_state_to_checksum (verifier, checksum);
+
+  ret = g_strdup (g_checksum_get_string (checksum));
+  g_checksum_free (checksum);
+  return ret;
+}
+
+static gboolean
+verify_commit_cache_lookup (OstreeRepo *self,
+                            const char *cache_key)
+{
+  const char *path = glnx_strjoina (_OSTREE_COMMIT_VERIFY_CACHE_DIR, "/", cache_key);
+  struct stat stbuf;
+
+  return fstatat (self->cache_dir_fd, path, &stbuf, 0) == 0;
+}
+
+static void
+verify_commit_cache_mark (OstreeRepo    *self,
+                          const char    *cache_key,
+                          GCancellable  *cancellable)
+{
+  const char *path = glnx_strjoina (_OSTREE_COMMIT_VERIFY_CACHE_DIR, "/", cache_key);
+
+  /* Best-effort; a failure here just means re-verifying next time. */
+  if (!glnx_shutil_mkdir_p_at (self->cache_dir_fd, _OSTREE_COMMIT_VERIFY_CACHE_DIR,
+                               0775, cancellable, NULL))
+    return;
+
+  (void) glnx_file_replace_contents_at (self->cache_dir_fd, path,
+                                        (guint8*)"", 0,
+                                        GLNX_FILE_REPLACE_NODATASYNC,
+                                        cancellable, NULL);
+}
+
 /**
  * ostree_repo_verify_commit:
  * @self: Repository
@@ -4431,6 +6005,11 @@ out:
  * Check for a valid GPG signature on commit named by the ASCII
  * checksum @commit_checksum.
  *
+ * Successful verifications are recorded in the repository cache
+ * directory, keyed by the commit, its detached metadata and the state
+ * of the keyrings consulted; re-verifying an unchanged commit is then
+ * a single file lookup rather than a GPGME round trip.
+ *
  * Returns: %TRUE if there was a GPG signature from a trusted keyring, otherwise %FALSE
  */
 gboolean
@@ -4442,6 +6021,13 @@ ostree_repo_verify_commit (OstreeRepo   *self,
                            GError      **error)
 {
   g_autoptr(OstreeGpgVerifyResult) result = NULL;
+  g_autofree char *cache_key = NULL;
+
+  cache_key = verify_commit_cache_key (self, commit_checksum,
+                                       keyringdir, extra_keyring,
+                                       cancellable);
+  if (cache_key != NULL && verify_commit_cache_lookup (self, cache_key))
+    return TRUE;
 
   result = ostree_repo_verify_commit_ext (self, commit_checksum,
                                           keyringdir, extra_keyring,
@@ -4452,6 +6038,10 @@ ostree_repo_verify_commit (OstreeRepo   *self,
       g_prefix_error (error, "Commit %s: ", commit_checksum);
       return FALSE;
     }
+
+  if (cache_key != NULL)
+    verify_commit_cache_mark (self, cache_key, cancellable);
+
   return TRUE;
 }
 
@@ -4600,51 +6190,1425 @@ ostree_repo_verify_summary (OstreeRepo    *self,
                                                 error);
 }
 
-/* Add an entry for a @ref ↦ @checksum mapping to an `a(s(t@ay@a{sv}))`
- * @refs_builder to go into a `summary` file. This includes building the
- * standard additional metadata keys for the ref. */
-static gboolean
-summary_add_ref_entry (OstreeRepo       *self,
-                       const char       *ref,
-                       const char       *checksum,
+/* Best-effort load of the previously generated summary file, along
+ * with its stat buffer; used to reuse entries for refs and deltas
+ * which haven't changed.  Any failure just means everything is
+ * regenerated from scratch.
+ */
+static GVariant *
+summary_load_previous (OstreeRepo   *self,
+                       struct stat  *out_stbuf)
+{
+  GVariant *summary = NULL;
+
+  if (!ot_util_variant_map_at (self->repo_dir_fd, "summary",
+                               OSTREE_SUMMARY_GVARIANT_FORMAT,
+                               OT_VARIANT_MAP_ALLOW_NOENT, &summary, NULL))
+    return NULL;
+  if (summary == NULL)
+    return NULL;
+
+  if (fstatat (self->repo_dir_fd, "summary", out_stbuf, 0) < 0)
+    {
+      g_variant_unref (summary);
+      return NULL;
+    }
+
+  return summary;
+}
+
+/* Collect an `a(s(taya{sv}))` refs array from a previous summary into
+ * @table, mapping ref name → `(taya{sv})` entry. */
+static void
+summary_collect_ref_entries (GVariant   *refs_v,
+                             GHashTable *table)
+{
+  gsize n = g_variant_n_children (refs_v);
+  for (gsize i = 0; i < n; i++)
+    {
+      const char *ref;
+      g_autoptr(GVariant) entry = NULL;
+
+      g_variant_get_child (refs_v, i, "(&s@(taya{sv}))", &ref, &entry);
+      g_hash_table_replace (table, g_strdup (ref), g_steal_pointer (&entry));
+    }
+}
+
+/* Streaming serializer for the summary file.  The summary variant
+ * (%OSTREE_SUMMARY_GVARIANT_FORMAT, `(a(s(taya{sv}))a{sv})`) leads with
+ * the refs array, whose serialized form is just the elements' own
+ * serialized forms concatenated at 8-byte alignment followed by a table
+ * of little-endian end offsets; the outer tuple appends the metadata
+ * member and a single framing offset.  So instead of accumulating tens
+ * of thousands of ref entries in a GVariantBuilder tree and serializing
+ * them all at the end, we can write each entry's bytes straight to the
+ * summary tmpfile as ref listing proceeds, keeping only the offset list
+ * in memory, and emit the framing once the (comparatively small)
+ * metadata member is known.  This bounds regeneration memory to one
+ * entry at a time and overlaps serialization I/O with ref enumeration
+ * and commit object loading.  Not used when summary sharding is
+ * enabled, since repartitioning needs the whole refs array in memory
+ * anyway.
+ */
+typedef struct {
+  GLnxTmpfile tmpf;
+  gsize pos;        /* Serialized bytes written so far */
+  GArray *ref_ends; /* (element-type gsize): end offset of each refs array element */
+} SummaryStream;
+
+static void
+summary_stream_clear (SummaryStream *stream)
+{
+  glnx_tmpfile_clear (&stream->tmpf);
+  g_clear_pointer (&stream->ref_ends, g_array_unref);
+}
+G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC (SummaryStream, summary_stream_clear)
+
+static gboolean
+summary_stream_init (OstreeRepo     *self,
+                     SummaryStream  *stream,
+                     GError        **error)
+{
+  stream->pos = 0;
+  stream->ref_ends = g_array_new (FALSE, FALSE, sizeof (gsize));
+  return glnx_open_tmpfile_linkable_at (self->repo_dir_fd, ".", O_WRONLY | O_CLOEXEC,
+                                        &stream->tmpf, error);
+}
+
+static gboolean
+summary_stream_write (SummaryStream  *stream,
+                      gconstpointer   buf,
+                      gsize           len,
+                      GError        **error)
+{
+  if (glnx_loop_write (stream->tmpf.fd, buf, len) < 0)
+    return glnx_throw_errno_prefix (error, "write");
+  stream->pos += len;
+  return TRUE;
+}
+
+static gboolean
+summary_stream_pad (SummaryStream  *stream,
+                    gsize           alignment,
+                    GError        **error)
+{
+  static const guint8 zeros[8] = { 0, };
+  gsize rem = stream->pos & (alignment - 1);
+  if (rem == 0)
+    return TRUE;
+  return summary_stream_write (stream, zeros, alignment - rem, error);
+}
+
+/* The smallest GVariant framing offset size for a container of
+ * @body_size bytes carrying @n offsets; mirrors GLib's
+ * gvariant-serialiser.c so the output matches what GVariantBuilder
+ * would have produced. */
+static gsize
+summary_stream_offset_size (gsize body_size,
+                            gsize n)
+{
+  if (body_size + 1 * n <= G_MAXUINT8)
+    return 1;
+  if (body_size + 2 * n <= G_MAXUINT16)
+    return 2;
+  if (body_size + 4 * n <= G_MAXUINT32)
+    return 4;
+  return 8;
+}
+
+/* Framing offsets are little-endian regardless of the data's byte order */
+static gboolean
+summary_stream_write_offset (SummaryStream  *stream,
+                             guint64         value,
+                             gsize           offset_size,
+                             GError        **error)
+{
+  guint8 buf[8];
+  for (gsize i = 0; i < offset_size; i++)
+    buf[i] = (guint8)(value >> (8 * i));
+  return summary_stream_write (stream, buf, offset_size, error);
+}
+
+static gboolean
+summary_stream_add_ref_entry (SummaryStream  *stream,
+                              GVariant       *entry,
+                              GError        **error)
+{
+  /* `(s(taya{sv}))` contains a guint64, so elements align to 8 */
+  if (!summary_stream_pad (stream, 8, error))
+    return FALSE;
+  if (!summary_stream_write (stream, g_variant_get_data (entry),
+                             g_variant_get_size (entry), error))
+    return FALSE;
+  gsize end = stream->pos;
+  g_array_append_val (stream->ref_ends, end);
+  return TRUE;
+}
+
+/* Close the refs array and outer tuple framing, appending the @metadata
+ * member, then atomically replace the `summary` file; matches the fsync
+ * semantics of _ostree_repo_file_replace_contents(). */
+static gboolean
+summary_stream_finish (OstreeRepo     *self,
+                       SummaryStream  *stream,
+                       GVariant       *metadata,
+                       GCancellable   *cancellable,
+                       GError        **error)
+{
+  const gsize n_refs = stream->ref_ends->len;
+  gsize offset_size = summary_stream_offset_size (stream->pos, n_refs);
+  for (gsize i = 0; i < n_refs; i++)
+    if (!summary_stream_write_offset (stream, g_array_index (stream->ref_ends, gsize, i),
+                                      offset_size, error))
+      return FALSE;
+  const gsize refs_end = stream->pos;
+
+  /* The outer tuple: the metadata member (an a{sv}, 8-aligned), then
+   * one framing offset for the end of the refs member; the last member
+   * needs none. */
+  if (!summary_stream_pad (stream, 8, error))
+    return FALSE;
+  if (!summary_stream_write (stream, g_variant_get_data (metadata),
+                             g_variant_get_size (metadata), error))
+    return FALSE;
+  offset_size = summary_stream_offset_size (stream->pos, 1);
+  if (!summary_stream_write_offset (stream, refs_end, offset_size, error))
+    return FALSE;
+
+  if (!self->disable_fsync && fdatasync (stream->tmpf.fd) < 0)
+    return glnx_throw_errno_prefix (error, "fdatasync");
+
+  return glnx_link_tmpfile_at (&stream->tmpf, GLNX_LINK_TMPFILE_REPLACE,
+                               self->repo_dir_fd, "summary", error);
+}
+
+/* Add an entry for a @ref ↦ @checksum mapping to an `a(s(t@ay@a{sv}))`
+ * refs array to go into a `summary` file, either accumulated in
+ * @refs_builder or streamed to @stream (exactly one is non-%NULL).
+ * This includes building the standard additional metadata keys for the
+ * ref.  @previous, if non-%NULL, is this ref's `(taya{sv})` entry from
+ * the previous summary; if it describes the same commit it's reused
+ * verbatim, avoiding re-reading the commit object. */
+static gboolean
+summary_add_ref_entry (OstreeRepo       *self,
+                       const char       *ref,
+                       const char       *checksum,
+                       GVariant         *previous,
                        GVariantBuilder  *refs_builder,
+                       SummaryStream    *stream,
                        GError          **error)
 {
   g_auto(GVariantDict) commit_metadata_builder = OT_VARIANT_BUILDER_INITIALIZER;
 
-  g_assert (ref);  g_assert (checksum);
+  g_assert (ref);  g_assert (checksum);
+
+  g_autofree char *remotename = NULL;
+  if (!ostree_parse_refspec (ref, &remotename, NULL, NULL))
+    g_assert_not_reached ();
+
+  /* Don't put remote refs in the summary */
+  if (remotename != NULL)
+    return TRUE;
+
+  g_autoptr(GVariant) entry = NULL;
+
+  if (previous != NULL)
+    {
+      g_autoptr(GVariant) prev_csum_v = g_variant_get_child_value (previous, 1);
+      const guchar *prev_csum = ostree_checksum_bytes_peek (prev_csum_v);
+      guint8 csum_bytes[OSTREE_SHA256_DIGEST_LEN];
+
+      ostree_checksum_inplace_to_bytes (checksum, csum_bytes);
+      if (prev_csum != NULL && memcmp (prev_csum, csum_bytes, sizeof (csum_bytes)) == 0)
+        entry = g_variant_ref_sink (g_variant_new ("(s@(taya{sv}))", ref, previous));
+    }
+
+  if (entry == NULL)
+    {
+      g_autoptr(GVariant) commit_obj = NULL;
+      if (!ostree_repo_load_variant (self, OSTREE_OBJECT_TYPE_COMMIT, checksum, &commit_obj, error))
+        return FALSE;
+
+      g_variant_dict_init (&commit_metadata_builder, NULL);
+
+      /* Forward the commit’s timestamp if it’s valid. */
+      guint64 commit_timestamp = ostree_commit_get_timestamp (commit_obj);
+      g_autoptr(GDateTime) dt = g_date_time_new_from_unix_utc (commit_timestamp);
+
+      if (dt != NULL)
+        g_variant_dict_insert_value (&commit_metadata_builder, OSTREE_COMMIT_TIMESTAMP,
+                                     g_variant_new_uint64 (GUINT64_TO_BE (commit_timestamp)));
+
+      entry = g_variant_ref_sink (g_variant_new ("(s(t@ay@a{sv}))", ref,
+                                                 (guint64) g_variant_get_size (commit_obj),
+                                                 ostree_checksum_to_bytes_v (checksum),
+                                                 g_variant_dict_end (&commit_metadata_builder)));
+    }
+
+  if (refs_builder != NULL)
+    g_variant_builder_add_value (refs_builder, entry);
+  else if (!summary_stream_add_ref_entry (stream, entry, error))
+    return FALSE;
+
+  return TRUE;
+}
+
+/* The commit graph (_OSTREE_COMMIT_GRAPH_PATH) is a checksum-sorted
+ * `a(ssts)` array of (checksum, parent, timestamp, subject) entries over
+ * all local commit objects, regenerated together with the summary and
+ * incrementally merged when a transaction lands new commits (see
+ * _ostree_repo_commit_graph_merge()).  A commit's parent and timestamp
+ * are immutable, so entries never go stale; commits the graph doesn't
+ * cover are simply absent and callers fall back to loading the commit
+ * object.  Since the graph can outlive a pruned commit, callers
+ * answering existence questions must still check the object itself.
+ */
+#define OSTREE_COMMIT_GRAPH_GVARIANT_STRING "a(ssts)"
+
+static int
+compare_checksums_p (gconstpointer a,
+                     gconstpointer b)
+{
+  return strcmp (*(const char * const *)a, *(const char * const *)b);
+}
+
+gboolean
+_ostree_repo_regenerate_commit_graph (OstreeRepo    *self,
+                                      GCancellable  *cancellable,
+                                      GError       **error)
+{
+  g_autoptr(GHashTable) commits = NULL;
+  if (!ostree_repo_list_commit_objects_starting_with (self, "", &commits,
+                                                      cancellable, error))
+    return FALSE;
+
+  g_autoptr(GPtrArray) checksums = g_ptr_array_new_with_free_func (g_free);
+  GLNX_HASH_TABLE_FOREACH (commits, GVariant*, key)
+    {
+      const char *checksum;
+      OstreeObjectType objtype;
+      ostree_object_name_deserialize (key, &checksum, &objtype);
+      g_ptr_array_add (checksums, g_strdup (checksum));
+    }
+  g_ptr_array_sort (checksums, compare_checksums_p);
+
+  GVariantBuilder entries_builder;
+  g_variant_builder_init (&entries_builder,
+                          G_VARIANT_TYPE (OSTREE_COMMIT_GRAPH_GVARIANT_STRING));
+  for (guint i = 0; i < checksums->len; i++)
+    {
+      const char *checksum = checksums->pdata[i];
+      g_autoptr(GVariant) commit = NULL;
+      if (!ostree_repo_load_variant_if_exists (self, OSTREE_OBJECT_TYPE_COMMIT,
+                                               checksum, &commit, error))
+        return FALSE;
+      if (commit == NULL)
+        continue;  /* Raced with a prune */
+
+      g_autofree char *parent = ostree_commit_get_parent (commit);
+      const char *subject;
+      g_variant_get_child (commit, 3, "&s", &subject);
+
+      g_variant_builder_add (&entries_builder, "(ssts)",
+                             checksum, parent ?: "",
+                             ostree_commit_get_timestamp (commit), subject);
+    }
+
+  g_autoptr(GVariant) graph =
+    g_variant_ref_sink (g_variant_builder_end (&entries_builder));
+
+  if (!glnx_shutil_mkdir_p_at (self->repo_dir_fd, "state", 0755,
+                               cancellable, error))
+    return FALSE;
+  if (!_ostree_repo_file_replace_contents (self, self->repo_dir_fd,
+                                           _OSTREE_COMMIT_GRAPH_PATH,
+                                           g_variant_get_data (graph),
+                                           g_variant_get_size (graph),
+                                           cancellable, error))
+    return FALSE;
+
+  /* Remap on the next lookup */
+  g_clear_pointer (&self->commit_graph, g_variant_unref);
+  self->commit_graph_checked = FALSE;
+  return TRUE;
+}
+
+static gboolean
+commit_graph_ensure (OstreeRepo  *self,
+                     GError     **error)
+{
+  if (self->commit_graph_checked)
+    return TRUE;
+
+  glnx_fd_close int fd = openat (self->repo_dir_fd, _OSTREE_COMMIT_GRAPH_PATH,
+                                 O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    {
+      if (errno != ENOENT)
+        return glnx_throw_errno_prefix (error, "openat(%s)", _OSTREE_COMMIT_GRAPH_PATH);
+    }
+  else
+    {
+      if (!ot_util_variant_map_fd (fd, 0, G_VARIANT_TYPE (OSTREE_COMMIT_GRAPH_GVARIANT_STRING),
+                                   FALSE, &self->commit_graph, error))
+        return glnx_prefix_error (error, "Mapping %s", _OSTREE_COMMIT_GRAPH_PATH);
+    }
+
+  self->commit_graph_checked = TRUE;
+  return TRUE;
+}
+
+/* Look up @checksum in the commit graph.  On a hit, @out_found is set and
+ * the requested fields are returned; @out_parent is %NULL for a root
+ * commit.  A miss just means the graph doesn't cover the commit (or was
+ * never generated) and the caller should load the commit object instead.
+ */
+gboolean
+_ostree_repo_commit_graph_lookup (OstreeRepo   *self,
+                                  const char   *checksum,
+                                  gboolean     *out_found,
+                                  char        **out_parent,
+                                  guint64      *out_timestamp,
+                                  char        **out_subject,
+                                  GError      **error)
+{
+  *out_found = FALSE;
+
+  if (!commit_graph_ensure (self, error))
+    return FALSE;
+  if (self->commit_graph == NULL)
+    return TRUE;
+
+  int pos;
+  if (ot_variant_bsearch_str (self->commit_graph, checksum, &pos))
+    {
+      const char *parent;
+      const char *subject;
+      guint64 timestamp;
+      g_autoptr(GVariant) child = g_variant_get_child_value (self->commit_graph, pos);
+      g_variant_get (child, "(&s&st&s)", NULL, &parent, &timestamp, &subject);
+
+      *out_found = TRUE;
+      if (out_parent)
+        *out_parent = (*parent ? g_strdup (parent) : NULL);
+      if (out_timestamp)
+        *out_timestamp = timestamp;
+      if (out_subject)
+        *out_subject = g_strdup (subject);
+    }
+  return TRUE;
+}
+
+static int
+compare_graph_entries_p (gconstpointer a,
+                         gconstpointer b)
+{
+  const char *ca, *cb;
+  g_variant_get_child (*(GVariant * const *)a, 0, "&s", &ca);
+  g_variant_get_child (*(GVariant * const *)b, 0, "&s", &cb);
+  return strcmp (ca, cb);
+}
+
+/* Incrementally fold @commit_checksums (a set of hex checksums whose
+ * commit objects are already in the object store) into the commit
+ * graph.  Unlike full regeneration this only loads the new commits, so
+ * it's cheap enough to run on every transaction commit; the graph thus
+ * stays current on repos that never regenerate a summary.
+ */
+gboolean
+_ostree_repo_commit_graph_merge (OstreeRepo    *self,
+                                 GHashTable    *commit_checksums,
+                                 GCancellable  *cancellable,
+                                 GError       **error)
+{
+  if (!commit_graph_ensure (self, error))
+    return FALSE;
+
+  g_autoptr(GPtrArray) new_entries =
+    g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
+  GLNX_HASH_TABLE_FOREACH (commit_checksums, const char*, checksum)
+    {
+      int pos;
+      if (self->commit_graph != NULL
+          && ot_variant_bsearch_str (self->commit_graph, checksum, &pos))
+        continue;
+
+      g_autoptr(GVariant) commit = NULL;
+      if (!ostree_repo_load_variant_if_exists (self, OSTREE_OBJECT_TYPE_COMMIT,
+                                               checksum, &commit, error))
+        return FALSE;
+      if (commit == NULL)
+        continue;  /* Raced with a prune */
+
+      g_autofree char *parent = ostree_commit_get_parent (commit);
+      const char *subject;
+      g_variant_get_child (commit, 3, "&s", &subject);
+      g_ptr_array_add (new_entries,
+                       g_variant_ref_sink (g_variant_new ("(ssts)", checksum,
+                                                          parent ?: "",
+                                                          ostree_commit_get_timestamp (commit),
+                                                          subject)));
+    }
+
+  if (new_entries->len == 0)
+    return TRUE;
+
+  g_ptr_array_sort (new_entries, compare_graph_entries_p);
+
+  /* Merge the two sorted runs; the bsearch above already filtered out
+   * checksums present in the existing graph.
+   */
+  GVariantBuilder builder;
+  g_variant_builder_init (&builder,
+                          G_VARIANT_TYPE (OSTREE_COMMIT_GRAPH_GVARIANT_STRING));
+  const gsize n_existing =
+    self->commit_graph != NULL ? g_variant_n_children (self->commit_graph) : 0;
+  gsize i = 0;
+  guint j = 0;
+  while (i < n_existing || j < new_entries->len)
+    {
+      if (i < n_existing && j < new_entries->len)
+        {
+          g_autoptr(GVariant) existing = g_variant_get_child_value (self->commit_graph, i);
+          const char *ca, *cb;
+          g_variant_get_child (existing, 0, "&s", &ca);
+          g_variant_get_child ((GVariant*)new_entries->pdata[j], 0, "&s", &cb);
+          if (strcmp (ca, cb) < 0)
+            {
+              g_variant_builder_add_value (&builder, existing);
+              i++;
+            }
+          else
+            {
+              g_variant_builder_add_value (&builder, new_entries->pdata[j]);
+              j++;
+            }
+        }
+      else if (i < n_existing)
+        {
+          g_autoptr(GVariant) existing = g_variant_get_child_value (self->commit_graph, i);
+          g_variant_builder_add_value (&builder, existing);
+          i++;
+        }
+      else
+        {
+          g_variant_builder_add_value (&builder, new_entries->pdata[j]);
+          j++;
+        }
+    }
+
+  g_autoptr(GVariant) graph = g_variant_ref_sink (g_variant_builder_end (&builder));
+
+  if (!glnx_shutil_mkdir_p_at (self->repo_dir_fd, "state", 0755,
+                               cancellable, error))
+    return FALSE;
+  if (!_ostree_repo_file_replace_contents (self, self->repo_dir_fd,
+                                           _OSTREE_COMMIT_GRAPH_PATH,
+                                           g_variant_get_data (graph),
+                                           g_variant_get_size (graph),
+                                           cancellable, error))
+    return FALSE;
+
+  /* Remap on the next lookup */
+  g_clear_pointer (&self->commit_graph, g_variant_unref);
+  self->commit_graph_checked = FALSE;
+  return TRUE;
+}
+
+/* Path indexes (_OSTREE_PATH_INDEX_DIR/<tree-checksum>): an optional
+ * path-sorted `a(sayay)` array of (path, dirtree csum, dirmeta csum)
+ * entries over every file and directory in a commit, keyed by the
+ * commit's root dirtree checksum so commits sharing a tree share an
+ * index.  The checksums name the tree pair of the entry's *parent*
+ * directory; with the index mapped, resolving a deep path loads just
+ * that one pair instead of every dirtree along the walk (see
+ * ostree-repo-file.c).  All referenced objects are immutable, so an
+ * index never goes stale, but it can outlive pruned objects; readers
+ * fall back to the component walk on any miss or load failure.
+ */
+#define OSTREE_PATH_INDEX_GVARIANT_STRING "a(sayay)"
+
+typedef struct {
+  char *path;
+  char *dirtree_checksum;
+  char *dirmeta_checksum;
+} PathIndexEntry;
+
+static void
+path_index_entry_free (PathIndexEntry *entry)
+{
+  g_free (entry->path);
+  g_free (entry->dirtree_checksum);
+  g_free (entry->dirmeta_checksum);
+  g_free (entry);
+}
+
+static int
+path_index_entry_compare (gconstpointer ap,
+                          gconstpointer bp)
+{
+  const PathIndexEntry *a = *((PathIndexEntry**)ap);
+  const PathIndexEntry *b = *((PathIndexEntry**)bp);
+  return strcmp (a->path, b->path);
+}
+
+static void
+path_index_add_entry (GPtrArray  *entries,
+                      const char *prefix,
+                      const char *name,
+                      const char *dirtree_checksum,
+                      const char *dirmeta_checksum)
+{
+  PathIndexEntry *entry = g_new0 (PathIndexEntry, 1);
+  entry->path = g_strconcat (prefix, name, NULL);
+  entry->dirtree_checksum = g_strdup (dirtree_checksum);
+  entry->dirmeta_checksum = g_strdup (dirmeta_checksum);
+  g_ptr_array_add (entries, entry);
+}
+
+static gboolean
+path_index_scan_dirtree (OstreeRepo    *self,
+                         const char    *dirtree_checksum,
+                         const char    *dirmeta_checksum,
+                         const char    *prefix,
+                         GPtrArray     *entries,
+                         GCancellable  *cancellable,
+                         GError       **error)
+{
+  g_autoptr(GVariant) tree = NULL;
+  if (!ostree_repo_load_variant (self, OSTREE_OBJECT_TYPE_DIR_TREE,
+                                 dirtree_checksum, &tree, error))
+    return FALSE;
+
+  g_autoptr(GVariant) files_variant = g_variant_get_child_value (tree, 0);
+  g_autoptr(GVariant) dirs_variant = g_variant_get_child_value (tree, 1);
+
+  gsize n = g_variant_n_children (files_variant);
+  for (gsize i = 0; i < n; i++)
+    {
+      const char *name;
+      g_variant_get_child (files_variant, i, "(&s@ay)", &name, NULL);
+      path_index_add_entry (entries, prefix, name,
+                            dirtree_checksum, dirmeta_checksum);
+    }
+
+  n = g_variant_n_children (dirs_variant);
+  for (gsize i = 0; i < n; i++)
+    {
+      const char *name;
+      g_autoptr(GVariant) subtree_csum_v = NULL;
+      g_autoptr(GVariant) submeta_csum_v = NULL;
+      g_variant_get_child (dirs_variant, i, "(&s@ay@ay)",
+                           &name, &subtree_csum_v, &submeta_csum_v);
+
+      path_index_add_entry (entries, prefix, name,
+                            dirtree_checksum, dirmeta_checksum);
+
+      g_autofree char *subtree_checksum = ostree_checksum_from_bytes_v (subtree_csum_v);
+      g_autofree char *submeta_checksum = ostree_checksum_from_bytes_v (submeta_csum_v);
+      g_autofree char *subprefix = g_strconcat (prefix, name, "/", NULL);
+      if (!path_index_scan_dirtree (self, subtree_checksum, submeta_checksum,
+                                    subprefix, entries, cancellable, error))
+        return FALSE;
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+gboolean
+_ostree_repo_regenerate_path_index (OstreeRepo    *self,
+                                    const char    *commit_checksum,
+                                    GCancellable  *cancellable,
+                                    GError       **error)
+{
+  g_autoptr(GVariant) commit = NULL;
+  if (!ostree_repo_load_variant (self, OSTREE_OBJECT_TYPE_COMMIT,
+                                 commit_checksum, &commit, error))
+    return FALSE;
+
+  g_autoptr(GVariant) tree_contents_csum_v = NULL;
+  g_autoptr(GVariant) tree_metadata_csum_v = NULL;
+  g_variant_get_child (commit, 6, "@ay", &tree_contents_csum_v);
+  g_variant_get_child (commit, 7, "@ay", &tree_metadata_csum_v);
+  g_autofree char *tree_checksum = ostree_checksum_from_bytes_v (tree_contents_csum_v);
+  g_autofree char *meta_checksum = ostree_checksum_from_bytes_v (tree_metadata_csum_v);
+
+  g_autoptr(GPtrArray) entries =
+    g_ptr_array_new_with_free_func ((GDestroyNotify)path_index_entry_free);
+  if (!path_index_scan_dirtree (self, tree_checksum, meta_checksum, "",
+                                entries, cancellable, error))
+    return FALSE;
+  g_ptr_array_sort (entries, path_index_entry_compare);
+
+  GVariantBuilder entries_builder;
+  g_variant_builder_init (&entries_builder,
+                          G_VARIANT_TYPE (OSTREE_PATH_INDEX_GVARIANT_STRING));
+  for (guint i = 0; i < entries->len; i++)
+    {
+      const PathIndexEntry *entry = entries->pdata[i];
+      g_variant_builder_add (&entries_builder, "(s@ay@ay)", entry->path,
+                             ostree_checksum_to_bytes_v (entry->dirtree_checksum),
+                             ostree_checksum_to_bytes_v (entry->dirmeta_checksum));
+    }
+
+  g_autoptr(GVariant) index =
+    g_variant_ref_sink (g_variant_builder_end (&entries_builder));
+
+  if (!glnx_shutil_mkdir_p_at (self->repo_dir_fd, _OSTREE_PATH_INDEX_DIR, 0755,
+                               cancellable, error))
+    return FALSE;
+  g_autofree char *index_path =
+    g_strdup_printf (_OSTREE_PATH_INDEX_DIR "/%s", tree_checksum);
+  if (!_ostree_repo_file_replace_contents (self, self->repo_dir_fd, index_path,
+                                           g_variant_get_data (index),
+                                           g_variant_get_size (index),
+                                           cancellable, error))
+    return FALSE;
+
+  /* Remap on the next lookup */
+  g_mutex_lock (&self->cache_lock);
+  if (self->path_indexes != NULL)
+    g_hash_table_remove (self->path_indexes, tree_checksum);
+  g_mutex_unlock (&self->cache_lock);
+  return TRUE;
+}
+
+/* Return a new reference to the path index covering the tree named by
+ * the root dirtree @tree_checksum, or %NULL if none was generated.
+ * Best-effort: an unreadable index is treated as absent, since every
+ * caller has the component walk to fall back on.
+ */
+GVariant *
+_ostree_repo_get_path_index (OstreeRepo    *self,
+                             const char    *tree_checksum)
+{
+  GVariant *ret = NULL;
+
+  g_mutex_lock (&self->cache_lock);
+  if (self->path_indexes != NULL)
+    {
+      GVariant *cached = g_hash_table_lookup (self->path_indexes, tree_checksum);
+      if (cached != NULL)
+        ret = g_variant_ref (cached);
+    }
+  g_mutex_unlock (&self->cache_lock);
+  if (ret != NULL)
+    return ret;
+
+  g_autofree char *index_path =
+    g_strdup_printf (_OSTREE_PATH_INDEX_DIR "/%s", tree_checksum);
+  glnx_fd_close int fd = openat (self->repo_dir_fd, index_path,
+                                 O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+
+  g_autoptr(GVariant) index = NULL;
+  { g_autoptr(GError) local_error = NULL;
+    if (!ot_util_variant_map_fd (fd, 0,
+                                 G_VARIANT_TYPE (OSTREE_PATH_INDEX_GVARIANT_STRING),
+                                 FALSE, &index, &local_error))
+      {
+        g_debug ("Failed to map %s: %s", index_path, local_error->message);
+        return NULL;
+      }
+  }
+
+  g_mutex_lock (&self->cache_lock);
+  if (self->path_indexes == NULL)
+    self->path_indexes = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                g_free, (GDestroyNotify)g_variant_unref);
+  g_hash_table_replace (self->path_indexes, g_strdup (tree_checksum),
+                        g_variant_ref (index));
+  g_mutex_unlock (&self->cache_lock);
+
+  return g_steal_pointer (&index);
+}
+
+/* Content packs: an optional tiered layout for archive repositories,
+ * where the ocean of small .filez objects is folded into a handful of
+ * append-only pack files under objects/pack/ while large payloads stay
+ * loose.  Each pack is a pack-<id>.data file holding concatenated raw
+ * .filez streams, described by a pack-<id>.index GVariant next to it: a
+ * checksum-sorted array of (checksum, offset, size).  Loose objects
+ * always win over packed ones, so object writes are unaffected; packs
+ * are only consulted after a loose lookup misses.  Packed objects are
+ * invisible to loose enumeration, and therefore to prune: space for
+ * unreachable packed objects is only reclaimed by a future repack.
+ */
+#define OSTREE_CONTENT_PACK_INDEX_GVARIANT_STRING "a(stt)"
+
+typedef struct {
+  GVariant *index;   /* OSTREE_CONTENT_PACK_INDEX_GVARIANT_STRING */
+  int data_fd;
+} OtContentPack;
+
+static void
+content_pack_free (OtContentPack *pack)
+{
+  g_variant_unref (pack->index);
+  if (pack->data_fd != -1)
+    (void) close (pack->data_fd);
+  g_free (pack);
+}
+
+static gboolean
+content_packs_ensure (OstreeRepo  *self,
+                      GError     **error)
+{
+  /* Load side of a publish-once pattern; concurrent readers (e.g.
+   * parallel fsck workers) may race to load, the loser just discards
+   * its copy.  Once published the packs are immutable.
+   */
+  if (g_atomic_int_get (&self->content_packs_checked))
+    return TRUE;
+
+  g_autoptr(GPtrArray) packs = NULL;
+  g_autoptr(GPtrArray) entries = NULL;
+  gboolean exists;
+  if (!ot_dfd_list_sorted_allow_noent (self->objects_dir_fd, _OSTREE_CONTENT_PACK_DIR,
+                                       &entries, &exists, error))
+    return FALSE;
+  if (exists)
+    {
+      packs = g_ptr_array_new_with_free_func ((GDestroyNotify)content_pack_free);
+
+      for (guint i = 0; i < entries->len; i++)
+        {
+          const OtBulkDirent *dent = entries->pdata[i];
+          const char *name = dent->name;
+          if (!g_str_has_suffix (name, ".index"))
+            continue;
+
+          g_autofree char *index_path =
+            g_strdup_printf ("%s/%s", _OSTREE_CONTENT_PACK_DIR, name);
+          glnx_fd_close int index_fd = openat (self->objects_dir_fd, index_path,
+                                               O_RDONLY | O_CLOEXEC);
+          if (index_fd < 0)
+            {
+              if (errno == ENOENT)
+                continue;  /* Raced with a repack */
+              return glnx_throw_errno_prefix (error, "openat(%s)", index_path);
+            }
+
+          g_autoptr(GVariant) index = NULL;
+          if (!ot_util_variant_map_fd (index_fd, 0,
+                                       G_VARIANT_TYPE (OSTREE_CONTENT_PACK_INDEX_GVARIANT_STRING),
+                                       FALSE, &index, error))
+            return glnx_prefix_error (error, "Mapping %s", index_path);
+
+          g_autofree char *data_path =
+            g_strdup_printf ("%s/%.*s.data", _OSTREE_CONTENT_PACK_DIR,
+                             (int)(strlen (name) - strlen (".index")), name);
+          glnx_fd_close int data_fd = openat (self->objects_dir_fd, data_path,
+                                              O_RDONLY | O_CLOEXEC);
+          if (data_fd < 0)
+            return glnx_throw_errno_prefix (error, "openat(%s)", data_path);
+
+          OtContentPack *pack = g_new0 (OtContentPack, 1);
+          pack->index = g_steal_pointer (&index);
+          pack->data_fd = glnx_steal_fd (&data_fd);
+          g_ptr_array_add (packs, pack);
+        }
+
+      if (packs->len == 0)
+        g_clear_pointer (&packs, g_ptr_array_unref);
+    }
+
+  g_mutex_lock (&self->cache_lock);
+  if (!self->content_packs_checked)
+    {
+      self->content_packs = g_steal_pointer (&packs);
+      g_atomic_int_set (&self->content_packs_checked, TRUE);
+    }
+  g_mutex_unlock (&self->cache_lock);
+  return TRUE;
+}
+
+/* Look up the content object @checksum in the repository's content
+ * packs.  A miss just means the object isn't packed; @out_size and
+ * @out_data return the size and raw .filez bytes of a hit on request.
+ */
+gboolean
+_ostree_repo_content_pack_lookup (OstreeRepo    *self,
+                                  const char    *checksum,
+                                  gboolean      *out_found,
+                                  guint64       *out_size,
+                                  GBytes       **out_data,
+                                  GCancellable  *cancellable,
+                                  GError       **error)
+{
+  *out_found = FALSE;
+
+  if (!content_packs_ensure (self, error))
+    return FALSE;
+  if (self->content_packs == NULL)
+    return TRUE;
+
+  for (guint i = 0; i < self->content_packs->len; i++)
+    {
+      OtContentPack *pack = self->content_packs->pdata[i];
+      int pos;
+      if (!ot_variant_bsearch_str (pack->index, checksum, &pos))
+        continue;
+
+      guint64 offset, size;
+      g_autoptr(GVariant) child = g_variant_get_child_value (pack->index, pos);
+      g_variant_get (child, "(&stt)", NULL, &offset, &size);
+
+      if (out_data)
+        {
+          g_autofree guint8 *buf = g_malloc ((gsize)size);
+          gsize bytes_read = 0;
+          while (bytes_read < size)
+            {
+              ssize_t n = TEMP_FAILURE_RETRY (pread (pack->data_fd, buf + bytes_read,
+                                                     size - bytes_read,
+                                                     offset + bytes_read));
+              if (n < 0)
+                return glnx_throw_errno_prefix (error, "pread");
+              if (n == 0)
+                return glnx_throw (error, "Truncated content pack reading object %s",
+                                   checksum);
+              bytes_read += n;
+            }
+          *out_data = g_bytes_new_take (g_steal_pointer (&buf), (gsize)size);
+        }
+      if (out_size)
+        *out_size = size;
+      *out_found = TRUE;
+      return TRUE;
+    }
+
+  return TRUE;
+}
+
+typedef struct {
+  guint64 max_object_size;
+  GPtrArray *candidates;      /* (element-type PackCandidate) */
+  GPtrArray *already_packed;  /* (element-type utf8) */
+} PackSmallObjectsData;
+
+typedef struct {
+  char checksum[OSTREE_SHA256_STRING_LEN+1];
+  guint64 size;
+} PackCandidate;
+
+static int
+pack_candidate_compare (gconstpointer ap,
+                        gconstpointer bp)
+{
+  const PackCandidate *a = *((PackCandidate**)ap);
+  const PackCandidate *b = *((PackCandidate**)bp);
+  return strcmp (a->checksum, b->checksum);
+}
+
+static gboolean
+pack_candidate_visitor (OstreeRepo       *repo,
+                        const char       *checksum,
+                        OstreeObjectType  objtype,
+                        gpointer          user_data,
+                        GError          **error)
+{
+  PackSmallObjectsData *data = user_data;
+
+  if (objtype != OSTREE_OBJECT_TYPE_FILE)
+    return TRUE;
+
+  char loose_path_buf[_OSTREE_LOOSE_PATH_MAX];
+  _ostree_loose_path (loose_path_buf, checksum, objtype, repo->mode);
+
+  struct stat stbuf;
+  if (TEMP_FAILURE_RETRY (fstatat (repo->objects_dir_fd, loose_path_buf,
+                                   &stbuf, AT_SYMLINK_NOFOLLOW)) < 0)
+    {
+      if (errno == ENOENT)
+        return TRUE;  /* Raced with a prune */
+      return glnx_throw_errno_prefix (error, "fstatat(%s)", loose_path_buf);
+    }
+  if ((guint64)stbuf.st_size > data->max_object_size)
+    return TRUE;
+
+  /* An earlier pack may already cover this object (e.g. it was pulled
+   * again after packing); then the loose copy is just a duplicate.
+   */
+  gboolean found_in_pack = FALSE;
+  if (!_ostree_repo_content_pack_lookup (repo, checksum, &found_in_pack,
+                                         NULL, NULL, NULL, error))
+    return FALSE;
+  if (found_in_pack)
+    {
+      g_ptr_array_add (data->already_packed, g_strdup (checksum));
+      return TRUE;
+    }
+
+  PackCandidate *candidate = g_new0 (PackCandidate, 1);
+  memcpy (candidate->checksum, checksum, OSTREE_SHA256_STRING_LEN);
+  candidate->size = (guint64)stbuf.st_size;
+  g_ptr_array_add (data->candidates, candidate);
+  return TRUE;
+}
+
+static gboolean
+unlink_packed_loose_object (OstreeRepo  *self,
+                            const char  *checksum,
+                            GError     **error)
+{
+  char loose_path_buf[_OSTREE_LOOSE_PATH_MAX];
+  _ostree_loose_path (loose_path_buf, checksum, OSTREE_OBJECT_TYPE_FILE, self->mode);
+  if (unlinkat (self->objects_dir_fd, loose_path_buf, 0) < 0 && errno != ENOENT)
+    return glnx_throw_errno_prefix (error, "unlinkat(%s)", loose_path_buf);
+  return TRUE;
+}
+
+/* Fold all loose content objects of at most @max_object_size bytes into
+ * a new content pack, then remove the loose copies.  Objects written
+ * after this returns are loose again until the next invocation, so this
+ * is meant to run periodically on mostly-append archive repositories.
+ */
+gboolean
+_ostree_repo_pack_small_objects (OstreeRepo    *self,
+                                 guint64        max_object_size,
+                                 guint         *out_n_packed,
+                                 GCancellable  *cancellable,
+                                 GError       **error)
+{
+  if (self->mode != OSTREE_REPO_MODE_ARCHIVE_Z2)
+    return glnx_throw (error, "Content packs require an archive repository");
+  g_assert (max_object_size > 0);
+
+  PackSmallObjectsData data = { max_object_size, NULL, NULL };
+  g_autoptr(GPtrArray) candidates = data.candidates =
+    g_ptr_array_new_with_free_func (g_free);
+  g_autoptr(GPtrArray) already_packed = data.already_packed =
+    g_ptr_array_new_with_free_func (g_free);
+  if (!list_loose_objects (self, pack_candidate_visitor, &data, NULL,
+                           cancellable, error))
+    return FALSE;
+
+  guint n_packed = 0;
+  if (candidates->len > 0)
+    {
+      /* Checksum order, matching the index and the fanout, so packing
+       * itself is a sequential sweep and later bulk reads of the pack
+       * line up with sorted object walks.
+       */
+      g_ptr_array_sort (candidates, pack_candidate_compare);
+
+      if (!glnx_shutil_mkdir_p_at (self->objects_dir_fd, _OSTREE_CONTENT_PACK_DIR,
+                                   0775, cancellable, error))
+        return FALSE;
+
+      g_auto(GLnxTmpfile) data_tmpf = { 0, };
+      if (!glnx_open_tmpfile_linkable_at (self->tmp_dir_fd, ".", O_WRONLY|O_CLOEXEC,
+                                          &data_tmpf, error))
+        return FALSE;
+      if (fchmod (data_tmpf.fd, 0644) < 0)
+        return glnx_throw_errno_prefix (error, "fchmod");
+
+      GVariantBuilder index_builder;
+      g_variant_builder_init (&index_builder,
+                              G_VARIANT_TYPE (OSTREE_CONTENT_PACK_INDEX_GVARIANT_STRING));
+      guint64 offset = 0;
+      for (guint i = 0; i < candidates->len; i++)
+        {
+          PackCandidate *candidate = candidates->pdata[i];
+
+          if (g_cancellable_set_error_if_cancelled (cancellable, error))
+            return FALSE;
+
+          char loose_path_buf[_OSTREE_LOOSE_PATH_MAX];
+          _ostree_loose_path (loose_path_buf, candidate->checksum,
+                              OSTREE_OBJECT_TYPE_FILE, self->mode);
+          glnx_fd_close int src_fd = openat (self->objects_dir_fd, loose_path_buf,
+                                             O_RDONLY | O_CLOEXEC);
+          if (src_fd < 0)
+            {
+              if (errno == ENOENT)
+                {
+                  candidate->size = 0;  /* Raced with a prune; skip the unlink too */
+                  continue;
+                }
+              return glnx_throw_errno_prefix (error, "openat(%s)", loose_path_buf);
+            }
+
+          if (glnx_regfile_copy_bytes (src_fd, data_tmpf.fd,
+                                       (off_t)candidate->size, TRUE) < 0)
+            return glnx_throw_errno_prefix (error, "copying %s", loose_path_buf);
+
+          g_variant_builder_add (&index_builder, "(stt)", candidate->checksum,
+                                 offset, candidate->size);
+          offset += candidate->size;
+          n_packed++;
+        }
+
+      if (n_packed > 0)
+        {
+          g_autoptr(GVariant) index =
+            g_variant_ref_sink (g_variant_builder_end (&index_builder));
+
+          if (!self->disable_fsync)
+            {
+              if (fdatasync (data_tmpf.fd) < 0)
+                return glnx_throw_errno_prefix (error, "fdatasync");
+            }
+
+          /* The data file must be in place before the index makes it
+           * visible; the index write below syncs and renames.
+           */
+          guint64 pack_id = (guint64) g_get_real_time ();
+          g_autofree char *data_path =
+            g_strdup_printf ("%s/pack-%" G_GUINT64_FORMAT ".data",
+                             _OSTREE_CONTENT_PACK_DIR, pack_id);
+          g_autofree char *index_path =
+            g_strdup_printf ("%s/pack-%" G_GUINT64_FORMAT ".index",
+                             _OSTREE_CONTENT_PACK_DIR, pack_id);
+          if (!glnx_link_tmpfile_at (&data_tmpf, GLNX_LINK_TMPFILE_NOREPLACE,
+                                     self->objects_dir_fd, data_path, error))
+            return FALSE;
+          if (!_ostree_repo_file_replace_contents (self, self->objects_dir_fd,
+                                                   index_path,
+                                                   g_variant_get_data (index),
+                                                   g_variant_get_size (index),
+                                                   cancellable, error))
+            return FALSE;
+
+          for (guint i = 0; i < candidates->len; i++)
+            {
+              PackCandidate *candidate = candidates->pdata[i];
+              if (candidate->size == 0)
+                continue;
+              if (!unlink_packed_loose_object (self, candidate->checksum, error))
+                return FALSE;
+            }
+        }
+      else
+        g_variant_builder_clear (&index_builder);
+    }
+
+  for (guint i = 0; i < already_packed->len; i++)
+    {
+      if (!unlink_packed_loose_object (self, already_packed->pdata[i], error))
+        return FALSE;
+    }
+
+  if (n_packed > 0 || already_packed->len > 0)
+    {
+      /* Remap on the next lookup */
+      g_mutex_lock (&self->cache_lock);
+      g_clear_pointer (&self->content_packs, g_ptr_array_unref);
+      g_atomic_int_set (&self->content_packs_checked, FALSE);
+      g_mutex_unlock (&self->cache_lock);
+
+      if (!_ostree_repo_update_mtime (self, error))
+        return FALSE;
+    }
 
-  g_autofree char *remotename = NULL;
-  if (!ostree_parse_refspec (ref, &remotename, NULL, NULL))
-    g_assert_not_reached ();
+  *out_n_packed = n_packed;
+  return TRUE;
+}
 
-  /* Don't put remote refs in the summary */
-  if (remotename != NULL)
+/* Write the object manifest for @commit_checksum: a sorted `a(sut)`
+ * array of (checksum, object type, stored size), integers big-endian
+ * like the summary, covering every object reachable from the commit.
+ * A client can fetch this one file, set-difference it against its
+ * local objects, and schedule every fetch immediately instead of
+ * discovering the object set by iteratively scanning dirtrees.
+ *
+ * The manifest is addressed by commit, so a file that already exists
+ * is current by construction and regeneration only costs a traversal
+ * for new ref tips.
+ */
+static gboolean
+regenerate_object_manifest (OstreeRepo    *self,
+                            const char    *commit_checksum,
+                            GCancellable  *cancellable,
+                            GError       **error)
+{
+  g_autofree char *path = _ostree_get_relative_object_manifest_path (commit_checksum);
+  struct stat stbuf;
+
+  if (fstatat (self->repo_dir_fd, path, &stbuf, 0) == 0)
     return TRUE;
 
-  g_autoptr(GVariant) commit_obj = NULL;
-  if (!ostree_repo_load_variant (self, OSTREE_OBJECT_TYPE_COMMIT, checksum, &commit_obj, error))
-    return FALSE;
+  g_autoptr(GHashTable) reachable = NULL;
+  { g_autoptr(GError) local_error = NULL;
+    if (!ostree_repo_traverse_commit (self, commit_checksum, 0, &reachable,
+                                      cancellable, &local_error))
+      {
+        /* A partial commit (e.g. a mirror still being populated)
+         * simply doesn't get a manifest yet.
+         */
+        if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+          return TRUE;
+        g_propagate_error (error, g_steal_pointer (&local_error));
+        return FALSE;
+      }
+  }
+
+  g_autoptr(GPtrArray) sorted = g_ptr_array_new ();
+  GLNX_HASH_TABLE_FOREACH (reachable, GVariant*, objname)
+    g_ptr_array_add (sorted, objname);
+  g_ptr_array_sort (sorted, compare_object_names);
+
+  g_autoptr(GVariantBuilder) builder = g_variant_builder_new (G_VARIANT_TYPE ("a(sut)"));
+  for (guint i = 0; i < sorted->len; i++)
+    {
+      GVariant *objname = sorted->pdata[i];
+      const char *checksum;
+      OstreeObjectType objtype;
+      guint64 size;
+
+      ostree_object_name_deserialize (objname, &checksum, &objtype);
+      if (!ostree_repo_query_object_storage_size (self, objtype, checksum, &size,
+                                                  cancellable, error))
+        return FALSE;
+
+      g_variant_builder_add (builder, "(sut)", checksum,
+                             GUINT32_TO_BE ((guint32)objtype),
+                             GUINT64_TO_BE (size));
+    }
+  g_autoptr(GVariant) manifest = g_variant_ref_sink (g_variant_builder_end (builder));
 
-  g_variant_dict_init (&commit_metadata_builder, NULL);
+  g_autofree char *dn = g_path_get_dirname (path);
+  if (!glnx_shutil_mkdir_p_at (self->repo_dir_fd, dn, 0775, cancellable, error))
+    return FALSE;
 
-  /* Forward the commit’s timestamp if it’s valid. */
-  guint64 commit_timestamp = ostree_commit_get_timestamp (commit_obj);
-  g_autoptr(GDateTime) dt = g_date_time_new_from_unix_utc (commit_timestamp);
+  if (!glnx_file_replace_contents_at (self->repo_dir_fd, path,
+                                      g_variant_get_data (manifest),
+                                      g_variant_get_size (manifest),
+                                      self->disable_fsync ?
+                                      GLNX_FILE_REPLACE_NODATASYNC :
+                                      GLNX_FILE_REPLACE_DATASYNC_NEW,
+                                      cancellable, error))
+    return FALSE;
 
-  if (dt != NULL)
-    g_variant_dict_insert_value (&commit_metadata_builder, OSTREE_COMMIT_TIMESTAMP,
-                                 g_variant_new_uint64 (GUINT64_TO_BE (commit_timestamp)));
+  return TRUE;
+}
 
-  g_variant_builder_add_value (refs_builder,
-                               g_variant_new ("(s(t@ay@a{sv}))", ref,
-                                              (guint64) g_variant_get_size (commit_obj),
-                                              ostree_checksum_to_bytes_v (checksum),
-                                              g_variant_dict_end (&commit_metadata_builder)));
+/* Remove `summary.shard.*` files not in @kept_shards (%NULL = remove
+ * them all, for when sharding has been disabled). */
+static gboolean
+summary_prune_stale_shards (OstreeRepo    *self,
+                            GHashTable    *kept_shards,
+                            GCancellable  *cancellable,
+                            GError       **error)
+{
+  g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
+  if (!glnx_dirfd_iterator_init_at (self->repo_dir_fd, ".", FALSE, &dfd_iter, error))
+    return FALSE;
+  while (TRUE)
+    {
+      struct dirent *dent;
+      if (!glnx_dirfd_iterator_next_dent (&dfd_iter, &dent, cancellable, error))
+        return FALSE;
+      if (dent == NULL)
+        break;
+      if (!g_str_has_prefix (dent->d_name, "summary.shard."))
+        continue;
+      if (kept_shards != NULL && g_hash_table_contains (kept_shards, dent->d_name))
+        continue;
+      if (unlinkat (dfd_iter.fd, dent->d_name, 0) < 0 && errno != ENOENT)
+        return glnx_throw_errno_prefix (error, "unlinkat(%s)", dent->d_name);
+    }
 
   return TRUE;
 }
 
+/* Implementation of core.summary-shard-prefixes: split the main refs
+ * array of *@summary_inout into one standalone summary-format file per
+ * configured prefix (see _ostree_summary_shard_filename()), each also
+ * carrying the static delta checksums whose target commit is a ref tip
+ * in that shard.  The root summary keeps the refs matching no prefix
+ * and the remaining deltas, plus an %OSTREE_SUMMARY_SHARDS index of
+ * (prefix, shard file SHA256) pairs which extends the root summary's
+ * signature over the shards.  Inline delta superblocks always stay in
+ * the root, since they're bounded small by configuration.
+ *
+ * Shard files from a previous configuration which are no longer
+ * generated are removed.  On success *@summary_inout is replaced by
+ * the new root summary.
+ */
+static gboolean
+summary_write_shards (OstreeRepo    *self,
+                      GVariant     **summary_inout,
+                      GCancellable  *cancellable,
+                      GError       **error)
+{
+  char **prefixes = self->summary_shard_prefixes;
+  gboolean enabled = (prefixes != NULL && prefixes[0] != NULL);
+  g_autoptr(GHashTable) kept_shards = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  if (enabled)
+    {
+      g_autoptr(GVariant) refs_v = g_variant_get_child_value (*summary_inout, 0);
+      g_autoptr(GVariant) metadata_v = g_variant_get_child_value (*summary_inout, 1);
+      g_autoptr(GVariant) deltas_v = g_variant_lookup_value (metadata_v, OSTREE_SUMMARY_STATIC_DELTAS,
+                                                             G_VARIANT_TYPE ("a{sv}"));
+      guint n_prefixes = g_strv_length (prefixes);
+
+      /* Partition the (sorted) refs array; each shard's array and the
+       * root remainder stay sorted since we append in input order. */
+      g_autoptr(GPtrArray) shard_refs_builders =
+        g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_builder_unref);
+      g_autoptr(GPtrArray) shard_commits =
+        g_ptr_array_new_with_free_func ((GDestroyNotify)g_hash_table_unref);
+      for (guint i = 0; i < n_prefixes; i++)
+        {
+          g_ptr_array_add (shard_refs_builders,
+                           g_variant_builder_new (G_VARIANT_TYPE ("a(s(taya{sv}))")));
+          g_ptr_array_add (shard_commits,
+                           g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL));
+        }
+      g_autoptr(GVariantBuilder) root_refs_builder =
+        g_variant_builder_new (G_VARIANT_TYPE ("a(s(taya{sv}))"));
+
+      gsize n_refs = g_variant_n_children (refs_v);
+      for (gsize i = 0; i < n_refs; i++)
+        {
+          const char *ref;
+          g_autoptr(GVariant) entry = NULL;
+          g_variant_get_child (refs_v, i, "(&s@(taya{sv}))", &ref, &entry);
+
+          GVariantBuilder *target = root_refs_builder;
+          for (guint j = 0; j < n_prefixes; j++)
+            {
+              const char *prefix = prefixes[j];
+              size_t prefix_len = strlen (prefix);
+              if (strncmp (ref, prefix, prefix_len) == 0
+                  && (ref[prefix_len] == '\0' || ref[prefix_len] == '/'))
+                {
+                  target = shard_refs_builders->pdata[j];
+                  g_autoptr(GVariant) csum_v = g_variant_get_child_value (entry, 1);
+                  char *commit = ostree_checksum_from_bytes_v (csum_v);
+                  g_hash_table_add (shard_commits->pdata[j], commit);
+                  break;
+                }
+            }
+          g_variant_builder_add (target, "(s@(taya{sv}))", ref, entry);
+        }
+
+      /* Assign each delta checksum entry to the shard whose ref set
+       * contains its target commit; deltas to unsharded commits stay in
+       * the root.  Dual-endian variant keys ("<delta>.l"/"<delta>.B")
+       * follow their base delta. */
+      g_autoptr(GPtrArray) shard_deltas_builders =
+        g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_builder_unref);
+      for (guint i = 0; i < n_prefixes; i++)
+        g_ptr_array_add (shard_deltas_builders,
+                         g_variant_builder_new (G_VARIANT_TYPE ("a{sv}")));
+      g_autoptr(GVariantBuilder) root_deltas_builder =
+        g_variant_builder_new (G_VARIANT_TYPE ("a{sv}"));
+      gboolean have_root_deltas = FALSE;
+
+      gsize n_deltas = deltas_v ? g_variant_n_children (deltas_v) : 0;
+      for (gsize i = 0; i < n_deltas; i++)
+        {
+          const char *delta_key;
+          g_autoptr(GVariant) delta_csum_v = NULL;
+          g_variant_get_child (deltas_v, i, "{&sv}", &delta_key, &delta_csum_v);
+
+          g_autofree char *base_name = g_strdup (delta_key);
+          size_t len = strlen (base_name);
+          if (len > 2 && base_name[len-2] == '.'
+              && (base_name[len-1] == 'l' || base_name[len-1] == 'B'))
+            base_name[len-2] = '\0';
+
+          g_autofree char *from = NULL;
+          g_autofree char *to = NULL;
+          GVariantBuilder *target = root_deltas_builder;
+          if (_ostree_parse_delta_name (base_name, &from, &to, NULL))
+            {
+              for (guint j = 0; j < n_prefixes; j++)
+                {
+                  if (g_hash_table_contains (shard_commits->pdata[j], to))
+                    {
+                      target = shard_deltas_builders->pdata[j];
+                      break;
+                    }
+                }
+            }
+          if (target == root_deltas_builder)
+            have_root_deltas = TRUE;
+          g_variant_builder_add (target, "{sv}", delta_key, delta_csum_v);
+        }
+
+      /* Write the shard files and collect the index entries. */
+      g_autoptr(GVariantBuilder) shard_index_builder =
+        g_variant_builder_new (G_VARIANT_TYPE ("a(say)"));
+      for (guint i = 0; i < n_prefixes; i++)
+        {
+          g_auto(GVariantDict) shard_metadata_builder = OT_VARIANT_BUILDER_INITIALIZER;
+          g_variant_dict_init (&shard_metadata_builder, NULL);
+
+          if (g_hash_table_size (shard_commits->pdata[i]) > 0 && deltas_v != NULL)
+            g_variant_dict_insert_value (&shard_metadata_builder, OSTREE_SUMMARY_STATIC_DELTAS,
+                                         g_variant_builder_end (shard_deltas_builders->pdata[i]));
+          { g_autoptr(GVariant) last_modified =
+              g_variant_lookup_value (metadata_v, OSTREE_SUMMARY_LAST_MODIFIED, G_VARIANT_TYPE ("t"));
+            if (last_modified != NULL)
+              g_variant_dict_insert_value (&shard_metadata_builder, OSTREE_SUMMARY_LAST_MODIFIED,
+                                           g_steal_pointer (&last_modified));
+          }
+
+          g_autoptr(GVariantBuilder) shard_builder =
+            g_variant_builder_new (OSTREE_SUMMARY_GVARIANT_FORMAT);
+          g_variant_builder_add_value (shard_builder,
+                                       g_variant_builder_end (shard_refs_builders->pdata[i]));
+          g_variant_builder_add_value (shard_builder,
+                                       g_variant_dict_end (&shard_metadata_builder));
+          g_autoptr(GVariant) shard = g_variant_ref_sink (g_variant_builder_end (shard_builder));
+
+          g_autofree char *shard_fn = _ostree_summary_shard_filename (prefixes[i]);
+          if (!_ostree_repo_file_replace_contents (self, self->repo_dir_fd, shard_fn,
+                                                   g_variant_get_data (shard),
+                                                   g_variant_get_size (shard),
+                                                   cancellable, error))
+            return FALSE;
+
+          g_autofree char *shard_csum =
+            g_compute_checksum_for_data (G_CHECKSUM_SHA256,
+                                         g_variant_get_data (shard),
+                                         g_variant_get_size (shard));
+          g_autofree guchar *shard_csum_bytes = ostree_checksum_to_bytes (shard_csum);
+          g_variant_builder_add (shard_index_builder, "(s@ay)", prefixes[i],
+                                 ot_gvariant_new_bytearray (shard_csum_bytes, 32));
+
+          g_hash_table_add (kept_shards, g_steal_pointer (&shard_fn));
+        }
+
+      /* Rebuild the root summary: the remainder refs, the metadata with
+       * the delta table trimmed to the root's share, and the shard
+       * index. */
+      g_auto(GVariantDict) root_metadata_builder = OT_VARIANT_BUILDER_INITIALIZER;
+      g_variant_dict_init (&root_metadata_builder, metadata_v);
+      if (deltas_v != NULL)
+        {
+          if (have_root_deltas)
+            g_variant_dict_insert_value (&root_metadata_builder, OSTREE_SUMMARY_STATIC_DELTAS,
+                                         g_variant_builder_end (root_deltas_builder));
+          else
+            g_variant_dict_remove (&root_metadata_builder, OSTREE_SUMMARY_STATIC_DELTAS);
+        }
+      g_variant_dict_insert_value (&root_metadata_builder, OSTREE_SUMMARY_SHARDS,
+                                   g_variant_builder_end (shard_index_builder));
+
+      g_autoptr(GVariantBuilder) root_builder =
+        g_variant_builder_new (OSTREE_SUMMARY_GVARIANT_FORMAT);
+      g_variant_builder_add_value (root_builder, g_variant_builder_end (root_refs_builder));
+      g_variant_builder_add_value (root_builder, g_variant_dict_end (&root_metadata_builder));
+
+      g_variant_unref (*summary_inout);
+      *summary_inout = g_variant_ref_sink (g_variant_builder_end (root_builder));
+    }
+
+  /* Remove shards we no longer generate (including all of them when
+   * sharding was just disabled). */
+  return summary_prune_stale_shards (self, kept_shards, cancellable, error);
+}
+
 /**
  * ostree_repo_regenerate_summary:
  * @self: Repo
@@ -4668,6 +7632,12 @@ summary_add_ref_entry (OstreeRepo       *self,
  * listed under the %OSTREE_SUMMARY_COLLECTION_MAP key. Collection IDs and refs
  * in %OSTREE_SUMMARY_COLLECTION_MAP are guaranteed to be in lexicographic
  * order.
+ *
+ * If the `core/summary-shard-prefixes` key is set, refs matching one of the
+ * configured prefixes are moved out of the summary into per-prefix
+ * `summary.shard.<prefix>` files, and the summary instead carries an
+ * %OSTREE_SUMMARY_SHARDS index of their checksums; clients then only download
+ * the shards covering the refs they pull.
  */
 gboolean
 ostree_repo_regenerate_summary (OstreeRepo     *self,
@@ -4677,10 +7647,115 @@ ostree_repo_regenerate_summary (OstreeRepo     *self,
 {
   g_auto(GVariantDict) additional_metadata_builder = OT_VARIANT_BUILDER_INITIALIZER;
   g_variant_dict_init (&additional_metadata_builder, additional_metadata);
-  g_autoptr(GVariantBuilder) refs_builder = g_variant_builder_new (G_VARIANT_TYPE ("a(s(taya{sv}))"));
+
+  /* Sharding repartitions the refs array, so it needs the whole summary
+   * variant in memory; otherwise stream ref entries to the summary
+   * tmpfile as they're produced, see SummaryStream above. */
+  const gboolean sharded = (self->summary_shard_prefixes != NULL
+                            && self->summary_shard_prefixes[0] != NULL);
+  g_autoptr(GVariantBuilder) refs_builder =
+    sharded ? g_variant_builder_new (G_VARIANT_TYPE ("a(s(taya{sv}))")) : NULL;
+  g_auto(SummaryStream) stream = { { 0, }, 0, NULL };
+  if (!sharded && !summary_stream_init (self, &stream, error))
+    return FALSE;
+  SummaryStream *refs_stream = sharded ? NULL : &stream;
 
   const gchar *main_collection_id = ostree_repo_get_collection_id (self);
 
+  /* With tens of thousands of refs, re-reading every commit object and
+   * re-checksumming every delta superblock dominates regeneration time,
+   * so reuse entries from the previous summary where we can prove
+   * they're still current. */
+  struct stat old_summary_stbuf;
+  g_autoptr(GVariant) old_summary = summary_load_previous (self, &old_summary_stbuf);
+  g_autoptr(GHashTable) old_main_refs = NULL;  /* (element-type utf8 GVariant) */
+  g_autoptr(GHashTable) old_collection_map = NULL;  /* (element-type utf8 GHashTable) */
+  g_autoptr(GVariant) old_deltas = NULL;
+  if (old_summary != NULL)
+    {
+      g_autoptr(GVariant) old_refs_v = g_variant_get_child_value (old_summary, 0);
+      g_autoptr(GVariant) old_metadata = g_variant_get_child_value (old_summary, 1);
+
+      old_main_refs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                             (GDestroyNotify)g_variant_unref);
+      summary_collect_ref_entries (old_refs_v, old_main_refs);
+
+      old_deltas = g_variant_lookup_value (old_metadata, OSTREE_SUMMARY_STATIC_DELTAS,
+                                           G_VARIANT_TYPE ("a{sv}"));
+
+      /* If the previous summary was sharded, its ref entries and delta
+       * checksums live in the shard files; fold them back in so reuse
+       * still works when refs move between shards or the shard
+       * configuration changes. */
+      g_autoptr(GVariant) old_shards =
+        g_variant_lookup_value (old_metadata, OSTREE_SUMMARY_SHARDS, G_VARIANT_TYPE ("a(say)"));
+      if (old_shards != NULL)
+        {
+          g_auto(GVariantDict) merged_deltas = OT_VARIANT_BUILDER_INITIALIZER;
+          g_variant_dict_init (&merged_deltas, old_deltas);
+
+          gsize n_shards = g_variant_n_children (old_shards);
+          for (gsize i = 0; i < n_shards; i++)
+            {
+              const char *prefix;
+              g_variant_get_child (old_shards, i, "(&s@ay)", &prefix, NULL);
+
+              g_autofree char *shard_fn = _ostree_summary_shard_filename (prefix);
+              g_autoptr(GVariant) shard = NULL;
+              if (!ot_util_variant_map_at (self->repo_dir_fd, shard_fn,
+                                           OSTREE_SUMMARY_GVARIANT_FORMAT,
+                                           OT_VARIANT_MAP_ALLOW_NOENT, &shard, NULL)
+                  || shard == NULL)
+                continue;
+
+              g_autoptr(GVariant) shard_refs_v = g_variant_get_child_value (shard, 0);
+              summary_collect_ref_entries (shard_refs_v, old_main_refs);
+
+              g_autoptr(GVariant) shard_metadata = g_variant_get_child_value (shard, 1);
+              g_autoptr(GVariant) shard_deltas =
+                g_variant_lookup_value (shard_metadata, OSTREE_SUMMARY_STATIC_DELTAS,
+                                        G_VARIANT_TYPE ("a{sv}"));
+              if (shard_deltas != NULL)
+                {
+                  gsize n_deltas = g_variant_n_children (shard_deltas);
+                  for (gsize j = 0; j < n_deltas; j++)
+                    {
+                      const char *delta_name;
+                      g_autoptr(GVariant) delta_csum_v = NULL;
+
+                      g_variant_get_child (shard_deltas, j, "{&sv}", &delta_name, &delta_csum_v);
+                      g_variant_dict_insert_value (&merged_deltas, delta_name, delta_csum_v);
+                    }
+                }
+            }
+
+          g_clear_pointer (&old_deltas, g_variant_unref);
+          old_deltas = g_variant_ref_sink (g_variant_dict_end (&merged_deltas));
+        }
+
+      g_autoptr(GVariant) old_collections_v =
+        g_variant_lookup_value (old_metadata, OSTREE_SUMMARY_COLLECTION_MAP,
+                                G_VARIANT_TYPE ("a{sa(s(taya{sv}))}"));
+      if (old_collections_v != NULL)
+        {
+          old_collection_map = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                                      (GDestroyNotify)g_hash_table_unref);
+          gsize n = g_variant_n_children (old_collections_v);
+          for (gsize i = 0; i < n; i++)
+            {
+              const char *old_collection_id;
+              g_autoptr(GVariant) old_collection_refs_v = NULL;
+
+              g_variant_get_child (old_collections_v, i, "{&s@a(s(taya{sv}))}",
+                                   &old_collection_id, &old_collection_refs_v);
+              GHashTable *subtable = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                                            (GDestroyNotify)g_variant_unref);
+              summary_collect_ref_entries (old_collection_refs_v, subtable);
+              g_hash_table_replace (old_collection_map, g_strdup (old_collection_id), subtable);
+            }
+        }
+    }
+
   {
     if (main_collection_id == NULL)
       {
@@ -4695,8 +7770,10 @@ ostree_repo_regenerate_summary (OstreeRepo     *self,
           {
             const char *ref = iter->data;
             const char *commit = g_hash_table_lookup (refs, ref);
+            GVariant *previous = old_main_refs ? g_hash_table_lookup (old_main_refs, ref) : NULL;
 
-            if (!summary_add_ref_entry (self, ref, commit, refs_builder, error))
+            if (!summary_add_ref_entry (self, ref, commit, previous,
+                                        refs_builder, refs_stream, error))
               return FALSE;
           }
       }
@@ -4705,11 +7782,14 @@ ostree_repo_regenerate_summary (OstreeRepo     *self,
   {
     g_autoptr(GPtrArray) delta_names = NULL;
     g_auto(GVariantDict) deltas_builder = OT_VARIANT_BUILDER_INITIALIZER;
+    g_auto(GVariantDict) inline_deltas_builder = OT_VARIANT_BUILDER_INITIALIZER;
+    gboolean have_inline_deltas = FALSE;
 
     if (!ostree_repo_list_static_delta_names (self, &delta_names, cancellable, error))
       return FALSE;
 
     g_variant_dict_init (&deltas_builder, NULL);
+    g_variant_dict_init (&inline_deltas_builder, NULL);
     for (guint i = 0; i < delta_names->len; i++)
       {
         g_autofree char *from = NULL;
@@ -4720,6 +7800,96 @@ ostree_repo_regenerate_summary (OstreeRepo     *self,
         g_autofree char *superblock = _ostree_get_relative_static_delta_superblock_path ((from && from[0]) ? from : NULL, to);
         glnx_fd_close int superblock_file_fd = -1;
 
+        /* Optionally embed small superblocks directly in the summary, so a
+         * client can apply them (when the part data is inline too) with no
+         * further requests.
+         */
+        if (self->summary_inline_delta_max_bytes > 0)
+          {
+            struct stat inline_stbuf;
+
+            if (fstatat (self->repo_dir_fd, superblock, &inline_stbuf, 0) == 0
+                && (guint64)inline_stbuf.st_size <= self->summary_inline_delta_max_bytes)
+              {
+                glnx_fd_close int inline_fd = -1;
+                if (!glnx_openat_rdonly (self->repo_dir_fd, superblock, TRUE, &inline_fd, error))
+                  return FALSE;
+                g_autoptr(GBytes) sb_bytes = glnx_fd_readall_bytes (inline_fd, cancellable, error);
+                if (!sb_bytes)
+                  return FALSE;
+                g_variant_dict_insert_value (&inline_deltas_builder, delta_names->pdata[i],
+                                             ot_gvariant_new_ay_bytes (sb_bytes));
+                have_inline_deltas = TRUE;
+              }
+          }
+
+        /* Dual-endian publishing writes per-endianness superblock
+         * variants next to the canonical one; advertise their checksums
+         * keyed "<delta>.l"/"<delta>.B" so a client can verify the
+         * variant it selects against this (possibly signed) summary.
+         */
+        { static const char * const variant_suffixes[] = { "l", "B" };
+          for (guint j = 0; j < G_N_ELEMENTS (variant_suffixes); j++)
+            {
+              g_autofree char *variant_path = g_strconcat (superblock, ".", variant_suffixes[j], NULL);
+              g_autofree char *variant_key = g_strconcat ((char*)delta_names->pdata[i], ".", variant_suffixes[j], NULL);
+              struct stat variant_stbuf;
+
+              if (fstatat (self->repo_dir_fd, variant_path, &variant_stbuf, 0) != 0)
+                continue;
+
+              if (old_deltas != NULL)
+                {
+                  g_autoptr(GVariant) old_variant_csum_v =
+                    g_variant_lookup_value (old_deltas, variant_key, G_VARIANT_TYPE ("ay"));
+
+                  if (old_variant_csum_v != NULL &&
+                      ostree_checksum_bytes_peek (old_variant_csum_v) != NULL &&
+                      (variant_stbuf.st_mtim.tv_sec < old_summary_stbuf.st_mtim.tv_sec ||
+                       (variant_stbuf.st_mtim.tv_sec == old_summary_stbuf.st_mtim.tv_sec &&
+                        variant_stbuf.st_mtim.tv_nsec < old_summary_stbuf.st_mtim.tv_nsec)))
+                    {
+                      g_variant_dict_insert_value (&deltas_builder, variant_key, old_variant_csum_v);
+                      continue;
+                    }
+                }
+
+              glnx_fd_close int variant_fd = -1;
+              if (!glnx_openat_rdonly (self->repo_dir_fd, variant_path, TRUE, &variant_fd, error))
+                return FALSE;
+
+              g_autoptr(GInputStream) variant_in = g_unix_input_stream_new (variant_fd, FALSE);
+              g_autofree guchar *variant_csum = NULL;
+              if (!ot_gio_checksum_stream (variant_in, &variant_csum, cancellable, error))
+                return FALSE;
+
+              g_variant_dict_insert_value (&deltas_builder, variant_key,
+                                           ot_gvariant_new_bytearray (variant_csum, 32));
+            }
+        }
+
+        /* Reuse the cached checksum if the superblock strictly predates
+         * the previous summary; superblocks are written once at delta
+         * generation time, so an older mtime means it can't have changed
+         * since it was last checksummed. */
+        if (old_deltas != NULL)
+          {
+            g_autoptr(GVariant) old_csum_v =
+              g_variant_lookup_value (old_deltas, delta_names->pdata[i], G_VARIANT_TYPE ("ay"));
+            struct stat stbuf;
+
+            if (old_csum_v != NULL &&
+                ostree_checksum_bytes_peek (old_csum_v) != NULL &&
+                fstatat (self->repo_dir_fd, superblock, &stbuf, 0) == 0 &&
+                (stbuf.st_mtim.tv_sec < old_summary_stbuf.st_mtim.tv_sec ||
+                 (stbuf.st_mtim.tv_sec == old_summary_stbuf.st_mtim.tv_sec &&
+                  stbuf.st_mtim.tv_nsec < old_summary_stbuf.st_mtim.tv_nsec)))
+              {
+                g_variant_dict_insert_value (&deltas_builder, delta_names->pdata[i], old_csum_v);
+                continue;
+              }
+          }
+
         if (!glnx_openat_rdonly (self->repo_dir_fd, superblock, TRUE, &superblock_file_fd, error))
           return FALSE;
 
@@ -4739,6 +7909,41 @@ ostree_repo_regenerate_summary (OstreeRepo     *self,
 
     if (delta_names->len > 0)
       g_variant_dict_insert_value (&additional_metadata_builder, OSTREE_SUMMARY_STATIC_DELTAS, g_variant_dict_end (&deltas_builder));
+    if (have_inline_deltas)
+      g_variant_dict_insert_value (&additional_metadata_builder, OSTREE_SUMMARY_INLINE_DELTAS, g_variant_dict_end (&inline_deltas_builder));
+
+    /* Also write the standalone delta index, used by clients which
+     * don't have a (signed) summary in hand to avoid probing for
+     * superblocks that don't exist.
+     */
+    if (!_ostree_repo_static_delta_index_regenerate (self, delta_names, cancellable, error))
+      return FALSE;
+  }
+
+  /* Publish an object manifest for every ref tip, so clients pulling
+   * without a delta can discover the needed object set in a single
+   * request instead of a dirtree request chain.
+   */
+  {
+    g_autoptr(GHashTable) refs = NULL;
+    g_autoptr(GHashTable) collection_refs = NULL;
+
+    if (!ostree_repo_list_refs (self, NULL, &refs, cancellable, error))
+      return FALSE;
+    if (!ostree_repo_list_collection_refs (self, NULL, &collection_refs, cancellable, error))
+      return FALSE;
+
+    g_autoptr(GHashTable) tips = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    GLNX_HASH_TABLE_FOREACH_V (refs, const char*, checksum)
+      g_hash_table_add (tips, g_strdup (checksum));
+    GLNX_HASH_TABLE_FOREACH_V (collection_refs, const char*, checksum)
+      g_hash_table_add (tips, g_strdup (checksum));
+
+    GLNX_HASH_TABLE_FOREACH (tips, const char*, checksum)
+      {
+        if (!regenerate_object_manifest (self, checksum, cancellable, error))
+          return FALSE;
+      }
   }
 
   {
@@ -4746,6 +7951,41 @@ ostree_repo_regenerate_summary (OstreeRepo     *self,
                                  g_variant_new_uint64 (GUINT64_TO_BE (g_get_real_time () / G_USEC_PER_SEC)));
   }
 
+  /* Add a bloom prefilter over all ref names, so clients can answer
+   * negative ref-existence queries against huge summaries without
+   * searching the ref arrays at all.  See OSTREE_SUMMARY_REF_BLOOM.
+   */
+  {
+    g_autoptr(GHashTable) refs = NULL;
+    g_autoptr(GHashTable) collection_refs = NULL;
+
+    if (!ostree_repo_list_refs (self, NULL, &refs, cancellable, error))
+      return FALSE;
+    if (!ostree_repo_list_collection_refs (self, NULL, &collection_refs, cancellable, error))
+      return FALSE;
+
+    guint n_refs = g_hash_table_size (refs) + g_hash_table_size (collection_refs);
+    if (n_refs > 0)
+      {
+        /* ~10 bits per element with k=8 keeps the false positive rate
+         * well under 1%, at ~1.25 bytes/ref of summary growth. */
+        gsize n_bytes = MAX (((gsize)n_refs * 10 + 7) / 8, (gsize)32);
+        g_autoptr(OstreeBloom) bloom = ostree_bloom_new (n_bytes, 8, ostree_str_bloom_hash);
+
+        GLNX_HASH_TABLE_FOREACH (refs, const char*, ref)
+          ostree_bloom_add_element (bloom, ref);
+        GLNX_HASH_TABLE_FOREACH (collection_refs, const OstreeCollectionRef*, ref)
+          ostree_bloom_add_element (bloom, ref->ref_name);
+
+        g_autoptr(GBytes) sealed = ostree_bloom_seal (bloom);
+        g_variant_dict_insert_value (&additional_metadata_builder, OSTREE_SUMMARY_REF_BLOOM,
+                                     g_variant_new ("(yy@ay)",
+                                                    (guchar)ostree_bloom_get_k (bloom),
+                                                    (guchar)OSTREE_SUMMARY_REF_BLOOM_HASH_ID,
+                                                    ot_gvariant_new_ay_bytes (sealed)));
+      }
+  }
+
   /* Add refs which have a collection specified. ostree_repo_list_collection_refs()
    * is guaranteed to only return refs which are in refs/mirrors, or those which
    * are in refs/heads if the repository configuration specifies a collection ID
@@ -4805,8 +8045,20 @@ ostree_repo_regenerate_summary (OstreeRepo     *self,
             const char *ref = ref_iter->data;
             const char *commit = g_hash_table_lookup (ref_map, ref);
             GVariantBuilder *builder = is_main_collection_id ? refs_builder : collection_refs_builder;
-
-            if (!summary_add_ref_entry (self, ref, commit, builder, error))
+            SummaryStream *entry_stream = is_main_collection_id ? refs_stream : NULL;
+            GVariant *previous = NULL;
+
+            if (is_main_collection_id)
+              previous = old_main_refs ? g_hash_table_lookup (old_main_refs, ref) : NULL;
+            else if (old_collection_map != NULL)
+              {
+                GHashTable *subtable = g_hash_table_lookup (old_collection_map, collection_id);
+                if (subtable != NULL)
+                  previous = g_hash_table_lookup (subtable, ref);
+              }
+
+            if (!summary_add_ref_entry (self, ref, commit, previous,
+                                        builder, entry_stream, error))
               return FALSE;
 
             if (!is_main_collection_id)
@@ -4828,25 +8080,45 @@ ostree_repo_regenerate_summary (OstreeRepo     *self,
                                    g_variant_builder_end (collection_refs_builder));
   }
 
-  g_autoptr(GVariant) summary = NULL;
-  {
-    g_autoptr(GVariantBuilder) summary_builder =
-      g_variant_builder_new (OSTREE_SUMMARY_GVARIANT_FORMAT);
+  g_autoptr(GVariant) metadata =
+    g_variant_ref_sink (g_variant_dict_end (&additional_metadata_builder));
 
-    g_variant_builder_add_value (summary_builder, g_variant_builder_end (refs_builder));
-    g_variant_builder_add_value (summary_builder, g_variant_dict_end (&additional_metadata_builder));
-    summary = g_variant_builder_end (summary_builder);
-    g_variant_ref_sink (summary);
-  }
+  if (sharded)
+    {
+      g_autoptr(GVariant) summary = NULL;
+      {
+        g_autoptr(GVariantBuilder) summary_builder =
+          g_variant_builder_new (OSTREE_SUMMARY_GVARIANT_FORMAT);
 
-  if (!_ostree_repo_file_replace_contents (self,
-                                           self->repo_dir_fd,
-                                           "summary",
-                                           g_variant_get_data (summary),
-                                           g_variant_get_size (summary),
-                                           cancellable,
-                                           error))
-    return FALSE;
+        g_variant_builder_add_value (summary_builder, g_variant_builder_end (refs_builder));
+        g_variant_builder_add_value (summary_builder, metadata);
+        summary = g_variant_builder_end (summary_builder);
+        g_variant_ref_sink (summary);
+      }
+
+      /* Partition the refs into per-prefix shard files, replacing
+       * @summary with the root summary holding the shard index. */
+      if (!summary_write_shards (self, &summary, cancellable, error))
+        return FALSE;
+
+      if (!_ostree_repo_file_replace_contents (self,
+                                               self->repo_dir_fd,
+                                               "summary",
+                                               g_variant_get_data (summary),
+                                               g_variant_get_size (summary),
+                                               cancellable,
+                                               error))
+        return FALSE;
+    }
+  else
+    {
+      if (!summary_stream_finish (self, &stream, metadata, cancellable, error))
+        return FALSE;
+
+      /* Sharding may have just been disabled */
+      if (!summary_prune_stale_shards (self, NULL, cancellable, error))
+        return FALSE;
+    }
 
   if (unlinkat (self->repo_dir_fd, "summary.sig", 0) < 0)
     {
@@ -4854,6 +8126,19 @@ ostree_repo_regenerate_summary (OstreeRepo     *self,
         return glnx_throw_errno_prefix (error, "unlinkat");
     }
 
+  /* The combined artifact embeds the now-stale signature too */
+  if (unlinkat (self->repo_dir_fd, _OSTREE_SUMMARY_SIGNED_PATH, 0) < 0)
+    {
+      if (errno != ENOENT)
+        return glnx_throw_errno_prefix (error, "unlinkat");
+    }
+
+  /* Also refresh the commit graph; like the summary it's a snapshot
+   * over the current commit set.
+   */
+  if (!_ostree_repo_regenerate_commit_graph (self, cancellable, error))
+    return FALSE;
+
   return TRUE;
 }
 
@@ -5017,7 +8302,10 @@ _ostree_repo_allocate_tmpdir (int tmpdir_dfd,
   return ret;
 }
 
-/* See ostree-repo-private.h for more information about this */
+/* See ostree-repo-private.h for more information about this.  The
+ * metadata cache is now always on and LRU-bounded, so holders need no
+ * special handling; we keep the refcount for debugging.
+ */
 void
 _ostree_repo_memory_cache_ref_init (OstreeRepoMemoryCacheRef *state,
                                     OstreeRepo               *repo)
@@ -5026,10 +8314,7 @@ _ostree_repo_memory_cache_ref_init (OstreeRepoMemoryCacheRef *state,
   GMutex *lock = &repo->cache_lock;
   g_mutex_lock (lock);
   repo->dirmeta_cache_refcount++;
-  if (repo->dirmeta_cache == NULL)
-    repo->dirmeta_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_variant_unref);
   g_mutex_unlock (lock);
-
 }
 
 /* See ostree-repo-private.h for more information about this */
@@ -5040,12 +8325,183 @@ _ostree_repo_memory_cache_ref_destroy (OstreeRepoMemoryCacheRef *state)
   GMutex *lock = &repo->cache_lock;
   g_mutex_lock (lock);
   repo->dirmeta_cache_refcount--;
-  if (repo->dirmeta_cache_refcount == 0)
-    g_clear_pointer (&repo->dirmeta_cache, (GDestroyNotify) g_hash_table_unref);
   g_mutex_unlock (lock);
   g_object_unref (repo);
 }
 
+/* Return a canonical copy of the hex @checksum, owned by @self and
+ * valid for its lifetime.  Tree traversal visits the same checksums
+ * over and over; interning them keeps each distinct 65-byte string in
+ * memory once instead of g_strdup()ing it per node.  Safe to call from
+ * multiple threads.
+ */
+const char *
+_ostree_repo_intern_checksum (OstreeRepo *self,
+                              const char *checksum)
+{
+  g_mutex_lock (&self->interned_checksums_lock);
+  if (self->interned_checksums == NULL)
+    self->interned_checksums = g_string_chunk_new (/* ~64 checksums per chunk */ 4096);
+  const char *ret = g_string_chunk_insert_const (self->interned_checksums, checksum);
+  g_mutex_unlock (&self->interned_checksums_lock);
+  return ret;
+}
+
+/* Ref updates arrive as several filesystem events (tmpfile, rename,
+ * directory change); coalesce them into one signal emission. */
+#define REFS_CHANGED_COALESCE_MS 100
+
+static gboolean
+emit_refs_changed_cb (gpointer user_data)
+{
+  OstreeRepo *self = user_data;
+
+  g_clear_pointer (&self->refs_changed_source, (GDestroyNotify) g_source_unref);
+  g_signal_emit (self, signals[REFS_CHANGED], 0);
+  return G_SOURCE_REMOVE;
+}
+
+static void
+queue_refs_changed (OstreeRepo *self)
+{
+  if (self->refs_changed_source != NULL)
+    return;
+
+  GSource *source = g_timeout_source_new (REFS_CHANGED_COALESCE_MS);
+  g_source_set_callback (source, emit_refs_changed_cb, self, NULL);
+  g_source_set_name (source, "[ostree] refs-changed");
+  g_source_attach (source, self->ref_monitor_context);
+  self->refs_changed_source = source;
+}
+
+static gboolean watch_refs_dir (OstreeRepo    *self,
+                                GFile         *dir,
+                                GCancellable  *cancellable,
+                                GError       **error);
+
+static void
+ref_monitor_changed_cb (GFileMonitor      *monitor,
+                        GFile             *file,
+                        GFile             *other_file,
+                        GFileMonitorEvent  event_type,
+                        gpointer           user_data)
+{
+  OstreeRepo *self = user_data;
+
+  /* A newly created subdirectory (e.g. refs/heads/exampleos for
+   * exampleos/x86_64) needs its own monitor.
+   */
+  if (event_type == G_FILE_MONITOR_EVENT_CREATED
+      && g_file_query_file_type (file, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL) == G_FILE_TYPE_DIRECTORY)
+    (void) watch_refs_dir (self, file, NULL, NULL);
+
+  /* Drop the lazily mapped refs/packed so resolves from the signal
+   * handler see the new state.
+   */
+  g_clear_pointer (&self->packed_refs, (GDestroyNotify) g_variant_unref);
+  self->packed_refs_checked = FALSE;
+
+  queue_refs_changed (self);
+}
+
+static gboolean
+watch_refs_dir (OstreeRepo    *self,
+                GFile         *dir,
+                GCancellable  *cancellable,
+                GError       **error)
+{
+  g_autoptr(GFileMonitor) monitor =
+    g_file_monitor_directory (dir, G_FILE_MONITOR_NONE, cancellable, error);
+  if (monitor == NULL)
+    return FALSE;
+  g_signal_connect (monitor, "changed", G_CALLBACK (ref_monitor_changed_cb), self);
+  g_ptr_array_add (self->ref_monitors, g_steal_pointer (&monitor));
+
+  g_autoptr(GError) temp_error = NULL;
+  g_autoptr(GFileEnumerator) direnum =
+    g_file_enumerate_children (dir, "standard::name,standard::type",
+                               G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                               cancellable, &temp_error);
+  if (direnum == NULL)
+    {
+      /* The directory may have been removed concurrently */
+      if (g_error_matches (temp_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+        return TRUE;
+      g_propagate_error (error, g_steal_pointer (&temp_error));
+      return FALSE;
+    }
+
+  while (TRUE)
+    {
+      GFileInfo *file_info;
+      GFile *child;
+
+      if (!g_file_enumerator_iterate (direnum, &file_info, &child,
+                                      cancellable, error))
+        return FALSE;
+      if (file_info == NULL)
+        break;
+
+      if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_DIRECTORY)
+        {
+          if (!watch_refs_dir (self, child, cancellable, error))
+            return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+/**
+ * ostree_repo_watch_refs:
+ * @self: Repo
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Start watching the repository's refs for changes; whenever a ref is
+ * created, updated or deleted (including via the packed refs file),
+ * the #OstreeRepo::refs-changed signal is emitted.  This lets
+ * long-running services react to ref moves without polling
+ * ostree_repo_resolve_rev() on a timer.
+ *
+ * The signal is emitted from the #GMainContext which is the
+ * thread-default at the time of this call, so that context must be
+ * iterated for notifications to be delivered.  Watching lasts for the
+ * lifetime of @self; calling this again is a no-op.
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 2017.10
+ */
+gboolean
+ostree_repo_watch_refs (OstreeRepo    *self,
+                        GCancellable  *cancellable,
+                        GError       **error)
+{
+  g_return_val_if_fail (self->inited, FALSE);
+
+  if (self->ref_monitors != NULL)
+    return TRUE;
+
+  self->ref_monitors = g_ptr_array_new_with_free_func (g_object_unref);
+  self->ref_monitor_context = g_main_context_ref_thread_default ();
+
+  /* Monitoring the refs dir itself covers the packed refs file as well
+   * as creation of new heads/remotes/mirrors subtrees; the recursion
+   * picks up the existing subdirectories.
+   */
+  g_autoptr(GFile) refsdir = g_file_resolve_relative_path (self->repodir, "refs");
+  if (!watch_refs_dir (self, refsdir, cancellable, error))
+    {
+      for (guint i = 0; i < self->ref_monitors->len; i++)
+        g_file_monitor_cancel (self->ref_monitors->pdata[i]);
+      g_clear_pointer (&self->ref_monitors, g_ptr_array_unref);
+      g_clear_pointer (&self->ref_monitor_context, g_main_context_unref);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
 /**
  * ostree_repo_get_collection_id:
  * @self: an #OstreeRepo
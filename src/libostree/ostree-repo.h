@@ -354,6 +354,13 @@ gboolean      ostree_repo_has_object (OstreeRepo           *self,
                                       GCancellable         *cancellable,
                                       GError              **error);
 
+_OSTREE_PUBLIC
+gboolean      ostree_repo_has_objects_batch (OstreeRepo    *self,
+                                             GPtrArray     *objects,
+                                             GHashTable   **out_found,
+                                             GCancellable  *cancellable,
+                                             GError       **error);
+
 _OSTREE_PUBLIC
 gboolean      ostree_repo_write_metadata (OstreeRepo        *self,
                                           OstreeObjectType   objtype,
@@ -450,6 +457,11 @@ gboolean      ostree_repo_resolve_rev_ext (OstreeRepo                    *self,
                                            char                         **out_rev,
                                            GError                       **error);
 
+_OSTREE_PUBLIC
+gboolean      ostree_repo_watch_refs (OstreeRepo    *self,
+                                      GCancellable  *cancellable,
+                                      GError       **error);
+
 _OSTREE_PUBLIC
 gboolean      ostree_repo_list_refs (OstreeRepo       *self,
                                      const char       *refspec_prefix,
@@ -533,6 +545,15 @@ gboolean      ostree_repo_query_object_storage_size (OstreeRepo           *self,
                                                      GCancellable         *cancellable,
                                                      GError              **error);
 
+_OSTREE_PUBLIC
+gboolean      ostree_repo_get_commit_sizes (OstreeRepo           *self,
+                                            const char           *checksum,
+                                            guint64              *out_total,
+                                            guint64              *out_unique,
+                                            guint64              *out_shared,
+                                            GCancellable         *cancellable,
+                                            GError              **error);
+
 _OSTREE_PUBLIC
 gboolean      ostree_repo_import_object_from (OstreeRepo           *self,
                                               OstreeRepo           *source,
@@ -587,6 +608,8 @@ typedef OstreeRepoCommitFilterResult (*OstreeRepoCommitFilter) (OstreeRepo    *r
  * @OSTREE_REPO_COMMIT_MODIFIER_FLAGS_GENERATE_SIZES: Generate size information.
  * @OSTREE_REPO_COMMIT_MODIFIER_FLAGS_CANONICAL_PERMISSIONS: Canonicalize permissions for bare-user-only mode.
  * @OSTREE_REPO_COMMIT_MODIFIER_FLAGS_ERROR_ON_UNLABELED: Emit an error if configured SELinux policy does not provide a label
+ * @OSTREE_REPO_COMMIT_MODIFIER_FLAGS_PARALLEL_WRITES: Checksum and write content objects on multiple worker threads; the filter and xattr callbacks still run on the calling thread
+ * @OSTREE_REPO_COMMIT_MODIFIER_FLAGS_CONCURRENT_FILTERS: Also evaluate the filter and xattr callbacks for non-directory entries on the worker threads; the callbacks must be thread-safe.  Implies %OSTREE_REPO_COMMIT_MODIFIER_FLAGS_PARALLEL_WRITES
  */
 typedef enum {
   OSTREE_REPO_COMMIT_MODIFIER_FLAGS_NONE = 0,
@@ -594,6 +617,8 @@ typedef enum {
   OSTREE_REPO_COMMIT_MODIFIER_FLAGS_GENERATE_SIZES = (1 << 1),
   OSTREE_REPO_COMMIT_MODIFIER_FLAGS_CANONICAL_PERMISSIONS = (1 << 2),
   OSTREE_REPO_COMMIT_MODIFIER_FLAGS_ERROR_ON_UNLABELED = (1 << 3),
+  OSTREE_REPO_COMMIT_MODIFIER_FLAGS_PARALLEL_WRITES = (1 << 4),
+  OSTREE_REPO_COMMIT_MODIFIER_FLAGS_CONCURRENT_FILTERS = (1 << 5),
 } OstreeRepoCommitModifierFlags;
 
 /**
@@ -699,7 +724,12 @@ gboolean      ostree_repo_import_archive_to_mtree (OstreeRepo
  */
 typedef struct {
   guint disable_xattrs : 1;
-  guint reserved : 31;
+  /* For %OSTREE_REPO_MODE_ARCHIVE_Z2 repos, write each regular file's
+   * stored zlib stream into the archive as-is instead of decompressing
+   * it; consumers must inflate entry payloads themselves.
+   */
+  guint zlib_payloads : 1;
+  guint reserved : 30;
 
   guint64 timestamp_secs;
 
@@ -814,14 +844,16 @@ typedef struct {
   gboolean no_copy_fallback;
   gboolean force_copy; /* Since: 2017.6 */
   gboolean bareuseronly_dirs; /* Since: 2017.7 */
-  gboolean unused_bools[5];
+  gboolean ordered_object_reads; /* Since: 2017.10 */
+  gboolean unused_bools[4];
 
   const char *subpath;
 
   OstreeRepoDevInoCache *devino_to_csum_cache;
 
   int unused_ints[6];
-  gpointer unused_ptrs[5];
+  gpointer unused_ptrs[4];
+  OstreeAsyncProgress *async_progress; /* Since: 2017.10 */
   OstreeSePolicy *sepolicy; /* Since: 2017.6 */
   const char *sepolicy_prefix;
 } OstreeRepoCheckoutAtOptions;
@@ -844,6 +876,22 @@ gboolean ostree_repo_checkout_at (OstreeRepo                         *self,
                                   GCancellable                       *cancellable,
                                   GError                            **error);
 
+_OSTREE_PUBLIC
+void ostree_repo_checkout_at_async (OstreeRepo                         *self,
+                                    OstreeRepoCheckoutAtOptions        *options,
+                                    int                                 destination_dfd,
+                                    const char                         *destination_path,
+                                    const char                         *commit,
+                                    OstreeAsyncProgress                *progress,
+                                    GCancellable                       *cancellable,
+                                    GAsyncReadyCallback                 callback,
+                                    gpointer                            user_data);
+
+_OSTREE_PUBLIC
+gboolean ostree_repo_checkout_at_finish (OstreeRepo                    *self,
+                                         GAsyncResult                  *result,
+                                         GError                       **error);
+
 _OSTREE_PUBLIC
 gboolean       ostree_repo_checkout_gc (OstreeRepo        *self,
                                         GCancellable      *cancellable,
@@ -886,6 +934,33 @@ gboolean ostree_repo_list_objects (OstreeRepo                  *self,
                                    GCancellable                *cancellable,
                                    GError                     **error);
 
+/**
+ * OstreeRepoListObjectsForeachFunc:
+ * @repo: Repository holding the object
+ * @csum: (array fixed-size=32): Binary checksum of the object
+ * @objtype: Object type
+ * @user_data: User data
+ * @error: Error
+ *
+ * Invoked by ostree_repo_list_objects_foreach() for each object.
+ * Return %FALSE with @error set to abort the enumeration.
+ *
+ * Since: 2017.10
+ */
+typedef gboolean (*OstreeRepoListObjectsForeachFunc) (OstreeRepo       *repo,
+                                                      const guchar     *csum,
+                                                      OstreeObjectType  objtype,
+                                                      gpointer          user_data,
+                                                      GError          **error);
+
+_OSTREE_PUBLIC
+gboolean ostree_repo_list_objects_foreach (OstreeRepo                       *self,
+                                           OstreeRepoListObjectsFlags        flags,
+                                           OstreeRepoListObjectsForeachFunc  callback,
+                                           gpointer                          user_data,
+                                           GCancellable                     *cancellable,
+                                           GError                          **error);
+
 _OSTREE_PUBLIC
 gboolean ostree_repo_list_commit_objects_starting_with ( OstreeRepo                  *self,
                                                          const char                  *start,
@@ -1126,6 +1201,20 @@ gboolean ostree_repo_pull_with_options (OstreeRepo             *self,
                                         GCancellable           *cancellable,
                                         GError                **error);
 
+_OSTREE_PUBLIC
+void ostree_repo_pull_with_options_async (OstreeRepo             *self,
+                                          const char             *remote_name_or_baseurl,
+                                          GVariant               *options,
+                                          OstreeAsyncProgress    *progress,
+                                          GCancellable           *cancellable,
+                                          GAsyncReadyCallback     callback,
+                                          gpointer                user_data);
+
+_OSTREE_PUBLIC
+gboolean ostree_repo_pull_with_options_finish (OstreeRepo    *self,
+                                               GAsyncResult  *result,
+                                               GError       **error);
+
 #ifdef OSTREE_ENABLE_EXPERIMENTAL_API
 
 _OSTREE_PUBLIC
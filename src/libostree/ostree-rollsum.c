@@ -29,17 +29,22 @@
 
 #define ROLLSUM_BLOB_MAX (8192*4)
 
-static GHashTable *
-rollsum_chunks_crc32 (GBytes           *bytes)
+/* Compute the bupsplit chunk table of @bytes as a (crc32, start,
+ * length) array ordered by start offset.  The table is a pure function
+ * of the content, which makes it suitable for persisting keyed by
+ * content checksum; see _ostree_compute_rollsum_matches_full().
+ */
+GVariant *
+_ostree_rollsum_chunk_table (GBytes *bytes)
 {
   gsize start = 0;
   gboolean rollsum_end = FALSE;
-  GHashTable *ret_rollsums = NULL;
   const guint8 *buf;
   gsize buflen;
   gsize remaining;
+  GVariantBuilder builder;
 
-  ret_rollsums = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)g_ptr_array_unref);
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(utt)"));
 
   buf = g_bytes_get_data (bytes, &buflen);
 
@@ -50,7 +55,7 @@ rollsum_chunks_crc32 (GBytes           *bytes)
 
       if (!rollsum_end)
         {
-          offset = bupsplit_find_ofs (buf + start, MIN(G_MAXINT32, remaining), &bits); 
+          offset = bupsplit_find_ofs (buf + start, MIN(G_MAXINT32, remaining), &bits);
           if (offset == 0)
             {
               rollsum_end = TRUE;
@@ -64,25 +69,42 @@ rollsum_chunks_crc32 (GBytes           *bytes)
 
       /* Use zlib's crc32 */
       { guint32 crc = crc32 (0L, NULL, 0);
-        GVariant *val;
-        GPtrArray *matches;
-
         crc = crc32 (crc, buf, offset);
-
-        val = g_variant_ref_sink (g_variant_new ("(utt)", crc, (guint64) start, (guint64)offset));
-        matches = g_hash_table_lookup (ret_rollsums, GUINT_TO_POINTER (crc));
-        if (!matches)
-          {
-            matches = g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
-            g_hash_table_insert (ret_rollsums, GUINT_TO_POINTER (crc), matches);
-          }
-        g_ptr_array_add (matches, val);
+        g_variant_builder_add (&builder, "(utt)", crc, (guint64) start, (guint64)offset);
       }
 
       start += offset;
       remaining -= offset;
     }
 
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+static GHashTable *
+rollsum_chunks_from_table (GVariant *chunk_table)
+{
+  GHashTable *ret_rollsums = NULL;
+  const gsize n = g_variant_n_children (chunk_table);
+
+  ret_rollsums = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)g_ptr_array_unref);
+
+  for (gsize i = 0; i < n; i++)
+    {
+      GVariant *val = g_variant_get_child_value (chunk_table, i);
+      guint32 crc;
+      GPtrArray *matches;
+
+      g_variant_get_child (val, 0, "u", &crc);
+
+      matches = g_hash_table_lookup (ret_rollsums, GUINT_TO_POINTER (crc));
+      if (!matches)
+        {
+          matches = g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
+          g_hash_table_insert (ret_rollsums, GUINT_TO_POINTER (crc), matches);
+        }
+      g_ptr_array_add (matches, val);  /* Transfer ownership */
+    }
+
   return ret_rollsums;
 }
 
@@ -106,13 +128,21 @@ compare_matches (const void *app,
   return 1;
 }
 
+/* Like _ostree_compute_rollsum_matches(), but accepts precomputed
+ * chunk tables (from _ostree_rollsum_chunk_table(), possibly loaded
+ * from a cache) for either side; %NULL means compute it here.
+ */
 OstreeRollsumMatches *
-_ostree_compute_rollsum_matches (GBytes                           *from,
-                                 GBytes                           *to)
+_ostree_compute_rollsum_matches_full (GBytes                           *from,
+                                      GBytes                           *to,
+                                      GVariant                         *from_chunk_table,
+                                      GVariant                         *to_chunk_table)
 {
   OstreeRollsumMatches *ret_rollsum = NULL;
   g_autoptr(GHashTable) from_rollsum = NULL;
   g_autoptr(GHashTable) to_rollsum = NULL;
+  g_autoptr(GVariant) local_from_table = NULL;
+  g_autoptr(GVariant) local_to_table = NULL;
   g_autoptr(GPtrArray) matches = NULL;
   const guint8 *from_buf;
   gsize from_len;
@@ -128,8 +158,13 @@ _ostree_compute_rollsum_matches (GBytes                           *from,
   from_buf = g_bytes_get_data (from, &from_len);
   to_buf = g_bytes_get_data (to, &to_len);
 
-  from_rollsum = rollsum_chunks_crc32 (from);
-  to_rollsum = rollsum_chunks_crc32 (to);
+  if (from_chunk_table == NULL)
+    from_chunk_table = local_from_table = _ostree_rollsum_chunk_table (from);
+  if (to_chunk_table == NULL)
+    to_chunk_table = local_to_table = _ostree_rollsum_chunk_table (to);
+
+  from_rollsum = rollsum_chunks_from_table (from_chunk_table);
+  to_rollsum = rollsum_chunks_from_table (to_chunk_table);
 
   g_hash_table_iter_init (&hiter, to_rollsum);
   while (g_hash_table_iter_next (&hiter, &hkey, &hvalue))
@@ -194,6 +229,13 @@ _ostree_compute_rollsum_matches (GBytes                           *from,
   return ret_rollsum;
 }
 
+OstreeRollsumMatches *
+_ostree_compute_rollsum_matches (GBytes                           *from,
+                                 GBytes                           *to)
+{
+  return _ostree_compute_rollsum_matches_full (from, to, NULL, NULL);
+}
+
 void
 _ostree_rollsum_matches_free (OstreeRollsumMatches *rollsum)
 {
@@ -39,6 +39,15 @@ OstreeRollsumMatches *
 _ostree_compute_rollsum_matches (GBytes                           *from,
                                  GBytes                           *to);
 
+GVariant *
+_ostree_rollsum_chunk_table (GBytes                           *bytes);
+
+OstreeRollsumMatches *
+_ostree_compute_rollsum_matches_full (GBytes                           *from,
+                                      GBytes                           *to,
+                                      GVariant                         *from_chunk_table,
+                                      GVariant                         *to_chunk_table);
+
 void _ostree_rollsum_matches_free (OstreeRollsumMatches *rollsum);
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(OstreeRollsumMatches, _ostree_rollsum_matches_free)
 
@@ -40,6 +40,50 @@
  * A #OstreeSePolicy object can load the SELinux policy from a given
  * root and perform labeling.
  */
+
+#ifdef HAVE_SELINUX
+/* A refcounted, process-global compiled file-context database.
+ * Compiling the file-context regexes in selabel_open() costs hundreds
+ * of milliseconds, and a single deploy creates several OstreeSePolicy
+ * objects against the same policy; share one compiled handle, keyed by
+ * policy root and binary-policy checksum so that an OS upgrade
+ * invalidates it.  selabel lookups aren't guaranteed thread-safe, so
+ * the shared handle carries a lock.
+ */
+typedef struct {
+  gint refcount;  /* atomic */
+  GMutex lock;    /* Serializes selabel_lookup_raw() on @hnd */
+  char *policy_rootpath;
+  char *policy_csum;
+  struct selabel_handle *hnd;
+} CompiledPolicyDb;
+
+static GMutex compiled_policy_cache_lock;
+/* A single slot: a process effectively works against one policy root
+ * at a time, and one slot keeps invalidation trivial. */
+static CompiledPolicyDb *compiled_policy_cache;
+
+static CompiledPolicyDb *
+compiled_policy_db_ref (CompiledPolicyDb *db)
+{
+  g_atomic_int_inc (&db->refcount);
+  return db;
+}
+
+static void
+compiled_policy_db_unref (CompiledPolicyDb *db)
+{
+  if (!g_atomic_int_dec_and_test (&db->refcount))
+    return;
+  g_mutex_clear (&db->lock);
+  g_free (db->policy_rootpath);
+  g_free (db->policy_csum);
+  if (db->hnd)
+    selabel_close (db->hnd);
+  g_free (db);
+}
+#endif
+
 struct OstreeSePolicy {
   GObject parent;
 
@@ -49,9 +93,14 @@ struct OstreeSePolicy {
 
 #ifdef HAVE_SELINUX
   GFile *selinux_policy_root;
-  struct selabel_handle *selinux_hnd;
+  CompiledPolicyDb *selabel_db;
+  struct selabel_handle *selinux_hnd; /* Borrowed from selabel_db */
   char *selinux_policy_name;
   char *selinux_policy_csum;
+  /* Lazily created "type:path" → label (or NULL) memoization of
+   * selabel_lookup_raw(), see ostree_sepolicy_get_label().
+   */
+  GHashTable *label_cache;
 #endif
 };
 
@@ -83,11 +132,9 @@ ostree_sepolicy_finalize (GObject *object)
   g_clear_object (&self->selinux_policy_root);
   g_clear_pointer (&self->selinux_policy_name, g_free);
   g_clear_pointer (&self->selinux_policy_csum, g_free);
-  if (self->selinux_hnd)
-    {
-      selabel_close (self->selinux_hnd);
-      self->selinux_hnd = NULL;
-    }
+  g_clear_pointer (&self->label_cache, g_hash_table_unref);
+  self->selinux_hnd = NULL;
+  g_clear_pointer (&self->selabel_db, compiled_policy_db_unref);
 #endif
 
   G_OBJECT_CLASS (ostree_sepolicy_parent_class)->finalize (object);
@@ -371,20 +418,50 @@ initable_init (GInitable     *initable,
       if (selinux_set_policy_root (policy_rootpath) != 0)
         return glnx_throw_errno_prefix (error, "selinux_set_policy_root(%s)", policy_rootpath);
 
-      self->selinux_hnd = selabel_open (SELABEL_CTX_FILE, NULL, 0);
-      if (!self->selinux_hnd)
-        return glnx_throw_errno_prefix (error, "With policy root '%s': selabel_open(SELABEL_CTX_FILE)",
-                                        policy_rootpath);
-
-      char *con = NULL;
-      if (selabel_lookup_raw (self->selinux_hnd, &con, "/", 0755) != 0)
-        return glnx_throw_errno_prefix (error, "With policy root '%s': Failed to look up context of /",
-                                        policy_rootpath);
-      freecon (con);
-
       if (!get_policy_checksum (&self->selinux_policy_csum, cancellable, error))
         return glnx_prefix_error (error, "While calculating SELinux checksum");
 
+      /* Reuse the compiled database if this policy was already loaded
+       * by this process. */
+      g_mutex_lock (&compiled_policy_cache_lock);
+      if (compiled_policy_cache != NULL
+          && g_str_equal (compiled_policy_cache->policy_rootpath, policy_rootpath)
+          && g_str_equal (compiled_policy_cache->policy_csum, self->selinux_policy_csum))
+        self->selabel_db = compiled_policy_db_ref (compiled_policy_cache);
+      g_mutex_unlock (&compiled_policy_cache_lock);
+
+      if (self->selabel_db == NULL)
+        {
+          struct selabel_handle *hnd = selabel_open (SELABEL_CTX_FILE, NULL, 0);
+          if (!hnd)
+            return glnx_throw_errno_prefix (error, "With policy root '%s': selabel_open(SELABEL_CTX_FILE)",
+                                            policy_rootpath);
+
+          char *con = NULL;
+          if (selabel_lookup_raw (hnd, &con, "/", 0755) != 0)
+            {
+              selabel_close (hnd);
+              return glnx_throw_errno_prefix (error, "With policy root '%s': Failed to look up context of /",
+                                              policy_rootpath);
+            }
+          freecon (con);
+
+          CompiledPolicyDb *db = g_new0 (CompiledPolicyDb, 1);
+          db->refcount = 1;
+          g_mutex_init (&db->lock);
+          db->policy_rootpath = g_strdup (policy_rootpath);
+          db->policy_csum = g_strdup (self->selinux_policy_csum);
+          db->hnd = hnd;
+          self->selabel_db = db;
+
+          g_mutex_lock (&compiled_policy_cache_lock);
+          if (compiled_policy_cache != NULL)
+            compiled_policy_db_unref (compiled_policy_cache);
+          compiled_policy_cache = compiled_policy_db_ref (db);
+          g_mutex_unlock (&compiled_policy_cache_lock);
+        }
+
+      self->selinux_hnd = self->selabel_db->hnd;
       self->selinux_policy_name = g_steal_pointer (&policytype);
       self->selinux_policy_root = g_object_ref (etc_selinux_dir);
     }
@@ -514,14 +591,40 @@ ostree_sepolicy_get_label (OstreeSePolicy    *self,
   if (strcmp (relpath, "/proc") == 0)
     relpath = "/mnt";
 
+  /* For a loaded policy the label is a pure function of (path, file
+   * type), and the same paths recur heavily across the checkout and
+   * deploy labeling passes, so memoize the selabel_lookup_raw()
+   * results; the regex matching it does dominates labeling time.
+   */
+  if (self->label_cache == NULL)
+    self->label_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                               g_free, g_free);
+
+  g_autofree char *cache_key =
+    g_strdup_printf ("%u:%s", (guint32)(unix_mode & S_IFMT), relpath);
+  gpointer cached_label = NULL;
+  if (g_hash_table_lookup_extended (self->label_cache, cache_key,
+                                    NULL, &cached_label))
+    {
+      /* A cached %NULL records "policy specifies no label" */
+      *out_label = g_strdup (cached_label);
+      return TRUE;
+    }
+
   char *con = NULL;
+  g_mutex_lock (&self->selabel_db->lock);
   int res = selabel_lookup_raw (self->selinux_hnd, &con, relpath, unix_mode);
+  int lookup_errno = errno;
+  g_mutex_unlock (&self->selabel_db->lock);
   if (res != 0)
     {
-      if (errno == ENOENT)
+      if (lookup_errno == ENOENT)
         *out_label = NULL;
       else
-        return glnx_throw_errno (error);
+        {
+          errno = lookup_errno;
+          return glnx_throw_errno (error);
+        }
     }
   else
     {
@@ -530,6 +633,12 @@ ostree_sepolicy_get_label (OstreeSePolicy    *self,
       freecon (con);
     }
 
+  /* Paranoid bound; flushing wholesale keeps the code trivial */
+  if (g_hash_table_size (self->label_cache) >= 65536)
+    g_hash_table_remove_all (self->label_cache);
+  g_hash_table_replace (self->label_cache, g_steal_pointer (&cache_key),
+                        g_strdup (*out_label));
+
 #endif
   return TRUE;
 }
@@ -245,6 +245,189 @@ cleanup_other_bootversions (OstreeSysroot       *self,
   return ret;
 }
 
+/* One stale deployment checkout to remove, along with its origin file. */
+typedef struct {
+  char *deployment_path;
+  char *origin_relpath;
+} RemoveDeploymentJob;
+
+static void
+remove_deployment_job_free (RemoveDeploymentJob *job)
+{
+  g_free (job->deployment_path);
+  g_free (job->origin_relpath);
+  g_free (job);
+}
+
+/* Shared state for one parallel stale-deployment removal batch. */
+typedef struct {
+  OstreeSysroot *sysroot;
+  struct stat root_stbuf;
+  GCancellable *cancellable;
+  GMutex lock;
+  GCond cond;
+  guint jobs_pending; /* protected by lock */
+  GError *error; /* first failure, protected by lock */
+} RemoveDeploymentsContext;
+
+static gboolean
+remove_stale_deployment (OstreeSysroot      *self,
+                         const struct stat  *root_stbuf,
+                         const char         *deployment_path,
+                         const char         *origin_relpath,
+                         GCancellable       *cancellable,
+                         GError            **error)
+{
+  struct stat stbuf;
+  glnx_fd_close int deployment_fd = -1;
+
+  if (!glnx_opendirat (self->sysroot_fd, deployment_path, TRUE,
+                       &deployment_fd, error))
+    return FALSE;
+
+  if (fstat (deployment_fd, &stbuf) != 0)
+    {
+      glnx_set_error_from_errno (error);
+      return FALSE;
+    }
+
+  /* This shouldn't happen, because higher levels should
+   * disallow having the booted deployment not in the active
+   * deployment list, but let's be extra safe. */
+  if (stbuf.st_dev == root_stbuf->st_dev &&
+      stbuf.st_ino == root_stbuf->st_ino)
+    return TRUE;
+
+  if (!_ostree_linuxfs_fd_alter_immutable_flag (deployment_fd, FALSE,
+                                                cancellable, error))
+    return FALSE;
+
+  if (!glnx_shutil_rm_rf_at (self->sysroot_fd, deployment_path, cancellable, error))
+    return FALSE;
+  if (!glnx_shutil_rm_rf_at (self->sysroot_fd, origin_relpath, cancellable, error))
+    return FALSE;
+
+  /* Also remove the readahead pack and /etc change journal sidecars, if any */
+  if (g_str_has_suffix (origin_relpath, ".origin"))
+    {
+      g_autofree char *base = g_strndup (origin_relpath,
+                                         strlen (origin_relpath) - strlen (".origin"));
+      g_autofree char *readahead_relpath = g_strconcat (base, ".readahead", NULL);
+      if (!glnx_shutil_rm_rf_at (self->sysroot_fd, readahead_relpath, cancellable, error))
+        return FALSE;
+      g_autofree char *etc_journal_relpath = g_strconcat (base, ".etc-journal", NULL);
+      if (!glnx_shutil_rm_rf_at (self->sysroot_fd, etc_journal_relpath, cancellable, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+remove_deployments_worker (gpointer data,
+                           gpointer user_data)
+{
+  RemoveDeploymentJob *job = data;
+  RemoveDeploymentsContext *ctx = user_data;
+  gboolean failed;
+  g_autoptr(GError) local_error = NULL;
+
+  /* After the first failure, just drain the queue */
+  g_mutex_lock (&ctx->lock);
+  failed = (ctx->error != NULL);
+  g_mutex_unlock (&ctx->lock);
+
+  if (!failed &&
+      !remove_stale_deployment (ctx->sysroot, &ctx->root_stbuf,
+                                job->deployment_path, job->origin_relpath,
+                                ctx->cancellable, &local_error))
+    {
+      g_mutex_lock (&ctx->lock);
+      if (ctx->error == NULL)
+        ctx->error = g_steal_pointer (&local_error);
+      g_mutex_unlock (&ctx->lock);
+    }
+
+  g_mutex_lock (&ctx->lock);
+  ctx->jobs_pending--;
+  if (ctx->jobs_pending == 0)
+    g_cond_signal (&ctx->cond);
+  g_mutex_unlock (&ctx->lock);
+}
+
+/* Remove stale deployment checkouts in parallel unlink batches.  Each
+ * checkout is an independent subtree under ostree/deploy, so the removals
+ * can proceed concurrently, which helps considerably on slow flash where a
+ * single rm -rf is latency-bound.  Parallelism is best-effort; with a
+ * single job or if pool creation fails we just run serially.
+ */
+static gboolean
+remove_stale_deployments (OstreeSysroot      *self,
+                          const struct stat  *root_stbuf,
+                          GPtrArray          *jobs,
+                          GCancellable       *cancellable,
+                          GError            **error)
+{
+  if (jobs->len == 0)
+    return TRUE;
+
+  const guint n_threads = MIN (jobs->len, g_get_num_processors ());
+  if (n_threads > 1)
+    {
+      RemoveDeploymentsContext ctx = { 0, };
+      GThreadPool *pool;
+
+      ctx.sysroot = self;
+      ctx.root_stbuf = *root_stbuf;
+      ctx.cancellable = cancellable;
+      g_mutex_init (&ctx.lock);
+      g_cond_init (&ctx.cond);
+
+      pool = g_thread_pool_new (remove_deployments_worker, &ctx, n_threads, FALSE, NULL);
+      if (pool != NULL)
+        {
+          ctx.jobs_pending = jobs->len;
+          for (guint i = 0; i < jobs->len; i++)
+            {
+              if (!g_thread_pool_push (pool, jobs->pdata[i], NULL))
+                /* Run inline so jobs_pending still reaches zero */
+                remove_deployments_worker (jobs->pdata[i], &ctx);
+            }
+
+          g_mutex_lock (&ctx.lock);
+          while (ctx.jobs_pending > 0)
+            g_cond_wait (&ctx.cond, &ctx.lock);
+          g_mutex_unlock (&ctx.lock);
+          g_thread_pool_free (pool, FALSE, TRUE);
+        }
+
+      g_mutex_clear (&ctx.lock);
+      g_cond_clear (&ctx.cond);
+
+      if (pool != NULL)
+        {
+          if (ctx.error != NULL)
+            {
+              g_propagate_error (error, g_steal_pointer (&ctx.error));
+              return FALSE;
+            }
+          return TRUE;
+        }
+      /* Pool creation failed; fall through to the serial path */
+    }
+
+  for (guint i = 0; i < jobs->len; i++)
+    {
+      RemoveDeploymentJob *job = jobs->pdata[i];
+
+      if (!remove_stale_deployment (self, root_stbuf, job->deployment_path,
+                                    job->origin_relpath, cancellable, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
 static gboolean
 cleanup_old_deployments (OstreeSysroot       *self,
                          GCancellable        *cancellable,
@@ -281,44 +464,29 @@ cleanup_old_deployments (OstreeSysroot       *self,
                                         cancellable, error))
     goto out;
   
-  for (i = 0; i < all_deployment_dirs->len; i++)
-    {
-      OstreeDeployment *deployment = all_deployment_dirs->pdata[i];
-      g_autofree char *deployment_path = ostree_sysroot_get_deployment_dirpath (self, deployment);
-      g_autofree char *origin_relpath = ostree_deployment_get_origin_relpath (deployment);
-
-      if (!g_hash_table_lookup (active_deployment_dirs, deployment_path))
-        {
-          struct stat stbuf;
-          glnx_fd_close int deployment_fd = -1;
-
-          if (!glnx_opendirat (self->sysroot_fd, deployment_path, TRUE,
-                               &deployment_fd, error))
-            goto out;
-
-          if (fstat (deployment_fd, &stbuf) != 0)
-            {
-              glnx_set_error_from_errno (error);
-              goto out;
-            }
-
-          /* This shouldn't happen, because higher levels should
-           * disallow having the booted deployment not in the active
-           * deployment list, but let's be extra safe. */
-          if (stbuf.st_dev == root_stbuf.st_dev &&
-              stbuf.st_ino == root_stbuf.st_ino)
-            continue;
-
-          if (!_ostree_linuxfs_fd_alter_immutable_flag (deployment_fd, FALSE,
-                                                        cancellable, error))
-            goto out;
-          
-          if (!glnx_shutil_rm_rf_at (self->sysroot_fd, deployment_path, cancellable, error))
-            goto out;
-          if (!glnx_shutil_rm_rf_at (self->sysroot_fd, origin_relpath, cancellable, error))
-            goto out;
-        }
-    }
+  {
+    g_autoptr(GPtrArray) stale_deployments =
+      g_ptr_array_new_with_free_func ((GDestroyNotify)remove_deployment_job_free);
+
+    for (i = 0; i < all_deployment_dirs->len; i++)
+      {
+        OstreeDeployment *deployment = all_deployment_dirs->pdata[i];
+        g_autofree char *deployment_path = ostree_sysroot_get_deployment_dirpath (self, deployment);
+        g_autofree char *origin_relpath = ostree_deployment_get_origin_relpath (deployment);
+
+        if (!g_hash_table_lookup (active_deployment_dirs, deployment_path))
+          {
+            RemoveDeploymentJob *job = g_new0 (RemoveDeploymentJob, 1);
+            job->deployment_path = g_steal_pointer (&deployment_path);
+            job->origin_relpath = g_steal_pointer (&origin_relpath);
+            g_ptr_array_add (stale_deployments, job);
+          }
+      }
+
+    if (!remove_stale_deployments (self, &root_stbuf, stale_deployments,
+                                   cancellable, error))
+      goto out;
+  }
 
   if (!list_all_boot_directories (self, &all_boot_dirs,
                                   cancellable, error))
@@ -495,6 +663,34 @@ ostree_sysroot_prepare_cleanup (OstreeSysroot  *self,
   return _ostree_sysroot_cleanup_internal (self, FALSE, cancellable, error);
 }
 
+/**
+ * ostree_sysroot_cleanup_prune_repo:
+ * @self: Sysroot
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Prune the sysroot repository, deleting objects no longer referenced
+ * by any deployment.  This is the expensive half of
+ * ostree_sysroot_cleanup(); callers that want deploys to complete
+ * quickly can run ostree_sysroot_prepare_cleanup() eagerly and defer
+ * this to an idle moment.
+ *
+ * Since: 2017.10
+ */
+gboolean
+ostree_sysroot_cleanup_prune_repo (OstreeSysroot  *self,
+                                   GCancellable   *cancellable,
+                                   GError        **error)
+{
+  g_return_val_if_fail (OSTREE_IS_SYSROOT (self), FALSE);
+  g_return_val_if_fail (self->loaded, FALSE);
+
+  if (!prune_repo (ostree_sysroot_repo (self), cancellable, error))
+    return glnx_prefix_error (error, "Pruning repo");
+
+  return TRUE;
+}
+
 gboolean
 _ostree_sysroot_cleanup_internal (OstreeSysroot              *self,
                                   gboolean                    do_prune_repo,
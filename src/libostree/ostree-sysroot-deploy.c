@@ -24,6 +24,8 @@
 #include <gio/gunixoutputstream.h>
 #include <sys/mount.h>
 #include <sys/statvfs.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
 
 #ifdef HAVE_LIBMOUNT
 #include <libmount.h>
@@ -87,6 +89,103 @@ sysroot_flags_to_copy_flags (GLnxFileCopyFlags defaults,
   return defaults;
 }
 
+static gboolean
+dirfd_copy_attributes_and_xattrs (int            src_parent_dfd,
+                                  const char    *src_name,
+                                  int            src_dfd,
+                                  int            dest_dfd,
+                                  OstreeSysrootDebugFlags flags,
+                                  GCancellable  *cancellable,
+                                  GError       **error);
+
+#ifndef FICLONE
+#define FICLONE _IOW (0x94, 9, int)
+#endif
+
+/* Copy @src_subpath to a freshly created @dest_subpath, preferring a
+ * reflink (FICLONE) and then in-kernel copy_file_range() over pumping
+ * the data through userspace; kernel+initramfs images run to ~100MB.
+ * If neither is supported, @out_supported is set to %FALSE and the
+ * destination is removed so the caller can fall back.
+ */
+static gboolean
+clone_or_splice_file_at (int         src_dfd,
+                         const char *src_subpath,
+                         int         dest_dfd,
+                         const char *dest_subpath,
+                         OstreeSysrootDebugFlags flags,
+                         gboolean   *out_supported,
+                         GCancellable  *cancellable,
+                         GError       **error)
+{
+  glnx_fd_close int src_fd = -1;
+  glnx_fd_close int dest_fd = -1;
+  struct stat stbuf;
+  gboolean copied = FALSE;
+
+  *out_supported = FALSE;
+
+  if (!glnx_openat_rdonly (src_dfd, src_subpath, FALSE, &src_fd, error))
+    return FALSE;
+  if (!glnx_fstat (src_fd, &stbuf, error))
+    return FALSE;
+
+  dest_fd = openat (dest_dfd, dest_subpath,
+                    O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+  if (dest_fd < 0)
+    return glnx_throw_errno_prefix (error, "openat(%s)", dest_subpath);
+
+  if (ioctl (dest_fd, FICLONE, src_fd) == 0)
+    copied = TRUE;
+#ifdef __NR_copy_file_range
+  else
+    {
+      guint64 remaining = stbuf.st_size;
+      copied = TRUE;
+      while (remaining > 0)
+        {
+          ssize_t n = syscall (__NR_copy_file_range, src_fd, NULL, dest_fd, NULL,
+                               (size_t)remaining, 0);
+          if (n < 0)
+            {
+              if (remaining == (guint64)stbuf.st_size &&
+                  G_IN_SET (errno, ENOSYS, EXDEV, EOPNOTSUPP, EINVAL, EBADF))
+                {
+                  /* Nothing written yet; let the caller fall back */
+                  copied = FALSE;
+                  break;
+                }
+              (void) glnx_throw_errno_prefix (error, "copy_file_range(%s)", dest_subpath);
+              goto err;
+            }
+          if (n == 0)
+            break;
+          remaining -= n;
+          if (g_cancellable_set_error_if_cancelled (cancellable, error))
+            goto err;
+        }
+    }
+#endif
+
+  if (!copied)
+    {
+      (void) unlinkat (dest_dfd, dest_subpath, 0);
+      return TRUE;
+    }
+
+  if (!dirfd_copy_attributes_and_xattrs (src_dfd, src_subpath, src_fd, dest_fd,
+                                         flags, cancellable, error))
+    goto err;
+
+  *out_supported = TRUE;
+  return TRUE;
+
+ err:
+  /* Don't leave a partial image behind looking like a completed copy */
+  (void) unlinkat (dest_dfd, dest_subpath, 0);
+  return FALSE;
+}
+
 /* Try a hardlink if we can, otherwise fall back to copying.  Used
  * right now for kernels/initramfs in /boot, where we can just
  * hardlink if we're on the same partition.
@@ -103,9 +202,17 @@ hardlink_or_copy_at (int         src_dfd,
   if (linkat (src_dfd, src_subpath, dest_dfd, dest_subpath, 0) != 0)
     {
       if (G_IN_SET (errno, EMLINK, EXDEV))
-        return glnx_file_copy_at (src_dfd, src_subpath, NULL, dest_dfd, dest_subpath,
-                                  sysroot_flags_to_copy_flags (0, flags),
-                                  cancellable, error);
+        {
+          gboolean clone_supported;
+          if (!clone_or_splice_file_at (src_dfd, src_subpath, dest_dfd, dest_subpath,
+                                        flags, &clone_supported, cancellable, error))
+            return FALSE;
+          if (clone_supported)
+            return TRUE;
+          return glnx_file_copy_at (src_dfd, src_subpath, NULL, dest_dfd, dest_subpath,
+                                    sysroot_flags_to_copy_flags (0, flags),
+                                    cancellable, error);
+        }
       else
         return glnx_throw_errno_prefix (error, "linkat");
     }
@@ -360,6 +467,450 @@ copy_modified_config_file (int                 orig_etc_fd,
   return TRUE;
 }
 
+#define ETC_JOURNAL_VERSION 1
+/* Format: version, then a sorted (path, mode, size, mtime-sec,
+ * mtime-nsec) snapshot of every entry in the deployment's `/etc` as it
+ * looked when the deployment was created, then the paths that differed
+ * from `/usr/etc` at that point and the paths deleted relative to it.
+ */
+#define ETC_JOURNAL_GVARIANT_STRING "(ua(suttu)asas)"
+#define ETC_JOURNAL_GVARIANT_FORMAT G_VARIANT_TYPE (ETC_JOURNAL_GVARIANT_STRING)
+
+typedef struct {
+  guint32 mode;
+  guint64 size;
+  guint64 mtime_sec;
+  guint32 mtime_nsec;
+  gboolean seen;  /* Scratch space for etc_journal_compute_diff() */
+} EtcJournalEntry;
+
+/* The journal lives next to the deployment's origin file */
+static char *
+get_etc_journal_relpath (OstreeDeployment *deployment)
+{
+  return g_strdup_printf ("ostree/deploy/%s/deploy/%s.%d.etc-journal",
+                          ostree_deployment_get_osname (deployment),
+                          ostree_deployment_get_csum (deployment),
+                          ostree_deployment_get_deployserial (deployment));
+}
+
+static int
+compare_path_ptrs (gconstpointer a,
+                   gconstpointer b)
+{
+  return strcmp (*(const char *const*)a, *(const char *const*)b);
+}
+
+/* Recursively stat every entry under @etc_fd/@prefix into @entries,
+ * keyed by relative path.  This is a pure readdir()+fstatat() walk; no
+ * file contents are read.
+ */
+static gboolean
+etc_journal_scan (int            etc_fd,
+                  const char    *prefix,
+                  GHashTable    *entries,
+                  GCancellable  *cancellable,
+                  GError       **error)
+{
+  g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
+
+  if (!glnx_dirfd_iterator_init_at (etc_fd, prefix ? prefix : ".", FALSE,
+                                    &dfd_iter, error))
+    return FALSE;
+
+  while (TRUE)
+    {
+      struct dirent *dent;
+      struct stat stbuf;
+
+      if (!glnx_dirfd_iterator_next_dent (&dfd_iter, &dent, cancellable, error))
+        return FALSE;
+      if (dent == NULL)
+        break;
+
+      if (!glnx_fstatat (dfd_iter.fd, dent->d_name, &stbuf, AT_SYMLINK_NOFOLLOW, error))
+        return FALSE;
+
+      char *path = prefix ? g_strconcat (prefix, "/", dent->d_name, NULL)
+                          : g_strdup (dent->d_name);
+      EtcJournalEntry *ent = g_new0 (EtcJournalEntry, 1);
+      ent->mode = stbuf.st_mode;
+      ent->size = stbuf.st_size;
+      ent->mtime_sec = stbuf.st_mtim.tv_sec;
+      ent->mtime_nsec = stbuf.st_mtim.tv_nsec;
+      g_hash_table_replace (entries, path, ent);
+
+      if (S_ISDIR (stbuf.st_mode))
+        {
+          if (!etc_journal_scan (etc_fd, path, entries, cancellable, error))
+            return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+/* Snapshot the state of @deployment's `/etc` along with the merge
+ * result that produced it (@modified_paths/@removed_paths/@added_paths
+ * may be %NULL for a pristine checkout), so that the next merge against
+ * this deployment can limit itself to entries that changed since.
+ */
+static gboolean
+write_etc_journal (OstreeSysroot     *sysroot,
+                   OstreeDeployment  *deployment,
+                   int                deployment_dfd,
+                   GPtrArray         *modified_paths,
+                   GPtrArray         *removed_paths,
+                   GPtrArray         *added_paths,
+                   GCancellable      *cancellable,
+                   GError           **error)
+{
+  if (sysroot->debug_flags & OSTREE_SYSROOT_DEBUG_NO_ETC_JOURNAL)
+    return TRUE;
+
+  glnx_fd_close int etc_fd = -1;
+  if (!glnx_opendirat (deployment_dfd, "etc", TRUE, &etc_fd, error))
+    return FALSE;
+
+  g_autoptr(GHashTable) entries =
+    g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  if (!etc_journal_scan (etc_fd, NULL, entries, cancellable, error))
+    return FALSE;
+
+  g_autoptr(GPtrArray) sorted_paths = g_ptr_array_new ();
+  GHashTableIter hashiter;
+  gpointer hashkey;
+  g_hash_table_iter_init (&hashiter, entries);
+  while (g_hash_table_iter_next (&hashiter, &hashkey, NULL))
+    g_ptr_array_add (sorted_paths, hashkey);
+  g_ptr_array_sort (sorted_paths, compare_path_ptrs);
+
+  GVariantBuilder entry_builder;
+  g_variant_builder_init (&entry_builder, G_VARIANT_TYPE ("a(suttu)"));
+  for (guint i = 0; i < sorted_paths->len; i++)
+    {
+      const char *path = sorted_paths->pdata[i];
+      EtcJournalEntry *ent = g_hash_table_lookup (entries, path);
+      g_variant_builder_add (&entry_builder, "(suttu)", path,
+                             ent->mode, ent->size, ent->mtime_sec, ent->mtime_nsec);
+    }
+
+  g_autoptr(GPtrArray) drifted = g_ptr_array_new ();
+  for (guint i = 0; modified_paths != NULL && i < modified_paths->len; i++)
+    g_ptr_array_add (drifted, modified_paths->pdata[i]);
+  for (guint i = 0; added_paths != NULL && i < added_paths->len; i++)
+    g_ptr_array_add (drifted, added_paths->pdata[i]);
+  g_ptr_array_sort (drifted, compare_path_ptrs);
+
+  g_autoptr(GPtrArray) deleted = g_ptr_array_new ();
+  for (guint i = 0; removed_paths != NULL && i < removed_paths->len; i++)
+    g_ptr_array_add (deleted, removed_paths->pdata[i]);
+  g_ptr_array_sort (deleted, compare_path_ptrs);
+
+  GVariantBuilder drifted_builder;
+  g_variant_builder_init (&drifted_builder, G_VARIANT_TYPE ("as"));
+  for (guint i = 0; i < drifted->len; i++)
+    g_variant_builder_add (&drifted_builder, "s", (const char*)drifted->pdata[i]);
+  GVariantBuilder deleted_builder;
+  g_variant_builder_init (&deleted_builder, G_VARIANT_TYPE ("as"));
+  for (guint i = 0; i < deleted->len; i++)
+    g_variant_builder_add (&deleted_builder, "s", (const char*)deleted->pdata[i]);
+
+  g_autoptr(GVariant) journal =
+    g_variant_ref_sink (g_variant_new ("(u@a(suttu)@as@as)",
+                                       (guint32)ETC_JOURNAL_VERSION,
+                                       g_variant_builder_end (&entry_builder),
+                                       g_variant_builder_end (&drifted_builder),
+                                       g_variant_builder_end (&deleted_builder)));
+
+  /* Don't fsync here; like the origin file we assume that's done in
+   * ostree_sysroot_write_deployments().
+   */
+  g_autofree char *journal_relpath = get_etc_journal_relpath (deployment);
+  if (!glnx_file_replace_contents_at (sysroot->sysroot_fd, journal_relpath,
+                                      g_variant_get_data (journal),
+                                      g_variant_get_size (journal),
+                                      GLNX_FILE_REPLACE_NODATASYNC,
+                                      cancellable, error))
+    return FALSE;
+
+  return TRUE;
+}
+
+/* Returns the change journal for @merge_deployment, or %NULL if there
+ * isn't a usable one.  The journal is just a cache of state derivable
+ * from the deployment itself, so missing or unparseable content simply
+ * means the caller does a full tree diff.
+ */
+static GVariant *
+load_etc_journal (OstreeSysroot    *sysroot,
+                  OstreeDeployment *merge_deployment)
+{
+  if (sysroot->debug_flags & OSTREE_SYSROOT_DEBUG_NO_ETC_JOURNAL)
+    return NULL;
+
+  g_autofree char *journal_relpath = get_etc_journal_relpath (merge_deployment);
+  glnx_fd_close int fd = -1;
+  if (!ot_openat_ignore_enoent (sysroot->sysroot_fd, journal_relpath, &fd, NULL))
+    return NULL;
+  if (fd == -1)
+    return NULL;
+
+  g_autoptr(GVariant) journal = NULL;
+  if (!ot_util_variant_map_fd (fd, 0, ETC_JOURNAL_GVARIANT_FORMAT, FALSE,
+                               &journal, NULL))
+    return NULL;
+
+  guint32 version;
+  g_variant_get_child (journal, 0, "u", &version);
+  if (version != ETC_JOURNAL_VERSION)
+    return NULL;
+
+  return g_steal_pointer (&journal);
+}
+
+/* Determine how each of the (sorted, possibly duplicated) @candidates
+ * relates to `/usr/etc`, appending to the merge result arrays.  This
+ * mirrors the classification ostree_diff_dirs() would make, except that
+ * files present on both sides are conservatively treated as modified
+ * without comparing content; re-copying an identical file is far
+ * cheaper than checksumming the whole tree to find out.
+ */
+static gboolean
+etc_journal_classify_paths (int         orig_etc_fd,
+                            int         modified_etc_fd,
+                            GPtrArray  *candidates,
+                            GPtrArray  *modified_paths,
+                            GPtrArray  *removed_paths,
+                            GPtrArray  *added_paths,
+                            GError    **error)
+{
+  g_autofree char *skip_prefix = NULL;
+  const char *prev = NULL;
+
+  for (guint i = 0; i < candidates->len; i++)
+    {
+      const char *path = candidates->pdata[i];
+      struct stat orig_stbuf, modified_stbuf;
+      gboolean have_orig = TRUE, have_modified = TRUE;
+
+      if (prev != NULL && strcmp (path, prev) == 0)
+        continue;
+      prev = path;
+      /* Children of a directory handled recursively below */
+      if (skip_prefix != NULL && g_str_has_prefix (path, skip_prefix))
+        continue;
+
+      if (fstatat (modified_etc_fd, path, &modified_stbuf, AT_SYMLINK_NOFOLLOW) < 0)
+        {
+          if (errno != ENOENT)
+            return glnx_throw_errno_prefix (error, "fstatat(%s)", path);
+          have_modified = FALSE;
+        }
+      if (fstatat (orig_etc_fd, path, &orig_stbuf, AT_SYMLINK_NOFOLLOW) < 0)
+        {
+          if (errno != ENOENT)
+            return glnx_throw_errno_prefix (error, "fstatat(%s)", path);
+          have_orig = FALSE;
+        }
+
+      if (!have_modified && !have_orig)
+        continue;
+      else if (!have_modified)
+        {
+          g_ptr_array_add (removed_paths, g_strdup (path));
+          if (S_ISDIR (orig_stbuf.st_mode))
+            {
+              g_free (skip_prefix);
+              skip_prefix = g_strconcat (path, "/", NULL);
+            }
+        }
+      else if (!have_orig)
+        {
+          g_ptr_array_add (added_paths, g_strdup (path));
+          if (S_ISDIR (modified_stbuf.st_mode))
+            {
+              g_free (skip_prefix);
+              skip_prefix = g_strconcat (path, "/", NULL);
+            }
+        }
+      else if (S_ISDIR (modified_stbuf.st_mode) && S_ISDIR (orig_stbuf.st_mode))
+        ;  /* Directory on both sides; its children are tracked individually */
+      else
+        g_ptr_array_add (modified_paths, g_strdup (path));
+    }
+
+  return TRUE;
+}
+
+/* Compute the `/usr/etc` → `/etc` difference using @journal: a single
+ * stat walk of the current `/etc` finds what changed since the journal
+ * was written, and together with the drift the journal already records
+ * that bounds the set of paths whose merge disposition can have
+ * changed.  Only those are then compared against `/usr/etc`, making the
+ * merge proportional to configuration drift rather than to the size of
+ * `/etc`.
+ */
+static gboolean
+etc_journal_compute_diff (GVariant      *journal,
+                          int            orig_etc_fd,
+                          int            modified_etc_fd,
+                          GPtrArray     *modified_paths,
+                          GPtrArray     *removed_paths,
+                          GPtrArray     *added_paths,
+                          GCancellable  *cancellable,
+                          GError       **error)
+{
+  g_autoptr(GHashTable) current =
+    g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  if (!etc_journal_scan (modified_etc_fd, NULL, current, cancellable, error))
+    return FALSE;
+
+  g_autoptr(GPtrArray) candidates = g_ptr_array_new_with_free_func (g_free);
+
+  g_autoptr(GVariant) snapshot = g_variant_get_child_value (journal, 1);
+  const gsize n_snapshot = g_variant_n_children (snapshot);
+  for (gsize i = 0; i < n_snapshot; i++)
+    {
+      const char *path;
+      guint32 mode, mtime_nsec;
+      guint64 size, mtime_sec;
+      g_variant_get_child (snapshot, i, "(&suttu)", &path, &mode, &size,
+                           &mtime_sec, &mtime_nsec);
+
+      EtcJournalEntry *ent = g_hash_table_lookup (current, path);
+      if (ent == NULL)
+        {
+          /* Deleted since the journal was written */
+          g_ptr_array_add (candidates, g_strdup (path));
+        }
+      else
+        {
+          ent->seen = TRUE;
+          if (ent->mode != mode || ent->size != size
+              || ent->mtime_sec != mtime_sec || ent->mtime_nsec != mtime_nsec)
+            g_ptr_array_add (candidates, g_strdup (path));
+        }
+    }
+
+  /* Created since the journal was written */
+  GHashTableIter hashiter;
+  gpointer hashkey, hashvalue;
+  g_hash_table_iter_init (&hashiter, current);
+  while (g_hash_table_iter_next (&hashiter, &hashkey, &hashvalue))
+    {
+      EtcJournalEntry *ent = hashvalue;
+      if (!ent->seen)
+        g_ptr_array_add (candidates, g_strdup (hashkey));
+    }
+
+  /* Paths that had already diverged from /usr/etc when the journal was
+   * written remain part of the merge.
+   */
+  g_autoptr(GVariant) drifted = g_variant_get_child_value (journal, 2);
+  const gsize n_drifted = g_variant_n_children (drifted);
+  for (gsize i = 0; i < n_drifted; i++)
+    {
+      const char *path;
+      g_variant_get_child (drifted, i, "&s", &path);
+      g_ptr_array_add (candidates, g_strdup (path));
+    }
+  g_autoptr(GVariant) deleted = g_variant_get_child_value (journal, 3);
+  const gsize n_deleted = g_variant_n_children (deleted);
+  for (gsize i = 0; i < n_deleted; i++)
+    {
+      const char *path;
+      g_variant_get_child (deleted, i, "&s", &path);
+      g_ptr_array_add (candidates, g_strdup (path));
+    }
+
+  g_ptr_array_sort (candidates, compare_path_ptrs);
+
+  return etc_journal_classify_paths (orig_etc_fd, modified_etc_fd, candidates,
+                                     modified_paths, removed_paths, added_paths,
+                                     error);
+}
+
+/* Compute the (modified, removed, added) path sets between
+ * @merge_deployment's `/usr/etc` and `/etc`, into @diff's arrays (which
+ * the caller must have allocated).  This only reads the merge
+ * deployment, so the upgrader can run it while the pull of the new tree
+ * is still in flight.
+ */
+gboolean
+_ostree_sysroot_compute_etc_diff (OstreeSysroot        *sysroot,
+                                  OstreeDeployment     *merge_deployment,
+                                  OstreeSysrootEtcDiff *diff,
+                                  GCancellable         *cancellable,
+                                  GError              **error)
+{
+  g_autofree char *merge_deployment_path = ostree_sysroot_get_deployment_dirpath (sysroot, merge_deployment);
+  glnx_fd_close int merge_deployment_dfd = -1;
+  if (!glnx_opendirat (sysroot->sysroot_fd, merge_deployment_path, FALSE,
+                       &merge_deployment_dfd, error))
+    return FALSE;
+
+  glnx_fd_close int orig_etc_fd = -1;
+  if (!glnx_opendirat (merge_deployment_dfd, "usr/etc", TRUE, &orig_etc_fd, error))
+    return FALSE;
+  glnx_fd_close int modified_etc_fd = -1;
+  if (!glnx_opendirat (merge_deployment_dfd, "etc", TRUE, &modified_etc_fd, error))
+    return FALSE;
+
+  g_autoptr(GVariant) journal = load_etc_journal (sysroot, merge_deployment);
+  if (journal != NULL)
+    {
+      if (!etc_journal_compute_diff (journal, orig_etc_fd, modified_etc_fd,
+                                     diff->modified_paths, diff->removed_paths,
+                                     diff->added_paths,
+                                     cancellable, error))
+        return glnx_prefix_error (error, "While computing configuration diff");
+    }
+  else
+    {
+      /* TODO: get rid of GFile usage here */
+      g_autoptr(GFile) orig_etc = ot_fdrel_to_gfile (merge_deployment_dfd, "usr/etc");
+      g_autoptr(GFile) modified_etc = ot_fdrel_to_gfile (merge_deployment_dfd, "etc");
+      g_autoptr(GPtrArray) modified = g_ptr_array_new_with_free_func ((GDestroyNotify) ostree_diff_item_unref);
+      g_autoptr(GPtrArray) removed = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+      g_autoptr(GPtrArray) added = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+      /* For now, ignore changes to xattrs; the problem is that
+       * security.selinux will be different between the /usr/etc labels
+       * and the ones in the real /etc, so they all show up as different.
+       *
+       * This means that if you want to change the security context of a
+       * file, to have that change persist across upgrades, you must also
+       * modify the content of the file.
+       */
+      if (!ostree_diff_dirs (OSTREE_DIFF_FLAGS_IGNORE_XATTRS,
+                             orig_etc, modified_etc, modified, removed, added,
+                             cancellable, error))
+        return glnx_prefix_error (error, "While computing configuration diff");
+
+      for (guint i = 0; i < modified->len; i++)
+        {
+          OstreeDiffItem *diff_item = modified->pdata[i];
+          char *path = g_file_get_relative_path (modified_etc, diff_item->target);
+          g_assert (path);
+          g_ptr_array_add (diff->modified_paths, path);
+        }
+      for (guint i = 0; i < removed->len; i++)
+        {
+          char *path = g_file_get_relative_path (orig_etc, removed->pdata[i]);
+          g_assert (path);
+          g_ptr_array_add (diff->removed_paths, path);
+        }
+      for (guint i = 0; i < added->len; i++)
+        {
+          char *path = g_file_get_relative_path (modified_etc, added->pdata[i]);
+          g_assert (path);
+          g_ptr_array_add (diff->added_paths, path);
+        }
+    }
+
+  return TRUE;
+}
+
 /*
  * merge_configuration_from:
  * @sysroot: Sysroot
@@ -367,6 +918,7 @@ copy_modified_config_file (int                 orig_etc_fd,
  * @merge_deployment_dfd: Directory fd, may be -1
  * @new_deployment: Target for merge of configuration
  * @new_deployment_dfd: Directory fd for @new_deployment (may *not* be -1)
+ * @precomputed_diff: (allow-none): Diff already computed by _ostree_sysroot_compute_etc_diff()
  * @cancellable: Cancellable
  * @error: Error
  *
@@ -377,6 +929,11 @@ copy_modified_config_file (int                 orig_etc_fd,
  * approximately equivalent to "diff -unR orig_etc modified_etc",
  * except that rather than attempting a 3-way merge if a file is also
  * changed in @new_etc, the modified version always wins.
+ *
+ * If @merge_deployment carries an /etc change journal (written when it
+ * was deployed), the difference is computed incrementally from it;
+ * otherwise a full tree diff is performed.  Either way a fresh journal
+ * is written for @new_deployment.
  */
 static gboolean
 merge_configuration_from (OstreeSysroot    *sysroot,
@@ -384,6 +941,7 @@ merge_configuration_from (OstreeSysroot    *sysroot,
                           int               merge_deployment_dfd,
                           OstreeDeployment *new_deployment,
                           int               new_deployment_dfd,
+                          const OstreeSysrootEtcDiff *precomputed_diff,
                           GCancellable     *cancellable,
                           GError          **error)
 {
@@ -403,32 +961,6 @@ merge_configuration_from (OstreeSysroot    *sysroot,
       merge_deployment_dfd = owned_merge_deployment_dfd;
     }
 
-  /* TODO: get rid of GFile usage here */
-  g_autoptr(GFile) orig_etc = ot_fdrel_to_gfile (merge_deployment_dfd, "usr/etc");
-  g_autoptr(GFile) modified_etc = ot_fdrel_to_gfile (merge_deployment_dfd, "etc");
-  /* Return values for below */
-  g_autoptr(GPtrArray) modified = g_ptr_array_new_with_free_func ((GDestroyNotify) ostree_diff_item_unref);
-  g_autoptr(GPtrArray) removed = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
-  g_autoptr(GPtrArray) added = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
-  /* For now, ignore changes to xattrs; the problem is that
-   * security.selinux will be different between the /usr/etc labels
-   * and the ones in the real /etc, so they all show up as different.
-   *
-   * This means that if you want to change the security context of a
-   * file, to have that change persist across upgrades, you must also
-   * modify the content of the file.
-   */
-  if (!ostree_diff_dirs (OSTREE_DIFF_FLAGS_IGNORE_XATTRS,
-                         orig_etc, modified_etc, modified, removed, added,
-                         cancellable, error))
-    return glnx_prefix_error (error, "While computing configuration diff");
-
-  ot_log_structured_print_id_v (OSTREE_CONFIGMERGE_ID,
-                                "Copying /etc changes: %u modified, %u removed, %u added",
-                                modified->len,
-                                removed->len,
-                                added->len);
-
   glnx_fd_close int orig_etc_fd = -1;
   if (!glnx_opendirat (merge_deployment_dfd, "usr/etc", TRUE, &orig_etc_fd, error))
     return FALSE;
@@ -439,41 +971,507 @@ merge_configuration_from (OstreeSysroot    *sysroot,
   if (!glnx_opendirat (new_deployment_dfd, "etc", TRUE, &new_etc_fd, error))
     return FALSE;
 
-  for (guint i = 0; i < removed->len; i++)
+  /* The merge result, as paths relative to /etc */
+  g_autoptr(GPtrArray) owned_modified_paths = NULL;
+  g_autoptr(GPtrArray) owned_removed_paths = NULL;
+  g_autoptr(GPtrArray) owned_added_paths = NULL;
+  GPtrArray *modified_paths;
+  GPtrArray *removed_paths;
+  GPtrArray *added_paths;
+
+  if (precomputed_diff != NULL)
     {
-      GFile *file = removed->pdata[i];
-      g_autofree char *path = NULL;
+      modified_paths = precomputed_diff->modified_paths;
+      removed_paths = precomputed_diff->removed_paths;
+      added_paths = precomputed_diff->added_paths;
+    }
+  else
+    {
+      owned_modified_paths = g_ptr_array_new_with_free_func (g_free);
+      owned_removed_paths = g_ptr_array_new_with_free_func (g_free);
+      owned_added_paths = g_ptr_array_new_with_free_func (g_free);
+      OstreeSysrootEtcDiff diff = { owned_modified_paths, owned_removed_paths,
+                                    owned_added_paths };
+      if (!_ostree_sysroot_compute_etc_diff (sysroot, merge_deployment, &diff,
+                                             cancellable, error))
+        return FALSE;
+      modified_paths = owned_modified_paths;
+      removed_paths = owned_removed_paths;
+      added_paths = owned_added_paths;
+    }
 
-      path = g_file_get_relative_path (orig_etc, file);
-      g_assert (path);
+  ot_log_structured_print_id_v (OSTREE_CONFIGMERGE_ID,
+                                "Copying /etc changes: %u modified, %u removed, %u added",
+                                modified_paths->len,
+                                removed_paths->len,
+                                added_paths->len);
+
+  for (guint i = 0; i < removed_paths->len; i++)
+    {
+      const char *path = removed_paths->pdata[i];
 
       if (!glnx_shutil_rm_rf_at (new_etc_fd, path, cancellable, error))
         return FALSE;
     }
 
-  for (guint i = 0; i < modified->len; i++)
+  for (guint i = 0; i < modified_paths->len; i++)
     {
-      OstreeDiffItem *diff = modified->pdata[i];
-      g_autofree char *path = g_file_get_relative_path (modified_etc, diff->target);
-
-      g_assert (path);
+      const char *path = modified_paths->pdata[i];
 
       if (!copy_modified_config_file (orig_etc_fd, modified_etc_fd, new_etc_fd, path,
                                       flags, cancellable, error))
         return FALSE;
     }
-  for (guint i = 0; i < added->len; i++)
+  for (guint i = 0; i < added_paths->len; i++)
     {
-      GFile *file = added->pdata[i];
-      g_autofree char *path = g_file_get_relative_path (modified_etc, file);
-
-      g_assert (path);
+      const char *path = added_paths->pdata[i];
 
       if (!copy_modified_config_file (orig_etc_fd, modified_etc_fd, new_etc_fd, path,
                                       flags, cancellable, error))
         return FALSE;
     }
 
+  /* Snapshot the result so the next merge against @new_deployment only
+   * has to look at what changes from here on.
+   */
+  if (!write_etc_journal (sysroot, new_deployment, new_deployment_dfd,
+                          modified_paths, removed_paths, added_paths,
+                          cancellable, error))
+    return glnx_prefix_error (error, "Writing /etc change journal");
+
+  return TRUE;
+}
+
+typedef struct {
+  OstreeRepo *repo;
+  const char *csum;
+  int target_dfd;
+  GCancellable *cancellable;
+  GMutex lock;
+  GError *error;               /* First failure; guarded by lock */
+} DeployCheckoutData;
+
+/* Check out one top-level entry of the deployment root.  Directories
+ * get their own ostree_repo_checkout_at() with a subpath; non-directory
+ * entries (e.g. compat symlinks in the root) use the "." destination
+ * special case which checks out a single file.
+ */
+static void
+checkout_deploy_child_worker (gpointer item,
+                              gpointer user_data)
+{
+  GFileInfo *file_info = item;
+  DeployCheckoutData *data = user_data;
+  const char *name = g_file_info_get_name (file_info);
+  const gboolean is_dir =
+    g_file_info_get_file_type (file_info) == G_FILE_TYPE_DIRECTORY;
+  OstreeRepoCheckoutAtOptions subdir_opts = { 0, };
+  g_autofree char *subpath = g_strconcat ("/", name, NULL);
+  g_autoptr(GError) local_error = NULL;
+  gboolean failed;
+
+  g_mutex_lock (&data->lock);
+  failed = (data->error != NULL);
+  g_mutex_unlock (&data->lock);
+  if (failed)
+    return;
+
+  subdir_opts.subpath = subpath;
+  if (!ostree_repo_checkout_at (data->repo, &subdir_opts, data->target_dfd,
+                                is_dir ? name : ".", data->csum,
+                                data->cancellable, &local_error))
+    {
+      g_prefix_error (&local_error, "Checking out %s: ", name);
+      g_mutex_lock (&data->lock);
+      if (data->error == NULL)
+        data->error = g_steal_pointer (&local_error);
+      g_mutex_unlock (&data->lock);
+    }
+}
+
+/* Parallel variant of the deployment checkout: create the deployment
+ * root ourselves, check out each top-level entry on a thread pool
+ * (object loads and the dirmeta cache are mutex protected), then apply
+ * the root directory's own metadata.
+ */
+static gboolean
+checkout_deployment_tree_parallel (OstreeRepo    *repo,
+                                   const char    *csum,
+                                   int            osdeploy_dfd,
+                                   const char    *checkout_target_name,
+                                   guint          n_jobs,
+                                   GCancellable  *cancellable,
+                                   GError       **error)
+{
+  g_autoptr(GFile) root = NULL;
+  if (!ostree_repo_read_commit (repo, csum, &root, NULL, cancellable, error))
+    return FALSE;
+
+  g_autoptr(GFileInfo) root_info =
+    g_file_query_info (root, OSTREE_GIO_FAST_QUERYINFO,
+                       G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                       cancellable, error);
+  if (root_info == NULL)
+    return FALSE;
+
+  if (mkdirat (osdeploy_dfd, checkout_target_name, 0700) < 0)
+    return glnx_throw_errno_prefix (error, "mkdirat(%s)", checkout_target_name);
+  glnx_fd_close int target_dfd = -1;
+  if (!glnx_opendirat (osdeploy_dfd, checkout_target_name, TRUE, &target_dfd, error))
+    return FALSE;
+
+  g_autoptr(GFileEnumerator) dir_enum =
+    g_file_enumerate_children (root, OSTREE_GIO_FAST_QUERYINFO,
+                               G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                               cancellable, error);
+  if (dir_enum == NULL)
+    return FALSE;
+
+  g_autoptr(GPtrArray) children = g_ptr_array_new_with_free_func (g_object_unref);
+  while (TRUE)
+    {
+      GFileInfo *file_info;
+      if (!g_file_enumerator_iterate (dir_enum, &file_info, NULL,
+                                      cancellable, error))
+        return FALSE;
+      if (file_info == NULL)
+        break;
+      g_ptr_array_add (children, g_object_ref (file_info));
+    }
+
+  DeployCheckoutData data = { repo, csum, target_dfd, cancellable, };
+  data.error = NULL;
+  g_mutex_init (&data.lock);
+  GThreadPool *pool = g_thread_pool_new (checkout_deploy_child_worker, &data,
+                                         n_jobs, FALSE, NULL);
+  if (pool == NULL)
+    {
+      g_mutex_clear (&data.lock);
+      return glnx_throw (error, "Failed to create checkout thread pool");
+    }
+  for (guint i = 0; i < children->len; i++)
+    g_thread_pool_push (pool, children->pdata[i], NULL);
+  /* Waits for the queue to drain */
+  g_thread_pool_free (pool, FALSE, TRUE);
+  g_mutex_clear (&data.lock);
+  if (data.error != NULL)
+    {
+      g_propagate_error (error, g_steal_pointer (&data.error));
+      return FALSE;
+    }
+
+  /* Now give the root directory itself its real ownership and mode */
+  guint32 uid = g_file_info_get_attribute_uint32 (root_info, "unix::uid");
+  guint32 gid = g_file_info_get_attribute_uint32 (root_info, "unix::gid");
+  guint32 mode = g_file_info_get_attribute_uint32 (root_info, "unix::mode");
+  if (fchown (target_dfd, uid, gid) < 0)
+    return glnx_throw_errno_prefix (error, "fchown");
+  if (fchmod (target_dfd, mode & 07777) < 0)
+    return glnx_throw_errno_prefix (error, "fchmod");
+
+  g_autoptr(GVariant) xattrs = NULL;
+  if (!ostree_repo_file_get_xattrs ((OstreeRepoFile*)root, &xattrs, cancellable, error))
+    return FALSE;
+  if (xattrs != NULL &&
+      !glnx_fd_set_all_xattrs (target_dfd, xattrs, cancellable, error))
+    return FALSE;
+
+  return TRUE;
+}
+
+/* Like copy_dir_recurse(), but hardlinks regular files and symlinks
+ * instead of copying them (hardlink_or_copy_at() transparently falls
+ * back to a copy on EMLINK/EXDEV).  Used for subtrees of the merge
+ * deployment whose dirtree and dirmeta checksums match the new tree
+ * exactly, so everything - including each directory's ownership and
+ * xattrs - can be taken from the previous deployment without consulting
+ * the repository.
+ */
+static gboolean
+hardlink_dir_recurse (int              src_parent_dfd,
+                      int              dest_parent_dfd,
+                      const char      *name,
+                      OstreeSysrootDebugFlags flags,
+                      GCancellable    *cancellable,
+                      GError         **error)
+{
+  g_auto(GLnxDirFdIterator) src_dfd_iter = { 0, };
+  glnx_fd_close int dest_dfd = -1;
+  struct dirent *dent;
+
+  if (!glnx_dirfd_iterator_init_at (src_parent_dfd, name, TRUE, &src_dfd_iter, error))
+    return FALSE;
+
+  /* Create with mode 0700, we'll fchmod/fchown later */
+  if (mkdirat (dest_parent_dfd, name, 0700) != 0)
+    return glnx_throw_errno (error);
+
+  if (!glnx_opendirat (dest_parent_dfd, name, TRUE, &dest_dfd, error))
+    return FALSE;
+
+  if (!dirfd_copy_attributes_and_xattrs (src_parent_dfd, name, src_dfd_iter.fd, dest_dfd,
+                                         flags, cancellable, error))
+    return FALSE;
+
+  while (TRUE)
+    {
+      if (!glnx_dirfd_iterator_next_dent_ensure_dtype (&src_dfd_iter, &dent, cancellable, error))
+        return FALSE;
+      if (dent == NULL)
+        break;
+
+      if (dent->d_type == DT_DIR)
+        {
+          if (!hardlink_dir_recurse (src_dfd_iter.fd, dest_dfd, dent->d_name,
+                                     flags, cancellable, error))
+            return FALSE;
+        }
+      else
+        {
+          if (!hardlink_or_copy_at (src_dfd_iter.fd, dent->d_name,
+                                    dest_dfd, dent->d_name,
+                                    flags, cancellable, error))
+            return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+/* One directory level of the delta checkout.  Children whose object
+ * checksums match the merge deployment are hardlinked from it - whole
+ * subtrees at a time when both the dirtree and dirmeta checksums match
+ * - and only the changed paths fall back to a regular repository
+ * checkout.
+ */
+static gboolean
+delta_checkout_dir (OstreeRepo     *repo,
+                    const char     *csum,
+                    GFile          *new_dir,
+                    GFile          *old_dir,
+                    int             old_dfd,
+                    int             new_dfd,
+                    const char     *path,
+                    OstreeSysrootDebugFlags debug_flags,
+                    guint          *inout_n_reused,
+                    guint          *inout_n_changed,
+                    GCancellable   *cancellable,
+                    GError        **error)
+{
+  g_autoptr(GFileEnumerator) dir_enum =
+    g_file_enumerate_children (new_dir, OSTREE_GIO_FAST_QUERYINFO,
+                               G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                               cancellable, error);
+  if (dir_enum == NULL)
+    return FALSE;
+
+  while (TRUE)
+    {
+      GFileInfo *child_info;
+      if (!g_file_enumerator_iterate (dir_enum, &child_info, NULL,
+                                      cancellable, error))
+        return FALSE;
+      if (child_info == NULL)
+        break;
+
+      const char *name = g_file_info_get_name (child_info);
+      const gboolean is_dir =
+        g_file_info_get_file_type (child_info) == G_FILE_TYPE_DIRECTORY;
+      g_autofree char *child_path = g_strconcat (path, "/", name, NULL);
+      g_autoptr(GFile) new_child = g_file_get_child (new_dir, name);
+      g_autoptr(GFile) old_child = g_file_get_child (old_dir, name);
+      /* Deliberately ignoring errors here; a child that can't be
+       * resolved in the old tree is simply treated as new. */
+      g_autoptr(GFileInfo) old_info =
+        g_file_query_info (old_child, OSTREE_GIO_FAST_QUERYINFO,
+                           G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                           cancellable, NULL);
+      const gboolean old_is_dir = old_info != NULL
+        && g_file_info_get_file_type (old_info) == G_FILE_TYPE_DIRECTORY;
+      /* A deployment's physical /etc is the merged configuration, not
+       * the committed tree, so it can never be reused from the previous
+       * deployment even when the trees match. */
+      const gboolean can_reuse =
+        !(path[0] == '\0' && strcmp (name, "etc") == 0);
+
+      if (can_reuse && is_dir && old_is_dir)
+        {
+          OstreeRepoFile *new_repof = (OstreeRepoFile*)new_child;
+          OstreeRepoFile *old_repof = (OstreeRepoFile*)old_child;
+
+          /* Load the tree checksums (@old_repof was resolved by the
+           * query_info() above) */
+          if (!ostree_repo_file_ensure_resolved (new_repof, error))
+            return FALSE;
+
+          if (strcmp (ostree_repo_file_tree_get_contents_checksum (new_repof),
+                      ostree_repo_file_tree_get_contents_checksum (old_repof)) == 0
+              && strcmp (ostree_repo_file_tree_get_metadata_checksum (new_repof),
+                         ostree_repo_file_tree_get_metadata_checksum (old_repof)) == 0)
+            {
+              if (!hardlink_dir_recurse (old_dfd, new_dfd, name,
+                                         debug_flags, cancellable, error))
+                return glnx_prefix_error (error, "Hardlinking %s", child_path);
+              (*inout_n_reused)++;
+              continue;
+            }
+
+          /* The directory exists in both trees but differs; create it
+           * with the new tree's metadata and recurse. */
+          if (mkdirat (new_dfd, name, 0700) < 0)
+            return glnx_throw_errno_prefix (error, "mkdirat(%s)", name);
+          glnx_fd_close int new_child_dfd = -1;
+          if (!glnx_opendirat (new_dfd, name, TRUE, &new_child_dfd, error))
+            return FALSE;
+          glnx_fd_close int old_child_dfd = -1;
+          if (!glnx_opendirat (old_dfd, name, TRUE, &old_child_dfd, error))
+            return FALSE;
+
+          if (!delta_checkout_dir (repo, csum, new_child, old_child,
+                                   old_child_dfd, new_child_dfd, child_path,
+                                   debug_flags, inout_n_reused, inout_n_changed,
+                                   cancellable, error))
+            return FALSE;
+
+          const guint32 uid = g_file_info_get_attribute_uint32 (child_info, "unix::uid");
+          const guint32 gid = g_file_info_get_attribute_uint32 (child_info, "unix::gid");
+          const guint32 mode = g_file_info_get_attribute_uint32 (child_info, "unix::mode");
+          if (fchown (new_child_dfd, uid, gid) < 0)
+            return glnx_throw_errno_prefix (error, "fchown");
+          if (fchmod (new_child_dfd, mode & 07777) < 0)
+            return glnx_throw_errno_prefix (error, "fchmod");
+          g_autoptr(GVariant) xattrs = NULL;
+          if (!ostree_repo_file_get_xattrs (new_repof, &xattrs, cancellable, error))
+            return FALSE;
+          if (xattrs != NULL &&
+              !glnx_fd_set_all_xattrs (new_child_dfd, xattrs, cancellable, error))
+            return FALSE;
+          continue;
+        }
+
+      if (can_reuse && !is_dir && old_info != NULL && !old_is_dir
+          && g_strcmp0 (ostree_repo_file_get_checksum ((OstreeRepoFile*)new_child),
+                        ostree_repo_file_get_checksum ((OstreeRepoFile*)old_child)) == 0)
+        {
+          if (!hardlink_or_copy_at (old_dfd, name, new_dfd, name,
+                                    debug_flags, cancellable, error))
+            return FALSE;
+          (*inout_n_reused)++;
+          continue;
+        }
+
+      /* Added or changed; do a regular checkout of just this path */
+      OstreeRepoCheckoutAtOptions subdir_opts = { 0, };
+      subdir_opts.subpath = child_path;
+      if (!ostree_repo_checkout_at (repo, &subdir_opts, new_dfd,
+                                    is_dir ? name : ".", csum,
+                                    cancellable, error))
+        return glnx_prefix_error (error, "Checking out %s", child_path);
+      (*inout_n_changed)++;
+    }
+
+  return TRUE;
+}
+
+/* Delta variant of the deployment checkout: diff the new tree against
+ * the merge deployment's tree via dirtree checksum short-circuiting,
+ * hardlink unchanged subtrees wholesale from the previous deployment,
+ * and only materialize changed paths, making the checkout O(changes)
+ * instead of O(tree).  Sets @out_performed to %FALSE (without error)
+ * when the layout rules it out: no merge deployment, its commit was
+ * pruned, or it lives on another filesystem.
+ */
+static gboolean
+checkout_deployment_tree_delta (OstreeSysroot    *sysroot,
+                                OstreeRepo       *repo,
+                                OstreeDeployment *deployment,
+                                OstreeDeployment *merge_deployment,
+                                int               osdeploy_dfd,
+                                const char       *checkout_target_name,
+                                gboolean         *out_performed,
+                                GCancellable     *cancellable,
+                                GError          **error)
+{
+  *out_performed = FALSE;
+
+  if (merge_deployment == NULL)
+    return TRUE;
+
+  const char *csum = ostree_deployment_get_csum (deployment);
+  const char *merge_csum = ostree_deployment_get_csum (merge_deployment);
+
+  g_autoptr(GFile) old_root = NULL;
+  if (!ostree_repo_read_commit (repo, merge_csum, &old_root, NULL,
+                                cancellable, NULL))
+    return TRUE; /* e.g. the merge deployment's commit was pruned */
+
+  g_autoptr(GFile) new_root = NULL;
+  if (!ostree_repo_read_commit (repo, csum, &new_root, NULL,
+                                cancellable, error))
+    return FALSE;
+
+  /* Resolving the roots also loads their tree checksums */
+  g_autoptr(GFileInfo) root_info =
+    g_file_query_info (new_root, OSTREE_GIO_FAST_QUERYINFO,
+                       G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                       cancellable, error);
+  if (root_info == NULL)
+    return FALSE;
+  g_autoptr(GFileInfo) old_root_info =
+    g_file_query_info (old_root, OSTREE_GIO_FAST_QUERYINFO,
+                       G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                       cancellable, NULL);
+  if (old_root_info == NULL)
+    return TRUE;
+
+  g_autofree char *merge_path =
+    ostree_sysroot_get_deployment_dirpath (sysroot, merge_deployment);
+  glnx_fd_close int old_dfd = -1;
+  if (!glnx_opendirat (sysroot->sysroot_fd, merge_path, TRUE, &old_dfd, NULL))
+    return TRUE;
+
+  /* Hardlinks can't cross filesystems */
+  struct stat old_stbuf, new_stbuf;
+  if (!glnx_fstat (old_dfd, &old_stbuf, error))
+    return FALSE;
+  if (!glnx_fstat (osdeploy_dfd, &new_stbuf, error))
+    return FALSE;
+  if (old_stbuf.st_dev != new_stbuf.st_dev)
+    return TRUE;
+
+  if (mkdirat (osdeploy_dfd, checkout_target_name, 0700) < 0)
+    return glnx_throw_errno_prefix (error, "mkdirat(%s)", checkout_target_name);
+  glnx_fd_close int target_dfd = -1;
+  if (!glnx_opendirat (osdeploy_dfd, checkout_target_name, TRUE, &target_dfd, error))
+    return FALSE;
+
+  guint n_reused = 0;
+  guint n_changed = 0;
+  if (!delta_checkout_dir (repo, csum, new_root, old_root,
+                           old_dfd, target_dfd, "",
+                           sysroot->debug_flags, &n_reused, &n_changed,
+                           cancellable, error))
+    return FALSE;
+
+  /* Now give the root directory itself its real ownership and mode */
+  guint32 uid = g_file_info_get_attribute_uint32 (root_info, "unix::uid");
+  guint32 gid = g_file_info_get_attribute_uint32 (root_info, "unix::gid");
+  guint32 mode = g_file_info_get_attribute_uint32 (root_info, "unix::mode");
+  if (fchown (target_dfd, uid, gid) < 0)
+    return glnx_throw_errno_prefix (error, "fchown");
+  if (fchmod (target_dfd, mode & 07777) < 0)
+    return glnx_throw_errno_prefix (error, "fchmod");
+
+  g_autoptr(GVariant) xattrs = NULL;
+  if (!ostree_repo_file_get_xattrs ((OstreeRepoFile*)new_root, &xattrs, cancellable, error))
+    return FALSE;
+  if (xattrs != NULL &&
+      !glnx_fd_set_all_xattrs (target_dfd, xattrs, cancellable, error))
+    return FALSE;
+
+  g_debug ("Delta deployment checkout: %u paths reused from %s, %u changed",
+           n_reused, merge_csum, n_changed);
+  *out_performed = TRUE;
   return TRUE;
 }
 
@@ -482,11 +1480,16 @@ merge_configuration_from (OstreeSysroot    *sysroot,
  *
  * Look up @revision in the repository, and check it out in
  * /ostree/deploy/OS/deploy/${treecsum}.${deployserial}.
+ *
+ * When @merge_deployment is on the same filesystem, unchanged subtrees
+ * are hardlinked from it instead of being checked out of the
+ * repository.
  */
 static gboolean
 checkout_deployment_tree (OstreeSysroot     *sysroot,
                           OstreeRepo        *repo,
                           OstreeDeployment  *deployment,
+                          OstreeDeployment  *merge_deployment,
                           int               *out_deployment_dfd,
                           GCancellable      *cancellable,
                           GError           **error)
@@ -497,6 +1500,7 @@ checkout_deployment_tree (OstreeSysroot     *sysroot,
   g_autofree char *checkout_target_name = NULL;
   g_autofree char *osdeploy_path = NULL;
   glnx_fd_close int osdeploy_dfd = -1;
+  guint n_jobs = g_get_num_processors ();
   int ret_fd;
 
   osdeploy_path = g_strconcat ("ostree/deploy/", ostree_deployment_get_osname (deployment), "/deploy", NULL);
@@ -511,11 +1515,30 @@ checkout_deployment_tree (OstreeSysroot     *sysroot,
   if (!glnx_shutil_rm_rf_at (osdeploy_dfd, checkout_target_name, cancellable, error))
     goto out;
 
-  if (!ostree_repo_checkout_at (repo, &checkout_opts, osdeploy_dfd,
-                                checkout_target_name, csum,
-                                cancellable, error))
+  gboolean used_delta = FALSE;
+  if (!checkout_deployment_tree_delta (sysroot, repo, deployment, merge_deployment,
+                                       osdeploy_dfd, checkout_target_name,
+                                       &used_delta, cancellable, error))
     goto out;
 
+  if (!used_delta)
+    {
+      if (n_jobs > 1)
+        {
+          if (!checkout_deployment_tree_parallel (repo, csum, osdeploy_dfd,
+                                                  checkout_target_name, n_jobs,
+                                                  cancellable, error))
+            goto out;
+        }
+      else
+        {
+          if (!ostree_repo_checkout_at (repo, &checkout_opts, osdeploy_dfd,
+                                        checkout_target_name, csum,
+                                        cancellable, error))
+            goto out;
+        }
+    }
+
   if (!glnx_opendirat (osdeploy_dfd, checkout_target_name, TRUE, &ret_fd, error))
     goto out;
 
@@ -703,8 +1726,11 @@ selinux_relabel_var_if_needed (OstreeSysroot                 *sysroot,
                                                   0644, error))
           return FALSE;
 
+        /* Don't fsync here; this is durable after the syncfs() in
+         * ostree_sysroot_write_deployments().
+         */
         if (!glnx_file_replace_contents_at (os_deploy_dfd, selabeled, (guint8*)"", 0,
-                                            GLNX_FILE_REPLACE_DATASYNC_NEW,
+                                            GLNX_FILE_REPLACE_NODATASYNC,
                                             cancellable, error))
           return FALSE;
       }
@@ -719,6 +1745,7 @@ merge_configuration (OstreeSysroot         *sysroot,
                      OstreeDeployment      *previous_deployment,
                      OstreeDeployment      *deployment,
                      int                    deployment_dfd,
+                     const OstreeSysrootEtcDiff *etc_diff,
                      OstreeSePolicy       **out_sepolicy,
                      GCancellable          *cancellable,
                      GError               **error)
@@ -792,10 +1819,20 @@ merge_configuration (OstreeSysroot         *sysroot,
   if (previous_deployment)
     {
       if (!merge_configuration_from (sysroot, previous_deployment, -1,
-                                     deployment, deployment_dfd,
+                                     deployment, deployment_dfd, etc_diff,
                                      cancellable, error))
         return FALSE;
     }
+  else if (usretc_exists)
+    {
+      /* Nothing to merge, but record a journal showing /etc as
+       * pristine so the next merge can be computed incrementally.
+       */
+      if (!write_etc_journal (sysroot, deployment, deployment_dfd,
+                              NULL, NULL, NULL,
+                              cancellable, error))
+        return glnx_prefix_error (error, "Writing /etc change journal");
+    }
 
   if (out_sepolicy)
     *out_sepolicy = g_steal_pointer (&sepolicy);
@@ -991,12 +2028,16 @@ syncfs_dir_at (int            dfd,
 typedef struct {
   guint64 root_syncfs_msec;
   guint64 boot_syncfs_msec;
-  guint64 extra_syncfs_msec;
 } SyncStats;
 
-/* First, sync the root directory as well as /var and /boot which may
- * be separate mount points.  Then *in addition*, do a global
- * `sync()`.
+/* Sync the filesystems holding the sysroot (which covers the
+ * deployment directories and /var) and /boot, which may be a separate
+ * mount point.  This is the single barrier between staging all of the
+ * writes for a deployment and atomically swapping the bootloader
+ * entries; individual file writes above deliberately skip fsync() and
+ * rely on this.  We use `syncfs()` rather than a global `sync()` so
+ * that we get error codes back, and so an unrelated slow filesystem
+ * (e.g. a hung NFS mount) can't stall the deployment.
  */
 static gboolean
 full_system_sync (OstreeSysroot     *self,
@@ -1017,17 +2058,6 @@ full_system_sync (OstreeSysroot     *self,
   end_msec = g_get_monotonic_time () / 1000;
   out_stats->boot_syncfs_msec = (end_msec - start_msec);
 
-  /* And now out of an excess of conservativism, we still invoke
-   * sync().  The advantage of still using `syncfs()` above is that we
-   * actually get error codes out of that API, and we more clearly
-   * delineate what we actually want to sync in the future when this
-   * global sync call is removed.
-   */
-  start_msec = g_get_monotonic_time () / 1000;
-  sync ();
-  end_msec = g_get_monotonic_time () / 1000;
-  out_stats->extra_syncfs_msec = (end_msec - start_msec);
-
   return TRUE;
 }
 
@@ -1799,7 +2829,6 @@ ostree_sysroot_write_deployments_with_options (OstreeSysroot     *self,
                      "OSTREE_N_DEPLOYMENTS=%u", new_deployments->len,
                      "OSTREE_SYNCFS_ROOT_MSEC=%" G_GUINT64_FORMAT, syncstats.root_syncfs_msec,
                      "OSTREE_SYNCFS_BOOT_MSEC=%" G_GUINT64_FORMAT, syncstats.boot_syncfs_msec,
-                     "OSTREE_SYNCFS_EXTRA_MSEC=%" G_GUINT64_FORMAT, syncstats.extra_syncfs_msec,
                      NULL);
 #endif
     if (!ot_stdout_is_journal ())
@@ -1882,31 +2911,145 @@ allocate_deployserial (OstreeSysroot           *self,
   return TRUE;
 }
 
-/**
- * ostree_sysroot_deploy_tree:
- * @self: Sysroot
- * @osname: (allow-none): osname to use for merge deployment
- * @revision: Checksum to add
- * @origin: (allow-none): Origin to use for upgrades
- * @provided_merge_deployment: (allow-none): Use this deployment for merge path
- * @override_kernel_argv: (allow-none) (array zero-terminated=1) (element-type utf8): Use these as kernel arguments; if %NULL, inherit options from provided_merge_deployment
- * @out_new_deployment: (out): The new deployment path
- * @cancellable: Cancellable
- * @error: Error
+/* The file list shipped in the tree enumerating boot-critical files;
+ * deployment-relative paths, one per line, '#' starts a comment.
+ */
+#define READAHEAD_LIST_PATH "usr/lib/ostree-boot/readahead.list"
+
+typedef struct {
+  guint64 ino;
+  guint64 size;
+  char *path;
+} ReadaheadEntry;
+
+static void
+readahead_entry_free (gpointer data)
+{
+  ReadaheadEntry *entry = data;
+  g_free (entry->path);
+  g_free (entry);
+}
+
+static gint
+compare_readahead_entries (gconstpointer ap,
+                           gconstpointer bp)
+{
+  const ReadaheadEntry *a = *((ReadaheadEntry**)ap);
+  const ReadaheadEntry *b = *((ReadaheadEntry**)bp);
+
+  if (a->ino < b->ino)
+    return -1;
+  else if (a->ino > b->ino)
+    return 1;
+  return 0;
+}
+
+/* Optionally (core.deploy-readahead-pack) record the boot-critical file
+ * list shipped in the tree as a "readahead pack" next to the origin
+ * file.  First boot otherwise faults in thousands of loose-object-backed
+ * files in random order, which is seek-bound on rotational media and
+ * eMMC; an early boot unit can instead walk the pack and
+ * posix_fadvise(POSIX_FADV_WILLNEED) each file in one pass.  Entries are
+ * sorted by inode number — the deployment's files are hardlinks to the
+ * loose objects, and on ext4 inode order correlates with on-disk
+ * placement well enough to make the sweep mostly sequential.
  *
- * Check out deployment tree with revision @revision, performing a 3
- * way merge with @provided_merge_deployment for configuration.
+ * The pack format is one "size TAB path" line per file, paths relative
+ * to the deployment root.
+ */
+static gboolean
+generate_readahead_pack (OstreeSysroot     *self,
+                         OstreeRepo        *repo,
+                         OstreeDeployment  *deployment,
+                         int                deployment_dfd,
+                         GCancellable      *cancellable,
+                         GError           **error)
+{
+  gboolean enabled = FALSE;
+  GKeyFile *repo_config = ostree_repo_get_config (repo);
+
+  if (!ot_keyfile_get_boolean_with_default (repo_config, "core", "deploy-readahead-pack",
+                                            FALSE, &enabled, error))
+    return FALSE;
+  if (!enabled)
+    return TRUE;
+
+  /* No list shipped in this tree?  Nothing to do. */
+  g_autofree char *contents =
+    glnx_file_get_contents_utf8_at (deployment_dfd, READAHEAD_LIST_PATH, NULL,
+                                    cancellable, NULL);
+  if (contents == NULL)
+    return TRUE;
+
+  g_autoptr(GPtrArray) entries = g_ptr_array_new_with_free_func (readahead_entry_free);
+  g_auto(GStrv) lines = g_strsplit (contents, "\n", -1);
+  for (char **iter = lines; *iter != NULL; iter++)
+    {
+      const char *path = *iter;
+      while (*path == '/')
+        path++;
+      if (*path == '\0' || *path == '#')
+        continue;
+
+      /* The list may be approximate (generated from a boot profile of a
+       * different build), so just skip entries that don't resolve.
+       */
+      struct stat stbuf;
+      if (fstatat (deployment_dfd, path, &stbuf, AT_SYMLINK_NOFOLLOW) < 0)
+        continue;
+      if (!S_ISREG (stbuf.st_mode))
+        continue;
+
+      ReadaheadEntry *entry = g_new0 (ReadaheadEntry, 1);
+      entry->ino = stbuf.st_ino;
+      entry->size = stbuf.st_size;
+      entry->path = g_strdup (path);
+      g_ptr_array_add (entries, entry);
+    }
+
+  if (entries->len == 0)
+    return TRUE;
+
+  g_ptr_array_sort (entries, compare_readahead_entries);
+
+  g_autoptr(GString) buf = g_string_new (NULL);
+  for (guint i = 0; i < entries->len; i++)
+    {
+      ReadaheadEntry *entry = entries->pdata[i];
+      g_string_append_printf (buf, "%" G_GUINT64_FORMAT "\t%s\n",
+                              entry->size, entry->path);
+    }
+
+  g_autofree char *pack_relpath = _ostree_deployment_get_readahead_pack_relpath (deployment);
+  /* Don't fsync here, as we assume that's all done in
+   * ostree_sysroot_write_deployments().
+   */
+  if (!glnx_file_replace_contents_at (self->sysroot_fd, pack_relpath,
+                                      (guint8*)buf->str, buf->len,
+                                      GLNX_FILE_REPLACE_NODATASYNC,
+                                      cancellable, error))
+    return FALSE;
+
+  return TRUE;
+}
+
+/* Internal implementation of ostree_sysroot_deploy_tree().  If
+ * @etc_diff is non-%NULL, the configuration merge uses it instead of
+ * recomputing the diff between the merge deployment's /usr/etc and
+ * /etc; the upgrader uses this to compute the diff while the pull is
+ * still downloading content.
  */
 gboolean
-ostree_sysroot_deploy_tree (OstreeSysroot     *self,
-                            const char        *osname,
-                            const char        *revision,
-                            GKeyFile          *origin,
-                            OstreeDeployment  *provided_merge_deployment,
-                            char             **override_kernel_argv,
-                            OstreeDeployment **out_new_deployment,
-                            GCancellable      *cancellable,
-                            GError           **error)
+_ostree_sysroot_deploy_tree_with_etc_diff (OstreeSysroot               *self,
+                                           const char                  *osname,
+                                           const char                  *revision,
+                                           GKeyFile                    *origin,
+                                           OstreeDeployment            *provided_merge_deployment,
+                                           char                       **override_kernel_argv,
+                                           const OstreeSysrootEtcDiff  *etc_diff,
+                                           OstreeDeployment           **out_new_deployment,
+                                           GCancellable                *cancellable,
+                                           GError                     **error)
 {
   g_return_val_if_fail (osname != NULL || self->booted_deployment != NULL, FALSE);
 
@@ -1935,13 +3078,17 @@ ostree_sysroot_deploy_tree (OstreeSysroot     *self,
   ostree_deployment_set_origin (new_deployment, origin);
 
   /* Check out the userspace tree onto the filesystem */
+  guint64 phase_start = g_get_monotonic_time ();
   glnx_fd_close int deployment_dfd = -1;
-  if (!checkout_deployment_tree (self, repo, new_deployment, &deployment_dfd,
+  if (!checkout_deployment_tree (self, repo, new_deployment, merge_deployment,
+                                 &deployment_dfd,
                                  cancellable, error))
     {
       g_prefix_error (error, "Checking out tree: ");
       return FALSE;
     }
+  g_debug ("Deployment checkout of %s took %0.1fms", revision,
+           (g_get_monotonic_time () - phase_start) / 1000.0);
 
   glnx_fd_close int tree_boot_dfd = -1;
   g_autofree char *tree_kernel_path = NULL;
@@ -1970,19 +3117,25 @@ ostree_sysroot_deploy_tree (OstreeSysroot     *self,
   g_autoptr(OstreeBootconfigParser) bootconfig = ostree_bootconfig_parser_new ();
   ostree_deployment_set_bootconfig (new_deployment, bootconfig);
 
+  phase_start = g_get_monotonic_time ();
   g_autoptr(OstreeSePolicy) sepolicy = NULL;
   if (!merge_configuration (self, repo, merge_deployment, new_deployment,
-                            deployment_dfd,
+                            deployment_dfd, etc_diff,
                             &sepolicy,
                             cancellable, error))
     {
       g_prefix_error (error, "During /etc merge: ");
       return FALSE;
     }
+  g_debug ("Deployment /etc merge took %0.1fms",
+           (g_get_monotonic_time () - phase_start) / 1000.0);
 
+  phase_start = g_get_monotonic_time ();
   if (!selinux_relabel_var_if_needed (self, sepolicy, os_deploy_dfd,
                                       cancellable, error))
     return FALSE;
+  g_debug ("Deployment /var relabel took %0.1fms",
+           (g_get_monotonic_time () - phase_start) / 1000.0);
 
   if (!(self->debug_flags & OSTREE_SYSROOT_DEBUG_MUTABLE_DEPLOYMENTS))
     {
@@ -2010,6 +3163,13 @@ ostree_sysroot_deploy_tree (OstreeSysroot     *self,
       }
   }
 
+  if (!generate_readahead_pack (self, repo, new_deployment, deployment_dfd,
+                                cancellable, error))
+    {
+      g_prefix_error (error, "Writing readahead pack: ");
+      return FALSE;
+    }
+
   /* After this, install_deployment_kernel() will set the other boot
    * options and write it out to disk.
    */
@@ -2028,6 +3188,39 @@ ostree_sysroot_deploy_tree (OstreeSysroot     *self,
   return TRUE;
 }
 
+/**
+ * ostree_sysroot_deploy_tree:
+ * @self: Sysroot
+ * @osname: (allow-none): osname to use for merge deployment
+ * @revision: Checksum to add
+ * @origin: (allow-none): Origin to use for upgrades
+ * @provided_merge_deployment: (allow-none): Use this deployment for merge path
+ * @override_kernel_argv: (allow-none) (array zero-terminated=1) (element-type utf8): Use these as kernel arguments; if %NULL, inherit options from provided_merge_deployment
+ * @out_new_deployment: (out): The new deployment path
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Check out deployment tree with revision @revision, performing a 3
+ * way merge with @provided_merge_deployment for configuration.
+ */
+gboolean
+ostree_sysroot_deploy_tree (OstreeSysroot     *self,
+                            const char        *osname,
+                            const char        *revision,
+                            GKeyFile          *origin,
+                            OstreeDeployment  *provided_merge_deployment,
+                            char             **override_kernel_argv,
+                            OstreeDeployment **out_new_deployment,
+                            GCancellable      *cancellable,
+                            GError           **error)
+{
+  return _ostree_sysroot_deploy_tree_with_etc_diff (self, osname, revision,
+                                                    origin, provided_merge_deployment,
+                                                    override_kernel_argv, NULL,
+                                                    out_new_deployment,
+                                                    cancellable, error);
+}
+
 /**
  * ostree_sysroot_deployment_set_kargs:
  * @self: Sysroot
@@ -33,6 +33,9 @@ typedef enum {
   OSTREE_SYSROOT_DEBUG_MUTABLE_DEPLOYMENTS = 1 << 0,
   /* See https://github.com/ostreedev/ostree/pull/759 */
   OSTREE_SYSROOT_DEBUG_NO_XATTRS = 1 << 1,
+  /* Always compute the /etc merge with a full tree diff, ignoring
+   * any change journal from the merge deployment. */
+  OSTREE_SYSROOT_DEBUG_NO_ETC_JOURNAL = 1 << 2,
 
 } OstreeSysrootDebugFlags;
 
@@ -64,6 +67,12 @@ struct OstreeSysroot {
 };
 
 #define OSTREE_SYSROOT_LOCKFILE "ostree/lock"
+/* Serialized deployment state keyed by the ostree/deploy mtime, so that
+ * repeated loads within one boot avoid re-parsing bootloader entries;
+ * see ostree-sysroot.c.  Note it lives under ostree/, not ostree/deploy,
+ * as writing it must not perturb the mtime it is keyed by.
+ */
+#define _OSTREE_SYSROOT_STATE_CACHE_PATH "ostree/sysroot-state-cache"
 /* We keep some transient state in /run */
 #define _OSTREE_SYSROOT_DEPLOYMENT_RUNSTATE_DIR "/run/ostree/deployment-state/"
 #define _OSTREE_SYSROOT_DEPLOYMENT_RUNSTATE_FLAG_DEVELOPMENT "unlocked-development"
@@ -117,4 +126,38 @@ gboolean _ostree_sysroot_cleanup_internal (OstreeSysroot *sysroot,
                                            GCancellable  *cancellable,
                                            GError       **error);
 
+gboolean _ostree_sysroot_deployment_unlock_no_clone (OstreeSysroot     *self,
+                                                     OstreeDeployment  *deployment,
+                                                     GCancellable      *cancellable,
+                                                     GError           **error);
+
+/* A precomputed /etc merge diff (paths relative to /etc).  The upgrader
+ * fills one of these from the merge deployment - possibly while a pull
+ * is still in flight, since it doesn't depend on the new tree - and
+ * hands it to _ostree_sysroot_deploy_tree_with_etc_diff(), which then
+ * skips recomputing the diff during the configuration merge.
+ */
+typedef struct {
+  GPtrArray *modified_paths; /* (element-type utf8) */
+  GPtrArray *removed_paths;  /* (element-type utf8) */
+  GPtrArray *added_paths;    /* (element-type utf8) */
+} OstreeSysrootEtcDiff;
+
+gboolean _ostree_sysroot_compute_etc_diff (OstreeSysroot        *sysroot,
+                                           OstreeDeployment     *merge_deployment,
+                                           OstreeSysrootEtcDiff *diff,
+                                           GCancellable         *cancellable,
+                                           GError              **error);
+
+gboolean _ostree_sysroot_deploy_tree_with_etc_diff (OstreeSysroot               *self,
+                                                    const char                  *osname,
+                                                    const char                  *revision,
+                                                    GKeyFile                    *origin,
+                                                    OstreeDeployment            *provided_merge_deployment,
+                                                    char                       **override_kernel_argv,
+                                                    const OstreeSysrootEtcDiff  *etc_diff,
+                                                    OstreeDeployment           **out_new_deployment,
+                                                    GCancellable                *cancellable,
+                                                    GError                     **error);
+
 G_END_DECLS
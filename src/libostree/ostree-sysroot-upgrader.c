@@ -24,6 +24,7 @@
 
 #include "ostree.h"
 #include "ostree-sysroot-upgrader.h"
+#include "ostree-sysroot-private.h"
 
 /**
  * SECTION:ostree-sysroot-upgrader
@@ -453,6 +454,67 @@ ostree_sysroot_upgrader_check_timestamps (OstreeRepo     *repo,
   return TRUE;
 }
 
+/**
+ * ostree_sysroot_upgrader_check:
+ * @self: Upgrader
+ * @out_changed: (out): Whether or not a new commit is available
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Check whether the origin has a commit newer than the merge deployment
+ * without downloading any objects.  The remote's current head for the
+ * origin ref is resolved from its summary file — a conditional fetch
+ * which in the steady state is answered with a single 304 round trip —
+ * and compared against the deployed revision.  No transaction is
+ * created and the local ref is left unchanged; use
+ * ostree_sysroot_upgrader_pull() to actually fetch an update.
+ *
+ * Since: 2017.10
+ */
+gboolean
+ostree_sysroot_upgrader_check (OstreeSysrootUpgrader *self,
+                               gboolean              *out_changed,
+                               GCancellable          *cancellable,
+                               GError               **error)
+{
+  g_autoptr(OstreeRepo) repo = NULL;
+  const char *from_revision = NULL;
+  g_autofree char *new_revision = NULL;
+
+  if (!ostree_sysroot_get_repo (self->sysroot, &repo, cancellable, error))
+    return FALSE;
+
+  g_assert (self->merge_deployment);
+  from_revision = ostree_deployment_get_csum (self->merge_deployment);
+
+  if (self->override_csum != NULL)
+    new_revision = g_strdup (self->override_csum);
+  else if (self->origin_remote != NULL)
+    {
+      g_autoptr(GHashTable) remote_refs = NULL;  /* (element-type utf8 utf8) */
+      const char *checksum;
+
+      if (!ostree_repo_remote_list_refs (repo, self->origin_remote, &remote_refs,
+                                         cancellable, error))
+        return FALSE;
+
+      checksum = g_hash_table_lookup (remote_refs, self->origin_ref);
+      if (checksum == NULL)
+        return glnx_throw (error, "Remote '%s' has no ref '%s' in its summary",
+                           self->origin_remote, self->origin_ref);
+      new_revision = g_strdup (checksum);
+    }
+  else
+    {
+      if (!ostree_repo_resolve_rev (repo, self->origin_ref, FALSE,
+                                    &new_revision, error))
+        return FALSE;
+    }
+
+  *out_changed = (g_strcmp0 (from_revision, new_revision) != 0);
+  return TRUE;
+}
+
 /**
  * ostree_sysroot_upgrader_pull:
  * @self: Upgrader
@@ -663,6 +725,156 @@ ostree_sysroot_upgrader_deploy (OstreeSysrootUpgrader  *self,
   return TRUE;
 }
 
+typedef struct {
+  OstreeRepo *repo;
+  const char *remote;
+  char *refs_to_fetch[2];
+  OstreeRepoPullFlags flags;
+  OstreeAsyncProgress *progress;
+  GCancellable *cancellable;
+  gboolean success;
+  GError *error;
+} PullContentData;
+
+/* Fetch the content objects for an already-resolved commit.  Runs on a
+ * worker thread, so push a fresh thread-default main context for the
+ * duration of the pull.
+ */
+static gpointer
+pull_content_worker (gpointer user_data)
+{
+  PullContentData *data = user_data;
+  g_autoptr(GMainContext) context = g_main_context_new ();
+
+  g_main_context_push_thread_default (context);
+  data->success = ostree_repo_pull_one_dir (data->repo, data->remote, NULL,
+                                            data->refs_to_fetch, data->flags,
+                                            data->progress, data->cancellable,
+                                            &data->error);
+  g_main_context_pop_thread_default (context);
+
+  return NULL;
+}
+
+/**
+ * ostree_sysroot_upgrader_pull_and_deploy:
+ * @self: Upgrader
+ * @flags: Flags controlling pull behavior
+ * @upgrader_flags: Flags controlling upgrader behavior
+ * @progress: (allow-none): Progress
+ * @out_changed: (out): Whether or not the origin changed
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * A pipelined combination of ostree_sysroot_upgrader_pull() and
+ * ostree_sysroot_upgrader_deploy().  The commit metadata is fetched
+ * first to resolve the target revision; the content objects are then
+ * downloaded on a worker thread while the /etc merge is planned from
+ * the merge deployment, overlapping network and disk phases.  If no
+ * new commit is available, @out_changed is set to %FALSE and nothing
+ * is deployed.
+ *
+ * Since: 2017.10
+ */
+gboolean
+ostree_sysroot_upgrader_pull_and_deploy (OstreeSysrootUpgrader  *self,
+                                         OstreeRepoPullFlags     flags,
+                                         OstreeSysrootUpgraderPullFlags     upgrader_flags,
+                                         OstreeAsyncProgress    *progress,
+                                         gboolean               *out_changed,
+                                         GCancellable           *cancellable,
+                                         GError                **error)
+{
+  /* Resolve the new revision with a commit-only pull; this handles the
+   * end-of-life rebase and timestamp checks and updates the local ref,
+   * but doesn't download any content yet.
+   */
+  gboolean changed = FALSE;
+  if (!ostree_sysroot_upgrader_pull (self,
+                                     flags | OSTREE_REPO_PULL_FLAGS_COMMIT_ONLY,
+                                     upgrader_flags, NULL, &changed,
+                                     cancellable, error))
+    return FALSE;
+
+  *out_changed = changed;
+  if (!changed)
+    return TRUE;
+
+  g_autoptr(OstreeRepo) repo = NULL;
+  if (!ostree_sysroot_get_repo (self->sysroot, &repo, cancellable, error))
+    return FALSE;
+
+  /* Fetch the content on a worker thread; during the download the repo
+   * is only touched from there, while this thread reads the merge
+   * deployment's filesystem.
+   */
+  PullContentData pull_data = { 0, };
+  GThread *pull_thread = NULL;
+  if (self->origin_remote != NULL &&
+      (upgrader_flags & OSTREE_SYSROOT_UPGRADER_PULL_FLAGS_SYNTHETIC) == 0)
+    {
+      pull_data.repo = repo;
+      pull_data.remote = self->origin_remote;
+      pull_data.refs_to_fetch[0] = self->new_revision;
+      pull_data.flags = flags;
+      pull_data.progress = progress;
+      pull_data.cancellable = cancellable;
+      pull_thread = g_thread_new ("upgrader-pull", pull_content_worker, &pull_data);
+    }
+
+  /* Meanwhile, plan the /etc merge; it only depends on the merge
+   * deployment, not the tree being pulled.  The SELinux policy is
+   * deliberately not precomputed here, as it's loaded from the new
+   * deployment's /usr/etc.
+   */
+  g_autoptr(GPtrArray) modified_paths = g_ptr_array_new_with_free_func (g_free);
+  g_autoptr(GPtrArray) removed_paths = g_ptr_array_new_with_free_func (g_free);
+  g_autoptr(GPtrArray) added_paths = g_ptr_array_new_with_free_func (g_free);
+  OstreeSysrootEtcDiff etc_diff = { modified_paths, removed_paths, added_paths };
+  g_autoptr(GError) diff_error = NULL;
+  g_assert (self->merge_deployment);
+  gboolean diff_success =
+    _ostree_sysroot_compute_etc_diff (self->sysroot, self->merge_deployment,
+                                      &etc_diff, cancellable, &diff_error);
+
+  if (pull_thread != NULL)
+    {
+      g_thread_join (pull_thread);
+      if (!pull_data.success)
+        {
+          g_propagate_error (error, pull_data.error);
+          return FALSE;
+        }
+      if (progress)
+        ostree_async_progress_finish (progress);
+    }
+
+  if (!diff_success)
+    {
+      g_propagate_error (error, g_steal_pointer (&diff_error));
+      return FALSE;
+    }
+
+  g_autoptr(OstreeDeployment) new_deployment = NULL;
+  if (!_ostree_sysroot_deploy_tree_with_etc_diff (self->sysroot, self->osname,
+                                                  self->new_revision,
+                                                  self->origin,
+                                                  self->merge_deployment,
+                                                  NULL, &etc_diff,
+                                                  &new_deployment,
+                                                  cancellable, error))
+    return FALSE;
+
+  if (!ostree_sysroot_simple_write_deployment (self->sysroot, self->osname,
+                                               new_deployment,
+                                               self->merge_deployment,
+                                               0,
+                                               cancellable, error))
+    return FALSE;
+
+  return TRUE;
+}
+
 GType
 ostree_sysroot_upgrader_flags_get_type (void)
 {
@@ -83,6 +83,12 @@ gboolean ostree_sysroot_upgrader_check_timestamps (OstreeRepo     *repo,
                                                    const char     *to_rev,
                                                    GError        **error);
 
+_OSTREE_PUBLIC
+gboolean ostree_sysroot_upgrader_check (OstreeSysrootUpgrader *self,
+                                        gboolean              *out_changed,
+                                        GCancellable          *cancellable,
+                                        GError               **error);
+
 typedef enum {
   OSTREE_SYSROOT_UPGRADER_PULL_FLAGS_NONE = 0,
   OSTREE_SYSROOT_UPGRADER_PULL_FLAGS_ALLOW_OLDER = (1 << 0),
@@ -113,4 +119,13 @@ gboolean ostree_sysroot_upgrader_deploy (OstreeSysrootUpgrader  *self,
                                          GCancellable           *cancellable,
                                          GError                **error);
 
+_OSTREE_PUBLIC
+gboolean ostree_sysroot_upgrader_pull_and_deploy (OstreeSysrootUpgrader  *self,
+                                                  OstreeRepoPullFlags     flags,
+                                                  OstreeSysrootUpgraderPullFlags     upgrader_flags,
+                                                  OstreeAsyncProgress    *progress,
+                                                  gboolean               *out_changed,
+                                                  GCancellable           *cancellable,
+                                                  GError                **error);
+
 G_END_DECLS
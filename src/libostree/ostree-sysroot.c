@@ -31,6 +31,7 @@
 #include "ostree-sepolicy-private.h"
 #include "ostree-sysroot-private.h"
 #include "ostree-deployment-private.h"
+#include "ostree-bootconfig-parser-private.h"
 #include "ostree-bootloader-uboot.h"
 #include "ostree-bootloader-syslinux.h"
 #include "ostree-bootloader-grub2.h"
@@ -167,6 +168,7 @@ ostree_sysroot_init (OstreeSysroot *self)
   const GDebugKey keys[] = {
     { "mutable-deployments", OSTREE_SYSROOT_DEBUG_MUTABLE_DEPLOYMENTS },
     { "no-xattrs", OSTREE_SYSROOT_DEBUG_NO_XATTRS },
+    { "no-etc-journal", OSTREE_SYSROOT_DEBUG_NO_ETC_JOURNAL },
   };
 
   self->debug_flags = g_parse_debug_string (g_getenv ("OSTREE_SYSROOT_DEBUG"),
@@ -245,13 +247,20 @@ gboolean
 _ostree_sysroot_bump_mtime (OstreeSysroot *self,
                             GError       **error)
 {
+  /* The cached deployment state is now out of date; drop it eagerly
+   * rather than relying solely on the mtime key below.
+   */
+  if (unlinkat (self->sysroot_fd, _OSTREE_SYSROOT_STATE_CACHE_PATH, 0) < 0
+      && errno != ENOENT)
+    return glnx_throw_errno_prefix (error, "unlinkat(%s)", _OSTREE_SYSROOT_STATE_CACHE_PATH);
+
   /* Allow other systems to monitor for changes */
   if (utimensat (self->sysroot_fd, "ostree/deploy", NULL, 0) < 0)
     {
       glnx_set_prefix_error_from_errno (error, "%s", "futimens");
       return FALSE;
     }
-  return TRUE; 
+  return TRUE;
 }
 
 /**
@@ -579,6 +588,37 @@ get_unlocked_development_path (OstreeDeployment *deployment)
                           _OSTREE_SYSROOT_DEPLOYMENT_RUNSTATE_FLAG_DEVELOPMENT);
 }
 
+/* The unlocked state lives in /run (and the origin), not in the deploy
+ * directory, so it can change independently of the deployment list; it is
+ * (re)checked both on a full parse and when loading from the state cache.
+ */
+static void
+load_deployment_unlocked_state (OstreeDeployment *deployment)
+{
+  deployment->unlocked = OSTREE_DEPLOYMENT_UNLOCKED_NONE;
+  g_autofree char *unlocked_development_path = get_unlocked_development_path (deployment);
+  struct stat stbuf;
+  if (lstat (unlocked_development_path, &stbuf) == 0)
+    deployment->unlocked = OSTREE_DEPLOYMENT_UNLOCKED_DEVELOPMENT;
+  else
+    {
+      GKeyFile *origin = ostree_deployment_get_origin (deployment);
+      g_autofree char *existing_unlocked_state = origin ?
+        g_key_file_get_string (origin, "origin", "unlocked", NULL) : NULL;
+
+      if (g_strcmp0 (existing_unlocked_state, "hotfix") == 0)
+        {
+          deployment->unlocked = OSTREE_DEPLOYMENT_UNLOCKED_HOTFIX;
+        }
+      /* TODO: warn on unknown unlock types? */
+    }
+
+  g_debug ("Deployment %s.%d unlocked=%d",
+           ostree_deployment_get_csum (deployment),
+           ostree_deployment_get_deployserial (deployment),
+           deployment->unlocked);
+}
+
 static gboolean
 parse_deployment (OstreeSysroot       *self,
                   const char          *boot_link,
@@ -631,24 +671,7 @@ parse_deployment (OstreeSysroot       *self,
   if (origin)
     ostree_deployment_set_origin (ret_deployment, origin);
 
-  ret_deployment->unlocked = OSTREE_DEPLOYMENT_UNLOCKED_NONE;
-  g_autofree char *unlocked_development_path = get_unlocked_development_path (ret_deployment);
-  struct stat stbuf;
-  if (lstat (unlocked_development_path, &stbuf) == 0)
-    ret_deployment->unlocked = OSTREE_DEPLOYMENT_UNLOCKED_DEVELOPMENT;
-  else
-    {
-      g_autofree char *existing_unlocked_state =
-        g_key_file_get_string (origin, "origin", "unlocked", NULL);
-
-      if (g_strcmp0 (existing_unlocked_state, "hotfix") == 0)
-        {
-          ret_deployment->unlocked = OSTREE_DEPLOYMENT_UNLOCKED_HOTFIX;
-        }
-      /* TODO: warn on unknown unlock types? */
-    }
-
-  g_debug ("Deployment %s.%d unlocked=%d", treecsum, deployserial, ret_deployment->unlocked);
+  load_deployment_unlocked_state (ret_deployment);
 
   if (out_deployment)
     *out_deployment = g_steal_pointer (&ret_deployment);
@@ -715,6 +738,163 @@ compare_deployments_by_boot_loader_version_reversed (gconstpointer     a_pp,
   return compare_boot_loader_configs (a_bootconfig, b_bootconfig);
 }
 
+/* The state cache serializes the parsed deployment list, keyed by the mtime
+ * of ostree/deploy, so that repeated loads within one boot (e.g. several
+ * tools invoking `ostree admin status` in sequence) avoid re-parsing every
+ * bootloader entry and origin file.  It's invalidated explicitly by
+ * _ostree_sysroot_bump_mtime(), and implicitly by any mtime change.
+ *
+ * Increment the version on incompatible format changes.
+ */
+#define SYSROOT_STATE_CACHE_VERSION 0
+/* u - cache version
+ * (tt) - ostree/deploy mtime (seconds, nanoseconds)
+ * i - bootversion
+ * i - subbootversion
+ * a(ssisi(a(ss)a{ss})s) - deployments: osname, csum, deployserial, bootcsum,
+ *   bootserial, serialized bootconfig, origin keyfile data ("" if none)
+ */
+#define SYSROOT_STATE_CACHE_GVARIANT_STRING "(u(tt)iia(ssisi(a(ss)a{ss})s))"
+#define SYSROOT_STATE_CACHE_GVARIANT_FORMAT G_VARIANT_TYPE (SYSROOT_STATE_CACHE_GVARIANT_STRING)
+
+/* Returns the cached deployment list if the cache exists and matches the
+ * current ostree/deploy mtime and boot versions, %NULL otherwise.  A missing,
+ * stale, or corrupt cache is never an error; we just fall back to parsing.
+ */
+static GPtrArray *
+sysroot_state_cache_load (OstreeSysroot     *self,
+                          const struct stat *deploy_stbuf,
+                          int                bootversion,
+                          int                subbootversion,
+                          GCancellable      *cancellable)
+{
+  g_autoptr(GVariant) cache = NULL;
+  if (!ot_util_variant_map_at (self->sysroot_fd, _OSTREE_SYSROOT_STATE_CACHE_PATH,
+                               SYSROOT_STATE_CACHE_GVARIANT_FORMAT,
+                               OT_VARIANT_MAP_ALLOW_NOENT, &cache, NULL))
+    return NULL;
+  if (cache == NULL)
+    return NULL;
+
+  guint32 version;
+  guint64 cache_sec;
+  guint64 cache_nsec;
+  gint32 cache_bootversion;
+  gint32 cache_subbootversion;
+  g_autoptr(GVariant) deployments_v = NULL;
+  g_variant_get (cache, "(u(tt)ii@a(ssisi(a(ss)a{ss})s))",
+                 &version, &cache_sec, &cache_nsec,
+                 &cache_bootversion, &cache_subbootversion,
+                 &deployments_v);
+
+  if (version != SYSROOT_STATE_CACHE_VERSION)
+    return NULL;
+  if (cache_sec != (guint64)deploy_stbuf->st_mtim.tv_sec ||
+      cache_nsec != (guint64)deploy_stbuf->st_mtim.tv_nsec)
+    return NULL;
+  if (cache_bootversion != bootversion ||
+      cache_subbootversion != subbootversion)
+    return NULL;
+
+  g_autoptr(GPtrArray) ret_deployments =
+    g_ptr_array_new_with_free_func ((GDestroyNotify)g_object_unref);
+  const gsize n = g_variant_n_children (deployments_v);
+  for (gsize i = 0; i < n; i++)
+    {
+      const char *osname;
+      const char *csum;
+      const char *bootcsum;
+      const char *origin_data;
+      gint32 deployserial;
+      gint32 bootserial;
+      g_autoptr(GVariant) bootconfig_v = NULL;
+      g_variant_get_child (deployments_v, i, "(&s&si&si@(a(ss)a{ss})&s)",
+                           &osname, &csum, &deployserial, &bootcsum, &bootserial,
+                           &bootconfig_v, &origin_data);
+
+      g_autoptr(OstreeDeployment) deployment
+        = ostree_deployment_new ((int)i, osname, csum, deployserial,
+                                 bootcsum, bootserial);
+
+      g_autoptr(OstreeBootconfigParser) bootconfig =
+        _ostree_bootconfig_parser_new_from_variant (bootconfig_v);
+      ostree_deployment_set_bootconfig (deployment, bootconfig);
+
+      g_autoptr(GKeyFile) origin = g_key_file_new ();
+      if (*origin_data)
+        {
+          if (!g_key_file_load_from_data (origin, origin_data, -1, 0, NULL))
+            return NULL;
+        }
+      ostree_deployment_set_origin (deployment, origin);
+
+      load_deployment_unlocked_state (deployment);
+
+      g_ptr_array_add (ret_deployments, g_steal_pointer (&deployment));
+    }
+
+  g_debug ("Loaded %u deployments from state cache", ret_deployments->len);
+  return g_steal_pointer (&ret_deployments);
+}
+
+/* Write the state cache after a full parse.  Purely an optimization; failure
+ * (e.g. an unprivileged caller inspecting a sysroot) is silently ignored.
+ */
+static void
+sysroot_state_cache_save (OstreeSysroot     *self,
+                          const struct stat *deploy_stbuf,
+                          int                bootversion,
+                          int                subbootversion,
+                          GPtrArray         *deployments,
+                          GCancellable      *cancellable)
+{
+  /* Deployments constructed outside the load path may lack a bootconfig;
+   * don't cache in that case.
+   */
+  for (guint i = 0; i < deployments->len; i++)
+    {
+      if (ostree_deployment_get_bootconfig (deployments->pdata[i]) == NULL)
+        return;
+    }
+
+  GVariantBuilder deployments_builder;
+  g_variant_builder_init (&deployments_builder,
+                          G_VARIANT_TYPE ("a(ssisi(a(ss)a{ss})s)"));
+  for (guint i = 0; i < deployments->len; i++)
+    {
+      OstreeDeployment *deployment = deployments->pdata[i];
+      GKeyFile *origin = ostree_deployment_get_origin (deployment);
+      g_autoptr(GVariant) bootconfig_v =
+        _ostree_bootconfig_parser_serialize (ostree_deployment_get_bootconfig (deployment));
+      g_autofree char *origin_data =
+        origin ? g_key_file_to_data (origin, NULL, NULL) : NULL;
+
+      g_variant_builder_add (&deployments_builder, "(ssisi@(a(ss)a{ss})s)",
+                             ostree_deployment_get_osname (deployment),
+                             ostree_deployment_get_csum (deployment),
+                             ostree_deployment_get_deployserial (deployment),
+                             ostree_deployment_get_bootcsum (deployment),
+                             ostree_deployment_get_bootserial (deployment),
+                             bootconfig_v,
+                             origin_data ?: "");
+    }
+
+  g_autoptr(GVariant) cache =
+    g_variant_ref_sink (g_variant_new ("(u(tt)iia(ssisi(a(ss)a{ss})s))",
+                                       (guint32)SYSROOT_STATE_CACHE_VERSION,
+                                       (guint64)deploy_stbuf->st_mtim.tv_sec,
+                                       (guint64)deploy_stbuf->st_mtim.tv_nsec,
+                                       bootversion, subbootversion,
+                                       &deployments_builder));
+
+  (void) glnx_file_replace_contents_at (self->sysroot_fd,
+                                        _OSTREE_SYSROOT_STATE_CACHE_PATH,
+                                        g_variant_get_data (cache),
+                                        g_variant_get_size (cache),
+                                        GLNX_FILE_REPLACE_NODATASYNC,
+                                        cancellable, NULL);
+}
+
 /**
  * ostree_sysroot_load:
  * @self: Sysroot
@@ -744,21 +924,20 @@ ensure_repo_opened (OstreeSysroot  *self,
   return TRUE;
 }
 
-gboolean
-ostree_sysroot_load_if_changed (OstreeSysroot  *self,
-                                gboolean       *out_changed,
-                                GCancellable   *cancellable,
-                                GError        **error)
+/* One optimistic snapshot attempt for ostree_sysroot_load_if_changed();
+ * see the caller for the concurrency rationale.  On success,
+ * @out_version_changed reports whether a concurrent writer swapped the
+ * boot(sub)version while we were reading, in which case the caller
+ * should retry for a consistent snapshot.
+ */
+static gboolean
+sysroot_load_once (OstreeSysroot  *self,
+                   gboolean       *out_changed,
+                   gboolean       *out_version_changed,
+                   GCancellable   *cancellable,
+                   GError        **error)
 {
-  if (!ensure_sysroot_fd (self, error))
-    return FALSE;
-
-  /* Here we also lazily initialize the repository.  We didn't do this
-   * previous to v2017.6, but we do now to support the error-free
-   * ostree_sysroot_repo() API.
-   */
-  if (!ensure_repo_opened (self, error))
-    return FALSE;
+  *out_version_changed = FALSE;
 
   int bootversion = 0;
   if (!read_current_bootversion (self, &bootversion, cancellable, error))
@@ -789,23 +968,32 @@ ostree_sysroot_load_if_changed (OstreeSysroot  *self,
   self->bootversion = -1;
   self->subbootversion = -1;
 
-  g_autoptr(GPtrArray) boot_loader_configs = NULL;
-  if (!_ostree_sysroot_read_boot_loader_configs (self, bootversion, &boot_loader_configs,
-                                                 cancellable, error))
-    return FALSE;
-
-  g_autoptr(GPtrArray) deployments = g_ptr_array_new_with_free_func ((GDestroyNotify)g_object_unref);
+  g_autoptr(GPtrArray) deployments =
+    sysroot_state_cache_load (self, &stbuf, bootversion, subbootversion,
+                              cancellable);
+  const gboolean loaded_from_cache = (deployments != NULL);
 
-  for (guint i = 0; i < boot_loader_configs->len; i++)
+  if (!loaded_from_cache)
     {
-      OstreeBootconfigParser *config = boot_loader_configs->pdata[i];
-
-      if (!list_deployments_process_one_boot_entry (self, config, deployments,
-                                                    cancellable, error))
+      g_autoptr(GPtrArray) boot_loader_configs = NULL;
+      if (!_ostree_sysroot_read_boot_loader_configs (self, bootversion, &boot_loader_configs,
+                                                     cancellable, error))
         return FALSE;
+
+      deployments = g_ptr_array_new_with_free_func ((GDestroyNotify)g_object_unref);
+
+      for (guint i = 0; i < boot_loader_configs->len; i++)
+        {
+          OstreeBootconfigParser *config = boot_loader_configs->pdata[i];
+
+          if (!list_deployments_process_one_boot_entry (self, config, deployments,
+                                                        cancellable, error))
+            return FALSE;
+        }
+
+      g_ptr_array_sort (deployments, compare_deployments_by_boot_loader_version_reversed);
     }
 
-  g_ptr_array_sort (deployments, compare_deployments_by_boot_loader_version_reversed);
   for (guint i = 0; i < deployments->len; i++)
     {
       OstreeDeployment *deployment = deployments->pdata[i];
@@ -816,6 +1004,13 @@ ostree_sysroot_load_if_changed (OstreeSysroot  *self,
                                cancellable, error))
     return FALSE;
 
+  /* Note this must happen before the is_physical check below, which may
+   * reuse stbuf.
+   */
+  if (!loaded_from_cache)
+    sysroot_state_cache_save (self, &stbuf, bootversion, subbootversion,
+                              deployments, cancellable);
+
   /* Determine whether we're "physical" or not, the first time we initialize */
   if (!self->loaded)
     {
@@ -843,11 +1038,80 @@ ostree_sysroot_load_if_changed (OstreeSysroot  *self,
   self->loaded = TRUE;
   self->loaded_ts = stbuf.st_mtim;
 
+  /* Re-read the version state; if a concurrent writer performed the
+   * atomic swap between our first read and now, the pieces we parsed may
+   * span two generations, so tell the caller to retry.
+   */
+  { int bootversion_after = 0;
+    int subbootversion_after = 0;
+
+    if (!read_current_bootversion (self, &bootversion_after, cancellable, error))
+      return FALSE;
+    if (!_ostree_sysroot_read_current_subbootversion (self, bootversion_after,
+                                                      &subbootversion_after,
+                                                      cancellable, error))
+      return FALSE;
+    if (bootversion_after != bootversion || subbootversion_after != subbootversion)
+      *out_version_changed = TRUE;
+  }
+
   if (out_changed)
     *out_changed = TRUE;
   return TRUE;
 }
 
+gboolean
+ostree_sysroot_load_if_changed (OstreeSysroot  *self,
+                                gboolean       *out_changed,
+                                GCancellable   *cancellable,
+                                GError        **error)
+{
+  if (!ensure_sysroot_fd (self, error))
+    return FALSE;
+
+  /* Here we also lazily initialize the repository.  We didn't do this
+   * previous to v2017.6, but we do now to support the error-free
+   * ostree_sysroot_repo() API.
+   */
+  if (!ensure_repo_opened (self, error))
+    return FALSE;
+
+  /* The sysroot lock is writer-exclusive; readers like `ostree admin
+   * status` deliberately don't take it, so they never block behind a
+   * long-running deploy.  Writers publish state with an atomic
+   * boot(sub)version swap, so instead of locking we load optimistically
+   * and retry if the version state moved under us mid-read: a swap can
+   * also produce spurious ENOENT while entries are being replaced, hence
+   * errors are retried too (except on the final attempt).
+   */
+  const guint max_attempts = 3;
+  for (guint attempt = 0; ; attempt++)
+    {
+      const gboolean last_attempt = (attempt + 1 == max_attempts);
+      g_autoptr(GError) local_error = NULL;
+      gboolean version_changed = FALSE;
+
+      if (!sysroot_load_once (self, out_changed, &version_changed,
+                              cancellable, &local_error))
+        {
+          if (last_attempt || g_cancellable_is_cancelled (cancellable))
+            {
+              g_propagate_error (error, g_steal_pointer (&local_error));
+              return FALSE;
+            }
+        }
+      else if (!version_changed)
+        return TRUE;
+      else if (last_attempt)
+        {
+          /* We raced repeatedly; the state we hold is fully parsed, just
+           * possibly already stale, which is inherent to unlocked reads.
+           */
+          return TRUE;
+        }
+    }
+}
+
 int
 ostree_sysroot_get_bootversion (OstreeSysroot   *self)
 {
@@ -1595,27 +1859,13 @@ clone_deployment (OstreeSysroot  *sysroot,
   return ret;
 }
 
-/**
- * ostree_sysroot_deployment_unlock:
- * @self: Sysroot
- * @deployment: Deployment
- * @unlocked_state: Transition to this unlocked state
- * @cancellable: Cancellable
- * @error: Error
- *
- * Configure the target deployment @deployment such that it
- * is writable.  There are multiple modes, essentially differing
- * in whether or not any changes persist across reboot.
- *
- * The `OSTREE_DEPLOYMENT_UNLOCKED_HOTFIX` state is persistent
- * across reboots.
- */
-gboolean
-ostree_sysroot_deployment_unlock (OstreeSysroot     *self,
-                                  OstreeDeployment  *deployment,
-                                  OstreeDeploymentUnlockedState unlocked_state,
-                                  GCancellable      *cancellable,
-                                  GError           **error)
+static gboolean
+sysroot_deployment_unlock_internal (OstreeSysroot     *self,
+                                    OstreeDeployment  *deployment,
+                                    OstreeDeploymentUnlockedState unlocked_state,
+                                    gboolean           skip_rollback_clone,
+                                    GCancellable      *cancellable,
+                                    GError           **error)
 {
   gboolean ret = FALSE;
   g_autoptr(OstreeSePolicy) sepolicy = NULL;
@@ -1650,7 +1900,7 @@ ostree_sysroot_deployment_unlock (OstreeSysroot     *self,
     }
 
   /* For hotfixes, we push a rollback target */
-  if (unlocked_state == OSTREE_DEPLOYMENT_UNLOCKED_HOTFIX)
+  if (unlocked_state == OSTREE_DEPLOYMENT_UNLOCKED_HOTFIX && !skip_rollback_clone)
     {
       if (!clone_deployment (self, deployment, merge_deployment, cancellable, error))
         goto out;
@@ -1800,3 +2050,47 @@ ostree_sysroot_deployment_unlock (OstreeSysroot     *self,
  out:
   return ret;
 }
+
+/**
+ * ostree_sysroot_deployment_unlock:
+ * @self: Sysroot
+ * @deployment: Deployment
+ * @unlocked_state: Transition to this unlocked state
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Configure the target deployment @deployment such that it
+ * is writable.  There are multiple modes, essentially differing
+ * in whether or not any changes persist across reboot.
+ *
+ * The `OSTREE_DEPLOYMENT_UNLOCKED_HOTFIX` state is persistent
+ * across reboots.
+ */
+gboolean
+ostree_sysroot_deployment_unlock (OstreeSysroot     *self,
+                                  OstreeDeployment  *deployment,
+                                  OstreeDeploymentUnlockedState unlocked_state,
+                                  GCancellable      *cancellable,
+                                  GError           **error)
+{
+  return sysroot_deployment_unlock_internal (self, deployment, unlocked_state,
+                                             FALSE, cancellable, error);
+}
+
+/* Like ostree_sysroot_deployment_unlock() in hotfix mode, but skips
+ * the up-front hardlink rollback clone, which for large deployments
+ * dominates the cost of unlocking.  The overlayfs mount itself is
+ * O(1); a rollback target can be produced later by harvesting the
+ * copied-up files with `ostree admin commit-hotfix` and deploying the
+ * result.
+ */
+gboolean
+_ostree_sysroot_deployment_unlock_no_clone (OstreeSysroot     *self,
+                                            OstreeDeployment  *deployment,
+                                            GCancellable      *cancellable,
+                                            GError           **error)
+{
+  return sysroot_deployment_unlock_internal (self, deployment,
+                                             OSTREE_DEPLOYMENT_UNLOCKED_HOTFIX,
+                                             TRUE, cancellable, error);
+}
@@ -119,6 +119,11 @@ gboolean ostree_sysroot_prepare_cleanup (OstreeSysroot  *self,
                                          GCancellable   *cancellable,
                                          GError        **error);
 
+_OSTREE_PUBLIC
+gboolean ostree_sysroot_cleanup_prune_repo (OstreeSysroot  *self,
+                                            GCancellable   *cancellable,
+                                            GError        **error);
+
 _OSTREE_PUBLIC
 gboolean ostree_sysroot_write_origin_file (OstreeSysroot         *sysroot,
                                            OstreeDeployment      *deployment,
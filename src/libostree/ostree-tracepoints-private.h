@@ -0,0 +1,44 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2017 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include "config.h"
+
+/* Static (USDT) tracepoints for the hot paths, in the "ostree"
+ * provider; they compile to a single nop unless a tracer like
+ * systemtap, bpftrace or perf attaches, so they're always on.
+ * Example:
+ *
+ *   bpftrace -e 'usdt:/usr/lib64/libostree-1.so:ostree:fetch_done
+ *                { @bytes = sum(arg1); }'
+ */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define ostree_probe1(name, a1)             STAP_PROBE1 (ostree, name, a1)
+#define ostree_probe2(name, a1, a2)         STAP_PROBE2 (ostree, name, a1, a2)
+#define ostree_probe3(name, a1, a2, a3)     STAP_PROBE3 (ostree, name, a1, a2, a3)
+#define ostree_probe4(name, a1, a2, a3, a4) STAP_PROBE4 (ostree, name, a1, a2, a3, a4)
+#else
+#define ostree_probe1(name, a1)             do { } while (0)
+#define ostree_probe2(name, a1, a2)         do { } while (0)
+#define ostree_probe3(name, a1, a2, a3)     do { } while (0)
+#define ostree_probe4(name, a1, a2, a3, a4) do { } while (0)
+#endif
@@ -99,6 +99,69 @@ _ostree_read_varuint64 (const guint8   *buf,
   return TRUE;
 }
 
+/**
+ * _ostree_read_varuint64_run:
+ * @buf: (array length=buflen): Byte buffer
+ * @buflen: Length of bytes in @buf
+ * @out_values: (array length=n_values): Decoded values
+ * @n_values: Number of consecutive varints to decode
+ * @bytes_read: (out): Total number of bytes consumed
+ *
+ * Decode @n_values consecutive varints from @buf in a single pass.
+ * The 1- and 2-byte encodings that dominate delta opcode streams
+ * (table indexes and small lengths) are decoded without entering the
+ * general loop.
+ *
+ * Returns: %TRUE on success, %FALSE on end of stream
+ */
+gboolean
+_ostree_read_varuint64_run (const guint8   *buf,
+                            gsize           buflen,
+                            guint64        *out_values,
+                            gsize           n_values,
+                            gsize          *bytes_read)
+{
+  const guint8 *p = buf;
+  const guint8 *end = buf + buflen;
+
+  for (gsize i = 0; i < n_values; i++)
+    {
+      guint64 result;
+
+      if (G_LIKELY (p < end && (p[0] & 0x80) == 0))
+        {
+          result = p[0];
+          p += 1;
+        }
+      else if (G_LIKELY (p + 1 < end && (p[1] & 0x80) == 0))
+        {
+          result = (guint64)(p[0] & 0x7F) | ((guint64)p[1] << 7);
+          p += 2;
+        }
+      else
+        {
+          int count = 0;
+          guint8 b;
+
+          result = 0;
+          do
+            {
+              if (count == max_varint_bytes || p == end)
+                return FALSE;
+              b = *p++;
+              result |= ((guint64)(b & 0x7F)) << (7 * count);
+              ++count;
+            }
+          while (b & 0x80);
+        }
+
+      out_values[i] = result;
+    }
+
+  *bytes_read = p - buf;
+  return TRUE;
+}
+
 /**
  * _ostree_write_varuint64:
  * @buf: Target buffer (will contain binary data)
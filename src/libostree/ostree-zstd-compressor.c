@@ -0,0 +1,236 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2017 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "ostree-zstd-compressor.h"
+
+#include <string.h>
+#include <zstd.h>
+
+enum {
+  PROP_0,
+  PROP_PARAMS
+};
+
+/**
+ * SECTION:ostree-zstd-compressor
+ * @title: Zstandard compressor
+ *
+ * An implementation of #GConverter that compresses data using
+ * Zstandard.
+ */
+
+static void _ostree_zstd_compressor_iface_init          (GConverterIface *iface);
+
+struct _OstreeZstdCompressor
+{
+  GObject parent_instance;
+
+  GVariant *params;
+  ZSTD_CStream *cstream;
+};
+
+G_DEFINE_TYPE_WITH_CODE (OstreeZstdCompressor, _ostree_zstd_compressor,
+                         G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_CONVERTER,
+                                                _ostree_zstd_compressor_iface_init))
+
+static void
+_ostree_zstd_compressor_finalize (GObject *object)
+{
+  OstreeZstdCompressor *self = OSTREE_ZSTD_COMPRESSOR (object);
+
+  g_clear_pointer (&self->cstream, (GDestroyNotify)ZSTD_freeCStream);
+  g_clear_pointer (&self->params, (GDestroyNotify)g_variant_unref);
+
+  G_OBJECT_CLASS (_ostree_zstd_compressor_parent_class)->finalize (object);
+}
+
+static void
+_ostree_zstd_compressor_set_property (GObject      *object,
+                                      guint         prop_id,
+                                      const GValue *value,
+                                      GParamSpec   *pspec)
+{
+  OstreeZstdCompressor *self = OSTREE_ZSTD_COMPRESSOR (object);
+
+  switch (prop_id)
+    {
+    case PROP_PARAMS:
+      self->params = g_value_dup_variant (value);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+_ostree_zstd_compressor_get_property (GObject    *object,
+                                      guint       prop_id,
+                                      GValue     *value,
+                                      GParamSpec *pspec)
+{
+  OstreeZstdCompressor *self = OSTREE_ZSTD_COMPRESSOR (object);
+
+  switch (prop_id)
+    {
+    case PROP_PARAMS:
+      g_value_set_variant (value, self->params);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+_ostree_zstd_compressor_init (OstreeZstdCompressor *self)
+{
+}
+
+static void
+_ostree_zstd_compressor_class_init (OstreeZstdCompressorClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->finalize = _ostree_zstd_compressor_finalize;
+  gobject_class->get_property = _ostree_zstd_compressor_get_property;
+  gobject_class->set_property = _ostree_zstd_compressor_set_property;
+
+  g_object_class_install_property (gobject_class,
+                                   PROP_PARAMS,
+                                   g_param_spec_variant ("params", "", "",
+                                                         G_VARIANT_TYPE ("a{sv}"),
+                                                         NULL,
+                                                         G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY |
+                                                         G_PARAM_STATIC_STRINGS));
+}
+
+/* @params may be %NULL for the defaults, or an a{sv} with:
+ *   - level: u: zstd compression level (default 10)
+ */
+OstreeZstdCompressor *
+_ostree_zstd_compressor_new (GVariant *params)
+{
+  return g_object_new (OSTREE_TYPE_ZSTD_COMPRESSOR,
+                       "params", params,
+                       NULL);
+}
+
+static void
+_ostree_zstd_compressor_reset (GConverter *converter)
+{
+  OstreeZstdCompressor *self = OSTREE_ZSTD_COMPRESSOR (converter);
+
+  g_clear_pointer (&self->cstream, (GDestroyNotify)ZSTD_freeCStream);
+}
+
+static GConverterResult
+zstd_return (size_t res, GError **error)
+{
+  if (ZSTD_isError (res))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "zstd: %s", ZSTD_getErrorName (res));
+      return G_CONVERTER_ERROR;
+    }
+  return G_CONVERTER_CONVERTED;
+}
+
+static GConverterResult
+_ostree_zstd_compressor_convert (GConverter *converter,
+                                 const void *inbuf,
+                                 gsize       inbuf_size,
+                                 void       *outbuf,
+                                 gsize       outbuf_size,
+                                 GConverterFlags flags,
+                                 gsize      *bytes_read,
+                                 gsize      *bytes_written,
+                                 GError    **error)
+{
+  OstreeZstdCompressor *self = OSTREE_ZSTD_COMPRESSOR (converter);
+  size_t res;
+
+  if (inbuf_size != 0 && outbuf_size == 0)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
+         "Output buffer too small");
+      return G_CONVERTER_ERROR;
+    }
+
+  if (self->cstream == NULL)
+    {
+      guint32 level = 10;
+
+      if (self->params)
+        (void) g_variant_lookup (self->params, "level", "u", &level);
+
+      self->cstream = ZSTD_createCStream ();
+      if (self->cstream == NULL)
+        {
+          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                               "zstd: failed to create compression stream");
+          return G_CONVERTER_ERROR;
+        }
+      res = ZSTD_initCStream (self->cstream, level);
+      if (ZSTD_isError (res))
+        return zstd_return (res, error);
+    }
+
+  ZSTD_inBuffer input = { inbuf, inbuf_size, 0 };
+  ZSTD_outBuffer output = { outbuf, outbuf_size, 0 };
+
+  res = ZSTD_compressStream (self->cstream, &output, &input);
+  if (ZSTD_isError (res))
+    return zstd_return (res, error);
+
+  GConverterResult ret = G_CONVERTER_CONVERTED;
+  if ((flags & G_CONVERTER_INPUT_AT_END) && input.pos == input.size)
+    {
+      res = ZSTD_endStream (self->cstream, &output);
+      if (ZSTD_isError (res))
+        return zstd_return (res, error);
+      /* endStream returns the number of bytes still to flush */
+      if (res == 0)
+        ret = G_CONVERTER_FINISHED;
+    }
+  else if ((flags & G_CONVERTER_FLUSH) && input.pos == input.size)
+    {
+      res = ZSTD_flushStream (self->cstream, &output);
+      if (ZSTD_isError (res))
+        return zstd_return (res, error);
+      if (res == 0)
+        ret = G_CONVERTER_FLUSHED;
+    }
+
+  *bytes_read = input.pos;
+  *bytes_written = output.pos;
+
+  return ret;
+}
+
+static void
+_ostree_zstd_compressor_iface_init (GConverterIface *iface)
+{
+  iface->convert = _ostree_zstd_compressor_convert;
+  iface->reset = _ostree_zstd_compressor_reset;
+}
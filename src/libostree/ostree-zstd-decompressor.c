@@ -0,0 +1,146 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2017 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "ostree-zstd-decompressor.h"
+
+#include <string.h>
+#include <zstd.h>
+
+/**
+ * SECTION:ostree-zstd-decompressor
+ * @title: Zstandard decompressor
+ *
+ * An implementation of #GConverter that decompresses data compressed
+ * with Zstandard.
+ */
+
+static void _ostree_zstd_decompressor_iface_init          (GConverterIface *iface);
+
+struct _OstreeZstdDecompressor
+{
+  GObject parent_instance;
+
+  ZSTD_DStream *dstream;
+};
+
+G_DEFINE_TYPE_WITH_CODE (OstreeZstdDecompressor, _ostree_zstd_decompressor,
+                         G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_CONVERTER,
+                                                _ostree_zstd_decompressor_iface_init))
+
+static void
+_ostree_zstd_decompressor_finalize (GObject *object)
+{
+  OstreeZstdDecompressor *self = OSTREE_ZSTD_DECOMPRESSOR (object);
+
+  g_clear_pointer (&self->dstream, (GDestroyNotify)ZSTD_freeDStream);
+
+  G_OBJECT_CLASS (_ostree_zstd_decompressor_parent_class)->finalize (object);
+}
+
+static void
+_ostree_zstd_decompressor_init (OstreeZstdDecompressor *self)
+{
+}
+
+static void
+_ostree_zstd_decompressor_class_init (OstreeZstdDecompressorClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->finalize = _ostree_zstd_decompressor_finalize;
+}
+
+OstreeZstdDecompressor *
+_ostree_zstd_decompressor_new (void)
+{
+  return g_object_new (OSTREE_TYPE_ZSTD_DECOMPRESSOR, NULL);
+}
+
+static void
+_ostree_zstd_decompressor_reset (GConverter *converter)
+{
+  OstreeZstdDecompressor *self = OSTREE_ZSTD_DECOMPRESSOR (converter);
+
+  g_clear_pointer (&self->dstream, (GDestroyNotify)ZSTD_freeDStream);
+}
+
+static GConverterResult
+_ostree_zstd_decompressor_convert (GConverter *converter,
+                                   const void *inbuf,
+                                   gsize       inbuf_size,
+                                   void       *outbuf,
+                                   gsize       outbuf_size,
+                                   GConverterFlags flags,
+                                   gsize      *bytes_read,
+                                   gsize      *bytes_written,
+                                   GError    **error)
+{
+  OstreeZstdDecompressor *self = OSTREE_ZSTD_DECOMPRESSOR (converter);
+  size_t res;
+
+  if (inbuf_size != 0 && outbuf_size == 0)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
+         "Output buffer too small");
+      return G_CONVERTER_ERROR;
+    }
+
+  if (self->dstream == NULL)
+    {
+      self->dstream = ZSTD_createDStream ();
+      if (self->dstream == NULL)
+        {
+          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                               "zstd: failed to create decompression stream");
+          return G_CONVERTER_ERROR;
+        }
+      res = ZSTD_initDStream (self->dstream);
+      if (ZSTD_isError (res))
+        goto out;
+    }
+
+  ZSTD_inBuffer input = { inbuf, inbuf_size, 0 };
+  ZSTD_outBuffer output = { outbuf, outbuf_size, 0 };
+
+  res = ZSTD_decompressStream (self->dstream, &output, &input);
+  if (ZSTD_isError (res))
+    goto out;
+
+  *bytes_read = input.pos;
+  *bytes_written = output.pos;
+
+  /* res == 0 means a frame is fully decoded and flushed */
+  if (res == 0 && (flags & G_CONVERTER_INPUT_AT_END) && input.pos == input.size)
+    return G_CONVERTER_FINISHED;
+  return G_CONVERTER_CONVERTED;
+
+ out:
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+               "zstd: %s", ZSTD_getErrorName (res));
+  return G_CONVERTER_ERROR;
+}
+
+static void
+_ostree_zstd_decompressor_iface_init (GConverterIface *iface)
+{
+  iface->convert = _ostree_zstd_decompressor_convert;
+  iface->reset = _ostree_zstd_decompressor_reset;
+}
@@ -29,6 +29,11 @@
 
 G_DEFINE_TYPE (OtChecksumInstream, ot_checksum_instream, G_TYPE_FILTER_INPUT_STREAM)
 
+typedef struct {
+  GChecksumType checksum_type;
+  GChecksum *checksum;
+} OtExtraDigest;
+
 struct _OtChecksumInstreamPrivate {
 #ifdef HAVE_OPENSSL
   EVP_MD_CTX *checksum;
@@ -36,6 +41,9 @@ struct _OtChecksumInstreamPrivate {
   GChecksumType checksum_type;
   GChecksum *checksum;
 #endif
+  /* Additional digests updated in the same pass; %NULL unless
+   * ot_checksum_instream_add_digest() was called. */
+  GPtrArray *additional;
 };
 
 static gssize   ot_checksum_instream_read         (GInputStream         *stream,
@@ -54,6 +62,7 @@ ot_checksum_instream_finalize (GObject *object)
 #else
   g_checksum_free (self->priv->checksum);
 #endif
+  g_clear_pointer (&self->priv->additional, g_ptr_array_unref);
 
   G_OBJECT_CLASS (ot_checksum_instream_parent_class)->finalize (object);
 }
@@ -118,6 +127,32 @@ ot_checksum_instream_new (GInputStream    *base,
   return (OtChecksumInstream*) (stream);
 }
 
+static void
+ot_extra_digest_free (gpointer data)
+{
+  OtExtraDigest *extra = data;
+  g_checksum_free (extra->checksum);
+  g_free (extra);
+}
+
+/* Register an additional digest to be computed over the same bytes as
+ * the primary checksum, interleaved in the single read pass.  Must be
+ * called before any data has been read from the stream.
+ */
+void
+ot_checksum_instream_add_digest (OtChecksumInstream *stream,
+                                 GChecksumType       checksum_type)
+{
+  OtExtraDigest *extra = g_new0 (OtExtraDigest, 1);
+
+  extra->checksum_type = checksum_type;
+  extra->checksum = g_checksum_new (checksum_type);
+
+  if (stream->priv->additional == NULL)
+    stream->priv->additional = g_ptr_array_new_with_free_func (ot_extra_digest_free);
+  g_ptr_array_add (stream->priv->additional, extra);
+}
+
 static gssize
 ot_checksum_instream_read (GInputStream  *stream,
                            void          *buffer,
@@ -141,6 +176,14 @@ ot_checksum_instream_read (GInputStream  *stream,
 #else
       g_checksum_update (self->priv->checksum, buffer, res);
 #endif
+      if (self->priv->additional != NULL)
+        {
+          for (guint i = 0; i < self->priv->additional->len; i++)
+            {
+              OtExtraDigest *extra = self->priv->additional->pdata[i];
+              g_checksum_update (extra->checksum, buffer, res);
+            }
+        }
     }
 
   return res;
@@ -179,6 +222,24 @@ ot_checksum_instream_dup_digest (OtChecksumInstream *stream,
   return ret;
 }
 
+/* Fetch the hex digest for an additional algorithm registered with
+ * ot_checksum_instream_add_digest().  Like the primary digest, it can
+ * only be fetched once.
+ */
+char *
+ot_checksum_instream_get_extra_digest_string (OtChecksumInstream *stream,
+                                              GChecksumType       checksum_type)
+{
+  g_assert (stream->priv->additional != NULL);
+  for (guint i = 0; i < stream->priv->additional->len; i++)
+    {
+      OtExtraDigest *extra = stream->priv->additional->pdata[i];
+      if (extra->checksum_type == checksum_type)
+        return g_strdup (g_checksum_get_string (extra->checksum));
+    }
+  g_assert_not_reached ();
+}
+
 char *
 ot_checksum_instream_get_string (OtChecksumInstream *stream)
 {
@@ -53,6 +53,12 @@ GType          ot_checksum_instream_get_type     (void) G_GNUC_CONST;
 
 OtChecksumInstream * ot_checksum_instream_new          (GInputStream   *stream, GChecksumType   checksum);
 
+void   ot_checksum_instream_add_digest (OtChecksumInstream *stream,
+                                        GChecksumType       checksum_type);
+
+char * ot_checksum_instream_get_extra_digest_string (OtChecksumInstream *stream,
+                                                     GChecksumType       checksum_type);
+
 void   ot_checksum_instream_get_digest (OtChecksumInstream *stream,
                                         guint8          *buffer,
                                         gsize           *digest_len);
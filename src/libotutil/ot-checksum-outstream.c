@@ -0,0 +1,140 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2017 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include "ot-checksum-outstream.h"
+#include "ot-checksum-utils.h"
+
+/* The write-side counterpart of OtChecksumInstream; every byte written
+ * through this stream also updates the digest, so copy-to-tmpfile paths
+ * can compute the object checksum in the same pass as the write.
+ */
+
+G_DEFINE_TYPE (OtChecksumOutstream, ot_checksum_outstream, G_TYPE_FILTER_OUTPUT_STREAM)
+
+struct _OtChecksumOutstreamPrivate {
+  OtChecksum checksum;
+};
+
+static gssize   ot_checksum_outstream_write        (GOutputStream        *stream,
+                                                    const void           *buffer,
+                                                    gsize                 count,
+                                                    GCancellable         *cancellable,
+                                                    GError              **error);
+
+static void
+ot_checksum_outstream_finalize (GObject *object)
+{
+  OtChecksumOutstream *self = (OtChecksumOutstream*)object;
+
+  ot_checksum_clear (&self->priv->checksum);
+
+  G_OBJECT_CLASS (ot_checksum_outstream_parent_class)->finalize (object);
+}
+
+static void
+ot_checksum_outstream_class_init (OtChecksumOutstreamClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GOutputStreamClass *stream_class = G_OUTPUT_STREAM_CLASS (klass);
+
+  g_type_class_add_private (klass, sizeof (OtChecksumOutstreamPrivate));
+
+  object_class->finalize = ot_checksum_outstream_finalize;
+  stream_class->write_fn = ot_checksum_outstream_write;
+}
+
+static void
+ot_checksum_outstream_init (OtChecksumOutstream *self)
+{
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, OT_TYPE_CHECKSUM_OUTSTREAM, OtChecksumOutstreamPrivate);
+}
+
+OtChecksumOutstream *
+ot_checksum_outstream_new (GOutputStream   *base,
+                           GChecksumType    checksum_type)
+{
+  OtChecksumOutstream *stream;
+
+  g_return_val_if_fail (G_IS_OUTPUT_STREAM (base), NULL);
+
+  stream = g_object_new (OT_TYPE_CHECKSUM_OUTSTREAM,
+                         "base-stream", base,
+                         NULL);
+
+  /* For now */
+  g_assert (checksum_type == G_CHECKSUM_SHA256);
+
+  ot_checksum_init (&stream->priv->checksum);
+
+  return (OtChecksumOutstream*) (stream);
+}
+
+static gssize
+ot_checksum_outstream_write (GOutputStream  *stream,
+                             const void     *buffer,
+                             gsize           count,
+                             GCancellable   *cancellable,
+                             GError        **error)
+{
+  OtChecksumOutstream *self = (OtChecksumOutstream*) stream;
+  GFilterOutputStream *fself = (GFilterOutputStream*) self;
+  gssize res = -1;
+
+  res = g_output_stream_write (fself->base_stream,
+                               buffer,
+                               count,
+                               cancellable,
+                               error);
+  if (res > 0)
+    ot_checksum_update (&self->priv->checksum, buffer, res);
+
+  return res;
+}
+
+void
+ot_checksum_outstream_get_digest (OtChecksumOutstream *stream,
+                                  guint8          *buffer,
+                                  gsize           *digest_len)
+{
+  ot_checksum_get_digest (&stream->priv->checksum, buffer, OT_CHECKSUM_DIGEST_LEN);
+  if (digest_len)
+    *digest_len = OT_CHECKSUM_DIGEST_LEN;
+}
+
+guint8*
+ot_checksum_outstream_dup_digest (OtChecksumOutstream *stream,
+                                  gsize              *ret_len)
+{
+  guchar *ret = g_malloc (OT_CHECKSUM_DIGEST_LEN);
+  ot_checksum_get_digest (&stream->priv->checksum, ret, OT_CHECKSUM_DIGEST_LEN);
+  if (ret_len)
+    *ret_len = OT_CHECKSUM_DIGEST_LEN;
+  return ret;
+}
+
+char *
+ot_checksum_outstream_get_string (OtChecksumOutstream *stream)
+{
+  char hexdigest[OT_CHECKSUM_DIGEST_HEXLEN];
+  ot_checksum_get_hexdigest (&stream->priv->checksum, hexdigest, sizeof (hexdigest));
+  return g_strdup (hexdigest);
+}
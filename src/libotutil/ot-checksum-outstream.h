@@ -0,0 +1,64 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2017 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define OT_TYPE_CHECKSUM_OUTSTREAM         (ot_checksum_outstream_get_type ())
+#define OT_CHECKSUM_OUTSTREAM(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), OT_TYPE_CHECKSUM_OUTSTREAM, OtChecksumOutstream))
+#define OT_CHECKSUM_OUTSTREAM_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST((k), OT_TYPE_CHECKSUM_OUTSTREAM, OtChecksumOutstreamClass))
+#define OT_IS_CHECKSUM_OUTSTREAM(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), OT_TYPE_CHECKSUM_OUTSTREAM))
+#define OT_IS_CHECKSUM_OUTSTREAM_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), OT_TYPE_CHECKSUM_OUTSTREAM))
+#define OT_CHECKSUM_OUTSTREAM_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), OT_TYPE_CHECKSUM_OUTSTREAM, OtChecksumOutstreamClass))
+
+typedef struct _OtChecksumOutstream         OtChecksumOutstream;
+typedef struct _OtChecksumOutstreamClass    OtChecksumOutstreamClass;
+typedef struct _OtChecksumOutstreamPrivate  OtChecksumOutstreamPrivate;
+
+struct _OtChecksumOutstream
+{
+  GFilterOutputStream parent_instance;
+
+  /*< private >*/
+  OtChecksumOutstreamPrivate *priv;
+};
+
+struct _OtChecksumOutstreamClass
+{
+  GFilterOutputStreamClass parent_class;
+};
+
+GType          ot_checksum_outstream_get_type     (void) G_GNUC_CONST;
+
+OtChecksumOutstream * ot_checksum_outstream_new          (GOutputStream  *stream, GChecksumType   checksum);
+
+void   ot_checksum_outstream_get_digest (OtChecksumOutstream *stream,
+                                         guint8          *buffer,
+                                         gsize           *digest_len);
+
+guint8* ot_checksum_outstream_dup_digest (OtChecksumOutstream *stream,
+                                          gsize              *ret_len);
+char * ot_checksum_outstream_get_string (OtChecksumOutstream *stream);
+
+G_END_DECLS
@@ -24,6 +24,10 @@
 
 #include "otutil.h"
 
+#ifdef HAVE_OPENSSL
+#include <openssl/evp.h>
+#endif
+
 #include <string.h>
 
 
@@ -53,14 +57,232 @@ ot_csum_from_gchecksum (GChecksum  *checksum)
   return ret;
 }
 
+void
+ot_checksum_init (OtChecksum *checksum)
+{
+  g_return_if_fail (!checksum->initialized);
+#ifdef HAVE_OPENSSL
+  EVP_MD_CTX *ctx = EVP_MD_CTX_create ();
+  g_assert (ctx);
+  g_assert (EVP_DigestInit_ex (ctx, EVP_sha256 (), NULL));
+  checksum->data[0] = ctx;
+#else
+  checksum->data[0] = g_checksum_new (G_CHECKSUM_SHA256);
+#endif
+  checksum->initialized = TRUE;
+}
+
+void
+ot_checksum_update (OtChecksum   *checksum,
+                    const guint8 *buf,
+                    size_t        len)
+{
+  g_return_if_fail (checksum->initialized);
+#ifdef HAVE_OPENSSL
+  g_assert (EVP_DigestUpdate ((EVP_MD_CTX*)checksum->data[0], buf, len));
+#else
+  g_checksum_update ((GChecksum*)checksum->data[0], buf, len);
+#endif
+}
+
+void
+ot_checksum_get_digest (OtChecksum *checksum,
+                        guint8     *buf,
+                        size_t      buflen)
+{
+  g_return_if_fail (checksum->initialized);
+  g_assert_cmpint (buflen, ==, OT_CHECKSUM_DIGEST_LEN);
+#ifdef HAVE_OPENSSL
+  unsigned len;
+  g_assert (EVP_DigestFinal_ex ((EVP_MD_CTX*)checksum->data[0], buf, &len));
+  g_assert_cmpint (len, ==, OT_CHECKSUM_DIGEST_LEN);
+#else
+  gsize len = buflen;
+  g_checksum_get_digest ((GChecksum*)checksum->data[0], buf, &len);
+  g_assert_cmpint (len, ==, OT_CHECKSUM_DIGEST_LEN);
+#endif
+  /* A checksum can only be finalized once */
+  checksum->initialized = FALSE;
+}
+
+void
+ot_checksum_get_hexdigest (OtChecksum *checksum,
+                           char       *buf,
+                           size_t      buflen)
+{
+  guint8 digest[OT_CHECKSUM_DIGEST_LEN];
+
+  g_assert_cmpint (buflen, ==, OT_CHECKSUM_DIGEST_HEXLEN);
+  ot_checksum_get_digest (checksum, digest, sizeof (digest));
+  ot_bin2hex (buf, digest, sizeof (digest));
+}
+
+void
+ot_checksum_clear (OtChecksum *checksum)
+{
+  if (checksum->data[0] == NULL)
+    return;
+#ifdef HAVE_OPENSSL
+  EVP_MD_CTX_destroy ((EVP_MD_CTX*)checksum->data[0]);
+#else
+  g_checksum_free ((GChecksum*)checksum->data[0]);
+#endif
+  checksum->data[0] = NULL;
+  checksum->initialized = FALSE;
+}
+
+/* Feed into @checksum the content of @fd starting from offset 0; the
+ * fd's own file offset is left untouched.
+ */
 gboolean
-ot_gio_write_update_checksum (GOutputStream  *out,
-                              gconstpointer   data,
-                              gsize           len,
-                              gsize          *out_bytes_written,
-                              GChecksum      *checksum,
-                              GCancellable   *cancellable,
-                              GError        **error)
+ot_checksum_update_from_fd (OtChecksum *checksum,
+                            int         fd,
+                            GError    **error)
+{
+  guint8 buf[8192];
+  off_t offset = 0;
+
+  while (TRUE)
+    {
+      ssize_t bytes_read = TEMP_FAILURE_RETRY (pread (fd, buf, sizeof (buf), offset));
+      if (bytes_read < 0)
+        return glnx_throw_errno_prefix (error, "pread");
+      if (bytes_read == 0)
+        break;
+      ot_checksum_update (checksum, buf, bytes_read);
+      offset += bytes_read;
+    }
+
+  return TRUE;
+}
+
+/* CRC32C (the Castagnoli polynomial, reflected).  Chosen over plain
+ * CRC32 because both x86 SSE4.2 and ARMv8 have instructions for it,
+ * which run at memory bandwidth; when the compiler targets those we
+ * use the builtins, otherwise a bytewise table fallback.
+ */
+#if defined(__SSE4_2__)
+
+static guint32
+crc32c_update (guint32 crc, const guint8 *buf, gsize len)
+{
+  while (len >= sizeof (guint64))
+    {
+      guint64 chunk;
+      memcpy (&chunk, buf, sizeof (chunk));
+      crc = (guint32)__builtin_ia32_crc32di (crc, chunk);
+      buf += sizeof (chunk);
+      len -= sizeof (chunk);
+    }
+  while (len > 0)
+    {
+      crc = __builtin_ia32_crc32qi (crc, *buf);
+      buf++;
+      len--;
+    }
+  return crc;
+}
+
+#elif defined(__ARM_FEATURE_CRC32)
+
+#include <arm_acle.h>
+
+static guint32
+crc32c_update (guint32 crc, const guint8 *buf, gsize len)
+{
+  while (len >= sizeof (guint64))
+    {
+      guint64 chunk;
+      memcpy (&chunk, buf, sizeof (chunk));
+      crc = __crc32cd (crc, chunk);
+      buf += sizeof (chunk);
+      len -= sizeof (chunk);
+    }
+  while (len > 0)
+    {
+      crc = __crc32cb (crc, *buf);
+      buf++;
+      len--;
+    }
+  return crc;
+}
+
+#else
+
+static guint32 crc32c_table[256];
+
+static gpointer
+crc32c_table_init (gpointer unused)
+{
+  for (guint32 i = 0; i < 256; i++)
+    {
+      guint32 c = i;
+      for (int k = 0; k < 8; k++)
+        c = (c & 1) ? (0x82f63b78 ^ (c >> 1)) : (c >> 1);
+      crc32c_table[i] = c;
+    }
+  return NULL;
+}
+
+static guint32
+crc32c_update (guint32 crc, const guint8 *buf, gsize len)
+{
+  static GOnce table_once = G_ONCE_INIT;
+  g_once (&table_once, crc32c_table_init, NULL);
+
+  while (len > 0)
+    {
+      crc = crc32c_table[(crc ^ *buf) & 0xff] ^ (crc >> 8);
+      buf++;
+      len--;
+    }
+  return crc;
+}
+
+#endif
+
+guint32
+ot_crc32c (guint32 crc, const guint8 *buf, gsize len)
+{
+  return ~crc32c_update (~crc, buf, len);
+}
+
+/* CRC32C of the content of @fd starting from offset 0; the fd's own
+ * file offset is left untouched.
+ */
+gboolean
+ot_crc32c_fd (int      fd,
+              guint32 *out_crc,
+              GError **error)
+{
+  guint8 buf[65536];
+  off_t offset = 0;
+  guint32 crc = 0;
+
+  while (TRUE)
+    {
+      ssize_t bytes_read = TEMP_FAILURE_RETRY (pread (fd, buf, sizeof (buf), offset));
+      if (bytes_read < 0)
+        return glnx_throw_errno_prefix (error, "pread");
+      if (bytes_read == 0)
+        break;
+      crc = ot_crc32c (crc, buf, bytes_read);
+      offset += bytes_read;
+    }
+
+  *out_crc = crc;
+  return TRUE;
+}
+
+gboolean
+ot_gio_write_update_checksums (GOutputStream  *out,
+                               gconstpointer   data,
+                               gsize           len,
+                               gsize          *out_bytes_written,
+                               GChecksum     **checksums,
+                               guint           n_checksums,
+                               GCancellable   *cancellable,
+                               GError        **error)
 {
   if (out)
     {
@@ -73,21 +295,40 @@ ot_gio_write_update_checksum (GOutputStream  *out,
       *out_bytes_written = len;
     }
 
-  if (checksum)
-    g_checksum_update (checksum, data, len);
+  for (guint i = 0; i < n_checksums; i++)
+    g_checksum_update (checksums[i], data, len);
   return TRUE;
 }
 
 gboolean
-ot_gio_splice_update_checksum (GOutputStream  *out,
-                               GInputStream   *in,
-                               GChecksum      *checksum,
-                               GCancellable   *cancellable,
-                               GError        **error)
+ot_gio_write_update_checksum (GOutputStream  *out,
+                              gconstpointer   data,
+                              gsize           len,
+                              gsize          *out_bytes_written,
+                              GChecksum      *checksum,
+                              GCancellable   *cancellable,
+                              GError        **error)
 {
-  g_return_val_if_fail (out != NULL || checksum != NULL, FALSE);
+  return ot_gio_write_update_checksums (out, data, len, out_bytes_written,
+                                        &checksum, checksum != NULL ? 1 : 0,
+                                        cancellable, error);
+}
 
-  if (checksum != NULL)
+/* Copy @in to @out (if any), updating all of @checksums with the data
+ * as it streams past - multiple digests cost one read pass, not one
+ * pass per algorithm.
+ */
+gboolean
+ot_gio_splice_update_checksums (GOutputStream  *out,
+                                GInputStream   *in,
+                                GChecksum     **checksums,
+                                guint           n_checksums,
+                                GCancellable   *cancellable,
+                                GError        **error)
+{
+  g_return_val_if_fail (out != NULL || n_checksums > 0, FALSE);
+
+  if (n_checksums > 0)
     {
       gsize bytes_read, bytes_written;
       char buf[4096];
@@ -95,8 +336,9 @@ ot_gio_splice_update_checksum (GOutputStream  *out,
         {
           if (!g_input_stream_read_all (in, buf, sizeof(buf), &bytes_read, cancellable, error))
             return FALSE;
-          if (!ot_gio_write_update_checksum (out, buf, bytes_read, &bytes_written, checksum,
-                                             cancellable, error))
+          if (!ot_gio_write_update_checksums (out, buf, bytes_read, &bytes_written,
+                                              checksums, n_checksums,
+                                              cancellable, error))
             return FALSE;
         }
       while (bytes_read > 0);
@@ -110,8 +352,22 @@ ot_gio_splice_update_checksum (GOutputStream  *out,
   return TRUE;
 }
 
+gboolean
+ot_gio_splice_update_checksum (GOutputStream  *out,
+                               GInputStream   *in,
+                               GChecksum      *checksum,
+                               GCancellable   *cancellable,
+                               GError        **error)
+{
+  return ot_gio_splice_update_checksums (out, in, &checksum,
+                                         checksum != NULL ? 1 : 0,
+                                         cancellable, error);
+}
+
 /* Copy @in to @out, return in @out_csum the binary checksum for
- * all data read.
+ * all data read.  When there's an output stream the digest is computed
+ * on the write side via OtChecksumOutstream, so the copy and the
+ * checksum are a single pass.
  */
 gboolean
 ot_gio_splice_get_checksum (GOutputStream  *out,
@@ -120,12 +376,45 @@ ot_gio_splice_get_checksum (GOutputStream  *out,
                             GCancellable   *cancellable,
                             GError        **error)
 {
-  g_autoptr(GChecksum) checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  guint8 buf[8192];
+  gsize bytes_read, bytes_written;
 
-  if (!ot_gio_splice_update_checksum (out, in, checksum, cancellable, error))
-    return FALSE;
+  if (out)
+    {
+      glnx_unref_object OtChecksumOutstream *checksum_out =
+        ot_checksum_outstream_new (out, G_CHECKSUM_SHA256);
 
-  g_autofree guchar *ret_csum = ot_csum_from_gchecksum (checksum);
+      /* Manual copy loop; g_output_stream_splice() pointlessly poll()s
+       * the output fd on every write.
+       */
+      do
+        {
+          if (!g_input_stream_read_all (in, buf, sizeof (buf), &bytes_read, cancellable, error))
+            return FALSE;
+          if (!g_output_stream_write_all ((GOutputStream*)checksum_out, buf, bytes_read,
+                                          &bytes_written, cancellable, error))
+            return FALSE;
+        }
+      while (bytes_read > 0);
+
+      g_autofree guchar *ret_csum = ot_checksum_outstream_dup_digest (checksum_out, NULL);
+      ot_transfer_out_value (out_csum, &ret_csum);
+      return TRUE;
+    }
+
+  g_auto(OtChecksum) checksum = { 0, };
+  ot_checksum_init (&checksum);
+
+  do
+    {
+      if (!g_input_stream_read_all (in, buf, sizeof (buf), &bytes_read, cancellable, error))
+        return FALSE;
+      ot_checksum_update (&checksum, buf, bytes_read);
+    }
+  while (bytes_read > 0);
+
+  g_autofree guchar *ret_csum = g_malloc (OT_CHECKSUM_DIGEST_LEN);
+  ot_checksum_get_digest (&checksum, ret_csum, OT_CHECKSUM_DIGEST_LEN);
   ot_transfer_out_value (out_csum, &ret_csum);
   return TRUE;
 }
@@ -152,6 +441,19 @@ ot_checksum_file_at (int             dfd,
   if (!ot_openat_read_stream (dfd, path, TRUE, &in, cancellable, error))
     return FALSE;
 
+  /* The accelerated backend is SHA256-only */
+  if (checksum_type == G_CHECKSUM_SHA256)
+    {
+      g_autofree guchar *csum = NULL;
+      char hexdigest[OT_CHECKSUM_DIGEST_HEXLEN];
+
+      if (!ot_gio_splice_get_checksum (NULL, in, &csum, cancellable, error))
+        return FALSE;
+
+      ot_bin2hex (hexdigest, csum, OT_CHECKSUM_DIGEST_LEN);
+      return g_strdup (hexdigest);
+    }
+
   g_autoptr(GChecksum) checksum = g_checksum_new (checksum_type);
   if (!ot_gio_splice_update_checksum (NULL, in, checksum, cancellable, error))
     return FALSE;
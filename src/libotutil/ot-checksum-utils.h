@@ -30,6 +30,38 @@ void ot_bin2hex (char *out_buf, const guint8 *inbuf, gsize len);
 
 guchar *ot_csum_from_gchecksum (GChecksum *checksum);
 
+/* A wrapper above our active SHA256 implementation: OpenSSL's EVP
+ * (hardware accelerated via SHA-NI/AVX2 where libcrypto supports it)
+ * when built --with-openssl, GChecksum otherwise.  Use this instead of
+ * GChecksum directly in checksum-bound paths.
+ */
+typedef struct {
+  gboolean initialized;
+  guint uints[2];
+  gpointer data[2];
+} OtChecksum;
+
+void ot_checksum_init (OtChecksum *checksum);
+void ot_checksum_update (OtChecksum *checksum, const guint8 *buf, size_t len);
+void ot_checksum_get_digest (OtChecksum *checksum, guint8 *buf, size_t buflen);
+void ot_checksum_get_hexdigest (OtChecksum *checksum, char *buf, size_t buflen);
+void ot_checksum_clear (OtChecksum *checksum);
+G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC(OtChecksum, ot_checksum_clear)
+
+gboolean ot_checksum_update_from_fd (OtChecksum *checksum, int fd, GError **error);
+
+/* CRC32C (Castagnoli); not a cryptographic digest, used for cheap
+ * bit-rot detection where SHA256 remains the escalation path.  Chained
+ * like zlib's crc32(): pass the previous return value (0 to start).
+ */
+guint32 ot_crc32c (guint32 crc, const guint8 *buf, gsize len);
+
+gboolean ot_crc32c_fd (int fd, guint32 *out_crc, GError **error);
+
+#define OT_CHECKSUM_DIGEST_LEN (32)
+/* Includes NUL terminator */
+#define OT_CHECKSUM_DIGEST_HEXLEN (65)
+
 gboolean ot_gio_write_update_checksum (GOutputStream  *out,
                                        gconstpointer   data,
                                        gsize           len,
@@ -44,12 +76,28 @@ gboolean ot_gio_splice_get_checksum (GOutputStream  *out,
                                      GCancellable   *cancellable,
                                      GError        **error);
 
+gboolean ot_gio_write_update_checksums (GOutputStream  *out,
+                                        gconstpointer   data,
+                                        gsize           len,
+                                        gsize          *out_bytes_written,
+                                        GChecksum     **checksums,
+                                        guint           n_checksums,
+                                        GCancellable   *cancellable,
+                                        GError        **error);
+
 gboolean ot_gio_splice_update_checksum (GOutputStream  *out,
                                         GInputStream   *in,
                                         GChecksum      *checksum,
                                         GCancellable   *cancellable,
                                         GError        **error);
 
+gboolean ot_gio_splice_update_checksums (GOutputStream  *out,
+                                         GInputStream   *in,
+                                         GChecksum     **checksums,
+                                         guint           n_checksums,
+                                         GCancellable   *cancellable,
+                                         GError        **error);
+
 gboolean ot_gio_checksum_stream (GInputStream   *in,
                                  guchar        **out_csum,
                                  GCancellable   *cancellable,
@@ -86,6 +86,22 @@ gboolean ot_dfd_iter_init_allow_noent (int dfd,
                                        gboolean *out_exists,
                                        GError **error);
 
+/* A single directory entry read by ot_dfd_list_sorted_allow_noent().
+ * @ino and @d_type come straight from the kernel dirent, so @d_type may
+ * be DT_UNKNOWN on filesystems that don't fill it in.
+ */
+typedef struct {
+  guint64 ino;
+  guint8  d_type;
+  char    name[];
+} OtBulkDirent;
+
+gboolean ot_dfd_list_sorted_allow_noent (int          dfd,
+                                         const char  *path,
+                                         GPtrArray  **out_entries,
+                                         gboolean    *out_exists,
+                                         GError     **error);
+
 GBytes *
 ot_map_anonymous_tmpfile_from_content (GInputStream *instream,
                                        GCancellable *cancellable,
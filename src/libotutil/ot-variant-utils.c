@@ -157,6 +157,20 @@ ot_util_variant_map_fd (int                    fd,
       goto out;
     }
 
+  /* GVariant parsing touches the mapping in essentially random order
+   * (tree traversal, binary search), so on a cold cache every access
+   * is a scattered major fault.  The maps we create here (summaries,
+   * delta superblocks) are parsed immediately and in full; ask the
+   * kernel to read the whole range ahead instead.  Advice is best
+   * effort, so failures are ignored.
+   */
+  (void) madvise (map, len, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+  /* Multi-MB summaries additionally benefit from fewer TLB misses */
+  if (len >= 2 * 1024 * 1024)
+    (void) madvise (map, len, MADV_HUGEPAGE);
+#endif
+
   mdata = g_new (VariantMapData, 1);
   mdata->addr = map;
   mdata->len = len;
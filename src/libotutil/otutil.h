@@ -53,5 +53,6 @@
 #include <ot-gpg-utils.h>
 #include <ot-log-utils.h>
 #include <ot-checksum-instream.h>
+#include <ot-checksum-outstream.h>
 
 void ot_ptrarray_add_many (GPtrArray  *a, ...) G_GNUC_NULL_TERMINATED; 
@@ -39,7 +39,9 @@ static OstreeCommand commands[] = {
   { "checksum", ostree_builtin_checksum },
   { "commit", ostree_builtin_commit },
   { "config", ostree_builtin_config },
+  { "debug", ostree_builtin_debug },
   { "diff", ostree_builtin_diff },
+  { "du", ostree_builtin_du },
   { "export", ostree_builtin_export },
 #ifdef OSTREE_ENABLE_EXPERIMENTAL_API
   { "find-remotes", ostree_builtin_find_remotes },
@@ -49,6 +51,8 @@ static OstreeCommand commands[] = {
   { "init", ostree_builtin_init },
   { "log", ostree_builtin_log },
   { "ls", ostree_builtin_ls },
+  { "pack", ostree_builtin_pack },
+  { "path-index", ostree_builtin_path_index },
   { "prune", ostree_builtin_prune },
   { "pull-local", ostree_builtin_pull_local },
 #ifdef HAVE_LIBSOUP 
@@ -56,6 +60,7 @@ static OstreeCommand commands[] = {
 #endif
   { "refs", ostree_builtin_refs },
   { "remote", ostree_builtin_remote },
+  { "repod", ostree_builtin_repod },
   { "reset", ostree_builtin_reset },
   { "rev-parse", ostree_builtin_rev_parse },
   { "show", ostree_builtin_show },
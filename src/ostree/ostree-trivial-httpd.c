@@ -31,6 +31,7 @@
 
 #include <locale.h>
 #include <err.h>
+#include <fcntl.h>
 #include <sys/socket.h>
 #include <sys/prctl.h>
 #include <signal.h>
@@ -44,6 +45,9 @@ static int opt_random_500s_percentage;
 /* We have a strong upper bound for any unlikely
  * cases involving repeated random 500s. */
 static int opt_random_500s_max = 100;
+static int opt_bandwidth_limit;
+static int opt_latency_ms;
+static int opt_latency_jitter_ms;
 static gint opt_port = 0;
 static gchar **opt_expected_cookies;
 static gchar **opt_expected_headers;
@@ -54,8 +58,80 @@ typedef struct {
   int root_dfd;
   gboolean running;
   GOutputStream *log;
+  GHashTable *mapping_cache; /* Maps path → MappingCacheEntry */
 } OtTrivialHttpd;
 
+/* Pulls request the same loose objects and deltas over and over (and
+ * range requests hit the same file twice); keep the mappings around so
+ * repeated GETs serve straight out of the page cache instead of
+ * re-open+mmap'ing every time.  Entries are validated against the stat
+ * identity of the file on each use.  Everything runs on the main
+ * context, so no locking.
+ */
+#define MAPPING_CACHE_MAX_ENTRIES 128
+
+typedef struct {
+  GMappedFile *mapping;
+  ino_t ino;
+  off_t size;
+  struct timespec mtim;
+} MappingCacheEntry;
+
+static void
+mapping_cache_entry_free (MappingCacheEntry *entry)
+{
+  g_mapped_file_unref (entry->mapping);
+  g_free (entry);
+}
+
+static GMappedFile *
+get_file_mapping (OtTrivialHttpd    *self,
+                  const char        *path,
+                  const struct stat *stbuf)
+{
+  if (self->mapping_cache == NULL)
+    self->mapping_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                                 (GDestroyNotify)mapping_cache_entry_free);
+
+  MappingCacheEntry *entry = g_hash_table_lookup (self->mapping_cache, path);
+  if (entry != NULL)
+    {
+      if (entry->ino == stbuf->st_ino &&
+          entry->size == stbuf->st_size &&
+          entry->mtim.tv_sec == stbuf->st_mtim.tv_sec &&
+          entry->mtim.tv_nsec == stbuf->st_mtim.tv_nsec)
+        return g_mapped_file_ref (entry->mapping);
+
+      g_hash_table_remove (self->mapping_cache, path);
+    }
+
+  glnx_fd_close int fd = openat (self->root_dfd, path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+
+  /* We're going to stream the whole thing out */
+  (void) posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  GMappedFile *mapping = g_mapped_file_new_from_fd (fd, FALSE, NULL);
+  if (!mapping)
+    return NULL;
+
+  /* Crude bound; a loose object set has no meaningful working-set
+   * order, so just start over rather than tracking LRU.
+   */
+  if (g_hash_table_size (self->mapping_cache) >= MAPPING_CACHE_MAX_ENTRIES)
+    g_hash_table_remove_all (self->mapping_cache);
+
+  entry = g_new0 (MappingCacheEntry, 1);
+  entry->mapping = g_mapped_file_ref (mapping);
+  entry->ino = stbuf->st_ino;
+  entry->size = stbuf->st_size;
+  entry->mtim = stbuf->st_mtim;
+  g_hash_table_replace (self->mapping_cache, g_strdup (path), entry);
+
+  return mapping;
+}
+
 static GOptionEntry options[] = {
   { "daemonize", 'd', 0, G_OPTION_ARG_NONE, &opt_daemonize, "Fork into background when ready", NULL },
   { "autoexit", 0, 0, G_OPTION_ARG_NONE, &opt_autoexit, "Automatically exit when directory is deleted", NULL },
@@ -64,6 +140,9 @@ static GOptionEntry options[] = {
   { "force-range-requests", 0, 0, G_OPTION_ARG_NONE, &opt_force_ranges, "Force range requests by only serving half of files", NULL },
   { "random-500s", 0, 0, G_OPTION_ARG_INT, &opt_random_500s_percentage, "Generate random HTTP 500 errors approximately for PERCENTAGE requests", "PERCENTAGE" },
   { "random-500s-max", 0, 0, G_OPTION_ARG_INT, &opt_random_500s_max, "Limit HTTP 500 errors to MAX (default 100)", "MAX" },
+  { "bandwidth-limit", 0, 0, G_OPTION_ARG_INT, &opt_bandwidth_limit, "Limit each response to KBPS KiB/s (token bucket)", "KBPS" },
+  { "latency", 0, 0, G_OPTION_ARG_INT, &opt_latency_ms, "Delay each response by MS milliseconds", "MS" },
+  { "latency-jitter", 0, 0, G_OPTION_ARG_INT, &opt_latency_jitter_ms, "Additionally delay each response by a random amount up to MS milliseconds", "MS" },
   { "log-file", 0, 0, G_OPTION_ARG_FILENAME, &opt_log, "Put logs here (use - for stdout)", "PATH" },
   { "expected-cookies", 0, 0, G_OPTION_ARG_STRING_ARRAY, &opt_expected_cookies, "Expect given cookies in the http request", "KEY=VALUE" },
   { "expected-header", 0, 0, G_OPTION_ARG_STRING_ARRAY, &opt_expected_headers, "Expect given headers in the http request", "KEY=VALUE" },
@@ -176,6 +255,19 @@ is_safe_to_access (struct stat *stbuf)
   return TRUE;
 }
 
+/* Loose objects and static deltas are named by checksum, so any path
+ * below objects/ or deltas/ can never change in place; a cache in
+ * front of us (or the client's own) may keep them forever.
+ */
+static gboolean
+path_is_immutable (const char *path)
+{
+  return g_str_has_prefix (path, "objects/")
+    || g_str_has_prefix (path, "deltas/")
+    || strstr (path, "/objects/") != NULL
+    || strstr (path, "/deltas/") != NULL;
+}
+
 static void
 close_socket (SoupMessage *msg, gpointer user_data)
 {
@@ -193,12 +285,133 @@ close_socket (SoupMessage *msg, gpointer user_data)
 #endif
 }
 
+/* Network shaping for reproducing field performance problems: a
+ * per-response token bucket refilled at --bandwidth-limit KiB/s.  The
+ * response body is streamed in chunks; when the bucket runs dry we
+ * pause the message and resume once enough tokens have accumulated.
+ */
+#define THROTTLE_CHUNK_SIZE 16384
+
+typedef struct {
+  SoupServer *server; /* owned */
+  SoupMessage *msg; /* unowned; we're disconnected on finished */
+  GMappedFile *mapping; /* owned */
+  gsize offset;
+  gsize length;
+  gdouble tokens; /* bytes */
+  gdouble rate; /* bytes per second */
+  gdouble burst; /* bucket capacity, bytes */
+  gint64 last_refill_usec;
+  guint timeout_id;
+  gboolean completed;
+} ThrottledSend;
+
+static void
+throttled_send_pump (ThrottledSend *state);
+
+static void
+throttled_send_free (SoupMessage *msg, gpointer user_data)
+{
+  ThrottledSend *state = user_data;
+
+  if (state->timeout_id > 0)
+    g_source_remove (state->timeout_id);
+  g_mapped_file_unref (state->mapping);
+  g_object_unref (state->server);
+  g_free (state);
+}
+
+static gboolean
+throttled_send_ready (gpointer user_data)
+{
+  ThrottledSend *state = user_data;
+
+  state->timeout_id = 0;
+  throttled_send_pump (state);
+  soup_server_unpause_message (state->server, state->msg);
+  return FALSE;
+}
+
+static void
+throttled_send_pump (ThrottledSend *state)
+{
+  SoupMessage *msg = state->msg;
+
+  if (state->completed)
+    return;
+
+  /* Refill the bucket for the time elapsed since the last send */
+  const gint64 now = g_get_monotonic_time ();
+  state->tokens = MIN (state->burst,
+                       state->tokens + (now - state->last_refill_usec) * state->rate / G_USEC_PER_SEC);
+  state->last_refill_usec = now;
+
+  if (state->offset == state->length)
+    {
+      state->completed = TRUE;
+      soup_message_body_complete (msg->response_body);
+      return;
+    }
+
+  const gsize chunk = MIN (state->length - state->offset, (gsize)THROTTLE_CHUNK_SIZE);
+  if (state->tokens < chunk)
+    {
+      const gdouble wait_usec = (chunk - state->tokens) * G_USEC_PER_SEC / state->rate;
+      soup_server_pause_message (state->server, msg);
+      state->timeout_id = g_timeout_add (MAX ((guint)(wait_usec / 1000), 1u),
+                                         throttled_send_ready, state);
+      return;
+    }
+  state->tokens -= chunk;
+
+  SoupBuffer *buffer =
+    soup_buffer_new_with_owner (g_mapped_file_get_contents (state->mapping) + state->offset,
+                                chunk,
+                                g_mapped_file_ref (state->mapping),
+                                (GDestroyNotify)g_mapped_file_unref);
+  state->offset += chunk;
+  soup_message_body_append_buffer (msg->response_body, buffer);
+  soup_buffer_free (buffer);
+}
+
+static void
+throttled_send_chunk_cb (SoupMessage *msg, gpointer user_data)
+{
+  throttled_send_pump (user_data);
+}
+
+static void
+setup_throttled_send (SoupServer  *server,
+                      SoupMessage *msg,
+                      GMappedFile *mapping,
+                      gsize        length)
+{
+  ThrottledSend *state = g_new0 (ThrottledSend, 1);
+
+  state->server = g_object_ref (server);
+  state->msg = msg;
+  state->mapping = g_mapped_file_ref (mapping);
+  state->length = length;
+  state->rate = (gdouble)opt_bandwidth_limit * 1024;
+  /* Allow brief bursts, but keep the steady state close to the cap */
+  state->burst = MAX (state->rate / 8, THROTTLE_CHUNK_SIZE);
+  state->tokens = state->burst;
+  state->last_refill_usec = g_get_monotonic_time ();
+
+  soup_message_body_set_accumulate (msg->response_body, FALSE);
+  soup_message_headers_set_content_length (msg->response_headers, length);
+  /* The first chunk goes out once the headers are written */
+  g_signal_connect (msg, "wrote-headers", G_CALLBACK (throttled_send_chunk_cb), state);
+  g_signal_connect (msg, "wrote-chunk", G_CALLBACK (throttled_send_chunk_cb), state);
+  g_signal_connect (msg, "finished", G_CALLBACK (throttled_send_free), state);
+}
+
 static void
 do_get (OtTrivialHttpd    *self,
         SoupServer        *server,
         SoupMessage       *msg,
         const char        *path,
-        SoupClientContext *context)
+        SoupSocket        *sock)
 {
   char *slash;
   int ret;
@@ -326,7 +539,7 @@ do_get (OtTrivialHttpd    *self,
           if (fstatat (self->root_dfd, index_realpath, &stbuf, 0) != -1)
             {
               g_autofree char *index_path = g_strconcat (path, "/index.html", NULL);
-              do_get (self, server, msg, index_path, context);
+              do_get (self, server, msg, index_path, sock);
             }
           else
             {
@@ -346,36 +559,75 @@ do_get (OtTrivialHttpd    *self,
           soup_message_set_status (msg, SOUP_STATUS_FORBIDDEN);
           goto out;
         }
-      
+
+      /* Checksum-addressed content is cacheable forever; everything
+       * else (summary, refs, config) gets replaced in place, so those
+       * carry validators instead and revalidate with 304s.
+       */
+      if (path_is_immutable (path))
+        soup_message_headers_append (msg->response_headers, "Cache-Control",
+                                     "max-age=31536000, immutable");
+      else
+        {
+          g_autofree char *etag =
+            g_strdup_printf ("\"%" G_GUINT64_FORMAT "-%" G_GUINT64_FORMAT "-%" G_GINT64_FORMAT ".%09ld\"",
+                             (guint64)stbuf.st_ino,
+                             (guint64)stbuf.st_size,
+                             (gint64)stbuf.st_mtim.tv_sec,
+                             stbuf.st_mtim.tv_nsec);
+          gboolean not_modified = FALSE;
+
+          {
+            SoupDate *mtime_date = soup_date_new_from_time_t (stbuf.st_mtime);
+            g_autofree char *mtime_str = soup_date_to_string (mtime_date, SOUP_DATE_HTTP);
+            soup_message_headers_append (msg->response_headers, "ETag", etag);
+            soup_message_headers_append (msg->response_headers, "Last-Modified", mtime_str);
+            soup_date_free (mtime_date);
+          }
+
+          const char *if_none_match =
+            soup_message_headers_get_one (msg->request_headers, "If-None-Match");
+          const char *if_modified_since =
+            soup_message_headers_get_one (msg->request_headers, "If-Modified-Since");
+          if (if_none_match != NULL)
+            not_modified = (strcmp (if_none_match, "*") == 0 ||
+                            strstr (if_none_match, etag) != NULL);
+          else if (if_modified_since != NULL)
+            {
+              SoupDate *since = soup_date_new_from_string (if_modified_since);
+              if (since)
+                {
+                  not_modified = soup_date_to_time_t (since) >= stbuf.st_mtime;
+                  soup_date_free (since);
+                }
+            }
+
+          if (not_modified)
+            {
+              soup_message_set_status (msg, SOUP_STATUS_NOT_MODIFIED);
+              goto out;
+            }
+        }
+
       if (msg->method == SOUP_METHOD_GET)
         {
-          glnx_fd_close int fd = -1;
           g_autoptr(GMappedFile) mapping = NULL;
           gsize buffer_length, file_size;
           SoupRange *ranges;
           int ranges_length;
           gboolean have_ranges;
 
-          fd = openat (self->root_dfd, path, O_RDONLY | O_CLOEXEC);
-          if (fd < 0)
-            {
-              soup_message_set_status (msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
-              goto out;
-            }
-
-          mapping = g_mapped_file_new_from_fd (fd, FALSE, NULL);
+          mapping = get_file_mapping (self, path, &stbuf);
           if (!mapping)
             {
               soup_message_set_status (msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
               goto out;
             }
-          (void) close (fd); fd = -1;
 
           file_size = g_mapped_file_get_length (mapping);
           have_ranges = soup_message_headers_get_ranges(msg->request_headers, file_size, &ranges, &ranges_length);
           if (opt_force_ranges && !have_ranges && g_strrstr (path, "/objects") != NULL)
             {
-              SoupSocket *sock;
               buffer_length = file_size/2;
               soup_message_headers_set_content_length (msg->response_headers, file_size);
               soup_message_headers_append (msg->response_headers,
@@ -386,7 +638,6 @@ do_get (OtTrivialHttpd    *self,
                * the declared Content-Length. Instead, we
                * forcibly close the socket at that point.
                */
-              sock = soup_client_context_get_socket (context);
               g_signal_connect (msg, "wrote-chunk", G_CALLBACK (close_socket), sock);
             }
           else
@@ -400,9 +651,42 @@ do_get (OtTrivialHttpd    *self,
                   soup_message_headers_free_ranges (msg->request_headers, ranges);
                   goto out;
                 }
+              if (ranges_length == 1)
+                {
+                  /* Serve the requested slice directly rather than
+                   * accumulating the whole file for libsoup to cut
+                   * up; a resumed pull only pays for the bytes it is
+                   * missing.
+                   */
+                  const goffset start = ranges[0].start;
+                  const goffset end = MIN (ranges[0].end, (goffset)file_size - 1);
+                  SoupBuffer *buffer =
+                    soup_buffer_new_with_owner (g_mapped_file_get_contents (mapping) + start,
+                                                (gsize)(end - start + 1),
+                                                g_mapped_file_ref (mapping),
+                                                (GDestroyNotify)g_mapped_file_unref);
+                  soup_message_headers_set_content_range (msg->response_headers,
+                                                          start, end, file_size);
+                  soup_message_body_append_buffer (msg->response_body, buffer);
+                  soup_buffer_free (buffer);
+                  soup_message_set_status (msg, SOUP_STATUS_PARTIAL_CONTENT);
+                  soup_message_headers_free_ranges (msg->request_headers, ranges);
+                  goto out;
+                }
+              /* Multiple ranges: fall through to a full response,
+               * which libsoup slices into a multipart reply itself.
+               */
               soup_message_headers_free_ranges (msg->request_headers, ranges);
             }
-          if (buffer_length > 0)
+          if (opt_bandwidth_limit > 0 && !have_ranges && buffer_length == file_size)
+            {
+              /* The shaped path streams the body chunk by chunk; range
+               * and forced-range responses rely on body accumulation,
+               * so they stay on the plain path below.
+               */
+              setup_throttled_send (server, msg, mapping, buffer_length);
+            }
+          else if (buffer_length > 0)
             {
               SoupBuffer *buffer;
 
@@ -442,6 +726,31 @@ do_get (OtTrivialHttpd    *self,
   return;
 }
 
+/* State for a response held back by --latency/--latency-jitter */
+typedef struct {
+  OtTrivialHttpd *self;
+  SoupServer *server; /* owned */
+  SoupMessage *msg; /* owned */
+  SoupSocket *sock; /* owned, or NULL */
+  char *path;
+} DelayedRequest;
+
+static gboolean
+delayed_request_ready (gpointer user_data)
+{
+  DelayedRequest *req = user_data;
+
+  do_get (req->self, req->server, req->msg, req->path, req->sock);
+  soup_server_unpause_message (req->server, req->msg);
+
+  g_object_unref (req->server);
+  g_object_unref (req->msg);
+  g_clear_object (&req->sock);
+  g_free (req->path);
+  g_free (req);
+  return FALSE;
+}
+
 static void
 httpd_callback (SoupServer *server, SoupMessage *msg,
                 const char *path, GHashTable *query,
@@ -449,10 +758,30 @@ httpd_callback (SoupServer *server, SoupMessage *msg,
 {
   OtTrivialHttpd *self = data;
 
-  if (msg->method == SOUP_METHOD_GET || msg->method == SOUP_METHOD_HEAD)
-    do_get (self, server, msg, path, context);
+  if (!(msg->method == SOUP_METHOD_GET || msg->method == SOUP_METHOD_HEAD))
+    {
+      soup_message_set_status (msg, SOUP_STATUS_NOT_IMPLEMENTED);
+      return;
+    }
+
+  SoupSocket *sock = soup_client_context_get_socket (context);
+
+  guint delay_ms = opt_latency_ms;
+  if (opt_latency_jitter_ms > 0)
+    delay_ms += g_random_int_range (0, opt_latency_jitter_ms + 1);
+  if (delay_ms > 0)
+    {
+      DelayedRequest *req = g_new0 (DelayedRequest, 1);
+      req->self = self;
+      req->server = g_object_ref (server);
+      req->msg = g_object_ref (msg);
+      req->sock = sock ? g_object_ref (sock) : NULL;
+      req->path = g_strdup (path);
+      soup_server_pause_message (server, msg);
+      g_timeout_add (delay_ms, delayed_request_ready, req);
+    }
   else
-    soup_message_set_status (msg, SOUP_STATUS_NOT_IMPLEMENTED);
+    do_get (self, server, msg, path, sock);
 }
 
 static void
@@ -505,6 +834,13 @@ run (int argc, char **argv, GCancellable *cancellable, GError **error)
       goto out;
     }
 
+  if (opt_bandwidth_limit < 0 || opt_latency_ms < 0 || opt_latency_jitter_ms < 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "--bandwidth-limit, --latency and --latency-jitter must not be negative");
+      goto out;
+    }
+
   if (opt_log)
     {
       GOutputStream *stream = NULL;
@@ -657,6 +993,7 @@ run (int argc, char **argv, GCancellable *cancellable, GError **error)
  out:
   if (app->root_dfd != -1)
     (void) close (app->root_dfd);
+  g_clear_pointer (&app->mapping_cache, (GDestroyNotify) g_hash_table_unref);
   g_clear_object (&app->log);
   return ret;
 }
@@ -29,7 +29,12 @@
 
 #include <glib/gi18n.h>
 
+static gboolean opt_no_prune;
+static gboolean opt_prune_only;
+
 static GOptionEntry options[] = {
+  { "no-prune", 0, 0, G_OPTION_ARG_NONE, &opt_no_prune, "Only clean up deployments and boot entries; skip the repository prune", NULL },
+  { "prune-only", 0, 0, G_OPTION_ARG_NONE, &opt_prune_only, "Only prune the repository; useful for deferring the expensive phase to an idle moment", NULL },
   { NULL }
 };
 
@@ -47,11 +52,31 @@ ot_admin_builtin_cleanup (int argc, char **argv, GCancellable *cancellable, GErr
                                           &sysroot, cancellable, error))
     goto out;
 
+  if (opt_no_prune && opt_prune_only)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                           "Cannot specify both --no-prune and --prune-only");
+      goto out;
+    }
+
   if (!ostree_sysroot_load (sysroot, cancellable, error))
     goto out;
 
-  if (!ostree_sysroot_cleanup (sysroot, cancellable, error))
-    goto out;
+  if (opt_prune_only)
+    {
+      if (!ostree_sysroot_cleanup_prune_repo (sysroot, cancellable, error))
+        goto out;
+    }
+  else if (opt_no_prune)
+    {
+      if (!ostree_sysroot_prepare_cleanup (sysroot, cancellable, error))
+        goto out;
+    }
+  else
+    {
+      if (!ostree_sysroot_cleanup (sysroot, cancellable, error))
+        goto out;
+    }
 
   ret = TRUE;
  out:
@@ -0,0 +1,270 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "ot-main.h"
+#include "ot-admin-builtins.h"
+#include "ot-admin-functions.h"
+#include "ostree.h"
+#include "otutil.h"
+
+#include "../libostree/ostree-repo-private.h"
+#include "../libostree/ostree-repo-file.h"
+
+#include <glib/gi18n.h>
+
+static char *opt_ref;
+static char *opt_subject;
+
+static GOptionEntry options[] = {
+  { "ref", 0, 0, G_OPTION_ARG_STRING, &opt_ref, "Write the commit to this ref (default: hotfix/OSNAME)", "REF" },
+  { "subject", 's', 0, G_OPTION_ARG_STRING, &opt_subject, "One line subject", "SUBJECT" },
+  { NULL }
+};
+
+/* Read xattrs for committed files from the overlayfs upper directory,
+ * stripping the "trusted.overlay." bookkeeping xattrs the kernel
+ * attaches on copy-up; they describe the overlay itself, not the
+ * content we're harvesting.
+ */
+static GVariant *
+upper_xattrs_cb (OstreeRepo   *repo,
+                 const char   *path,
+                 GFileInfo    *file_info,
+                 gpointer      user_data)
+{
+  int upper_dfd = GPOINTER_TO_INT (user_data);
+  g_autoptr(GVariant) xattrs = NULL;
+  GVariantBuilder builder;
+  gsize n;
+
+  while (*path == '/')
+    path++;
+  if (*path == '\0')
+    path = ".";
+
+  if (!glnx_dfd_name_get_all_xattrs (upper_dfd, path, &xattrs, NULL, NULL))
+    return NULL;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ayay)"));
+  n = g_variant_n_children (xattrs);
+  for (gsize i = 0; i < n; i++)
+    {
+      const guint8 *name;
+      g_autoptr(GVariant) value = NULL;
+
+      g_variant_get_child (xattrs, i, "(^&ay@ay)", &name, &value);
+      if (g_str_has_prefix ((const char*)name, "trusted.overlay."))
+        continue;
+      g_variant_builder_add (&builder, "(@ay@ay)",
+                             g_variant_new_bytestring ((const char*)name),
+                             value);
+    }
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+gboolean
+ot_admin_builtin_commit_hotfix (int argc, char **argv, GCancellable *cancellable, GError **error)
+{
+  gboolean ret = FALSE;
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(OstreeSysroot) sysroot = NULL;
+  g_autoptr(OstreeRepo) repo = NULL;
+  OstreeDeployment *booted_deployment = NULL;
+  OstreeRepoCommitModifier *modifier = NULL;
+  g_autofree char *deployment_path = NULL;
+  glnx_fd_close int deployment_dfd = -1;
+  glnx_fd_close int upper_dfd = -1;
+  g_autoptr(GFile) base_root = NULL;
+  g_autoptr(GFile) new_root = NULL;
+  g_autoptr(OstreeMutableTree) mtree = NULL;
+  g_autoptr(OstreeMutableTree) usr_mtree = NULL;
+  g_autofree char *default_ref = NULL;
+  g_autofree char *new_revision = NULL;
+  const char *base_rev;
+  const char *ref;
+
+  context = g_option_context_new ("Commit the copied-up changes of a hotfixed deployment");
+
+  if (!ostree_admin_option_context_parse (context, options, &argc, &argv,
+                                          OSTREE_ADMIN_BUILTIN_FLAG_SUPERUSER,
+                                          &sysroot, cancellable, error))
+    goto out;
+
+  if (argc > 1)
+    {
+      ot_util_usage_error (context, "This command takes no extra arguments", error);
+      goto out;
+    }
+
+  if (!ostree_sysroot_load (sysroot, cancellable, error))
+    goto out;
+
+  booted_deployment = ostree_sysroot_get_booted_deployment (sysroot);
+  if (!booted_deployment)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "Not currently booted into an OSTree system");
+      goto out;
+    }
+
+  if (ostree_deployment_get_unlocked (booted_deployment) != OSTREE_DEPLOYMENT_UNLOCKED_HOTFIX)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "Deployment is not unlocked in hotfix mode");
+      goto out;
+    }
+
+  if (!ostree_sysroot_get_repo (sysroot, &repo, cancellable, error))
+    goto out;
+
+  deployment_path = ostree_sysroot_get_deployment_dirpath (sysroot, booted_deployment);
+  if (!glnx_opendirat (ostree_sysroot_get_fd (sysroot), deployment_path, TRUE,
+                       &deployment_dfd, error))
+    goto out;
+
+  if (!glnx_opendirat (deployment_dfd, ".usr-ovl-upper", TRUE, &upper_dfd, error))
+    goto out;
+
+  base_rev = ostree_deployment_get_csum (booted_deployment);
+  if (!ostree_repo_read_commit (repo, base_rev, &base_root, NULL, cancellable, error))
+    goto out;
+
+  if (!ostree_repo_file_ensure_resolved ((OstreeRepoFile*)base_root, error))
+    goto out;
+
+  { gboolean usr_is_dir = FALSE;
+    if (ostree_repo_file_tree_find_child ((OstreeRepoFile*)base_root, "usr",
+                                          &usr_is_dir, NULL) < 0
+        || !usr_is_dir)
+      {
+        g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                             "Deployment commit has no /usr directory");
+        goto out;
+      }
+  }
+
+  if (!ostree_repo_prepare_transaction (repo, NULL, cancellable, error))
+    goto out;
+
+  modifier = ostree_repo_commit_modifier_new (0, NULL, NULL, NULL);
+  ostree_repo_commit_modifier_set_xattr_callback (modifier, upper_xattrs_cb,
+                                                  NULL, GINT_TO_POINTER (upper_dfd));
+
+  /* The overlay only covers /usr; reference everything else in the
+   * deployed tree unchanged.
+   */
+  mtree = ostree_mutable_tree_new ();
+  ostree_mutable_tree_set_metadata_checksum (mtree,
+    ostree_repo_file_tree_get_metadata_checksum ((OstreeRepoFile*)base_root));
+
+  { GVariant *base_contents = ostree_repo_file_tree_get_contents ((OstreeRepoFile*)base_root);
+    g_autoptr(GVariant) base_files = g_variant_get_child_value (base_contents, 0);
+    g_autoptr(GVariant) base_dirs = g_variant_get_child_value (base_contents, 1);
+    gsize n;
+
+    n = g_variant_n_children (base_files);
+    for (gsize i = 0; i < n; i++)
+      {
+        const char *fname;
+        g_autoptr(GVariant) csum_v = NULL;
+
+        g_variant_get_child (base_files, i, "(&s@ay)", &fname, &csum_v);
+        g_autofree char *checksum = ostree_checksum_from_bytes_v (csum_v);
+        if (!ostree_mutable_tree_replace_file (mtree, fname, checksum, error))
+          goto out;
+      }
+
+    n = g_variant_n_children (base_dirs);
+    for (gsize i = 0; i < n; i++)
+      {
+        const char *dname;
+        g_autoptr(GVariant) tree_csum_v = NULL;
+        g_autoptr(GVariant) meta_csum_v = NULL;
+        g_autoptr(OstreeMutableTree) child_mtree = NULL;
+
+        g_variant_get_child (base_dirs, i, "(&s@ay@ay)", &dname,
+                             &tree_csum_v, &meta_csum_v);
+        if (strcmp (dname, "usr") == 0)
+          continue;
+
+        if (!ostree_mutable_tree_ensure_dir (mtree, dname, &child_mtree, error))
+          goto out;
+
+        g_autofree char *tree_checksum = ostree_checksum_from_bytes_v (tree_csum_v);
+        g_autofree char *meta_checksum = ostree_checksum_from_bytes_v (meta_csum_v);
+        ostree_mutable_tree_set_metadata_checksum (child_mtree, meta_checksum);
+        ostree_mutable_tree_set_contents_checksum (child_mtree, tree_checksum);
+      }
+  }
+
+  if (!ostree_mutable_tree_ensure_dir (mtree, "usr", &usr_mtree, error))
+    goto out;
+
+  { g_autoptr(GFile) base_usr = g_file_get_child (base_root, "usr");
+
+    if (!_ostree_repo_write_overlay_upper_to_mtree (repo, (OstreeRepoFile*)base_usr,
+                                                    upper_dfd, usr_mtree, modifier,
+                                                    cancellable, error))
+      goto out;
+  }
+
+  if (!ostree_repo_write_mtree (repo, mtree, &new_root, cancellable, error))
+    goto out;
+
+  if (strcmp (ostree_repo_file_tree_get_contents_checksum ((OstreeRepoFile*)new_root),
+              ostree_repo_file_tree_get_contents_checksum ((OstreeRepoFile*)base_root)) == 0
+      && strcmp (ostree_repo_file_tree_get_metadata_checksum ((OstreeRepoFile*)new_root),
+                 ostree_repo_file_tree_get_metadata_checksum ((OstreeRepoFile*)base_root)) == 0)
+    {
+      g_print ("No changes to commit\n");
+      ostree_repo_abort_transaction (repo, cancellable, NULL);
+      ret = TRUE;
+      goto out;
+    }
+
+  default_ref = g_strdup_printf ("hotfix/%s", ostree_deployment_get_osname (booted_deployment));
+  ref = opt_ref != NULL ? opt_ref : default_ref;
+
+  if (!ostree_repo_write_commit (repo, base_rev,
+                                 opt_subject != NULL ? opt_subject : "Hotfix",
+                                 NULL, NULL, (OstreeRepoFile*)new_root,
+                                 &new_revision, cancellable, error))
+    goto out;
+
+  ostree_repo_transaction_set_ref (repo, NULL, ref, new_revision);
+
+  if (!ostree_repo_commit_transaction (repo, NULL, cancellable, error))
+    goto out;
+
+  g_print ("Committed hotfix changes to %s: %s\n"
+           "Use \"ostree admin deploy %s\" to deploy it.\n",
+           ref, new_revision, ref);
+
+  ret = TRUE;
+ out:
+  if (repo)
+    ostree_repo_abort_transaction (repo, cancellable, NULL);
+  if (modifier)
+    ostree_repo_commit_modifier_unref (modifier);
+  return ret;
+}
@@ -27,14 +27,17 @@
 #include "otutil.h"
 
 #include "../libostree/ostree-kernel-args.h"
+#include "../libostree/ostree-sysroot-private.h"
 
 #include <glib/gi18n.h>
 #include <err.h>
 
 static gboolean opt_hotfix;
+static gboolean opt_no_clone;
 
 static GOptionEntry options[] = {
   { "hotfix", 0, 0, G_OPTION_ARG_NONE, &opt_hotfix, "Retain changes across reboots", NULL },
+  { "no-clone", 0, 0, G_OPTION_ARG_NONE, &opt_no_clone, "With --hotfix, skip the rollback clone; use \"ostree admin commit-hotfix\" to commit changes later", NULL },
   { NULL }
 };
 
@@ -71,21 +74,38 @@ ot_admin_builtin_unlock (int argc, char **argv, GCancellable *cancellable, GErro
       goto out;
     }
 
+  if (opt_no_clone && !opt_hotfix)
+    {
+      ot_util_usage_error (context, "--no-clone requires --hotfix", error);
+      goto out;
+    }
+
   target_state = opt_hotfix ? OSTREE_DEPLOYMENT_UNLOCKED_HOTFIX : OSTREE_DEPLOYMENT_UNLOCKED_DEVELOPMENT;
 
-  if (!ostree_sysroot_deployment_unlock (sysroot, booted_deployment,
-                                         target_state, cancellable, error))
+  if (opt_no_clone)
+    {
+      if (!_ostree_sysroot_deployment_unlock_no_clone (sysroot, booted_deployment,
+                                                       cancellable, error))
+        goto out;
+    }
+  else if (!ostree_sysroot_deployment_unlock (sysroot, booted_deployment,
+                                              target_state, cancellable, error))
     goto out;
-  
+
   switch (target_state)
     {
     case OSTREE_DEPLOYMENT_UNLOCKED_NONE:
       g_assert_not_reached ();
       break;
     case OSTREE_DEPLOYMENT_UNLOCKED_HOTFIX:
-      g_print ("Hotfix mode enabled.  A writable overlayfs is now mounted on /usr\n"
-               "for this booted deployment.  A non-hotfixed clone has been created\n"
-               "as the non-default rollback target.\n");
+      if (opt_no_clone)
+        g_print ("Hotfix mode enabled.  A writable overlayfs is now mounted on /usr\n"
+                 "for this booted deployment.  Use \"ostree admin commit-hotfix\" to\n"
+                 "commit your changes.\n");
+      else
+        g_print ("Hotfix mode enabled.  A writable overlayfs is now mounted on /usr\n"
+                 "for this booted deployment.  A non-hotfixed clone has been created\n"
+                 "as the non-default rollback target.\n");
       break;
     case OSTREE_DEPLOYMENT_UNLOCKED_DEVELOPMENT:
       g_print ("Development mode enabled.  A writable overlayfs is now mounted on /usr.\n"
@@ -36,6 +36,7 @@ static gboolean opt_reboot;
 static gboolean opt_allow_downgrade;
 static gboolean opt_pull_only;
 static gboolean opt_deploy_only;
+static gboolean opt_check;
 static char *opt_osname;
 static char *opt_override_commit;
 
@@ -46,6 +47,7 @@ static GOptionEntry options[] = {
   { "override-commit", 0, 0, G_OPTION_ARG_STRING, &opt_override_commit, "Deploy CHECKSUM instead of the latest tree", "CHECKSUM" },
   { "pull-only", 0, 0, G_OPTION_ARG_NONE, &opt_pull_only, "Do not create a deployment, just download", NULL },
   { "deploy-only", 0, 0, G_OPTION_ARG_NONE, &opt_deploy_only, "Do not pull, only deploy", NULL },
+  { "check", 0, 0, G_OPTION_ARG_NONE, &opt_check, "Check whether an update is available without downloading it", NULL },
   { NULL }
 };
 
@@ -80,6 +82,12 @@ ot_admin_builtin_upgrade (int argc, char **argv, GCancellable *cancellable, GErr
                    "Cannot simultaneously specify --pull-only and --reboot");
       goto out;
     }
+  else if (opt_check && (opt_pull_only || opt_deploy_only || opt_reboot))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Cannot simultaneously specify --check and --pull-only, --deploy-only or --reboot");
+      goto out;
+    }
 
   if (!ostree_sysroot_load (sysroot, cancellable, error))
     goto out;
@@ -121,6 +129,26 @@ ot_admin_builtin_upgrade (int argc, char **argv, GCancellable *cancellable, GErr
         }
     }
 
+  if (opt_check)
+    {
+      /* Resolve the remote head from its summary (a conditional fetch)
+       * and compare against the deployed revision; no objects are
+       * downloaded and no local state changes. */
+      if (!ostree_sysroot_upgrader_check (upgrader, &changed, cancellable, error))
+        goto out;
+
+      if (changed)
+        {
+          g_autofree char *origin_description = ostree_sysroot_upgrader_get_origin_description (upgrader);
+          g_print ("Update available for %s\n", origin_description);
+        }
+      else
+        g_print ("No update available.\n");
+
+      ret = TRUE;
+      goto out;
+    }
+
   if (opt_deploy_only)
     upgraderpullflags |= OSTREE_SYSROOT_UPGRADER_PULL_FLAGS_SYNTHETIC;
 
@@ -38,6 +38,7 @@ typedef struct {
 
 static OstreeAdminCommand admin_subcommands[] = {
   { "cleanup", ot_admin_builtin_cleanup },
+  { "commit-hotfix", ot_admin_builtin_commit_hotfix },
   { "config-diff", ot_admin_builtin_diff },
   { "deploy", ot_admin_builtin_deploy }, 
   { "init-fs", ot_admin_builtin_init_fs },
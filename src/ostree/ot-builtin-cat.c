@@ -24,21 +24,88 @@
 
 #include "ot-main.h"
 #include "ot-builtins.h"
+#include "ot-repod.h"
 #include "ostree.h"
+#include "ostree-repo-private.h"
 #include "otutil.h"
 
 #include <gio/gunixoutputstream.h>
+#include <sys/sendfile.h>
 
 static GOptionEntry options[] = {
   { NULL },
 };
 
 static gboolean
-cat_one_file (GFile         *f,
+cat_one_file (OstreeRepo    *repo,
+              GFile         *f,
               GOutputStream *stdout_stream,
               GCancellable  *cancellable,
               GError       **error)
 {
+  /* Fast path for the bare modes: a regular file's payload is exactly the
+   * loose object, so we can hand its fd to sendfile() and let the kernel
+   * move the data to stdout instead of bouncing every page through a
+   * userspace buffer.  Archive objects are compressed and symlinks have no
+   * payload fd; those fall through to the stream copy below.
+   */
+  if (ostree_repo_get_mode (repo) != OSTREE_REPO_MODE_ARCHIVE_Z2)
+    {
+      if (!ostree_repo_file_ensure_resolved ((OstreeRepoFile*)f, error))
+        return FALSE;
+      g_autoptr(GFileInfo) finfo =
+        g_file_query_info (f, "standard::type", G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                           cancellable, error);
+      if (!finfo)
+        return FALSE;
+
+      if (g_file_info_get_file_type (finfo) == G_FILE_TYPE_REGULAR)
+        {
+          const char *checksum = ostree_repo_file_get_checksum ((OstreeRepoFile*)f);
+          glnx_fd_close int obj_fd = -1;
+          struct stat stbuf;
+          if (!_ostree_repo_load_file_bare (repo, checksum, &obj_fd, &stbuf,
+                                            NULL, NULL, cancellable, error))
+            return FALSE;
+
+          if (obj_fd != -1)
+            {
+              const int stdout_fd = g_unix_output_stream_get_fd ((GUnixOutputStream*)stdout_stream);
+              off_t offset = 0;
+              gboolean fallback = FALSE;
+
+              while (offset < stbuf.st_size)
+                {
+                  ssize_t bytes_sent = sendfile (stdout_fd, obj_fd, &offset,
+                                                 stbuf.st_size - offset);
+                  if (bytes_sent < 0)
+                    {
+                      if (errno == EINTR)
+                        continue;
+                      /* E.g. this kernel can't sendfile() to whatever
+                       * stdout is; nothing was written yet, so we can
+                       * cleanly fall back to the stream copy.
+                       */
+                      if (offset == 0 && (errno == EINVAL || errno == ENOSYS))
+                        {
+                          fallback = TRUE;
+                          break;
+                        }
+                      return glnx_throw_errno_prefix (error, "sendfile");
+                    }
+                  else if (bytes_sent == 0)
+                    return glnx_throw (error, "Unexpected EOF reading object %s", checksum);
+
+                  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+                    return FALSE;
+                }
+
+              if (!fallback)
+                return TRUE;
+            }
+        }
+    }
+
   g_autoptr(GInputStream) in = (GInputStream*)g_file_read (f, cancellable, error);
   if (!in)
     return FALSE;
@@ -65,6 +132,22 @@ ostree_builtin_cat (int argc, char **argv, GCancellable *cancellable, GError **e
     }
   const char *rev = argv[1];
 
+  /* Delegate to a running repod, which keeps commit and dirtree caches
+   * warm across invocations; fall back to reading locally.
+   */
+  { gboolean handled = FALSE;
+    g_autoptr(GPtrArray) delegate_args = g_ptr_array_new ();
+    g_ptr_array_add (delegate_args, "cat");
+    for (int i = 1; i < argc; i++)
+      g_ptr_array_add (delegate_args, argv[i]);
+    g_ptr_array_add (delegate_args, NULL);
+    if (!ot_repod_delegate (repo, (const char *const *)delegate_args->pdata,
+                            &handled, cancellable, error))
+      return FALSE;
+    if (handled)
+      return TRUE;
+  }
+
   g_autoptr(GFile) root = NULL;
   if (!ostree_repo_read_commit (repo, rev, &root, NULL, NULL, error))
     return FALSE;
@@ -75,7 +158,7 @@ ostree_builtin_cat (int argc, char **argv, GCancellable *cancellable, GError **e
     {
       g_autoptr(GFile) f = g_file_resolve_relative_path (root, argv[i]);
 
-      if (!cat_one_file (f, stdout_stream, cancellable, error))
+      if (!cat_one_file (repo, f, stdout_stream, cancellable, error))
         return FALSE;
     }
 
@@ -44,6 +44,7 @@ static gboolean opt_disable_fsync;
 static gboolean opt_require_hardlinks;
 static gboolean opt_force_copy;
 static gboolean opt_bareuseronly_dirs;
+static gboolean opt_ordered_reads;
 
 static gboolean
 parse_fsync_cb (const char  *option_name,
@@ -75,6 +76,7 @@ static GOptionEntry options[] = {
   { "require-hardlinks", 'H', 0, G_OPTION_ARG_NONE, &opt_require_hardlinks, "Do not fall back to full copies if hardlinking fails", NULL },
   { "force-copy", 'C', 0, G_OPTION_ARG_NONE, &opt_force_copy, "Never hardlink (but may reflink if available)", NULL },
   { "bareuseronly-dirs", 'M', 0, G_OPTION_ARG_NONE, &opt_bareuseronly_dirs, "Suppress mode bits outside of 0775 for directories (suid, world writable, etc.)", NULL },
+  { "order-reads", 0, 0, G_OPTION_ARG_NONE, &opt_ordered_reads, "Order file checkouts by on-disk object layout (optimizes for rotational storage)", NULL },
   { NULL }
 };
 
@@ -94,7 +96,8 @@ process_one_checkout (OstreeRepo           *repo,
    * convenient infrastructure for testing C APIs with data.
    */
   if (opt_disable_cache || opt_whiteouts || opt_require_hardlinks ||
-      opt_union_add || opt_force_copy || opt_bareuseronly_dirs)
+      opt_union_add || opt_force_copy || opt_bareuseronly_dirs ||
+      opt_ordered_reads)
     {
       OstreeRepoCheckoutAtOptions options = { 0, };
 
@@ -123,6 +126,7 @@ process_one_checkout (OstreeRepo           *repo,
       options.no_copy_fallback = opt_require_hardlinks;
       options.force_copy = opt_force_copy;
       options.bareuseronly_dirs = opt_bareuseronly_dirs;
+      options.ordered_object_reads = opt_ordered_reads;
 
       if (!ostree_repo_checkout_at (repo, &options,
                                     AT_FDCWD, destination,
@@ -28,64 +28,130 @@
 
 #include <string.h>
 
+static int opt_jobs = 0;
+
 static GOptionEntry options[] = {
+  { "jobs", 0, 0, G_OPTION_ARG_INT, &opt_jobs, "Number of concurrent checksum jobs (0 = one per CPU)", "N" },
   { NULL }
 };
 
+/* Checksumming is independent per path, so workers only synchronize on
+ * the error slot (first fatal error wins); results land in a
+ * preallocated slot per input path so output stays in input order.
+ */
+typedef struct {
+  GCancellable *cancellable;
+  char **results;          /* one slot per input path */
+  GMutex error_lock;
+  GError *error;           /* protected by error_lock */
+} ChecksumWorkerData;
+
 typedef struct {
-  GError **error;
-  GMainLoop *loop;
-} AsyncChecksumData;
+  ChecksumWorkerData *data;
+  const char *path;
+  guint idx;
+} ChecksumWorkerItem;
 
 static void
-on_checksum_received (GObject    *obj,
-                      GAsyncResult  *result,
-                      gpointer       user_data)
+checksum_one_path_worker (gpointer itemp,
+                          gpointer user_data)
 {
-  g_autofree guchar *csum = NULL;
-  g_autofree char *checksum = NULL;
-  AsyncChecksumData *data = user_data;
+  ChecksumWorkerItem *item = itemp;
+  ChecksumWorkerData *data = item->data;
+  gboolean failed;
+
+  /* Once a fatal error is recorded, drain the remaining queue cheaply */
+  g_mutex_lock (&data->error_lock);
+  failed = (data->error != NULL);
+  g_mutex_unlock (&data->error_lock);
+  if (failed)
+    return;
 
-  if (ostree_checksum_file_async_finish ((GFile*)obj, result, &csum, data->error))
+  g_autoptr(GFile) f = g_file_new_for_path (item->path);
+  g_autofree guchar *csum = NULL;
+  g_autoptr(GError) local_error = NULL;
+  if (!ostree_checksum_file (f, OSTREE_OBJECT_TYPE_FILE, &csum,
+                             data->cancellable, &local_error))
     {
-      checksum = ostree_checksum_from_bytes (csum);
-      g_print ("%s\n", checksum);
+      g_mutex_lock (&data->error_lock);
+      if (data->error == NULL)
+        g_propagate_prefixed_error (&data->error, g_steal_pointer (&local_error),
+                                    "Checksumming %s: ", item->path);
+      g_mutex_unlock (&data->error_lock);
+      return;
     }
-  
-  g_main_loop_quit (data->loop);
+
+  data->results[item->idx] = ostree_checksum_from_bytes (csum);
 }
 
 gboolean
 ostree_builtin_checksum (int argc, char **argv, GCancellable *cancellable, GError **error)
 {
-  g_autoptr(GOptionContext) context = NULL;
-  gboolean ret = FALSE;
-  g_autoptr(GFile) f = NULL;
-  AsyncChecksumData data = { 0, };
-
-  context = g_option_context_new ("PATH - Checksum a file or directory");
+  g_autoptr(GOptionContext) context =
+    g_option_context_new ("PATH... - Checksum files or directories");
 
   if (!ostree_option_context_parse (context, options, &argc, &argv, OSTREE_BUILTIN_FLAG_NO_REPO, NULL, cancellable, error))
-    goto out;
+    return FALSE;
 
-  if (argc > 1)
-    f = g_file_new_for_path (argv[1]);
-  else
+  if (argc < 2)
     {
       g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
                            "A filename must be given");
-      goto out;
+      return FALSE;
+    }
+  const guint n_paths = argc - 1;
+
+  g_autofree char **results = g_new0 (char *, n_paths);
+  g_autofree ChecksumWorkerItem *items = g_new0 (ChecksumWorkerItem, n_paths);
+  guint n_jobs = (opt_jobs > 0) ? (guint)opt_jobs : g_get_num_processors ();
+  n_jobs = MIN (n_jobs, n_paths);
+
+  ChecksumWorkerData data = { cancellable, results, };
+  g_mutex_init (&data.error_lock);
+
+  for (guint i = 0; i < n_paths; i++)
+    {
+      items[i].data = &data;
+      items[i].path = argv[i + 1];
+      items[i].idx = i;
+    }
+
+  gboolean processed = FALSE;
+  if (n_jobs > 1)
+    {
+      GThreadPool *pool =
+        g_thread_pool_new (checksum_one_path_worker, &data, n_jobs, FALSE, NULL);
+      if (pool != NULL)
+        {
+          for (guint i = 0; i < n_paths; i++)
+            g_thread_pool_push (pool, &items[i], NULL);
+
+          /* Waits for the queue to drain */
+          g_thread_pool_free (pool, FALSE, TRUE);
+          processed = TRUE;
+        }
+    }
+
+  if (!processed)
+    {
+      /* Single path, or pool creation failed */
+      for (guint i = 0; i < n_paths; i++)
+        checksum_one_path_worker (&items[i], &data);
     }
 
-  data.loop = g_main_loop_new (NULL, FALSE);
-  data.error = error;
-  ostree_checksum_file_async (f, OSTREE_OBJECT_TYPE_FILE, G_PRIORITY_DEFAULT, cancellable, on_checksum_received, &data);
-  
-  g_main_loop_run (data.loop);
+  g_mutex_clear (&data.error_lock);
+
+  gboolean ret = FALSE;
+  if (data.error != NULL)
+    g_propagate_error (error, g_steal_pointer (&data.error));
+  else
+    {
+      for (guint i = 0; i < n_paths; i++)
+        g_print ("%s\n", results[i]);
+      ret = TRUE;
+    }
 
-  ret = TRUE;
- out:
-  if (data.loop)
-    g_main_loop_unref (data.loop);
+  for (guint i = 0; i < n_paths; i++)
+    g_free (results[i]);
   return ret;
 }
@@ -371,6 +371,75 @@ fill_bindings (OstreeRepo    *repo,
   *out_metadata = g_variant_ref_sink (g_variant_builder_end (metadata_builder));
 }
 
+/* Generate static deltas ending at @to_commit from up to @depth of its
+ * ancestors, skipping pairs the repository already has.  Driven by the
+ * core/commit-update-deltas option; like commit-update-summary this
+ * runs here in the commit tool rather than inside the library
+ * transaction, since multiple processes may commit to different refs
+ * concurrently.  One pair at a time is enough: the delta compiler
+ * already parallelizes content analysis and part compression
+ * internally.
+ */
+static gboolean
+generate_ancestor_deltas (OstreeRepo    *repo,
+                          const char    *to_commit,
+                          guint          depth,
+                          GCancellable  *cancellable,
+                          GError       **error)
+{
+  g_autoptr(GPtrArray) delta_names = NULL;
+  if (!ostree_repo_list_static_delta_names (repo, &delta_names, cancellable, error))
+    return FALSE;
+
+  g_autoptr(GHashTable) existing_deltas = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                                 g_free, NULL);
+  for (guint i = 0; i < delta_names->len; i++)
+    g_hash_table_add (existing_deltas, g_strdup (delta_names->pdata[i]));
+
+  g_autofree char *from = NULL;
+  {
+    g_autoptr(GVariant) to_variant = NULL;
+    if (!ostree_repo_load_variant (repo, OSTREE_OBJECT_TYPE_COMMIT, to_commit,
+                                   &to_variant, error))
+      return FALSE;
+    from = ostree_commit_get_parent (to_variant);
+  }
+
+  for (guint i = 0; i < depth && from != NULL; i++)
+    {
+      g_autoptr(GVariant) from_variant = NULL;
+      g_autoptr(GError) local_error = NULL;
+
+      /* Stop quietly at the end of locally-available history */
+      if (!ostree_repo_load_variant (repo, OSTREE_OBJECT_TYPE_COMMIT, from,
+                                     &from_variant, &local_error))
+        {
+          if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+            break;
+          g_propagate_error (error, g_steal_pointer (&local_error));
+          return FALSE;
+        }
+
+      g_autofree char *delta_name = g_strdup_printf ("%s-%s", from, to_commit);
+      if (!g_hash_table_contains (existing_deltas, delta_name))
+        {
+          if (!ostree_repo_static_delta_generate (repo, OSTREE_STATIC_DELTA_GENERATE_OPT_MAJOR,
+                                                  from, to_commit, NULL, NULL,
+                                                  cancellable, error))
+            {
+              g_prefix_error (error, "Generating delta from %s: ", from);
+              return FALSE;
+            }
+        }
+
+      g_autofree char *next = ostree_commit_get_parent (from_variant);
+      g_free (from);
+      from = g_steal_pointer (&next);
+    }
+
+  return TRUE;
+}
+
 gboolean
 ostree_builtin_commit (int argc, char **argv, GCancellable *cancellable, GError **error)
 {
@@ -694,6 +763,27 @@ ostree_builtin_commit (int argc, char **argv, GCancellable *cancellable, GError
       if (!ostree_repo_commit_transaction (repo, &stats, cancellable, error))
         goto out;
 
+      /* Delta generation happens before the summary update below, so
+       * that a single commit invocation publishes the new deltas in the
+       * regenerated summary's delta list. */
+      {
+        g_autofree char *update_deltas_str = NULL;
+        guint update_deltas_depth;
+
+        if (!ot_keyfile_get_value_with_default (ostree_repo_get_config (repo), "core",
+                                                "commit-update-deltas", "0",
+                                                &update_deltas_str, error))
+          goto out;
+        update_deltas_depth = g_ascii_strtoull (update_deltas_str, NULL, 10);
+
+        if (update_deltas_depth > 0 && opt_branch != NULL)
+          {
+            if (!generate_ancestor_deltas (repo, commit_checksum, update_deltas_depth,
+                                           cancellable, error))
+              goto out;
+          }
+      }
+
       /* The default for this option is FALSE, even for archive-z2 repos,
        * because ostree supports multiple processes committing to the same
        * repo (but different refs) concurrently, and in fact gnome-continuous
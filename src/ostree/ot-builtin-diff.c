@@ -30,6 +30,7 @@
 static gboolean opt_stats;
 static gboolean opt_fs_diff;
 static gboolean opt_no_xattrs;
+static gboolean opt_detect_renames;
 static gint opt_owner_uid = -1;
 static gint opt_owner_gid = -1;
 
@@ -37,6 +38,7 @@ static GOptionEntry options[] = {
   { "stats", 0, 0, G_OPTION_ARG_NONE, &opt_stats, "Print various statistics", NULL },
   { "fs-diff", 0, 0, G_OPTION_ARG_NONE, &opt_fs_diff, "Print filesystem diff", NULL },
   { "no-xattrs", 0, 0, G_OPTION_ARG_NONE, &opt_no_xattrs, "Skip output of extended attributes", NULL },
+  { "detect-renames", 'M', 0, G_OPTION_ARG_NONE, &opt_detect_renames, "Pair removed and added files by content similarity", NULL },
   { "owner-uid", 0, 0, G_OPTION_ARG_INT, &opt_owner_uid, "Use file ownership user id for local files", "UID" },
   { "owner-gid", 0, 0, G_OPTION_ARG_INT, &opt_owner_gid, "Use file ownership group id for local files", "GID" },
   { NULL }
@@ -172,6 +174,9 @@ ostree_builtin_diff (int argc, char **argv, GCancellable *cancellable, GError **
 
       if (opt_no_xattrs)
         diff_flags |= OSTREE_DIFF_FLAGS_IGNORE_XATTRS;
+
+      if (opt_detect_renames)
+        diff_flags |= OSTREE_DIFF_FLAGS_DETECT_RENAMES;
       
       if (!parse_file_or_commit (repo, src, &srcf, cancellable, error))
         goto out;
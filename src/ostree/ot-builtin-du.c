@@ -0,0 +1,93 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2017 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include "ot-main.h"
+#include "ot-builtins.h"
+#include "ostree.h"
+#include "otutil.h"
+
+static GOptionEntry options[] = {
+  { NULL }
+};
+
+static gboolean
+du_one_rev (OstreeRepo    *repo,
+            const char    *name,
+            GCancellable  *cancellable,
+            GError       **error)
+{
+  g_autofree char *resolved_rev = NULL;
+  guint64 total;
+  guint64 unique;
+  guint64 shared;
+
+  if (!ostree_repo_resolve_rev (repo, name, FALSE, &resolved_rev, error))
+    return FALSE;
+  if (!ostree_repo_get_commit_sizes (repo, resolved_rev, &total, &unique, &shared,
+                                     cancellable, error))
+    return FALSE;
+
+  g_autofree char *formatted_total = g_format_size (total);
+  g_autofree char *formatted_unique = g_format_size (unique);
+  g_autofree char *formatted_shared = g_format_size (shared);
+  g_print ("%s: %s total; %s unique; %s shared\n",
+           name, formatted_total, formatted_unique, formatted_shared);
+  return TRUE;
+}
+
+gboolean
+ostree_builtin_du (int argc, char **argv, GCancellable *cancellable, GError **error)
+{
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(OstreeRepo) repo = NULL;
+
+  context = g_option_context_new ("[REV...] - Show cached storage size accounting for commits");
+
+  if (!ostree_option_context_parse (context, options, &argc, &argv, OSTREE_BUILTIN_FLAG_NONE, &repo, cancellable, error))
+    return FALSE;
+
+  if (argc > 1)
+    {
+      for (int i = 1; i < argc; i++)
+        {
+          if (!du_one_rev (repo, argv[i], cancellable, error))
+            return FALSE;
+        }
+    }
+  else
+    {
+      g_autoptr(GHashTable) refs = NULL;
+      if (!ostree_repo_list_refs (repo, NULL, &refs, cancellable, error))
+        return FALSE;
+
+      g_autoptr(GList) ordered_keys = g_hash_table_get_keys (refs);
+      ordered_keys = g_list_sort (ordered_keys, (GCompareFunc)strcmp);
+
+      for (GList *iter = ordered_keys; iter; iter = iter->next)
+        {
+          if (!du_one_rev (repo, iter->data, cancellable, error))
+            return FALSE;
+        }
+    }
+
+  return TRUE;
+}
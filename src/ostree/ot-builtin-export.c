@@ -36,9 +36,11 @@ static char *opt_output_path;
 static char *opt_subpath;
 static char *opt_prefix;
 static gboolean opt_no_xattrs;
+static gboolean opt_zlib_payloads;
 
 static GOptionEntry options[] = {
   { "no-xattrs", 0, 0, G_OPTION_ARG_NONE, &opt_no_xattrs, "Skip output of extended attributes", NULL },
+  { "zlib-payloads", 0, 0, G_OPTION_ARG_NONE, &opt_zlib_payloads, "Write file content as the stored zlib streams, without decompressing (archive repos only)", NULL },
   { "subpath", 0, 0, G_OPTION_ARG_FILENAME, &opt_subpath, "Checkout sub-directory PATH", "PATH" },
   { "prefix", 0, 0, G_OPTION_ARG_FILENAME, &opt_prefix, "Add PATH as prefix to archive pathnames", "PATH" },
   { "output", 'o', 0, G_OPTION_ARG_FILENAME, &opt_output_path, "Output to PATH ", "PATH" },
@@ -124,6 +126,17 @@ ostree_builtin_export (int argc, char **argv, GCancellable *cancellable, GError
   if (opt_no_xattrs)
     opts.disable_xattrs = TRUE;
 
+  if (opt_zlib_payloads)
+    {
+      if (ostree_repo_get_mode (repo) != OSTREE_REPO_MODE_ARCHIVE_Z2)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "--zlib-payloads requires an archive repository");
+          goto out;
+        }
+      opts.zlib_payloads = TRUE;
+    }
+
   if (!ostree_repo_read_commit (repo, rev, &root, &commit, cancellable, error))
     goto out;
 
@@ -22,28 +22,143 @@
 
 #include "config.h"
 
+#include <string.h>
+#include <stdlib.h>
+
 #include "ot-main.h"
 #include "ot-builtins.h"
 #include "ostree.h"
 #include "ostree-cmdprivate.h"
+#include "ostree-repo-private.h"
 #include "otutil.h"
 
 static gboolean opt_quiet;
 static gboolean opt_delete;
 static gboolean opt_add_tombstones;
+static gboolean opt_since_last;
+static gboolean opt_quick;
+static int opt_jobs = 1;
+static char *opt_checksum;
+static char *opt_repair_remote;
+/* Set from --checksum; additional digests computed in the same read
+ * pass as the SHA256 verification. */
+static gboolean opt_extra_sha512;
 
 static GOptionEntry options[] = {
   { "add-tombstones", 0, 0, G_OPTION_ARG_NONE, &opt_add_tombstones, "Add tombstones for missing commits", NULL },
   { "quiet", 'q', 0, G_OPTION_ARG_NONE, &opt_quiet, "Only print error messages", NULL },
   { "delete", 0, 0, G_OPTION_ARG_NONE, &opt_delete, "Remove corrupted objects", NULL },
+  { "jobs", 0, 0, G_OPTION_ARG_INT, &opt_jobs, "Number of concurrent verification jobs (0 = one per CPU)", "N" },
+  { "since-last", 0, 0, G_OPTION_ARG_NONE, &opt_since_last, "Only verify objects not covered by the last successful fsck", NULL },
+  { "quick", 0, 0, G_OPTION_ARG_NONE, &opt_quick, "Verify the CRC32C index only, escalating to full checksums on mismatch", NULL },
+  { "checksum", 0, 0, G_OPTION_ARG_STRING, &opt_checksum, "Comma-separated digest algorithms to compute in one pass (sha256,sha512)", "ALGOS" },
+  { "repair-from-remote", 0, 0, G_OPTION_ARG_STRING, &opt_repair_remote, "Delete corrupted objects and refetch them (and missing objects) from REMOTE", "REMOTE" },
   { NULL }
 };
 
+/* The verification journal records which objects the last fully
+ * successful fsck covered, as a sorted array of fixed-size (objtype,
+ * checksum) records in the repo cache directory.  With --since-last
+ * we mmap it and skip membership hits, making a periodic integrity
+ * sweep proportional to churn rather than repository size.  It is
+ * only ever rewritten after a clean pass, so a full `fsck` run
+ * re-verifies (and re-records) everything.
+ */
+#define FSCK_JOURNAL_NAME "fsck-journal"
+#define FSCK_JOURNAL_RECORD_LEN (1 + OSTREE_SHA256_DIGEST_LEN)
+
+static int
+compare_journal_records (gconstpointer a,
+                         gconstpointer b)
+{
+  return memcmp (a, b, FSCK_JOURNAL_RECORD_LEN);
+}
+
+static void
+fsck_journal_record_init (GVariant *serialized_key,
+                          guint8   *record)
+{
+  const char *checksum;
+  OstreeObjectType objtype;
+
+  ostree_object_name_deserialize (serialized_key, &checksum, &objtype);
+  record[0] = (guint8)objtype;
+  ostree_checksum_inplace_to_bytes (checksum, record + 1);
+}
+
+static GVariant *
+fsck_journal_load (OstreeRepo *repo)
+{
+  glnx_fd_close int fd = -1;
+  g_autoptr(GVariant) ret = NULL;
+
+  if (repo->cache_dir_fd == -1)
+    return NULL;
+  if (!ot_openat_ignore_enoent (repo->cache_dir_fd, FSCK_JOURNAL_NAME, &fd, NULL))
+    return NULL;
+  if (fd == -1)
+    return NULL;
+  if (!ot_util_variant_map_fd (fd, 0, G_VARIANT_TYPE ("ay"), TRUE, &ret, NULL))
+    return NULL;
+
+  return g_steal_pointer (&ret);
+}
+
+static gboolean
+fsck_journal_contains (GVariant *journal,
+                       GVariant *serialized_key)
+{
+  guint8 record[FSCK_JOURNAL_RECORD_LEN];
+  gsize len;
+  const guint8 *data = g_variant_get_fixed_array (journal, &len, 1);
+
+  fsck_journal_record_init (serialized_key, record);
+  return bsearch (record, data, len / FSCK_JOURNAL_RECORD_LEN,
+                  FSCK_JOURNAL_RECORD_LEN, compare_journal_records) != NULL;
+}
+
+/* Best-effort; a failure to persist the journal only costs the next
+ * --since-last run some extra verification.
+ */
+static void
+fsck_journal_save (OstreeRepo *repo,
+                   GHashTable *verified_objects)
+{
+  GHashTableIter hash_iter;
+  gpointer key, value;
+
+  if (repo->cache_dir_fd == -1)
+    return;
+
+  const guint n = g_hash_table_size (verified_objects);
+  g_autofree guint8 *buf = g_malloc_n (n, FSCK_JOURNAL_RECORD_LEN);
+  guint8 *p = buf;
+
+  g_hash_table_iter_init (&hash_iter, verified_objects);
+  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+    {
+      fsck_journal_record_init (key, p);
+      p += FSCK_JOURNAL_RECORD_LEN;
+    }
+  qsort (buf, n, FSCK_JOURNAL_RECORD_LEN, compare_journal_records);
+
+  (void) glnx_file_replace_contents_at (repo->cache_dir_fd, FSCK_JOURNAL_NAME,
+                                        buf, n * FSCK_JOURNAL_RECORD_LEN,
+                                        GLNX_FILE_REPLACE_NODATASYNC,
+                                        NULL, NULL);
+}
+
+/* With --repair-from-remote, @out_repair_object receives the
+ * "checksum.objtype" name of an object found missing or corrupt (the
+ * latter deleted here, so the refetched copy isn't deduped away).
+ */
 static gboolean
 load_and_fsck_one_object (OstreeRepo            *repo,
                           const char            *checksum,
                           OstreeObjectType       objtype,
                           gboolean              *out_found_corruption,
+                          char                 **out_sha512,
+                          char                 **out_repair_object,
                           GCancellable          *cancellable,
                           GError               **error)
 {
@@ -127,15 +242,27 @@ load_and_fsck_one_object (OstreeRepo            *repo,
   if (missing)
     {
       *out_found_corruption = TRUE;
+      if (out_repair_object != NULL && opt_repair_remote != NULL)
+        *out_repair_object = ostree_object_to_string (checksum, objtype);
     }
   else
     {
       g_autofree guchar *computed_csum = NULL;
       g_autofree char *tmp_checksum = NULL;
+      g_autoptr(GChecksum) sha512 = NULL;
+      GChecksum *extra_checksums[1];
+      guint n_extra = 0;
 
-      if (!ostree_checksum_file_from_input (file_info, xattrs, input,
-                                            objtype, &computed_csum,
-                                            cancellable, error))
+      if (opt_extra_sha512)
+        {
+          sha512 = g_checksum_new (G_CHECKSUM_SHA512);
+          extra_checksums[n_extra++] = sha512;
+        }
+
+      if (!ostree_checksum_file_from_input_multi (file_info, xattrs, input,
+                                                  objtype, extra_checksums, n_extra,
+                                                  &computed_csum,
+                                                  cancellable, error))
         return FALSE;
 
       tmp_checksum = ostree_checksum_from_bytes (computed_csum);
@@ -144,24 +271,105 @@ load_and_fsck_one_object (OstreeRepo            *repo,
           g_autofree char *msg = g_strdup_printf ("corrupted object %s.%s; actual checksum: %s",
                                                checksum, ostree_object_type_to_string (objtype),
                                                tmp_checksum);
-          if (opt_delete)
+          if (opt_delete || opt_repair_remote != NULL)
             {
               g_printerr ("%s\n", msg);
               (void) ostree_repo_delete_object (repo, objtype, checksum, cancellable, NULL);
               *out_found_corruption = TRUE;
+              if (out_repair_object != NULL && opt_repair_remote != NULL)
+                *out_repair_object = ostree_object_to_string (checksum, objtype);
             }
           else
             return glnx_throw (error, "%s", msg);
         }
+      else if (sha512 != NULL && out_sha512 != NULL)
+        *out_sha512 = g_strdup (g_checksum_get_string (sha512));
     }
 
   return TRUE;
 }
 
+/* Shared state for --jobs; object verification is independent
+ * per-object, so workers only synchronize on the error slot (first
+ * fatal error wins) and atomic counters.
+ */
+typedef struct {
+  OstreeRepo *repo;
+  GCancellable *cancellable;
+  guint count;
+  guint mod;
+  gint n_processed;        /* atomic */
+  gint found_corruption;   /* atomic */
+  GMutex error_lock;
+  GError *error;           /* protected by error_lock */
+  GMutex index_lock;
+  GHashTable *sha512_index; /* %NULL unless --checksum asked for sha512; protected by index_lock */
+  GPtrArray *repair_objects; /* %NULL unless --repair-from-remote; protected by index_lock */
+} FsckWorkerData;
+
+static void
+fsck_one_object_worker (gpointer item,
+                        gpointer user_data)
+{
+  GVariant *serialized_key = item;
+  FsckWorkerData *data = user_data;
+  const char *checksum;
+  OstreeObjectType objtype;
+  gboolean found_corruption = FALSE;
+  g_autoptr(GError) local_error = NULL;
+  gboolean failed;
+
+  /* Once a fatal error is recorded, drain the remaining queue cheaply */
+  g_mutex_lock (&data->error_lock);
+  failed = (data->error != NULL);
+  g_mutex_unlock (&data->error_lock);
+  if (failed)
+    return;
+
+  ostree_object_name_deserialize (serialized_key, &checksum, &objtype);
+
+  g_autofree char *sha512_digest = NULL;
+  g_autofree char *repair_object = NULL;
+  if (!load_and_fsck_one_object (data->repo, checksum, objtype, &found_corruption,
+                                 &sha512_digest, &repair_object,
+                                 data->cancellable, &local_error))
+    {
+      g_mutex_lock (&data->error_lock);
+      if (data->error == NULL)
+        data->error = g_steal_pointer (&local_error);
+      g_mutex_unlock (&data->error_lock);
+      return;
+    }
+
+  if (sha512_digest != NULL)
+    {
+      g_mutex_lock (&data->index_lock);
+      g_hash_table_replace (data->sha512_index,
+                            ostree_object_to_string (checksum, objtype),
+                            g_steal_pointer (&sha512_digest));
+      g_mutex_unlock (&data->index_lock);
+    }
+
+  if (repair_object != NULL)
+    {
+      g_mutex_lock (&data->index_lock);
+      g_ptr_array_add (data->repair_objects, g_steal_pointer (&repair_object));
+      g_mutex_unlock (&data->index_lock);
+    }
+
+  if (found_corruption)
+    g_atomic_int_set (&data->found_corruption, TRUE);
+
+  gint i = g_atomic_int_add (&data->n_processed, 1);
+  if (data->mod == 0 || (i % data->mod == 0))
+    g_print ("%u/%u objects\n", i + 1, data->count);
+}
+
 static gboolean
 fsck_reachable_objects_from_commits (OstreeRepo            *repo,
                                      GHashTable            *commits,
                                      gboolean              *out_found_corruption,
+                                     GPtrArray             *repair_objects,
                                      GCancellable          *cancellable,
                                      GError               **error)
 {
@@ -185,27 +393,232 @@ fsck_reachable_objects_from_commits (OstreeRepo            *repo,
         return FALSE;
     }
 
-  const guint count = g_hash_table_size (reachable_objects);
-  const guint mod = count / 10;
-  guint i = 0;
+  g_autoptr(GVariant) journal = NULL;
+  guint n_skipped = 0;
+
+  if (opt_since_last)
+    {
+      journal = fsck_journal_load (repo);
+      if (journal == NULL && !opt_quiet)
+        g_print ("No verification journal found; verifying all objects\n");
+    }
+
+  g_autoptr(GPtrArray) to_verify = g_ptr_array_new ();
   g_hash_table_iter_init (&hash_iter, reachable_objects);
   while (g_hash_table_iter_next (&hash_iter, &key, &value))
     {
-      GVariant *serialized_key = key;
-      const char *checksum;
-      OstreeObjectType objtype;
+      if (journal != NULL && fsck_journal_contains (journal, key))
+        {
+          n_skipped++;
+          continue;
+        }
+      g_ptr_array_add (to_verify, key);
+    }
 
-      ostree_object_name_deserialize (serialized_key, &checksum, &objtype);
+  if (n_skipped > 0 && !opt_quiet)
+    g_print ("Skipping %u objects verified by the previous fsck\n", n_skipped);
 
-      if (!load_and_fsck_one_object (repo, checksum, objtype, out_found_corruption,
-                                     cancellable, error))
-        return FALSE;
+  const guint count = to_verify->len;
+  const guint mod = count / 10;
+  guint n_jobs = (opt_jobs > 0) ? (guint)opt_jobs : g_get_num_processors ();
+  gboolean verified = FALSE;
 
-      if (mod == 0 || (i % mod == 0))
-        g_print ("%u/%u objects\n", i + 1, count);
-      i++;
+  g_autoptr(GHashTable) sha512_index = NULL;
+  if (opt_extra_sha512)
+    sha512_index = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  if (n_jobs > 1)
+    {
+      FsckWorkerData data = { repo, cancellable, count, mod, 0, FALSE, };
+      GThreadPool *pool;
+
+      g_mutex_init (&data.error_lock);
+      g_mutex_init (&data.index_lock);
+      data.sha512_index = sha512_index;
+      data.repair_objects = repair_objects;
+      pool = g_thread_pool_new (fsck_one_object_worker, &data, n_jobs, FALSE, NULL);
+      if (pool != NULL)
+        {
+          for (guint i = 0; i < to_verify->len; i++)
+            g_thread_pool_push (pool, to_verify->pdata[i], NULL);
+
+          /* Waits for the queue to drain */
+          g_thread_pool_free (pool, FALSE, TRUE);
+          g_mutex_clear (&data.error_lock);
+          g_mutex_clear (&data.index_lock);
+
+          if (data.error != NULL)
+            {
+              g_propagate_error (error, g_steal_pointer (&data.error));
+              return FALSE;
+            }
+          if (g_atomic_int_get (&data.found_corruption))
+            *out_found_corruption = TRUE;
+          verified = TRUE;
+        }
+      else
+        {
+          /* Pool creation failed; fall through to the serial path */
+          g_mutex_clear (&data.error_lock);
+          g_mutex_clear (&data.index_lock);
+        }
     }
 
+  if (!verified)
+    {
+      for (guint i = 0; i < to_verify->len; i++)
+        {
+          GVariant *serialized_key = to_verify->pdata[i];
+          const char *checksum;
+          OstreeObjectType objtype;
+
+          ostree_object_name_deserialize (serialized_key, &checksum, &objtype);
+
+          g_autofree char *sha512_digest = NULL;
+          g_autofree char *repair_object = NULL;
+          if (!load_and_fsck_one_object (repo, checksum, objtype, out_found_corruption,
+                                         &sha512_digest, &repair_object,
+                                         cancellable, error))
+            return FALSE;
+
+          if (repair_object != NULL)
+            g_ptr_array_add (repair_objects, g_steal_pointer (&repair_object));
+
+          if (sha512_digest != NULL)
+            g_hash_table_replace (sha512_index,
+                                  ostree_object_to_string (checksum, objtype),
+                                  g_steal_pointer (&sha512_digest));
+
+          if (mod == 0 || (i % mod == 0))
+            g_print ("%u/%u objects\n", i + 1, count);
+        }
+    }
+
+  /* Each recorded digest covers an object whose SHA256 verified, so
+   * fold them into the index even if some other object was corrupted.
+   */
+  if (sha512_index != NULL && g_hash_table_size (sha512_index) > 0)
+    {
+      if (!ostree_cmd__private__ ()->ostree_repo_sha512_index_update (repo, sha512_index,
+                                                                      cancellable, error))
+        return glnx_prefix_error (error, "Updating sha512 index");
+    }
+
+  /* Everything reachable is now known good (either verified in this
+   * run or carried over from the journal), so record it for the next
+   * --since-last invocation.
+   */
+  if (!*out_found_corruption)
+    fsck_journal_save (repo, reachable_objects);
+
+  return TRUE;
+}
+
+typedef struct {
+  GHashTable *commits;       /* Non-partial commits to verify from */
+  GPtrArray *tombstones;     /* %NULL unless --add-tombstones */
+  guint n_partial;
+} FsckEnumerateData;
+
+/* Streamed over every object; picks out the commits, counting partial
+ * ones and (with --add-tombstones) noting commits whose parent is
+ * missing.
+ */
+static gboolean
+fsck_enumerate_commit_cb (OstreeRepo       *repo,
+                          const guchar     *csum,
+                          OstreeObjectType  objtype,
+                          gpointer          user_data,
+                          GError          **error)
+{
+  FsckEnumerateData *data = user_data;
+
+  if (objtype != OSTREE_OBJECT_TYPE_COMMIT)
+    return TRUE;
+
+  char checksum[OSTREE_SHA256_STRING_LEN+1];
+  ostree_checksum_inplace_from_bytes (csum, checksum);
+
+  OstreeRepoCommitState commitstate = 0;
+  g_autoptr(GVariant) commit = NULL;
+  if (!ostree_repo_load_commit (repo, checksum, &commit, &commitstate, error))
+    return FALSE;
+
+  if (data->tombstones)
+    {
+      GError *local_error = NULL;
+      g_autofree char *parent = ostree_commit_get_parent (commit);
+      if (parent)
+        {
+          g_autoptr(GVariant) parent_commit = NULL;
+          if (!ostree_repo_load_variant (repo, OSTREE_OBJECT_TYPE_COMMIT, parent,
+                                         &parent_commit, &local_error))
+            {
+              if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+                {
+                  g_ptr_array_add (data->tombstones, g_strdup (checksum));
+                  g_clear_error (&local_error);
+                }
+              else
+                {
+                  g_propagate_error (error, local_error);
+                  return FALSE;
+                }
+            }
+        }
+    }
+
+  if (commitstate & OSTREE_REPO_COMMIT_STATE_PARTIAL)
+    data->n_partial++;
+  else
+    g_hash_table_add (data->commits,
+                      g_variant_ref_sink (ostree_object_name_serialize (checksum, objtype)));
+
+  return TRUE;
+}
+
+/* Refetch the objects named in @repair_objects ("checksum.objtype")
+ * from @remote through the regular verified pull machinery, then
+ * re-verify each repaired copy in place.
+ */
+static gboolean
+fsck_repair_from_remote (OstreeRepo    *repo,
+                         const char    *remote,
+                         GPtrArray     *repair_objects,
+                         GCancellable  *cancellable,
+                         GError       **error)
+{
+  if (!opt_quiet)
+    g_print ("Refetching %u objects from remote '%s'...\n",
+             repair_objects->len, remote);
+
+  GVariantBuilder builder;
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+  g_variant_builder_add (&builder, "{s@v}", "fetch-objects",
+                         g_variant_new_variant (g_variant_new_strv ((const char *const *)repair_objects->pdata,
+                                                                    repair_objects->len)));
+  g_autoptr(GVariant) pull_options = g_variant_ref_sink (g_variant_builder_end (&builder));
+  if (!ostree_repo_pull_with_options (repo, remote, pull_options, NULL,
+                                      cancellable, error))
+    return glnx_prefix_error (error, "Refetching objects from remote '%s'", remote);
+
+  for (guint i = 0; i < repair_objects->len; i++)
+    {
+      const char *objname = repair_objects->pdata[i];
+      g_autofree char *checksum = NULL;
+      OstreeObjectType objtype;
+      gboolean still_corrupt = FALSE;
+
+      ostree_object_from_string (objname, &checksum, &objtype);
+      if (!load_and_fsck_one_object (repo, checksum, objtype, &still_corrupt,
+                                     NULL, NULL, cancellable, error))
+        return FALSE;
+      if (still_corrupt)
+        return glnx_throw (error, "Object %s still missing or corrupt after refetch", objname);
+    }
+
+  if (!opt_quiet)
+    g_print ("Repaired %u objects\n", repair_objects->len);
   return TRUE;
 }
 
@@ -219,6 +632,24 @@ ostree_builtin_fsck (int argc, char **argv, GCancellable *cancellable, GError **
   if (!ostree_option_context_parse (context, options, &argc, &argv, OSTREE_BUILTIN_FLAG_NONE, &repo, cancellable, error))
     return FALSE;
 
+  if (opt_checksum != NULL)
+    {
+      g_auto(GStrv) algos = g_strsplit (opt_checksum, ",", -1);
+      for (char **iter = algos; iter && *iter; iter++)
+        {
+          if ((*iter)[0] == '\0' || g_str_equal (*iter, "sha256"))
+            continue; /* SHA256 is always verified */
+          else if (g_str_equal (*iter, "sha512"))
+            opt_extra_sha512 = TRUE;
+          else
+            return glnx_throw (error, "Unknown checksum algorithm '%s'", *iter);
+        }
+    }
+
+  g_autoptr(GPtrArray) repair_objects = NULL;
+  if (opt_repair_remote != NULL)
+    repair_objects = g_ptr_array_new_with_free_func (g_free);
+
   if (!opt_quiet)
     g_print ("Validating refs...\n");
 
@@ -263,77 +694,95 @@ ostree_builtin_fsck (int argc, char **argv, GCancellable *cancellable, GError **
     }
 #endif  /* OSTREE_ENABLE_EXPERIMENTAL_API */
 
-  if (!opt_quiet)
-    g_print ("Enumerating objects...\n");
-
-  g_autoptr(GHashTable) objects = NULL;
-  if (!ostree_repo_list_objects (repo, OSTREE_REPO_LIST_OBJECTS_ALL,
-                                 &objects, cancellable, error))
-    return FALSE;
-
-  g_autoptr(GHashTable) commits = g_hash_table_new_full (ostree_hash_object_name, g_variant_equal,
-                                                         (GDestroyNotify)g_variant_unref, NULL);
-
-
-  g_autoptr(GPtrArray) tombstones = NULL;
-  if (opt_add_tombstones)
-    tombstones = g_ptr_array_new_with_free_func (g_free);
-
-  guint n_partial = 0;
-  g_hash_table_iter_init (&hash_iter, objects);
-  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+  /* The quick tier compares every loose object's stored bytes against
+   * the CRC32C index at memory bandwidth, falling back to full SHA256
+   * verification only for unindexed or mismatched objects.  Objects
+   * that pass the escalation are folded back into the index, so the
+   * first --quick run on an older repository backfills it.
+   */
+  if (opt_quick)
     {
-      GVariant *serialized_key = key;
-      const char *checksum;
-      OstreeObjectType objtype;
-      OstreeRepoCommitState commitstate = 0;
-      g_autoptr(GVariant) commit = NULL;
+      guint n_crc_verified = 0;
+      g_autoptr(GHashTable) unverified = NULL;
 
-      ostree_object_name_deserialize (serialized_key, &checksum, &objtype);
+      if (!ostree_cmd__private__ ()->ostree_repo_crc32c_quick_check (repo, &n_crc_verified,
+                                                                     &unverified,
+                                                                     cancellable, error))
+        return FALSE;
+
+      if (!opt_quiet)
+        g_print ("%u objects verified by CRC32C; %u require full verification\n",
+                 n_crc_verified, (guint)g_hash_table_size (unverified));
 
-      if (objtype == OSTREE_OBJECT_TYPE_COMMIT)
+      GHashTableIter quick_iter;
+      gpointer quick_key;
+      g_hash_table_iter_init (&quick_iter, unverified);
+      while (g_hash_table_iter_next (&quick_iter, &quick_key, NULL))
         {
-          if (!ostree_repo_load_commit (repo, checksum, &commit, &commitstate, error))
+          const char *objname = quick_key;
+          g_autofree char *checksum = NULL;
+          OstreeObjectType objtype;
+          gboolean obj_corrupt = FALSE;
+
+          ostree_object_from_string (objname, &checksum, &objtype);
+          g_autofree char *repair_object = NULL;
+          if (!load_and_fsck_one_object (repo, checksum, objtype, &obj_corrupt,
+                                         NULL, &repair_object, cancellable, error))
             return FALSE;
-
-          if (opt_add_tombstones)
+          if (repair_object != NULL)
+            g_ptr_array_add (repair_objects, g_steal_pointer (&repair_object));
+          if (obj_corrupt)
             {
-              GError *local_error = NULL;
-              g_autofree char *parent = ostree_commit_get_parent (commit);
-              if (parent)
-                {
-                  g_autoptr(GVariant) parent_commit = NULL;
-                  if (!ostree_repo_load_variant (repo, OSTREE_OBJECT_TYPE_COMMIT, parent,
-                                                 &parent_commit, &local_error))
-                    {
-                      if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
-                        {
-                          g_ptr_array_add (tombstones, g_strdup (checksum));
-                          g_clear_error (&local_error);
-                        }
-                      else
-                        {
-                          g_propagate_error (error, local_error);
-                          return FALSE;
-                        }
-                    }
-                }
+              found_corruption = TRUE;
+              g_hash_table_iter_remove (&quick_iter);
             }
+        }
 
-          if (commitstate & OSTREE_REPO_COMMIT_STATE_PARTIAL)
-            n_partial++;
-          else
-            g_hash_table_add (commits, g_variant_ref (serialized_key));
+      if (g_hash_table_size (unverified) > 0)
+        {
+          if (!ostree_cmd__private__ ()->ostree_repo_crc32c_index_update (repo, unverified,
+                                                                          cancellable, error))
+            return glnx_prefix_error (error, "Updating crc32c index");
         }
+
+      if (repair_objects != NULL && repair_objects->len > 0)
+        {
+          if (!fsck_repair_from_remote (repo, opt_repair_remote, repair_objects,
+                                        cancellable, error))
+            return FALSE;
+          found_corruption = FALSE;
+        }
+
+      if (found_corruption)
+        return glnx_throw (error, "Repository corruption encountered");
+
+      return TRUE;
     }
 
-  g_clear_pointer (&objects, (GDestroyNotify) g_hash_table_unref);
+  if (!opt_quiet)
+    g_print ("Enumerating objects...\n");
+
+  g_autoptr(GHashTable) commits = g_hash_table_new_full (ostree_hash_object_name, g_variant_equal,
+                                                         (GDestroyNotify)g_variant_unref, NULL);
+
+
+  g_autoptr(GPtrArray) tombstones = NULL;
+  if (opt_add_tombstones)
+    tombstones = g_ptr_array_new_with_free_func (g_free);
+
+  FsckEnumerateData enumerate_data = { commits, tombstones, 0 };
+  if (!ostree_repo_list_objects_foreach (repo, OSTREE_REPO_LIST_OBJECTS_ALL,
+                                         fsck_enumerate_commit_cb, &enumerate_data,
+                                         cancellable, error))
+    return FALSE;
+  guint n_partial = enumerate_data.n_partial;
 
   if (!opt_quiet)
     g_print ("Verifying content integrity of %u commit objects...\n",
              (guint)g_hash_table_size (commits));
 
   if (!fsck_reachable_objects_from_commits (repo, commits, &found_corruption,
+                                            repair_objects,
                                             cancellable, error))
     return FALSE;
 
@@ -358,6 +807,14 @@ ostree_builtin_fsck (int argc, char **argv, GCancellable *cancellable, GError **
       g_print ("%u partial commits not verified\n", n_partial);
     }
 
+  if (repair_objects != NULL && repair_objects->len > 0)
+    {
+      if (!fsck_repair_from_remote (repo, opt_repair_remote, repair_objects,
+                                    cancellable, error))
+        return FALSE;
+      found_corruption = FALSE;
+    }
+
   if (found_corruption)
     return glnx_throw (error, "Repository corruption encountered");
 
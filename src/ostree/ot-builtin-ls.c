@@ -26,6 +26,7 @@
 #include "ot-builtins.h"
 #include "ostree.h"
 #include "ostree-repo-file.h"
+#include "ostree-repo-private.h"
 #include "otutil.h"
 
 static gboolean opt_dironly;
@@ -144,6 +145,44 @@ print_one_file (GFile     *f,
     print_one_file_text (f, file_info);
 }
 
+static gboolean
+print_directory_recurse (GFile    *f,
+                         int       depth,
+                         GError  **error);
+
+/* The names-only output needs no metadata at all, so walk the dirtree
+ * variant directly instead of allocating a GFileInfo per child.
+ */
+static gboolean
+print_directory_recurse_names_only (GFile    *f,
+                                    int       depth,
+                                    GError  **error)
+{
+  for (int i = 0; TRUE; i++)
+    {
+      const char *name = NULL;
+      gboolean is_dir = FALSE;
+      g_autoptr(GFile) child = NULL;
+
+      if (!_ostree_repo_file_tree_query_child_lite ((OstreeRepoFile*)f, i, &name,
+                                                    &is_dir, error))
+        return FALSE;
+      if (name == NULL)
+        break;
+
+      child = g_file_get_child (f, name);
+      print_one_file_binary (child, NULL);
+
+      if (is_dir)
+        {
+          if (!print_directory_recurse (child, depth, error))
+            return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
 static gboolean
 print_directory_recurse (GFile    *f,
                          int       depth,
@@ -162,9 +201,12 @@ print_directory_recurse (GFile    *f,
   else
     g_assert (depth == -1);
 
-  dir_enum = g_file_enumerate_children (f, OSTREE_GIO_FAST_QUERYINFO, 
+  if (opt_nul_filenames_only)
+    return print_directory_recurse_names_only (f, depth, error);
+
+  dir_enum = g_file_enumerate_children (f, OSTREE_GIO_FAST_QUERYINFO,
                                         G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-                                        NULL, 
+                                        NULL,
                                         error);
   if (!dir_enum)
     goto out;
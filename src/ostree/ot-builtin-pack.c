@@ -0,0 +1,60 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2017 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include "ot-main.h"
+#include "ot-builtins.h"
+#include "ostree.h"
+#include "ostree-repo-private.h"
+#include "otutil.h"
+
+static char *opt_max_size;
+
+static GOptionEntry options[] = {
+  { "max-size", 0, 0, G_OPTION_ARG_STRING, &opt_max_size, "Pack content objects of at most SIZE bytes (default: core.pack-small-objects-max-bytes)", "SIZE" },
+  { NULL }
+};
+
+gboolean
+ostree_builtin_pack (int argc, char **argv, GCancellable *cancellable, GError **error)
+{
+  g_autoptr(GOptionContext) context =
+    g_option_context_new ("- Pack small content objects into pack files");
+  g_autoptr(OstreeRepo) repo = NULL;
+  if (!ostree_option_context_parse (context, options, &argc, &argv, OSTREE_BUILTIN_FLAG_NONE, &repo, cancellable, error))
+    return FALSE;
+
+  guint64 max_object_size;
+  if (opt_max_size != NULL)
+    max_object_size = g_ascii_strtoull (opt_max_size, NULL, 10);
+  else
+    max_object_size = repo->pack_small_objects_max_bytes;
+  if (max_object_size == 0)
+    return glnx_throw (error, "No --max-size specified and core.pack-small-objects-max-bytes is unset");
+
+  guint n_packed;
+  if (!_ostree_repo_pack_small_objects (repo, max_object_size, &n_packed,
+                                        cancellable, error))
+    return FALSE;
+
+  g_print ("Packed %u content objects\n", n_packed);
+  return TRUE;
+}
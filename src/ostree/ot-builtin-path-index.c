@@ -0,0 +1,58 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2017 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include "ot-main.h"
+#include "ot-builtins.h"
+#include "ostree.h"
+#include "ostree-repo-private.h"
+#include "otutil.h"
+
+static GOptionEntry options[] = {
+  { NULL }
+};
+
+gboolean
+ostree_builtin_path_index (int argc, char **argv, GCancellable *cancellable, GError **error)
+{
+  g_autoptr(GOptionContext) context =
+    g_option_context_new ("REV... - Generate path indexes for commits");
+  g_autoptr(OstreeRepo) repo = NULL;
+  if (!ostree_option_context_parse (context, options, &argc, &argv, OSTREE_BUILTIN_FLAG_NONE, &repo, cancellable, error))
+    return FALSE;
+
+  if (argc <= 1)
+    {
+      ot_util_usage_error (context, "At least one REV must be specified", error);
+      return FALSE;
+    }
+
+  for (int i = 1; i < argc; i++)
+    {
+      g_autofree char *checksum = NULL;
+      if (!ostree_repo_resolve_rev (repo, argv[i], FALSE, &checksum, error))
+        return FALSE;
+      if (!_ostree_repo_regenerate_path_index (repo, checksum, cancellable, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
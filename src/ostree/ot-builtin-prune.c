@@ -25,6 +25,7 @@
 #include "ot-main.h"
 #include "ot-builtins.h"
 #include "ostree.h"
+#include "ostree-repo-private.h"
 #include "otutil.h"
 #include "parse-datetime.h"
 
@@ -114,7 +115,6 @@ traverse_keep_younger_than (OstreeRepo *repo, const char *checksum,
                             GCancellable *cancellable, GError **error)
 {
   g_autofree char *next_checksum = g_strdup (checksum);
-  g_autoptr(GVariant) commit = NULL;
 
   /* This is the first commit in our loop, which has a ref pointing to it. We
    * don't want to auto-prune it.
@@ -126,15 +126,40 @@ traverse_keep_younger_than (OstreeRepo *repo, const char *checksum,
   while (TRUE)
     {
       guint64 commit_timestamp;
-
-      if (!ostree_repo_load_variant_if_exists (repo, OSTREE_OBJECT_TYPE_COMMIT, next_checksum,
-                                               &commit, error))
+      g_autofree char *parent = NULL;
+
+      /* The commit graph answers timestamp and parent with a sequential
+       * index read; only commits it doesn't cover cost a loose-object
+       * load.  It can outlive pruned commits, so a hit still needs the
+       * cheap existence check.
+       */
+      gboolean found_in_graph = FALSE;
+      if (!_ostree_repo_commit_graph_lookup (repo, next_checksum, &found_in_graph,
+                                             &parent, &commit_timestamp, NULL, error))
         return FALSE;
+      if (found_in_graph)
+        {
+          gboolean have_commit;
+          if (!ostree_repo_has_object (repo, OSTREE_OBJECT_TYPE_COMMIT, next_checksum,
+                                       &have_commit, cancellable, error))
+            return FALSE;
+          if (!have_commit)
+            break; /* This commit was pruned, so we're done */
+        }
+      else
+        {
+          g_autoptr(GVariant) commit = NULL;
+          if (!ostree_repo_load_variant_if_exists (repo, OSTREE_OBJECT_TYPE_COMMIT, next_checksum,
+                                                   &commit, error))
+            return FALSE;
+
+          if (!commit)
+            break; /* This commit was pruned, so we're done */
 
-      if (!commit)
-        break; /* This commit was pruned, so we're done */
+          commit_timestamp = ostree_commit_get_timestamp (commit);
+          parent = ostree_commit_get_parent (commit);
+        }
 
-      commit_timestamp = ostree_commit_get_timestamp (commit);
       /* Is this commit newer than our --keep-younger-than spec? */
       if (commit_timestamp >= ts->tv_sec)
         {
@@ -143,12 +168,10 @@ traverse_keep_younger_than (OstreeRepo *repo, const char *checksum,
                                                   cancellable, error))
             return FALSE;
 
-          g_free (next_checksum);
-          next_checksum = ostree_commit_get_parent (commit);
-          if (next_checksum)
-            g_clear_pointer (&commit, (GDestroyNotify)g_variant_unref);
-          else
+          if (parent == NULL)
             break; /* No parent, we're done */
+          g_free (next_checksum);
+          next_checksum = g_steal_pointer (&parent);
         }
       else
         break; /* It's older than our spec, we're done */
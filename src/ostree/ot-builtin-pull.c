@@ -33,12 +33,17 @@ static gboolean opt_commit_only;
 static gboolean opt_dry_run;
 static gboolean opt_disable_static_deltas;
 static gboolean opt_require_static_deltas;
+static gboolean opt_disable_delta_cost_model;
+static gboolean opt_disable_commitmeta_refresh;
 static gboolean opt_untrusted;
 static gboolean opt_bareuseronly_files;
 static char** opt_subpaths;
 static char** opt_http_headers;
 static char* opt_cache_dir;
 static int opt_depth = 0;
+static int opt_deepen = 0;
+static gboolean opt_dump_stats;
+static int opt_scan_queue_limit = 0;
 static int opt_frequency = 0;
 static char* opt_url;
 static char** opt_localcache_repos;
@@ -49,16 +54,21 @@ static GOptionEntry options[] = {
    { "disable-fsync", 0, 0, G_OPTION_ARG_NONE, &opt_disable_fsync, "Do not invoke fsync()", NULL },
    { "disable-static-deltas", 0, 0, G_OPTION_ARG_NONE, &opt_disable_static_deltas, "Do not use static deltas", NULL },
    { "require-static-deltas", 0, 0, G_OPTION_ARG_NONE, &opt_require_static_deltas, "Require static deltas", NULL },
+   { "disable-delta-cost-model", 0, 0, G_OPTION_ARG_NONE, &opt_disable_delta_cost_model, "Always apply available static deltas, even when fetching loose objects is estimated to be faster", NULL },
+   { "disable-commitmeta-refresh", 0, 0, G_OPTION_ARG_NONE, &opt_disable_commitmeta_refresh, "Don't refetch detached metadata for commits already stored locally", NULL },
    { "mirror", 0, 0, G_OPTION_ARG_NONE, &opt_mirror, "Write refs suitable for a mirror", NULL },
    { "subpath", 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &opt_subpaths, "Only pull the provided subpath(s)", NULL },
    { "untrusted", 0, 0, G_OPTION_ARG_NONE, &opt_untrusted, "Do not trust (local) sources", NULL },
    { "bareuseronly-files", 0, 0, G_OPTION_ARG_NONE, &opt_bareuseronly_files, "Reject regular files with mode outside of 0775 (world writable, suid, etc.)", NULL },
    { "dry-run", 0, 0, G_OPTION_ARG_NONE, &opt_dry_run, "Only print information on what will be downloaded (requires static deltas)", NULL },
    { "depth", 0, 0, G_OPTION_ARG_INT, &opt_depth, "Traverse DEPTH parents (-1=infinite) (default: 0)", "DEPTH" },
+   { "deepen", 0, 0, G_OPTION_ARG_INT, &opt_deepen, "Extend a previous depth-limited pull by DEPTH more parents, resuming at the recorded history boundary", "DEPTH" },
    { "url", 0, 0, G_OPTION_ARG_STRING, &opt_url, "Pull objects from this URL instead of the one from the remote config", NULL },
    { "http-header", 0, 0, G_OPTION_ARG_STRING_ARRAY, &opt_http_headers, "Add NAME=VALUE as HTTP header to all requests", "NAME=VALUE" },
    { "update-frequency", 0, 0, G_OPTION_ARG_INT, &opt_frequency, "Sets the update frequency, in milliseconds (0=1000ms) (default: 0)", "FREQUENCY" },
    { "localcache-repo", 'L', 0, G_OPTION_ARG_FILENAME_ARRAY, &opt_localcache_repos, "Add REPO as local cache source for objects during this pull", "REPO" },
+   { "stats", 0, 0, G_OPTION_ARG_NONE, &opt_dump_stats, "Print a summary of pull timing and queue statistics to stderr", NULL },
+   { "scan-queue-limit", 0, 0, G_OPTION_ARG_INT, &opt_scan_queue_limit, "Keep at most N pending object scan entries in memory, spilling the rest to a temporary file", "N" },
    { NULL }
  };
 
@@ -271,6 +281,13 @@ ostree_builtin_pull (int argc, char **argv, GCancellable *cancellable, GError **
                              g_variant_new_variant (g_variant_new_strv ((const char *const*) refs_to_fetch->pdata, -1)));
     g_variant_builder_add (&builder, "{s@v}", "depth",
                            g_variant_new_variant (g_variant_new_int32 (opt_depth)));
+    g_variant_builder_add (&builder, "{s@v}", "deepen",
+                           g_variant_new_variant (g_variant_new_int32 (opt_deepen)));
+    g_variant_builder_add (&builder, "{s@v}", "stats",
+                           g_variant_new_variant (g_variant_new_boolean (opt_dump_stats)));
+    if (opt_scan_queue_limit > 0)
+      g_variant_builder_add (&builder, "{s@v}", "scan-queue-limit",
+                             g_variant_new_variant (g_variant_new_uint32 (opt_scan_queue_limit)));
    
     g_variant_builder_add (&builder, "{s@v}", "update-frequency",
                            g_variant_new_variant (g_variant_new_uint32 (opt_frequency)));
@@ -281,6 +298,12 @@ ostree_builtin_pull (int argc, char **argv, GCancellable *cancellable, GError **
     g_variant_builder_add (&builder, "{s@v}", "require-static-deltas",
                            g_variant_new_variant (g_variant_new_boolean (opt_require_static_deltas)));
 
+    g_variant_builder_add (&builder, "{s@v}", "disable-delta-cost-model",
+                           g_variant_new_variant (g_variant_new_boolean (opt_disable_delta_cost_model)));
+
+    g_variant_builder_add (&builder, "{s@v}", "disable-commitmeta-refresh",
+                           g_variant_new_variant (g_variant_new_boolean (opt_disable_commitmeta_refresh)));
+
     g_variant_builder_add (&builder, "{s@v}", "dry-run",
                            g_variant_new_variant (g_variant_new_boolean (opt_dry_run)));
 
@@ -25,8 +25,10 @@
 #include "ot-main.h"
 #include "ot-builtins.h"
 #include "ostree.h"
+#include "ostree-repo-private.h"
 
 static gboolean opt_delete;
+static gboolean opt_pack;
 static gboolean opt_list;
 static gboolean opt_alias;
 static char *opt_create;
@@ -36,6 +38,7 @@ static gboolean opt_collections;
 
 static GOptionEntry options[] = {
   { "delete", 0, 0, G_OPTION_ARG_NONE, &opt_delete, "Delete refs which match PREFIX, rather than listing them", NULL },
+  { "pack", 0, 0, G_OPTION_ARG_NONE, &opt_pack, "Pack loose local refs into a single sorted file", NULL },
   { "list", 0, 0, G_OPTION_ARG_NONE, &opt_list, "Do not remove the prefix from the refs", NULL },
   { "alias", 'A', 0, G_OPTION_ARG_NONE, &opt_alias, "If used with --create, create an alias, otherwise just list aliases", NULL },
   { "create", 0, 0, G_OPTION_ARG_STRING, &opt_create, "Create a new ref for an existing commit", "NEWREF" },
@@ -268,6 +271,20 @@ ostree_builtin_refs (int argc, char **argv, GCancellable *cancellable, GError **
   if (!ostree_option_context_parse (context, options, &argc, &argv, OSTREE_BUILTIN_FLAG_NONE, &repo, cancellable, error))
     goto out;
 
+  if (opt_pack)
+    {
+      if (opt_delete || opt_create || opt_alias)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "--pack cannot be combined with other operations");
+          goto out;
+        }
+      if (!_ostree_repo_pack_refs (repo, cancellable, error))
+        goto out;
+      ret = TRUE;
+      goto out;
+    }
+
   if (argc >= 2)
     {
       if (opt_create && argc > 2)
@@ -0,0 +1,417 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2017 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <gio/gunixsocketaddress.h>
+#include <glib-unix.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "ot-main.h"
+#include "ot-builtins.h"
+#include "ot-repod.h"
+#include "ostree.h"
+#include "otutil.h"
+
+static int opt_exit_idle_time;
+
+static GOptionEntry options[] = {
+  { "exit-idle-time", 0, 0, G_OPTION_ARG_INT, &opt_exit_idle_time, "Exit after SECS seconds without a request (default: stay running)", "SECS" },
+  { NULL }
+};
+
+typedef struct {
+  OstreeRepo *repo;
+  GMainLoop *loop;
+  char *socket_path;   /* NULL if the listening socket was inherited */
+  guint idle_timeout_id;
+} RepodServer;
+
+static gboolean
+on_idle_timeout (gpointer user_data)
+{
+  RepodServer *server = user_data;
+  server->idle_timeout_id = 0;
+  g_main_loop_quit (server->loop);
+  return G_SOURCE_REMOVE;
+}
+
+static void
+repod_reset_idle_timeout (RepodServer *server)
+{
+  if (opt_exit_idle_time <= 0)
+    return;
+  if (server->idle_timeout_id > 0)
+    g_source_remove (server->idle_timeout_id);
+  server->idle_timeout_id =
+    g_timeout_add_seconds (opt_exit_idle_time, on_idle_timeout, server);
+}
+
+/* Append one `ls`-style line for @f to @payload; this mirrors the
+ * default output of `ostree ls` (no checksums or xattrs).
+ */
+static gboolean
+ls_append_one_file (GFile      *f,
+                    GFileInfo  *file_info,
+                    GString    *payload,
+                    GError    **error)
+{
+  char type_c = '?';
+  guint32 mode = g_file_info_get_attribute_uint32 (file_info, "unix::mode");
+  guint32 type = g_file_info_get_file_type (file_info);
+
+  switch (type)
+    {
+    case G_FILE_TYPE_REGULAR:
+      type_c = '-';
+      break;
+    case G_FILE_TYPE_DIRECTORY:
+      type_c = 'd';
+      break;
+    case G_FILE_TYPE_SYMBOLIC_LINK:
+      type_c = 'l';
+      break;
+    case G_FILE_TYPE_SPECIAL:
+      if (S_ISCHR (mode))
+        type_c = 'c';
+      else if (S_ISBLK (mode))
+        type_c = 'b';
+      break;
+    default:
+      break;
+    }
+
+  g_string_append_c (payload, type_c);
+  g_string_append_printf (payload, "0%04o %u %u %6" G_GUINT64_FORMAT " ",
+                          mode & ~S_IFMT,
+                          g_file_info_get_attribute_uint32 (file_info, "unix::uid"),
+                          g_file_info_get_attribute_uint32 (file_info, "unix::gid"),
+                          g_file_info_get_attribute_uint64 (file_info, "standard::size"));
+  g_string_append (payload, gs_file_get_path_cached (f));
+  if (type == G_FILE_TYPE_SYMBOLIC_LINK)
+    g_string_append_printf (payload, " -> %s",
+                            g_file_info_get_attribute_byte_string (file_info, "standard::symlink-target"));
+  g_string_append_c (payload, '\n');
+  return TRUE;
+}
+
+static gboolean
+handle_op_resolve (RepodServer   *server,
+                   char         **args,
+                   GString       *payload,
+                   GCancellable  *cancellable,
+                   GError       **error)
+{
+  if (g_strv_length (args) != 1)
+    return glnx_throw (error, "resolve: expected one REV");
+
+  g_autofree char *checksum = NULL;
+  if (!ostree_repo_resolve_rev (server->repo, args[0], FALSE, &checksum, error))
+    return FALSE;
+  g_string_append_printf (payload, "%s\n", checksum);
+  return TRUE;
+}
+
+static gboolean
+handle_op_has_object (RepodServer   *server,
+                      char         **args,
+                      GString       *payload,
+                      GCancellable  *cancellable,
+                      GError       **error)
+{
+  if (g_strv_length (args) != 2)
+    return glnx_throw (error, "has-object: expected TYPE and CHECKSUM");
+
+  /* ostree_object_type_from_string() asserts on unknown input */
+  OstreeObjectType objtype = 0;
+  for (OstreeObjectType i = OSTREE_OBJECT_TYPE_FILE; i <= OSTREE_OBJECT_TYPE_LAST; i++)
+    {
+      if (g_str_equal (args[0], ostree_object_type_to_string (i)))
+        {
+          objtype = i;
+          break;
+        }
+    }
+  if (objtype == 0)
+    return glnx_throw (error, "has-object: invalid object type '%s'", args[0]);
+  if (!ostree_validate_checksum_string (args[1], error))
+    return FALSE;
+
+  gboolean have_object = FALSE;
+  if (!ostree_repo_has_object (server->repo, objtype, args[1], &have_object,
+                               cancellable, error))
+    return FALSE;
+  g_string_append (payload, have_object ? "true\n" : "false\n");
+  return TRUE;
+}
+
+static gboolean
+handle_op_cat (RepodServer   *server,
+               char         **args,
+               GString       *payload,
+               GCancellable  *cancellable,
+               GError       **error)
+{
+  if (g_strv_length (args) < 2)
+    return glnx_throw (error, "cat: expected REV and at least one PATH");
+
+  g_autoptr(GFile) root = NULL;
+  if (!ostree_repo_read_commit (server->repo, args[0], &root, NULL,
+                                cancellable, error))
+    return FALSE;
+
+  for (guint i = 1; args[i] != NULL; i++)
+    {
+      g_autoptr(GFile) f = g_file_resolve_relative_path (root, args[i]);
+      g_autoptr(GInputStream) in = (GInputStream*)g_file_read (f, cancellable, error);
+      if (in == NULL)
+        return FALSE;
+
+      guint8 buf[8192];
+      while (TRUE)
+        {
+          gssize bytes_read = g_input_stream_read (in, buf, sizeof (buf),
+                                                   cancellable, error);
+          if (bytes_read < 0)
+            return FALSE;
+          if (bytes_read == 0)
+            break;
+          g_string_append_len (payload, (char*)buf, bytes_read);
+        }
+    }
+
+  return TRUE;
+}
+
+static gboolean
+handle_op_ls (RepodServer   *server,
+              char         **args,
+              GString       *payload,
+              GCancellable  *cancellable,
+              GError       **error)
+{
+  if (g_strv_length (args) < 2)
+    return glnx_throw (error, "ls: expected REV and at least one PATH");
+
+  g_autoptr(GFile) root = NULL;
+  if (!ostree_repo_read_commit (server->repo, args[0], &root, NULL,
+                                cancellable, error))
+    return FALSE;
+
+  for (guint i = 1; args[i] != NULL; i++)
+    {
+      g_autoptr(GFile) f = g_file_resolve_relative_path (root, args[i]);
+      g_autoptr(GFileInfo) file_info =
+        g_file_query_info (f, OSTREE_GIO_FAST_QUERYINFO,
+                           G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                           cancellable, error);
+      if (file_info == NULL)
+        return FALSE;
+
+      if (!ls_append_one_file (f, file_info, payload, error))
+        return FALSE;
+
+      if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_DIRECTORY)
+        {
+          g_autoptr(GFileEnumerator) dir_enum =
+            g_file_enumerate_children (f, OSTREE_GIO_FAST_QUERYINFO,
+                                       G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                       cancellable, error);
+          if (dir_enum == NULL)
+            return FALSE;
+
+          while (TRUE)
+            {
+              GFileInfo *child_info;
+              GFile *child;
+              if (!g_file_enumerator_iterate (dir_enum, &child_info, &child,
+                                              cancellable, error))
+                return FALSE;
+              if (child_info == NULL)
+                break;
+              if (!ls_append_one_file (child, child_info, payload, error))
+                return FALSE;
+            }
+        }
+    }
+
+  return TRUE;
+}
+
+static gboolean
+handle_request (RepodServer   *server,
+                const char    *line,
+                GString       *payload,
+                GCancellable  *cancellable,
+                GError       **error)
+{
+  g_auto(GStrv) fields = g_strsplit (line, " ", -1);
+  guint n_fields = g_strv_length (fields);
+  if (n_fields == 0)
+    return glnx_throw (error, "Empty request");
+
+  for (guint i = 0; i < n_fields; i++)
+    {
+      char *unescaped = g_uri_unescape_string (fields[i], NULL);
+      if (unescaped == NULL)
+        return glnx_throw (error, "Invalid escaping in request");
+      g_free (fields[i]);
+      fields[i] = unescaped;
+    }
+
+  const char *op = fields[0];
+  char **args = fields + 1;
+  if (g_str_equal (op, "resolve"))
+    return handle_op_resolve (server, args, payload, cancellable, error);
+  else if (g_str_equal (op, "has-object"))
+    return handle_op_has_object (server, args, payload, cancellable, error);
+  else if (g_str_equal (op, "cat"))
+    return handle_op_cat (server, args, payload, cancellable, error);
+  else if (g_str_equal (op, "ls"))
+    return handle_op_ls (server, args, payload, cancellable, error);
+  else
+    return glnx_throw (error, "Unknown operation '%s'", op);
+}
+
+static gboolean
+on_incoming (GSocketService     *service,
+             GSocketConnection  *connection,
+             GObject            *source_object,
+             gpointer            user_data)
+{
+  RepodServer *server = user_data;
+
+  repod_reset_idle_timeout (server);
+
+  /* Requests are short metadata lookups; handling them serially on the
+   * main loop keeps the repository's caches single-threaded.
+   */
+  g_autoptr(GDataInputStream) in =
+    g_data_input_stream_new (g_io_stream_get_input_stream (G_IO_STREAM (connection)));
+  g_autofree char *line = g_data_input_stream_read_line (in, NULL, NULL, NULL);
+  if (line == NULL)
+    return TRUE;
+
+  g_autoptr(GString) payload = g_string_new ("");
+  g_autoptr(GString) reply = g_string_new ("");
+  g_autoptr(GError) local_error = NULL;
+  if (handle_request (server, line, payload, NULL, &local_error))
+    {
+      g_string_append_printf (reply, "ok %" G_GSIZE_FORMAT "\n", payload->len);
+      g_string_append_len (reply, payload->str, payload->len);
+    }
+  else
+    {
+      g_autofree char *escaped = g_uri_escape_string (local_error->message, NULL, FALSE);
+      g_string_append_printf (reply, "error %s\n", escaped);
+    }
+
+  GOutputStream *out = g_io_stream_get_output_stream (G_IO_STREAM (connection));
+  { g_autoptr(GError) write_error = NULL;
+    if (!g_output_stream_write_all (out, reply->str, reply->len, NULL,
+                                    NULL, &write_error))
+      g_debug ("repod: writing reply: %s", write_error->message);
+  }
+
+  repod_reset_idle_timeout (server);
+  return TRUE;
+}
+
+static gboolean
+on_terminating_signal (gpointer user_data)
+{
+  RepodServer *server = user_data;
+  g_main_loop_quit (server->loop);
+  return G_SOURCE_CONTINUE;
+}
+
+gboolean
+ostree_builtin_repod (int argc, char **argv, GCancellable *cancellable, GError **error)
+{
+  g_autoptr(GOptionContext) context =
+    g_option_context_new ("- Serve repository queries over a Unix socket");
+  g_autoptr(OstreeRepo) repo = NULL;
+  if (!ostree_option_context_parse (context, options, &argc, &argv, OSTREE_BUILTIN_FLAG_NONE, &repo, cancellable, error))
+    return FALSE;
+
+  RepodServer server = { 0, };
+  server.repo = repo;
+
+  g_autoptr(GSocketService) service = g_socket_service_new ();
+
+  /* Under socket activation the listening socket is inherited as fd 3;
+   * otherwise bind next to the repository's other runtime state.
+   */
+  const char *listen_fds = g_getenv ("LISTEN_FDS");
+  const char *listen_pid = g_getenv ("LISTEN_PID");
+  if (listen_fds != NULL && listen_pid != NULL
+      && atoll (listen_pid) == (long long)getpid ())
+    {
+      if (!g_str_equal (listen_fds, "1"))
+        return glnx_throw (error, "Expected exactly one inherited socket, got %s", listen_fds);
+      g_autoptr(GSocket) sock = g_socket_new_from_fd (3, error);
+      if (sock == NULL)
+        return FALSE;
+      if (!g_socket_listener_add_socket ((GSocketListener*)service, sock, NULL, error))
+        return FALSE;
+    }
+  else
+    {
+      g_autoptr(GFile) repo_path = g_object_ref (ostree_repo_get_path (repo));
+      server.socket_path =
+        g_build_filename (gs_file_get_path_cached (repo_path), "tmp",
+                          OT_REPOD_SOCKET_NAME, NULL);
+      /* Replace a socket left behind by an earlier instance */
+      if (unlink (server.socket_path) < 0 && errno != ENOENT)
+        return glnx_throw_errno_prefix (error, "unlink(%s)", server.socket_path);
+      g_autoptr(GSocketAddress) address = g_unix_socket_address_new (server.socket_path);
+      if (!g_socket_listener_add_address ((GSocketListener*)service, address,
+                                          G_SOCKET_TYPE_STREAM,
+                                          G_SOCKET_PROTOCOL_DEFAULT,
+                                          NULL, NULL, error))
+        {
+          g_free (server.socket_path);
+          return FALSE;
+        }
+    }
+
+  g_autoptr(GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  server.loop = loop;
+
+  g_signal_connect (service, "incoming", G_CALLBACK (on_incoming), &server);
+  g_unix_signal_add (SIGTERM, on_terminating_signal, &server);
+  g_unix_signal_add (SIGINT, on_terminating_signal, &server);
+
+  repod_reset_idle_timeout (&server);
+  g_socket_service_start (service);
+  g_main_loop_run (loop);
+  g_socket_service_stop (service);
+
+  if (server.idle_timeout_id > 0)
+    g_source_remove (server.idle_timeout_id);
+  if (server.socket_path != NULL)
+    {
+      (void) unlink (server.socket_path);
+      g_free (server.socket_path);
+    }
+
+  return TRUE;
+}
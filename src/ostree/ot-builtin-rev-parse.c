@@ -24,6 +24,7 @@
 
 #include "ot-main.h"
 #include "ot-builtins.h"
+#include "ot-repod.h"
 #include "ostree.h"
 #include "otutil.h"
 
@@ -54,6 +55,18 @@ ostree_builtin_rev_parse (int argc, char **argv, GCancellable *cancellable, GErr
   for (i = 1; i < argc; i++)
     {
       rev = argv[i];
+
+      /* Delegate to a running repod, which keeps ref and object caches
+       * warm across invocations; fall back to resolving locally.
+       */
+      { gboolean handled = FALSE;
+        const char *const delegate_args[] = { "resolve", rev, NULL };
+        if (!ot_repod_delegate (repo, delegate_args, &handled, cancellable, error))
+          goto out;
+        if (handled)
+          continue;
+      }
+
       g_free (resolved_rev);
       resolved_rev = NULL;
       if (!ostree_repo_resolve_rev (repo, rev, FALSE, &resolved_rev, error))
@@ -31,11 +31,17 @@ static char *opt_from_rev;
 static char *opt_to_rev;
 static char *opt_min_fallback_size;
 static char *opt_max_bsdiff_size;
+static char *opt_max_bsdiff_memory;
+static char *opt_zstd_diff_min_size;
 static char *opt_max_chunk_size;
+static char *opt_compression_threads;
+static char *opt_compression;
+static gboolean opt_auto_preset;
 static char *opt_endianness;
 static char *opt_filename;
 static gboolean opt_empty;
 static gboolean opt_swap_endianness;
+static gboolean opt_dual_endian;
 static gboolean opt_inline;
 static gboolean opt_disable_bsdiff;
 static gboolean opt_if_not_exists;
@@ -69,9 +75,15 @@ static GOptionEntry generate_options[] = {
   { "if-not-exists", 'n', 0, G_OPTION_ARG_NONE, &opt_if_not_exists, "Only generate if a delta does not already exist", NULL },
   { "set-endianness", 0, 0, G_OPTION_ARG_STRING, &opt_endianness, "Choose metadata endianness ('l' or 'B')", "ENDIAN" },
   { "swap-endianness", 0, 0, G_OPTION_ARG_NONE, &opt_swap_endianness, "Swap metadata endianness from host order", NULL },
+  { "dual-endian", 0, 0, G_OPTION_ARG_NONE, &opt_dual_endian, "Also publish both endianness variants of the superblock", NULL },
   { "min-fallback-size", 0, 0, G_OPTION_ARG_STRING, &opt_min_fallback_size, "Minimum uncompressed size in megabytes for individual HTTP request", NULL},
   { "max-bsdiff-size", 0, 0, G_OPTION_ARG_STRING, &opt_max_bsdiff_size, "Maximum size in megabytes to consider bsdiff compression for input files", NULL},
+  { "max-bsdiff-memory", 0, 0, G_OPTION_ARG_STRING, &opt_max_bsdiff_memory, "Maximum estimated bsdiff working set in megabytes, 0 for unlimited", NULL},
+  { "zstd-diff-min-size", 0, 0, G_OPTION_ARG_STRING, &opt_zstd_diff_min_size, "Diff pairs of at least this many megabytes with zstd instead of bsdiff, 0 to disable", NULL},
   { "max-chunk-size", 0, 0, G_OPTION_ARG_STRING, &opt_max_chunk_size, "Maximum size of delta chunks in megabytes", NULL},
+  { "compression-threads", 0, 0, G_OPTION_ARG_STRING, &opt_compression_threads, "Number of threads for part compression, 0 for one per CPU", NULL},
+  { "compression", 0, 0, G_OPTION_ARG_STRING, &opt_compression, "Part compression format: 'xz' (default) or 'zstd'", "FORMAT"},
+  { "auto-preset", 0, 0, G_OPTION_ARG_NONE, &opt_auto_preset, "Use a faster compression preset for incompressible-looking parts", NULL},
   { "filename", 0, 0, G_OPTION_ARG_FILENAME, &opt_filename, "Write the delta content to PATH (a directory).  If not specified, the OSTree repository is used", "PATH"},
   { NULL }
 };
@@ -315,15 +327,33 @@ ot_static_delta_builtin_generate (int argc, char **argv, GCancellable *cancellab
       if (opt_max_bsdiff_size)
         g_variant_builder_add (parambuilder, "{sv}",
                                "max-bsdiff-size", g_variant_new_uint32 (g_ascii_strtoull (opt_max_bsdiff_size, NULL, 10)));
+      if (opt_max_bsdiff_memory)
+        g_variant_builder_add (parambuilder, "{sv}",
+                               "max-bsdiff-memory", g_variant_new_uint32 (g_ascii_strtoull (opt_max_bsdiff_memory, NULL, 10)));
+      if (opt_zstd_diff_min_size)
+        g_variant_builder_add (parambuilder, "{sv}",
+                               "zstd-diff-min-size", g_variant_new_uint32 (g_ascii_strtoull (opt_zstd_diff_min_size, NULL, 10)));
       if (opt_max_chunk_size)
         g_variant_builder_add (parambuilder, "{sv}",
                                "max-chunk-size", g_variant_new_uint32 (g_ascii_strtoull (opt_max_chunk_size, NULL, 10)));
+      if (opt_compression_threads)
+        g_variant_builder_add (parambuilder, "{sv}",
+                               "compression-threads", g_variant_new_uint32 (g_ascii_strtoull (opt_compression_threads, NULL, 10)));
+      if (opt_compression)
+        g_variant_builder_add (parambuilder, "{sv}",
+                               "compression", g_variant_new_string (opt_compression));
+      if (opt_auto_preset)
+        g_variant_builder_add (parambuilder, "{sv}",
+                               "auto-preset", g_variant_new_boolean (TRUE));
       if (opt_disable_bsdiff)
         g_variant_builder_add (parambuilder, "{sv}",
                                "bsdiff-enabled", g_variant_new_boolean (FALSE));
       if (opt_inline)
         g_variant_builder_add (parambuilder, "{sv}",
                                "inline-parts", g_variant_new_boolean (TRUE));
+      if (opt_dual_endian)
+        g_variant_builder_add (parambuilder, "{sv}",
+                               "dual-endian", g_variant_new_boolean (TRUE));
       if (opt_filename)
         g_variant_builder_add (parambuilder, "{sv}",
                                "filename", g_variant_new_bytestring (opt_filename));
@@ -36,7 +36,9 @@ BUILTINPROTO(config);
 BUILTINPROTO(checkout);
 BUILTINPROTO(checksum);
 BUILTINPROTO(commit);
+BUILTINPROTO(debug);
 BUILTINPROTO(diff);
+BUILTINPROTO(du);
 BUILTINPROTO(export);
 #ifdef OSTREE_ENABLE_EXPERIMENTAL_API
 BUILTINPROTO(find_remotes);
@@ -47,8 +49,11 @@ BUILTINPROTO(log);
 BUILTINPROTO(pull);
 BUILTINPROTO(pull_local);
 BUILTINPROTO(ls);
+BUILTINPROTO(pack);
+BUILTINPROTO(path_index);
 BUILTINPROTO(prune);
 BUILTINPROTO(refs);
+BUILTINPROTO(repod);
 BUILTINPROTO(reset);
 BUILTINPROTO(fsck);
 BUILTINPROTO(show);
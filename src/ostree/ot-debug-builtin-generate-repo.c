@@ -0,0 +1,299 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <sys/stat.h>
+#include <string.h>
+
+#include "otutil.h"
+
+#include "ot-main.h"
+#include "ot-debug-builtins.h"
+
+/* Synthesize repositories with a parameterized shape for load and
+ * performance testing.  Everything goes through the normal
+ * ostree_repo_write_*() APIs inside a single transaction, so the
+ * result is indistinguishable from a "real" repository, and the
+ * generator doubles as a stress test of the commit path itself.
+ *
+ * All content is derived from --seed, so two runs with the same
+ * parameters produce object-for-object identical repositories.  Per
+ * commit, only --change-ratio percent of the files are given new
+ * content; the rest keep their previous checksum, which reproduces
+ * the high cross-commit (and cross-ref) object sharing of OS trees.
+ */
+
+static gint opt_refs = 1;
+static gint opt_depth = 5;
+static gint opt_files = 100;
+static gint opt_tree_width = 8;
+static gint opt_tree_depth = 2;
+static gint opt_file_size = 4096;
+static gint opt_change_ratio = 10;
+static gint opt_seed = 42;
+static char *opt_ref_prefix;
+
+static GOptionEntry options[] = {
+  { "refs", 0, 0, G_OPTION_ARG_INT, &opt_refs, "Number of refs to create (default: 1)", "N" },
+  { "depth", 0, 0, G_OPTION_ARG_INT, &opt_depth, "Commit history depth per ref (default: 5)", "N" },
+  { "files", 0, 0, G_OPTION_ARG_INT, &opt_files, "Regular files per commit (default: 100)", "N" },
+  { "tree-width", 0, 0, G_OPTION_ARG_INT, &opt_tree_width, "Subdirectories per directory level (default: 8)", "N" },
+  { "tree-depth", 0, 0, G_OPTION_ARG_INT, &opt_tree_depth, "Directory nesting depth (default: 2)", "N" },
+  { "file-size", 0, 0, G_OPTION_ARG_INT, &opt_file_size, "Mean file size in bytes (default: 4096)", "BYTES" },
+  { "change-ratio", 0, 0, G_OPTION_ARG_INT, &opt_change_ratio, "Percent of files changed per commit (default: 10)", "PERCENT" },
+  { "seed", 0, 0, G_OPTION_ARG_INT, &opt_seed, "Seed for deterministic content generation (default: 42)", "N" },
+  { "ref-prefix", 0, 0, G_OPTION_ARG_STRING, &opt_ref_prefix, "Prefix for generated ref names (default: synth)", "PREFIX" },
+  { NULL }
+};
+
+/* Write (or look up from @content_cache) the content object for
+ * @content_seed; the seed fully determines size and bytes.  Returns
+ * the content checksum, or %NULL on error.  The cache saves us
+ * re-hashing the ~90% of files that are unchanged from the previous
+ * commit.
+ */
+static char *
+write_synthetic_file (OstreeRepo    *repo,
+                      GHashTable    *content_cache,
+                      guint32        content_seed,
+                      GCancellable  *cancellable,
+                      GError       **error)
+{
+  const char *cached = g_hash_table_lookup (content_cache, GUINT_TO_POINTER (content_seed));
+  if (cached != NULL)
+    return g_strdup (cached);
+
+  g_autoptr(GRand) grand = g_rand_new_with_seed (content_seed);
+  gsize size = 0;
+  if (opt_file_size > 0)
+    size = g_rand_int_range (grand, MAX (opt_file_size / 2, 1), opt_file_size * 3 / 2 + 1);
+
+  guint8 *buf = g_malloc (MAX (size, 1));
+  for (gsize i = 0; i < size; i += 4)
+    {
+      guint32 v = g_rand_int (grand);
+      memcpy (buf + i, &v, MIN (sizeof (v), size - i));
+    }
+
+  g_autoptr(GInputStream) memin =
+    g_memory_input_stream_new_from_data (buf, size, g_free);
+  g_autoptr(GFileInfo) finfo = g_file_info_new ();
+  g_file_info_set_attribute_uint32 (finfo, "standard::type", G_FILE_TYPE_REGULAR);
+  g_file_info_set_attribute_boolean (finfo, "standard::is-symlink", FALSE);
+  g_file_info_set_attribute_uint64 (finfo, "standard::size", size);
+  g_file_info_set_attribute_uint32 (finfo, "unix::uid", 0);
+  g_file_info_set_attribute_uint32 (finfo, "unix::gid", 0);
+  g_file_info_set_attribute_uint32 (finfo, "unix::mode", S_IFREG | 0644);
+
+  g_autoptr(GInputStream) content = NULL;
+  guint64 length;
+  if (!ostree_raw_file_to_content_stream (memin, finfo, NULL,
+                                          &content, &length,
+                                          cancellable, error))
+    return NULL;
+
+  g_autofree guchar *csum = NULL;
+  if (!ostree_repo_write_content (repo, NULL, content, length, &csum,
+                                  cancellable, error))
+    return NULL;
+
+  char *checksum = ostree_checksum_from_bytes (csum);
+  g_hash_table_replace (content_cache, GUINT_TO_POINTER (content_seed),
+                        g_strdup (checksum));
+  return checksum;
+}
+
+/* Walk (creating as needed) from @root to the directory holding file
+ * @file_index; files are spread across the leaf directories of a tree
+ * with --tree-width children per level, --tree-depth levels deep.
+ */
+static gboolean
+ensure_file_dir (OstreeMutableTree  *root,
+                 guint               file_index,
+                 const char         *dirmeta_checksum,
+                 OstreeMutableTree **out_dir,
+                 GError            **error)
+{
+  g_autoptr(OstreeMutableTree) dir = g_object_ref (root);
+
+  for (gint level = 0; level < opt_tree_depth; level++)
+    {
+      g_autofree char *name = g_strdup_printf ("d%u", file_index % opt_tree_width);
+      g_autoptr(OstreeMutableTree) subdir = NULL;
+
+      if (!ostree_mutable_tree_ensure_dir (dir, name, &subdir, error))
+        return FALSE;
+      ostree_mutable_tree_set_metadata_checksum (subdir, dirmeta_checksum);
+
+      g_set_object (&dir, subdir);
+      file_index /= opt_tree_width;
+    }
+
+  *out_dir = g_steal_pointer (&dir);
+  return TRUE;
+}
+
+gboolean
+ot_debug_builtin_generate_repo (int argc, char **argv, GCancellable *cancellable, GError **error)
+{
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(OstreeRepo) repo = NULL;
+
+  context = g_option_context_new ("- Synthesize a repository for testing");
+
+  if (!ostree_option_context_parse (context, options, &argc, &argv,
+                                    OSTREE_BUILTIN_FLAG_NONE, &repo, cancellable, error))
+    return FALSE;
+
+  if (opt_refs < 1 || opt_depth < 1 || opt_files < 0
+      || opt_tree_width < 1 || opt_tree_depth < 0
+      || opt_change_ratio < 0 || opt_change_ratio > 100)
+    {
+      ot_util_usage_error (context, "Invalid generation parameters", error);
+      return FALSE;
+    }
+  if (opt_file_size < 0 || opt_file_size > (1 << 30))
+    {
+      ot_util_usage_error (context, "--file-size out of range", error);
+      return FALSE;
+    }
+  if (opt_ref_prefix == NULL)
+    opt_ref_prefix = g_strdup ("synth");
+
+  gboolean ret = FALSE;
+  gboolean in_transaction = FALSE;
+  /* content seed -> content checksum, for files already written */
+  g_autoptr(GHashTable) content_cache =
+    g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  /* How many times each file has changed so far on the current ref */
+  g_autofree guint32 *file_versions = g_new0 (guint32, MAX (opt_files, 1));
+  g_autofree char *dirmeta_checksum = NULL;
+
+  if (!ostree_repo_prepare_transaction (repo, NULL, cancellable, error))
+    goto out;
+  in_transaction = TRUE;
+
+  /* Every directory shares one dirmeta, as real OS trees mostly do */
+  {
+    g_autoptr(GFileInfo) dir_info = g_file_info_new ();
+    g_file_info_set_attribute_uint32 (dir_info, "standard::type", G_FILE_TYPE_DIRECTORY);
+    g_file_info_set_attribute_uint32 (dir_info, "unix::uid", 0);
+    g_file_info_set_attribute_uint32 (dir_info, "unix::gid", 0);
+    g_file_info_set_attribute_uint32 (dir_info, "unix::mode", S_IFDIR | 0755);
+
+    g_autoptr(GVariant) dirmeta = ostree_create_directory_metadata (dir_info, NULL);
+    g_autofree guchar *csum = NULL;
+    if (!ostree_repo_write_metadata (repo, OSTREE_OBJECT_TYPE_DIR_META, NULL,
+                                     dirmeta, &csum, cancellable, error))
+      goto out;
+    dirmeta_checksum = ostree_checksum_from_bytes (csum);
+  }
+
+  for (gint ref_index = 0; ref_index < opt_refs; ref_index++)
+    {
+      g_autofree char *refname = g_strdup_printf ("%s-%d", opt_ref_prefix, ref_index);
+      g_autofree char *parent = NULL;
+
+      memset (file_versions, 0, sizeof (guint32) * MAX (opt_files, 1));
+
+      for (gint commit_index = 0; commit_index < opt_depth; commit_index++)
+        {
+          /* Pick this commit's changed subset deterministically */
+          if (commit_index > 0 && opt_change_ratio > 0)
+            {
+              g_autoptr(GRand) change_rand =
+                g_rand_new_with_seed (opt_seed
+                                      ^ ((ref_index + 1) * 7919u)
+                                      ^ ((commit_index + 1) * 104729u));
+              for (gint i = 0; i < opt_files; i++)
+                {
+                  if (g_rand_int_range (change_rand, 0, 100) < opt_change_ratio)
+                    file_versions[i]++;
+                }
+            }
+
+          g_autoptr(OstreeMutableTree) mtree = ostree_mutable_tree_new ();
+          ostree_mutable_tree_set_metadata_checksum (mtree, dirmeta_checksum);
+
+          for (gint i = 0; i < opt_files; i++)
+            {
+              /* Version 0 is shared by all refs; changed versions mix
+               * in the ref so diverged branches really diverge.
+               */
+              guint32 content_seed = (guint32)opt_seed ^ ((guint32)i * 2654435761u);
+              if (file_versions[i] > 0)
+                content_seed ^= (file_versions[i] * 2246822519u)
+                  ^ (((guint32)ref_index + 1) * 3266489917u);
+
+              g_autofree char *checksum =
+                write_synthetic_file (repo, content_cache, content_seed,
+                                      cancellable, error);
+              if (checksum == NULL)
+                goto out;
+
+              g_autoptr(OstreeMutableTree) dir = NULL;
+              if (!ensure_file_dir (mtree, (guint)i, dirmeta_checksum, &dir, error))
+                goto out;
+
+              g_autofree char *fname = g_strdup_printf ("f%d", i);
+              if (!ostree_mutable_tree_replace_file (dir, fname, checksum, error))
+                goto out;
+            }
+
+          g_autoptr(GFile) root = NULL;
+          if (!ostree_repo_write_mtree (repo, mtree, &root, cancellable, error))
+            goto out;
+
+          g_autofree char *subject =
+            g_strdup_printf ("Synthetic commit %d/%d", commit_index + 1, opt_depth);
+          /* A fixed timestamp, so identical parameters reproduce
+           * identical commit checksums.
+           */
+          guint64 timestamp = 1000000000 + (guint64)commit_index * 60;
+          g_autofree char *commit_checksum = NULL;
+          if (!ostree_repo_write_commit_with_time (repo, parent, subject, NULL, NULL,
+                                                   OSTREE_REPO_FILE (root), timestamp,
+                                                   &commit_checksum, cancellable, error))
+            goto out;
+
+          g_free (parent);
+          parent = g_steal_pointer (&commit_checksum);
+        }
+
+      ostree_repo_transaction_set_ref (repo, NULL, refname, parent);
+      g_print ("%s => %s\n", refname, parent);
+    }
+
+  OstreeRepoTransactionStats stats;
+  if (!ostree_repo_commit_transaction (repo, &stats, cancellable, error))
+    goto out;
+  in_transaction = FALSE;
+
+  g_print ("Wrote %u metadata and %u content objects (%" G_GUINT64_FORMAT " content bytes)\n",
+           stats.metadata_objects_written, stats.content_objects_written,
+           stats.content_bytes_written);
+
+  ret = TRUE;
+ out:
+  if (in_transaction)
+    (void) ostree_repo_abort_transaction (repo, cancellable, NULL);
+  return ret;
+}
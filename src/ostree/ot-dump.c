@@ -25,6 +25,7 @@
 #include "config.h"
 
 #include <err.h>
+#include <stdio.h>
 
 #include "ostree-repo-private.h"
 #include "ostree-repo-static-delta-private.h"
@@ -32,22 +33,157 @@
 #include "otutil.h"
 #include "ot-admin-functions.h"
 
-void
-ot_dump_variant (GVariant *variant)
+/* Flush the pending text once this much has accumulated */
+#define DUMP_VARIANT_FLUSH_THRESHOLD (64 * 1024)
+/* Subtrees up to this (serialized) size are rendered in one go via
+ * g_variant_print_string(); anything larger is walked child by child. */
+#define DUMP_VARIANT_INLINE_MAX (128 * 1024)
+
+static void
+dump_variant_flush (GString *buf)
 {
-  g_autofree char *formatted_variant = NULL;
-  g_autoptr(GVariant) byteswapped = NULL;
+  if (buf->len < DUMP_VARIANT_FLUSH_THRESHOLD)
+    return;
+  fwrite (buf->str, 1, buf->len, stdout);
+  g_string_truncate (buf, 0);
+}
 
-  if (G_BYTE_ORDER != G_BIG_ENDIAN)
+/* Append the GVariant text form of @variant to @buf, flushing it to
+ * stdout as we go so memory stays bounded regardless of the variant's
+ * size.  The container syntax below matches g_variant_print(), with one
+ * deliberate exception: a byte array larger than DUMP_VARIANT_INLINE_MAX
+ * is always rendered as a byte list, never with the b'...' bytestring
+ * shorthand.
+ */
+static void
+dump_variant_streaming (GVariant *variant,
+                        gboolean  type_annotate,
+                        GString  *buf)
+{
+  if (g_variant_get_size (variant) <= DUMP_VARIANT_INLINE_MAX)
     {
-      byteswapped = g_variant_byteswap (variant);
-      formatted_variant = g_variant_print (byteswapped, TRUE);
+      g_variant_print_string (variant, buf, type_annotate);
+      dump_variant_flush (buf);
+      return;
     }
-  else
+
+  switch (g_variant_classify (variant))
     {
-      formatted_variant = g_variant_print (variant, TRUE);
+    case G_VARIANT_CLASS_ARRAY:
+      {
+        const char *type_string = g_variant_get_type_string (variant);
+        const gsize n = g_variant_n_children (variant);
+
+        if (type_string[1] == '{')
+          {
+            /* Dictionary */
+            g_string_append_c (buf, '{');
+            for (gsize i = 0; i < n; i++)
+              {
+                g_autoptr(GVariant) entry = g_variant_get_child_value (variant, i);
+                g_autoptr(GVariant) key = g_variant_get_child_value (entry, 0);
+                g_autoptr(GVariant) value = g_variant_get_child_value (entry, 1);
+
+                if (i != 0)
+                  g_string_append (buf, ", ");
+                dump_variant_streaming (key, type_annotate && i == 0, buf);
+                g_string_append (buf, ": ");
+                dump_variant_streaming (value, type_annotate && i == 0, buf);
+              }
+            g_string_append_c (buf, '}');
+          }
+        else
+          {
+            g_string_append_c (buf, '[');
+            for (gsize i = 0; i < n; i++)
+              {
+                g_autoptr(GVariant) element = g_variant_get_child_value (variant, i);
+
+                if (i != 0)
+                  g_string_append (buf, ", ");
+                dump_variant_streaming (element, type_annotate && i == 0, buf);
+              }
+            g_string_append_c (buf, ']');
+          }
+      }
+      break;
+    case G_VARIANT_CLASS_TUPLE:
+      {
+        const gsize n = g_variant_n_children (variant);
+
+        g_string_append_c (buf, '(');
+        for (gsize i = 0; i < n; i++)
+          {
+            g_autoptr(GVariant) element = g_variant_get_child_value (variant, i);
+
+            if (i != 0)
+              g_string_append (buf, ", ");
+            dump_variant_streaming (element, type_annotate, buf);
+          }
+        if (n == 1)
+          g_string_append_c (buf, ',');
+        g_string_append_c (buf, ')');
+      }
+      break;
+    case G_VARIANT_CLASS_DICT_ENTRY:
+      {
+        g_autoptr(GVariant) key = g_variant_get_child_value (variant, 0);
+        g_autoptr(GVariant) value = g_variant_get_child_value (variant, 1);
+
+        g_string_append_c (buf, '{');
+        dump_variant_streaming (key, type_annotate, buf);
+        g_string_append (buf, ": ");
+        dump_variant_streaming (value, type_annotate, buf);
+        g_string_append_c (buf, '}');
+      }
+      break;
+    case G_VARIANT_CLASS_VARIANT:
+      {
+        g_autoptr(GVariant) child = g_variant_get_variant (variant);
+
+        /* Nested variants are always annotated, like g_variant_print() */
+        g_string_append_c (buf, '<');
+        dump_variant_streaming (child, TRUE, buf);
+        g_string_append_c (buf, '>');
+      }
+      break;
+    case G_VARIANT_CLASS_MAYBE:
+      {
+        g_autoptr(GVariant) element = g_variant_get_maybe (variant);
+
+        if (type_annotate)
+          g_string_append_printf (buf, "@%s ", g_variant_get_type_string (variant));
+        if (element != NULL)
+          {
+            if (g_variant_is_of_type (element, G_VARIANT_TYPE_MAYBE))
+              g_string_append (buf, "just ");
+            dump_variant_streaming (element, FALSE, buf);
+          }
+        else
+          g_string_append (buf, "nothing");
+      }
+      break;
+    default:
+      /* A large leaf, e.g. a long string */
+      g_variant_print_string (variant, buf, type_annotate);
+      break;
     }
-  g_print ("%s\n", formatted_variant);
+
+  dump_variant_flush (buf);
+}
+
+void
+ot_dump_variant (GVariant *variant)
+{
+  g_autoptr(GVariant) byteswapped = NULL;
+
+  if (G_BYTE_ORDER != G_BIG_ENDIAN)
+    variant = byteswapped = g_variant_byteswap (variant);
+
+  g_autoptr(GString) buf = g_string_new (NULL);
+  dump_variant_streaming (variant, TRUE, buf);
+  g_string_append_c (buf, '\n');
+  fwrite (buf->str, 1, buf->len, stdout);
 }
 
 static gchar *
@@ -343,6 +479,11 @@ ot_dump_summary_bytes (GBytes          *summary_bytes,
           pretty_key = "Collection Map";
           value_str = g_strdup ("(printed above)");
         }
+      else if (g_strcmp0 (key, OSTREE_SUMMARY_SHARDS) == 0)
+        {
+          pretty_key = "Summary Shards";
+          value_str = g_variant_print (value, FALSE);
+        }
       else
         {
           value_str = g_variant_print (value, FALSE);
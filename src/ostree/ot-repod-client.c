@@ -0,0 +1,123 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2017 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <gio/gunixsocketaddress.h>
+#include <gio/gunixoutputstream.h>
+#include <sys/un.h>
+
+#include "ot-repod.h"
+#include "otutil.h"
+
+/* Try to hand the request @args (e.g. { "resolve", rev, NULL }) to a
+ * repod instance serving @repo; on a hit the response payload is copied
+ * to stdout.  No daemon listening just sets *out_handled to %FALSE and
+ * succeeds, so callers fall back to doing the work themselves; once a
+ * daemon has answered, errors it reports (or protocol failures) are
+ * returned normally with *out_handled set.
+ */
+gboolean
+ot_repod_delegate (OstreeRepo    *repo,
+                   const char    *const *args,
+                   gboolean      *out_handled,
+                   GCancellable  *cancellable,
+                   GError       **error)
+{
+  *out_handled = FALSE;
+
+  g_autoptr(GFile) repo_path = g_object_ref (ostree_repo_get_path (repo));
+  g_autofree char *socket_path =
+    g_build_filename (gs_file_get_path_cached (repo_path), "tmp",
+                      OT_REPOD_SOCKET_NAME, NULL);
+
+  /* Socket paths are length-limited; an unrepresentable path just means
+   * no daemon can be serving it either.
+   */
+  if (!g_unix_socket_address_abstract_names_supported () &&
+      strlen (socket_path) >= sizeof (((struct sockaddr_un*)0)->sun_path))
+    return TRUE;
+
+  g_autoptr(GSocketClient) client = g_socket_client_new ();
+  g_autoptr(GSocketAddress) address = g_unix_socket_address_new (socket_path);
+  g_autoptr(GSocketConnection) connection =
+    g_socket_client_connect (client, G_SOCKET_CONNECTABLE (address),
+                             cancellable, NULL);
+  if (connection == NULL)
+    return TRUE;  /* No daemon; not handled */
+
+  g_autoptr(GString) request = g_string_new ("");
+  for (guint i = 0; args[i] != NULL; i++)
+    {
+      g_autofree char *escaped = g_uri_escape_string (args[i], NULL, FALSE);
+      if (i > 0)
+        g_string_append_c (request, ' ');
+      g_string_append (request, escaped);
+    }
+  g_string_append_c (request, '\n');
+
+  GOutputStream *out = g_io_stream_get_output_stream (G_IO_STREAM (connection));
+  if (!g_output_stream_write_all (out, request->str, request->len, NULL,
+                                  cancellable, error))
+    return FALSE;
+
+  g_autoptr(GDataInputStream) in =
+    g_data_input_stream_new (g_io_stream_get_input_stream (G_IO_STREAM (connection)));
+  gsize line_len;
+  g_autofree char *status = g_data_input_stream_read_line (in, &line_len,
+                                                           cancellable, error);
+  if (status == NULL)
+    {
+      if (error != NULL && *error == NULL)
+        glnx_throw (error, "repod: Connection closed without a reply");
+      return FALSE;
+    }
+
+  *out_handled = TRUE;
+
+  if (g_str_has_prefix (status, "error "))
+    {
+      g_autofree char *message = g_uri_unescape_string (status + strlen ("error "), NULL);
+      return glnx_throw (error, "%s", message ?: status);
+    }
+  else if (!g_str_has_prefix (status, "ok "))
+    return glnx_throw (error, "repod: Malformed status line '%s'", status);
+
+  guint64 length = g_ascii_strtoull (status + strlen ("ok "), NULL, 10);
+  g_autoptr(GOutputStream) stdout_stream = g_unix_output_stream_new (1, FALSE);
+  guint64 remaining = length;
+  guint8 buf[8192];
+  while (remaining > 0)
+    {
+      gssize bytes_read = g_input_stream_read ((GInputStream*)in, buf,
+                                               MIN (remaining, sizeof (buf)),
+                                               cancellable, error);
+      if (bytes_read < 0)
+        return FALSE;
+      if (bytes_read == 0)
+        return glnx_throw (error, "repod: Truncated response payload");
+      if (!g_output_stream_write_all (stdout_stream, buf, bytes_read, NULL,
+                                      cancellable, error))
+        return FALSE;
+      remaining -= bytes_read;
+    }
+
+  return TRUE;
+}
@@ -0,0 +1,50 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2017 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <ostree.h>
+
+G_BEGIN_DECLS
+
+/* The repod protocol: `ostree repod` listens on a stream socket at
+ * <repo>/tmp/repod.socket and answers one request per connection,
+ * keeping the repository (and its parsed caches) open across them.
+ *
+ * A request is a single line of space-separated, URI-escaped fields:
+ * an operation name followed by its arguments.  The reply is a status
+ * line, either "ok LENGTH\n" followed by exactly LENGTH payload bytes,
+ * or "error MESSAGE\n" with a URI-escaped message.  Operations:
+ *
+ *   resolve REV              checksum of REV, newline-terminated
+ *   has-object TYPE CHECKSUM "true\n" or "false\n"
+ *   cat REV PATH...          concatenated file contents
+ *   ls REV PATH...           one `ls`-style line per entry; directories
+ *                            list their immediate children
+ */
+#define OT_REPOD_SOCKET_NAME "repod.socket"
+
+gboolean ot_repod_delegate (OstreeRepo    *repo,
+                            const char    *const *args,
+                            gboolean      *out_handled,
+                            GCancellable  *cancellable,
+                            GError       **error);
+
+G_END_DECLS
@@ -32,6 +32,7 @@
 #include <dirent.h>
 #include <unistd.h>
 #include <fuse.h>
+#include <fuse_lowlevel.h>
 
 #include <glib.h>
 
@@ -178,6 +179,48 @@ callback_symlink (const char *from, const char *to)
   return 0;
 }
 
+/* Cache of paths known writable (not hardlinked regular files), so that
+ * the chmod/chown/truncate/utimes sequences package managers issue per
+ * file do only one fstatat instead of one per operation.  Only positive
+ * results are cached: a new or single-link file stays writable until a
+ * hardlink to it is created, so the cache is dropped wholesale on
+ * link() and rename(), the only operations that can put a hardlinked
+ * inode behind a previously writable path.  Negative (EROFS) results
+ * are never cached since unlinking a sibling link can make the file
+ * writable again.
+ */
+static GMutex writable_cache_lock;
+static GHashTable *writable_cache; /* set of paths */
+
+static void
+writable_cache_insert (const char *path)
+{
+  g_mutex_lock (&writable_cache_lock);
+  if (writable_cache == NULL)
+    writable_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  g_hash_table_add (writable_cache, g_strdup (path));
+  g_mutex_unlock (&writable_cache_lock);
+}
+
+static gboolean
+writable_cache_contains (const char *path)
+{
+  gboolean ret;
+  g_mutex_lock (&writable_cache_lock);
+  ret = writable_cache != NULL && g_hash_table_contains (writable_cache, path);
+  g_mutex_unlock (&writable_cache_lock);
+  return ret;
+}
+
+static void
+writable_cache_invalidate (void)
+{
+  g_mutex_lock (&writable_cache_lock);
+  if (writable_cache != NULL)
+    g_hash_table_remove_all (writable_cache);
+  g_mutex_unlock (&writable_cache_lock);
+}
+
 static int
 callback_rename (const char *from, const char *to)
 {
@@ -185,6 +228,7 @@ callback_rename (const char *from, const char *to)
   to = ENSURE_RELPATH (to);
   if (renameat (basefd, from, basefd, to) == -1)
     return -errno;
+  writable_cache_invalidate ();
   return 0;
 }
 
@@ -195,6 +239,7 @@ callback_link (const char *from, const char *to)
   to = ENSURE_RELPATH (to);
   if (linkat (basefd, from, basefd, to, 0) == -1)
     return -errno;
+  writable_cache_invalidate ();
   return 0;
 }
 
@@ -208,6 +253,10 @@ static int
 can_write (const char *path)
 {
   struct stat stbuf;
+
+  if (writable_cache_contains (path))
+    return 0;
+
   if (fstatat (basefd, path, &stbuf, 0) == -1)
     {
       if (errno == ENOENT)
@@ -217,6 +266,8 @@ can_write (const char *path)
     }
   if (stbuf_is_regfile_hardlinked (&stbuf))
     return -EROFS;
+
+  writable_cache_insert (path);
   return 0;
 }
 
@@ -318,6 +369,8 @@ do_open (const char *path, mode_t mode, struct fuse_file_info *finfo)
           return -EROFS;
         }
 
+      writable_cache_insert (path);
+
       /* Handle O_TRUNC here only after verifying hardlink state */
       if (finfo->flags & O_TRUNC)
         {
@@ -472,7 +525,44 @@ callback_removexattr (const char *path, const char *name)
 
 }
 
+static void *
+callback_init (struct fuse_conn_info *conn)
+{
+  /* Let the kernel batch writes into large requests instead of 4k
+   * chunks; with newer libfuse also enable the page-cache writeback
+   * mode, deferring and merging writes before they reach us.  Nothing
+   * modifies the base directory behind our back in the supported
+   * usage, so cached pages can't go stale.
+   */
+#ifdef FUSE_CAP_BIG_WRITES
+  if (conn->capable & FUSE_CAP_BIG_WRITES)
+    conn->want |= FUSE_CAP_BIG_WRITES;
+#endif
+#ifdef FUSE_CAP_WRITEBACK_CACHE
+  if (conn->capable & FUSE_CAP_WRITEBACK_CACHE)
+    conn->want |= FUSE_CAP_WRITEBACK_CACHE;
+#endif
+  /* With the fd-based read_buf/write_buf callbacks above, these let
+   * request payloads move kernel-to-kernel through a pipe instead of
+   * being copied through a userspace buffer.
+   */
+#ifdef FUSE_CAP_SPLICE_READ
+  if (conn->capable & FUSE_CAP_SPLICE_READ)
+    conn->want |= FUSE_CAP_SPLICE_READ;
+#endif
+#ifdef FUSE_CAP_SPLICE_WRITE
+  if (conn->capable & FUSE_CAP_SPLICE_WRITE)
+    conn->want |= FUSE_CAP_SPLICE_WRITE;
+#endif
+#ifdef FUSE_CAP_SPLICE_MOVE
+  if (conn->capable & FUSE_CAP_SPLICE_MOVE)
+    conn->want |= FUSE_CAP_SPLICE_MOVE;
+#endif
+  return NULL;
+}
+
 struct fuse_operations callback_oper = {
+  .init = callback_init,
   .getattr = callback_getattr,
   .readlink = callback_readlink,
   .readdir = callback_readdir,
@@ -508,8 +598,12 @@ struct fuse_operations callback_oper = {
 enum {
   KEY_HELP,
   KEY_VERSION,
+  KEY_MAX_THREADS,
 };
 
+/* Cap on concurrent request-processing workers; 0 means one per CPU */
+static unsigned int opt_max_threads = 0;
+
 static void
 usage (const char *progname)
 {
@@ -520,6 +614,7 @@ usage (const char *progname)
            "\n"
            "general options:\n"
            "   -o opt,[opt...]     mount options\n"
+           "   -o max_threads=N    cap request workers at N (default: one per CPU)\n"
            "   -h  --help          print help\n"
            "\n", progname);
 }
@@ -549,6 +644,9 @@ rofs_parse_opt (void *data, const char *arg, int key,
         }
     case FUSE_OPT_KEY_OPT:
       return 1;
+    case KEY_MAX_THREADS:
+      opt_max_threads = (unsigned int) atoi (arg + strlen ("max_threads="));
+      return 0;
     case KEY_HELP:
       usage (outargs->argv[0]);
       exit (EXIT_SUCCESS);
@@ -560,6 +658,7 @@ rofs_parse_opt (void *data, const char *arg, int key,
 }
 
 static struct fuse_opt rofs_opts[] = {
+  FUSE_OPT_KEY ("max_threads=", KEY_MAX_THREADS),
   FUSE_OPT_KEY ("-h", KEY_HELP),
   FUSE_OPT_KEY ("--help", KEY_HELP),
   FUSE_OPT_KEY ("-V", KEY_VERSION),
@@ -567,6 +666,69 @@ static struct fuse_opt rofs_opts[] = {
   FUSE_OPT_END
 };
 
+typedef struct {
+  struct fuse_session *se;
+  struct fuse_chan *ch;
+} FuseWorkerData;
+
+/* One request-processing worker.  Reads on the fuse channel are atomic
+ * per request, so the workers share it directly; each keeps its own
+ * receive buffer, which fuse_session_receive_buf() reuses (or, with
+ * splice support, replaces with pipe fds) across iterations.
+ */
+static void *
+fuse_worker (void *data)
+{
+  FuseWorkerData *wd = data;
+  struct fuse_buf fbuf = { 0, };
+
+  while (!fuse_session_exited (wd->se))
+    {
+      struct fuse_chan *tmpch = wd->ch;
+      int res = fuse_session_receive_buf (wd->se, &fbuf, &tmpch);
+
+      if (res == -EINTR)
+        continue;
+      if (res <= 0)
+        {
+          if (res < 0)
+            fuse_session_exit (wd->se);
+          break;
+        }
+
+      fuse_session_process_buf (wd->se, &fbuf, tmpch);
+    }
+
+  free (fbuf.mem);
+  return NULL;
+}
+
+/* A multithreaded session loop with a bounded worker pool.  Unlike
+ * fuse_loop_mt(), which spawns a new thread whenever all existing ones
+ * are busy, this keeps a fixed set of workers so a parallel package
+ * install can't fork-bomb us with threads, while one slow operation no
+ * longer serializes everything as the single-threaded loop did.
+ */
+static int
+fuse_loop_pool (struct fuse *fuse,
+                unsigned int n_threads)
+{
+  struct fuse_session *se = fuse_get_session (fuse);
+  struct fuse_chan *ch = fuse_session_next_chan (se, NULL);
+  FuseWorkerData wd = { se, ch };
+  GPtrArray *threads = g_ptr_array_new ();
+
+  for (unsigned int i = 0; i < n_threads; i++)
+    g_ptr_array_add (threads, g_thread_new ("fuse-worker", fuse_worker, &wd));
+
+  for (unsigned int i = 0; i < threads->len; i++)
+    g_thread_join (threads->pdata[i]);
+  g_ptr_array_unref (threads);
+
+  fuse_session_reset (se);
+  return fuse_session_exited (se) ? 0 : -1;
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -587,7 +749,25 @@ main (int argc, char *argv[])
       exit (EXIT_FAILURE);
     }
 
-  fuse_main (args.argc, args.argv, &callback_oper, NULL);
+  char *mountpoint = NULL;
+  int multithreaded = 1;
+  struct fuse *fuse = fuse_setup (args.argc, args.argv, &callback_oper,
+                                  sizeof (callback_oper), &mountpoint,
+                                  &multithreaded, NULL);
+  if (fuse == NULL)
+    exit (EXIT_FAILURE);
 
-  return 0;
+  if (multithreaded)
+    {
+      unsigned int n_threads = opt_max_threads;
+      if (n_threads == 0)
+        n_threads = g_get_num_processors ();
+      res = fuse_loop_pool (fuse, n_threads);
+    }
+  else
+    res = fuse_loop (fuse);
+
+  fuse_teardown (fuse, mountpoint);
+
+  return res == 0 ? 0 : EXIT_FAILURE;
 }
@@ -43,9 +43,63 @@
 #include <err.h>
 #include <errno.h>
 #include <ctype.h>
+#include <time.h>
 
 #include "ostree-mount-util.h"
 
+/* Initialized from the kernel cmdline; when enabled we log the time taken by
+ * each mount/setup step to the kernel log so that boot-time regressions can
+ * be tracked without attaching a debugger to the initramfs.
+ */
+static int debug_timing;
+static struct timespec debug_prev_ts;
+
+static void
+debug_timing_init (void)
+{
+  char *cmdline = read_proc_cmdline ();
+
+  if (cmdline && strstr (cmdline, "ostree.debug"))
+    {
+      debug_timing = 1;
+      clock_gettime (CLOCK_MONOTONIC, &debug_prev_ts);
+    }
+  free (cmdline);
+}
+
+/* If enabled, log the time elapsed since the previous step to the kernel
+ * log (or stdout if /dev/kmsg isn't available yet).  This must only be
+ * called while /proc is mounted.
+ */
+static void
+debug_step (const char *name)
+{
+  struct timespec now;
+  unsigned long long usecs;
+  char buf[256];
+  int fd;
+
+  if (!debug_timing)
+    return;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  usecs = (now.tv_sec - debug_prev_ts.tv_sec) * 1000000ULL
+    + (now.tv_nsec - debug_prev_ts.tv_nsec) / 1000;
+  debug_prev_ts = now;
+
+  snprintf (buf, sizeof (buf), "<6>ostree-prepare-root: %s: %llu.%03llums\n",
+            name, usecs / 1000, usecs % 1000);
+
+  fd = open ("/dev/kmsg", O_WRONLY | O_CLOEXEC);
+  if (fd >= 0)
+    {
+      (void) write (fd, buf, strlen (buf));
+      (void) close (fd);
+    }
+  else
+    fputs (buf + 3, stdout);
+}
+
 /* This is an API for other projects to determine whether or not the
  * currently running system is ostree-controlled.
  */
@@ -118,10 +172,13 @@ main(int argc, char *argv[])
       we_mounted_proc = 1;
     }
 
+  debug_timing_init ();
+
   root_mountpoint = realpath (root_arg, NULL);
   if (root_mountpoint == NULL)
     err (EXIT_FAILURE, "realpath(\"%s\")", root_arg);
   deploy_path = resolve_deploy_path (root_mountpoint);
+  debug_step ("resolve deploy path");
 
   if (we_mounted_proc)
     {
@@ -148,12 +205,14 @@ main(int argc, char *argv[])
    * below. */
   if (chdir (deploy_path) < 0)
     err (EXIT_FAILURE, "failed to chdir to deploy_path");
+  debug_step ("bind deployment root");
 
   /* In the systemd case, this is handled by ostree-system-generator */
 #ifndef HAVE_SYSTEMD_AND_LIBMOUNT
   /* Link to the deployment's /var */
   if (mount ("../../var", "var", NULL, MS_MGC_VAL|MS_BIND, NULL) < 0)
     err (EXIT_FAILURE, "failed to bind mount ../../var to var");
+  debug_step ("bind /var");
 #endif
 
   /* If /boot is on the same partition, use a bind mount to make it visible
@@ -166,6 +225,7 @@ main(int argc, char *argv[])
           snprintf (srcpath, sizeof(srcpath), "%s/boot", root_mountpoint);
           if (mount (srcpath, "boot", NULL, MS_BIND, NULL) < 0)
             err (EXIT_FAILURE, "failed to bind mount %s to boot", srcpath);
+          debug_step ("bind /boot");
         }
     }
 
@@ -196,6 +256,7 @@ main(int argc, char *argv[])
       if (mount ("usr", "usr", NULL, MS_BIND | MS_REMOUNT | MS_RDONLY, NULL) < 0)
         err (EXIT_FAILURE, "failed to bind mount (class:readonly) /usr");
     }
+  debug_step ("mount /usr");
 
   touch_run_ostree ();
 
@@ -237,6 +298,7 @@ main(int argc, char *argv[])
       if (mount (".", root_mountpoint, NULL, MS_MOVE, NULL) < 0)
         err (EXIT_FAILURE, "failed to MS_MOVE %s to %s", deploy_path, root_mountpoint);
     }
+  debug_step ("switch root");
 
   if (getpid() == 1)
     {
@@ -29,19 +29,83 @@
 #include <sys/param.h>
 #include <sys/mount.h>
 #include <sys/statvfs.h>
+#include <sys/wait.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <err.h>
 #include <errno.h>
 
 #include "ostree-mount-util.h"
 
+/* Boot-critical units order After=ostree-remount.service, so each
+ * sequential remount syscall that stalls on device readiness directly
+ * extends the boot critical path.  We issue the (independent) remounts
+ * in parallel from forked children instead, and only wait for the ones
+ * boot actually depends on; paths listed in $OSTREE_REMOUNT_LAZY
+ * (colon-separated, set via a service drop-in) are left to complete in
+ * a detached child after we exit and boot proceeds.
+ */
+
+static int
+path_is_lazy (const char *target)
+{
+  const char *lazy = getenv ("OSTREE_REMOUNT_LAZY");
+  if (lazy == NULL)
+    return 0;
+  const size_t target_len = strlen (target);
+  const char *iter = lazy;
+  while (*iter)
+    {
+      const char *next = strchr (iter, ':');
+      const size_t len = next ? (size_t)(next - iter) : strlen (iter);
+      if (len == target_len && strncmp (iter, target, len) == 0)
+        return 1;
+      iter = next ? next + 1 : iter + len;
+    }
+  return 0;
+}
+
+static uint64_t
+monotonic_usec (void)
+{
+  struct timespec ts;
+  if (clock_gettime (CLOCK_MONOTONIC, &ts) < 0)
+    err (EXIT_FAILURE, "clock_gettime");
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Runs in a forked child; the exit status reports failure to the
+ * parent for non-lazy mounts.
+ */
+static void
+do_remount (const char *target)
+{
+  const uint64_t start_usec = monotonic_usec ();
+  if (mount (target, target, NULL, MS_REMOUNT | MS_SILENT, NULL) < 0)
+    {
+      /* Also ignore EINVAL - if the target isn't a mountpoint
+       * already, then assume things are OK.
+       */
+      if (errno != EINVAL)
+        err (EXIT_FAILURE, "failed to remount %s", target);
+      exit (EXIT_SUCCESS);
+    }
+  const uint64_t elapsed_usec = monotonic_usec () - start_usec;
+  printf ("Remounted: %s (%u.%03us)\n", target,
+          (unsigned) (elapsed_usec / 1000000),
+          (unsigned) ((elapsed_usec % 1000000) / 1000));
+  exit (EXIT_SUCCESS);
+}
+
 int
 main(int argc, char *argv[])
 {
   const char *remounts[] = { "/sysroot", "/var", NULL };
+  pid_t pids[sizeof (remounts) / sizeof (remounts[0])];
+  int n_pids = 0;
   struct stat stbuf;
   int i;
 
@@ -71,17 +135,36 @@ main(int argc, char *argv[])
       /* If no read-only flag, skip it */
       if ((stvfsbuf.f_flag & ST_RDONLY) == 0)
         continue;
-      /* It's a mounted, read-only fs; remount it */
-      if (mount (target, target, NULL, MS_REMOUNT | MS_SILENT, NULL) < 0)
+      /* It's a mounted, read-only fs; remount it from a child so the
+       * remounts proceed in parallel.
+       */
+      pid_t pid = fork ();
+      if (pid < 0)
+        err (EXIT_FAILURE, "fork");
+      if (pid == 0)
         {
-          /* Also ignore ENINVAL - if the target isn't a mountpoint
-           * already, then assume things are OK.
+          if (!path_is_lazy (target))
+            do_remount (target);
+          /* Lazy: double-fork so the grandchild is reparented to init
+           * and boot proceeds without waiting on this mount.
            */
-          if (errno != EINVAL)
-            err (EXIT_FAILURE, "failed to remount %s", target);
+          pid_t lazy_pid = fork ();
+          if (lazy_pid < 0)
+            err (EXIT_FAILURE, "fork");
+          if (lazy_pid == 0)
+            do_remount (target);
+          exit (EXIT_SUCCESS);
         }
-      else
-        printf ("Remounted: %s\n", target);
+      pids[n_pids++] = pid;
+    }
+
+  for (i = 0; i < n_pids; i++)
+    {
+      int estatus;
+      if (TEMP_FAILURE_RETRY (waitpid (pids[i], &estatus, 0)) < 0)
+        err (EXIT_FAILURE, "waitpid");
+      if (!WIFEXITED (estatus) || WEXITSTATUS (estatus) != EXIT_SUCCESS)
+        exit (EXIT_FAILURE);
     }
 
   exit (EXIT_SUCCESS);
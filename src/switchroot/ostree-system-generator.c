@@ -21,19 +21,133 @@
 #include "config.h"
 
 #include <err.h>
+#include <errno.h>
+#include <mntent.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <fcntl.h>
-#include <stdlib.h>
 
-#include "ostree-cmdprivate.h"
 #include "ostree-mount-util.h"
 
 static const char *arg_dest = "/tmp";
 static const char *arg_dest_late = "/tmp";
 
-/* This program is a simple stub that calls the implementation that
- * lives inside libostree.
+/* Taken from systemd path-util.c */
+static bool
+is_path (const char *p)
+{
+  return !!strchr (p, '/');
+}
+
+/* Taken from systemd path-util.c */
+static char*
+path_kill_slashes (char *path)
+{
+  char *f, *t;
+  bool slash = false;
+
+  /* Removes redundant inner and trailing slashes. Modifies the
+   * passed string in-place.
+   *
+   * For example: ///foo///bar/ becomes /foo/bar
+   */
+
+  for (f = path, t = path; *f; f++)
+    {
+      if (*f == '/')
+        {
+          slash = true;
+          continue;
+        }
+
+      if (slash)
+        {
+          slash = false;
+          *(t++) = '/';
+        }
+
+      *(t++) = *f;
+    }
+
+  /* Special rule, if we are talking of the root directory, a
+     trailing slash is good */
+
+  if (t == path && slash)
+    *(t++) = '/';
+
+  *t = 0;
+  return path;
+}
+
+/* Written by ostree-sysroot-deploy.c. We parse out the stateroot here since we
+ * need to know it to mount /var. Unfortunately we can't easily use the
+ * libostree API to find the booted deployment since /boot might not have been
+ * mounted yet.  This is the plain-C equivalent of matching
+ * ^/ostree/boot.[01]/([^/]+)/ — we run on the early boot critical path, so
+ * we avoid dragging in GLib and libostree just for one string parse.
+ */
+static char *
+stateroot_from_ostree_cmdline (const char *ostree_cmdline)
+{
+  static const char prefix[] = "/ostree/boot.";
+
+  if (strncmp (ostree_cmdline, prefix, sizeof (prefix) - 1) != 0)
+    return NULL;
+  const char *iter = ostree_cmdline + sizeof (prefix) - 1;
+  if (!(*iter == '0' || *iter == '1') || *(iter + 1) != '/')
+    return NULL;
+  iter += 2;
+  const char *slash = strchr (iter, '/');
+  if (slash == NULL || slash == iter)
+    return NULL;
+  return strndup (iter, slash - iter);
+}
+
+/* Check /etc/fstab (if it exists) for a /var entry; if the admin
+ * configured one, it wins over our bind mount.
+ */
+static bool
+fstab_has_var_mount (void)
+{
+  FILE *fstab = setmntent ("/etc/fstab", "re");
+  bool found_var_mnt = false;
+  struct mntent *me;
+
+  if (!fstab)
+    {
+      if (errno != ENOENT)
+        err (EXIT_FAILURE, "Reading /etc/fstab");
+      return false;
+    }
+
+  while ((me = getmntent (fstab)))
+    {
+      char *where = strdup (me->mnt_dir);
+      if (where == NULL)
+        err (EXIT_FAILURE, "strdup");
+      if (is_path (where))
+        path_kill_slashes (where);
+
+      /* We're only looking for /var here */
+      if (strcmp (where, "/var") == 0)
+        found_var_mnt = true;
+      free (where);
+      if (found_var_mnt)
+        break;
+    }
+
+  endmntent (fstab);
+  return found_var_mnt;
+}
+
+/* This generator computes the /var bind mount for the booted stateroot.  It
+ * deliberately avoids libostree (and hence GObject/GIO initialization and
+ * shared library loading) since it runs on the boot critical path; all we
+ * need is the stateroot name parsed from the ostree= karg.
  */
 int
 main(int argc, char *argv[])
@@ -53,15 +167,72 @@ main(int argc, char *argv[])
     arg_dest = argv[1];
   if (argc > 3)
     arg_dest_late = argv[3];
+  (void)arg_dest_late;
 
   char *ostree_cmdline = read_proc_cmdline_ostree ();
   if (!ostree_cmdline)
     errx (EXIT_FAILURE, "Failed to find ostree= kernel argument");
 
-  { g_autoptr(GError) local_error = NULL;
-    if (!ostree_cmd__private__()->ostree_system_generator (ostree_cmdline, arg_dest, NULL, arg_dest_late, &local_error))
-      errx (EXIT_FAILURE, "%s", local_error->message);
-  }
+  char *stateroot = stateroot_from_ostree_cmdline (ostree_cmdline);
+  if (!stateroot)
+    errx (EXIT_FAILURE, "Failed to parse %s", ostree_cmdline);
+
+  /* If the admin configured a /var mount, we're done */
+  if (fstab_has_var_mount ())
+    exit (EXIT_SUCCESS);
+
+  /* Generate our bind mount unit in the "normal" dir that overrides /usr,
+   * but not /etc.  Error out if it somehow already exists, that'll help us
+   * debug conflicts.
+   */
+  int dest_dfd = open (arg_dest, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dest_dfd < 0)
+    err (EXIT_FAILURE, "opening %s", arg_dest);
+
+  int unit_fd = openat (dest_dfd, "var.mount", O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (unit_fd < 0)
+    err (EXIT_FAILURE, "creating %s/var.mount", arg_dest);
+
+  FILE *unit = fdopen (unit_fd, "w");
+  if (!unit)
+    err (EXIT_FAILURE, "fdopen");
+
+  /* This code is inspired by systemd's fstab-generator.c.
+   *
+   * Note that our unit doesn't run if systemd.volatile is enabled;
+   * see https://github.com/ostreedev/ostree/pull/856
+   */
+  if (fprintf (unit,
+               "##\n# Automatically generated by ostree-system-generator\n##\n\n"
+               "[Unit]\n"
+               "Documentation=man:ostree(1)\n"
+               "ConditionKernelCommandLine=!systemd.volatile\n"
+               /* We need /sysroot mounted writable first */
+               "After=ostree-remount.service\n"
+               "Before=local-fs.target\n"
+               "\n"
+               "[Mount]\n"
+               "Where=/var\n"
+               "What=/sysroot/ostree/deploy/%s/var\n"
+               "Options=bind\n",
+               stateroot) < 0)
+    err (EXIT_FAILURE, "writing var.mount");
+  if (fclose (unit) != 0)
+    err (EXIT_FAILURE, "writing var.mount");
+
+  /* And ensure it's required; newer systemd will auto-inject fs dependencies
+   * via RequiresMountsFor and the like, but on older versions (e.g. CentOS) we
+   * need this. It's what the fstab generator does.  And my mother always said,
+   * listen to the fstab generator.
+   */
+  if (mkdirat (dest_dfd, "local-fs.target.requires", 0755) < 0 && errno != EEXIST)
+    err (EXIT_FAILURE, "mkdirat");
+  if (symlinkat ("../var.mount", dest_dfd, "local-fs.target.requires/var.mount") < 0)
+    err (EXIT_FAILURE, "symlinkat");
+
+  free (stateroot);
+  free (ostree_cmdline);
+  (void) close (dest_dfd);
 
   exit (EXIT_SUCCESS);
 }
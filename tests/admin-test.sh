@@ -249,3 +249,12 @@ ${CMD_PREFIX} ostree --sysroot=${deployment} remote add --set=gpg-verify=false r
 assert_not_file_has_content sysroot/ostree/repo/config remote-test-nonphysical
 assert_file_has_content ${deployment}/etc/ostree/remotes.d/remote-test-nonphysical.conf testos-repo
 echo "ok remote add nonphysical sysroot"
+
+# The remotes.d parse results are cached in the repo between runs; check that
+# editing a config file behind the cache's back is picked up.
+${CMD_PREFIX} ostree --sysroot=${deployment} remote list --show-urls > remotes-list.txt
+assert_file_has_content remotes-list.txt testos-repo
+sed -i -e s,testos-repo,renamed-repo, ${deployment}/etc/ostree/remotes.d/remote-test-nonphysical.conf
+${CMD_PREFIX} ostree --sysroot=${deployment} remote list --show-urls > remotes-list.txt
+assert_file_has_content remotes-list.txt renamed-repo
+echo "ok remotes.d config cache invalidation"
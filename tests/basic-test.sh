@@ -19,7 +19,7 @@
 
 set -euo pipefail
 
-echo "1..$((70 + ${extra_basic_tests:-0}))"
+echo "1..$((72 + ${extra_basic_tests:-0}))"
 
 $CMD_PREFIX ostree --version > version.yaml
 python -c 'import yaml; yaml.safe_load(open("version.yaml"))'
@@ -55,6 +55,11 @@ if grep -q 'mode=bare$' repo/config; then
 fi
 echo "ok checkout"
 
+rm checkout-test2 -rf
+$OSTREE checkout --order-reads test2 checkout-test2
+validate_checkout_basic checkout-test2
+echo "ok checkout ordered"
+
 # Note this tests bare-user *and* bare-user-only
 rm checkout-test2 -rf
 if grep -q bare-user repo/config; then
@@ -238,6 +243,25 @@ cd ${test_tmpdir}
 assert_file_has_content diff-test2-2 'A *oh-look-a-file$'
 echo "ok diff cwd"
 
+cd ${test_tmpdir}
+mkdir renametest
+seq 1 100 > renametest/original-name
+seq 1 20000 > renametest/large-original
+$OSTREE commit ${COMMIT_ARGS} -b renametest -s "before rename" renametest
+mv renametest/original-name renametest/new-name
+mv renametest/large-original renametest/large-renamed
+echo modified >> renametest/large-renamed
+$OSTREE commit ${COMMIT_ARGS} -b renametest -s "after rename" renametest
+$OSTREE diff renametest^ renametest > diff-rename
+assert_file_has_content diff-rename 'D *original-name$'
+assert_file_has_content diff-rename 'A *new-name$'
+$OSTREE diff --detect-renames renametest^ renametest > diff-rename
+# Identical content goes through the exact checksum match; the large
+# file was also modified, so it exercises the rollsum similarity path.
+assert_file_has_content diff-rename 'R *original-name -> new-name$'
+assert_file_has_content diff-rename 'R *large-original -> large-renamed$'
+echo "ok diff rename detection"
+
 cd ${test_tmpdir}/checkout-test2-4
 $OSTREE diff ${DIFF_ARGS} test2 ./ > ${test_tmpdir}/diff-test2
 assert_file_empty ${test_tmpdir}/diff-test2
@@ -282,6 +306,9 @@ rm repo2 -rf && mkdir repo2
 ostree_repo_init repo2 --mode=$opposite_mode
 ${CMD_PREFIX} ostree --repo=repo2 pull-local --bareuseronly-files repo test2
 ${CMD_PREFIX} ostree --repo=repo2 fsck -q
+${CMD_PREFIX} ostree --repo=repo2 fsck -q --jobs=4
+${CMD_PREFIX} ostree --repo=repo2 fsck --since-last > fsck-since-last.txt
+assert_file_has_content fsck-since-last.txt "Skipping [0-9]* objects verified by the previous fsck"
 echo "ok pull-local --bareuseronly-files"
 
 # This is mostly a copy of the suid test in test-basic-user-only.sh,
@@ -534,6 +561,21 @@ $OSTREE checkout test2 test2-checkout
 (cd test2-checkout && $OSTREE commit ${COMMIT_ARGS} --link-checkout-speedup -b test2 -s "tmp")
 echo "ok commit with link speedup"
 
+cd ${test_tmpdir}
+assert_has_file repo/state/devino-cache
+(cd test2-checkout && $OSTREE commit ${COMMIT_ARGS} --link-checkout-speedup -b test2 -s "tmp again")
+echo "ok commit with link speedup from persisted devino cache"
+
+cd ${test_tmpdir}
+$OSTREE config set core.commit-stat-cache true
+statcache_rev1=$(cd test2-checkout && $OSTREE commit ${COMMIT_ARGS} -b test2-statcache -s "statcache")
+assert_has_file repo/state/commit-stat-cache
+statcache_rev2=$(cd test2-checkout && $OSTREE commit ${COMMIT_ARGS} -b test2-statcache -s "statcache again")
+$OSTREE diff ${statcache_rev1} ${statcache_rev2} > statcache-diff.txt
+assert_file_empty statcache-diff.txt
+$OSTREE config set core.commit-stat-cache false
+echo "ok commit with stat cache"
+
 cd ${test_tmpdir}
 $OSTREE ls test2
 echo "ok ls with no argument"
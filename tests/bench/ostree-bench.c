@@ -0,0 +1,295 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2017 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* Microbenchmark harness over synthetic repositories, run via
+ * `make check-perf`.  This is not a correctness test: each scenario
+ * exercises a hot path (commit, checkout, pull-local, prune, delta
+ * generate/apply) over a generated tree and prints one JSON object
+ * per line so results can be tracked per release:
+ *
+ *   {"scenario": "commit", "files": 1000, "seconds": 0.813}
+ *
+ * The tree shape and file contents are deterministic (fixed PRNG
+ * seed), so runs are comparable across builds on the same hardware.
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <ostree.h>
+#include <err.h>
+#include <string.h>
+
+#include "libglnx.h"
+
+static guint opt_n_files = 1000;
+static guint opt_file_size = 4096;
+static guint opt_n_dirs = 64;
+
+static GOptionEntry options[] = {
+  { "files", 0, 0, G_OPTION_ARG_INT, &opt_n_files, "Number of files in the synthetic tree (default: 1000)", "N" },
+  { "file-size", 0, 0, G_OPTION_ARG_INT, &opt_file_size, "Size of each file in bytes (default: 4096)", "BYTES" },
+  { "dirs", 0, 0, G_OPTION_ARG_INT, &opt_n_dirs, "Number of subdirectories (default: 64)", "N" },
+  { NULL }
+};
+
+static void
+emit_result (const char *scenario,
+             gdouble     seconds)
+{
+  g_print ("{\"scenario\": \"%s\", \"files\": %u, \"file_size\": %u, \"seconds\": %.4f}\n",
+           scenario, opt_n_files, opt_file_size, seconds);
+}
+
+static gdouble
+elapsed_secs (gint64 start_usec)
+{
+  return (g_get_monotonic_time () - start_usec) / (gdouble)G_USEC_PER_SEC;
+}
+
+/* Write @n_files of @file_size pseudo-random bytes spread over
+ * @n_dirs subdirectories of @treepath.  @generation perturbs the
+ * content so successive generations model an OS update.
+ */
+static gboolean
+generate_tree (const char    *treepath,
+               guint          generation,
+               GCancellable  *cancellable,
+               GError       **error)
+{
+  g_autoptr(GRand) rand = g_rand_new_with_seed (42 + generation);
+  g_autofree guint8 *buf = g_malloc (opt_file_size);
+  glnx_fd_close int tree_dfd = -1;
+
+  if (g_mkdir_with_parents (treepath, 0755) < 0)
+    return glnx_throw_errno_prefix (error, "mkdir(%s)", treepath);
+  if (!glnx_opendirat (AT_FDCWD, treepath, TRUE, &tree_dfd, error))
+    return FALSE;
+
+  for (guint i = 0; i < opt_n_dirs; i++)
+    {
+      g_autofree char *dname = g_strdup_printf ("dir%u", i);
+      if (mkdirat (tree_dfd, dname, 0755) < 0 && errno != EEXIST)
+        return glnx_throw_errno_prefix (error, "mkdirat(%s)", dname);
+    }
+
+  for (guint i = 0; i < opt_n_files; i++)
+    {
+      g_autofree char *path = g_strdup_printf ("dir%u/file%u", i % opt_n_dirs, i);
+
+      /* In later generations, rewrite 1/16th of the files */
+      if (generation > 0 && (i % 16 != 0))
+        continue;
+
+      for (guint j = 0; j < opt_file_size; j++)
+        buf[j] = (guint8)g_rand_int (rand);
+
+      if (!glnx_file_replace_contents_at (tree_dfd, path, buf, opt_file_size,
+                                          GLNX_FILE_REPLACE_NODATASYNC,
+                                          cancellable, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+commit_tree (OstreeRepo    *repo,
+             const char    *treepath,
+             const char    *ref,
+             char         **out_checksum,
+             GCancellable  *cancellable,
+             GError       **error)
+{
+  g_autoptr(GFile) treef = g_file_new_for_path (treepath);
+  g_autoptr(OstreeMutableTree) mtree = ostree_mutable_tree_new ();
+  g_autoptr(GFile) root = NULL;
+  g_autofree char *checksum = NULL;
+
+  if (!ostree_repo_prepare_transaction (repo, NULL, cancellable, error))
+    return FALSE;
+  if (!ostree_repo_write_directory_to_mtree (repo, treef, mtree, NULL,
+                                             cancellable, error))
+    return FALSE;
+  if (!ostree_repo_write_mtree (repo, mtree, &root, cancellable, error))
+    return FALSE;
+  if (!ostree_repo_write_commit (repo, NULL, "bench", NULL, NULL,
+                                 OSTREE_REPO_FILE (root), &checksum,
+                                 cancellable, error))
+    return FALSE;
+  ostree_repo_transaction_set_ref (repo, NULL, ref, checksum);
+  if (!ostree_repo_commit_transaction (repo, NULL, cancellable, error))
+    return FALSE;
+
+  *out_checksum = g_steal_pointer (&checksum);
+  return TRUE;
+}
+
+static gboolean
+run (GCancellable  *cancellable,
+     GError       **error)
+{
+  g_autofree char *tmpdir = g_dir_make_tmp ("ostree-bench-XXXXXX", error);
+  if (tmpdir == NULL)
+    return FALSE;
+
+  g_autofree char *repopath = g_build_filename (tmpdir, "repo", NULL);
+  g_autofree char *treepath = g_build_filename (tmpdir, "tree", NULL);
+  g_autoptr(GFile) repof = g_file_new_for_path (repopath);
+  g_autoptr(OstreeRepo) repo = ostree_repo_new (repof);
+
+  if (!ostree_repo_create (repo, OSTREE_REPO_MODE_ARCHIVE_Z2, cancellable, error))
+    return FALSE;
+  ostree_repo_set_disable_fsync (repo, TRUE);
+
+  if (!generate_tree (treepath, 0, cancellable, error))
+    return FALSE;
+
+  /* Scenario: commit */
+  g_autofree char *commit1 = NULL;
+  { gint64 start = g_get_monotonic_time ();
+    if (!commit_tree (repo, treepath, "bench", &commit1, cancellable, error))
+      return FALSE;
+    emit_result ("commit", elapsed_secs (start));
+  }
+
+  /* A second generation, as a delta source and prune victim */
+  if (!generate_tree (treepath, 1, cancellable, error))
+    return FALSE;
+  g_autofree char *commit2 = NULL;
+  { gint64 start = g_get_monotonic_time ();
+    if (!commit_tree (repo, treepath, "bench", &commit2, cancellable, error))
+      return FALSE;
+    emit_result ("commit-incremental", elapsed_secs (start));
+  }
+
+  /* Scenario: checkout */
+  { g_autofree char *checkoutpath = g_build_filename (tmpdir, "checkout", NULL);
+    glnx_fd_close int tmpdir_dfd = -1;
+    if (!glnx_opendirat (AT_FDCWD, tmpdir, TRUE, &tmpdir_dfd, error))
+      return FALSE;
+
+    OstreeRepoCheckoutAtOptions checkout_options = { 0, };
+    checkout_options.mode = OSTREE_REPO_CHECKOUT_MODE_USER;
+    gint64 start = g_get_monotonic_time ();
+    if (!ostree_repo_checkout_at (repo, &checkout_options, tmpdir_dfd, "checkout",
+                                  commit2, cancellable, error))
+      return FALSE;
+    emit_result ("checkout", elapsed_secs (start));
+    (void) checkoutpath;
+  }
+
+  /* Scenario: pull-local */
+  { g_autofree char *dstpath = g_build_filename (tmpdir, "repo-dst", NULL);
+    g_autofree char *srcuri = g_strconcat ("file://", repopath, NULL);
+    g_autoptr(GFile) dstf = g_file_new_for_path (dstpath);
+    g_autoptr(OstreeRepo) dst = ostree_repo_new (dstf);
+    const char *refs[] = { "bench", NULL };
+
+    if (!ostree_repo_create (dst, OSTREE_REPO_MODE_BARE_USER, cancellable, error))
+      return FALSE;
+    ostree_repo_set_disable_fsync (dst, TRUE);
+
+    gint64 start = g_get_monotonic_time ();
+    if (!ostree_repo_pull (dst, srcuri, (char**)refs, OSTREE_REPO_PULL_FLAGS_NONE,
+                           NULL, cancellable, error))
+      return FALSE;
+    emit_result ("pull-local", elapsed_secs (start));
+  }
+
+  /* Scenario: delta generate and apply */
+  { g_autofree char *deltadir = g_build_filename (tmpdir, "delta", NULL);
+    g_autofree char *superblock = g_build_filename (deltadir, "superblock", NULL);
+    if (g_mkdir_with_parents (deltadir, 0755) < 0)
+      return glnx_throw_errno_prefix (error, "mkdir(%s)", deltadir);
+
+    g_autoptr(GVariantBuilder) parambuilder = g_variant_builder_new (G_VARIANT_TYPE ("a{sv}"));
+    g_variant_builder_add (parambuilder, "{sv}", "filename",
+                           g_variant_new_bytestring (superblock));
+    g_autoptr(GVariant) params = g_variant_ref_sink (g_variant_builder_end (parambuilder));
+
+    gint64 start = g_get_monotonic_time ();
+    if (!ostree_repo_static_delta_generate (repo, OSTREE_STATIC_DELTA_GENERATE_OPT_MAJOR,
+                                            commit1, commit2, NULL, params,
+                                            cancellable, error))
+      return FALSE;
+    emit_result ("delta-generate", elapsed_secs (start));
+
+    g_autofree char *applypath = g_build_filename (tmpdir, "repo-apply", NULL);
+    g_autoptr(GFile) applyf = g_file_new_for_path (applypath);
+    g_autoptr(OstreeRepo) applyrepo = ostree_repo_new (applyf);
+    if (!ostree_repo_create (applyrepo, OSTREE_REPO_MODE_BARE_USER, cancellable, error))
+      return FALSE;
+    ostree_repo_set_disable_fsync (applyrepo, TRUE);
+
+    /* The delta needs its FROM commit present */
+    { g_autofree char *srcuri = g_strconcat ("file://", repopath, NULL);
+      g_autoptr(GVariantBuilder) builder = g_variant_builder_new (G_VARIANT_TYPE ("a{sv}"));
+      g_variant_builder_add (builder, "{s@v}", "refs",
+                             g_variant_new_variant (g_variant_new_strv ((const char*[]){ commit1, NULL }, -1)));
+      g_autoptr(GVariant) pull_options = g_variant_ref_sink (g_variant_builder_end (builder));
+      if (!ostree_repo_pull_with_options (applyrepo, srcuri, pull_options,
+                                          NULL, cancellable, error))
+        return FALSE;
+    }
+
+    g_autoptr(GFile) superblockf = g_file_new_for_path (superblock);
+    start = g_get_monotonic_time ();
+    if (!ostree_repo_static_delta_execute_offline (applyrepo, superblockf, FALSE,
+                                                   cancellable, error))
+      return FALSE;
+    emit_result ("delta-apply", elapsed_secs (start));
+  }
+
+  /* Scenario: prune (drops the first generation) */
+  { gint total, pruned;
+    guint64 pruned_size;
+    gint64 start = g_get_monotonic_time ();
+    if (!ostree_repo_prune (repo, OSTREE_REPO_PRUNE_FLAGS_REFS_ONLY, 0,
+                            &total, &pruned, &pruned_size,
+                            cancellable, error))
+      return FALSE;
+    emit_result ("prune", elapsed_secs (start));
+  }
+
+  /* Not a test fixture, so clean up after ourselves */
+  { g_autofree char *rmcmd = g_strdup_printf ("rm -rf '%s'", tmpdir);
+    (void) system (rmcmd);
+  }
+
+  return TRUE;
+}
+
+int
+main (int argc, char **argv)
+{
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GOptionContext) context = g_option_context_new ("- ostree microbenchmarks");
+
+  g_option_context_add_main_entries (context, options, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    errx (1, "parsing options: %s", error->message);
+
+  if (!run (NULL, &error))
+    errx (1, "%s", error->message);
+
+  return 0;
+}
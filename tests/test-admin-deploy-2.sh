@@ -24,7 +24,7 @@ set -euo pipefail
 # Exports OSTREE_SYSROOT so --sysroot not needed.
 setup_os_repository "archive-z2" "syslinux"
 
-echo "1..3"
+echo "1..5"
 
 ${CMD_PREFIX} ostree --repo=sysroot/ostree/repo pull-local --remote=testos testos-repo testos/buildmaster/x86_64-runtime
 rev=$(${CMD_PREFIX} ostree --repo=sysroot/ostree/repo rev-parse testos/buildmaster/x86_64-runtime)
@@ -61,3 +61,31 @@ assert_has_dir sysroot/boot/ostree/testos-${bootcsum}
 assert_file_has_content sysroot/ostree/deploy/testos/deploy/${newrev}.0/etc/os-release 'NAME=TestOS'
 
 echo "ok manual cleanup"
+
+if ${CMD_PREFIX} ostree admin cleanup --no-prune --prune-only 2>err.txt; then
+    assert_not_reached "--no-prune --prune-only unexpectedly succeeded"
+fi
+assert_file_has_content err.txt "Cannot specify both"
+${CMD_PREFIX} ostree admin cleanup --no-prune
+${CMD_PREFIX} ostree admin cleanup --prune-only
+assert_has_dir sysroot/boot/ostree/testos-${bootcsum}
+assert_file_has_content sysroot/ostree/deploy/testos/deploy/${newrev}.0/etc/os-release 'NAME=TestOS'
+
+echo "ok split cleanup phases"
+
+# Loading the sysroot writes a state cache; loading from it must give the
+# same results as a full parse.
+${CMD_PREFIX} ostree admin status > status1.txt
+assert_has_file sysroot/ostree/sysroot-state-cache
+${CMD_PREFIX} ostree admin status > status2.txt
+if ! cmp status1.txt status2.txt; then
+    assert_not_reached "status changed when loading from the state cache"
+fi
+rm sysroot/ostree/sysroot-state-cache
+${CMD_PREFIX} ostree admin status > status3.txt
+assert_has_file sysroot/ostree/sysroot-state-cache
+if ! cmp status1.txt status3.txt; then
+    assert_not_reached "status changed after state cache removal"
+fi
+
+echo "ok sysroot state cache"
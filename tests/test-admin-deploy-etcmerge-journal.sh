@@ -0,0 +1,71 @@
+#!/bin/bash
+#
+# Copyright (C) 2017 Colin Walters <walters@verbum.org>
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 02111-1307, USA.
+
+set -euo pipefail
+
+. $(dirname $0)/libtest.sh
+
+# Exports OSTREE_SYSROOT so --sysroot not needed.
+setup_os_repository "archive-z2" "syslinux"
+
+echo "1..2"
+
+${CMD_PREFIX} ostree --repo=sysroot/ostree/repo pull-local --remote=testos testos-repo testos/buildmaster/x86_64-runtime
+rev=$(${CMD_PREFIX} ostree --repo=sysroot/ostree/repo rev-parse testos/buildmaster/x86_64-runtime)
+${CMD_PREFIX} ostree admin deploy --karg=root=LABEL=MOO --os=testos testos:testos/buildmaster/x86_64-runtime
+
+deploydir=sysroot/ostree/deploy/testos/deploy
+# The change journal is written next to the origin file
+assert_has_file ${deploydir}/${rev}.0.etc-journal
+
+etc=${deploydir}/${rev}.0/etc
+echo "a modified config file" > ${etc}/NetworkManager/nm.conf
+echo "a new local config file" > ${etc}/a-new-config-file
+rm -rf ${etc}/testdirectory
+
+os_repository_new_commit
+${CMD_PREFIX} ostree --repo=sysroot/ostree/repo remote add --set=gpg-verify=false testos file://$(pwd)/testos-repo testos/buildmaster/x86_64-runtime
+# This merge is computed incrementally from the journal
+${CMD_PREFIX} ostree admin upgrade --os=testos
+newrev=$(${CMD_PREFIX} ostree --repo=sysroot/ostree/repo rev-parse testos/buildmaster/x86_64-runtime)
+newetc=${deploydir}/${newrev}.0/etc
+
+assert_file_has_content ${newetc}/NetworkManager/nm.conf "a modified config file"
+assert_file_has_content ${newetc}/a-new-config-file "a new local config file"
+assert_not_has_dir ${newetc}/testdirectory
+assert_has_file ${deploydir}/${newrev}.0.etc-journal
+
+echo "ok etcmerge from journal"
+
+# Without a journal (e.g. a deployment created by an older ostree) we
+# fall back to the full tree diff, with the same result.
+rm ${deploydir}/${newrev}.0.etc-journal
+os_repository_new_commit
+${CMD_PREFIX} ostree admin upgrade --os=testos
+newrev2=$(${CMD_PREFIX} ostree --repo=sysroot/ostree/repo rev-parse testos/buildmaster/x86_64-runtime)
+newetc2=${deploydir}/${newrev2}.0/etc
+
+assert_file_has_content ${newetc2}/NetworkManager/nm.conf "a modified config file"
+assert_file_has_content ${newetc2}/a-new-config-file "a new local config file"
+assert_not_has_dir ${newetc2}/testdirectory
+assert_has_file ${deploydir}/${newrev2}.0.etc-journal
+# The original deployment was garbage collected along with its journal
+assert_not_has_file ${deploydir}/${rev}.0.etc-journal
+
+echo "ok etcmerge full diff fallback"
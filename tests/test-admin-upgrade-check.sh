@@ -0,0 +1,56 @@
+#!/bin/bash
+#
+# Copyright (C) 2017 Colin Walters <walters@verbum.org>
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 02111-1307, USA.
+
+set -euo pipefail
+
+. $(dirname $0)/libtest.sh
+
+# Exports OSTREE_SYSROOT so --sysroot not needed.
+setup_os_repository "archive-z2" "syslinux"
+
+echo "1..3"
+
+cd ${test_tmpdir}
+${CMD_PREFIX} ostree --repo=sysroot/ostree/repo remote add --set=gpg-verify=false testos $(cat httpd-address)/ostree/testos-repo
+${CMD_PREFIX} ostree --repo=sysroot/ostree/repo pull testos testos/buildmaster/x86_64-runtime
+${CMD_PREFIX} ostree admin deploy --karg=root=LABEL=MOO --os=testos testos:testos/buildmaster/x86_64-runtime
+
+# The check resolves the remote head from its summary
+${CMD_PREFIX} ostree --repo=${test_tmpdir}/testos-repo summary -u
+
+${CMD_PREFIX} ostree admin upgrade --os=testos --check > check.txt
+assert_file_has_content check.txt "No update available"
+echo "ok check no update"
+
+os_repository_new_commit
+${CMD_PREFIX} ostree --repo=${test_tmpdir}/testos-repo summary -u
+newrev=$(${CMD_PREFIX} ostree --repo=${test_tmpdir}/testos-repo rev-parse testos/buildmaster/x86_64-runtime)
+
+${CMD_PREFIX} ostree admin upgrade --os=testos --check > check.txt
+assert_file_has_content check.txt "Update available for testos:testos/buildmaster/x86_64-runtime"
+# The check must not download the new commit or move the local ref
+if ${CMD_PREFIX} ostree --repo=sysroot/ostree/repo show ${newrev} 2>/dev/null; then
+    assert_not_reached "check unexpectedly downloaded the new commit"
+fi
+echo "ok check update available"
+
+${CMD_PREFIX} ostree admin upgrade --os=testos
+${CMD_PREFIX} ostree admin upgrade --os=testos --check > check.txt
+assert_file_has_content check.txt "No update available"
+echo "ok check after upgrade"
@@ -0,0 +1,63 @@
+#!/bin/bash
+#
+# Copyright (C) 2017 Red Hat, Inc.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 02111-1307, USA.
+
+set -euo pipefail
+
+echo "1..3"
+
+. $(dirname $0)/libtest.sh
+
+setup_test_repository "archive-z2"
+
+mkdir test
+echo hello > test/a
+
+$OSTREE commit -b test -s "First commit" test
+
+# Deltas are off by default
+assert_streq "$($OSTREE static-delta list | wc -l)" "0"
+
+echo hello2 > test/a
+$OSTREE commit -b test -s "Second commit" test
+assert_streq "$($OSTREE static-delta list | wc -l)" "0"
+echo "ok no deltas by default"
+
+$OSTREE --repo=repo config set core.commit-update-deltas 2
+
+echo hello3 > test/a
+$OSTREE commit -b test -s "Third commit" test
+
+# Two ancestors available, so two deltas ending at the new commit
+assert_streq "$($OSTREE static-delta list | wc -l)" "2"
+echo "ok deltas from previous commits"
+
+# The next commit only needs the two new pairs; the existing delta is kept
+echo hello4 > test/a
+$OSTREE commit -b test -s "Fourth commit" test
+assert_streq "$($OSTREE static-delta list | wc -l)" "4"
+
+# And combined with commit-update-summary, the summary advertises them
+$OSTREE --repo=repo config set core.commit-update-summary true
+echo hello5 > test/a
+$OSTREE commit -b test -s "Fifth commit" test
+$OSTREE summary --view > summary.txt
+NEWEST=$($OSTREE rev-parse test)
+PARENT=$($OSTREE rev-parse test^)
+assert_file_has_content summary.txt "${PARENT}-${NEWEST}"
+echo "ok deltas incremental and in summary"
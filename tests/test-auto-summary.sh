@@ -20,7 +20,7 @@
 
 set -euo pipefail
 
-echo "1..4"
+echo "1..5"
 
 . $(dirname $0)/libtest.sh
 
@@ -58,3 +58,8 @@ assert_not_streq "$OLD_MD5" "$(md5sum repo/summary)"
 touch repo/summary.sig
 $OSTREE summary --update
 assert_not_has_file repo/summary.sig
+
+# Each ref tip gets a published object manifest
+rev=$($OSTREE rev-parse test)
+assert_has_file repo/manifests/${rev:0:2}/${rev:2}.manifest
+echo "ok object manifest"
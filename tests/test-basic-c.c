@@ -237,6 +237,97 @@ test_object_writes (gconstpointer data)
   }
 }
 
+static void
+test_has_objects_batch (gconstpointer data)
+{
+  OstreeRepo *repo = OSTREE_REPO (data);
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *commit_checksum = NULL;
+  g_autoptr(GHashTable) reachable = NULL;
+  g_autoptr(GHashTable) found = NULL;
+  g_autoptr(GPtrArray) objects = g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
+  GHashTableIter iter;
+  GVariant *serialized_object;
+  guint n_reachable;
+
+  ostree_repo_resolve_rev (repo, "test2", FALSE, &commit_checksum, &error);
+  g_assert_no_error (error);
+  ostree_repo_traverse_commit (repo, commit_checksum, -1, &reachable, NULL, &error);
+  g_assert_no_error (error);
+
+  g_hash_table_iter_init (&iter, reachable);
+  while (g_hash_table_iter_next (&iter, (gpointer*)&serialized_object, NULL))
+    g_ptr_array_add (objects, g_variant_ref (serialized_object));
+  n_reachable = objects->len;
+  g_assert_cmpuint (n_reachable, >, 0);
+
+  /* An object that certainly doesn't exist, plus a duplicate entry */
+  static const char bogus_sha256[] = "cafebabecafebabecafebabecafebabecafebabecafebabecafebabecafebabe";
+  g_ptr_array_add (objects, ostree_object_name_serialize (bogus_sha256, OSTREE_OBJECT_TYPE_COMMIT));
+  g_ptr_array_add (objects, g_variant_ref (objects->pdata[0]));
+
+  ostree_repo_has_objects_batch (repo, objects, &found, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_hash_table_size (found), ==, n_reachable);
+  for (guint i = 0; i < n_reachable; i++)
+    g_assert (g_hash_table_contains (found, objects->pdata[i]));
+}
+
+static gboolean
+count_objects_cb (OstreeRepo       *repo,
+                  const guchar     *csum,
+                  OstreeObjectType  objtype,
+                  gpointer          user_data,
+                  GError          **error)
+{
+  GHashTable *seen = user_data;
+  char checksum[OSTREE_SHA256_STRING_LEN+1];
+
+  ostree_checksum_inplace_from_bytes (csum, checksum);
+  g_hash_table_add (seen, g_variant_ref_sink (ostree_object_name_serialize (checksum, objtype)));
+  return TRUE;
+}
+
+static gboolean
+fail_object_cb (OstreeRepo       *repo,
+                const guchar     *csum,
+                OstreeObjectType  objtype,
+                gpointer          user_data,
+                GError          **error)
+{
+  return glnx_throw (error, "oops");
+}
+
+static void
+test_list_objects_foreach (gconstpointer data)
+{
+  OstreeRepo *repo = OSTREE_REPO (data);
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GHashTable) objects = NULL;
+  g_autoptr(GHashTable) seen = g_hash_table_new_full (ostree_hash_object_name, g_variant_equal,
+                                                      (GDestroyNotify)g_variant_unref, NULL);
+  GHashTableIter iter;
+  GVariant *serialized_object;
+
+  ostree_repo_list_objects (repo, OSTREE_REPO_LIST_OBJECTS_ALL, &objects, NULL, &error);
+  g_assert_no_error (error);
+
+  /* The streaming walk must visit exactly the set list_objects returns */
+  ostree_repo_list_objects_foreach (repo, OSTREE_REPO_LIST_OBJECTS_ALL,
+                                    count_objects_cb, seen, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_hash_table_size (seen), ==, g_hash_table_size (objects));
+  g_hash_table_iter_init (&iter, objects);
+  while (g_hash_table_iter_next (&iter, (gpointer*)&serialized_object, NULL))
+    g_assert (g_hash_table_contains (seen, serialized_object));
+
+  /* Callback errors propagate */
+  g_assert (!ostree_repo_list_objects_foreach (repo, OSTREE_REPO_LIST_OBJECTS_ALL,
+                                               fail_object_cb, NULL, NULL, &error));
+  g_assert (error);
+  g_assert (strstr (error->message, "oops"));
+}
+
 int main (int argc, char **argv)
 {
   g_autoptr(GError) error = NULL;
@@ -251,6 +342,8 @@ int main (int argc, char **argv)
   g_test_add_data_func ("/repo-not-system", repo, test_repo_is_not_system);
   g_test_add_data_func ("/raw-file-to-archive-z2-stream", repo, test_raw_file_to_archive_z2_stream);
   g_test_add_data_func ("/objectwrites", repo, test_object_writes);
+  g_test_add_data_func ("/has-objects-batch", repo, test_has_objects_batch);
+  g_test_add_data_func ("/list-objects-foreach", repo, test_list_objects_foreach);
   g_test_add_func ("/remotename", test_validate_remotename);
 
   return g_test_run();
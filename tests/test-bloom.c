@@ -91,6 +91,55 @@ test_bloom_construction (void)
     g_assert_false (ostree_bloom_maybe_contains (bloom, non_members[i]));
 }
 
+/* As test_bloom_construction(), but for the blocked layout: round-trip
+ * through GBytes and check membership is preserved. */
+static void
+test_bloom_blocked_construction (void)
+{
+  g_autoptr(OstreeBloom) bloom = NULL;
+  g_autoptr(OstreeBloom) immutable_bloom = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  gsize i;
+  const gchar *members[] =
+    {
+      "hello", "there", "these", "are", "test", "strings"
+    };
+  const gchar *non_members[] =
+    {
+      "not", "an", "element"
+    };
+  const gsize n_bytes = 4 * OSTREE_BLOOM_BLOCK_SIZE;
+  const guint8 k = 8;
+  const OstreeBloomHashFunc hash = ostree_str_bloom_hash;
+
+  bloom = ostree_bloom_new_blocked (n_bytes, k, hash);
+
+  for (i = 0; i < G_N_ELEMENTS (members); i++)
+    ostree_bloom_add_element (bloom, members[i]);
+
+  bytes = ostree_bloom_seal (bloom);
+
+  immutable_bloom = ostree_bloom_new_from_bytes_blocked (bytes, k, hash);
+  g_assert_nonnull (immutable_bloom);
+
+  for (i = 0; i < G_N_ELEMENTS (members); i++)
+    g_assert_true (ostree_bloom_maybe_contains (immutable_bloom, members[i]));
+
+  /* As above, a false positive here would technically be valid, but the
+   * fixed hash function makes the result deterministic. */
+  for (i = 0; i < G_N_ELEMENTS (non_members); i++)
+    g_assert_false (ostree_bloom_maybe_contains (immutable_bloom, non_members[i]));
+}
+
+/* The blocked deserializer must reject sizes which are not a block multiple. */
+static void
+test_bloom_blocked_invalid_size (void)
+{
+  g_autoptr(GBytes) bytes = g_bytes_new_take (g_malloc0 (OSTREE_BLOOM_BLOCK_SIZE - 1),
+                                              OSTREE_BLOOM_BLOCK_SIZE - 1);
+  g_assert_null (ostree_bloom_new_from_bytes_blocked (bytes, 8, ostree_str_bloom_hash));
+}
+
 /* Test that an empty bloom filter definitely contains no elements. */
 static void
 test_bloom_empty (void)
@@ -147,6 +196,8 @@ int main (int argc, char **argv)
 
   g_test_add_func ("/bloom/init", test_bloom_init);
   g_test_add_func ("/bloom/construction", test_bloom_construction);
+  g_test_add_func ("/bloom/blocked-construction", test_bloom_blocked_construction);
+  g_test_add_func ("/bloom/blocked-invalid-size", test_bloom_blocked_invalid_size);
   g_test_add_func ("/bloom/empty", test_bloom_empty);
   g_test_add_func ("/bloom/membership-during-construction", test_bloom_membership_during_construction);
 
@@ -0,0 +1,63 @@
+#!/bin/bash
+#
+# Copyright (C) 2017 Red Hat, Inc.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 02111-1307, USA.
+
+set -euo pipefail
+
+. $(dirname $0)/libtest.sh
+
+echo '1..5'
+
+cd ${test_tmpdir}
+mkdir repo
+ostree_repo_init repo --mode=archive-z2
+
+${CMD_PREFIX} ostree --repo=repo debug generate-repo \
+    --refs=2 --depth=3 --files=20 --file-size=512 --seed=7 > gen.txt
+assert_file_has_content gen.txt "^synth-0 => "
+assert_file_has_content gen.txt "^synth-1 => "
+echo "ok generate"
+
+$OSTREE fsck
+echo "ok fsck generated repo"
+
+$OSTREE refs > refs.txt
+assert_streq "$(wc -l < refs.txt)" 2
+$OSTREE log synth-0 > log.txt
+assert_streq "$(grep -c '^commit ' log.txt)" 3
+echo "ok refs and history depth"
+
+$OSTREE checkout synth-0 gen-checkout
+assert_streq "$(find gen-checkout -type f | wc -l)" 20
+echo "ok checkout generated tree"
+
+# Same parameters must reproduce the same commits
+mkdir repo2
+ostree_repo_init repo2 --mode=archive-z2
+${CMD_PREFIX} ostree --repo=repo2 debug generate-repo \
+    --refs=2 --depth=3 --files=20 --file-size=512 --seed=7 > gen2.txt
+assert_streq "$($OSTREE rev-parse synth-0)" "$(${CMD_PREFIX} ostree --repo=repo2 rev-parse synth-0)"
+# A different seed must not
+mkdir repo3
+ostree_repo_init repo3 --mode=archive-z2
+${CMD_PREFIX} ostree --repo=repo3 debug generate-repo \
+    --refs=2 --depth=3 --files=20 --file-size=512 --seed=8 > gen3.txt
+if [ "$($OSTREE rev-parse synth-0)" = "$(${CMD_PREFIX} ostree --repo=repo3 rev-parse synth-0)" ]; then
+    assert_not_reached "different seeds produced the same commit"
+fi
+echo "ok deterministic from seed"
@@ -26,7 +26,7 @@ skip_without_user_xattrs
 bindatafiles="bash true ostree"
 morebindatafiles="false ls"
 
-echo '1..12'
+echo '1..14'
 
 mkdir repo
 ostree_repo_init repo --mode=archive-z2
@@ -114,6 +114,7 @@ assert_has_file repo/deltas/${deltaprefix}/${deltadir}/0
 ${CMD_PREFIX} ostree --repo=repo static-delta generate --disable-bsdiff --from=${origrev} --to=${newrev} 2>&1 | grep "bsdiff=0 objects"
 ${CMD_PREFIX} ostree --repo=repo static-delta generate --max-bsdiff-size=0 --from=${origrev} --to=${newrev} 2>&1 | grep "bsdiff=0 objects"
 ${CMD_PREFIX} ostree --repo=repo static-delta generate --max-bsdiff-size=10000 --from=${origrev} --to=${newrev} 2>&1 | grep "bsdiff=[1-9]"
+${CMD_PREFIX} ostree --repo=repo static-delta generate --max-bsdiff-memory=10000 --from=${origrev} --to=${newrev} 2>&1 | grep "bsdiff=[1-9]"
 
 ${CMD_PREFIX} ostree --repo=repo static-delta list | grep ${origrev}-${newrev} || exit 1
 
@@ -145,6 +146,16 @@ assert_streq "${totalsize_orig}" "${totalsize_swapped}"
 
 echo 'ok generate + show endian swapped'
 
+${CMD_PREFIX} ostree --repo=repo static-delta generate --dual-endian --from=${origrev} --to=${newrev}
+assert_has_file repo/deltas/${deltaprefix}/${deltadir}/superblock.l
+assert_has_file repo/deltas/${deltaprefix}/${deltadir}/superblock.B
+# One variant is byte-identical to the canonical superblock; the other
+# only differs in the superblock metadata, never the part payloads.
+cmp repo/deltas/${deltaprefix}/${deltadir}/superblock.l repo/deltas/${deltaprefix}/${deltadir}/superblock || \
+  cmp repo/deltas/${deltaprefix}/${deltadir}/superblock.B repo/deltas/${deltaprefix}/${deltadir}/superblock
+
+echo 'ok generate dual endian'
+
 tar xf ${test_srcdir}/pre-endian-deltas-repo-big.tar.xz
 mv pre-endian-deltas-repo{,-big}
 tar xf ${test_srcdir}/pre-endian-deltas-repo-little.tar.xz
@@ -167,6 +178,7 @@ assert_streq "${totalsize_legacy_big}" "${totalsize_legacy_little}"
 echo 'ok heuristic endian detection'
 
 ${CMD_PREFIX} ostree --repo=repo summary -u
+assert_has_file repo/delta-index
 
 mkdir repo2 && ostree_repo_init repo2 --mode=bare-user
 ${CMD_PREFIX} ostree --repo=repo2 pull-local --require-static-deltas repo ${origrev}
@@ -254,6 +266,25 @@ ${CMD_PREFIX} ostree --repo=repo2 pull-local --require-static-deltas repo otherb
 
 echo 'ok rebase deltas'
 
+# Inline-delta summaries: with summary-inline-delta-max-bytes set, a small
+# superblock generated with --inline is embedded in the summary, so the
+# delta applies even with the superblock file itself gone.
+echo inline-content > files/inline-content
+${CMD_PREFIX} ostree --repo=repo commit -b test --tree=dir=files
+inlinerev=$(${CMD_PREFIX} ostree --repo=repo rev-parse test)
+touch delta-stamp
+${CMD_PREFIX} ostree --repo=repo static-delta generate --inline --from=${samerev} --to=${inlinerev}
+inline_superblock=$(find repo/deltas -name superblock -newer delta-stamp)
+assert_has_file "${inline_superblock}"
+${CMD_PREFIX} ostree --repo=repo config set core.summary-inline-delta-max-bytes 10000000
+${CMD_PREFIX} ostree --repo=repo summary -u
+rm "${inline_superblock}"
+${CMD_PREFIX} ostree --repo=repo2 pull-local --require-static-deltas repo test
+${CMD_PREFIX} ostree --repo=repo2 fsck
+${CMD_PREFIX} ostree --repo=repo config set core.summary-inline-delta-max-bytes 0
+
+echo 'ok inline delta in summary'
+
 ${CMD_PREFIX} ostree --repo=repo summary -u
 if ${CMD_PREFIX} ostree --repo=repo static-delta show GARBAGE 2> err.txt; then
     assert_not_reached "static-delta show GARBAGE unexpectedly succeeded"
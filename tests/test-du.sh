@@ -0,0 +1,48 @@
+#!/bin/bash
+#
+# Copyright (C) 2017 Colin Walters <walters@verbum.org>
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 02111-1307, USA.
+
+set -euo pipefail
+
+echo "1..4"
+
+. $(dirname $0)/libtest.sh
+
+setup_test_repository "bare"
+echo "ok setup"
+
+mkdir sizetest
+echo first > sizetest/a
+
+$OSTREE commit -b size1 -s "First commit" sizetest
+rev1=$($OSTREE rev-parse size1)
+
+# The size closure is cached as part of the transaction
+assert_has_file repo/state/size-closures/${rev1}
+echo "ok size closure cached at commit"
+
+$OSTREE du size1 > du.txt
+assert_file_has_content du.txt "size1:.*total;.*unique;.*shared"
+echo "ok du output"
+
+# A second branch with identical content shares everything except its
+# own commit object, so only a few hundred bytes remain unique to it.
+$OSTREE commit -b size2 -s "Second commit" sizetest
+$OSTREE du size2 > du2.txt
+assert_file_has_content du2.txt "size2:.*; [0-9][0-9]* bytes unique;"
+echo "ok du shared content"
@@ -0,0 +1,54 @@
+#!/bin/bash
+#
+# Copyright (C) 2017 Colin Walters <walters@verbum.org>
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 02111-1307, USA.
+
+set -euo pipefail
+
+. $(dirname $0)/libtest.sh
+
+echo "1..3"
+
+setup_fake_remote_repo1 "archive-z2"
+
+cd ${test_tmpdir}
+mkdir repo
+ostree_repo_init repo
+${CMD_PREFIX} ostree --repo=repo remote add --set=gpg-verify=false origin $(cat httpd-address)/ostree/gnomerepo
+${CMD_PREFIX} ostree --repo=repo pull origin main
+${CMD_PREFIX} ostree --repo=repo fsck -q
+echo "ok pull and fsck"
+
+# Damage two regular-file objects: corrupt the content of one and
+# delete the other outright.
+objects=$(find repo/objects -name '*.file' -type f | sort | head -2)
+corrupt_object=$(echo "${objects}" | sed -n 1p)
+missing_object=$(echo "${objects}" | sed -n 2p)
+chmod u+w ${corrupt_object}
+echo corruptioncorruption >> ${corrupt_object}
+rm ${missing_object}
+if ${CMD_PREFIX} ostree --repo=repo fsck -q 2>err.txt; then
+    assert_not_reached "fsck unexpectedly succeeded on damaged repo!"
+fi
+echo "ok fsck detects damage"
+
+${CMD_PREFIX} ostree --repo=repo fsck --repair-from-remote=origin > repair.txt
+assert_file_has_content repair.txt "Refetching 2 objects from remote 'origin'"
+assert_file_has_content repair.txt "Repaired 2 objects"
+assert_has_file ${missing_object}
+${CMD_PREFIX} ostree --repo=repo fsck -q
+echo "ok repair from remote"
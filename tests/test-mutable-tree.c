@@ -20,6 +20,7 @@
 
 #include "config.h"
 #include "libglnx.h"
+#include "ostree.h"
 #include "ostree-mutable-tree.h"
 #include <glib.h>
 #include <stdlib.h>
@@ -175,10 +176,49 @@ test_contents_checksum (void)
   g_assert_null (ostree_mutable_tree_get_contents_checksum (tree));
 }
 
+static void
+test_fill_empty_from_dirtree (void)
+{
+  const char *contents_checksum = "01234567890123456789012345678901";
+  const char *metadata_checksum = "ABCDEF01234567890123456789012345";
+  const char *file_checksum = "11111111111111111111111111111111";
+  g_autoptr(GFile) repo_path = g_file_new_for_path ("/nonexistent");
+  glnx_unref_object OstreeRepo *repo = ostree_repo_new (repo_path);
+  g_autoptr(GError) error = NULL;
+
+  /* An empty tree becomes a reference; the checksums are visible
+   * without any children being instantiated.
+   */
+  {
+    glnx_unref_object OstreeMutableTree *tree = ostree_mutable_tree_new ();
+    g_assert (ostree_mutable_tree_fill_empty_from_dirtree (tree, repo,
+                                                           contents_checksum,
+                                                           metadata_checksum));
+    g_assert_cmpstr (contents_checksum, ==, ostree_mutable_tree_get_contents_checksum (tree));
+    g_assert_cmpstr (metadata_checksum, ==, ostree_mutable_tree_get_metadata_checksum (tree));
+
+    /* Refilling with the same reference is allowed */
+    g_assert (ostree_mutable_tree_fill_empty_from_dirtree (tree, repo,
+                                                           contents_checksum,
+                                                           metadata_checksum));
+  }
+
+  /* A tree with content refuses */
+  {
+    glnx_unref_object OstreeMutableTree *tree = ostree_mutable_tree_new ();
+    g_assert (ostree_mutable_tree_replace_file (tree, "a", file_checksum, &error));
+    g_assert_no_error (error);
+    g_assert_false (ostree_mutable_tree_fill_empty_from_dirtree (tree, repo,
+                                                                 contents_checksum,
+                                                                 metadata_checksum));
+  }
+}
+
 int main (int argc, char **argv)
 {
   g_test_init (&argc, &argv, NULL);
   g_test_add_func ("/mutable-tree/metadata-checksum", test_metadata_checksum);
+  g_test_add_func ("/mutable-tree/fill-empty-from-dirtree", test_fill_empty_from_dirtree);
   g_test_add_func ("/mutable-tree/contents-checksum", test_contents_checksum);
   g_test_add_func ("/mutable-tree/parent-dirs", test_ensure_parent_dirs);
   g_test_add_func ("/mutable-tree/walk", test_mutable_tree_walk);
@@ -0,0 +1,97 @@
+#!/bin/bash
+#
+# Copyright (C) 2017 Colin Walters <walters@verbum.org>
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 02111-1307, USA.
+
+set -euo pipefail
+
+. $(dirname $0)/libtest.sh
+
+echo '1..8'
+
+setup_test_repository "archive-z2"
+
+cd ${test_tmpdir}
+
+count_loose_content() {
+    find repo/objects -name '*.filez' | wc -l
+}
+
+assert_no_loose_content() {
+    count=$(count_loose_content)
+    if [ "${count}" != 0 ]; then
+        assert_not_reached "expected no loose content objects, have ${count}"
+    fi
+}
+
+${CMD_PREFIX} ostree --repo=repo pack --max-size=1000000 > pack.txt
+assert_file_has_content pack.txt "Packed [1-9]"
+assert_has_file repo/objects/pack/*.index
+assert_has_file repo/objects/pack/*.data
+assert_no_loose_content
+echo "ok pack"
+
+$OSTREE checkout test2 pack-checkout
+assert_has_file pack-checkout/firstfile
+assert_file_has_content pack-checkout/baz/cow moo
+assert_has_file pack-checkout/baz/deeper/ohyeah
+echo "ok checkout from packed repo"
+
+$OSTREE fsck
+echo "ok fsck"
+
+$OSTREE cat test2 /baz/cow > cow.txt
+assert_file_has_content cow.txt moo
+echo "ok cat from packed repo"
+
+mkdir repo2
+ostree_repo_init repo2
+${CMD_PREFIX} ostree --repo=repo2 pull-local repo test2
+${CMD_PREFIX} ostree --repo=repo2 fsck
+${CMD_PREFIX} ostree --repo=repo2 checkout test2 pulled-checkout
+assert_file_has_content pulled-checkout/baz/cow moo
+echo "ok pull-local from packed repo"
+
+# An identical re-commit dedups against loose objects only, so it writes
+# loose duplicates of the packed content; the next pack run folds them
+# away without packing anything new.
+$OSTREE commit -b test2 -s "Identical commit" --tree=dir=pack-checkout
+if [ "$(count_loose_content)" = 0 ]; then
+    assert_not_reached "expected loose duplicates after re-commit"
+fi
+$OSTREE config set core.pack-small-objects-max-bytes 1000000
+${CMD_PREFIX} ostree --repo=repo pack > pack2.txt
+assert_file_has_content pack2.txt "Packed 0 content objects"
+assert_no_loose_content
+echo "ok repack folds duplicates"
+
+echo newcontent > pack-checkout/newfile
+$OSTREE commit -b test2 -s "New content" --tree=dir=pack-checkout
+${CMD_PREFIX} ostree --repo=repo pack > pack3.txt
+assert_file_has_content pack3.txt "Packed [1-9]"
+assert_no_loose_content
+$OSTREE fsck
+rm pack-checkout2 -rf
+$OSTREE checkout test2 pack-checkout2
+assert_file_has_content pack-checkout2/newfile newcontent
+echo "ok incremental pack"
+
+if ${CMD_PREFIX} ostree --repo=repo2 pack --max-size=1000000 2>err.txt; then
+    assert_not_reached "pack unexpectedly succeeded on a bare repo"
+fi
+assert_file_has_content err.txt "archive"
+echo "ok pack requires archive mode"
@@ -0,0 +1,61 @@
+#!/bin/bash
+#
+# Copyright (C) 2017 Colin Walters <walters@verbum.org>
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 02111-1307, USA.
+
+set -euo pipefail
+
+. $(dirname $0)/libtest.sh
+
+echo "1..2"
+
+cd ${test_tmpdir}
+ostree_repo_init repo --mode=archive-z2
+
+# Each job commits a tree sharing common/ (deduplicated at merge time)
+# plus a per-job file, to its own branch, all concurrently.
+njobs=4
+for x in $(seq ${njobs}); do
+    mkdir -p files-${x}/common
+    echo shared-content > files-${x}/common/shared.txt
+    echo content-${x} > files-${x}/unique-${x}.txt
+done
+
+for x in $(seq ${njobs}); do
+    ${CMD_PREFIX} ostree --repo=repo commit -b branch-${x} --tree=dir=files-${x} &
+done
+wait
+
+for x in $(seq ${njobs}); do
+    ${CMD_PREFIX} ostree --repo=repo rev-parse branch-${x}
+done
+
+echo "ok concurrent commits all landed"
+
+${CMD_PREFIX} ostree --repo=repo fsck
+for x in $(seq ${njobs}); do
+    ${CMD_PREFIX} ostree --repo=repo checkout branch-${x} checkout-${x}
+    assert_file_has_content checkout-${x}/common/shared.txt shared-content
+    assert_file_has_content checkout-${x}/unique-${x}.txt content-${x}
+done
+
+# No transaction should have left its staging directory behind
+if ls repo/tmp/staging-* 2>/dev/null; then
+    assert_not_reached "leftover staging directory"
+fi
+
+echo "ok concurrent commit contents"
@@ -0,0 +1,52 @@
+#!/bin/bash
+#
+# Copyright (C) 2017 Colin Walters <walters@verbum.org>
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 02111-1307, USA.
+
+set -euo pipefail
+
+. $(dirname $0)/libtest.sh
+
+echo '1..4'
+
+setup_test_repository "archive-z2"
+
+cd ${test_tmpdir}
+
+$OSTREE ls -R test2 > ls-before.txt
+
+${CMD_PREFIX} ostree --repo=repo path-index test2
+assert_has_file repo/state/path-index/*
+echo "ok generate path index"
+
+$OSTREE cat test2 /baz/cow > cow.txt
+assert_file_has_content cow.txt moo
+$OSTREE cat test2 /baz/deeper/ohyeah > /dev/null
+echo "ok cat via path index"
+
+$OSTREE checkout --subpath /baz/deeper test2 deeper-checkout
+assert_has_file deeper-checkout/ohyeah
+echo "ok checkout subpath via path index"
+
+$OSTREE ls -R test2 > ls-after.txt
+if ! cmp ls-before.txt ls-after.txt; then
+    assert_not_reached "ls -R output changed with a path index present"
+fi
+if $OSTREE cat test2 /baz/no-such-file 2>err.txt; then
+    assert_not_reached "cat of a missing path unexpectedly succeeded"
+fi
+echo "ok indexed repo consistent"
@@ -139,6 +139,13 @@ ${CMD_PREFIX} ostree --repo=repo prune --static-deltas-only --keep-younger-than=
 ${CMD_PREFIX} ostree --repo=repo static-delta list | wc -l > deltascount
 assert_file_has_content deltascount "^1$"
 
+# Repeated prunes reuse the persisted per-commit closures; the result
+# must be identical to a from-scratch traversal.
+${CMD_PREFIX} ostree --repo=repo prune --refs-only
+assert_has_dir repo/state/prune-closures
+${CMD_PREFIX} ostree --repo=repo prune --refs-only
+$OSTREE fsck
+
 echo "ok prune"
 
 rm repo -rf
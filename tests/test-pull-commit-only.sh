@@ -23,7 +23,7 @@ set -euo pipefail
 
 setup_fake_remote_repo1 "archive-z2"
 
-echo '1..1'
+echo '1..2'
 
 cd ${test_tmpdir}
 mkdir repo
@@ -42,3 +42,12 @@ find repo/objects -name '*.dirtree' | wc -l > commitcount
 assert_file_has_content commitcount "^0$"
 
 echo "ok pull commit metadata only"
+
+# Re-sync with the detached metadata refresh disabled: the commit is
+# already stored, so this should issue no object fetches at all.
+${CMD_PREFIX} ostree --repo=repo pull --commit-metadata-only --disable-commitmeta-refresh origin main
+find repo/objects -name '*.commit' | wc -l > commitcount
+assert_file_has_content commitcount "^1$"
+${CMD_PREFIX} ostree --repo=repo fsck
+
+echo "ok pull commit metadata only without commitmeta refresh"
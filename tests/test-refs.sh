@@ -23,7 +23,7 @@ set -euo pipefail
 
 setup_fake_remote_repo1 "archive-z2"
 
-echo '1..2'
+echo '1..4'
 
 cd ${test_tmpdir}
 mkdir repo
@@ -157,3 +157,49 @@ assert_file_has_content_literal refs.txt 'exampleos/x86_64/stable/server -> exam
 ${CMD_PREFIX} ostree --repo=repo summary -u
 
 echo "ok ref symlink"
+
+# Test packing refs into a single sorted file
+${CMD_PREFIX} ostree --repo=repo refs > refs.before
+${CMD_PREFIX} ostree --repo=repo refs --pack
+assert_has_file repo/refs/packed
+${CMD_PREFIX} ostree --repo=repo refs > refs.after
+if ! cmp <(sort refs.before) <(sort refs.after); then
+    assert_not_reached "ref listing changed after refs --pack"
+fi
+# Resolution must work from the packed file
+packedrev=$(${CMD_PREFIX} ostree --repo=repo rev-parse exampleos/x86_64/27/server)
+assert_streq "${packedrev}" "${newcurrent}"
+# Loose writes take precedence over packed entries
+${CMD_PREFIX} ostree --repo=repo commit -b exampleos/x86_64/27/server --tree=dir=tree
+relooserev=$(${CMD_PREFIX} ostree --repo=repo rev-parse exampleos/x86_64/27/server)
+assert_not_streq "${relooserev}" "${packedrev}"
+# Deleting a packed ref must not let it resurrect
+${CMD_PREFIX} ostree --repo=repo refs --delete exampleos/x86_64/26/server
+${CMD_PREFIX} ostree --repo=repo refs > refs.txt
+assert_not_file_has_content refs.txt '^exampleos/x86_64/26/server$'
+if ${CMD_PREFIX} ostree --repo=repo rev-parse exampleos/x86_64/26/server 2>/dev/null; then
+    assert_not_reached "deleted packed ref still resolves"
+fi
+# Packing again folds in the newer loose refs
+${CMD_PREFIX} ostree --repo=repo refs --pack
+repackedrev=$(${CMD_PREFIX} ostree --repo=repo rev-parse exampleos/x86_64/27/server)
+assert_streq "${repackedrev}" "${relooserev}"
+
+echo "ok ref pack"
+
+# In a packed repo, a multi-ref transaction is batched straight into the
+# packed file rather than writing one loose file per ref
+mkdir batchsrc
+ostree_repo_init batchsrc
+for v in 1 2 3; do
+    ${CMD_PREFIX} ostree --repo=batchsrc commit -b batch/ref${v} --tree=dir=tree
+done
+${CMD_PREFIX} ostree --repo=repo pull-local batchsrc batch/ref1 batch/ref2 batch/ref3
+for v in 1 2 3; do
+    srcrev=$(${CMD_PREFIX} ostree --repo=batchsrc rev-parse batch/ref${v})
+    dstrev=$(${CMD_PREFIX} ostree --repo=repo rev-parse batch/ref${v})
+    assert_streq "${srcrev}" "${dstrev}"
+    assert_not_has_file repo/refs/heads/batch/ref${v}
+done
+
+echo "ok batched packed ref update"
@@ -482,6 +482,111 @@ test_repo_finder_mount_mixed_mounts (Fixture       *fixture,
   g_main_context_pop_thread_default (context);
 }
 
+/* Test that a .ostree/repos.index file at the root of a volume is used to
+ * resolve refs without opening the repositories on the volume, and that
+ * invalid index entries are ignored. */
+static void
+test_repo_finder_mount_index (Fixture       *fixture,
+                              gconstpointer  test_data)
+{
+  g_autoptr(OstreeRepoFinderMount) finder = NULL;
+  g_autoptr(GVolumeMonitor) monitor = NULL;
+  g_autoptr(GMainContext) context = NULL;
+  g_autoptr(GAsyncResult) result = NULL;
+  g_autoptr(GPtrArray) results = NULL;  /* (element-type OstreeRepoFinderResult) */
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GList) mounts = NULL;  /* (element-type OstreeMockMount)  */
+  g_autoptr(GMount) index_mount = NULL;
+  glnx_fd_close int index_repos = -1;
+  g_autoptr(OstreeRepo) index_repo_a = NULL;
+  g_autofree gchar *index_repo_a_uri = NULL;
+  g_autofree gchar *ref0_checksum = NULL;
+  const gchar *ref1_fake_checksum = "df1bf34f32e9ad37cd3f90b5ea2a2e2e0655709ffe4d52b563e2b6d0966c6ec9";
+  const gchar *repo_a_relative_path = ".ostree/repos/org.example.Collection1/exampleos/x86_64/ref0";
+  const OstreeCollectionRef ref0 = { "org.example.Collection1", "exampleos/x86_64/ref0" };
+  const OstreeCollectionRef ref1 = { "org.example.Collection1", "exampleos/x86_64/ref1" };
+  const OstreeCollectionRef ref2 = { "org.example.Collection1", "exampleos/x86_64/ref2" };
+  const OstreeCollectionRef ref3 = { "org.example.Collection1", "exampleos/x86_64/ref3" };
+  const OstreeCollectionRef * const refs[] = { &ref0, &ref1, &ref2, &ref3, NULL };
+
+  context = g_main_context_new ();
+  g_main_context_push_thread_default (context);
+
+  assert_create_repos_dir (fixture, "index-mount", &index_repos, &index_mount);
+  index_repo_a = assert_create_repo_dir (fixture, index_repos, index_mount, refs[0], &index_repo_a_uri,
+                                         refs[0], &ref0_checksum,
+                                         NULL);
+
+  /* Write the index. @ref1 maps to the same repository with a fabricated
+   * checksum — the index is authoritative, so the repository should not be
+   * opened to check it. @ref2 has an invalid checksum and @ref3 points to a
+   * nonexistent directory, so both should be ignored. */
+  {
+    GVariantBuilder builder;
+    g_autoptr(GVariant) index = NULL;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{s(ss)}"));
+    g_variant_builder_add (&builder, "{s(ss)}",
+                           "org.example.Collection1/exampleos/x86_64/ref0",
+                           repo_a_relative_path, ref0_checksum);
+    g_variant_builder_add (&builder, "{s(ss)}",
+                           "org.example.Collection1/exampleos/x86_64/ref1",
+                           repo_a_relative_path, ref1_fake_checksum);
+    g_variant_builder_add (&builder, "{s(ss)}",
+                           "org.example.Collection1/exampleos/x86_64/ref2",
+                           repo_a_relative_path, "not-a-checksum");
+    g_variant_builder_add (&builder, "{s(ss)}",
+                           "org.example.Collection1/exampleos/x86_64/ref3",
+                           ".ostree/repos/org.example.Collection1/exampleos/x86_64/nonexistent",
+                           ref1_fake_checksum);
+    index = g_variant_ref_sink (g_variant_builder_end (&builder));
+
+    glnx_file_replace_contents_at (fixture->working_dfd,
+                                   "index-mount/.ostree/repos.index",
+                                   g_variant_get_data (index),
+                                   g_variant_get_size (index),
+                                   GLNX_FILE_REPLACE_NODATASYNC, NULL, &error);
+    g_assert_no_error (error);
+  }
+
+  mounts = g_list_prepend (mounts, index_mount);
+
+  monitor = ostree_mock_volume_monitor_new (mounts, NULL);
+  finder = ostree_repo_finder_mount_new (monitor);
+
+  assert_create_remote_config (fixture->parent_repo, "remote1", "https://nope1", "org.example.Collection1");
+
+  /* Resolve the refs. */
+  ostree_repo_finder_resolve_async (OSTREE_REPO_FINDER (finder), refs,
+                                    fixture->parent_repo,
+                                    NULL, result_cb, &result);
+
+  while (result == NULL)
+    g_main_context_iteration (context, TRUE);
+
+  results = ostree_repo_finder_resolve_finish (OSTREE_REPO_FINDER (finder),
+                                               result, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (results);
+  g_assert_cmpuint (results->len, ==, 1);
+
+  {
+    g_autofree gchar *uri = NULL;
+    const OstreeRepoFinderResult *finder_result = g_ptr_array_index (results, 0);
+
+    uri = g_key_file_get_string (finder_result->remote->options, finder_result->remote->group, "url", &error);
+    g_assert_no_error (error);
+    g_assert_cmpstr (uri, ==, index_repo_a_uri);
+    g_assert_cmpstr (finder_result->remote->keyring, ==, "remote1.trustedkeys.gpg");
+
+    g_assert_cmpuint (g_hash_table_size (finder_result->ref_to_checksum), ==, 2);
+    g_assert_cmpstr (g_hash_table_lookup (finder_result->ref_to_checksum, refs[0]), ==, ref0_checksum);
+    g_assert_cmpstr (g_hash_table_lookup (finder_result->ref_to_checksum, refs[1]), ==, ref1_fake_checksum);
+  }
+
+  g_main_context_pop_thread_default (context);
+}
+
 int main (int argc, char **argv)
 {
   setlocale (LC_ALL, "");
@@ -492,6 +597,8 @@ int main (int argc, char **argv)
               test_repo_finder_mount_no_mounts, teardown);
   g_test_add ("/repo-finder-mount/mixed-mounts", Fixture, NULL, setup,
               test_repo_finder_mount_mixed_mounts, teardown);
+  g_test_add ("/repo-finder-mount/index", Fixture, NULL, setup,
+              test_repo_finder_mount_index, teardown);
 
   return g_test_run();
 }
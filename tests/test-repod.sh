@@ -0,0 +1,84 @@
+#!/bin/bash
+#
+# Copyright (C) 2017 Colin Walters <walters@verbum.org>
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 02111-1307, USA.
+
+set -euo pipefail
+
+. $(dirname $0)/libtest.sh
+
+echo '1..6'
+
+setup_test_repository "archive-z2"
+
+cd ${test_tmpdir}
+
+# Baseline output without any daemon
+$OSTREE rev-parse test2 > rev-local.txt
+$OSTREE cat test2 /baz/cow > cow-local.txt
+assert_file_has_content cow-local.txt moo
+
+${CMD_PREFIX} ostree --repo=repo repod &
+repod_pid=$!
+cleanup_repod() {
+    kill ${repod_pid} 2>/dev/null || true
+}
+trap cleanup_repod EXIT
+
+for i in $(seq 50); do
+    if [ -S repo/tmp/repod.socket ]; then
+        break
+    fi
+    sleep 0.1
+done
+assert_has_file repo/tmp/repod.socket
+echo "ok repod creates socket"
+
+$OSTREE rev-parse test2 > rev-daemon.txt
+cmp rev-local.txt rev-daemon.txt
+echo "ok rev-parse via repod"
+
+$OSTREE cat test2 /baz/cow > cow-daemon.txt
+cmp cow-local.txt cow-daemon.txt
+$OSTREE cat test2 /firstfile /baz/deeper/ohyeah > multi-daemon.txt
+$OSTREE cat test2 /nosuchfile 2>err.txt && assert_not_reached "cat of missing path unexpectedly succeeded"
+echo "ok cat via repod"
+
+if which socat 2>/dev/null >/dev/null; then
+    rev=$(cat rev-local.txt)
+    printf 'has-object commit %s\n' "${rev}" | socat - UNIX-CONNECT:repo/tmp/repod.socket > hasobj.txt
+    assert_file_has_content hasobj.txt "^ok"
+    assert_file_has_content hasobj.txt "^true"
+    printf 'ls test2 /baz\n' | socat - UNIX-CONNECT:repo/tmp/repod.socket > ls.txt
+    assert_file_has_content ls.txt "/baz/cow"
+    echo "ok raw protocol"
+else
+    echo "ok # SKIP no socat"
+fi
+
+kill ${repod_pid}
+wait ${repod_pid} 2>/dev/null || true
+trap - EXIT
+if test -S repo/tmp/repod.socket; then
+    assert_not_reached "socket not removed on exit"
+fi
+echo "ok socket removed on exit"
+
+# With the daemon gone, commands fall back to local operation
+$OSTREE rev-parse test2 > rev-fallback.txt
+cmp rev-local.txt rev-fallback.txt
+echo "ok local fallback"
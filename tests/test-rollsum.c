@@ -162,10 +162,78 @@ test_bupsplit_sum(void)
     g_assert_cmpint (sum3a, ==, sum3b);
 }
 
+#define TEST_ROLLSUM_CHAR_OFFSET 31
+
+/* The original byte-at-a-time window-buffer implementation, kept as a
+ * reference to pin down the behavior of the optimized
+ * bupsplit_find_ofs(). */
+static int
+ref_bupsplit_find_ofs (const unsigned char *buf, int len, int *bits)
+{
+  unsigned s1 = BUP_WINDOWSIZE * TEST_ROLLSUM_CHAR_OFFSET;
+  unsigned s2 = BUP_WINDOWSIZE * (BUP_WINDOWSIZE-1) * TEST_ROLLSUM_CHAR_OFFSET;
+  uint8_t window[BUP_WINDOWSIZE] = { 0, };
+  int wofs = 0;
+  int count;
+
+  for (count = 0; count < len; count++)
+    {
+      uint8_t drop = window[wofs];
+
+      s1 += buf[count] - drop;
+      s2 += s1 - (BUP_WINDOWSIZE * (drop + TEST_ROLLSUM_CHAR_OFFSET));
+      window[wofs] = buf[count];
+      wofs = (wofs + 1) % BUP_WINDOWSIZE;
+
+      if ((s2 & (BUP_BLOBSIZE-1)) == ((~0) & (BUP_BLOBSIZE-1)))
+        {
+          if (bits)
+            {
+              unsigned rsum = (s1 << 16) | (s2 & 0xffff);
+              rsum >>= BUP_BLOBBITS;
+              for (*bits = BUP_BLOBBITS; (rsum >>= 1) & 1; (*bits)++)
+                ;
+            }
+          return count + 1;
+        }
+    }
+  return 0;
+}
+
+static void
+test_bupsplit_find_ofs (void)
+{
+  g_autofree uint8_t *buf = g_malloc (BUP_SELFTEST_SIZE);
+  unsigned count;
+
+  for (count = 0; count < BUP_SELFTEST_SIZE; count++)
+    buf[count] = g_random_int_range (0, 256);
+
+  /* Walk both implementations over every split point of the buffer,
+   * including short (sub-window) tails. */
+  const uint8_t *p = buf;
+  int remaining = BUP_SELFTEST_SIZE;
+  while (remaining > 0)
+    {
+      int bits = 0, ref_bits = 0;
+      int ofs = bupsplit_find_ofs (p, remaining, &bits);
+      int ref_ofs = ref_bupsplit_find_ofs (p, remaining, &ref_bits);
+
+      g_assert_cmpint (ofs, ==, ref_ofs);
+      g_assert_cmpint (bits, ==, ref_bits);
+
+      if (ofs == 0)
+        break;
+      p += ofs;
+      remaining -= ofs;
+    }
+}
+
 int main (int argc, char **argv)
 {
   g_test_init (&argc, &argv, NULL);
   g_test_add_func ("/rollsum", test_rollsum);
   g_test_add_func ("/bupsum", test_bupsplit_sum);
+  g_test_add_func ("/bupsplit-find-ofs", test_bupsplit_find_ofs);
   return g_test_run();
 }
@@ -0,0 +1,84 @@
+#!/bin/bash
+#
+# Copyright (C) 2017 Colin Walters <walters@verbum.org>
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 02111-1307, USA.
+
+set -euo pipefail
+
+. $(dirname $0)/libtest.sh
+
+echo "1..4"
+
+setup_fake_remote_repo1 "archive-z2"
+
+repo=${test_tmpdir}/ostree-srv/gnomerepo
+
+# Populate refs for two "architectures" plus one unsharded ref
+mkdir ${test_tmpdir}/ostree-srv/shard-files
+cd ${test_tmpdir}/ostree-srv/shard-files
+for arch in x86_64 aarch64; do
+    echo "content for ${arch}" > hello-${arch}
+    ${CMD_PREFIX} ostree --repo=${repo} commit -b exampleos/${arch}/standard -s "A commit" -m "Commit body"
+done
+
+${CMD_PREFIX} ostree --repo=${repo} config set core.summary-shard-prefixes "exampleos/x86_64;exampleos/aarch64"
+${CMD_PREFIX} ostree --repo=${repo} summary -u
+
+assert_has_file ${repo}/summary.shard.exampleos_x86_64
+assert_has_file ${repo}/summary.shard.exampleos_aarch64
+
+# The root summary keeps the unsharded ref but not the sharded ones
+${CMD_PREFIX} ostree --repo=${repo} summary --view > ${test_tmpdir}/summary-view
+assert_file_has_content ${test_tmpdir}/summary-view "main"
+assert_not_file_has_content ${test_tmpdir}/summary-view "exampleos/x86_64/standard"
+assert_not_file_has_content ${test_tmpdir}/summary-view "exampleos/aarch64/standard"
+assert_file_has_content ${test_tmpdir}/summary-view "ostree.summary.shards"
+
+echo "ok 1 generate sharded summary"
+
+# Pulling a sharded ref fetches its shard and resolves through it
+cd ${test_tmpdir}
+ostree_repo_init repo --mode=archive-z2
+${CMD_PREFIX} ostree --repo=repo remote add --set=gpg-verify=false origin $(cat httpd-address)/ostree/gnomerepo
+${CMD_PREFIX} ostree --repo=repo pull origin exampleos/x86_64/standard
+${CMD_PREFIX} ostree --repo=repo rev-parse origin:exampleos/x86_64/standard
+${CMD_PREFIX} ostree --repo=repo fsck
+
+echo "ok 2 pull sharded ref"
+
+# A mirror pull picks up every shard's refs
+cd ${test_tmpdir}
+rm -rf mirror-repo
+ostree_repo_init mirror-repo --mode=archive-z2
+${CMD_PREFIX} ostree --repo=mirror-repo remote add --set=gpg-verify=false origin $(cat httpd-address)/ostree/gnomerepo
+${CMD_PREFIX} ostree --repo=mirror-repo pull --mirror origin
+${CMD_PREFIX} ostree --repo=mirror-repo rev-parse main
+${CMD_PREFIX} ostree --repo=mirror-repo rev-parse exampleos/x86_64/standard
+${CMD_PREFIX} ostree --repo=mirror-repo rev-parse exampleos/aarch64/standard
+
+echo "ok 3 mirror pull with shards"
+
+# Disabling sharding removes the shard files and folds the refs back in
+${CMD_PREFIX} ostree --repo=${repo} config set core.summary-shard-prefixes ""
+${CMD_PREFIX} ostree --repo=${repo} summary -u
+assert_not_has_file ${repo}/summary.shard.exampleos_x86_64
+assert_not_has_file ${repo}/summary.shard.exampleos_aarch64
+${CMD_PREFIX} ostree --repo=${repo} summary --view > ${test_tmpdir}/summary-view
+assert_file_has_content ${test_tmpdir}/summary-view "exampleos/x86_64/standard"
+assert_not_file_has_content ${test_tmpdir}/summary-view "ostree.summary.shards"
+
+echo "ok 4 disable sharding"
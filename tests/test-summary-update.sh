@@ -24,7 +24,7 @@ set -euo pipefail
 
 . $(dirname $0)/libtest.sh
 
-echo "1..2"
+echo "1..4"
 
 cd ${test_tmpdir}
 mkdir repo
@@ -56,9 +56,37 @@ assert_file_has_content summary "^map: {}$"
 
 echo "ok 1 update summary"
 
+# The summary update also writes the commit graph; parent resolution via
+# rev^ must give the same answer whether it's answered from the graph or
+# by loading the commit.
+assert_has_file repo/state/commit-graph
+${CMD_PREFIX} ostree --repo=repo commit --branch=test-1 -m test2 -s test2 tree
+parent=$(${CMD_PREFIX} ostree --repo=repo rev-parse test-1^)
+rm repo/state/commit-graph
+parent_nograph=$(${CMD_PREFIX} ostree --repo=repo rev-parse test-1^)
+assert_streq "${parent}" "${parent_nograph}"
+${CMD_PREFIX} ostree --repo=repo summary --update
+assert_has_file repo/state/commit-graph
+parent_graph=$(${CMD_PREFIX} ostree --repo=repo rev-parse test-1^)
+assert_streq "${parent}" "${parent_graph}"
+
+echo "ok 2 commit graph"
+
+# Commits also merge into the graph incrementally at transaction commit
+# time, with no summary update in between.
+rm repo/state/commit-graph
+${CMD_PREFIX} ostree --repo=repo commit --branch=test-1 -m test3 -s test3 tree
+assert_has_file repo/state/commit-graph
+parent_incr=$(${CMD_PREFIX} ostree --repo=repo rev-parse test-1^)
+rm repo/state/commit-graph
+parent_incr_nograph=$(${CMD_PREFIX} ostree --repo=repo rev-parse test-1^)
+assert_streq "${parent_incr}" "${parent_incr_nograph}"
+
+echo "ok 3 incremental commit graph"
+
 # Test again, but with collections enabled in the repository (if supported).
 if ! ostree --version | grep -q -e '- experimental'; then
-    echo "ok 2 # skip No experimental API is compiled in"
+    echo "ok 4 # skip No experimental API is compiled in"
     exit 0
 fi
 
@@ -91,4 +119,4 @@ ${CMD_PREFIX} ostree --repo=repo summary --update --add-metadata=map='@a{sv} {}'
 ${CMD_PREFIX} ostree --repo=repo summary --view > summary
 assert_file_has_content summary "^map: {}$"
 
-echo "ok 2 update summary with collections"
+echo "ok 4 update summary with collections"